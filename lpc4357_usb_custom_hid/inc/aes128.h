@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef AES128_H_
+#define AES128_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * AES-128 block encryption in software (FIPS-197), byte oriented with
+ * no large tables so it fits anywhere and runs the same on a PC. Only
+ * the forward cipher is here, CTR mode never decrypts blocks.
+ */
+
+#define AES128_KEY_SIZE			16
+#define AES128_BLOCK_SIZE		16
+#define AES128_ROUNDS			10
+
+typedef struct {
+	uint8_t round_key[(AES128_ROUNDS + 1) * AES128_BLOCK_SIZE];
+} aes128_key_t;
+
+void aes128_set_key(aes128_key_t *key, const uint8_t *bytes);
+
+/**
+ * Encrypt one block, in and out may be the same buffer.
+ */
+void aes128_encrypt(const aes128_key_t *key, const uint8_t *in, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AES128_H_ */
@@ -52,6 +52,15 @@ extern "C"
 #undef USE_USB0
 #define USE_USB1
 
+/* Second function next to HID, either mass storage or CDC-ACM serial port.
+   USB1 has endpoints 1..3 only, HID takes EP1 and both do not fit in the rest. */
+#define USE_MSC
+#undef USE_CDC
+
+#if defined(USE_MSC) && defined(USE_CDC)
+#error "Select either MSC or CDC"
+#endif
+
 
 /* Manifest constants used by USBD ROM stack. These values SHOULD NOT BE CHANGED
    for advance features which require usage of USB_CORE_CTRL_T structure.
@@ -84,19 +93,34 @@ extern "C"
 #define HID_EP_IN       0x81
 #define HID_EP_OUT      0x01
 
+/* MSC Bulk In/Out Endpoint Address */
+#define MSC_EP_IN       0x82
+#define MSC_EP_OUT      0x02
+
+/* CDC Interrupt In and Bulk In/Out Endpoint Address */
+#define CDC_EP_INT      0x82
+#define CDC_EP_IN       0x83
+#define CDC_EP_OUT      0x03
+
 /* On LPC18xx/43xx the USB controller requires endpoint queue heads to start on
    a 4KB aligned memory. Hence the mem_base value passed to USB stack init should
    be 4KB aligned. The following manifest constants are used to define this memory.
  */
 #define USB_STACK_MEM_BASE      0x20000000
-#define USB_STACK_MEM_SIZE      0x00002000
+#define USB_STACK_MEM_SIZE      0x00004000
+
+/* Serial number string descriptor, hex digits of the 128 bit unique ID */
+#define USB_SERIAL_NUMBER_INDEX		0x03
+#define USB_SERIAL_NUMBER_CHARS		32
 
 /* USB descriptor arrays defined *_desc.c file */
 extern const uint8_t USB_DeviceDescriptor[];
 extern uint8_t USB_HsConfigDescriptor[];
 extern uint8_t USB_FsConfigDescriptor[];
-extern const uint8_t USB_StringDescriptor[];
+extern uint8_t USB_StringDescriptor[];
 extern const uint8_t USB_DeviceQualifier[];
+extern const uint8_t USB_DfuDeviceDescriptor[];
+extern uint8_t USB_DfuConfigDescriptor[];
 
 /**
  * @brief	Find the address of interface descriptor for given class type.
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef AUDIO_PACKETIZER_H_
+#define AUDIO_PACKETIZER_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Sample FIFO between I2S DMA buffers and HID audio reports. FIFO holds
+ * raw I2S words, one 32 bit word per frame with left channel in the low
+ * half word. Packets carry 16 bit samples, mono packets only left channel.
+ * Nothing here touches hardware so it can be compiled and exercised on a PC.
+ *
+ * Packet: seq u16, frames u8, flags u8, then frames x channels x 16 bit samples.
+ */
+
+#define AUDIO_PACKET_HEADER_SIZE	4
+#define AUDIO_FLAG_DISCONTINUITY	(1 << 0)	/* Frames were dropped or inserted before this packet */
+
+typedef struct {
+	uint32_t overruns;		/* Frames dropped because FIFO was full */
+	uint32_t underruns;		/* Frames replaced by silence because FIFO was empty */
+	uint32_t slips;			/* Frames dropped to follow a faster I2S clock */
+	uint32_t packets;
+	uint32_t lost_packets;	/* Gaps in received packet sequence numbers */
+} audio_stats_t;
+
+typedef struct {
+	uint32_t *frames;
+	uint32_t size;			/* Power of 2 */
+	volatile uint32_t head;	/* Written by producer only */
+	volatile uint32_t tail;	/* Written by consumer only */
+	uint8_t channels;
+	uint16_t seq;
+	bool expect_seq;
+	bool discontinuity;
+	volatile bool overrun;	/* Set by producer, cleared by consumer once FIFO drained up to the gap */
+	audio_stats_t stats;
+} audio_fifo_t;
+
+void audio_fifo_init(audio_fifo_t *fifo, uint32_t *frames, uint32_t size, uint8_t channels);
+uint32_t audio_fifo_level(const audio_fifo_t *fifo);
+
+/**
+ * Producer side. Frames which do not fit are dropped and counted, and so is
+ * everything after them until consumer has drained FIFO. That keeps a single
+ * gap at FIFO head which the next packet built after it can be flagged for.
+ */
+uint32_t audio_fifo_write(audio_fifo_t *fifo, const uint32_t *frames, uint32_t count);
+
+/**
+ * Consumer side. Missing frames are filled with silence and counted.
+ */
+void audio_fifo_read(audio_fifo_t *fifo, uint32_t *frames, uint32_t count);
+
+/**
+ * Drop one frame when FIFO level is above high_level, used on capture side
+ * when I2S clock runs faster than host drains packets.
+ */
+bool audio_fifo_slip(audio_fifo_t *fifo, uint32_t high_level);
+
+/**
+ * @return	Frames that fit in a packet of max_len bytes.
+ */
+uint32_t audio_packet_capacity(uint8_t channels, uint32_t max_len);
+
+/**
+ * Build one packet from at least min_frames frames.
+ * @return	Packet length, 0 if fewer than min_frames are queued.
+ */
+uint32_t audio_packetize(audio_fifo_t *fifo, uint8_t *packet, uint32_t max_len, uint32_t min_frames);
+
+/**
+ * Unpack a received packet into FIFO.
+ * @return	Frames written, 0 on malformed packet.
+ */
+uint32_t audio_depacketize(audio_fifo_t *fifo, const uint8_t *packet, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_PACKETIZER_H_ */
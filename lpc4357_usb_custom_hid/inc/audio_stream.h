@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef AUDIO_STREAM_H_
+#define AUDIO_STREAM_H_
+
+#include "board.h"
+#include "audio_packetizer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * I2S0 audio streaming. I2S0 runs as master, 16 bit stereo, receiver shares
+ * transmitter clocks (4 pin mode). Each direction has a GPDMA channel cycling
+ * through two linked list items, interrupt of each finished half moves frames
+ * between DMA buffer and a frame FIFO.
+ *
+ * Capture frames go to host in HID_REPORT_ID_AUDIO input reports, playback
+ * frames come from output reports. Both use audio_packetizer packet format.
+ * Capture follows a faster I2S clock by dropping frames, playback publishes
+ * frames per millisecond feedback which host uses to pace output reports.
+ * Rates are measured against USB frame counter, i.e. host clock.
+ *
+ * One 64 byte report per millisecond limits format to what fits
+ * AUDIO_STREAM_PACKET_SIZE with headroom, up to 12 kHz stereo or 27 kHz mono.
+ */
+
+#define AUDIO_STREAM_CAPTURE		(1 << 0)
+#define AUDIO_STREAM_PLAYBACK		(1 << 1)
+
+#define AUDIO_STREAM_PACKET_SIZE	(HID_REPORT_MAX_SIZE - 1)
+
+typedef struct {
+	uint8_t directions;				/* AUDIO_STREAM_CAPTURE | AUDIO_STREAM_PLAYBACK */
+	uint8_t channels;
+	uint32_t rate;
+	uint32_t capture_level;
+	uint32_t playback_level;
+	uint32_t feedback;				/* Playback frames per ms, Q16.16 */
+	int32_t capture_ppm;
+	int32_t playback_ppm;
+	audio_stats_t capture;
+	audio_stats_t playback;
+} audio_stream_status_t;
+
+/* Feature report read: directions u8, channels u8, rate u32, levels u16 x2,
+ * feedback u32, ppm i32 x2, capture and playback audio_stats_t, little endian */
+#define AUDIO_STREAM_STATUS_SIZE	(22 + (2 * sizeof(audio_stats_t)))
+
+void audio_stream_init(void);
+
+/**
+ * Start streaming, allocates a DMA channel per direction. Starting a running
+ * stream restarts it with new format.
+ * @return	false if format does not fit report bandwidth or no DMA channel is free.
+ */
+bool audio_stream_start(uint8_t directions, uint32_t rate, uint8_t channels);
+void audio_stream_stop(void);
+
+/**
+ * Queue output report payload for playback. Called from USB interrupt.
+ */
+void audio_stream_write(const uint8_t *payload, uint32_t length);
+
+void audio_stream_get_status(audio_stream_status_t *status);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [directions][channels][rate u32], directions 0 stops.
+ */
+bool audio_stream_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t audio_stream_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUDIO_STREAM_H_ */
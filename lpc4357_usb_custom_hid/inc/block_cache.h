@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef BLOCK_CACHE_H_
+#define BLOCK_CACHE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Write-back cache in front of media which is erased and programmed in
+ * lines much larger than a disk block, like SPI flash sectors. A line
+ * holds one erase unit, blocks are filled lazily and tracked with a valid
+ * bitmap, so a line fully overwritten by the host is programmed without
+ * ever being read. Dirty lines are written back after they were left
+ * alone for a while, or when evicted if the writer allows it.
+ *
+ * Memory mapped media is read in place. Unmapped media gets read-ahead,
+ * a read miss loads up to the end of its line into a clean line.
+ *
+ * Callers serialize access, nothing here touches hardware so a file
+ * backed media works on a PC. The one exception is a line being
+ * programmed by block_cache_flush_line(), writers may run meanwhile.
+ */
+
+#define BLOCK_CACHE_BLOCK_SIZE		512
+#define BLOCK_CACHE_MAX_LINE_BLOCKS	128		/* 64 KB lines */
+#define BLOCK_CACHE_MAX_LINES		4
+#define BLOCK_CACHE_NO_LINE			0xFFFFFFFF
+
+typedef struct {
+	/* Media contents at offset, NULL if media is not memory mapped */
+	const uint8_t *(*map)(void *ctx, uint32_t offset);
+	bool (*read)(void *ctx, uint32_t offset, uint8_t *data, uint32_t length);
+	/* Erase line at offset and program it with line_size bytes */
+	bool (*write_line)(void *ctx, uint32_t offset, const uint8_t *data);
+	void *ctx;
+	uint32_t size;
+	uint32_t line_size;		/* Power of two multiple of block size */
+} block_media_t;
+
+typedef struct {
+	uint8_t *data;
+	uint32_t offset;		/* Media offset of line, BLOCK_CACHE_NO_LINE if unused */
+	uint32_t valid[BLOCK_CACHE_MAX_LINE_BLOCKS / 32];
+	bool dirty;
+	bool flushing;			/* Being programmed, never evicted */
+	uint32_t last_use;		/* LRU clock */
+	uint32_t last_write;	/* Caller time of last write, for idle write back */
+} block_cache_line_t;
+
+typedef struct {
+	uint32_t read_hits;		/* Reads served from a line */
+	uint32_t read_direct;	/* Reads served from mapped media */
+	uint32_t read_misses;	/* Reads which had to read media */
+	uint32_t write_hits;	/* Writes into a line already cached */
+	uint32_t write_allocs;	/* Writes which allocated a line */
+	uint32_t fills;			/* Blocks read from media into lines */
+	uint32_t write_backs;	/* Lines programmed */
+	uint32_t errors;
+} block_cache_stats_t;
+
+typedef struct {
+	const block_media_t *media;
+	block_cache_line_t lines[BLOCK_CACHE_MAX_LINES];
+	uint32_t num_lines;
+	uint32_t clock;
+	block_cache_stats_t stats;
+} block_cache_t;
+
+/**
+ * @param	line_memory	: num_lines * media->line_size bytes, word aligned.
+ * @return	false if media geometry is not supported.
+ */
+bool block_cache_init(block_cache_t *cache, const block_media_t *media, uint8_t *line_memory,
+		uint32_t num_lines);
+
+/**
+ * Read length bytes at offset.
+ * @param	buffer	: Used when data is not available in one piece, at least length bytes.
+ * @return	Pointer to the data, buffer or a line or mapped media. NULL on error.
+ */
+const uint8_t *block_cache_read(block_cache_t *cache, uint32_t offset, uint32_t length, uint8_t *buffer);
+
+/**
+ * Zero-copy write, reserve the line area data for offset will land in.
+ * Partially covered blocks are filled first.
+ * @param	evict_dirty	: Allow writing back a line to make room, false from
+ *			contexts which can not wait for the media.
+ * @return	Pointer to fill then pass to block_cache_write(), NULL if range
+ *			spans lines or can not be cached.
+ */
+uint8_t *block_cache_write_buffer(block_cache_t *cache, uint32_t offset, uint32_t length,
+		bool evict_dirty);
+
+/**
+ * Write length bytes at offset. Data already in place after
+ * block_cache_write_buffer() is not copied.
+ * @param	now	: Caller time base, compared by block_cache_flush().
+ * @param	evict_dirty	: As for block_cache_write_buffer().
+ * @return	false on error or if no line was free without eviction.
+ */
+bool block_cache_write(block_cache_t *cache, uint32_t offset, const uint8_t *data, uint32_t length,
+		uint32_t now, bool evict_dirty);
+
+/**
+ * Write back the least recently written dirty line left alone for at
+ * least idle time units, idle 0 picks any dirty line.
+ * @return	true if a line was written back.
+ */
+bool block_cache_flush(block_cache_t *cache, uint32_t now, uint32_t idle);
+
+/**
+ * block_cache_flush() in two steps for writers running from an interrupt.
+ * Begin picks the line and fills its missing blocks, writers held off.
+ * Programming it runs with writers allowed, a line written meanwhile
+ * stays dirty.
+ * @return	Line to pass to block_cache_flush_line(), NULL if none is due.
+ */
+block_cache_line_t *block_cache_flush_begin(block_cache_t *cache, uint32_t now, uint32_t idle);
+
+/**
+ * @return	false if media failed, line is dropped then.
+ */
+bool block_cache_flush_line(block_cache_t *cache, block_cache_line_t *line);
+
+/**
+ * Write back all dirty lines.
+ */
+bool block_cache_sync(block_cache_t *cache);
+
+/**
+ * @return	true if any line is dirty.
+ */
+bool block_cache_dirty(const block_cache_t *cache);
+
+/**
+ * Forget all lines, dirty data is lost.
+ */
+void block_cache_invalidate(block_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLOCK_CACHE_H_ */
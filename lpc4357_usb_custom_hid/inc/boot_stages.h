@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef BOOT_STAGES_H_
+#define BOOT_STAGES_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Board parts brought up after USB connected, see init_stages. SystemInit
+ * only sets up clocks, GPIO and USB1 pins. SDRAM, SPIFI and the Ethernet
+ * PHY come up from main loop unless someone needs them sooner. Ethernet
+ * auto negotiation is only started, nothing here waits for a link.
+ *
+ * Times are microseconds from the cycle counter started in SystemInit once
+ * the core clock runs at full rate. Cycle counter wraps after 21 seconds,
+ * so the clock moves over to timer_service once it runs and wraps after
+ * 71 minutes from then on.
+ */
+
+#define BOOT_STAGE_SDRAM		0
+#define BOOT_STAGE_SPIFI		1
+#define BOOT_STAGE_ETH_PHY		2
+#define BOOT_STAGES				3
+
+/* Feature report read: stages, 0, 0, 0, main entry time, USB connect time,
+ * then for each stage: state, on demand, 0, 0, start time, duration, little endian */
+#define BOOT_STATUS_SIZE		(12 + BOOT_STAGES * 12)
+
+/**
+ * Starts the boot clock, call from SystemInit right after the core clock
+ * setup. Touches no variables, .data and .bss are set up after it.
+ */
+void boot_stages_start_clock(void);
+
+/**
+ * Call first thing in main.
+ */
+void boot_stages_init(void);
+
+/**
+ * Call right after timer_service_init().
+ */
+void boot_stages_timer_started(void);
+
+/**
+ * Brings a stage up before its first use, call from thread context.
+ * @return	false if the part did not come up.
+ */
+bool boot_stage_require(uint32_t stage);
+
+void boot_stages_usb_connected(void);
+
+bool boot_stages_pending(void);
+
+/**
+ * Brings up the next background stage, one per call.
+ */
+void boot_stages_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ */
+uint16_t boot_stages_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_STAGES_H_ */
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CAN_CODEC_H_
+#define CAN_CODEC_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * CAN frame queues and their HID report encoding. CAN interrupt pushes
+ * received frames, USB IN path packs as many as fit into one report.
+ * Output reports are decoded into the transmit queue. Nothing here
+ * touches hardware so it can be compiled and exercised on a PC.
+ */
+
+#define CAN_ID_FLAG_EXT		(1UL << 31)		/* 29 bit identifier */
+#define CAN_ID_FLAG_RTR		(1UL << 30)		/* Remote frame, carries no data */
+#define CAN_ID_STD_MASK		0x000007FF
+#define CAN_ID_EXT_MASK		0x1FFFFFFF
+
+typedef struct {
+	uint32_t timestamp_us;
+	uint32_t id;			/* Identifier and CAN_ID_FLAG_* bits */
+	uint8_t dlc;
+	uint8_t data[8];
+} can_frame_t;
+
+/**
+ * Input report payload: count, lost, then count records of
+ * timestamp_us u32, id u32, dlc u8 and dlc data bytes (none for remote frames).
+ * Output report payload: count, then count records of id u32, dlc u8, data.
+ * All fields little endian.
+ */
+#define CAN_REPORT_HEADER_SIZE		2
+#define CAN_RX_RECORD_SIZE(dlc)		(9 + (dlc))
+#define CAN_TX_RECORD_SIZE(dlc)		(5 + (dlc))
+
+typedef struct {
+	uint32_t rx_frames;		/* Frames pushed by interrupt handler */
+	uint32_t rx_overflow;	/* Frames lost because RX queue was full */
+	uint32_t tx_frames;		/* Frames queued from output reports */
+	uint32_t tx_overflow;	/* Frames dropped because TX queue was full */
+	uint32_t tx_malformed;	/* Output reports with bad records */
+} can_codec_stats_t;
+
+void can_codec_init(void);
+
+/**
+ * Interrupt context, single producer.
+ */
+bool can_codec_push_rx(const can_frame_t *frame);
+bool can_codec_rx_pending(void);
+
+/**
+ * Moves as many frames as fit in max_len into payload.
+ * @return	Number of payload bytes written, 0 if nothing was pending.
+ */
+uint32_t can_codec_fill_report(uint8_t *payload, uint32_t max_len);
+
+/**
+ * Decode output report payload into the TX queue.
+ * @return	Number of frames queued.
+ */
+uint32_t can_codec_queue_tx(const uint8_t *payload, uint32_t length);
+bool can_codec_pop_tx(can_frame_t *frame);
+bool can_codec_tx_pending(void);
+
+const can_codec_stats_t *can_codec_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAN_CODEC_H_ */
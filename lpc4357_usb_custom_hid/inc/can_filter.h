@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CAN_FILTER_H_
+#define CAN_FILTER_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Host uploaded acceptance filters and their mapping onto C_CAN message
+ * objects. A frame matches when (frame id & mask) == (filter id & mask)
+ * and both are of the same type (CAN_ID_FLAG_EXT). When there are more
+ * filters than receive objects, filters are merged pairwise, always the
+ * pair whose merged mask keeps most bits, so hardware lets through as few
+ * unwanted frames as possible. Merged objects accept a superset, received
+ * frames are checked again against the exact list with can_filter_match().
+ * Nothing here touches hardware so it can be compiled and exercised on a PC.
+ */
+
+#define CAN_FILTER_MAX		64
+
+typedef struct {
+	uint32_t id;		/* Identifier and CAN_ID_FLAG_EXT */
+	uint32_t mask;		/* Identifier bits which must match */
+} can_filter_t;
+
+/**
+ * @return	Number of message object filters written to objects (<= max_objects),
+ *			0 if max_objects is less than 2.
+ */
+uint32_t can_filter_allocate(const can_filter_t *filters, uint32_t num,
+							 can_filter_t *objects, uint32_t max_objects);
+
+/**
+ * @return	true if frame id (with CAN_ID_FLAG_* bits) passes any filter,
+ *			or if num is zero.
+ */
+bool can_filter_match(const can_filter_t *filters, uint32_t num, uint32_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAN_FILTER_H_ */
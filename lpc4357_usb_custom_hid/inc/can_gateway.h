@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CAN_GATEWAY_H_
+#define CAN_GATEWAY_H_
+
+#include "board.h"
+#include "can_codec.h"
+#include "can_filter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * CAN sniffer and injector on C_CAN0 (P3_1 CAN0_RD, P3_2 CAN0_TD).
+ * Message objects 1..31 receive through host filters, object 32 transmits
+ * frames queued from output reports.
+ */
+
+#define CAN_GATEWAY_RX_OBJECTS		31
+#define CAN_GATEWAY_TX_OBJECT		32
+
+/* Feature report commands, first payload byte */
+#define CAN_CMD_START				0	/* [bitrate u32][mode] */
+#define CAN_CMD_STOP				1
+#define CAN_CMD_FILTER_CLEAR		2
+#define CAN_CMD_FILTER_ADD			3	/* [count u8][count x {id u32, mask u32}] */
+#define CAN_CMD_FILTER_APPLY		4
+
+#define CAN_MODE_SILENT				(1 << 0)	/* Listen only, no ACK and no transmit */
+#define CAN_MODE_LOOPBACK			(1 << 1)	/* Transmitted frames are received back */
+
+typedef struct {
+	uint32_t rx_filtered;	/* Frames let through by merged hardware filter but not by host filters */
+	uint32_t rx_hw_lost;	/* Frames overwritten in message objects */
+	uint32_t tx_done;		/* Frames transmitted */
+	uint32_t bus_errors;	/* Last error code changes */
+	uint32_t bus_off;
+} can_gateway_stats_t;
+
+/* Feature report read: [running][filters][objects][TEC][REC][STAT], can_codec_stats_t, can_gateway_stats_t, u32 little endian */
+#define CAN_GATEWAY_STATUS_SIZE		(6 + sizeof(can_codec_stats_t) + sizeof(can_gateway_stats_t))
+
+void can_gateway_init(uint32_t irq_priority);
+bool can_gateway_start(uint32_t bitrate, uint8_t mode);
+void can_gateway_stop(void);
+
+/**
+ * Filters are staged, can_gateway_apply_filters() programs message objects
+ * from main loop. No filters means all frames are received.
+ */
+void can_gateway_clear_filters(void);
+bool can_gateway_add_filter(uint32_t id, uint32_t mask);
+void can_gateway_apply_filters(void);
+
+/**
+ * Queue output report payload for transmission. Called from USB interrupt.
+ */
+void can_gateway_write(const uint8_t *payload, uint32_t length);
+
+bool can_gateway_pending(void);
+void can_gateway_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ */
+bool can_gateway_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t can_gateway_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAN_GATEWAY_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CDC_CHANNEL_H_
+#define CDC_CHANNEL_H_
+
+#include "app_usbd_cfg.h"
+#include "cdc_framing.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * CDC-ACM serial port carrying the HID report command set in cdc_framing
+ * frames, for hosts which can open /dev/ttyACM* but not the HID device.
+ * Output and feature reports go to the same handlers as on HID. While the
+ * host holds DTR, input reports are taken from the HID interrupt endpoint
+ * and sent here instead.
+ *
+ * Bulk OUT transfers land in two buffers, one is decoded while USB DMA
+ * fills the other. Frames to the host are packed into two buffers as
+ * well, one is collected while the other is sent. A transfer never ends
+ * on a full packet, a spare frame delimiter is appended instead of a ZLP.
+ */
+
+#define CDC_CHANNEL_BUF_SIZE		512
+
+/* Feature report read: CRC test length, slice-by-8 and bytewise CRC cycles
+ * for it, frames sent, cdc_frame_stats_t of frames received, little endian */
+#define CDC_CHANNEL_STATUS_SIZE		(16 + sizeof(cdc_frame_stats_t))
+
+/**
+ * @brief	CDC interface init routine, same contract as usb_hid_init().
+ *			Times the CRC on the transfer buffers, call before USB connect.
+ * @param	pDesc	: Configuration descriptor holding both CDC interfaces.
+ */
+ErrorCode_t cdc_channel_init(USBD_HANDLE_T hUsb,
+							 const uint8_t *pDesc,
+							 uint32_t *mem_base,
+							 uint32_t *mem_size);
+
+/**
+ * @brief	Forget transfers in flight, call on USB bus reset and configuration.
+ */
+void cdc_channel_reset(void);
+
+/**
+ * @brief	Move pending input reports and start transfers, call from thread
+ *			context like hid_in_kick().
+ */
+void cdc_channel_kick(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ */
+uint16_t cdc_channel_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CDC_CHANNEL_H_ */
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CDC_FRAMING_H_
+#define CDC_FRAMING_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Carries HID reports over a byte stream. A frame is
+ * [kind][seq u16][length][report][CRC-32C u32], little endian, COBS
+ * encoded and terminated by a zero byte, so a receiver joining mid-stream
+ * or after garbage resynchronizes at the next zero. Empty frames are
+ * ignored and serve as padding. Reports are at most CDC_FRAME_MAX_REPORT
+ * bytes which keeps every frame a single COBS block.
+ *
+ * CRC covers everything before it, see crc32c.h. Each direction numbers its
+ * frames, the decoder drops frames failing the CRC or length check and
+ * counts sequence gaps, i.e. frames lost anywhere between the two ends, and
+ * drops and counts frames repeating or going back in sequence. The first
+ * frame after init or resync is taken as is.
+ *
+ * Nothing here touches hardware, a pty pair works on a PC.
+ */
+
+#define CDC_FRAME_MAX_REPORT		64
+#define CDC_FRAME_HEADER_SIZE		4		/* Kind, seq, length */
+#define CDC_FRAME_CRC_SIZE			4
+#define CDC_FRAME_MAX_DECODED		(CDC_FRAME_HEADER_SIZE + CDC_FRAME_MAX_REPORT + CDC_FRAME_CRC_SIZE)
+#define CDC_FRAME_MAX_ENCODED		(CDC_FRAME_MAX_DECODED + 2)
+
+/* Host to device */
+#define CDC_FRAME_OUTPUT			0	/* Output report */
+#define CDC_FRAME_SET_FEATURE		1	/* Feature report to set */
+#define CDC_FRAME_GET_FEATURE		2	/* [report ID], answered with CDC_FRAME_FEATURE */
+/* Device to host */
+#define CDC_FRAME_INPUT				3	/* Input report */
+#define CDC_FRAME_FEATURE			4	/* Feature report read */
+#define CDC_FRAME_NAK				5	/* [report ID], feature request was refused */
+
+typedef void (*cdc_frame_handler_t)(void *ctx, uint8_t kind, const uint8_t *report, uint32_t length);
+
+typedef struct {
+	uint32_t frames;
+	uint32_t errors;		/* Truncated or oversized frames dropped */
+	uint32_t crc_errors;	/* Frames dropped for a CRC mismatch */
+	uint32_t gaps;			/* Frames missing in sequence */
+	uint32_t duplicates;	/* Repeated or older frames dropped */
+} cdc_frame_stats_t;
+
+typedef struct {
+	uint8_t data[CDC_FRAME_MAX_DECODED];
+	uint32_t length;
+	uint8_t code;			/* Current COBS block code */
+	uint8_t left;			/* Bytes left in current block */
+	bool overflow;
+	bool paused;
+	bool synced;			/* next_seq is valid */
+	uint16_t next_seq;
+	cdc_frame_stats_t stats;
+} cdc_frame_decoder_t;
+
+/**
+ * Encode one frame including its terminating zero.
+ * @param	seq	: Sender's frame number, one more for every frame.
+ * @param	out	: At least CDC_FRAME_MAX_ENCODED bytes.
+ * @return	Bytes written, 0 if report is too long.
+ */
+uint32_t cdc_frame_encode(uint8_t kind, uint16_t seq, const uint8_t *report, uint32_t length, uint8_t *out);
+
+void cdc_frame_decoder_init(cdc_frame_decoder_t *dec);
+
+/**
+ * Next frame starts the sequence over, for a new sender. Statistics stay.
+ */
+void cdc_frame_decoder_resync(cdc_frame_decoder_t *dec);
+
+/**
+ * Feed stream bytes, handler is called for every complete frame.
+ * Decoding stops after a frame when handler asks for it through
+ * cdc_frame_decoder_pause(), so a consumer can apply backpressure.
+ * @return	Bytes consumed.
+ */
+uint32_t cdc_frame_decode(cdc_frame_decoder_t *dec, const uint8_t *data, uint32_t length,
+		cdc_frame_handler_t handler, void *ctx);
+
+/**
+ * Called from handler, cdc_frame_decode() returns after current frame.
+ */
+void cdc_frame_decoder_pause(cdc_frame_decoder_t *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CDC_FRAMING_H_ */
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CONFIG_STORE_H_
+#define CONFIG_STORE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Key/value settings on a page programmed medium like the on-chip EEPROM.
+ * Values live in a RAM shadow of logical pages, a change only marks its
+ * page dirty. Dirty pages are programmed once they were left alone for a
+ * while, so a burst of changes costs one page write.
+ *
+ * Every logical page has two physical copies written alternately, each
+ * with a sequence number and CRC. The copy not in use is the one being
+ * programmed, a write cut short by power loss leaves the previous copy
+ * in charge. Records never span pages and sequence numbers count page
+ * writes of the whole store, a value which grew onto another page is
+ * written there first and the newer page wins if both hold it after a
+ * power loss. So a value is always either old or new, values on different
+ * pages are not updated atomically together.
+ *
+ * Page programming is started here and reported back through
+ * config_store_write_done(), typically from the end of program interrupt
+ * which then starts the next page. Callers serialize access, nothing here
+ * touches hardware so an emulated medium works on a PC.
+ */
+
+#define CONFIG_STORE_PAGE_SIZE		128
+#define CONFIG_STORE_MAX_PAGES		8		/* Logical pages, medium holds twice as many */
+#define CONFIG_STORE_HEADER_SIZE	8
+#define CONFIG_STORE_PAYLOAD_SIZE	(CONFIG_STORE_PAGE_SIZE - CONFIG_STORE_HEADER_SIZE)
+#define CONFIG_STORE_VALUE_MAX		(CONFIG_STORE_PAYLOAD_SIZE - 2)
+#define CONFIG_STORE_NO_PAGE		0xFFFFFFFF
+
+/* A page changed without pause is programmed anyway once its oldest
+ * change waited this many idle times */
+#define CONFIG_STORE_MAX_DELAY_IDLES	4
+
+/* Keys are 1..255, a record is [key][length][value] */
+#define CONFIG_STORE_KEY_END		0
+
+typedef struct {
+	bool (*read)(void *ctx, uint32_t page, uint8_t *data);
+	/* Start erasing and programming a page, data stays untouched until
+	 * config_store_write_done() */
+	void (*write)(void *ctx, uint32_t page, const uint8_t *data);
+	void *ctx;
+} config_media_t;
+
+typedef struct {
+	uint8_t data[CONFIG_STORE_PAYLOAD_SIZE];	/* Records, rest is zero */
+	uint32_t seq;			/* Store sequence number of the copy in use */
+	uint32_t first_change;	/* Caller time of the oldest unsaved change */
+	uint32_t last_change;	/* Caller time of the newest one, for idle flush */
+	uint8_t copy;			/* Physical copy in use, the other one is written next */
+	bool dirty;
+} config_page_t;
+
+typedef struct {
+	uint32_t sets;			/* Values changed */
+	uint32_t unchanged;		/* Sets with the value already stored */
+	uint32_t coalesced;		/* Changes to a page already waiting to be written */
+	uint32_t page_writes;	/* Pages programmed */
+	uint32_t errors;		/* Failed programs, page is written again later */
+	uint32_t latency_max;	/* Longest time from a change to its page programmed */
+} config_store_stats_t;
+
+typedef struct {
+	uint8_t image[CONFIG_STORE_PAGE_SIZE];	/* Page being programmed, word aligned */
+	const config_media_t *media;
+	config_page_t pages[CONFIG_STORE_MAX_PAGES];
+	uint32_t num_pages;
+	uint32_t seq;			/* Last sequence number handed out */
+	uint32_t writing;		/* Logical page in flight, CONFIG_STORE_NO_PAGE if none */
+	uint32_t writing_seq;
+	uint32_t writing_since;
+	config_store_stats_t stats;
+} config_store_t;
+
+/**
+ * Load the newest valid copy of every page, pages without one start empty.
+ * A key found on two pages is dropped from the older one.
+ * @param	num_pages	: Logical pages, medium pages 0 .. 2 * num_pages - 1 are used.
+ */
+void config_store_init(config_store_t *cs, const config_media_t *media, uint32_t num_pages);
+
+/**
+ * @return	Value length, 0 if key is not stored. At most max_length bytes are copied.
+ */
+uint32_t config_store_get(const config_store_t *cs, uint8_t key, uint8_t *value, uint32_t max_length);
+
+/**
+ * @param	now	: Caller time base, compared by config_store_flush().
+ * @return	false if value is too long or no page has room, old value is kept.
+ */
+bool config_store_set(config_store_t *cs, uint8_t key, const uint8_t *value, uint32_t length, uint32_t now);
+void config_store_delete(config_store_t *cs, uint8_t key, uint32_t now);
+
+/**
+ * Delete all keys.
+ */
+void config_store_clear(config_store_t *cs, uint32_t now);
+
+/**
+ * Start programming the dirty page changed least recently if nothing is
+ * in flight and the page was left alone for at least idle time units,
+ * or kept changing for CONFIG_STORE_MAX_DELAY_IDLES times that. Idle 0
+ * picks any dirty page.
+ * @return	true if a page write was started.
+ */
+bool config_store_flush(config_store_t *cs, uint32_t now, uint32_t idle);
+
+/**
+ * Page write started by config_store_flush() is over.
+ */
+void config_store_write_done(config_store_t *cs, bool ok, uint32_t now);
+
+bool config_store_dirty(const config_store_t *cs);
+bool config_store_busy(const config_store_t *cs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_STORE_H_ */
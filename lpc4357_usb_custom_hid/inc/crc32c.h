@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * CRC-32C (Castagnoli), reflected polynomial 0x82F63B78, initial value and
+ * final XOR 0xFFFFFFFF, the one SSE4.2 computes in hardware. crc32c() runs
+ * slice-by-8, eight bytes per step through eight 256 entry const tables in
+ * flash, 8 KB that on-chip RAM has no room for. crc32c_bytewise() uses the
+ * first table only, for comparison. No setup is needed before either.
+ *
+ * Nothing here touches hardware, host tools build it as is.
+ */
+
+#define CRC32C_CHECK			0xE3069283	/* CRC of "123456789" */
+
+/**
+ * @param	crc	: 0 to start, previous result to continue over more data.
+ */
+uint32_t crc32c(uint32_t crc, const uint8_t *data, uint32_t length);
+uint32_t crc32c_bytewise(uint32_t crc, const uint8_t *data, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CRC32C_H_ */
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CREDIT_FLOW_H_
+#define CREDIT_FLOW_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Credit based flow control of a byte stream. Receiver owns a buffer and
+ * grants credit as a limit: total bytes it will have accepted once the
+ * buffer is full, i.e. bytes consumed so far plus buffer size. Sender
+ * sends while its total sent is below the last limit it heard of and
+ * stops at zero credit instead of overrunning the buffer.
+ *
+ * Limits and totals are free running 32 bit counters compared modulo
+ * 2^32, so a limit can be repeated in any report of the other direction,
+ * a lost or stale one is harmless and a newer one supersedes it. Both
+ * ends start at zero when the stream is opened, sender has no credit
+ * until the first limit arrives.
+ *
+ * Receiver advertises a new limit once it grew by threshold since the
+ * last one sent, or by a quarter of that while sender has less than
+ * threshold left, so a stalled sender is not left waiting for a full
+ * threshold of consumption.
+ *
+ * No hardware here, tools/credit_flow.py is the host side of the same logic
+ * and tools/credit_sim.c runs it on a PC. Each field has one writer, a
+ * receiver consuming from another interrupt than it accepts from is fine.
+ */
+
+typedef struct {
+	uint32_t size;			/* Receive buffer size */
+	uint32_t threshold;		/* Limit growth worth an update of its own */
+	uint32_t accepted;		/* Total bytes put into buffer */
+	volatile uint32_t consumed;	/* Total bytes taken out of buffer */
+	uint32_t advertised;	/* Last limit handed to sender */
+	uint32_t overruns;		/* Bytes that did not fit, sender went beyond its credit */
+} credit_rx_t;
+
+typedef struct {
+	uint32_t sent;			/* Total bytes sent */
+	uint32_t limit;			/* Last limit heard from receiver */
+	uint32_t stalls;		/* Times sender had data but no credit */
+} credit_tx_t;
+
+void credit_rx_init(credit_rx_t *rx, uint32_t size, uint32_t threshold);
+
+/**
+ * Account for count bytes put into the buffer.
+ * @return	Bytes within credit, the rest did not fit and is counted as overrun.
+ */
+uint32_t credit_rx_accept(credit_rx_t *rx, uint32_t count);
+void credit_rx_consume(credit_rx_t *rx, uint32_t count);
+
+/**
+ * @return	true if a new limit is worth a report of its own.
+ */
+bool credit_rx_update_due(const credit_rx_t *rx);
+
+/**
+ * Current limit, remembered as advertised. Put it in every report going
+ * to the sender.
+ */
+uint32_t credit_rx_advertise(credit_rx_t *rx);
+
+void credit_tx_init(credit_tx_t *tx);
+
+/**
+ * Take a limit from receiver, older limits than the one held are ignored.
+ */
+void credit_tx_grant(credit_tx_t *tx, uint32_t limit);
+
+/**
+ * @return	Bytes sender may send now.
+ */
+uint32_t credit_tx_available(const credit_tx_t *tx);
+
+/**
+ * Account for count bytes sent, count must not exceed credit_tx_available().
+ * Sender with data left over after a short send calls credit_tx_stall().
+ */
+void credit_tx_sent(credit_tx_t *tx, uint32_t count);
+void credit_tx_stall(credit_tx_t *tx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CREDIT_FLOW_H_ */
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DFU_IMAGE_H_
+#define DFU_IMAGE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Writes a firmware image arriving in sequential DFU blocks to flash one
+ * erase sector at a time. Two sector buffers let the next sector fill
+ * while the previous one is erased and programmed, the expected time until
+ * a buffer frees up is handed back as host poll timeout.
+ *
+ * A sector which already holds the incoming data is neither erased nor
+ * programmed, so downloading the same image again after an interruption
+ * only spends flash time on the sectors which did not make it.
+ *
+ * Calls other than dfu_image_program() must be serialized by the caller,
+ * typically by running them with USB interrupt masked. Programming a
+ * claimed sector may overlap with blocks arriving for the other buffer.
+ * Nothing here touches hardware, a simulated flash works on a PC.
+ */
+
+#define DFU_IMAGE_SECTOR_MAX		(64 * 1024)
+
+#define DFU_IMAGE_OK				0
+#define DFU_IMAGE_ERR_ADDRESS		1	/* Block out of sequence or beyond media */
+#define DFU_IMAGE_ERR_BUSY			2	/* No free buffer yet, block may be sent again */
+#define DFU_IMAGE_ERR_PROG			3	/* Erase, program or verify failed */
+
+typedef struct {
+	/* Size of erase sector starting at offset */
+	uint32_t (*sector_size)(void *ctx, uint32_t offset);
+	/* Erase sector at offset and program it with length bytes */
+	bool (*program)(void *ctx, uint32_t offset, const uint8_t *data, uint32_t length);
+	void *ctx;
+	const uint8_t *map;			/* Current contents, NULL if not memory mapped */
+	uint32_t size;
+	/* Estimates for poll timeout */
+	uint32_t erase_ms;
+	uint32_t program_us_per_kb;
+} dfu_media_t;
+
+typedef struct {
+	uint8_t *data;
+	uint32_t offset;			/* Media offset of sector */
+	uint32_t length;			/* Sector size */
+	uint32_t filled;
+	uint8_t state;
+} dfu_image_buf_t;
+
+typedef struct {
+	uint32_t bytes;				/* Bytes received */
+	uint32_t programmed;		/* Sectors erased and programmed */
+	uint32_t skipped;			/* Sectors already holding the data */
+	uint32_t stalls;			/* Blocks refused for lack of a free buffer */
+	uint32_t errors;
+} dfu_image_stats_t;
+
+typedef struct {
+	const dfu_media_t *media;
+	dfu_image_buf_t buf[2];
+	uint8_t fill;				/* Buffer taking blocks */
+	uint32_t next;				/* Offset of next expected block */
+	uint32_t busy_start;		/* Caller time programming started, us */
+	uint8_t status;				/* First error, sticky until next download */
+	bool finished;
+	dfu_image_stats_t stats;
+} dfu_image_t;
+
+/**
+ * @param	buffers	: 2 * DFU_IMAGE_SECTOR_MAX bytes, word aligned.
+ */
+void dfu_image_init(dfu_image_t *img, uint8_t *buffers);
+
+/**
+ * Start a new download, sectors still queued from a previous one are
+ * programmed first.
+ * @return	false if media sectors do not fit the buffers.
+ */
+bool dfu_image_begin(dfu_image_t *img, const dfu_media_t *media);
+
+/**
+ * Zero-copy receive, reserve the buffer space of the block at offset.
+ * @return	Where to put at most length bytes, NULL if the block is out of
+ *			sequence or no buffer is free.
+ */
+uint8_t *dfu_image_buffer(dfu_image_t *img, uint32_t offset, uint32_t length);
+
+/**
+ * Account a block received in place of dfu_image_buffer(), data is copied
+ * if it landed elsewhere.
+ * @param	now		: Caller time, us, may wrap around.
+ * @param	poll_ms	: Time host should wait before the next block.
+ * @return	DFU_IMAGE_ status, errors other than busy stick until next
+ *			dfu_image_begin().
+ */
+uint8_t dfu_image_write(dfu_image_t *img, uint32_t offset, const uint8_t *data, uint32_t length,
+		uint32_t now, uint32_t *poll_ms);
+
+/**
+ * End of image, queue the partly filled sector with the rest erased.
+ */
+void dfu_image_finish(dfu_image_t *img);
+
+/**
+ * Take the oldest queued sector for programming.
+ * @return	Buffer index, -1 if nothing is queued.
+ */
+int32_t dfu_image_claim(dfu_image_t *img, uint32_t now);
+
+/**
+ * Program a claimed sector, may run while blocks arrive.
+ * @return	true on success.
+ */
+bool dfu_image_program(dfu_image_t *img, int32_t idx);
+
+/**
+ * Free a programmed sector buffer.
+ */
+void dfu_image_release(dfu_image_t *img, int32_t idx, bool ok);
+
+/**
+ * @return	true if sectors are queued or being programmed.
+ */
+bool dfu_image_busy(const dfu_image_t *img);
+
+/**
+ * @return	true once the finished image is completely in flash.
+ */
+bool dfu_image_done(const dfu_image_t *img);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFU_IMAGE_H_ */
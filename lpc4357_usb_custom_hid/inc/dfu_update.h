@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DFU_UPDATE_H_
+#define DFU_UPDATE_H_
+
+#include "app_usbd_cfg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * USB DFU firmware update.
+ *
+ * The normal configuration carries a DFU runtime interface. DFU_DETACH
+ * from the host leaves a request in an RTC backup register and resets,
+ * main() then brings up USB with only the DFU mode interface:
+ *  - Alternate setting 0 writes the internal flash bank the firmware is
+ *    not running from. An image linked for that bank, with a valid vector
+ *    table checksum, is made the boot bank once it is completely written.
+ *  - Alternate setting 1 writes SPIFI flash.
+ * Blocks are collected into erase sectors by dfu_image, which is
+ * programmed from main loop while the next sector arrives. Uploads read
+ * back the selected media.
+ *
+ * After a successful download the board resets into the new firmware. A
+ * failure leaves it in DFU mode, downloading again resumes at the first
+ * sector which does not hold the image yet.
+ */
+
+#define DFU_MEDIA_INTERNAL		0
+#define DFU_MEDIA_SPIFI			1
+
+/**
+ * @brief	DFU runtime interface init, same contract as usb_hid_init().
+ */
+ErrorCode_t dfu_update_runtime_init(USBD_HANDLE_T hUsb,
+									USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+									uint32_t *mem_base,
+									uint32_t *mem_size);
+
+/**
+ * @brief	Check and clear a request to start in DFU mode, call early in main().
+ * @return	true if USB should come up with DFU mode descriptors.
+ */
+bool dfu_update_requested(void);
+
+/**
+ * @brief	DFU mode interface init, same contract as usb_hid_init().
+ */
+ErrorCode_t dfu_update_init(USBD_HANDLE_T hUsb,
+							USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+							uint32_t *mem_base,
+							uint32_t *mem_size);
+
+/**
+ * @brief	Check for work left for dfu_update_process(), call with interrupts masked.
+ */
+bool dfu_update_pending(void);
+
+/**
+ * @brief	Detach, program queued sectors and finish a download, call from main loop.
+ */
+void dfu_update_process(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DFU_UPDATE_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DMA_SERVICE_H_
+#define DMA_SERVICE_H_
+
+#include "board.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * GPDMA channel allocation and interrupt dispatch shared by all DMA users.
+ * Channels are programmed with caller built linked list descriptors,
+ * Chip_GPDMA_PrepareDescriptor() or hand made control words can be used.
+ */
+
+/* DMAMUX request lines and functions (see GPDMA chapter of LPC43xx user manual) */
+#define DMA_REQ_LINE_MAT1_0		3
+#define DMA_REQ_LINE_MAT1_1		4
+#define DMA_REQ_LINE_MAT2_0		5
+#define DMA_REQ_FUNC_TIMER		0
+
+typedef void (*dma_service_callback_t)(uint8_t channel, bool error);
+
+void dma_service_init(uint32_t irq_priority);
+
+/**
+ * @return	Allocated channel number, or -1 if all channels are in use.
+ *			Lower channel numbers have higher DMA priority, high_priority
+ *			allocates from the bottom, otherwise from the top.
+ */
+int dma_service_alloc(dma_service_callback_t callback, bool high_priority);
+void dma_service_free(uint8_t channel);
+
+/**
+ * Route a DMAMUX request line to a peripheral function for as long as the
+ * caller uses it. Several peripherals share each line, a line stays with
+ * its first claimer until released.
+ * @return	false if the line is claimed already.
+ */
+bool dma_service_claim_request(uint8_t line, uint8_t function);
+void dma_service_release_request(uint8_t line);
+
+/**
+ * Start a channel from a descriptor. config holds the channel CONFIG register
+ * bits (flow control and peripheral selection), interrupt masks are added here.
+ */
+void dma_service_start(uint8_t channel, const DMA_TransferDescriptor_t *desc, uint32_t config);
+void dma_service_stop(uint8_t channel);
+bool dma_service_is_active(uint8_t channel);
+
+/**
+ * @return	Address of the linked list item the channel will load next, 0 on last item.
+ */
+uint32_t dma_service_next_lli(uint8_t channel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DMA_SERVICE_H_ */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DRIFT_ESTIMATOR_H_
+#define DRIFT_ESTIMATOR_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Estimates actual I2S frame rate against a microsecond time base and derives
+ * host feedback from it. Frame counts are accumulated over a window, each
+ * finished window updates a smoothed rate. Time base may be coarse (USB frame
+ * counter), quantization error of a window end carries into the next window
+ * so it does not accumulate. Feedback is the smoothed rate
+ * in frames per millisecond (Q16.16) plus a correction which pulls FIFO level
+ * back to its target, same idea as USB audio class feedback endpoints.
+ */
+
+#define DRIFT_WINDOW_US		(1000 * 1000)
+#define DRIFT_SMOOTH_SHIFT	5		/* IIR weight of new window, 1/32 */
+#define DRIFT_LEVEL_SHIFT	6		/* Level error gain, frames/ms per 64 frames of error */
+
+typedef struct {
+	uint32_t nominal_rate;		/* Hz */
+	int64_t rate_q16;			/* Smoothed measured rate, Hz Q16 */
+	uint32_t window_start_us;
+	uint32_t window_frames;
+	bool started;
+	bool valid;
+} drift_estimator_t;
+
+void drift_estimator_init(drift_estimator_t *est, uint32_t nominal_rate);
+
+/**
+ * Account frames transferred at timestamp now_us.
+ */
+void drift_estimator_update(drift_estimator_t *est, uint32_t frames, uint32_t now_us);
+
+/**
+ * @return	Deviation of measured rate from nominal rate in ppm.
+ */
+int32_t drift_estimator_ppm(const drift_estimator_t *est);
+
+/**
+ * @return	Frames per millisecond host should send, Q16.16.
+ */
+uint32_t drift_estimator_feedback(const drift_estimator_t *est, uint32_t level, uint32_t target_level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DRIFT_ESTIMATOR_H_ */
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EVENT_CAPTURE_H_
+#define EVENT_CAPTURE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Timestamped edge capture engine.
+ * Interrupt handlers push raw edges with event_capture_push(), main loop runs
+ * event_capture_process() to debounce them and USB IN path drains batches
+ * with event_capture_fill_report(). Nothing here touches hardware so it can be
+ * compiled and exercised on a PC.
+ */
+
+/* Channels 0 to 7 are pin interrupts, 8 and 9 are GPIO group interrupts. */
+#define EVENT_CAPTURE_NUM_CHANNELS 10
+#define EVENT_CHANNEL_GINT0 8
+#define EVENT_CHANNEL_GINT1 9
+
+#define EVENT_EDGE_FALL 0
+#define EVENT_EDGE_RISE 1
+
+#define EVENT_DEFAULT_DEBOUNCE_US 20000
+
+/**
+ * Report payload: count, lost, then count records of
+ * flags (bit 7 = rising edge, bits 0..3 = channel) and little endian 32 bit
+ * microsecond timestamp.
+ */
+#define EVENT_REPORT_HEADER_SIZE 2
+#define EVENT_RECORD_SIZE 5
+#define EVENT_RECORD_FLAG_RISE (1 << 7)
+#define EVENT_RECORD_CHANNEL_MASK 0x0F
+
+typedef struct {
+	uint32_t raw;		/* edges pushed by interrupt handlers */
+	uint32_t accepted;	/* edges which passed debounce */
+	uint32_t bounced;	/* edges rejected by debounce */
+	uint32_t overflow;	/* edges lost because raw ring was full */
+	uint32_t dropped;	/* debounced events lost because report ring was full */
+} event_capture_stats_t;
+
+void event_capture_init(void);
+
+/**
+ * Debounce is a lockout window: an edge is accepted only if at least
+ * debounce_us has passed since the last accepted edge of that channel.
+ */
+void event_capture_set_debounce(uint8_t channel, uint32_t debounce_us);
+
+/**
+ * Interrupt context. All capture interrupts must run at the same priority,
+ * the raw ring is lock free only for a single producer.
+ */
+bool event_capture_push(uint8_t channel, uint8_t edge, uint32_t timestamp_us);
+
+bool event_capture_pending(void);
+void event_capture_process(void);
+
+/**
+ * Moves as many debounced events as fit in max_len into payload.
+ * @return	Number of events written, 0 if nothing was pending.
+ */
+uint32_t event_capture_fill_report(uint8_t *payload, uint32_t max_len);
+
+const event_capture_stats_t *event_capture_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT_CAPTURE_H_ */
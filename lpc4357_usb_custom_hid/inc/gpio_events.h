@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef GPIO_EVENTS_H_
+#define GPIO_EVENTS_H_
+
+#include "board.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GPIO_EVENTS_EDGE_FALL (1 << 0)
+#define GPIO_EVENTS_EDGE_RISE (1 << 1)
+
+/**
+ * Pin interrupt (channels 0..7) and GPIO group interrupt (groups 0..1)
+ * front end of the event capture engine. Pins must already be muxed as GPIO inputs.
+ */
+void gpio_events_init(uint32_t irq_priority);
+bool gpio_events_enable_pin(uint8_t channel, uint8_t port, uint8_t pin, uint8_t edges);
+
+/**
+ * Group interrupt fires when any of the pins reaches its active level,
+ * it is reported as a rising edge on EVENT_CHANNEL_GINT0 + group.
+ */
+bool gpio_events_enable_group(uint8_t group, const gpio_pin_info_t *pins, uint32_t num_pins, bool active_high);
+
+/**
+ * Feature report payload: channel, debounce time in ms (16 bit little endian).
+ */
+bool gpio_events_set_feature(const uint8_t *payload, uint16_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPIO_EVENTS_H_ */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef HID_BATCH_H_
+#define HID_BATCH_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Batched commands in HID_REPORT_ID_BATCH output reports.
+ *
+ * Output report: opcode, args, opcode, args, ... up to the report end or
+ * HID_BATCH_OP_END, which also pads the rest of the report.
+ *
+ * Commands run in report order from the interrupt OUT handler, in one pass
+ * over the report without copying it, so one frame carries as many state
+ * changes as fit instead of one. Each opcode has fixed length args except
+ * HID_BATCH_OP_FEATURE which gives its own. A command a handler refuses is
+ * counted and the next one runs, an unknown opcode or a command running
+ * past the report end stops the report, the stream can't be followed
+ * beyond it.
+ */
+
+#define HID_BATCH_VERSION			1
+
+#define HID_BATCH_OP_END			0x00	/* rest of report is padding */
+#define HID_BATCH_OP_LED			0x01	/* LED number, on, LED5 only as LED4 pin is MCPWM output */
+#define HID_BATCH_OP_BLINK_RATE		0x02	/* LED4 blinks per second, saved like the feature report */
+#define HID_BATCH_OP_DEBOUNCE		0x03	/* event channel, milliseconds u16 */
+#define HID_BATCH_OP_FEATURE		0x04	/* length, report ID and feature payload, length bytes */
+#define HID_BATCH_NUM_OPS			5
+
+typedef struct {
+	uint32_t reports;
+	uint32_t commands;
+	uint32_t refused;				/* Commands a handler refused */
+	uint32_t malformed;				/* Reports stopped at an unknown or truncated command */
+} hid_batch_stats_t;
+
+#define HID_BATCH_STATUS_SIZE		(4 + sizeof(hid_batch_stats_t))
+
+/**
+ * Output report payload after report ID, call from USB interrupt context.
+ */
+void hid_batch_write(const uint8_t *payload, uint32_t length);
+
+/**
+ * Status: version, number of opcodes, 0, 0, hid_batch_stats_t.
+ */
+uint16_t hid_batch_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HID_BATCH_H_ */
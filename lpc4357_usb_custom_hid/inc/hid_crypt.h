@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef HID_CRYPT_H_
+#define HID_CRYPT_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Encrypted channel for input and output reports, on interrupt endpoints
+ * and CDC alike, see report_crypt for the scheme. Feature reports stay in
+ * clear, they carry the session control below.
+ *
+ * Keystream for the next report is computed from main loop while the
+ * current one is on the bus. Only LPC43Sxx parts have the AES engine, the
+ * LPC4357 on the board has not, so software AES is used unless
+ * HID_CRYPT_AES_ENGINE is defined. The engine is then fed by GPDMA
+ * through the boot ROM AES API.
+ *
+ * The key is written in clear with a feature report, good for a bench
+ * setup only.
+ */
+#undef HID_CRYPT_AES_ENGINE
+
+#define HID_CRYPT_CMD_KEY			0	/* [key 16] */
+#define HID_CRYPT_CMD_START			1	/* [threshold][host nonce 4] */
+#define HID_CRYPT_CMD_STOP			2
+
+#define HID_CRYPT_ENGINE_SOFTWARE	0
+#define HID_CRYPT_ENGINE_AES		1
+
+/* Feature report read: active, expired, threshold, engine, nonce 8 (host
+ * nonce then device nonce), report_crypt_stats_t, little endian */
+#define HID_CRYPT_STATUS_SIZE		32
+
+void hid_crypt_init(void);
+
+/**
+ * Encrypt an input report or decrypt an output report in place, call
+ * from USB interrupt context or with USB interrupt disabled.
+ * @return	false if the report must be dropped.
+ */
+bool hid_crypt_in(uint8_t *report, uint32_t length);
+bool hid_crypt_out(uint8_t *report, uint32_t length);
+
+/**
+ * @return	true if main loop has keystream to compute.
+ */
+bool hid_crypt_pending(void);
+void hid_crypt_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [command][arguments], starting a session adds a fresh device
+ * nonce, read it back before sending reports.
+ */
+bool hid_crypt_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t hid_crypt_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HID_CRYPT_H_ */
@@ -43,6 +43,59 @@ extern "C"
  * @{
  */
 
+/* Report IDs, first byte of every report exchanged with host. */
+#define HID_REPORT_ID_LED			0x01	/* Output: LED5 state, Feature: LED4 blink rate */
+#define HID_REPORT_ID_EVENTS		0x02	/* Input: event batch, Feature: channel debounce */
+#define HID_REPORT_ID_PWM_SEQ		0x03	/* Feature: PWM sequence upload/control and status */
+#define HID_REPORT_ID_UART			0x04	/* Input/Output: UART bridge data, Feature: channel setup and statistics */
+#define HID_REPORT_ID_CAN			0x05	/* Input: received frames, Output: frames to send, Feature: control and status */
+#define HID_REPORT_ID_AUDIO			0x06	/* Input: capture packets, Output: playback packets, Feature: format and status */
+#define HID_REPORT_ID_RECORDER		0x07	/* Input: readback data, Output: data to record, Feature: commands and status */
+#define HID_REPORT_ID_MSC			0x08	/* Feature: mass storage media select and cache status */
+#define HID_REPORT_ID_CRYPT			0x09	/* Feature: encrypted report session control and status */
+#define HID_REPORT_ID_SETTINGS		0x0A	/* Feature: saved settings sync and status */
+#define HID_REPORT_ID_POWER			0x0B	/* Feature: suspend, resume and remote wakeup status */
+#define HID_REPORT_ID_BOOT			0x0C	/* Feature: boot stage timing */
+#define HID_REPORT_ID_LOGIC			0x0D	/* Input: compressed logic capture chunks, Feature: capture control and status */
+#define HID_REPORT_ID_RPC			0x0E	/* Input: call responses, Output: call requests */
+#define HID_REPORT_ID_BATCH			0x0F	/* Output: batched commands, Feature: batch statistics */
+#define HID_REPORT_ID_CDC			0x10	/* Feature: CDC frame statistics and CRC timing */
+
+/* Report sizes including report ID byte */
+#define HID_REPORT_MAX_SIZE			64		/* Interrupt endpoints wMaxPacketSize */
+#define HID_LED_REPORT_SIZE			2
+#define HID_EVENTS_REPORT_SIZE		HID_REPORT_MAX_SIZE
+#define HID_EVENTS_FEATURE_SIZE		4
+#define HID_PWM_SEQ_FEATURE_SIZE	HID_REPORT_MAX_SIZE
+#define HID_UART_REPORT_SIZE		HID_REPORT_MAX_SIZE
+#define HID_UART_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_CAN_REPORT_SIZE			HID_REPORT_MAX_SIZE
+#define HID_CAN_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_AUDIO_REPORT_SIZE		HID_REPORT_MAX_SIZE
+#define HID_AUDIO_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_RECORDER_REPORT_SIZE	HID_REPORT_MAX_SIZE
+#define HID_RECORDER_FEATURE_SIZE	HID_REPORT_MAX_SIZE
+#define HID_MSC_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_CRYPT_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_SETTINGS_FEATURE_SIZE	HID_REPORT_MAX_SIZE
+#define HID_POWER_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_BOOT_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_LOGIC_REPORT_SIZE		HID_REPORT_MAX_SIZE
+#define HID_LOGIC_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_RPC_REPORT_SIZE			HID_REPORT_MAX_SIZE
+#define HID_BATCH_REPORT_SIZE		HID_REPORT_MAX_SIZE
+#define HID_BATCH_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+#define HID_CDC_FEATURE_SIZE		HID_REPORT_MAX_SIZE
+
+#define HID_IN_MAX_SOURCES			8
+
+/**
+ * @brief	Interrupt IN report producer.
+ * @param	report	: HID_REPORT_MAX_SIZE bytes zeroed buffer to fill, report ID first.
+ * @return	Number of bytes to send, 0 if producer has nothing pending.
+ */
+typedef uint32_t (*hid_in_source_t)(uint8_t *report);
+
 /**
  * @brief	Generic HID interface init routine.
  * @param	hUsb		: Handle to USB device stack
@@ -57,6 +110,68 @@ ErrorCode_t usb_hid_init(USBD_HANDLE_T hUsb,
 						 uint32_t *mem_base,
 						 uint32_t *mem_size);
 
+/**
+ * @brief	Register an interrupt IN report producer.
+ *			Producers are polled round robin whenever IN endpoint is free.
+ * @param	source	: Producer callback, called from USB interrupt context.
+ * @return	false if there is no free slot.
+ */
+bool hid_in_add_source(hid_in_source_t source);
+
+/**
+ * @brief	Poll IN report producers round robin, call from USB interrupt context
+ *			or with USB interrupt disabled.
+ * @param	report	: HID_REPORT_MAX_SIZE bytes buffer.
+ * @return	Report length, 0 if no producer has anything pending.
+ */
+uint32_t hid_in_poll(uint8_t *report);
+
+/**
+ * @brief	Take IN reports away from the interrupt endpoint, claimer pulls
+ *			them with hid_in_poll() instead.
+ * @return	Nothing
+ */
+void hid_in_claim(bool claim);
+
+/**
+ * @brief	Handle an output report, same as one received on interrupt OUT endpoint.
+ * @return	Nothing
+ */
+void hid_out_report(const uint8_t *report, uint32_t length);
+
+/**
+ * @brief	Read a feature report, report[0] holds the report ID.
+ * @param	report	: HID_REPORT_MAX_SIZE bytes buffer.
+ * @param	plength	: Receives report length including report ID.
+ * @return	false if report ID has no readable feature report.
+ */
+bool hid_get_feature(uint8_t *report, uint16_t *plength);
+
+/**
+ * @brief	Write a feature report, report[0] holds the report ID.
+ * @return	false if report was refused, host sees a STALL.
+ */
+bool hid_set_feature(const uint8_t *report, uint16_t length);
+
+/**
+ * @brief	Send pending IN reports if endpoint is idle. Call from thread context
+ *			after producers have queued new data.
+ * @return	Nothing
+ */
+void hid_in_kick(void);
+
+/**
+ * @brief	Check for an input report primed on the interrupt IN endpoint.
+ * @return	true until host takes it.
+ */
+bool hid_in_pending(void);
+
+/**
+ * @brief	Forget any IN transfer in flight, call on USB bus reset and configuration.
+ * @return	Nothing
+ */
+void hid_in_reset(void);
+
 /**
  * @}
  */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef HID_RPC_H_
+#define HID_RPC_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Request and response calls in HID_REPORT_ID_RPC reports.
+ *
+ * Output report: tag, method, args length, args
+ * Input report:  tag, status, result length, result
+ *
+ * Requests are handled as they arrive, from the interrupt OUT handler, and
+ * the response carries the request's tag so host can keep several calls
+ * outstanding and match them up. Responses wait in a ring of HID_RPC_WINDOW
+ * slots for the IN endpoint, a request arriving while all slots are taken
+ * is dropped and host sees its call time out. Host keeps at most
+ * HID_RPC_WINDOW calls outstanding, HID_RPC_METHOD_INFO tells it.
+ */
+
+#define HID_RPC_VERSION				1
+#define HID_RPC_WINDOW				8
+#define HID_RPC_HEADER_SIZE			4		/* Report ID, tag, method or status, length */
+#define HID_RPC_MAX_DATA			(HID_RPC_REPORT_SIZE - HID_RPC_HEADER_SIZE)
+
+#define HID_RPC_METHOD_PING			0x00	/* args echoed back */
+#define HID_RPC_METHOD_INFO			0x01	/* -> version, window, max data, 0, hid_rpc_stats_t */
+#define HID_RPC_METHOD_GET_FEATURE	0x02	/* report ID, offset -> feature report bytes after ID from offset */
+#define HID_RPC_METHOD_SET_FEATURE	0x03	/* report ID, feature payload, up to HID_RPC_MAX_DATA - 1 bytes */
+#define HID_RPC_METHOD_LED5			0x04	/* on */
+
+#define HID_RPC_STATUS_OK			0
+#define HID_RPC_STATUS_NO_METHOD	1
+#define HID_RPC_STATUS_BAD_ARGS		2
+#define HID_RPC_STATUS_REFUSED		3		/* Feature report handler refused it */
+
+typedef struct {
+	uint32_t requests;
+	uint32_t errors;				/* Responses with a status other than OK */
+	uint32_t dropped;				/* Requests without a free response slot */
+	uint32_t malformed;				/* Reports too short for their length field */
+} hid_rpc_stats_t;
+
+void hid_rpc_init(void);
+
+/**
+ * Output report payload after report ID, call from USB interrupt context.
+ */
+void hid_rpc_write(const uint8_t *payload, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HID_RPC_H_ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef INIT_STAGES_H_
+#define INIT_STAGES_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Staged bring-up of slow parts, so that USB can connect before them. A
+ * stage runs once, either on its first use through init_stages_require()
+ * or, for background stages, one at a time from main loop through
+ * init_stages_process(). Stages it depends on run before it, whichever
+ * way it was started. A failed stage fails everything depending on it.
+ *
+ * Start time and duration of every stage are kept for boot time reports.
+ * Callers serialize access, nothing here touches hardware so simulated
+ * stages with made up costs run on a PC.
+ */
+
+#define INIT_STAGES_MAX			16
+
+typedef enum {
+	INIT_STAGE_WAITING = 0,
+	INIT_STAGE_RUNNING,			/* Only seen by the stage's own init function */
+	INIT_STAGE_DONE,
+	INIT_STAGE_FAILED,
+} init_stage_state_t;
+
+typedef struct {
+	bool (*init)(void *ctx);	/* false if the part did not come up */
+	uint32_t deps;				/* Bit mask of stages to run first */
+	bool background;			/* Run from main loop when nobody needed it sooner */
+} init_stage_def_t;
+
+typedef struct {
+	uint8_t state;				/* init_stage_state_t */
+	bool on_demand;				/* Started by init_stages_require() */
+	uint32_t start_us;			/* Caller time */
+	uint32_t duration_us;		/* Init function alone, without its dependencies */
+} init_stage_status_t;
+
+typedef struct {
+	const init_stage_def_t *defs;
+	uint32_t num_stages;
+	uint32_t (*now_us)(void);
+	void *ctx;
+	init_stage_status_t status[INIT_STAGES_MAX];
+} init_stages_t;
+
+/**
+ * @return	false if a stage depends on an unknown stage or dependencies
+ *			form a cycle, nothing is run then.
+ */
+bool init_stages_init(init_stages_t *st, const init_stage_def_t *defs, uint32_t num_stages,
+					  uint32_t (*now_us)(void), void *ctx);
+
+/**
+ * Runs a stage and its dependencies unless they ran already.
+ * @return	true if the stage is done, false if it failed.
+ */
+bool init_stages_require(init_stages_t *st, uint32_t stage);
+
+bool init_stages_done(const init_stages_t *st, uint32_t stage);
+
+/**
+ * @return	true while a background stage waits.
+ */
+bool init_stages_pending(const init_stages_t *st);
+
+/**
+ * Runs the first waiting background stage, with its dependencies.
+ */
+void init_stages_process(init_stages_t *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INIT_STAGES_H_ */
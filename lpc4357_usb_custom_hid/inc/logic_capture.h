@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LOGIC_CAPTURE_H_
+#define LOGIC_CAPTURE_H_
+
+#include "board.h"
+#include "logic_rle.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * 8 channel logic analyzer on SGPIO8..15. Slice B shifts in all eight pins
+ * at once (8 bit parallel mode), so a 32 bit slice register holds four
+ * samples, and it swaps into the shadow register every fourth sample clock.
+ * SGPIO requests are not among the DMAMUX peripherals the chip library
+ * drives, so TIMER2 paces the copy instead: it runs off the same PLL at a
+ * quarter of the sample rate and each MAT2.0 match has GPDMA copy the
+ * shadow register into a ring in SDRAM, half way between two swaps.
+ *
+ * Main loop compresses the ring with logic_rle and HID_REPORT_ID_LOGIC input
+ * reports carry the chunks. Compression keeps up with the highest rate on
+ * mostly idle lines, a full speed interrupt endpoint carries 64 KB/s, so
+ * busy signals at high rates overrun the ring and show up as gaps.
+ */
+
+/* Sample clock dividers of SGPIO clock. The lower bound keeps the DMA read
+ * clear of the swaps, 17 MHz at 204 MHz, the upper one is the 12 bit PRESET. */
+#define LOGIC_CAPTURE_MIN_DIVIDER	12
+#define LOGIC_CAPTURE_MAX_DIVIDER	4096
+
+/* Open runs and short chunks go to host at least this often */
+#define LOGIC_CAPTURE_FLUSH_US		2000
+
+typedef struct {
+	uint8_t state;					/* logic_rle_state_t */
+	uint8_t mask;
+	uint8_t value;
+	uint32_t rate;					/* Actual sample rate */
+	uint32_t limit;
+	uint32_t backlog;				/* Samples in SDRAM ring waiting for compression */
+	logic_rle_stats_t stats;
+} logic_capture_status_t;
+
+/* Feature report read: state u8, mask u8, value u8, pad, rate u32, limit u32,
+ * backlog u32, logic_rle_stats_t, little endian */
+#define LOGIC_CAPTURE_STATUS_SIZE	(16 + sizeof(logic_rle_stats_t))
+
+void logic_capture_init(void);
+
+/**
+ * Arm a capture, runs from main loop. Rate is rounded to a divider of
+ * SGPIO clock, limit 0 captures until stopped.
+ * @return	false if rate is out of range.
+ */
+bool logic_capture_start(uint32_t rate, uint8_t mask, uint8_t value, uint32_t limit);
+void logic_capture_stop(void);
+
+/**
+ * @return	true if main loop has samples to compress or a command to run.
+ */
+bool logic_capture_pending(void);
+void logic_capture_process(void);
+
+void logic_capture_get_status(logic_capture_status_t *status);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [enable][mask][value][rate u32][limit u32], enable 0 stops.
+ */
+bool logic_capture_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t logic_capture_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGIC_CAPTURE_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LOGIC_RLE_H_
+#define LOGIC_RLE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Run length compression of 8 channel logic samples. A sample is one byte,
+ * bit n is channel n. Every run is its sample value followed by its length
+ * as a base 128 varint, low group first, so a line that stays put costs two
+ * bytes however long it does. Runs are queued in a byte FIFO which
+ * logic_rle_chunk() cuts into report sized chunks. Runs straddle chunks,
+ * host concatenates chunk payloads in sequence order.
+ *
+ * A run of length 0 marks a gap: [value][0][dropped samples varint], value
+ * is the last sample before the gap. Producer reports gaps when its sample
+ * source overran, e.g. because FIFO was full and it could not feed.
+ *
+ * Capture starts on the first sample which matches trigger (sample & mask
+ * == value) after one which did not, mask 0 starts on the first sample.
+ * Stream begins with the trigger sample and ends after limit samples.
+ *
+ * One producer feeds, one consumer takes chunks, possibly from an interrupt.
+ * Nothing here touches hardware so it can be compiled and exercised on a PC.
+ *
+ * Chunk: seq u16, flags u8, length u8, then length bytes of run stream.
+ */
+
+#define LOGIC_CHUNK_HEADER_SIZE		4
+#define LOGIC_CHUNK_FIRST			(1 << 0)	/* First chunk after trigger */
+#define LOGIC_CHUNK_END				(1 << 1)	/* Capture finished, no chunks follow */
+
+/* Longest encodings, FIFO must have room for one before anything is queued */
+#define LOGIC_RLE_RUN_MAX			6
+#define LOGIC_RLE_GAP_MAX			7
+
+typedef enum {
+	LOGIC_RLE_IDLE = 0,
+	LOGIC_RLE_ARMED,			/* Waiting for trigger, samples are discarded */
+	LOGIC_RLE_TRIGGERED,
+	LOGIC_RLE_DONE,				/* Limit reached or stopped, FIFO drains */
+} logic_rle_state_t;
+
+typedef struct {
+	uint32_t samples;			/* Samples since trigger, gaps included */
+	uint32_t runs;
+	uint32_t bytes;				/* Run stream bytes queued */
+	uint32_t chunks;
+	uint32_t gaps;
+	uint32_t dropped;			/* Samples lost in gaps */
+} logic_rle_stats_t;
+
+typedef struct {
+	uint8_t *fifo;
+	uint32_t size;				/* Power of 2 */
+	volatile uint32_t head;		/* Written by producer only */
+	volatile uint32_t tail;		/* Written by consumer only */
+	volatile uint8_t state;		/* logic_rle_state_t, written by producer only */
+	uint8_t mask;
+	uint8_t value;
+	bool missed;				/* Seen a sample not matching trigger */
+	bool stopping;				/* Stream ends once open run and gap are queued */
+	uint8_t run_value;
+	uint32_t run_length;
+	uint32_t limit;				/* Samples after trigger, 0 until stopped */
+	uint32_t pending_gap;		/* Dropped samples not yet marked in stream */
+	uint16_t seq;
+	bool end_sent;
+	logic_rle_stats_t stats;
+} logic_rle_t;
+
+void logic_rle_init(logic_rle_t *rle, uint8_t *fifo, uint32_t size);
+
+/**
+ * Forget queued stream and wait for trigger.
+ */
+void logic_rle_arm(logic_rle_t *rle, uint8_t mask, uint8_t value, uint32_t limit);
+
+/**
+ * Queue the open run and end the stream, consumer sends the rest.
+ */
+void logic_rle_stop(logic_rle_t *rle);
+
+/**
+ * Producer side. Stops early when FIFO can not take the next run, caller
+ * keeps the rest and offers it again.
+ * @return	Samples consumed.
+ */
+uint32_t logic_rle_feed(logic_rle_t *rle, const uint8_t *samples, uint32_t count);
+
+/**
+ * Producer side, samples between the last fed one and the next were lost.
+ */
+void logic_rle_gap(logic_rle_t *rle, uint32_t dropped);
+
+/**
+ * Producer side, queue the open run so far so that a slow signal shows up
+ * at host. Next samples of same value start a new run.
+ */
+void logic_rle_flush(logic_rle_t *rle);
+
+uint32_t logic_rle_level(const logic_rle_t *rle);
+
+/**
+ * Consumer side, build one chunk of at most max_len bytes (header included,
+ * up to 255 stream bytes). Chunks are only cut short when flush is set or
+ * the stream ended.
+ * @return	Chunk length, 0 if nothing is due.
+ */
+uint32_t logic_rle_chunk(logic_rle_t *rle, uint8_t *chunk, uint32_t max_len, bool flush);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGIC_RLE_H_ */
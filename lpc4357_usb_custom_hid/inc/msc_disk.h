@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef MSC_DISK_H_
+#define MSC_DISK_H_
+
+#include "app_usbd_cfg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * USB mass storage interface next to HID. ROM driver handles bulk only
+ * transport and SCSI, this module serves its block callbacks from one of
+ * two media:
+ *  - RAM disk in SDRAM, USB DMA reads and writes it in place.
+ *  - SPIFI flash, read through the XIP window and written through a
+ *    block_cache of 64 KB sector lines in SDRAM. Lines are programmed
+ *    from main loop once the host left them alone for a while, page by
+ *    page with USB interrupt masked only while the XIP window is gone.
+ *    Writing a fifth sector while four are dirty parks that transfer and
+ *    NAKs bulk OUT until main loop programmed a line, flash is never
+ *    touched from USB interrupt.
+ *
+ * RAM disk is cleared from main loop after USB connected, 64 KB per pass.
+ * Until then chunks not cleared yet read as zeros and a write clears the
+ * chunks it touches first, the host never has to wait for it.
+ *
+ * ROM driver has a single LUN whose geometry is fixed at init, both media
+ * are MSC_DISK_SIZE and the callbacks pick one. Selecting the other media
+ * syncs the cache and reconnects the device so the host drops what it
+ * cached of the old one. HID interface goes away for the reconnect as well.
+ */
+
+#define MSC_DISK_MEDIA_RAM			0
+#define MSC_DISK_MEDIA_SPIFI		1
+
+/* Both media, the SPIFI flash size */
+#define MSC_DISK_SIZE				(4 * 1024 * 1024)
+
+#define MSC_DISK_CMD_SELECT			0	/* [media] */
+#define MSC_DISK_CMD_SYNC			1	/* Program all dirty lines now */
+
+/* Feature report read: media, last command result, media switchable (always 1),
+ * cache dirty, block count u32, block_cache_stats_t, medium ready, little endian */
+#define MSC_DISK_STATUS_SIZE		41
+
+/**
+ * @brief	Mass storage interface init routine, same contract as usb_hid_init().
+ */
+ErrorCode_t msc_disk_init(USBD_HANDLE_T hUsb,
+						  USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+						  uint32_t *mem_base,
+						  uint32_t *mem_size);
+
+/**
+ * @return	true if main loop has a command to run.
+ */
+bool msc_disk_pending(void);
+void msc_disk_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [command][arguments], command runs later from main loop.
+ */
+bool msc_disk_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t msc_disk_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MSC_DISK_H_ */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PWM_SEQUENCE_H_
+#define PWM_SEQUENCE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Compiles host uploaded PWM steps into register images which are copied
+ * by DMA straight into MCPWM and SCT reload registers. No hardware access
+ * here, timing math can be checked on a PC.
+ */
+
+#define PWM_NUM_MCPWM_CHANNELS	3
+#define PWM_NUM_SCT_OUTPUTS		3
+#define PWM_DUTY_MAX			1000	/* duty cycle unit is 1/1000 of period */
+
+/**
+ * Wire format of one step, all fields little endian:
+ * 3 x MCPWM channel {uint32 period_us, uint16 duty}
+ * SCT {uint32 period_us, 3 x uint16 duty}
+ */
+#define PWM_STEP_WIRE_SIZE		28
+
+/* Words copied in one DMA burst: MCPWM LIM[0..2], MAT[0..2], DT, CCP */
+#define PWM_MCPWM_REG_WORDS		8
+/* Words copied in one DMA burst: SCT MATCHREL[0..3] */
+#define PWM_SCT_REG_WORDS		4
+
+typedef struct {
+	uint32_t mcpwm[PWM_MCPWM_REG_WORDS];
+	uint32_t sct[PWM_SCT_REG_WORDS];
+} pwm_step_regs_t;
+
+/**
+ * @return	Number of timer ticks in us, rounded to nearest and at least 2.
+ */
+uint32_t pwm_sequence_us_to_ticks(uint32_t us, uint32_t clk_hz);
+
+/**
+ * @return	Ticks of period_ticks for which output is in its first state, duty is clamped to PWM_DUTY_MAX.
+ */
+uint32_t pwm_sequence_duty_to_ticks(uint32_t period_ticks, uint16_t duty);
+
+/**
+ * Compile one step from its wire format.
+ * @return	false if a period is zero.
+ */
+bool pwm_sequence_compile_step(const uint8_t *wire, pwm_step_regs_t *regs,
+							   uint32_t mcpwm_clk_hz, uint32_t sct_clk_hz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PWM_SEQUENCE_H_ */
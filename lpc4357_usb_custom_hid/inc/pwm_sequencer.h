@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PWM_SEQUENCER_H_
+#define PWM_SEQUENCER_H_
+
+#include "board.h"
+#include "pwm_sequence.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Plays a host uploaded sequence of PWM steps on MCPWM channels 0..2 and
+ * SCT outputs 0..2. TIMER1 match events request GPDMA bursts that copy the
+ * next step straight into the shadow (reload) registers, so each output
+ * changes at its own cycle boundary without CPU involvement.
+ */
+
+#define PWM_SEQUENCER_MAX_STEPS		64
+
+/* Feature report commands, first payload byte */
+#define PWM_SEQ_CMD_BEGIN			0	/* [num_steps u16][step_ms u16][flags] */
+#define PWM_SEQ_CMD_STEPS			1	/* [first u16][count u8][count x step] */
+#define PWM_SEQ_CMD_START			2
+#define PWM_SEQ_CMD_STOP			3
+
+#define PWM_SEQ_FLAG_LOOP			0x01
+
+typedef enum {
+	PWM_SEQ_IDLE = 0,
+	PWM_SEQ_RUNNING,
+	PWM_SEQ_DONE,
+} pwm_seq_state_t;
+
+/* Status returned on feature report read: [state][num_steps u16][step u16][step_ms u16] */
+#define PWM_SEQ_STATUS_SIZE			7
+
+void pwm_sequencer_init(void);
+
+/**
+ * Stop playback and prepare for a new sequence of num_steps steps,
+ * each step lasts step_ms.
+ */
+bool pwm_sequencer_begin(uint16_t num_steps, uint16_t step_ms, uint8_t flags);
+
+/**
+ * Load count wire format steps (PWM_STEP_WIRE_SIZE each) starting at first.
+ * Not allowed while running.
+ */
+bool pwm_sequencer_load(uint16_t first, const uint8_t *wire, uint8_t count);
+
+bool pwm_sequencer_start(void);
+void pwm_sequencer_stop(void);
+pwm_seq_state_t pwm_sequencer_state(void);
+
+/**
+ * @return	Index of the step currently applied to the outputs.
+ */
+uint16_t pwm_sequencer_current_step(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ */
+bool pwm_sequencer_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t pwm_sequencer_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PWM_SEQUENCER_H_ */
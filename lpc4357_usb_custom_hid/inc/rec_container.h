@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef REC_CONTAINER_H_
+#define REC_CONTAINER_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Append-only recording container on a raw block device. Block 0 holds the
+ * index, recordings follow one after another, each starting on a
+ * REC_ALIGN_BLOCKS boundary. A recording is a run of fixed stride batches,
+ * every batch is written with one multi-block write and starts with a
+ * rec_batch_header_t, only the last batch of a recording may be short.
+ *
+ * Index is written when a recording starts and when it stops. A recording
+ * left open by a reset is recovered at mount by walking its batch headers.
+ *
+ * Data is double buffered, producer appends into one batch buffer while
+ * consumer writes the other. Readback reuses the same buffers. Nothing here
+ * touches hardware, block device is a pair of callbacks, so a file backed
+ * card image works on a PC. Layout is little endian.
+ */
+
+#define REC_BLOCK_SIZE			512
+#define REC_BATCH_BLOCKS		16
+#define REC_BATCH_SIZE			(REC_BATCH_BLOCKS * REC_BLOCK_SIZE)
+#define REC_BATCH_PAYLOAD		(REC_BATCH_SIZE - sizeof(rec_batch_header_t))
+#define REC_ALIGN_BLOCKS		128		/* 64 KB */
+#define REC_MAX_RECORDINGS		31
+
+#define REC_INDEX_MAGIC			0x43455248	/* "HREC" */
+#define REC_INDEX_VERSION		1
+#define REC_BATCH_MAGIC			0x54414252	/* "RBAT" */
+
+#define REC_ENTRY_OPEN			(1 << 0)
+
+typedef struct {
+	bool (*read)(void *ctx, uint32_t block, void *buffer, uint32_t count);
+	bool (*write)(void *ctx, uint32_t block, const void *buffer, uint32_t count);
+	void *ctx;
+	uint32_t num_blocks;
+} rec_blockdev_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t id;			/* Recording the batch belongs to */
+	uint32_t seq;			/* Batch number within recording */
+	uint32_t length;		/* Payload bytes following header */
+} rec_batch_header_t;
+
+typedef struct {
+	uint32_t id;
+	uint32_t start_block;
+	uint32_t bytes;
+	uint32_t flags;
+} rec_entry_t;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	uint32_t next_id;
+	uint32_t reserved;
+	rec_entry_t entries[REC_MAX_RECORDINGS];
+} rec_index_t;
+
+typedef struct {
+	uint32_t data[REC_BATCH_SIZE / sizeof(uint32_t)];	/* Word aligned for DMA */
+	volatile bool ready;	/* Full and waiting for writer, or loaded and waiting for reader */
+	uint32_t pos;			/* Next byte to fill or to read */
+	uint32_t end;			/* Readback, end of valid bytes */
+	uint32_t offset;		/* Readback, recording offset of byte at pos */
+} rec_buffer_t;
+
+typedef struct {
+	uint32_t bytes;			/* Bytes accepted into current recording */
+	uint32_t dropped;		/* Bytes dropped because both buffers were busy */
+	uint32_t batches;		/* Batches written */
+	uint32_t write_errors;
+	uint32_t read_errors;
+} rec_stats_t;
+
+typedef struct {
+	const rec_blockdev_t *dev;
+	rec_index_t index;
+	bool mounted;
+	volatile bool recording;
+	volatile bool reading;
+	bool halted;			/* Recording stopped accepting data, card full or write failed */
+	rec_entry_t *current;
+	uint32_t seq;			/* Next batch to write */
+	rec_buffer_t buffers[2];
+	uint8_t fill;			/* Buffer producer works on, loader when reading */
+	uint8_t drain;			/* Buffer consumer works on, reader when reading */
+	uint32_t read_pos;		/* Recording offset of next batch to load */
+	uint32_t read_end;
+	rec_stats_t stats;
+} rec_container_t;
+
+/**
+ * Read and validate index, close a recording left open.
+ * @return	false if device can not be read or holds no index.
+ */
+bool rec_mount(rec_container_t *rec, const rec_blockdev_t *dev);
+
+/**
+ * Write an empty index, all recordings are lost.
+ */
+bool rec_format(rec_container_t *rec, const rec_blockdev_t *dev);
+
+bool rec_start(rec_container_t *rec);
+
+/**
+ * Producer side, may run in interrupt context while recording.
+ * @return	Bytes accepted.
+ */
+uint32_t rec_append(rec_container_t *rec, const uint8_t *data, uint32_t length);
+
+/**
+ * Consumer side, write full batches or load readback batches.
+ * @return	true if a block device transfer was made.
+ */
+bool rec_process(rec_container_t *rec);
+
+/**
+ * @return	true if rec_process() has a transfer to make.
+ */
+bool rec_pending(const rec_container_t *rec);
+
+/**
+ * Flush partial batch and close current recording. Producer must not run
+ * concurrently.
+ */
+bool rec_stop(rec_container_t *rec);
+
+/**
+ * Start reading length bytes of recording number index from offset.
+ */
+bool rec_read_start(rec_container_t *rec, uint32_t index, uint32_t offset, uint32_t length);
+void rec_read_stop(rec_container_t *rec);
+
+/**
+ * Readback consumer, may run in interrupt context.
+ * @param	offset	: Receives recording offset of first byte.
+ * @return	Bytes copied, 0 if next batch is not loaded yet or read is done.
+ */
+uint32_t rec_read(rec_container_t *rec, uint8_t *data, uint32_t max_length, uint32_t *offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REC_CONTAINER_H_ */
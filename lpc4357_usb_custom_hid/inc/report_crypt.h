@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef REPORT_CRYPT_H_
+#define REPORT_CRYPT_H_
+
+#include "lpc_types.h"
+#include "aes128.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * AES-128 CTR encryption of report payloads. Every report ID and direction
+ * has its own counter, the counter block for payload block b of report n
+ * is
+ *   nonce[8] | report ID | direction | n (u32 big endian) | 0 | b
+ * so both ends stay in step just by counting reports, nothing is added
+ * to the report. Payloads shorter than the session threshold pass in
+ * clear and do not advance the counter.
+ *
+ * Keystream is computed ahead for the next report of every slot seen
+ * so far, by an ECB engine which may run in the background (AES engine
+ * fed by DMA) while the current report is on the bus. A report whose
+ * keystream is not ready computes it on the spot.
+ *
+ * CTR gives confidentiality only, a modified report is not detected.
+ *
+ * Callers serialize access, nothing here touches hardware so a software
+ * engine works on a PC.
+ */
+
+#define REPORT_CRYPT_MAX_IDS		16
+#define REPORT_CRYPT_NONCE_SIZE		8
+#define REPORT_CRYPT_STREAM_BLOCKS	4		/* Covers a 63 byte payload */
+#define REPORT_CRYPT_STREAM_SIZE	(REPORT_CRYPT_STREAM_BLOCKS * AES128_BLOCK_SIZE)
+
+#define REPORT_CRYPT_OUT			0		/* Host to device */
+#define REPORT_CRYPT_IN				1		/* Device to host */
+
+typedef struct {
+	void (*set_key)(void *ctx, const uint8_t *key);
+	/* ECB encrypt blocks, in and out stay untouched until busy() returns false */
+	void (*encrypt)(void *ctx, const uint8_t *in, uint8_t *out, uint32_t blocks);
+	/* NULL if encrypt() completes before returning */
+	bool (*busy)(void *ctx);
+	void *ctx;
+} report_crypt_engine_t;
+
+typedef struct {
+	uint8_t stream[REPORT_CRYPT_STREAM_SIZE];	/* Keystream of report counter, word aligned */
+	uint32_t counter;		/* Next report number */
+	uint8_t state;
+	bool used;				/* Prefetch only for slots the host talks on */
+} report_crypt_slot_t;
+
+typedef struct {
+	uint32_t reports;		/* Payloads encrypted or decrypted */
+	uint32_t prefetched;	/* ...with keystream computed ahead */
+	uint32_t waited;		/* ...waiting for the engine to finish it */
+	uint32_t computed;		/* ...computing keystream on the spot */
+	uint32_t clear;			/* Payloads below threshold passed in clear */
+} report_crypt_stats_t;
+
+typedef struct {
+	report_crypt_slot_t slots[REPORT_CRYPT_MAX_IDS][2];
+	uint8_t blocks[REPORT_CRYPT_STREAM_SIZE];	/* Counter blocks, engine input */
+	const report_crypt_engine_t *engine;
+	report_crypt_slot_t *running;
+	uint32_t next_slot;		/* Prefetch round robin */
+	uint8_t nonce[REPORT_CRYPT_NONCE_SIZE];
+	uint8_t threshold;
+	bool keyed;
+	bool active;
+	bool expired;			/* A counter ran out, session must be restarted */
+	report_crypt_stats_t stats;
+} report_crypt_t;
+
+void report_crypt_init(report_crypt_t *rc, const report_crypt_engine_t *engine);
+
+/**
+ * Load a new key, any session is stopped.
+ */
+void report_crypt_set_key(report_crypt_t *rc, const uint8_t *key);
+
+/**
+ * Start a session, counters restart from 0 so the nonce must never be
+ * reused with the same key.
+ * @param	threshold	: Smallest payload length which is encrypted, at least 1.
+ * @return	false if no key is loaded.
+ */
+bool report_crypt_start(report_crypt_t *rc, const uint8_t *nonce, uint8_t threshold);
+void report_crypt_stop(report_crypt_t *rc);
+
+/**
+ * Encrypt or decrypt a report in place, report[0] holds the report ID.
+ * @return	false if the report must be dropped, the session expired.
+ */
+bool report_crypt_apply(report_crypt_t *rc, uint8_t dir, uint8_t *report, uint32_t length);
+
+/**
+ * @return	true if report_crypt_process() has keystream to compute.
+ */
+bool report_crypt_pending(const report_crypt_t *rc);
+
+/**
+ * Collect finished keystream and start the next one, at most one engine
+ * run per call.
+ */
+void report_crypt_process(report_crypt_t *rc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REPORT_CRYPT_H_ */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SD_RECORDER_H_
+#define SD_RECORDER_H_
+
+#include "board.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Records a byte stream to SD card in rec_container format and streams
+ * recordings back. Card is used raw, formatting it destroys any file system.
+ * Card transfers block, they run from main loop only, USB interrupt keeps
+ * filling the second batch buffer meanwhile.
+ *
+ * Output report payload: [length][data], appended to current recording.
+ * Input report payload: [offset u32][length][data], readback stream.
+ */
+
+#define SD_RECORDER_CMD_MOUNT		0
+#define SD_RECORDER_CMD_FORMAT		1	/* [REC_INDEX_MAGIC u32] guards against accidents */
+#define SD_RECORDER_CMD_START		2
+#define SD_RECORDER_CMD_STOP		3
+#define SD_RECORDER_CMD_READ		4	/* [index][offset u32][length u32] */
+#define SD_RECORDER_CMD_READ_STOP	5
+#define SD_RECORDER_CMD_SELECT		6	/* [index], entry reported in status */
+
+#define SD_RECORDER_STATE_NO_CARD		0
+#define SD_RECORDER_STATE_UNFORMATTED	1
+#define SD_RECORDER_STATE_IDLE			2
+#define SD_RECORDER_STATE_RECORDING		3
+#define SD_RECORDER_STATE_READING		4
+
+/* Data bytes carried by one input report */
+#define SD_RECORDER_READ_DATA_SIZE		(HID_REPORT_MAX_SIZE - 6)
+
+/* Feature report read: state, last command result, count, selected, card blocks u32,
+ * rec_stats_t, read position and end u32, selected rec_entry_t, little endian */
+#define SD_RECORDER_STATUS_SIZE			52
+
+void sd_recorder_init(uint32_t irq_priority);
+
+/**
+ * Append output report payload to current recording. Called from USB interrupt.
+ */
+void sd_recorder_write(const uint8_t *payload, uint32_t length);
+
+/**
+ * Append data from firmware, same rules as sd_recorder_write().
+ */
+uint32_t sd_recorder_append(const uint8_t *data, uint32_t length);
+
+/**
+ * @return	true if main loop has a command or card transfer to run.
+ */
+bool sd_recorder_pending(void);
+void sd_recorder_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [command][arguments], command runs later from main loop.
+ */
+bool sd_recorder_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t sd_recorder_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SD_RECORDER_H_ */
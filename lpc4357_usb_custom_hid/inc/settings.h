@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Settings the host changes survive reset, kept in a config_store on the
+ * on-chip EEPROM. Modules save a setting where the host changes it and
+ * load it back in their init. Pages are programmed once settings were
+ * left alone for a while, one after the other from the EEPROM end of
+ * program interrupt, so USB interrupt never waits for the EEPROM.
+ *
+ * EEPROM interrupt shares its priority with USB, both may change the
+ * store and must not preempt each other.
+ */
+
+#define SETTINGS_KEY_BLINK_RATE		0x01	/* [blinks per second] */
+#define SETTINGS_KEY_DEBOUNCE		0x10	/* + channel: [ms u16] */
+#define SETTINGS_KEY_CAN_FILTERS	0x20	/* + chunk: [count x {id u32, mask u32}] */
+
+#define SETTINGS_CMD_SYNC			0	/* Program changed pages now */
+#define SETTINGS_CMD_CLEAR			1	/* Forget all settings, defaults after reset */
+
+/* Feature report read: dirty, busy, logical pages, 0, config_store_stats_t, little endian */
+#define SETTINGS_STATUS_SIZE		28
+
+void settings_init(uint32_t irq_priority);
+
+/**
+ * Read a setting, for module init.
+ * @return	Stored length, 0 if the setting was never saved.
+ */
+uint32_t settings_get(uint8_t key, uint8_t *value, uint32_t max_length);
+
+/**
+ * Save a setting, call from USB interrupt or thread context.
+ * @return	false if there is no room for it.
+ */
+bool settings_set(uint8_t key, const uint8_t *value, uint32_t length);
+void settings_delete(uint8_t key);
+
+/**
+ * Starts programming settings which were left alone long enough.
+ */
+void settings_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [command], read back the status until the store is clean.
+ */
+bool settings_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t settings_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SETTINGS_H_ */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef TIMER_SERVICE_H_
+#define TIMER_SERVICE_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Free running 1MHz time base on TIMER0.
+ * Timestamps wrap around every ~71 minutes, always compare them with
+ * timer_service_elapsed_us() and never directly.
+ */
+void timer_service_init(uint32_t irq_priority);
+
+uint32_t timer_service_now_us(void);
+
+/**
+ * Modules which poll time in main loop request periodic wakeups, CPU is
+ * woken every TIMER_SERVICE_WAKE_US while at least one request is active.
+ * Requests are counted, every enable must be paired with a disable. Safe
+ * to call from any interrupt and from main loop.
+ */
+#define TIMER_SERVICE_WAKE_US 1000
+
+void timer_service_wake_request(bool enable);
+
+STATIC INLINE uint32_t timer_service_elapsed_us(uint32_t since_us, uint32_t now_us)
+{
+	return now_us - since_us;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_SERVICE_H_ */
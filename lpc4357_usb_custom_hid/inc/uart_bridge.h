@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef UART_BRIDGE_H_
+#define UART_BRIDGE_H_
+
+#include "board.h"
+#include "credit_flow.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * UART to HID bridge. Received bytes are written by GPDMA into a circular
+ * buffer and sent to host in HID_REPORT_ID_UART input reports, a report goes
+ * out when it is full or when oldest pending byte waited flush timeout.
+ * Output reports are queued in a TX ring which GPDMA drains into UART THR.
+ *
+ * Input/Output report payload: [channel][length][credit limit u32][data]
+ *
+ * Both directions are credit flow controlled, see credit_flow.h. Input
+ * reports carry the limit of TX ring bytes host may send, output reports
+ * the limit of bytes host takes, length 0 reports carry only the limit.
+ * Host waits for credit instead of overrunning the TX ring. Received
+ * bytes wait in the RX buffer for host credit, the UART itself can not
+ * be stopped so they are still overwritten if host holds them back for
+ * longer than the buffer lasts.
+ */
+
+#define UART_BRIDGE_NUM_CHANNELS		2
+#define UART_BRIDGE_DEFAULT_BAUD		115200
+#define UART_BRIDGE_DEFAULT_FLUSH_US	2000
+
+/* Data bytes carried by one input or output report */
+#define UART_BRIDGE_REPORT_HEADER_SIZE	7
+#define UART_BRIDGE_REPORT_DATA_SIZE	(HID_REPORT_MAX_SIZE - UART_BRIDGE_REPORT_HEADER_SIZE)
+
+typedef struct {
+	uint32_t rx_bytes;		/* Bytes sent to host */
+	uint32_t tx_bytes;		/* Bytes written to UART */
+	uint32_t rx_reports;
+	uint32_t tx_reports;
+	uint32_t rx_overflow;	/* Bytes overwritten in RX buffer before host read them */
+	uint32_t tx_dropped;	/* Bytes dropped because TX ring was full, host went beyond its credit */
+	uint32_t line_errors;	/* Overrun, parity, framing errors and breaks */
+} uart_bridge_stats_t;
+
+/* Feature report read: [num_channels] then uart_bridge_stats_t of each channel, little endian */
+#define UART_BRIDGE_STATUS_SIZE		(1 + (UART_BRIDGE_NUM_CHANNELS * sizeof(uart_bridge_stats_t)))
+
+void uart_bridge_init(uint32_t irq_priority);
+
+/**
+ * Open channel, allocates two DMA channels. Opening an open channel
+ * applies new settings and clears its buffers.
+ */
+bool uart_bridge_open(uint8_t channel, uint32_t baud, uint32_t flush_us);
+void uart_bridge_close(uint8_t channel);
+
+/**
+ * Queue output report payload for transmission. Called from USB interrupt.
+ */
+void uart_bridge_write(const uint8_t *payload, uint32_t length);
+
+/**
+ * @return	true if main loop has TX work to start.
+ */
+bool uart_bridge_pending(void);
+void uart_bridge_process(void);
+
+bool uart_bridge_get_stats(uint8_t channel, uart_bridge_stats_t *stats);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ * Write: [channel][enable][baud u32][flush_us u16]
+ */
+bool uart_bridge_set_feature(const uint8_t *payload, uint16_t length);
+uint16_t uart_bridge_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UART_BRIDGE_H_ */
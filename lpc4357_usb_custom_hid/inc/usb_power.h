@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef USB_POWER_H_
+#define USB_POWER_H_
+
+#include "app_usbd_cfg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * USB suspend and resume. Input reports keep being queued while the bus
+ * is suspended and the first one stays primed on the interrupt IN
+ * endpoint, the controller sends it on the first IN token after resume
+ * without waiting for firmware. When the host enabled remote wakeup, a
+ * primed report wakes the host up.
+ *
+ * Device is self powered, there is no suspend current budget to meet.
+ * Deep sleep would stop the PLLs and TIMER0 and leave SDRAM without
+ * refresh, and pin interrupts can not wake the M4 from it, so SW2 could
+ * not wake the host. While suspended CPU sleeps between interrupts as
+ * usual and branch clocks of blocks this firmware never uses are gated.
+ */
+
+/* Bus must have been idle for 5 ms before remote wakeup signaling, suspend
+ * is detected after 3 ms of it. */
+#define USB_POWER_WAKEUP_DELAY_US	2000
+
+/* Feature report read: suspended, remote wakeup enabled, 0, 0, usb_power_stats_t, little endian */
+#define USB_POWER_STATUS_SIZE		28
+
+typedef struct {
+	uint32_t suspends;
+	uint32_t resumes;
+	uint32_t wakeups;				/* Remote wakeups signaled */
+	uint32_t wakeup_latency_us;		/* Last remote wakeup until host resumed the bus */
+	uint32_t resume_latency_us;		/* Last resume until the report queued across suspend was taken */
+	uint32_t resume_latency_max_us;
+} usb_power_stats_t;
+
+void usb_power_init(USBD_HANDLE_T hUsb);
+
+/**
+ * Bus events, call from the USB stack callbacks.
+ */
+void usb_power_suspended(void);
+void usb_power_resumed(void);
+void usb_power_reset(void);
+void usb_power_wakeup_cfg(bool enable);
+
+/**
+ * Input report was taken by host, call from USB interrupt context.
+ */
+void usb_power_in_done(void);
+
+bool usb_power_is_suspended(void);
+
+/**
+ * Signals remote wakeup once a report waits and the bus was idle long enough.
+ */
+void usb_power_process(void);
+
+/**
+ * HID feature report glue, payload excludes report ID.
+ */
+uint16_t usb_power_get_feature(uint8_t *payload, uint16_t max_length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* USB_POWER_H_ */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "aes128.h"
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static uint8_t xtime(uint8_t x) {
+	return (uint8_t) ((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+void aes128_set_key(aes128_key_t *key, const uint8_t *bytes) {
+	uint8_t *rk = key->round_key;
+	uint8_t rcon = 0x01, t[4];
+	uint32_t i;
+
+	memcpy(rk, bytes, AES128_KEY_SIZE);
+	for (i = AES128_KEY_SIZE; i < sizeof(key->round_key); i += 4) {
+		memcpy(t, &rk[i - 4], 4);
+		if ((i % AES128_KEY_SIZE) == 0) {
+			// RotWord, SubWord and round constant
+			uint8_t first = t[0];
+			t[0] = sbox[t[1]] ^ rcon;
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[first];
+			rcon = xtime(rcon);
+		}
+		rk[i + 0] = rk[i - 16] ^ t[0];
+		rk[i + 1] = rk[i - 15] ^ t[1];
+		rk[i + 2] = rk[i - 14] ^ t[2];
+		rk[i + 3] = rk[i - 13] ^ t[3];
+	}
+}
+
+static void add_round_key(uint8_t *s, const uint8_t *rk) {
+	uint32_t i;
+
+	for (i = 0; i < AES128_BLOCK_SIZE; i++) {
+		s[i] ^= rk[i];
+	}
+}
+
+/* SubBytes and ShiftRows in one pass, state is column major. */
+static void sub_shift(uint8_t *s) {
+	uint8_t t;
+
+	s[0] = sbox[s[0]];
+	s[4] = sbox[s[4]];
+	s[8] = sbox[s[8]];
+	s[12] = sbox[s[12]];
+
+	t = s[1];
+	s[1] = sbox[s[5]];
+	s[5] = sbox[s[9]];
+	s[9] = sbox[s[13]];
+	s[13] = sbox[t];
+
+	t = s[2];
+	s[2] = sbox[s[10]];
+	s[10] = sbox[t];
+	t = s[6];
+	s[6] = sbox[s[14]];
+	s[14] = sbox[t];
+
+	t = s[15];
+	s[15] = sbox[s[11]];
+	s[11] = sbox[s[7]];
+	s[7] = sbox[s[3]];
+	s[3] = sbox[t];
+}
+
+static void mix_columns(uint8_t *s) {
+	uint8_t a0, a1, a2, a3, all;
+	uint32_t c;
+
+	for (c = 0; c < AES128_BLOCK_SIZE; c += 4) {
+		a0 = s[c];
+		a1 = s[c + 1];
+		a2 = s[c + 2];
+		a3 = s[c + 3];
+		all = a0 ^ a1 ^ a2 ^ a3;
+		s[c] = a0 ^ all ^ xtime(a0 ^ a1);
+		s[c + 1] = a1 ^ all ^ xtime(a1 ^ a2);
+		s[c + 2] = a2 ^ all ^ xtime(a2 ^ a3);
+		s[c + 3] = a3 ^ all ^ xtime(a3 ^ a0);
+	}
+}
+
+void aes128_encrypt(const aes128_key_t *key, const uint8_t *in, uint8_t *out) {
+	const uint8_t *rk = key->round_key;
+	uint32_t round;
+
+	if (out != in) {
+		memcpy(out, in, AES128_BLOCK_SIZE);
+	}
+	add_round_key(out, rk);
+	for (round = 1; round < AES128_ROUNDS; round++) {
+		sub_shift(out);
+		mix_columns(out);
+		add_round_key(out, &rk[round * AES128_BLOCK_SIZE]);
+	}
+	sub_shift(out);
+	add_round_key(out, &rk[AES128_ROUNDS * AES128_BLOCK_SIZE]);
+}
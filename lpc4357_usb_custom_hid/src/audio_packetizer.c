@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "audio_packetizer.h"
+
+void audio_fifo_init(audio_fifo_t *fifo, uint32_t *frames, uint32_t size, uint8_t channels) {
+	memset(fifo, 0, sizeof(*fifo));
+	fifo->frames = frames;
+	fifo->size = size;
+	fifo->channels = channels;
+}
+
+uint32_t audio_fifo_level(const audio_fifo_t *fifo) {
+	return fifo->head - fifo->tail;
+}
+
+uint32_t audio_fifo_write(audio_fifo_t *fifo, const uint32_t *frames, uint32_t count) {
+	uint32_t free = fifo->size - audio_fifo_level(fifo);
+	uint32_t head = fifo->head;
+	uint32_t i;
+
+	if (fifo->overrun) {
+		fifo->stats.overruns += count;
+		return 0;
+	}
+	if (count > free) {
+		fifo->stats.overruns += count - free;
+		fifo->overrun = true;
+		count = free;
+	}
+
+	for (i = 0; i < count; i++) {
+		fifo->frames[(head + i) & (fifo->size - 1)] = frames[i];
+	}
+	fifo->head = head + count;
+	return count;
+}
+
+void audio_fifo_read(audio_fifo_t *fifo, uint32_t *frames, uint32_t count) {
+	uint32_t avail = audio_fifo_level(fifo);
+	uint32_t tail = fifo->tail;
+	uint32_t i, n = (count < avail) ? count : avail;
+
+	for (i = 0; i < n; i++) {
+		frames[i] = fifo->frames[(tail + i) & (fifo->size - 1)];
+	}
+	fifo->tail = tail + n;
+
+	if (n < count) {
+		memset(&frames[n], 0, (count - n) * sizeof(uint32_t));
+		fifo->stats.underruns += count - n;
+	}
+}
+
+bool audio_fifo_slip(audio_fifo_t *fifo, uint32_t high_level) {
+	if (audio_fifo_level(fifo) <= high_level) {
+		return false;
+	}
+	fifo->tail++;
+	fifo->stats.slips++;
+	fifo->discontinuity = true;
+	return true;
+}
+
+uint32_t audio_packet_capacity(uint8_t channels, uint32_t max_len) {
+	if (max_len <= AUDIO_PACKET_HEADER_SIZE) {
+		return 0;
+	}
+	return (max_len - AUDIO_PACKET_HEADER_SIZE) / (channels * 2);
+}
+
+uint32_t audio_packetize(audio_fifo_t *fifo, uint8_t *packet, uint32_t max_len, uint32_t min_frames) {
+	uint32_t count = audio_packet_capacity(fifo->channels, max_len);
+	uint32_t avail = audio_fifo_level(fifo);
+	uint32_t tail = fifo->tail;
+	uint32_t i, frame;
+	uint8_t *p = &packet[AUDIO_PACKET_HEADER_SIZE];
+
+	if (count > 0xFF) {
+		count = 0xFF;
+	}
+	if (fifo->overrun && (avail == 0)) {
+		// Gap reached, producer resumes and next packet carries the flag.
+		fifo->overrun = false;
+		fifo->discontinuity = true;
+	}
+	if ((avail == 0) || (avail < min_frames)) {
+		return 0;
+	}
+	if (count > avail) {
+		count = avail;
+	}
+
+	for (i = 0; i < count; i++) {
+		frame = fifo->frames[(tail + i) & (fifo->size - 1)];
+		*p++ = frame & 0xFF;
+		*p++ = (frame >> 8) & 0xFF;
+		if (fifo->channels == 2) {
+			*p++ = (frame >> 16) & 0xFF;
+			*p++ = frame >> 24;
+		}
+	}
+	fifo->tail = tail + count;
+
+	packet[0] = fifo->seq & 0xFF;
+	packet[1] = fifo->seq >> 8;
+	packet[2] = count;
+	packet[3] = fifo->discontinuity ? AUDIO_FLAG_DISCONTINUITY : 0;
+	fifo->discontinuity = false;
+	fifo->seq++;
+	fifo->stats.packets++;
+	return p - packet;
+}
+
+uint32_t audio_depacketize(audio_fifo_t *fifo, const uint8_t *packet, uint32_t length) {
+	uint32_t i, count, free, head, frame;
+	uint16_t seq;
+	const uint8_t *p = &packet[AUDIO_PACKET_HEADER_SIZE];
+
+	if (length < AUDIO_PACKET_HEADER_SIZE) {
+		return 0;
+	}
+	seq = packet[0] | (packet[1] << 8);
+	count = packet[2];
+	if (AUDIO_PACKET_HEADER_SIZE + (count * fifo->channels * 2) > length) {
+		return 0;
+	}
+
+	if (fifo->expect_seq && (seq != fifo->seq)) {
+		fifo->stats.lost_packets += (uint16_t) (seq - fifo->seq);
+	}
+	fifo->seq = seq + 1;
+	fifo->expect_seq = true;
+	fifo->stats.packets++;
+
+	free = fifo->size - audio_fifo_level(fifo);
+	if (count > free) {
+		fifo->stats.overruns += count - free;
+		count = free;
+	}
+
+	head = fifo->head;
+	for (i = 0; i < count; i++, p += fifo->channels * 2) {
+		frame = p[0] | (p[1] << 8);
+		// Mono packets feed both I2S channels.
+		frame |= (fifo->channels == 2) ? ((uint32_t) (p[2] | (p[3] << 8)) << 16) : (frame << 16);
+		fifo->frames[(head + i) & (fifo->size - 1)] = frame;
+	}
+	fifo->head = head + count;
+	return count;
+}
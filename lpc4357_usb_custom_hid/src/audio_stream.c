@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "hid_generic.h"
+#include "dma_service.h"
+#include "drift_estimator.h"
+#include "byte_order.h"
+#include "audio_stream.h"
+
+/* Frames per DMA half buffer and per FIFO, FIFO size is a power of 2 */
+#define HALF_FRAMES			32
+#define FIFO_FRAMES			256
+
+/* Capture drops frames above this level, playback steers its level to target */
+#define CAPTURE_HIGH_LEVEL	(FIFO_FRAMES * 3 / 4)
+#define PLAYBACK_TARGET		(FIFO_FRAMES / 2)
+
+/* Frames per report a format must leave unused, covers clock drift and jitter */
+#define RATE_HEADROOM		2
+
+#define DMA_REQ_LINE_I2S0_TX	9	/* I2S0 DMA request 1 */
+#define DMA_REQ_LINE_I2S0_RX	10	/* I2S0 DMA request 2 */
+#define DMA_REQ_FUNC_I2S		1
+
+/* I2S0 pins. Board has no codec, these land on expansion header. RX SCK and
+ * WS are taken from transmitter in 4 pin mode. P3_1/P3_2 would be shorter but
+ * belong to CAN gateway. */
+static const PINMUX_GRP_T i2s_pins[] = {
+	{0x3, 0, (SCU_MODE_INACT | SCU_MODE_FUNC2)},						/* I2S0_TX_SCK */
+	{0x7, 1, (SCU_MODE_INACT | SCU_MODE_FUNC2)},						/* I2S0_TX_WS */
+	{0x7, 2, (SCU_MODE_INACT | SCU_MODE_FUNC2)},						/* I2S0_TX_SDA */
+	{0x6, 2, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_FUNC3)},	/* I2S0_RX_SDA */
+};
+
+typedef struct {
+	int dma;
+	DMA_TransferDescriptor_t lli[2];
+	uint32_t buffer[2][HALF_FRAMES];
+	audio_fifo_t fifo;
+	uint32_t fifo_frames[FIFO_FRAMES];
+	drift_estimator_t drift;
+} audio_direction_t;
+
+static audio_direction_t capture;
+static audio_direction_t playback;
+
+static uint8_t directions;
+static uint8_t channels;
+static uint32_t rate;
+static bool playback_primed;
+
+/* USB frame counter extended to 32 bit, in microseconds */
+static uint32_t usb_frame;
+static uint32_t usb_time_ms;
+
+/* Called from DMA interrupt only, at least every 2 s while streaming. */
+static uint32_t usb_time_us(void) {
+	// Full speed frame number is in FRINDEX bits 13:3.
+	uint32_t frame = (LPC_USB1->FRINDEX_D >> 3) & 0x7FF;
+
+	usb_time_ms += (frame - usb_frame) & 0x7FF;
+	usb_frame = frame;
+	return usb_time_ms * 1000;
+}
+
+/* @return	Half buffer DMA just finished with. */
+static uint32_t finished_half(const audio_direction_t *dir) {
+	// LLI points to descriptor after the running one, which is the finished half.
+	return (dma_service_next_lli(dir->dma) == (uint32_t) &dir->lli[1]) ? 1 : 0;
+}
+
+static void capture_dma_done(uint8_t dma_ch, bool error) {
+	uint32_t half = finished_half(&capture);
+
+	audio_fifo_write(&capture.fifo, capture.buffer[half], HALF_FRAMES);
+	drift_estimator_update(&capture.drift, HALF_FRAMES, usb_time_us());
+}
+
+static void playback_dma_done(uint8_t dma_ch, bool error) {
+	uint32_t half = finished_half(&playback);
+
+	// Output silence until host has filled FIFO to target, startup is no underrun.
+	if (!playback_primed && (audio_fifo_level(&playback.fifo) >= PLAYBACK_TARGET)) {
+		playback_primed = true;
+	}
+	if (playback_primed) {
+		audio_fifo_read(&playback.fifo, playback.buffer[half], HALF_FRAMES);
+	}
+	else {
+		memset(playback.buffer[half], 0, sizeof(playback.buffer[half]));
+	}
+	drift_estimator_update(&playback.drift, HALF_FRAMES, usb_time_us());
+}
+
+/* IN report producer, sends whatever capture frames are queued. */
+static uint32_t audio_in_source(uint8_t *report) {
+	uint32_t length;
+
+	if (!(directions & AUDIO_STREAM_CAPTURE)) {
+		return 0;
+	}
+
+	audio_fifo_slip(&capture.fifo, CAPTURE_HIGH_LEVEL);
+	length = audio_packetize(&capture.fifo, &report[1], AUDIO_STREAM_PACKET_SIZE, 1);
+	if (length == 0) {
+		return 0;
+	}
+	report[0] = HID_REPORT_ID_AUDIO;
+	return HID_AUDIO_REPORT_SIZE;
+}
+
+static void dma_prepare(audio_direction_t *dir, bool tx) {
+	uint32_t i;
+
+	for (i = 0; i < 2; i++) {
+		dir->lli[i].src = tx ? (uint32_t) dir->buffer[i] : (uint32_t) &LPC_I2S0->RXFIFO;
+		dir->lli[i].dst = tx ? (uint32_t) &LPC_I2S0->TXFIFO : (uint32_t) dir->buffer[i];
+		dir->lli[i].lli = (uint32_t) &dir->lli[i ^ 1];
+		dir->lli[i].ctrl = GPDMA_DMACCxControl_TransferSize(HALF_FRAMES) |
+						   GPDMA_DMACCxControl_SBSize(GPDMA_BSIZE_4) |
+						   GPDMA_DMACCxControl_DBSize(GPDMA_BSIZE_4) |
+						   GPDMA_DMACCxControl_SWidth(GPDMA_WIDTH_WORD) |
+						   GPDMA_DMACCxControl_DWidth(GPDMA_WIDTH_WORD) |
+						   (tx ? GPDMA_DMACCxControl_SI : GPDMA_DMACCxControl_DI) |
+						   GPDMA_DMACCxControl_I;
+	}
+	memset(dir->buffer, 0, sizeof(dir->buffer));
+	audio_fifo_init(&dir->fifo, dir->fifo_frames, FIFO_FRAMES, channels);
+	drift_estimator_init(&dir->drift, rate);
+}
+
+void audio_stream_init(void) {
+	capture.dma = -1;
+	playback.dma = -1;
+	directions = 0;
+	hid_in_add_source(audio_in_source);
+}
+
+static bool claim_lines(void) {
+	if (!dma_service_claim_request(DMA_REQ_LINE_I2S0_TX, DMA_REQ_FUNC_I2S)) {
+		return false;
+	}
+	if (!dma_service_claim_request(DMA_REQ_LINE_I2S0_RX, DMA_REQ_FUNC_I2S)) {
+		dma_service_release_request(DMA_REQ_LINE_I2S0_TX);
+		return false;
+	}
+	return true;
+}
+
+bool audio_stream_start(uint8_t new_directions, uint32_t new_rate, uint8_t new_channels) {
+	I2S_AUDIO_FORMAT_T format;
+	uint32_t capacity;
+
+	new_directions &= AUDIO_STREAM_CAPTURE | AUDIO_STREAM_PLAYBACK;
+	if ((new_directions == 0) || (new_rate == 0) || ((new_channels != 1) && (new_channels != 2))) {
+		return false;
+	}
+	capacity = audio_packet_capacity(new_channels, AUDIO_STREAM_PACKET_SIZE);
+	if (new_rate > ((capacity - RATE_HEADROOM) * 1000)) {
+		return false;
+	}
+
+	audio_stream_stop();
+
+	if (new_directions & AUDIO_STREAM_CAPTURE) {
+		capture.dma = dma_service_alloc(capture_dma_done, true);
+	}
+	if (new_directions & AUDIO_STREAM_PLAYBACK) {
+		playback.dma = dma_service_alloc(playback_dma_done, true);
+	}
+	if (((new_directions & AUDIO_STREAM_CAPTURE) && (capture.dma < 0)) ||
+		((new_directions & AUDIO_STREAM_PLAYBACK) && (playback.dma < 0)) || !claim_lines()) {
+		if (capture.dma >= 0) {
+			dma_service_free(capture.dma);
+		}
+		if (playback.dma >= 0) {
+			dma_service_free(playback.dma);
+		}
+		capture.dma = playback.dma = -1;
+		return false;
+	}
+
+	rate = new_rate;
+	channels = new_channels;
+	playback_primed = false;
+	usb_frame = (LPC_USB1->FRINDEX_D >> 3) & 0x7FF;
+	usb_time_ms = 0;
+
+	Chip_SCU_SetPinMuxing(i2s_pins, sizeof(i2s_pins) / sizeof(PINMUX_GRP_T));
+
+	// I2S always carries stereo words, mono streams use left channel only.
+	format.SampleRate = rate;
+	format.ChannelNumber = 2;
+	format.WordWidth = 16;
+	Chip_I2S_Init(LPC_I2S0);
+	Chip_I2S_TxConfig(LPC_I2S0, &format);
+	Chip_I2S_RxConfig(LPC_I2S0, &format);
+	Chip_I2S_RxModeConfig(LPC_I2S0, I2S_RXMODE_CLKSEL(0), I2S_RXMODE_4PIN_ENABLE, 0);
+
+	// Transmitter always runs since it clocks the receiver, without
+	// playback it shifts out zeros left in TX FIFO.
+	if (new_directions & AUDIO_STREAM_PLAYBACK) {
+		dma_prepare(&playback, true);
+		Chip_I2S_DMA_TxCmd(LPC_I2S0, I2S_DMA_REQUEST_CHANNEL_1, ENABLE, 4);
+		dma_service_start(playback.dma, &playback.lli[0],
+						  GPDMA_DMACCxConfig_DestPeripheral(DMA_REQ_LINE_I2S0_TX) |
+						  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA));
+	}
+	if (new_directions & AUDIO_STREAM_CAPTURE) {
+		dma_prepare(&capture, false);
+		Chip_I2S_DMA_RxCmd(LPC_I2S0, I2S_DMA_REQUEST_CHANNEL_2, ENABLE, 4);
+		dma_service_start(capture.dma, &capture.lli[0],
+						  GPDMA_DMACCxConfig_SrcPeripheral(DMA_REQ_LINE_I2S0_RX) |
+						  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_P2M_CONTROLLER_DMA));
+	}
+
+	directions = new_directions;
+	Chip_I2S_TxStart(LPC_I2S0);
+	if (directions & AUDIO_STREAM_CAPTURE) {
+		Chip_I2S_RxStart(LPC_I2S0);
+	}
+	return true;
+}
+
+void audio_stream_stop(void) {
+	if (directions == 0) {
+		return;
+	}
+
+	directions = 0;
+	Chip_I2S_TxStop(LPC_I2S0);
+	Chip_I2S_RxStop(LPC_I2S0);
+	if (capture.dma >= 0) {
+		dma_service_free(capture.dma);
+	}
+	if (playback.dma >= 0) {
+		dma_service_free(playback.dma);
+	}
+	capture.dma = playback.dma = -1;
+	dma_service_release_request(DMA_REQ_LINE_I2S0_TX);
+	dma_service_release_request(DMA_REQ_LINE_I2S0_RX);
+	Chip_I2S_DeInit(LPC_I2S0);
+}
+
+void audio_stream_write(const uint8_t *payload, uint32_t length) {
+	if (directions & AUDIO_STREAM_PLAYBACK) {
+		audio_depacketize(&playback.fifo, payload, length);
+	}
+}
+
+void audio_stream_get_status(audio_stream_status_t *status) {
+	memset(status, 0, sizeof(*status));
+	status->directions = directions;
+	status->channels = channels;
+	status->rate = rate;
+	if (directions & AUDIO_STREAM_CAPTURE) {
+		status->capture_level = audio_fifo_level(&capture.fifo);
+		status->capture_ppm = drift_estimator_ppm(&capture.drift);
+		status->capture = capture.fifo.stats;
+	}
+	if (directions & AUDIO_STREAM_PLAYBACK) {
+		status->playback_level = audio_fifo_level(&playback.fifo);
+		status->playback_ppm = drift_estimator_ppm(&playback.drift);
+		status->feedback = drift_estimator_feedback(&playback.drift, status->playback_level, PLAYBACK_TARGET);
+		status->playback = playback.fifo.stats;
+	}
+}
+
+bool audio_stream_set_feature(const uint8_t *payload, uint16_t length) {
+	if (length < 6) {
+		return false;
+	}
+
+	if (payload[0] == 0) {
+		audio_stream_stop();
+		return true;
+	}
+	return audio_stream_start(payload[0], get_u32(&payload[2]), payload[1]);
+}
+
+uint16_t audio_stream_get_feature(uint8_t *payload, uint16_t max_length) {
+	audio_stream_status_t status;
+	const uint32_t *counters;
+	uint32_t i, offset = 22;
+
+	if (max_length < AUDIO_STREAM_STATUS_SIZE) {
+		return 0;
+	}
+
+	audio_stream_get_status(&status);
+	payload[0] = status.directions;
+	payload[1] = status.channels;
+	put_u32(&payload[2], status.rate);
+	payload[6] = status.capture_level & 0xFF;
+	payload[7] = status.capture_level >> 8;
+	payload[8] = status.playback_level & 0xFF;
+	payload[9] = status.playback_level >> 8;
+	put_u32(&payload[10], status.feedback);
+	put_u32(&payload[14], (uint32_t) status.capture_ppm);
+	put_u32(&payload[18], (uint32_t) status.playback_ppm);
+
+	counters = (const uint32_t *) &status.capture;
+	for (i = 0; i < sizeof(audio_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	counters = (const uint32_t *) &status.playback;
+	for (i = 0; i < sizeof(audio_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return AUDIO_STREAM_STATUS_SIZE;
+}
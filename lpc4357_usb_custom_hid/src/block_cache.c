@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "block_cache.h"
+
+/* Blocks loaded past the requested range on a read miss of unmapped media */
+#define BLOCK_CACHE_READ_AHEAD_BLOCKS	32
+
+static uint32_t line_base(const block_cache_t *cache, uint32_t offset) {
+	return offset & ~(cache->media->line_size - 1);
+}
+
+static bool block_valid(const block_cache_line_t *line, uint32_t block) {
+	return (line->valid[block / 32] & (1UL << (block % 32))) != 0;
+}
+
+static void set_valid(block_cache_line_t *line, uint32_t first, uint32_t last) {
+	for (; first <= last; first++) {
+		line->valid[first / 32] |= 1UL << (first % 32);
+	}
+}
+
+static void touch(block_cache_t *cache, block_cache_line_t *line) {
+	line->last_use = ++cache->clock;
+}
+
+static block_cache_line_t *find_line(block_cache_t *cache, uint32_t base) {
+	uint32_t i;
+
+	for (i = 0; i < cache->num_lines; i++) {
+		if (cache->lines[i].offset == base) {
+			return &cache->lines[i];
+		}
+	}
+	return NULL;
+}
+
+/* Load invalid blocks first..last from media, consecutive ones with one read. */
+static bool fill_blocks(block_cache_t *cache, block_cache_line_t *line, uint32_t first, uint32_t last) {
+	const block_media_t *media = cache->media;
+	uint32_t run, offset, length;
+
+	while (first <= last) {
+		if (block_valid(line, first)) {
+			first++;
+			continue;
+		}
+		for (run = first; (run < last) && !block_valid(line, run + 1); run++) {}
+
+		offset = first * BLOCK_CACHE_BLOCK_SIZE;
+		length = (run - first + 1) * BLOCK_CACHE_BLOCK_SIZE;
+		if (media->map != NULL) {
+			memcpy(&line->data[offset], media->map(media->ctx, line->offset + offset), length);
+		}
+		else if (!media->read(media->ctx, line->offset + offset, &line->data[offset], length)) {
+			cache->stats.errors++;
+			return false;
+		}
+		cache->stats.fills += run - first + 1;
+		set_valid(line, first, run);
+		first = run + 1;
+	}
+	return true;
+}
+
+static bool fill_line(block_cache_t *cache, block_cache_line_t *line) {
+	return fill_blocks(cache, line, 0, (cache->media->line_size / BLOCK_CACHE_BLOCK_SIZE) - 1);
+}
+
+/* Failed lines are dropped, retrying a worn out sector forever helps nobody.
+ * Dirty is cleared before programming so a write meanwhile sets it again. */
+static bool write_back(block_cache_t *cache, block_cache_line_t *line) {
+	const block_media_t *media = cache->media;
+	bool ok;
+
+	ok = fill_line(cache, line);
+	if (ok) {
+		line->dirty = false;
+		line->flushing = true;
+		ok = media->write_line(media->ctx, line->offset, line->data);
+		line->flushing = false;
+	}
+	if (ok) {
+		cache->stats.write_backs++;
+	}
+	else {
+		cache->stats.errors++;
+		line->offset = BLOCK_CACHE_NO_LINE;
+		line->dirty = false;
+	}
+	return ok;
+}
+
+/* Free line first, then least recently used clean one, dirty ones only if allowed. */
+static block_cache_line_t *alloc_line(block_cache_t *cache, uint32_t base, bool evict_dirty) {
+	block_cache_line_t *line, *clean = NULL, *dirty = NULL;
+	uint32_t i;
+
+	for (i = 0; i < cache->num_lines; i++) {
+		line = &cache->lines[i];
+		if (line->offset == BLOCK_CACHE_NO_LINE) {
+			clean = line;
+			break;
+		}
+		if (line->flushing) {
+			continue;
+		}
+		if (line->dirty) {
+			if ((dirty == NULL) || (line->last_use < dirty->last_use)) {
+				dirty = line;
+			}
+		}
+		else if ((clean == NULL) || (line->last_use < clean->last_use)) {
+			clean = line;
+		}
+	}
+
+	line = clean;
+	if (line == NULL) {
+		if (!evict_dirty || (dirty == NULL)) {
+			return NULL;
+		}
+		line = dirty;
+		write_back(cache, line);
+	}
+
+	line->offset = base;
+	line->dirty = false;
+	memset(line->valid, 0, sizeof(line->valid));
+	touch(cache, line);
+	return line;
+}
+
+static bool in_range(const block_cache_t *cache, uint32_t offset, uint32_t length) {
+	return (length > 0) && (offset < cache->media->size) && (length <= (cache->media->size - offset));
+}
+
+/* Read range within a single line. */
+static const uint8_t *read_line(block_cache_t *cache, uint32_t offset, uint32_t length, uint8_t *buffer) {
+	const block_media_t *media = cache->media;
+	uint32_t base = line_base(cache, offset);
+	uint32_t first = (offset - base) / BLOCK_CACHE_BLOCK_SIZE;
+	uint32_t last = (offset - base + length - 1) / BLOCK_CACHE_BLOCK_SIZE;
+	uint32_t ahead = MIN(last + BLOCK_CACHE_READ_AHEAD_BLOCKS, (media->line_size / BLOCK_CACHE_BLOCK_SIZE) - 1);
+	uint32_t i;
+	block_cache_line_t *line;
+
+	line = find_line(cache, base);
+	if (line != NULL) {
+		touch(cache, line);
+		for (i = first; (i <= last) && block_valid(line, i); i++) {}
+		if (i > last) {
+			cache->stats.read_hits++;
+		}
+		else {
+			cache->stats.read_misses++;
+			if (!fill_blocks(cache, line, first, (media->map != NULL) ? last : ahead)) {
+				return NULL;
+			}
+		}
+		return &line->data[offset - base];
+	}
+
+	if (media->map != NULL) {
+		cache->stats.read_direct++;
+		return media->map(media->ctx, offset);
+	}
+
+	cache->stats.read_misses++;
+	line = alloc_line(cache, base, false);
+	if (line != NULL) {
+		if (!fill_blocks(cache, line, first, ahead)) {
+			line->offset = BLOCK_CACHE_NO_LINE;
+			return NULL;
+		}
+		return &line->data[offset - base];
+	}
+
+	// All lines dirty, read around the cache.
+	if (!media->read(media->ctx, offset, buffer, length)) {
+		cache->stats.errors++;
+		return NULL;
+	}
+	return buffer;
+}
+
+/* Fill blocks only partially covered by range so the rest of them survives. */
+static bool fill_edges(block_cache_t *cache, block_cache_line_t *line, uint32_t start, uint32_t end) {
+	uint32_t first = start / BLOCK_CACHE_BLOCK_SIZE;
+	uint32_t last = (end - 1) / BLOCK_CACHE_BLOCK_SIZE;
+
+	if ((start % BLOCK_CACHE_BLOCK_SIZE) && !fill_blocks(cache, line, first, first)) {
+		return false;
+	}
+	if ((end % BLOCK_CACHE_BLOCK_SIZE) && !fill_blocks(cache, line, last, last)) {
+		return false;
+	}
+	return true;
+}
+
+bool block_cache_init(block_cache_t *cache, const block_media_t *media, uint8_t *line_memory,
+		uint32_t num_lines) {
+	uint32_t i, line_size = media->line_size;
+
+	memset(cache, 0, sizeof(*cache));
+	if ((line_size < BLOCK_CACHE_BLOCK_SIZE) ||
+		(line_size > (BLOCK_CACHE_MAX_LINE_BLOCKS * BLOCK_CACHE_BLOCK_SIZE)) ||
+		(line_size & (line_size - 1)) || (media->size % line_size) ||
+		(num_lines == 0) || (num_lines > BLOCK_CACHE_MAX_LINES) ||
+		(media->write_line == NULL) || ((media->map == NULL) && (media->read == NULL))) {
+		return false;
+	}
+
+	cache->media = media;
+	cache->num_lines = num_lines;
+	for (i = 0; i < num_lines; i++) {
+		cache->lines[i].data = &line_memory[i * line_size];
+		cache->lines[i].offset = BLOCK_CACHE_NO_LINE;
+	}
+	return true;
+}
+
+const uint8_t *block_cache_read(block_cache_t *cache, uint32_t offset, uint32_t length, uint8_t *buffer) {
+	const uint8_t *data;
+	uint32_t piece, pos;
+
+	if (!in_range(cache, offset, length)) {
+		return NULL;
+	}
+	if (line_base(cache, offset) == line_base(cache, offset + length - 1)) {
+		return read_line(cache, offset, length, buffer);
+	}
+
+	for (pos = 0; pos < length; pos += piece) {
+		piece = MIN(length - pos, cache->media->line_size - ((offset + pos) & (cache->media->line_size - 1)));
+		data = read_line(cache, offset + pos, piece, &buffer[pos]);
+		if (data == NULL) {
+			return NULL;
+		}
+		if (data != &buffer[pos]) {
+			memcpy(&buffer[pos], data, piece);
+		}
+	}
+	return buffer;
+}
+
+uint8_t *block_cache_write_buffer(block_cache_t *cache, uint32_t offset, uint32_t length,
+		bool evict_dirty) {
+	uint32_t base = line_base(cache, offset);
+	block_cache_line_t *line;
+
+	if (!in_range(cache, offset, length) || (base != line_base(cache, offset + length - 1))) {
+		return NULL;
+	}
+
+	line = find_line(cache, base);
+	if (line == NULL) {
+		line = alloc_line(cache, base, evict_dirty);
+		if (line == NULL) {
+			return NULL;
+		}
+	}
+	touch(cache, line);
+	if (!fill_edges(cache, line, offset - base, offset - base + length)) {
+		return NULL;
+	}
+	return &line->data[offset - base];
+}
+
+bool block_cache_write(block_cache_t *cache, uint32_t offset, const uint8_t *data, uint32_t length,
+		uint32_t now, bool evict_dirty) {
+	block_cache_line_t *line;
+	uint32_t base, start, piece;
+	uint8_t *dst;
+
+	if (!in_range(cache, offset, length)) {
+		return false;
+	}
+
+	while (length > 0) {
+		base = line_base(cache, offset);
+		start = offset - base;
+		piece = MIN(length, cache->media->line_size - start);
+
+		line = find_line(cache, base);
+		if (line != NULL) {
+			cache->stats.write_hits++;
+		}
+		else {
+			line = alloc_line(cache, base, evict_dirty);
+			if (line == NULL) {
+				return false;
+			}
+			cache->stats.write_allocs++;
+		}
+
+		dst = &line->data[start];
+		if (dst != data) {
+			if (!fill_edges(cache, line, start, start + piece)) {
+				return false;
+			}
+			memcpy(dst, data, piece);
+		}
+		set_valid(line, start / BLOCK_CACHE_BLOCK_SIZE, (start + piece - 1) / BLOCK_CACHE_BLOCK_SIZE);
+		line->dirty = true;
+		line->last_write = now;
+		touch(cache, line);
+
+		offset += piece;
+		data += piece;
+		length -= piece;
+	}
+	return true;
+}
+
+block_cache_line_t *block_cache_flush_begin(block_cache_t *cache, uint32_t now, uint32_t idle) {
+	block_cache_line_t *line, *oldest = NULL;
+	uint32_t i, age, oldest_age = 0;
+
+	for (i = 0; i < cache->num_lines; i++) {
+		line = &cache->lines[i];
+		if (!line->dirty) {
+			continue;
+		}
+		age = now - line->last_write;
+		if ((age >= idle) && ((oldest == NULL) || (age > oldest_age))) {
+			oldest = line;
+			oldest_age = age;
+		}
+	}
+
+	if ((oldest != NULL) && !fill_line(cache, oldest)) {
+		oldest->offset = BLOCK_CACHE_NO_LINE;
+		oldest->dirty = false;
+		return NULL;
+	}
+	return oldest;
+}
+
+bool block_cache_flush_line(block_cache_t *cache, block_cache_line_t *line) {
+	return write_back(cache, line);
+}
+
+bool block_cache_flush(block_cache_t *cache, uint32_t now, uint32_t idle) {
+	block_cache_line_t *line = block_cache_flush_begin(cache, now, idle);
+
+	if (line == NULL) {
+		return false;
+	}
+	block_cache_flush_line(cache, line);
+	return true;
+}
+
+bool block_cache_sync(block_cache_t *cache) {
+	uint32_t i;
+	bool ok = true;
+
+	for (i = 0; i < cache->num_lines; i++) {
+		if (cache->lines[i].dirty) {
+			ok = write_back(cache, &cache->lines[i]) && ok;
+		}
+	}
+	return ok;
+}
+
+bool block_cache_dirty(const block_cache_t *cache) {
+	uint32_t i;
+
+	for (i = 0; i < cache->num_lines; i++) {
+		if (cache->lines[i].dirty) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void block_cache_invalidate(block_cache_t *cache) {
+	uint32_t i;
+
+	for (i = 0; i < cache->num_lines; i++) {
+		cache->lines[i].offset = BLOCK_CACHE_NO_LINE;
+		cache->lines[i].dirty = false;
+	}
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "spifi_flash.h"
+#include "timer_service.h"
+#include "init_stages.h"
+#include "byte_order.h"
+#include "boot_stages.h"
+
+#define BOOT_CYCLES_PER_US		(MAX_CLOCK_FREQ / 1000000)
+
+static init_stages_t stages;
+static uint32_t main_us;
+static uint32_t connect_us;
+
+/* Cycle counter time when timer_service read zero */
+static uint32_t timer_offset_us;
+static bool timer_running;
+
+static uint32_t boot_now_us(void) {
+	if (timer_running) {
+		return timer_offset_us + timer_service_now_us();
+	}
+	return DWT->CYCCNT / BOOT_CYCLES_PER_US;
+}
+
+static bool init_sdram(void *ctx) {
+	board_init_sdram();
+	return true;
+}
+
+static bool init_spifi(void *ctx) {
+	// Hangs on a flash that does not answer, as it did from SystemInit.
+	spifi_flash_init();
+	spifi_flash_memmap();
+	return true;
+}
+
+/* Runs from main loop right after connect, long before the host can open
+ * UART bridge channel 1 which shares P1_15 and P1_16 with RMII. */
+static bool init_eth_phy(void *ctx) {
+	return board_init_eth_phy();
+}
+
+static const init_stage_def_t boot_defs[BOOT_STAGES] = {
+	[BOOT_STAGE_SDRAM]		= { init_sdram, 0, true },
+	[BOOT_STAGE_SPIFI]		= { init_spifi, 0, true },
+	[BOOT_STAGE_ETH_PHY]	= { init_eth_phy, 0, true },
+};
+
+void boot_stages_start_clock(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void boot_stages_init(void) {
+	timer_running = false;
+	main_us = boot_now_us();
+	connect_us = 0;
+	init_stages_init(&stages, boot_defs, BOOT_STAGES, boot_now_us, NULL);
+}
+
+void boot_stages_timer_started(void) {
+	timer_offset_us = boot_now_us() - timer_service_now_us();
+	timer_running = true;
+}
+
+bool boot_stage_require(uint32_t stage) {
+	return init_stages_require(&stages, stage);
+}
+
+void boot_stages_usb_connected(void) {
+	connect_us = boot_now_us();
+}
+
+bool boot_stages_pending(void) {
+	return init_stages_pending(&stages);
+}
+
+void boot_stages_process(void) {
+	init_stages_process(&stages);
+}
+
+uint16_t boot_stages_get_feature(uint8_t *payload, uint16_t max_length) {
+	const init_stage_status_t *status;
+	uint32_t i, offset = 12;
+
+	if (max_length < BOOT_STATUS_SIZE) {
+		return 0;
+	}
+
+	memset(payload, 0, BOOT_STATUS_SIZE);
+	payload[0] = BOOT_STAGES;
+	put_u32(&payload[4], main_us);
+	put_u32(&payload[8], connect_us);
+
+	for (i = 0; i < BOOT_STAGES; i++, offset += 12) {
+		status = &stages.status[i];
+		payload[offset] = status->state;
+		payload[offset + 1] = status->on_demand;
+		put_u32(&payload[offset + 4], status->start_us);
+		put_u32(&payload[offset + 8], status->duration_us);
+	}
+	return BOOT_STATUS_SIZE;
+}
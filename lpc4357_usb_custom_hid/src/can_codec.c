@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "ring_buffer.h"
+#include "byte_order.h"
+#include "can_codec.h"
+
+/* Ring sizes must be power of 2 */
+#define RX_RING_SIZE 64
+#define TX_RING_SIZE 32
+
+static can_frame_t rx_frames[RX_RING_SIZE];
+static can_frame_t tx_frames[TX_RING_SIZE];
+static RINGBUFF_T rx_ring;
+static RINGBUFF_T tx_ring;
+
+static can_codec_stats_t stats;
+static uint32_t lost_reported;
+
+/* Data bytes carried on the wire, remote frames have DLC but no data. */
+static uint8_t data_length(uint32_t id, uint8_t dlc) {
+	if (id & CAN_ID_FLAG_RTR) {
+		return 0;
+	}
+	return (dlc > 8) ? 8 : dlc;
+}
+
+void can_codec_init(void) {
+	RingBuffer_Init(&rx_ring, rx_frames, sizeof(can_frame_t), RX_RING_SIZE);
+	RingBuffer_Init(&tx_ring, tx_frames, sizeof(can_frame_t), TX_RING_SIZE);
+	memset(&stats, 0, sizeof(stats));
+	lost_reported = 0;
+}
+
+bool can_codec_push_rx(const can_frame_t *frame) {
+	stats.rx_frames++;
+	if (RingBuffer_Insert(&rx_ring, frame) == 0) {
+		stats.rx_overflow++;
+		return false;
+	}
+	return true;
+}
+
+bool can_codec_rx_pending(void) {
+	return !RingBuffer_IsEmpty(&rx_ring);
+}
+
+uint32_t can_codec_fill_report(uint8_t *payload, uint32_t max_len) {
+	const can_frame_t *frame;
+	uint32_t count = 0, offset = CAN_REPORT_HEADER_SIZE, lost;
+	uint8_t len;
+
+	if (max_len < CAN_REPORT_HEADER_SIZE) {
+		return 0;
+	}
+
+	// Frames are read in place and popped only once they fit.
+	while (!RingBuffer_IsEmpty(&rx_ring) && (count < 0xFF)) {
+		frame = &rx_frames[RB_VTAIL(&rx_ring) & (RX_RING_SIZE - 1)];
+		len = data_length(frame->id, frame->dlc);
+		if (offset + CAN_RX_RECORD_SIZE(len) > max_len) {
+			break;
+		}
+
+		put_u32(&payload[offset], frame->timestamp_us);
+		put_u32(&payload[offset + 4], frame->id);
+		payload[offset + 8] = frame->dlc;
+		memcpy(&payload[offset + 9], frame->data, len);
+		offset += CAN_RX_RECORD_SIZE(len);
+		count++;
+
+		RB_VTAIL(&rx_ring)++;
+	}
+
+	lost = stats.rx_overflow - lost_reported;
+	if ((count == 0) && (lost == 0)) {
+		return 0;
+	}
+
+	payload[0] = count;
+	payload[1] = (lost > 0xFF) ? 0xFF : lost;
+	lost_reported += payload[1];
+	return offset;
+}
+
+uint32_t can_codec_queue_tx(const uint8_t *payload, uint32_t length) {
+	can_frame_t frame;
+	uint32_t i, count, offset = 1, queued = 0;
+	uint8_t len;
+
+	if (length < 1) {
+		stats.tx_malformed++;
+		return 0;
+	}
+
+	count = payload[0];
+	for (i = 0; i < count; i++) {
+		if (offset + CAN_TX_RECORD_SIZE(0) > length) {
+			stats.tx_malformed++;
+			break;
+		}
+
+		memset(&frame, 0, sizeof(frame));
+		frame.id = get_u32(&payload[offset]);
+		frame.dlc = payload[offset + 4];
+		len = data_length(frame.id, frame.dlc);
+		if ((frame.dlc > 8) || (offset + CAN_TX_RECORD_SIZE(len) > length)) {
+			stats.tx_malformed++;
+			break;
+		}
+		memcpy(frame.data, &payload[offset + 5], len);
+		offset += CAN_TX_RECORD_SIZE(len);
+
+		if (RingBuffer_Insert(&tx_ring, &frame) == 0) {
+			stats.tx_overflow++;
+		}
+		else {
+			stats.tx_frames++;
+			queued++;
+		}
+	}
+	return queued;
+}
+
+bool can_codec_pop_tx(can_frame_t *frame) {
+	return RingBuffer_Pop(&tx_ring, frame) != 0;
+}
+
+bool can_codec_tx_pending(void) {
+	return !RingBuffer_IsEmpty(&tx_ring);
+}
+
+const can_codec_stats_t *can_codec_get_stats(void) {
+	return &stats;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "can_codec.h"
+#include "can_filter.h"
+
+static uint32_t id_mask(uint32_t id) {
+	return (id & CAN_ID_FLAG_EXT) ? CAN_ID_EXT_MASK : CAN_ID_STD_MASK;
+}
+
+/* Normalize so that id holds only bits covered by mask. */
+static can_filter_t normalize(const can_filter_t *f) {
+	can_filter_t n;
+
+	n.mask = f->mask & id_mask(f->id);
+	n.id = (f->id & n.mask) | (f->id & CAN_ID_FLAG_EXT);
+	return n;
+}
+
+/* Narrowest filter which accepts everything both a and b accept. */
+static can_filter_t merge(const can_filter_t *a, const can_filter_t *b) {
+	can_filter_t m;
+
+	m.mask = a->mask & b->mask & ~(a->id ^ b->id) & id_mask(a->id);
+	m.id = (a->id & m.mask) | (a->id & CAN_ID_FLAG_EXT);
+	return m;
+}
+
+static bool same_type(const can_filter_t *a, const can_filter_t *b) {
+	return ((a->id ^ b->id) & CAN_ID_FLAG_EXT) == 0;
+}
+
+uint32_t can_filter_allocate(const can_filter_t *filters, uint32_t num,
+							 can_filter_t *objects, uint32_t max_objects) {
+	uint32_t n, a, b, best_a, best_b, used = 0;
+	int best_bits, bits;
+	can_filter_t f, m;
+
+	if (max_objects < 2) {
+		return 0;
+	}
+
+	for (n = 0; n < num; n++) {
+		f = normalize(&filters[n]);
+
+		// Exact duplicates and filters already covered cost nothing.
+		for (a = 0; a < used; a++) {
+			m = merge(&objects[a], &f);
+			if (same_type(&objects[a], &f) && (m.mask == objects[a].mask) && (m.id == objects[a].id)) {
+				break;
+			}
+		}
+		if (a < used) {
+			continue;
+		}
+
+		if (used < max_objects) {
+			objects[used++] = f;
+			continue;
+		}
+
+		// Out of objects, merge the pair losing fewest mask bits. Index used
+		// stands for the new filter. With at least three candidates two are
+		// always of the same type.
+		best_bits = -1;
+		best_a = best_b = 0;
+		for (a = 0; a < used; a++) {
+			for (b = a + 1; b <= used; b++) {
+				const can_filter_t *fb = (b == used) ? &f : &objects[b];
+
+				if (!same_type(&objects[a], fb)) {
+					continue;
+				}
+				bits = __builtin_popcount(merge(&objects[a], fb).mask);
+				if (bits > best_bits) {
+					best_bits = bits;
+					best_a = a;
+					best_b = b;
+				}
+			}
+		}
+
+		if (best_b == used) {
+			objects[best_a] = merge(&objects[best_a], &f);
+		}
+		else {
+			objects[best_a] = merge(&objects[best_a], &objects[best_b]);
+			objects[best_b] = f;
+		}
+	}
+	return used;
+}
+
+bool can_filter_match(const can_filter_t *filters, uint32_t num, uint32_t id) {
+	uint32_t i;
+
+	if (num == 0) {
+		return true;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (((filters[i].id ^ id) & CAN_ID_FLAG_EXT) == 0 &&
+			((filters[i].id ^ id) & filters[i].mask & id_mask(id)) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,453 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "timer_service.h"
+#include "byte_order.h"
+#include "can_gateway.h"
+#include "settings.h"
+
+#define CAN_GATEWAY_CAN		LPC_C_CAN0
+#define CAN_GATEWAY_IRQ		C_CAN0_IRQn
+
+#define CCAN_LEC_NO_CHANGE	7
+
+/* Filter table is saved in settings values of this many filters */
+#define FILTERS_PER_SETTING	14
+#define FILTER_SETTINGS		((CAN_FILTER_MAX + FILTERS_PER_SETTING - 1) / FILTERS_PER_SETTING)
+
+/* Host uploads into staged list, received frames are checked against active one. */
+static can_filter_t filters[CAN_FILTER_MAX];
+static uint32_t num_filters;
+static can_filter_t snapshot[CAN_FILTER_MAX];
+static can_filter_t active_filters[CAN_FILTER_MAX];
+static uint32_t num_active_filters;
+static can_filter_t objects[CAN_GATEWAY_RX_OBJECTS];
+static uint32_t num_objects;
+
+static volatile bool apply_pending;
+static volatile bool tx_kick;
+static volatile bool tx_busy;
+static bool running;
+
+static can_gateway_stats_t stats;
+
+/* Applied filters are restored after reset, unused chunks are deleted. */
+static void save_filters(void) {
+	uint8_t value[FILTERS_PER_SETTING * 8];
+	uint32_t chunk, i, count;
+
+	for (chunk = 0; chunk < FILTER_SETTINGS; chunk++) {
+		count = MIN(FILTERS_PER_SETTING, num_filters - MIN(num_filters, chunk * FILTERS_PER_SETTING));
+		if (count == 0) {
+			settings_delete(SETTINGS_KEY_CAN_FILTERS + chunk);
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			put_u32(&value[i * 8], filters[(chunk * FILTERS_PER_SETTING) + i].id);
+			put_u32(&value[(i * 8) + 4], filters[(chunk * FILTERS_PER_SETTING) + i].mask);
+		}
+		settings_set(SETTINGS_KEY_CAN_FILTERS + chunk, value, count * 8);
+	}
+}
+
+static void load_filters(void) {
+	uint8_t value[FILTERS_PER_SETTING * 8];
+	uint32_t chunk, i, length;
+
+	for (chunk = 0; chunk < FILTER_SETTINGS; chunk++) {
+		length = MIN(settings_get(SETTINGS_KEY_CAN_FILTERS + chunk, value, sizeof(value)), sizeof(value));
+		for (i = 0; i + 8 <= length; i += 8) {
+			can_gateway_add_filter(get_u32(&value[i]), get_u32(&value[i + 4]));
+		}
+	}
+}
+
+/* Message object access through IF1 is done from main loop with CAN
+ * interrupt masked or from CAN interrupt, IF2 only from CAN interrupt. */
+static void program_rx_object(uint8_t msg_num, const can_filter_t *f) {
+	CCAN_IF_T *pIF = &CAN_GATEWAY_CAN->IF[CCAN_MSG_IF1];
+
+	// MXTD is always set so that standard and extended filters never overlap.
+	if (f->id & CAN_ID_FLAG_EXT) {
+		pIF->MSK1 = f->mask & 0xFFFF;
+		pIF->MSK2 = CCAN_IF_MASK2_MXTD | ((f->mask >> 16) & 0x1FFF);
+		pIF->ARB1 = f->id & 0xFFFF;
+		pIF->ARB2 = CCAN_IF_ARB2_MSGVAL | CCAN_IF_ARB2_XTD | ((f->id >> 16) & 0x1FFF);
+	}
+	else {
+		pIF->MSK1 = 0;
+		pIF->MSK2 = CCAN_IF_MASK2_MXTD | ((f->mask & CAN_ID_STD_MASK) << 2);
+		pIF->ARB1 = 0;
+		pIF->ARB2 = CCAN_IF_ARB2_MSGVAL | ((f->id & CAN_ID_STD_MASK) << 2);
+	}
+	pIF->MCTRL = CCAN_IF_MCTRL_UMSK | CCAN_IF_MCTRL_RXIE | CCAN_IF_MCTRL_EOB;
+
+	Chip_CCAN_TransferMsgObject(CAN_GATEWAY_CAN, CCAN_MSG_IF1,
+								CCAN_IF_CMDMSK_WR | CCAN_IF_CMDMSK_MASK | CCAN_IF_CMDMSK_ARB | CCAN_IF_CMDMSK_CTRL,
+								msg_num);
+}
+
+static void release_object(uint8_t msg_num) {
+	CCAN_IF_T *pIF = &CAN_GATEWAY_CAN->IF[CCAN_MSG_IF1];
+
+	pIF->ARB1 = 0;
+	pIF->ARB2 = 0;
+	pIF->MCTRL = 0;
+	Chip_CCAN_TransferMsgObject(CAN_GATEWAY_CAN, CCAN_MSG_IF1,
+								CCAN_IF_CMDMSK_WR | CCAN_IF_CMDMSK_ARB | CCAN_IF_CMDMSK_CTRL,
+								msg_num);
+}
+
+/* Must be called from CAN interrupt or with it masked. */
+static void tx_next(void) {
+	CCAN_IF_T *pIF = &CAN_GATEWAY_CAN->IF[CCAN_MSG_IF1];
+	can_frame_t frame;
+
+	if (tx_busy || !running || !can_codec_pop_tx(&frame)) {
+		return;
+	}
+
+	// Remote frames are sent by a receive direction object with TXRQ set.
+	if (frame.id & CAN_ID_FLAG_EXT) {
+		pIF->ARB1 = frame.id & 0xFFFF;
+		pIF->ARB2 = CCAN_IF_ARB2_MSGVAL | CCAN_IF_ARB2_XTD | ((frame.id >> 16) & 0x1FFF);
+	}
+	else {
+		pIF->ARB1 = 0;
+		pIF->ARB2 = CCAN_IF_ARB2_MSGVAL | ((frame.id & CAN_ID_STD_MASK) << 2);
+	}
+	if (!(frame.id & CAN_ID_FLAG_RTR)) {
+		pIF->ARB2 |= CCAN_IF_ARB2_DIR(1);
+	}
+	pIF->MCTRL = CCAN_IF_MCTRL_EOB | CCAN_IF_MCTRL_TXIE | CCAN_IF_MCTRL_TXRQ | (frame.dlc & CCAN_IF_MCTRL_DLC_MSK);
+	pIF->DA1 = frame.data[0] | (frame.data[1] << 8);
+	pIF->DA2 = frame.data[2] | (frame.data[3] << 8);
+	pIF->DB1 = frame.data[4] | (frame.data[5] << 8);
+	pIF->DB2 = frame.data[6] | (frame.data[7] << 8);
+
+	tx_busy = true;
+	Chip_CCAN_TransferMsgObject(CAN_GATEWAY_CAN, CCAN_MSG_IF1,
+								CCAN_IF_CMDMSK_WR | CCAN_IF_CMDMSK_ARB | CCAN_IF_CMDMSK_CTRL |
+								CCAN_IF_CMDMSK_DATAA | CCAN_IF_CMDMSK_DATAB,
+								CAN_GATEWAY_TX_OBJECT);
+}
+
+static void rx_object(uint8_t msg_num, uint32_t now_us) {
+	CCAN_IF_T *pIF = &CAN_GATEWAY_CAN->IF[CCAN_MSG_IF2];
+	can_frame_t frame;
+	uint32_t mctrl, arb2;
+
+	Chip_CCAN_TransferMsgObject(CAN_GATEWAY_CAN, CCAN_MSG_IF2,
+								CCAN_IF_CMDMSK_RD | CCAN_IF_CMDMSK_TRANSFER_ALL |
+								CCAN_IF_CMDMSK_R_CLRINTPND | CCAN_IF_CMDMSK_R_NEWDAT,
+								msg_num);
+	mctrl = pIF->MCTRL;
+	arb2 = pIF->ARB2;
+
+	if (mctrl & CCAN_IF_MCTRL_MLST) {
+		stats.rx_hw_lost++;
+		pIF->MCTRL = mctrl & ~(CCAN_IF_MCTRL_MLST | CCAN_IF_MCTRL_NEWD | CCAN_IF_MCTRL_INTP);
+		Chip_CCAN_TransferMsgObject(CAN_GATEWAY_CAN, CCAN_MSG_IF2, CCAN_IF_CMDMSK_WR | CCAN_IF_CMDMSK_CTRL, msg_num);
+	}
+	if (!(mctrl & CCAN_IF_MCTRL_NEWD)) {
+		return;
+	}
+
+	frame.timestamp_us = now_us;
+	if (arb2 & CCAN_IF_ARB2_XTD) {
+		frame.id = CAN_ID_FLAG_EXT | ((arb2 & 0x1FFF) << 16) | (pIF->ARB1 & 0xFFFF);
+	}
+	else {
+		frame.id = (arb2 >> 2) & CAN_ID_STD_MASK;
+	}
+	frame.dlc = mctrl & CCAN_IF_MCTRL_DLC_MSK;
+	frame.data[0] = pIF->DA1 & 0xFF;
+	frame.data[1] = (pIF->DA1 >> 8) & 0xFF;
+	frame.data[2] = pIF->DA2 & 0xFF;
+	frame.data[3] = (pIF->DA2 >> 8) & 0xFF;
+	frame.data[4] = pIF->DB1 & 0xFF;
+	frame.data[5] = (pIF->DB1 >> 8) & 0xFF;
+	frame.data[6] = pIF->DB2 & 0xFF;
+	frame.data[7] = (pIF->DB2 >> 8) & 0xFF;
+
+	if (!can_filter_match(active_filters, num_active_filters, frame.id)) {
+		stats.rx_filtered++;
+		return;
+	}
+	can_codec_push_rx(&frame);
+}
+
+static uint32_t can_in_source(uint8_t *report) {
+	uint32_t length = can_codec_fill_report(&report[1], HID_CAN_REPORT_SIZE - 1);
+
+	if (length == 0) {
+		return 0;
+	}
+	report[0] = HID_REPORT_ID_CAN;
+	return HID_CAN_REPORT_SIZE;
+}
+
+void can_gateway_init(uint32_t irq_priority) {
+	can_codec_init();
+	num_filters = 0;
+	num_active_filters = 0;
+	num_objects = 0;
+	apply_pending = false;
+	tx_kick = false;
+	tx_busy = false;
+	running = false;
+	memset(&stats, 0, sizeof(stats));
+
+	// Saved filters take effect with the next start.
+	load_filters();
+
+	NVIC_SetPriority(CAN_GATEWAY_IRQ, irq_priority);
+	hid_in_add_source(can_in_source);
+}
+
+bool can_gateway_start(uint32_t bitrate, uint8_t mode) {
+	can_gateway_stop();
+
+	Chip_SCU_PinMuxSet(0x3, 1, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_FUNC2));	/* P3_1 CAN0_RD */
+	Chip_SCU_PinMuxSet(0x3, 2, (SCU_MODE_INACT | SCU_MODE_FUNC2));						/* P3_2 CAN0_TD */
+
+	Chip_CCAN_Init(CAN_GATEWAY_CAN);
+	if (Chip_CCAN_SetBitRate(CAN_GATEWAY_CAN, bitrate) != SUCCESS) {
+		Chip_CCAN_DeInit(CAN_GATEWAY_CAN);
+		return false;
+	}
+
+	if (mode & (CAN_MODE_SILENT | CAN_MODE_LOOPBACK)) {
+		Chip_CCAN_EnableTestMode(CAN_GATEWAY_CAN);
+		Chip_CCAN_ConfigTestMode(CAN_GATEWAY_CAN,
+								 ((mode & CAN_MODE_SILENT) ? CCAN_TEST_SILENT_MODE : 0) |
+								 ((mode & CAN_MODE_LOOPBACK) ? CCAN_TEST_LOOPBACK_MODE : 0));
+	}
+
+	CAN_GATEWAY_CAN->STAT = CCAN_LEC_NO_CHANGE;
+	Chip_CCAN_EnableInt(CAN_GATEWAY_CAN, (CCAN_CTRL_IE | CCAN_CTRL_SIE | CCAN_CTRL_EIE));
+
+	tx_busy = false;
+	running = true;
+	apply_pending = true;
+	NVIC_EnableIRQ(CAN_GATEWAY_IRQ);
+	return true;
+}
+
+void can_gateway_stop(void) {
+	if (!running) {
+		return;
+	}
+
+	NVIC_DisableIRQ(CAN_GATEWAY_IRQ);
+	running = false;
+	tx_busy = false;
+	Chip_CCAN_DisableInt(CAN_GATEWAY_CAN, (CCAN_CTRL_IE | CCAN_CTRL_SIE | CCAN_CTRL_EIE));
+	Chip_CCAN_DeInit(CAN_GATEWAY_CAN);
+}
+
+void can_gateway_clear_filters(void) {
+	num_filters = 0;
+}
+
+bool can_gateway_add_filter(uint32_t id, uint32_t mask) {
+	if (num_filters >= CAN_FILTER_MAX) {
+		return false;
+	}
+	filters[num_filters].id = id;
+	filters[num_filters].mask = mask;
+	num_filters++;
+	return true;
+}
+
+void can_gateway_apply_filters(void) {
+	static const can_filter_t accept_all[2] = {
+		{ 0, 0 },
+		{ CAN_ID_FLAG_EXT, 0 },
+	};
+	uint32_t i, num_snapshot;
+
+	// Host may change the staged list from USB interrupt meanwhile, objects
+	// and active list are built from one copy of it.
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	num_snapshot = num_filters;
+	memcpy(snapshot, filters, num_snapshot * sizeof(can_filter_t));
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	if (num_snapshot > 0) {
+		num_objects = can_filter_allocate(snapshot, num_snapshot, objects, CAN_GATEWAY_RX_OBJECTS);
+	}
+	else {
+		num_objects = can_filter_allocate(accept_all, 2, objects, CAN_GATEWAY_RX_OBJECTS);
+	}
+
+	NVIC_DisableIRQ(CAN_GATEWAY_IRQ);
+	memcpy(active_filters, snapshot, num_snapshot * sizeof(can_filter_t));
+	num_active_filters = num_snapshot;
+
+	for (i = 0; running && (i < CAN_GATEWAY_RX_OBJECTS); i++) {
+		if (i < num_objects) {
+			program_rx_object(i + 1, &objects[i]);
+		}
+		else {
+			release_object(i + 1);
+		}
+	}
+	NVIC_EnableIRQ(CAN_GATEWAY_IRQ);
+}
+
+void can_gateway_write(const uint8_t *payload, uint32_t length) {
+	if (can_codec_queue_tx(payload, length) > 0) {
+		tx_kick = true;
+	}
+}
+
+bool can_gateway_pending(void) {
+	return apply_pending || tx_kick;
+}
+
+void can_gateway_process(void) {
+	// Filter allocation may take a while, it is kept out of USB interrupt.
+	if (apply_pending) {
+		apply_pending = false;
+		can_gateway_apply_filters();
+	}
+
+	if (tx_kick) {
+		tx_kick = false;
+		if (running) {
+			NVIC_DisableIRQ(CAN_GATEWAY_IRQ);
+			tx_next();
+			NVIC_EnableIRQ(CAN_GATEWAY_IRQ);
+		}
+	}
+}
+
+bool can_gateway_set_feature(const uint8_t *payload, uint16_t length) {
+	uint32_t i, count;
+
+	if (length < 1) {
+		return false;
+	}
+
+	switch (payload[0]) {
+	case CAN_CMD_START:
+		if (length < 6) {
+			return false;
+		}
+		return can_gateway_start(get_u32(&payload[1]), payload[5]);
+
+	case CAN_CMD_STOP:
+		can_gateway_stop();
+		return true;
+
+	case CAN_CMD_FILTER_CLEAR:
+		can_gateway_clear_filters();
+		return true;
+
+	case CAN_CMD_FILTER_ADD:
+		if (length < 2) {
+			return false;
+		}
+		count = payload[1];
+		if (length < 2 + (count * 8)) {
+			return false;
+		}
+		for (i = 0; i < count; i++) {
+			if (!can_gateway_add_filter(get_u32(&payload[2 + (i * 8)]), get_u32(&payload[6 + (i * 8)]))) {
+				return false;
+			}
+		}
+		return true;
+
+	case CAN_CMD_FILTER_APPLY:
+		apply_pending = true;
+		save_filters();
+		return true;
+	}
+	return false;
+}
+
+uint16_t can_gateway_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 6;
+	uint32_t ec = running ? CAN_GATEWAY_CAN->EC : 0;
+
+	if (max_length < CAN_GATEWAY_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = running;
+	payload[1] = num_filters;
+	payload[2] = num_objects;
+	payload[3] = ec & 0xFF;				/* TEC */
+	payload[4] = (ec >> 8) & 0x7F;		/* REC */
+	payload[5] = running ? (CAN_GATEWAY_CAN->STAT & 0xFF) : 0;
+
+	counters = (const uint32_t *) can_codec_get_stats();
+	for (i = 0; i < sizeof(can_codec_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	counters = (const uint32_t *) &stats;
+	for (i = 0; i < sizeof(can_gateway_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return CAN_GATEWAY_STATUS_SIZE;
+}
+
+void CAN0_IRQHandler(void) {
+	uint32_t now_us = timer_service_now_us();
+	uint32_t int_id, stat;
+
+	while ((int_id = Chip_CCAN_GetIntID(CAN_GATEWAY_CAN)) != CCAN_INT_NO_PENDING) {
+		if (int_id == CCAN_INT_STATUS) {
+			stat = Chip_CCAN_GetStatus(CAN_GATEWAY_CAN);
+			if (((stat & CCAN_STAT_LEC_MASK) != CCAN_LEC_NO_ERROR) &&
+				((stat & CCAN_STAT_LEC_MASK) != CCAN_LEC_NO_CHANGE)) {
+				stats.bus_errors++;
+			}
+			if (stat & CCAN_STAT_BOFF) {
+				// Controller sets INIT on bus off, clearing it starts recovery.
+				stats.bus_off++;
+				CAN_GATEWAY_CAN->CNTL &= ~CCAN_CTRL_INIT;
+			}
+			CAN_GATEWAY_CAN->STAT = CCAN_LEC_NO_CHANGE;
+		}
+		else if (int_id == CAN_GATEWAY_TX_OBJECT) {
+			Chip_CCAN_TransferMsgObject(CAN_GATEWAY_CAN, CCAN_MSG_IF2,
+										CCAN_IF_CMDMSK_RD | CCAN_IF_CMDMSK_R_CLRINTPND,
+										CAN_GATEWAY_TX_OBJECT);
+			stats.tx_done++;
+			tx_busy = false;
+			tx_next();
+		}
+		else {
+			rx_object(int_id & 0x3F, now_us);
+		}
+	}
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "crc32c.h"
+#include "cdc_framing.h"
+#include "byte_order.h"
+#include "cdc_channel.h"
+
+/* USB1 runs at full speed only */
+#define CDC_MAX_PACKET		USB_FS_MAX_BULK_PACKET
+
+#define CDC_DTR				(1 << 0)
+
+#define RX_FREE				0
+#define RX_QUEUED			1
+#define RX_FULL				2
+
+static USBD_HANDLE_T usb;
+static USBD_HANDLE_T cdc;
+static bool opened;
+
+static uint8_t *rx_buf[2];
+static uint32_t rx_len[2];
+static uint32_t rx_pos[2];
+static volatile uint8_t rx_state[2];
+static uint8_t rx_queue_idx;		/* Next buffer handed to USB DMA */
+static uint8_t rx_decode_idx;		/* Next buffer to decode, oldest data */
+static cdc_frame_decoder_t decoder;
+static uint32_t crc_cycles;			/* CRC of CDC_CHANNEL_BUF_SIZE bytes */
+static uint32_t crc_bytewise_cycles;
+
+static uint8_t *tx_buf[2];
+static uint32_t tx_len[2];
+static uint8_t tx_fill;				/* Buffer frames are collected in */
+static volatile bool tx_busy;		/* Other buffer is being sent */
+static uint16_t tx_seq;
+static uint32_t tx_frames;
+
+static uint32_t tx_room(void) {
+	// Keep one byte for the padding delimiter.
+	return CDC_CHANNEL_BUF_SIZE - 1 - tx_len[tx_fill];
+}
+
+static void tx_frame(uint8_t kind, const uint8_t *report, uint32_t length) {
+	tx_len[tx_fill] += cdc_frame_encode(kind, tx_seq++, report, length, &tx_buf[tx_fill][tx_len[tx_fill]]);
+	tx_frames++;
+}
+
+static void tx_start(void) {
+	uint8_t *buf = tx_buf[tx_fill];
+	uint32_t length = tx_len[tx_fill];
+
+	if (tx_busy || (length == 0)) {
+		return;
+	}
+
+	// A transfer ending on a full packet needs a ZLP to complete on the
+	// host, an empty frame is cheaper and always understood.
+	if ((length % CDC_MAX_PACKET) == 0) {
+		buf[length++] = 0;
+	}
+
+	tx_busy = true;
+	USBD_API->hw->WriteEP(usb, CDC_EP_IN, buf, length);
+	tx_fill ^= 1;
+	tx_len[tx_fill] = 0;
+}
+
+static void rx_queue(void) {
+	uint8_t idx = rx_queue_idx;
+
+	if ((rx_state[idx] != RX_FREE) || (rx_state[idx ^ 1] == RX_QUEUED)) {
+		return;
+	}
+	rx_state[idx] = RX_QUEUED;
+	USBD_API->hw->ReadReqEP(usb, CDC_EP_OUT, rx_buf[idx], CDC_CHANNEL_BUF_SIZE);
+}
+
+/* Every frame handled has room for its reply, decoding pauses otherwise. */
+static void handle_frame(void *ctx, uint8_t kind, const uint8_t *report, uint32_t length) {
+	uint8_t feature[HID_REPORT_MAX_SIZE];
+	uint16_t feature_length;
+
+	switch (kind) {
+	case CDC_FRAME_OUTPUT:
+		hid_out_report(report, length);
+		break;
+
+	case CDC_FRAME_SET_FEATURE:
+		if ((length < 1) || !hid_set_feature(report, length)) {
+			tx_frame(CDC_FRAME_NAK, report, MIN(length, 1));
+		}
+		break;
+
+	case CDC_FRAME_GET_FEATURE:
+		if (length < 1) {
+			break;
+		}
+		feature[0] = report[0];
+		if (hid_get_feature(feature, &feature_length)) {
+			tx_frame(CDC_FRAME_FEATURE, feature, feature_length);
+		}
+		else {
+			tx_frame(CDC_FRAME_NAK, report, 1);
+		}
+		break;
+	}
+
+	if (tx_room() < CDC_FRAME_MAX_ENCODED) {
+		cdc_frame_decoder_pause(&decoder);
+	}
+}
+
+static void rx_decode(void) {
+	uint8_t idx;
+
+	while (tx_room() >= CDC_FRAME_MAX_ENCODED) {
+		idx = rx_decode_idx;
+		if (rx_state[idx] != RX_FULL) {
+			break;
+		}
+		rx_pos[idx] += cdc_frame_decode(&decoder, &rx_buf[idx][rx_pos[idx]], rx_len[idx] - rx_pos[idx],
+				handle_frame, NULL);
+		if (rx_pos[idx] < rx_len[idx]) {
+			break;
+		}
+		rx_state[idx] = RX_FREE;
+		rx_decode_idx ^= 1;
+	}
+	rx_queue();
+}
+
+/* Must be called from USB interrupt context or with USB interrupt disabled. */
+static void cdc_pump(void) {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+	uint32_t length;
+
+	rx_decode();
+
+	while (opened && (tx_room() >= CDC_FRAME_MAX_ENCODED)) {
+		length = hid_in_poll(report);
+		if (length == 0) {
+			break;
+		}
+		tx_frame(CDC_FRAME_INPUT, report, length);
+	}
+
+	tx_start();
+}
+
+static ErrorCode_t cdc_bulk_in_hdlr(USBD_HANDLE_T hUsb, void *data, uint32_t event) {
+	if (event == USB_EVT_IN) {
+		tx_busy = false;
+		cdc_pump();
+	}
+	return LPC_OK;
+}
+
+static ErrorCode_t cdc_bulk_out_hdlr(USBD_HANDLE_T hUsb, void *data, uint32_t event) {
+	uint8_t idx = rx_queue_idx;
+
+	switch (event) {
+	case USB_EVT_OUT:
+		if (rx_state[idx] != RX_QUEUED) {
+			break;
+		}
+		rx_len[idx] = USBD_API->hw->ReadEP(hUsb, CDC_EP_OUT, rx_buf[idx]);
+		rx_pos[idx] = 0;
+		rx_state[idx] = RX_FULL;
+		rx_queue_idx ^= 1;
+		// Other buffer goes to DMA before this one is decoded.
+		rx_queue();
+		cdc_pump();
+		break;
+
+	case USB_EVT_OUT_NAK:
+		rx_queue();
+		break;
+	}
+	return LPC_OK;
+}
+
+static ErrorCode_t cdc_set_ctrl_line_state(USBD_HANDLE_T hCDC, uint16_t state) {
+	if (!opened && ((state & CDC_DTR) != 0)) {
+		// Host opened the port, its frame numbers start over.
+		cdc_frame_decoder_resync(&decoder);
+	}
+	opened = (state & CDC_DTR) != 0;
+	hid_in_claim(opened);
+	return LPC_OK;
+}
+
+static ErrorCode_t cdc_set_line_code(USBD_HANDLE_T hCDC, CDC_LINE_CODING *line_coding) {
+	// Baud rate means nothing on a virtual port, accept anything.
+	return LPC_OK;
+}
+
+/*
+ * Second run counts, flash accelerator holds the loop by then. The table
+ * lookups go to flash on both runs.
+ */
+static uint32_t time_crc(uint32_t (*crc)(uint32_t, const uint8_t *, uint32_t)) {
+	uint32_t i, start, cycles = 0;
+
+	for (i = 0; i < 2; i++) {
+		start = DWT->CYCCNT;
+		crc(0, rx_buf[0], CDC_CHANNEL_BUF_SIZE);
+		cycles = DWT->CYCCNT - start;
+	}
+	return cycles;
+}
+
+ErrorCode_t cdc_channel_init(USBD_HANDLE_T hUsb,
+							 const uint8_t *pDesc,
+							 uint32_t *mem_base,
+							 uint32_t *mem_size) {
+	USBD_CDC_INIT_PARAM_T cdc_param;
+	ErrorCode_t ret;
+	uint32_t i;
+
+	memset((void *) &cdc_param, 0, sizeof(USBD_CDC_INIT_PARAM_T));
+	cdc_param.mem_base = *mem_base;
+	cdc_param.mem_size = *mem_size;
+	cdc_param.cif_intf_desc = (uint8_t *) find_IntfDesc(pDesc, CDC_COMMUNICATION_INTERFACE_CLASS);
+	cdc_param.dif_intf_desc = (uint8_t *) find_IntfDesc(pDesc, CDC_DATA_INTERFACE_CLASS);
+	cdc_param.SetLineCode = cdc_set_line_code;
+	cdc_param.SetCtrlLineState = cdc_set_ctrl_line_state;
+
+	if ((cdc_param.cif_intf_desc == NULL) || (cdc_param.dif_intf_desc == NULL)) {
+		return ERR_FAILED;
+	}
+
+	ret = USBD_API->cdc->init(hUsb, &cdc_param, &cdc);
+	if (ret != LPC_OK) {
+		return ret;
+	}
+
+	/* allocate USB accessible transfer buffers */
+	if (cdc_param.mem_size < (4 * CDC_CHANNEL_BUF_SIZE)) {
+		return ERR_USBD_BAD_MEM_BUF;
+	}
+	for (i = 0; i < 2; i++) {
+		rx_buf[i] = (uint8_t *) cdc_param.mem_base;
+		cdc_param.mem_base += CDC_CHANNEL_BUF_SIZE;
+		tx_buf[i] = (uint8_t *) cdc_param.mem_base;
+		cdc_param.mem_base += CDC_CHANNEL_BUF_SIZE;
+	}
+	cdc_param.mem_size -= 4 * CDC_CHANNEL_BUF_SIZE;
+
+	// Cycle counter runs since SystemInit, see boot_stages.
+	crc_cycles = time_crc(crc32c);
+	crc_bytewise_cycles = time_crc(crc32c_bytewise);
+
+	usb = hUsb;
+	cdc_channel_reset();
+
+	ret = USBD_API->core->RegisterEpHandler(hUsb, ((CDC_EP_IN & 0x0F) << 1) + 1, cdc_bulk_in_hdlr, NULL);
+	if (ret == LPC_OK) {
+		ret = USBD_API->core->RegisterEpHandler(hUsb, (CDC_EP_OUT & 0x0F) << 1, cdc_bulk_out_hdlr, NULL);
+	}
+
+	/* update memory variables */
+	*mem_base = cdc_param.mem_base;
+	*mem_size = cdc_param.mem_size;
+	return ret;
+}
+
+void cdc_channel_reset(void) {
+	opened = false;
+	hid_in_claim(false);
+	rx_state[0] = RX_FREE;
+	rx_state[1] = RX_FREE;
+	rx_queue_idx = 0;
+	rx_decode_idx = 0;
+	cdc_frame_decoder_init(&decoder);
+	tx_len[0] = 0;
+	tx_len[1] = 0;
+	tx_fill = 0;
+	tx_busy = false;
+}
+
+uint16_t cdc_channel_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 16;
+
+	if (max_length < CDC_CHANNEL_STATUS_SIZE) {
+		return 0;
+	}
+
+	put_u32(&payload[0], CDC_CHANNEL_BUF_SIZE);
+	put_u32(&payload[4], crc_cycles);
+	put_u32(&payload[8], crc_bytewise_cycles);
+	put_u32(&payload[12], tx_frames);
+
+	counters = (const uint32_t *) &decoder.stats;
+	for (i = 0; i < sizeof(cdc_frame_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return CDC_CHANNEL_STATUS_SIZE;
+}
+
+void cdc_channel_kick(void) {
+	if (usb == NULL) {
+		return;
+	}
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	cdc_pump();
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "crc32c.h"
+#include "byte_order.h"
+#include "cdc_framing.h"
+
+static void reset_frame(cdc_frame_decoder_t *dec) {
+	dec->length = 0;
+	dec->code = 0;
+	dec->left = 0;
+	dec->overflow = false;
+}
+
+/* COBS, zero bytes are replaced by distance to the next one. */
+uint32_t cdc_frame_encode(uint8_t kind, uint16_t seq, const uint8_t *report, uint32_t length, uint8_t *out) {
+	uint8_t frame[CDC_FRAME_MAX_DECODED];
+	uint32_t i, size, code_pos = 0, pos = 1;
+	uint8_t code = 1, b;
+
+	if (length > CDC_FRAME_MAX_REPORT) {
+		return 0;
+	}
+
+	frame[0] = kind;
+	frame[1] = seq & 0xFF;
+	frame[2] = seq >> 8;
+	frame[3] = length;
+	memcpy(&frame[CDC_FRAME_HEADER_SIZE], report, length);
+	size = CDC_FRAME_HEADER_SIZE + length;
+	put_u32(&frame[size], crc32c(0, frame, size));
+	size += CDC_FRAME_CRC_SIZE;
+
+	for (i = 0; i < size; i++) {
+		b = frame[i];
+		if (b == 0) {
+			out[code_pos] = code;
+			code_pos = pos++;
+			code = 1;
+		}
+		else {
+			out[pos++] = b;
+			code++;
+		}
+	}
+	out[code_pos] = code;
+	out[pos++] = 0;
+	return pos;
+}
+
+void cdc_frame_decoder_init(cdc_frame_decoder_t *dec) {
+	memset(dec, 0, sizeof(*dec));
+}
+
+void cdc_frame_decoder_resync(cdc_frame_decoder_t *dec) {
+	dec->synced = false;
+}
+
+void cdc_frame_decoder_pause(cdc_frame_decoder_t *dec) {
+	dec->paused = true;
+}
+
+/* Checks a complete frame, true if it goes to the handler. */
+static bool check_frame(cdc_frame_decoder_t *dec) {
+	const uint8_t *data = dec->data;
+	uint32_t size = dec->length - CDC_FRAME_CRC_SIZE;
+	uint16_t seq, ahead;
+
+	if ((dec->length < (CDC_FRAME_HEADER_SIZE + CDC_FRAME_CRC_SIZE)) ||
+		(data[3] != (size - CDC_FRAME_HEADER_SIZE))) {
+		dec->stats.errors++;
+		return false;
+	}
+	if (crc32c(0, data, size) != (data[size] | (data[size + 1] << 8) |
+		(data[size + 2] << 16) | ((uint32_t) data[size + 3] << 24))) {
+		dec->stats.crc_errors++;
+		return false;
+	}
+
+	seq = data[1] | (data[2] << 8);
+	if (dec->synced) {
+		// Sequence wraps, a frame up to half the range ahead is newer.
+		ahead = (uint16_t) (seq - dec->next_seq);
+		if (ahead >= 0x8000) {
+			dec->stats.duplicates++;
+			return false;
+		}
+		dec->stats.gaps += ahead;
+	}
+	dec->synced = true;
+	dec->next_seq = seq + 1;
+	return true;
+}
+
+uint32_t cdc_frame_decode(cdc_frame_decoder_t *dec, const uint8_t *data, uint32_t length,
+		cdc_frame_handler_t handler, void *ctx) {
+	uint32_t i;
+	uint8_t b;
+	bool implied_zero;
+
+	dec->paused = false;
+	for (i = 0; (i < length) && !dec->paused; i++) {
+		b = data[i];
+
+		if (b == 0) {
+			if ((dec->left != 0) || dec->overflow) {
+				dec->stats.errors++;
+			}
+			else if ((dec->length > 0) && check_frame(dec)) {
+				dec->stats.frames++;
+				handler(ctx, dec->data[0], &dec->data[CDC_FRAME_HEADER_SIZE], dec->data[3]);
+			}
+			reset_frame(dec);
+			continue;
+		}
+
+		if (dec->left == 0) {
+			// New block, previous one ended in a zero unless it was a full one.
+			implied_zero = (dec->code != 0) && (dec->code != 0xFF);
+			dec->code = b;
+			dec->left = b - 1;
+			if (!implied_zero) {
+				continue;
+			}
+			b = 0;
+		}
+		else {
+			dec->left--;
+		}
+
+		if (dec->length < sizeof(dec->data)) {
+			dec->data[dec->length++] = b;
+		}
+		else {
+			dec->overflow = true;
+		}
+	}
+	return i;
+}
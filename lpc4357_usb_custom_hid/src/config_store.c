@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "byte_order.h"
+#include "config_store.h"
+
+/* Header: seq u32, magic, logical page, CRC-16 over everything else, little endian */
+#define HEADER_MAGIC		0xC5
+#define HEADER_CRC			6
+
+/* CRC-16/CCITT of the page without its CRC field. */
+static uint16_t page_crc(const uint8_t *image) {
+	uint16_t crc = 0xFFFF;
+	uint32_t i, bit;
+
+	for (i = 0; i < CONFIG_STORE_PAGE_SIZE; i++) {
+		if ((i == HEADER_CRC) || (i == HEADER_CRC + 1)) {
+			continue;
+		}
+		crc ^= (uint16_t) (image[i] << 8);
+		for (bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+		}
+	}
+	return crc;
+}
+
+static bool page_valid(const uint8_t *image, uint32_t logical) {
+	return (image[4] == HEADER_MAGIC) && (image[5] == logical) &&
+		   ((image[HEADER_CRC] | (image[HEADER_CRC + 1] << 8)) == page_crc(image));
+}
+
+/* Offset of key's record, or of the end of records if key is not there. */
+static uint32_t find_record(const config_page_t *page, uint8_t key) {
+	uint32_t offset = 0;
+
+	while ((offset + 2 <= CONFIG_STORE_PAYLOAD_SIZE) && (page->data[offset] != CONFIG_STORE_KEY_END)) {
+		if (page->data[offset] == key) {
+			return offset;
+		}
+		offset += 2 + page->data[offset + 1];
+	}
+	return MIN(offset, CONFIG_STORE_PAYLOAD_SIZE);
+}
+
+static uint32_t used_bytes(const config_page_t *page) {
+	return find_record(page, CONFIG_STORE_KEY_END);
+}
+
+static void touch(config_store_t *cs, config_page_t *page, uint32_t now) {
+	if (page->dirty) {
+		cs->stats.coalesced++;
+	}
+	else {
+		page->dirty = true;
+		page->first_change = now;
+	}
+	page->last_change = now;
+}
+
+static bool flush_due(const config_page_t *page, uint32_t now, uint32_t idle) {
+	return page->dirty && ((now - page->last_change >= idle) ||
+						   (now - page->first_change >= idle * CONFIG_STORE_MAX_DELAY_IDLES));
+}
+
+static void remove_record(config_page_t *page, uint32_t offset) {
+	uint32_t size = 2 + page->data[offset + 1];
+	uint32_t used = used_bytes(page);
+
+	memmove(&page->data[offset], &page->data[offset + size], used - offset - size);
+	memset(&page->data[used - size], 0, size);
+}
+
+/* Page holding key, NULL if none does. */
+static config_page_t *find_page(config_store_t *cs, uint8_t key, uint32_t *offset) {
+	uint32_t i;
+
+	for (i = 0; i < cs->num_pages; i++) {
+		*offset = find_record(&cs->pages[i], key);
+		if ((*offset < CONFIG_STORE_PAYLOAD_SIZE) && (cs->pages[i].data[*offset] == key)) {
+			return &cs->pages[i];
+		}
+	}
+	return NULL;
+}
+
+/* Value moved pages and power failed before the old page was written. */
+static void drop_duplicates(config_store_t *cs, uint32_t now) {
+	config_page_t *page, *other = NULL;
+	uint32_t i, j, offset, other_offset = 0;
+
+	for (i = 0; i < cs->num_pages; i++) {
+		page = &cs->pages[i];
+		offset = 0;
+		while ((offset < used_bytes(page)) && (page->data[offset] != CONFIG_STORE_KEY_END)) {
+			for (j = i + 1; j < cs->num_pages; j++) {
+				other = &cs->pages[j];
+				other_offset = find_record(other, page->data[offset]);
+				if ((other_offset < CONFIG_STORE_PAYLOAD_SIZE) && (other->data[other_offset] == page->data[offset])) {
+					break;
+				}
+			}
+			if (j == cs->num_pages) {
+				offset += 2 + page->data[offset + 1];
+			}
+			else if ((int32_t) (other->seq - page->seq) > 0) {
+				remove_record(page, offset);
+				touch(cs, page, now);
+			}
+			else {
+				remove_record(other, other_offset);
+				touch(cs, other, now);
+			}
+		}
+	}
+}
+
+void config_store_init(config_store_t *cs, const config_media_t *media, uint32_t num_pages) {
+	config_page_t *page;
+	uint32_t i, copy, seq;
+	bool found, any = false;
+
+	memset(cs, 0, sizeof(config_store_t));
+	cs->media = media;
+	cs->num_pages = MIN(num_pages, CONFIG_STORE_MAX_PAGES);
+	cs->writing = CONFIG_STORE_NO_PAGE;
+
+	for (i = 0; i < cs->num_pages; i++) {
+		page = &cs->pages[i];
+		found = false;
+		// Nothing valid: copy 1 is in use so that copy 0 is written first.
+		page->copy = 1;
+		for (copy = 0; copy < 2; copy++) {
+			if (!media->read(media->ctx, (i * 2) + copy, cs->image) || !page_valid(cs->image, i)) {
+				continue;
+			}
+			seq = get_u32(cs->image);
+			if (!any || ((int32_t) (seq - cs->seq) > 0)) {
+				cs->seq = seq;
+			}
+			any = true;
+			if (!found || ((int32_t) (seq - page->seq) > 0)) {
+				found = true;
+				page->seq = seq;
+				page->copy = (uint8_t) copy;
+				memcpy(page->data, &cs->image[CONFIG_STORE_HEADER_SIZE], CONFIG_STORE_PAYLOAD_SIZE);
+			}
+		}
+	}
+	drop_duplicates(cs, 0);
+}
+
+uint32_t config_store_get(const config_store_t *cs, uint8_t key, uint8_t *value, uint32_t max_length) {
+	uint32_t offset, length;
+	const config_page_t *page = find_page((config_store_t *) cs, key, &offset);
+
+	if ((page == NULL) || (key == CONFIG_STORE_KEY_END)) {
+		return 0;
+	}
+	length = page->data[offset + 1];
+	memcpy(value, &page->data[offset + 2], MIN(length, max_length));
+	return length;
+}
+
+bool config_store_set(config_store_t *cs, uint8_t key, const uint8_t *value, uint32_t length, uint32_t now) {
+	config_page_t *page, *old;
+	uint32_t offset, i;
+
+	if ((key == CONFIG_STORE_KEY_END) || (length > CONFIG_STORE_VALUE_MAX)) {
+		return false;
+	}
+
+	old = find_page(cs, key, &offset);
+	if ((old != NULL) && (old->data[offset + 1] == length)) {
+		if (memcmp(&old->data[offset + 2], value, length) == 0) {
+			cs->stats.unchanged++;
+			return true;
+		}
+		memcpy(&old->data[offset + 2], value, length);
+		touch(cs, old, now);
+		cs->stats.sets++;
+		return true;
+	}
+
+	// Size changes, prefer the page the key is on so only one page is rewritten.
+	page = NULL;
+	if ((old != NULL) && (used_bytes(old) - (2 + old->data[offset + 1]) + 2 + length <= CONFIG_STORE_PAYLOAD_SIZE)) {
+		page = old;
+	}
+	for (i = 0; (page == NULL) && (i < cs->num_pages); i++) {
+		if (used_bytes(&cs->pages[i]) + 2 + length <= CONFIG_STORE_PAYLOAD_SIZE) {
+			page = &cs->pages[i];
+		}
+	}
+	if (page == NULL) {
+		return false;
+	}
+
+	if (old != NULL) {
+		remove_record(old, offset);
+		touch(cs, old, now);
+	}
+	offset = used_bytes(page);
+	page->data[offset] = key;
+	page->data[offset + 1] = (uint8_t) length;
+	memcpy(&page->data[offset + 2], value, length);
+	if (page != old) {
+		// Looks idle first and at least as overdue, so it is written before
+		// the page the value left.
+		touch(cs, page, now);
+		page->last_change = now - 1;
+		if ((old != NULL) && ((int32_t) (old->first_change - page->first_change) < 0)) {
+			page->first_change = old->first_change;
+		}
+	}
+	cs->stats.sets++;
+	return true;
+}
+
+void config_store_delete(config_store_t *cs, uint8_t key, uint32_t now) {
+	config_page_t *page;
+	uint32_t offset;
+
+	page = find_page(cs, key, &offset);
+	if ((page != NULL) && (key != CONFIG_STORE_KEY_END)) {
+		remove_record(page, offset);
+		touch(cs, page, now);
+		cs->stats.sets++;
+	}
+}
+
+void config_store_clear(config_store_t *cs, uint32_t now) {
+	uint32_t i;
+
+	for (i = 0; i < cs->num_pages; i++) {
+		if (cs->pages[i].data[0] != CONFIG_STORE_KEY_END) {
+			memset(cs->pages[i].data, 0, CONFIG_STORE_PAYLOAD_SIZE);
+			touch(cs, &cs->pages[i], now);
+		}
+	}
+}
+
+bool config_store_flush(config_store_t *cs, uint32_t now, uint32_t idle) {
+	config_page_t *page, *oldest = NULL;
+	uint32_t i, seq, crc;
+
+	if (cs->writing != CONFIG_STORE_NO_PAGE) {
+		return false;
+	}
+
+	for (i = 0; i < cs->num_pages; i++) {
+		page = &cs->pages[i];
+		if (flush_due(page, now, idle) &&
+			((oldest == NULL) || ((int32_t) (page->last_change - oldest->last_change) < 0))) {
+			oldest = page;
+		}
+	}
+	if (oldest == NULL) {
+		return false;
+	}
+
+	// Snapshot, changes from here on dirty the page again.
+	i = oldest - cs->pages;
+	seq = ++cs->seq;
+	put_u32(cs->image, seq);
+	cs->image[4] = HEADER_MAGIC;
+	cs->image[5] = (uint8_t) i;
+	memcpy(&cs->image[CONFIG_STORE_HEADER_SIZE], oldest->data, CONFIG_STORE_PAYLOAD_SIZE);
+	crc = page_crc(cs->image);
+	cs->image[HEADER_CRC] = crc & 0xFF;
+	cs->image[HEADER_CRC + 1] = crc >> 8;
+
+	oldest->dirty = false;
+	cs->writing = i;
+	cs->writing_seq = seq;
+	cs->writing_since = oldest->first_change;
+	cs->media->write(cs->media->ctx, (i * 2) + (oldest->copy ^ 1), cs->image);
+	return true;
+}
+
+void config_store_write_done(config_store_t *cs, bool ok, uint32_t now) {
+	config_page_t *page;
+
+	if (cs->writing == CONFIG_STORE_NO_PAGE) {
+		return;
+	}
+	page = &cs->pages[cs->writing];
+	cs->writing = CONFIG_STORE_NO_PAGE;
+
+	if (!ok) {
+		// Copy in use is untouched, try again with whatever the page holds by then.
+		cs->stats.errors++;
+		if (!page->dirty) {
+			page->last_change = now;
+		}
+		page->dirty = true;
+		page->first_change = cs->writing_since;
+		return;
+	}
+
+	page->seq = cs->writing_seq;
+	page->copy ^= 1;
+	cs->stats.page_writes++;
+	cs->stats.latency_max = MAX(cs->stats.latency_max, now - cs->writing_since);
+}
+
+bool config_store_dirty(const config_store_t *cs) {
+	uint32_t i;
+
+	for (i = 0; i < cs->num_pages; i++) {
+		if (cs->pages[i].dirty) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool config_store_busy(const config_store_t *cs) {
+	return cs->writing != CONFIG_STORE_NO_PAGE;
+}
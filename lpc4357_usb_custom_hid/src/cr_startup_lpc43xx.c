@@ -272,22 +272,58 @@ void (* const g_pfnVectors[])(void) = {
 // are written as separate functions rather than being inlined within the
 // ResetISR() function in order to cope with MCUs with multiple banks of
 // memory.
+//
+// They run before main() on every reset, so whole 32 byte blocks are moved
+// with one LDM/STM pair each, the remaining words one at a time. Sections
+// are word aligned. Large buffers which need no zeroing are placed with
+// __NOINIT(RAM2) instead, the linker keeps them out of the BSS table.
 //*****************************************************************************
         __attribute__((section(".after_vectors"
 )))
 void data_init(unsigned int romstart, unsigned int start, unsigned int len) {
     unsigned int *pulDest = (unsigned int*) start;
     unsigned int *pulSrc = (unsigned int*) romstart;
-    unsigned int loop;
-    for (loop = 0; loop < len; loop = loop + 4)
+    unsigned int *pulEnd = pulDest + ((len + 3) / 4);
+    unsigned int *pulBlockEnd = pulDest + (len / 32) * 8;
+
+    // r7 is left alone, it is the frame pointer in debug builds.
+    __asm volatile (
+        "1:  cmp %[dst], %[end]\n"
+        "    bhs 2f\n"
+        "    ldmia %[src]!, {r3-r6, r8-r10, r12}\n"
+        "    stmia %[dst]!, {r3-r6, r8-r10, r12}\n"
+        "    b 1b\n"
+        "2:\n"
+        : [src] "+r" (pulSrc), [dst] "+r" (pulDest)
+        : [end] "r" (pulBlockEnd)
+        : "r3", "r4", "r5", "r6", "r8", "r9", "r10", "r12", "cc", "memory");
+
+    while (pulDest < pulEnd)
         *pulDest++ = *pulSrc++;
 }
 
 __attribute__ ((section(".after_vectors")))
 void bss_init(unsigned int start, unsigned int len) {
     unsigned int *pulDest = (unsigned int*) start;
-    unsigned int loop;
-    for (loop = 0; loop < len; loop = loop + 4)
+    unsigned int *pulEnd = pulDest + ((len + 3) / 4);
+    unsigned int *pulBlockEnd = pulDest + (len / 32) * 8;
+
+    __asm volatile (
+        "    movs r3, #0\n"
+        "    movs r4, #0\n"
+        "    movs r5, #0\n"
+        "    movs r6, #0\n"
+        "1:  cmp %[dst], %[end]\n"
+        "    bhs 2f\n"
+        "    stmia %[dst]!, {r3-r6}\n"
+        "    stmia %[dst]!, {r3-r6}\n"
+        "    b 1b\n"
+        "2:\n"
+        : [dst] "+r" (pulDest)
+        : [end] "r" (pulBlockEnd)
+        : "r3", "r4", "r5", "r6", "cc", "memory");
+
+    while (pulDest < pulEnd)
         *pulDest++ = 0;
 }
 
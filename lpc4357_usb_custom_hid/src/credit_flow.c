@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "credit_flow.h"
+
+/* Counters wrap, b is ahead of a if the difference is below half the range. */
+static bool after(uint32_t a, uint32_t b) {
+	return (int32_t) (b - a) > 0;
+}
+
+void credit_rx_init(credit_rx_t *rx, uint32_t size, uint32_t threshold) {
+	rx->size = size;
+	rx->threshold = MAX(threshold, 1);
+	rx->accepted = 0;
+	rx->consumed = 0;
+	rx->advertised = 0;
+	rx->overruns = 0;
+}
+
+uint32_t credit_rx_accept(credit_rx_t *rx, uint32_t count) {
+	uint32_t room = rx->size - (rx->accepted - rx->consumed);
+
+	if (count > room) {
+		rx->overruns += count - room;
+		count = room;
+	}
+	rx->accepted += count;
+	return count;
+}
+
+void credit_rx_consume(credit_rx_t *rx, uint32_t count) {
+	rx->consumed += count;
+}
+
+bool credit_rx_update_due(const credit_rx_t *rx) {
+	uint32_t limit = rx->consumed + rx->size;
+	uint32_t growth = limit - rx->advertised;
+
+	// Sender's remaining credit is what it was granted less what arrived.
+	return (growth >= rx->threshold) ||
+		   ((growth >= MAX(rx->threshold / 4, 1)) && ((rx->advertised - rx->accepted) < rx->threshold));
+}
+
+uint32_t credit_rx_advertise(credit_rx_t *rx) {
+	rx->advertised = rx->consumed + rx->size;
+	return rx->advertised;
+}
+
+void credit_tx_init(credit_tx_t *tx) {
+	tx->sent = 0;
+	tx->limit = 0;
+	tx->stalls = 0;
+}
+
+void credit_tx_grant(credit_tx_t *tx, uint32_t limit) {
+	if (after(tx->limit, limit)) {
+		tx->limit = limit;
+	}
+}
+
+uint32_t credit_tx_available(const credit_tx_t *tx) {
+	return after(tx->sent, tx->limit) ? (tx->limit - tx->sent) : 0;
+}
+
+void credit_tx_sent(credit_tx_t *tx, uint32_t count) {
+	tx->sent += count;
+}
+
+void credit_tx_stall(credit_tx_t *tx) {
+	tx->stalls++;
+}
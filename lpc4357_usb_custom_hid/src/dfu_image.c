@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "dfu_image.h"
+
+#define BUF_FREE		0
+#define BUF_FILLING		1
+#define BUF_QUEUED		2
+#define BUF_BUSY		3
+
+static uint32_t program_estimate_ms(const dfu_media_t *media, uint32_t length) {
+	return media->erase_ms + ((length / 1024) * media->program_us_per_kb) / 1000;
+}
+
+static void queue_buf(dfu_image_t *img) {
+	img->buf[img->fill].state = BUF_QUEUED;
+	img->fill ^= 1;
+}
+
+/* Time until the buffer the next sector goes to is free. */
+static uint32_t poll_estimate_ms(const dfu_image_t *img, uint32_t now) {
+	const dfu_image_buf_t *b = &img->buf[img->fill];
+	uint32_t estimate;
+	uint32_t elapsed;
+
+	if ((b->state == BUF_FREE) || (b->state == BUF_FILLING)) {
+		return 0;
+	}
+
+	estimate = program_estimate_ms(img->media, b->length);
+	if (b->state == BUF_BUSY) {
+		elapsed = (now - img->busy_start) / 1000;
+		estimate = (elapsed < estimate) ? estimate - elapsed : 0;
+	}
+	return estimate;
+}
+
+void dfu_image_init(dfu_image_t *img, uint8_t *buffers) {
+	memset(img, 0, sizeof(dfu_image_t));
+	img->buf[0].data = buffers;
+	img->buf[1].data = buffers + DFU_IMAGE_SECTOR_MAX;
+}
+
+bool dfu_image_begin(dfu_image_t *img, const dfu_media_t *media) {
+	uint32_t offset;
+	uint32_t length;
+	int i;
+
+	// Queued sectors belong to the media of the previous download.
+	if (dfu_image_busy(img)) {
+		return false;
+	}
+
+	for (offset = 0; offset < media->size; offset += length) {
+		length = media->sector_size(media->ctx, offset);
+		if ((length == 0) || (length > DFU_IMAGE_SECTOR_MAX)) {
+			return false;
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		img->buf[i].state = BUF_FREE;
+	}
+	img->media = media;
+	img->fill = 0;
+	img->next = 0;
+	img->status = DFU_IMAGE_OK;
+	img->finished = false;
+	memset(&img->stats, 0, sizeof(dfu_image_stats_t));
+	return true;
+}
+
+uint8_t *dfu_image_buffer(dfu_image_t *img, uint32_t offset, uint32_t length) {
+	dfu_image_buf_t *b = &img->buf[img->fill];
+
+	if ((img->media == NULL) || (img->status != DFU_IMAGE_OK) || img->finished ||
+		(offset != img->next) || (offset >= img->media->size)) {
+		return NULL;
+	}
+
+	if (b->state != BUF_FILLING) {
+		if (b->state != BUF_FREE) {
+			return NULL;
+		}
+		b->offset = offset;
+		b->length = img->media->sector_size(img->media->ctx, offset);
+		b->filled = 0;
+		b->state = BUF_FILLING;
+	}
+
+	// Blocks never span sectors, transfer size divides sector sizes.
+	if (length > b->length - b->filled) {
+		return NULL;
+	}
+	return &b->data[b->filled];
+}
+
+uint8_t dfu_image_write(dfu_image_t *img, uint32_t offset, const uint8_t *data, uint32_t length,
+		uint32_t now, uint32_t *poll_ms) {
+	dfu_image_buf_t *b = &img->buf[img->fill];
+	uint8_t *dst;
+
+	*poll_ms = 0;
+	if (img->status != DFU_IMAGE_OK) {
+		return img->status;
+	}
+
+	dst = dfu_image_buffer(img, offset, length);
+	if (dst == NULL) {
+		// Poll timeout was an underestimate, host may send this block again.
+		if ((offset == img->next) && (b->state != BUF_FREE) && (b->state != BUF_FILLING)) {
+			img->stats.stalls++;
+			*poll_ms = poll_estimate_ms(img, now);
+			return DFU_IMAGE_ERR_BUSY;
+		}
+		img->status = DFU_IMAGE_ERR_ADDRESS;
+		img->stats.errors++;
+		return img->status;
+	}
+	if (dst != data) {
+		memcpy(dst, data, length);
+	}
+
+	b->filled += length;
+	img->next += length;
+	img->stats.bytes += length;
+	if (b->filled == b->length) {
+		queue_buf(img);
+		*poll_ms = poll_estimate_ms(img, now);
+	}
+	return DFU_IMAGE_OK;
+}
+
+void dfu_image_finish(dfu_image_t *img) {
+	dfu_image_buf_t *b = &img->buf[img->fill];
+
+	img->finished = true;
+	if (b->state != BUF_FILLING) {
+		return;
+	}
+	// Buffer set up for a block that never came leaves its sector alone.
+	if (b->filled == 0) {
+		b->state = BUF_FREE;
+		return;
+	}
+	memset(&b->data[b->filled], 0xFF, b->length - b->filled);
+	b->filled = b->length;
+	queue_buf(img);
+}
+
+int32_t dfu_image_claim(dfu_image_t *img, uint32_t now) {
+	int32_t idx = -1;
+	int32_t i;
+
+	for (i = 0; i < 2; i++) {
+		if ((img->buf[i].state == BUF_QUEUED) &&
+			((idx < 0) || (img->buf[i].offset < img->buf[idx].offset))) {
+			idx = i;
+		}
+	}
+	if (idx >= 0) {
+		img->buf[idx].state = BUF_BUSY;
+		img->busy_start = now;
+	}
+	return idx;
+}
+
+bool dfu_image_program(dfu_image_t *img, int32_t idx) {
+	const dfu_media_t *media = img->media;
+	const dfu_image_buf_t *b = &img->buf[idx];
+
+	if ((media->map != NULL) && (memcmp(&media->map[b->offset], b->data, b->length) == 0)) {
+		img->stats.skipped++;
+		return true;
+	}
+
+	img->stats.programmed++;
+	return media->program(media->ctx, b->offset, b->data, b->length);
+}
+
+void dfu_image_release(dfu_image_t *img, int32_t idx, bool ok) {
+	img->buf[idx].state = BUF_FREE;
+	if (!ok) {
+		img->stats.errors++;
+		if (img->status == DFU_IMAGE_OK) {
+			img->status = DFU_IMAGE_ERR_PROG;
+		}
+	}
+}
+
+bool dfu_image_busy(const dfu_image_t *img) {
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if ((img->buf[i].state == BUF_QUEUED) || (img->buf[i].state == BUF_BUSY)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool dfu_image_done(const dfu_image_t *img) {
+	return img->finished && !dfu_image_busy(img);
+}
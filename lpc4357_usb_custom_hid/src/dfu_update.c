@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "spifi_flash.h"
+#include "timer_service.h"
+#include "dfu_image.h"
+#include "boot_stages.h"
+#include "dfu_update.h"
+
+#define FLASH_BANK_A			0x1A000000
+#define FLASH_BANK_B			0x1B000000
+#define FLASH_BANK_SIZE			(512 * 1024)
+#define FLASH_SMALL_SECTORS		8
+#define FLASH_SMALL_SECTOR_SIZE	(8 * 1024)
+#define FLASH_LARGE_SECTOR_SIZE	(64 * 1024)
+#define FLASH_WRITE_SIZE		4096	/* Largest IAP copy */
+
+#define SPIFI_SECTOR_SIZE		(64 * 1024)
+#define SPIFI_PAGE_SIZE			256
+
+/* RTC backup register, survives the reset into DFU mode */
+#define DFU_REQUEST_REG			63
+#define DFU_REQUEST_MAGIC		0x44465530
+
+/* Host reads the last status before the device goes away */
+#define DFU_RESET_DELAY_US		50000
+
+/* Sector buffers at the top of SDRAM, the rest is idle in DFU mode */
+#define DFU_BUFFERS_BASE		((uint8_t *) (SDRAM_BASE_ADDR + SDRAM_SIZE - 2 * DFU_IMAGE_SECTOR_MAX))
+
+static USBD_HANDLE_T usb;
+static uint8_t if_num;
+static uint8_t target_bank;			/* Flash bank firmware is not running from */
+static volatile bool detach_pending;
+static volatile bool manifest_pending;
+static dfu_image_t image;
+static dfu_media_t media[2];
+
+/* IAP copies from on-chip RAM only, RamLoc40 is plenty */
+static __BSS(RAM2) uint32_t iap_buffer[FLASH_WRITE_SIZE / sizeof(uint32_t)];
+
+static bool erased(const uint8_t *data, uint32_t length) {
+	const uint32_t *words = (const uint32_t *) data;
+	uint32_t i;
+
+	for (i = 0; i < length / sizeof(uint32_t); i++) {
+		if (words[i] != 0xFFFFFFFF) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint32_t bank_base(uint8_t bank) {
+	return (bank == 0) ? FLASH_BANK_A : FLASH_BANK_B;
+}
+
+static uint32_t flash_sector_size(void *ctx, uint32_t offset) {
+	return (offset < FLASH_SMALL_SECTORS * FLASH_SMALL_SECTOR_SIZE) ? FLASH_SMALL_SECTOR_SIZE : FLASH_LARGE_SECTOR_SIZE;
+}
+
+static uint32_t flash_sector(uint32_t offset) {
+	if (offset < FLASH_SMALL_SECTORS * FLASH_SMALL_SECTOR_SIZE) {
+		return offset / FLASH_SMALL_SECTOR_SIZE;
+	}
+	return FLASH_SMALL_SECTORS + (offset - FLASH_SMALL_SECTORS * FLASH_SMALL_SECTOR_SIZE) / FLASH_LARGE_SECTOR_SIZE;
+}
+
+/* Other bank keeps executing, USB interrupt may stay enabled. */
+static bool flash_program(void *ctx, uint32_t offset, const uint8_t *data, uint32_t length) {
+	uint32_t sector = flash_sector(offset);
+	uint32_t pos;
+
+	if ((Chip_IAP_PreSectorForReadWrite(sector, sector, target_bank) != IAP_CMD_SUCCESS) ||
+		(Chip_IAP_EraseSector(sector, sector, target_bank) != IAP_CMD_SUCCESS)) {
+		return false;
+	}
+
+	for (pos = 0; pos < length; pos += FLASH_WRITE_SIZE) {
+		if (erased(&data[pos], FLASH_WRITE_SIZE)) {
+			continue;
+		}
+		memcpy(iap_buffer, &data[pos], FLASH_WRITE_SIZE);
+		if ((Chip_IAP_PreSectorForReadWrite(sector, sector, target_bank) != IAP_CMD_SUCCESS) ||
+			(Chip_IAP_CopyRamToFlash(bank_base(target_bank) + offset + pos, iap_buffer, FLASH_WRITE_SIZE) != IAP_CMD_SUCCESS)) {
+			return false;
+		}
+	}
+
+	return memcmp((const uint8_t *) (bank_base(target_bank) + offset), data, length) == 0;
+}
+
+static uint32_t spifi_sector_size(void *ctx, uint32_t offset) {
+	return SPIFI_SECTOR_SIZE;
+}
+
+/* Firmware runs from internal flash, nothing but uploads reads the XIP window. */
+static bool spifi_program(void *ctx, uint32_t offset, const uint8_t *data, uint32_t length) {
+	uint32_t page;
+
+	spifi_set_cmd_mode();
+	spifi_erase_sector(offset);
+	for (page = 0; page < length; page += SPIFI_PAGE_SIZE) {
+		if (!erased(&data[page], SPIFI_PAGE_SIZE)) {
+			spifi_program_page(offset + page, &data[page], SPIFI_PAGE_SIZE);
+		}
+	}
+	spifi_set_mem_mode();
+
+	return memcmp((const uint8_t *) (SPIFI_VTABLE + offset), data, length) == 0;
+}
+
+static const dfu_media_t *selected_media(void) {
+	USB_CORE_CTRL_T *pCtrl = (USB_CORE_CTRL_T *) usb;
+
+	return &media[(pCtrl->alt_setting[if_num] == DFU_MEDIA_SPIFI) ? DFU_MEDIA_SPIFI : DFU_MEDIA_INTERNAL];
+}
+
+static bool begin_download(void) {
+	manifest_pending = false;
+	return dfu_image_begin(&image, selected_media());
+}
+
+static uint8_t dfu_status(uint8_t status) {
+	switch (status) {
+	case DFU_IMAGE_OK:
+		return DFU_STATUS_OK;
+
+	case DFU_IMAGE_ERR_ADDRESS:
+		return DFU_STATUS_errADDRESS;
+
+	case DFU_IMAGE_ERR_BUSY:
+		return DFU_STATUS_errNOTDONE;
+
+	default:
+		return DFU_STATUS_errPROG;
+	}
+}
+
+static uint8_t dfu_write(uint32_t block_num, uint8_t **src, uint32_t length, uint8_t *bwPollTimeout) {
+	uint32_t offset = block_num * USB_DFU_XFER_SIZE;
+	uint32_t poll_ms;
+	uint8_t status;
+	uint8_t *buf;
+
+	if (length == 0) {
+		// Stack asks where the block should land, receive it into its sector.
+		if ((block_num == 0) && !begin_download()) {
+			return DFU_STATUS_errTARGET;
+		}
+		buf = dfu_image_buffer(&image, offset, USB_DFU_XFER_SIZE);
+		if (buf != NULL) {
+			*src = buf;
+		}
+		return DFU_STATUS_OK;
+	}
+
+	if ((block_num == 0) &&
+		((image.next != 0) || (image.status != DFU_IMAGE_OK) || (image.media != selected_media())) &&
+		!begin_download()) {
+		return DFU_STATUS_errTARGET;
+	}
+
+	status = dfu_image_write(&image, offset, *src, length, timer_service_now_us(), &poll_ms);
+	bwPollTimeout[0] = poll_ms & 0xFF;
+	bwPollTimeout[1] = (poll_ms >> 8) & 0xFF;
+	bwPollTimeout[2] = (poll_ms >> 16) & 0xFF;
+	return dfu_status(status);
+}
+
+static uint32_t dfu_read(uint32_t block_num, uint8_t **dst, uint32_t length) {
+	const dfu_media_t *m = selected_media();
+	uint32_t offset = block_num * USB_DFU_XFER_SIZE;
+
+	// SPIFI is not mapped while a sector is programmed.
+	if (dfu_image_busy(&image)) {
+		return DFU_STATUS_errNOTDONE;
+	}
+	if (offset >= m->size) {
+		return 0;
+	}
+
+	length = MIN(length, m->size - offset);
+	memcpy(*dst, &m->map[offset], length);
+	return length;
+}
+
+static void dfu_done(void) {
+	dfu_image_finish(&image);
+	manifest_pending = true;
+}
+
+static void dfu_detach(USBD_HANDLE_T hUsb) {
+	detach_pending = true;
+}
+
+/* Boot ROM only starts a bank whose first 8 vectors sum up to zero. */
+static void activate_bank(void) {
+	const uint32_t *vectors = (const uint32_t *) bank_base(target_bank);
+	uint32_t sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < 8; i++) {
+		sum += vectors[i];
+	}
+
+	// An image linked for the running bank would execute old code.
+	if ((sum == 0) && (((vectors[1] & ~1UL) - bank_base(target_bank)) < FLASH_BANK_SIZE)) {
+		Chip_IAP_SetBootFlashBank(target_bank);
+	}
+}
+
+static void reset_device(void) {
+	uint32_t start;
+
+	start = timer_service_now_us();
+	while (timer_service_elapsed_us(start, timer_service_now_us()) < DFU_RESET_DELAY_US) {}
+	USBD_API->hw->Connect(usb, 0);
+	start = timer_service_now_us();
+	while (timer_service_elapsed_us(start, timer_service_now_us()) < DFU_RESET_DELAY_US) {}
+	NVIC_SystemReset();
+}
+
+static ErrorCode_t dfu_class_init(USBD_HANDLE_T hUsb,
+								  USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+								  uint32_t *mem_base,
+								  uint32_t *mem_size,
+								  uint32_t init_state) {
+	USBD_DFU_INIT_PARAM_T dfu_param;
+	ErrorCode_t ret;
+
+	if ((pIntfDesc == 0) || (pIntfDesc->bInterfaceClass != USB_DEVICE_CLASS_APP) ||
+		(pIntfDesc->bInterfaceSubClass != USB_DFU_SUBCLASS)) {
+		return ERR_FAILED;
+	}
+
+	usb = hUsb;
+	if_num = pIntfDesc->bInterfaceNumber;
+	detach_pending = false;
+	manifest_pending = false;
+
+	memset((void *) &dfu_param, 0, sizeof(USBD_DFU_INIT_PARAM_T));
+	dfu_param.mem_base = *mem_base;
+	dfu_param.mem_size = *mem_size;
+	dfu_param.wTransferSize = USB_DFU_XFER_SIZE;
+	dfu_param.intf_desc = (uint8_t *) pIntfDesc;
+	/* user defined functions */
+	dfu_param.DFU_Write = dfu_write;
+	dfu_param.DFU_Read = dfu_read;
+	dfu_param.DFU_Done = dfu_done;
+	dfu_param.DFU_Detach = dfu_detach;
+
+	ret = USBD_API->dfu->init(hUsb, &dfu_param, init_state);
+
+	/* update memory variables */
+	*mem_base = dfu_param.mem_base;
+	*mem_size = dfu_param.mem_size;
+	return ret;
+}
+
+ErrorCode_t dfu_update_runtime_init(USBD_HANDLE_T hUsb,
+									USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+									uint32_t *mem_base,
+									uint32_t *mem_size) {
+	return dfu_class_init(hUsb, pIntfDesc, mem_base, mem_size, DFU_STATE_appIDLE);
+}
+
+bool dfu_update_requested(void) {
+	bool requested = Chip_REGFILE_Read(LPC_REGFILE, DFU_REQUEST_REG) == DFU_REQUEST_MAGIC;
+
+	// One shot, a reset in DFU mode returns to the application.
+	Chip_REGFILE_Write(LPC_REGFILE, DFU_REQUEST_REG, 0);
+	return requested;
+}
+
+ErrorCode_t dfu_update_init(USBD_HANDLE_T hUsb,
+							USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+							uint32_t *mem_base,
+							uint32_t *mem_size) {
+	target_bank = (((uint32_t) dfu_update_init) >= FLASH_BANK_B) ? 0 : 1;
+	if (Chip_IAP_Init() != IAP_CMD_SUCCESS) {
+		return ERR_FAILED;
+	}
+	// Sector buffers and the SPIFI window, uploads read it too.
+	if (!boot_stage_require(BOOT_STAGE_SDRAM) || !boot_stage_require(BOOT_STAGE_SPIFI)) {
+		return ERR_FAILED;
+	}
+
+	media[DFU_MEDIA_INTERNAL].sector_size = flash_sector_size;
+	media[DFU_MEDIA_INTERNAL].program = flash_program;
+	media[DFU_MEDIA_INTERNAL].ctx = NULL;
+	media[DFU_MEDIA_INTERNAL].map = (const uint8_t *) bank_base(target_bank);
+	media[DFU_MEDIA_INTERNAL].size = FLASH_BANK_SIZE;
+	media[DFU_MEDIA_INTERNAL].erase_ms = 100;
+	media[DFU_MEDIA_INTERNAL].program_us_per_kb = 2000;
+
+	media[DFU_MEDIA_SPIFI].sector_size = spifi_sector_size;
+	media[DFU_MEDIA_SPIFI].program = spifi_program;
+	media[DFU_MEDIA_SPIFI].ctx = NULL;
+	media[DFU_MEDIA_SPIFI].map = (const uint8_t *) SPIFI_VTABLE;
+	media[DFU_MEDIA_SPIFI].size = SPIFI_FLASH_SIZE;
+	media[DFU_MEDIA_SPIFI].erase_ms = 500;
+	media[DFU_MEDIA_SPIFI].program_us_per_kb = 6000;
+
+	dfu_image_init(&image, DFU_BUFFERS_BASE);
+	return dfu_class_init(hUsb, pIntfDesc, mem_base, mem_size, DFU_STATE_dfuIDLE);
+}
+
+bool dfu_update_pending(void) {
+	return detach_pending || dfu_image_busy(&image) || (manifest_pending && dfu_image_done(&image));
+}
+
+void dfu_update_process(void) {
+	int32_t idx;
+	bool ok;
+
+	if (detach_pending) {
+		Chip_REGFILE_Write(LPC_REGFILE, DFU_REQUEST_REG, DFU_REQUEST_MAGIC);
+		reset_device();
+	}
+
+	if (!dfu_image_busy(&image) && !manifest_pending) {
+		return;
+	}
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	idx = dfu_image_claim(&image, timer_service_now_us());
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	// Next sector keeps arriving while this one is erased and programmed.
+	if (idx >= 0) {
+		ok = dfu_image_program(&image, idx);
+		NVIC_DisableIRQ(LPC_USB_IRQ);
+		dfu_image_release(&image, idx, ok);
+		NVIC_EnableIRQ(LPC_USB_IRQ);
+	}
+
+	if (manifest_pending && dfu_image_done(&image)) {
+		manifest_pending = false;
+		if (image.status == DFU_IMAGE_OK) {
+			if (image.media == &media[DFU_MEDIA_INTERNAL]) {
+				activate_bank();
+			}
+			reset_device();
+		}
+	}
+}
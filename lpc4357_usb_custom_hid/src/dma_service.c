@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "board.h"
+#include "dma_service.h"
+
+static dma_service_callback_t callbacks[GPDMA_NUMBER_CHANNELS];
+static uint32_t allocated_mask;
+static uint32_t claimed_lines;
+
+void dma_service_init(uint32_t irq_priority) {
+	Chip_GPDMA_Init(LPC_GPDMA);
+	LPC_GPDMA->CONFIG = GPDMA_DMACConfig_E;
+	allocated_mask = 0;
+	claimed_lines = 0;
+
+	NVIC_SetPriority(DMA_IRQn, irq_priority);
+	NVIC_EnableIRQ(DMA_IRQn);
+}
+
+/*
+ * Channels and request lines are taken and given back from USB interrupt
+ * and main loop alike, the masks change with interrupts off.
+ */
+int dma_service_alloc(dma_service_callback_t callback, bool high_priority) {
+	uint32_t primask = __get_PRIMASK();
+	int i, ch, allocated = -1;
+
+	__disable_irq();
+	for (i = 0; i < GPDMA_NUMBER_CHANNELS; i++) {
+		ch = high_priority ? i : (GPDMA_NUMBER_CHANNELS - 1 - i);
+		if ((allocated_mask & (1 << ch)) == 0) {
+			allocated_mask |= (1 << ch);
+			callbacks[ch] = callback;
+			allocated = ch;
+			break;
+		}
+	}
+	__set_PRIMASK(primask);
+	return allocated;
+}
+
+void dma_service_free(uint8_t channel) {
+	uint32_t primask;
+
+	// Only the owner touches its channel registers, stop can wait outside.
+	dma_service_stop(channel);
+	primask = __get_PRIMASK();
+	__disable_irq();
+	callbacks[channel] = 0;
+	allocated_mask &= ~(1 << channel);
+	__set_PRIMASK(primask);
+}
+
+bool dma_service_claim_request(uint8_t line, uint8_t function) {
+	uint32_t primask = __get_PRIMASK();
+	bool claimed = false;
+
+	__disable_irq();
+	if ((claimed_lines & (1 << line)) == 0) {
+		claimed_lines |= (1 << line);
+		LPC_CREG->DMAMUX = (LPC_CREG->DMAMUX & ~(0x03 << (2 * line))) | ((function & 0x03) << (2 * line));
+		claimed = true;
+	}
+	__set_PRIMASK(primask);
+	return claimed;
+}
+
+void dma_service_release_request(uint8_t line) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	claimed_lines &= ~(1 << line);
+	__set_PRIMASK(primask);
+}
+
+void dma_service_start(uint8_t channel, const DMA_TransferDescriptor_t *desc, uint32_t config) {
+	GPDMA_CH_T *pDMAch = &LPC_GPDMA->CH[channel];
+
+	pDMAch->CONFIG = 0;
+	LPC_GPDMA->INTTCCLEAR = (1 << channel);
+	LPC_GPDMA->INTERRCLR = (1 << channel);
+
+	pDMAch->SRCADDR = desc->src;
+	pDMAch->DESTADDR = desc->dst;
+	pDMAch->LLI = desc->lli;
+	pDMAch->CONTROL = desc->ctrl;
+	pDMAch->CONFIG = config | GPDMA_DMACCxConfig_IE | GPDMA_DMACCxConfig_ITC | GPDMA_DMACCxConfig_E;
+}
+
+void dma_service_stop(uint8_t channel) {
+	GPDMA_CH_T *pDMAch = &LPC_GPDMA->CH[channel];
+
+	// Halt first so that in flight burst completes, then disable.
+	pDMAch->CONFIG |= GPDMA_DMACCxConfig_H;
+	while (pDMAch->CONFIG & GPDMA_DMACCxConfig_A);
+	pDMAch->CONFIG &= ~(GPDMA_DMACCxConfig_E | GPDMA_DMACCxConfig_H);
+
+	LPC_GPDMA->INTTCCLEAR = (1 << channel);
+	LPC_GPDMA->INTERRCLR = (1 << channel);
+}
+
+bool dma_service_is_active(uint8_t channel) {
+	return (LPC_GPDMA->ENBLDCHNS & (1 << channel)) != 0;
+}
+
+uint32_t dma_service_next_lli(uint8_t channel) {
+	return LPC_GPDMA->CH[channel].LLI;
+}
+
+void DMA_IRQHandler(void) {
+	uint32_t tc = LPC_GPDMA->INTTCSTAT;
+	uint32_t err = LPC_GPDMA->INTERRSTAT;
+	uint8_t ch;
+
+	LPC_GPDMA->INTTCCLEAR = tc;
+	LPC_GPDMA->INTERRCLR = err;
+
+	for (ch = 0; ch < GPDMA_NUMBER_CHANNELS; ch++) {
+		if (((tc | err) & (1 << ch)) && callbacks[ch]) {
+			callbacks[ch](ch, (err & (1 << ch)) != 0);
+		}
+	}
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "drift_estimator.h"
+
+void drift_estimator_init(drift_estimator_t *est, uint32_t nominal_rate) {
+	est->nominal_rate = nominal_rate;
+	est->rate_q16 = (int64_t) nominal_rate << 16;
+	est->window_start_us = 0;
+	est->window_frames = 0;
+	est->started = false;
+	est->valid = false;
+}
+
+void drift_estimator_update(drift_estimator_t *est, uint32_t frames, uint32_t now_us) {
+	uint32_t elapsed;
+	int64_t rate_q16;
+
+	if (!est->started) {
+		// First call only marks window start, frames before it have no reference.
+		est->window_start_us = now_us;
+		est->window_frames = 0;
+		est->started = true;
+		return;
+	}
+
+	est->window_frames += frames;
+	elapsed = now_us - est->window_start_us;
+	if (elapsed < DRIFT_WINDOW_US) {
+		return;
+	}
+
+	// Q16 keeps IIR rounding well below one ppm.
+	rate_q16 = (int64_t) ((((uint64_t) est->window_frames * 1000000) << 16) / elapsed);
+	if (!est->valid) {
+		est->rate_q16 = rate_q16;
+		est->valid = true;
+	}
+	else {
+		est->rate_q16 += (rate_q16 - est->rate_q16) / (1 << DRIFT_SMOOTH_SHIFT);
+	}
+	est->window_start_us = now_us;
+	est->window_frames = 0;
+}
+
+int32_t drift_estimator_ppm(const drift_estimator_t *est) {
+	int64_t nominal_q16 = (int64_t) est->nominal_rate << 16;
+
+	if (nominal_q16 == 0) {
+		return 0;
+	}
+	return (int32_t) (((est->rate_q16 - nominal_q16) * 1000000) / nominal_q16);
+}
+
+uint32_t drift_estimator_feedback(const drift_estimator_t *est, uint32_t level, uint32_t target_level) {
+	// Hz to frames/ms, both Q16.
+	int64_t feedback = est->rate_q16 / 1000;
+	int32_t error = (int32_t) target_level - (int32_t) level;
+
+	feedback += ((int64_t) error << 16) >> DRIFT_LEVEL_SHIFT;
+	return (feedback > 0) ? (uint32_t) feedback : 0;
+}
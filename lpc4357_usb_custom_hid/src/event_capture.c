@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "ring_buffer.h"
+#include "event_capture.h"
+
+/* Ring sizes must be power of 2 */
+#define RAW_RING_SIZE 64
+#define REPORT_RING_SIZE 128
+
+typedef struct {
+	uint32_t timestamp_us;
+	uint8_t channel;
+	uint8_t edge;
+} event_edge_t;
+
+static event_edge_t raw_edges[RAW_RING_SIZE];
+static event_edge_t report_edges[REPORT_RING_SIZE];
+static RINGBUFF_T raw_ring;
+static RINGBUFF_T report_ring;
+
+static uint32_t debounce_us[EVENT_CAPTURE_NUM_CHANNELS];
+static uint32_t last_accepted_us[EVENT_CAPTURE_NUM_CHANNELS];
+static bool has_accepted[EVENT_CAPTURE_NUM_CHANNELS];
+
+static event_capture_stats_t stats;
+static uint32_t lost_reported;
+
+void event_capture_init(void) {
+	int i;
+
+	RingBuffer_Init(&raw_ring, raw_edges, sizeof(event_edge_t), RAW_RING_SIZE);
+	RingBuffer_Init(&report_ring, report_edges, sizeof(event_edge_t), REPORT_RING_SIZE);
+
+	for (i = 0; i < EVENT_CAPTURE_NUM_CHANNELS; i++) {
+		debounce_us[i] = EVENT_DEFAULT_DEBOUNCE_US;
+		has_accepted[i] = false;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	lost_reported = 0;
+}
+
+void event_capture_set_debounce(uint8_t channel, uint32_t us) {
+	if (channel < EVENT_CAPTURE_NUM_CHANNELS) {
+		debounce_us[channel] = us;
+	}
+}
+
+bool event_capture_push(uint8_t channel, uint8_t edge, uint32_t timestamp_us) {
+	event_edge_t e;
+
+	e.timestamp_us = timestamp_us;
+	e.channel = channel;
+	e.edge = edge;
+
+	stats.raw++;
+	if (RingBuffer_Insert(&raw_ring, &e) == 0) {
+		stats.overflow++;
+		return false;
+	}
+	return true;
+}
+
+bool event_capture_pending(void) {
+	return !RingBuffer_IsEmpty(&raw_ring);
+}
+
+void event_capture_process(void) {
+	event_edge_t e;
+
+	while (RingBuffer_Pop(&raw_ring, &e)) {
+		if (e.channel >= EVENT_CAPTURE_NUM_CHANNELS) {
+			continue;
+		}
+
+		if (has_accepted[e.channel] &&
+				((e.timestamp_us - last_accepted_us[e.channel]) < debounce_us[e.channel])) {
+			stats.bounced++;
+			continue;
+		}
+
+		has_accepted[e.channel] = true;
+		last_accepted_us[e.channel] = e.timestamp_us;
+		stats.accepted++;
+
+		if (RingBuffer_Insert(&report_ring, &e) == 0) {
+			stats.dropped++;
+		}
+	}
+}
+
+uint32_t event_capture_fill_report(uint8_t *payload, uint32_t max_len) {
+	event_edge_t e;
+	uint32_t count = 0;
+	uint32_t lost;
+	uint8_t *rec;
+
+	if ((max_len < (EVENT_REPORT_HEADER_SIZE + EVENT_RECORD_SIZE)) || RingBuffer_IsEmpty(&report_ring)) {
+		return 0;
+	}
+
+	rec = &payload[EVENT_REPORT_HEADER_SIZE];
+	while ((EVENT_REPORT_HEADER_SIZE + ((count + 1) * EVENT_RECORD_SIZE)) <= max_len) {
+		if (RingBuffer_Pop(&report_ring, &e) == 0) {
+			break;
+		}
+		rec[0] = (e.channel & EVENT_RECORD_CHANNEL_MASK) | (e.edge ? EVENT_RECORD_FLAG_RISE : 0);
+		rec[1] = (uint8_t) (e.timestamp_us);
+		rec[2] = (uint8_t) (e.timestamp_us >> 8);
+		rec[3] = (uint8_t) (e.timestamp_us >> 16);
+		rec[4] = (uint8_t) (e.timestamp_us >> 24);
+		rec += EVENT_RECORD_SIZE;
+		count++;
+	}
+
+	// Events lost since previous report, saturated to fit in one byte.
+	lost = (stats.overflow + stats.dropped) - lost_reported;
+	lost_reported += lost;
+
+	payload[0] = (uint8_t) count;
+	payload[1] = (lost > 0xFF) ? 0xFF : (uint8_t) lost;
+
+	return count;
+}
+
+const event_capture_stats_t *event_capture_get_stats(void) {
+	return &stats;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "board.h"
+
+#include "hid_generic.h"
+#include "event_capture.h"
+#include "timer_service.h"
+#include "gpio_events.h"
+#include "settings.h"
+
+#define NUM_PININT_CHANNELS 8
+#define NUM_GPIO_GROUPS 2
+
+static gpio_pin_info_t channel_pins[NUM_PININT_CHANNELS];
+static uint32_t events_irq_priority;
+
+static uint32_t events_in_source(uint8_t *report) {
+	if (event_capture_fill_report(&report[1], HID_EVENTS_REPORT_SIZE - 1) == 0) {
+		return 0;
+	}
+	report[0] = HID_REPORT_ID_EVENTS;
+	return HID_EVENTS_REPORT_SIZE;
+}
+
+void gpio_events_init(uint32_t irq_priority) {
+	uint8_t ms[2];
+	uint8_t channel;
+
+	events_irq_priority = irq_priority;
+	event_capture_init();
+	hid_in_add_source(events_in_source);
+
+	for (channel = 0; channel < EVENT_CAPTURE_NUM_CHANNELS; channel++) {
+		if (settings_get(SETTINGS_KEY_DEBOUNCE + channel, ms, sizeof(ms)) == sizeof(ms)) {
+			event_capture_set_debounce(channel, (ms[0] | (ms[1] << 8)) * 1000);
+		}
+	}
+}
+
+bool gpio_events_enable_pin(uint8_t channel, uint8_t port, uint8_t pin, uint8_t edges) {
+	uint32_t mask = PININTCH(channel);
+
+	if (channel >= NUM_PININT_CHANNELS) {
+		return false;
+	}
+
+	channel_pins[channel].port = port;
+	channel_pins[channel].pin = pin;
+
+	Chip_GPIO_SetPinDIRInput(LPC_GPIO_PORT, port, pin);
+	Chip_SCU_GPIOIntPinSel(channel, port, pin);
+	Chip_PININT_SetPinModeEdge(LPC_GPIO_PIN_INT, mask);
+
+	if (edges & GPIO_EVENTS_EDGE_FALL)
+		Chip_PININT_EnableIntLow(LPC_GPIO_PIN_INT, mask);
+	else
+		Chip_PININT_DisableIntLow(LPC_GPIO_PIN_INT, mask);
+
+	if (edges & GPIO_EVENTS_EDGE_RISE)
+		Chip_PININT_EnableIntHigh(LPC_GPIO_PIN_INT, mask);
+	else
+		Chip_PININT_DisableIntHigh(LPC_GPIO_PIN_INT, mask);
+
+	Chip_PININT_ClearIntStatus(LPC_GPIO_PIN_INT, mask);
+
+	// All capture IRQs share one priority, event ring expects a single producer.
+	NVIC_SetPriority(PIN_INT0_IRQn + channel, events_irq_priority);
+	NVIC_ClearPendingIRQ(PIN_INT0_IRQn + channel);
+	NVIC_EnableIRQ(PIN_INT0_IRQn + channel);
+
+	return true;
+}
+
+bool gpio_events_enable_group(uint8_t group, const gpio_pin_info_t *pins, uint32_t num_pins, bool active_high) {
+	uint32_t i;
+
+	if (group >= NUM_GPIO_GROUPS) {
+		return false;
+	}
+
+	Chip_GPIOGP_SelectOrMode(LPC_GPIOGROUP, group);
+	Chip_GPIOGP_SelectEdgeMode(LPC_GPIOGROUP, group);
+
+	for (i = 0; i < num_pins; i++) {
+		Chip_GPIO_SetPinDIRInput(LPC_GPIO_PORT, pins[i].port, pins[i].pin);
+		if (active_high)
+			Chip_GPIOGP_SelectHighLevel(LPC_GPIOGROUP, group, pins[i].port, 1 << pins[i].pin);
+		else
+			Chip_GPIOGP_SelectLowLevel(LPC_GPIOGROUP, group, pins[i].port, 1 << pins[i].pin);
+		Chip_GPIOGP_EnableGroupPins(LPC_GPIOGROUP, group, pins[i].port, 1 << pins[i].pin);
+	}
+
+	Chip_GPIOGP_ClearIntStatus(LPC_GPIOGROUP, group);
+
+	NVIC_SetPriority(GINT0_IRQn + group, events_irq_priority);
+	NVIC_ClearPendingIRQ(GINT0_IRQn + group);
+	NVIC_EnableIRQ(GINT0_IRQn + group);
+
+	return true;
+}
+
+bool gpio_events_set_feature(const uint8_t *payload, uint16_t length) {
+	if ((length < (HID_EVENTS_FEATURE_SIZE - 1)) || (payload[0] >= EVENT_CAPTURE_NUM_CHANNELS)) {
+		return false;
+	}
+
+	event_capture_set_debounce(payload[0], (payload[1] | (payload[2] << 8)) * 1000);
+	settings_set(SETTINGS_KEY_DEBOUNCE + payload[0], &payload[1], 2);
+	return true;
+}
+
+static void pinint_handler(uint8_t channel) {
+	uint32_t now_us = timer_service_now_us();
+	uint32_t mask = PININTCH(channel);
+	uint32_t rise, fall;
+
+	rise = Chip_PININT_GetRiseStates(LPC_GPIO_PIN_INT) & Chip_PININT_GetHighEnabled(LPC_GPIO_PIN_INT) & mask;
+	fall = Chip_PININT_GetFallStates(LPC_GPIO_PIN_INT) & Chip_PININT_GetLowEnabled(LPC_GPIO_PIN_INT) & mask;
+	Chip_PININT_ClearRiseStates(LPC_GPIO_PIN_INT, mask);
+	Chip_PININT_ClearFallStates(LPC_GPIO_PIN_INT, mask);
+
+	if (rise && fall) {
+		// Both edges latched before we got here, current level tells which one came last.
+		if (Chip_GPIO_GetPinState(LPC_GPIO_PORT, channel_pins[channel].port, channel_pins[channel].pin)) {
+			event_capture_push(channel, EVENT_EDGE_FALL, now_us);
+			event_capture_push(channel, EVENT_EDGE_RISE, now_us);
+		}
+		else {
+			event_capture_push(channel, EVENT_EDGE_RISE, now_us);
+			event_capture_push(channel, EVENT_EDGE_FALL, now_us);
+		}
+	}
+	else if (rise) {
+		event_capture_push(channel, EVENT_EDGE_RISE, now_us);
+	}
+	else if (fall) {
+		event_capture_push(channel, EVENT_EDGE_FALL, now_us);
+	}
+}
+
+static void gint_handler(uint8_t group) {
+	uint32_t now_us = timer_service_now_us();
+
+	Chip_GPIOGP_ClearIntStatus(LPC_GPIOGROUP, group);
+	event_capture_push(EVENT_CHANNEL_GINT0 + group, EVENT_EDGE_RISE, now_us);
+}
+
+void GPIO0_IRQHandler(void) {
+	pinint_handler(0);
+}
+
+void GPIO1_IRQHandler(void) {
+	pinint_handler(1);
+}
+
+void GPIO2_IRQHandler(void) {
+	pinint_handler(2);
+}
+
+void GPIO3_IRQHandler(void) {
+	pinint_handler(3);
+}
+
+void GPIO4_IRQHandler(void) {
+	pinint_handler(4);
+}
+
+void GPIO5_IRQHandler(void) {
+	pinint_handler(5);
+}
+
+void GPIO6_IRQHandler(void) {
+	pinint_handler(6);
+}
+
+void GPIO7_IRQHandler(void) {
+	pinint_handler(7);
+}
+
+void GINT0_IRQHandler(void) {
+	gint_handler(0);
+}
+
+void GINT1_IRQHandler(void) {
+	gint_handler(1);
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "board.h"
+#include "hid_generic.h"
+#include "gpio_events.h"
+#include "settings.h"
+#include "byte_order.h"
+#include "hid_batch.h"
+
+extern void MCPWM_CH1_Update(uint8_t rate);
+
+/* Args after the opcode, HID_BATCH_OP_FEATURE adds its length byte's value. */
+static const uint8_t op_args[HID_BATCH_NUM_OPS] = {
+	[HID_BATCH_OP_END] = 0,
+	[HID_BATCH_OP_LED] = 2,
+	[HID_BATCH_OP_BLINK_RATE] = 1,
+	[HID_BATCH_OP_DEBOUNCE] = 3,
+	[HID_BATCH_OP_FEATURE] = 1,
+};
+
+static hid_batch_stats_t stats;
+
+/* Runs one command, args are complete. */
+static bool batch_run(uint8_t op, const uint8_t *args) {
+	switch (op) {
+	case HID_BATCH_OP_LED:
+		if (args[0] != LED5) {
+			// LED4 pin belongs to MCPWM, it is set through the blink rate.
+			return false;
+		}
+		board_led_set(args[0], args[1] & 0x1);
+		return true;
+
+	case HID_BATCH_OP_BLINK_RATE:
+		MCPWM_CH1_Update(args[0]);
+		settings_set(SETTINGS_KEY_BLINK_RATE, args, 1);
+		return true;
+
+	case HID_BATCH_OP_DEBOUNCE:
+		return gpio_events_set_feature(args, 3);
+
+	case HID_BATCH_OP_FEATURE:
+		// Length 0 has no report ID to go to.
+		return (args[0] > 0) && hid_set_feature(&args[1], args[0]);
+	}
+	return false;
+}
+
+void hid_batch_write(const uint8_t *payload, uint32_t length) {
+	uint32_t offset = 0, args;
+	uint8_t op;
+
+	stats.reports++;
+	while (offset < length) {
+		op = payload[offset];
+		if (op == HID_BATCH_OP_END) {
+			return;
+		}
+		if (op >= HID_BATCH_NUM_OPS) {
+			stats.malformed++;
+			return;
+		}
+		args = op_args[op];
+		if ((op == HID_BATCH_OP_FEATURE) && ((offset + 1) < length)) {
+			args += payload[offset + 1];
+		}
+		if ((offset + 1 + args) > length) {
+			stats.malformed++;
+			return;
+		}
+		stats.commands++;
+		if (!batch_run(op, &payload[offset + 1])) {
+			stats.refused++;
+		}
+		offset += 1 + args;
+	}
+}
+
+uint16_t hid_batch_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 4;
+
+	if (max_length < HID_BATCH_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = HID_BATCH_VERSION;
+	payload[1] = HID_BATCH_NUM_OPS;
+
+	counters = (const uint32_t *) &stats;
+	for (i = 0; i < sizeof(hid_batch_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return HID_BATCH_STATUS_SIZE;
+}
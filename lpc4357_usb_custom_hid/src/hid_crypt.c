@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "timer_service.h"
+#include "dma_service.h"
+#include "report_crypt.h"
+#include "byte_order.h"
+#include "hid_crypt.h"
+
+// Cleared by report_crypt_init(), no need to zero it at reset too.
+static __NOINIT(RAM2) report_crypt_t crypt;
+static uint8_t engine_type;
+static uint32_t sessions;
+
+static aes128_key_t key_schedule;
+
+static void software_set_key(void *ctx, const uint8_t *key) {
+	aes128_set_key((aes128_key_t *) ctx, key);
+}
+
+static void software_encrypt(void *ctx, const uint8_t *in, uint8_t *out, uint32_t blocks) {
+	for (; blocks > 0; blocks--, in += AES128_BLOCK_SIZE, out += AES128_BLOCK_SIZE) {
+		aes128_encrypt((const aes128_key_t *) ctx, in, out);
+	}
+}
+
+static const report_crypt_engine_t software_engine = {software_set_key, software_encrypt, NULL, &key_schedule};
+
+#ifdef HID_CRYPT_AES_ENGINE
+/* ROM moves blocks into the engine on dma_channel and out on dma_channel + 1 */
+static int dma_channel;
+
+static void aes_set_key(void *ctx, const uint8_t *key) {
+	Chip_AES_LoadKeySW((uint8_t *) key);
+}
+
+static void aes_encrypt(void *ctx, const uint8_t *in, uint8_t *out, uint32_t blocks) {
+	Chip_AES_OperateDMA(dma_channel, out, (uint8_t *) in, blocks);
+}
+
+static bool aes_busy(void *ctx) {
+	return dma_service_is_active(dma_channel) || dma_service_is_active(dma_channel + 1);
+}
+
+static const report_crypt_engine_t aes_engine = {aes_set_key, aes_encrypt, aes_busy, NULL};
+#endif
+
+void hid_crypt_init(void) {
+#ifdef HID_CRYPT_AES_ENGINE
+	int out_channel;
+
+	// Two adjacent channels, taken from the top before anybody else
+	// allocates. Software AES still works if they are not available.
+	out_channel = dma_service_alloc(NULL, false);
+	dma_channel = dma_service_alloc(NULL, false);
+	if ((dma_channel >= 0) && (out_channel == dma_channel + 1)) {
+		Chip_AES_Init();
+		Chip_AES_SetMode(CHIP_AES_API_CMD_ENCODE_ECB);
+		if (Chip_AES_Config_DMA(dma_channel) == LPC_OK) {
+			engine_type = HID_CRYPT_ENGINE_AES;
+			report_crypt_init(&crypt, &aes_engine);
+			return;
+		}
+	}
+	if (out_channel >= 0) {
+		dma_service_free(out_channel);
+	}
+	if (dma_channel >= 0) {
+		dma_service_free(dma_channel);
+	}
+#endif
+	engine_type = HID_CRYPT_ENGINE_SOFTWARE;
+	report_crypt_init(&crypt, &software_engine);
+}
+
+bool hid_crypt_in(uint8_t *report, uint32_t length) {
+	return report_crypt_apply(&crypt, REPORT_CRYPT_IN, report, length);
+}
+
+bool hid_crypt_out(uint8_t *report, uint32_t length) {
+	return report_crypt_apply(&crypt, REPORT_CRYPT_OUT, report, length);
+}
+
+bool hid_crypt_pending(void) {
+	return report_crypt_pending(&crypt);
+}
+
+/* Slots are shared with USB interrupt, one engine run is a few microseconds. */
+void hid_crypt_process(void) {
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	report_crypt_process(&crypt);
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+}
+
+bool hid_crypt_set_feature(const uint8_t *payload, uint16_t length) {
+	uint8_t nonce[REPORT_CRYPT_NONCE_SIZE];
+
+	if (length < 1) {
+		return false;
+	}
+
+	switch (payload[0]) {
+	case HID_CRYPT_CMD_KEY:
+		if (length < 1 + AES128_KEY_SIZE) {
+			return false;
+		}
+		report_crypt_set_key(&crypt, &payload[1]);
+		return true;
+
+	case HID_CRYPT_CMD_START:
+		if (length < 6) {
+			return false;
+		}
+		// Host nonce is random, device half only guards against a host
+		// that repeats it.
+		memcpy(nonce, &payload[2], 4);
+		put_u32(&nonce[4], timer_service_now_us() ^ (++sessions << 24));
+		return report_crypt_start(&crypt, nonce, payload[1]);
+
+	case HID_CRYPT_CMD_STOP:
+		report_crypt_stop(&crypt);
+		return true;
+	}
+	return false;
+}
+
+uint16_t hid_crypt_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 12;
+
+	if (max_length < HID_CRYPT_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = crypt.active;
+	payload[1] = crypt.expired;
+	payload[2] = crypt.threshold;
+	payload[3] = engine_type;
+	memcpy(&payload[4], crypt.nonce, REPORT_CRYPT_NONCE_SIZE);
+
+	counters = (const uint32_t *) &crypt.stats;
+	for (i = 0; i < sizeof(report_crypt_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return HID_CRYPT_STATUS_SIZE;
+}
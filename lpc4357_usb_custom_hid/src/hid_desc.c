@@ -30,19 +30,31 @@
  */
 
 #include "app_usbd_cfg.h"
+#include "hid_generic.h"
 
 /*****************************************************************************
  * Private types/enumerations/variables
  ****************************************************************************/
 
+/* Interfaces following HID in the configuration, DFU runtime comes last */
+#if defined(USE_MSC)
+#define USB_DFU_INTERFACE		2
+#define USB_FUNCTION_DESC_SIZE	(USB_INTERFACE_DESC_SIZE + 2 * USB_ENDPOINT_DESC_SIZE)
+#elif defined(USE_CDC)
+#define USB_DFU_INTERFACE		3
+#define USB_FUNCTION_DESC_SIZE	(USB_INTERFACE_ASSOC_DESC_SIZE + 2 * USB_INTERFACE_DESC_SIZE + \
+								 0x13 + 3 * USB_ENDPOINT_DESC_SIZE)
+#else
+#define USB_DFU_INTERFACE		1
+#define USB_FUNCTION_DESC_SIZE	0
+#endif
+#define USB_NUM_INTERFACES		(USB_DFU_INTERFACE + 1)
+#define USB_DFU_DESC_SIZE		(USB_INTERFACE_DESC_SIZE + USB_DFU_DESCRIPTOR_SIZE)
+
 /*****************************************************************************
  * Public types/enumerations/variables
  ****************************************************************************/
 
-#define HID_INPUT_REPORT_BYTES       1				/* size of report in Bytes */
-#define HID_OUTPUT_REPORT_BYTES      1				/* size of report in Bytes */
-#define HID_FEATURE_REPORT_BYTES     1				/* size of report in Bytes */
-
 /**
  * HID Report Descriptor
  */
@@ -50,20 +62,134 @@ const uint8_t HID_ReportDescriptor[] = {
 	HID_UsagePageVendor(0x00),
 	HID_Usage(0x01),
 	HID_Collection(HID_Application),
-	HID_LogicalMin(0),	/* value range: 0 - 0xFF */
-	HID_LogicalMax(0xFF),
 	HID_ReportSize(8),	/* 8 bits */
-	HID_ReportCount(HID_INPUT_REPORT_BYTES),
-	HID_Usage(0x01),
-	HID_Input(HID_Data | HID_Variable | HID_Absolute),
-	HID_ReportCount(HID_OUTPUT_REPORT_BYTES),
+
+	/* LED control */
+	HID_ReportID(HID_REPORT_ID_LED),
+	HID_LogicalMin(0),	/* value range: 0 - 0xFF */
+	HID_LogicalMaxS(0xFF),
+	HID_ReportCount(HID_LED_REPORT_SIZE - 1),
 	HID_Usage(0x01),
 	HID_Output(HID_Data | HID_Variable | HID_Absolute),
 	HID_LogicalMin(1),	/* value range: 1 - 20 */
 	HID_LogicalMax(20),
-	HID_ReportCount(HID_FEATURE_REPORT_BYTES),
+	HID_ReportCount(1),
 	HID_Usage(0x01),
 	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+
+	/* Event capture */
+	HID_ReportID(HID_REPORT_ID_EVENTS),
+	HID_LogicalMin(0),	/* value range: 0 - 0xFF */
+	HID_LogicalMaxS(0xFF),
+	HID_ReportCount(HID_EVENTS_REPORT_SIZE - 1),
+	HID_Usage(0x02),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_EVENTS_FEATURE_SIZE - 1),
+	HID_Usage(0x02),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+
+	/* PWM sequencer */
+	HID_ReportID(HID_REPORT_ID_PWM_SEQ),
+	HID_ReportCount(HID_PWM_SEQ_FEATURE_SIZE - 1),
+	HID_Usage(0x03),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+
+	/* UART bridge */
+	HID_ReportID(HID_REPORT_ID_UART),
+	HID_ReportCount(HID_UART_REPORT_SIZE - 1),
+	HID_Usage(0x04),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_Usage(0x04),
+	HID_Output(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_UART_FEATURE_SIZE - 1),
+	HID_Usage(0x04),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+
+	/* CAN gateway */
+	HID_ReportID(HID_REPORT_ID_CAN),
+	HID_ReportCount(HID_CAN_REPORT_SIZE - 1),
+	HID_Usage(0x05),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_Usage(0x05),
+	HID_Output(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_CAN_FEATURE_SIZE - 1),
+	HID_Usage(0x05),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+
+	/* I2S audio stream */
+	HID_ReportID(HID_REPORT_ID_AUDIO),
+	HID_ReportCount(HID_AUDIO_REPORT_SIZE - 1),
+	HID_Usage(0x06),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_Usage(0x06),
+	HID_Output(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_AUDIO_FEATURE_SIZE - 1),
+	HID_Usage(0x06),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+
+	/* SD card recorder */
+	HID_ReportID(HID_REPORT_ID_RECORDER),
+	HID_ReportCount(HID_RECORDER_REPORT_SIZE - 1),
+	HID_Usage(0x07),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_Usage(0x07),
+	HID_Output(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_RECORDER_FEATURE_SIZE - 1),
+	HID_Usage(0x07),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* Mass storage control */
+	HID_ReportID(HID_REPORT_ID_MSC),
+	HID_ReportCount(HID_MSC_FEATURE_SIZE - 1),
+	HID_Usage(0x08),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* Encrypted reports control */
+	HID_ReportID(HID_REPORT_ID_CRYPT),
+	HID_ReportCount(HID_CRYPT_FEATURE_SIZE - 1),
+	HID_Usage(0x09),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* Saved settings */
+	HID_ReportID(HID_REPORT_ID_SETTINGS),
+	HID_ReportCount(HID_SETTINGS_FEATURE_SIZE - 1),
+	HID_Usage(0x0A),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* Suspend and remote wakeup status */
+	HID_ReportID(HID_REPORT_ID_POWER),
+	HID_ReportCount(HID_POWER_FEATURE_SIZE - 1),
+	HID_Usage(0x0B),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* Boot stage timing */
+	HID_ReportID(HID_REPORT_ID_BOOT),
+	HID_ReportCount(HID_BOOT_FEATURE_SIZE - 1),
+	HID_Usage(0x0C),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* SGPIO logic capture */
+	HID_ReportID(HID_REPORT_ID_LOGIC),
+	HID_ReportCount(HID_LOGIC_REPORT_SIZE - 1),
+	HID_Usage(0x0D),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_LOGIC_FEATURE_SIZE - 1),
+	HID_Usage(0x0D),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* Tagged calls */
+	HID_ReportID(HID_REPORT_ID_RPC),
+	HID_ReportCount(HID_RPC_REPORT_SIZE - 1),
+	HID_Usage(0x0E),
+	HID_Input(HID_Data | HID_Variable | HID_Absolute),
+	HID_Usage(0x0E),
+	HID_Output(HID_Data | HID_Variable | HID_Absolute),
+	/* Batched commands */
+	HID_ReportID(HID_REPORT_ID_BATCH),
+	HID_ReportCount(HID_BATCH_REPORT_SIZE - 1),
+	HID_Usage(0x0F),
+	HID_Output(HID_Data | HID_Variable | HID_Absolute),
+	HID_ReportCount(HID_BATCH_FEATURE_SIZE - 1),
+	HID_Usage(0x0F),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
+	/* CDC frame statistics */
+	HID_ReportID(HID_REPORT_ID_CDC),
+	HID_ReportCount(HID_CDC_FEATURE_SIZE - 1),
+	HID_Usage(0x10),
+	HID_Feature(HID_Data | HID_Variable | HID_Absolute),
 	HID_EndCollection,
 };
 const uint16_t HID_ReportDescSize = sizeof(HID_ReportDescriptor);
@@ -75,9 +201,16 @@ ALIGNED(4) const uint8_t USB_DeviceDescriptor[] = {
 	USB_DEVICE_DESC_SIZE,			/* bLength */
 	USB_DEVICE_DESCRIPTOR_TYPE,		/* bDescriptorType */
 	WBVAL(0x0200),					/* bcdUSB: 2.00 */
+#ifdef USE_CDC
+	/* Interface association descriptor groups the CDC interfaces */
+	USB_DEVICE_CLASS_MISCELLANEOUS,	/* bDeviceClass */
+	0x02,							/* bDeviceSubClass */
+	0x01,							/* bDeviceProtocol */
+#else
 	0x00,							/* bDeviceClass */
 	0x00,							/* bDeviceSubClass */
 	0x00,							/* bDeviceProtocol */
+#endif
 	USB_MAX_PACKET0,				/* bMaxPacketSize0 */
 
 	/*
@@ -120,12 +253,15 @@ ALIGNED(4) uint8_t USB_HsConfigDescriptor[] = {
 		USB_INTERFACE_DESC_SIZE       +
 		HID_DESC_SIZE                 +
 		USB_ENDPOINT_DESC_SIZE        +
-		USB_ENDPOINT_DESC_SIZE
+		USB_ENDPOINT_DESC_SIZE        +
+		USB_FUNCTION_DESC_SIZE        +
+		USB_DFU_DESC_SIZE
 		),
-	0x01,							/* bNumInterfaces */
+	USB_NUM_INTERFACES,				/* bNumInterfaces */
 	0x01,							/* bConfigurationValue */
 	0x00,							/* iConfiguration */
-	USB_CONFIG_SELF_POWERED,		/* bmAttributes */
+	USB_CONFIG_SELF_POWERED |
+	USB_CONFIG_REMOTE_WAKEUP,		/* bmAttributes */
 	USB_CONFIG_POWER_MA(100),		/* bMaxPower */
 
 	/* Interface 0, Alternate Setting 0, HID Class */
@@ -152,15 +288,132 @@ ALIGNED(4) uint8_t USB_HsConfigDescriptor[] = {
 	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
 	HID_EP_IN,						/* bEndpointAddress */
 	USB_ENDPOINT_TYPE_INTERRUPT,	/* bmAttributes */
-	WBVAL(0x0004),					/* wMaxPacketSize */
-	0x08,		/* 16ms */          /* bInterval */
+	WBVAL(HID_REPORT_MAX_SIZE),		/* wMaxPacketSize */
+	0x01,		/* 125us */         /* bInterval */
 	/* Endpoint, HID Interrupt Out */
 	USB_ENDPOINT_DESC_SIZE,			/* bLength */
 	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
 	HID_EP_OUT,						/* bEndpointAddress */
 	USB_ENDPOINT_TYPE_INTERRUPT,	/* bmAttributes */
-	WBVAL(0x0004),					/* wMaxPacketSize */
-	0x08,		/* 16ms */          /* bInterval */
+	WBVAL(HID_REPORT_MAX_SIZE),		/* wMaxPacketSize */
+	0x01,		/* 125us */         /* bInterval */
+#ifdef USE_MSC
+	/* Interface 1, Alternate Setting 0, MSC Class */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x01,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x02,							/* bNumEndpoints */
+	USB_DEVICE_CLASS_STORAGE,		/* bInterfaceClass */
+	MSC_SUBCLASS_SCSI,				/* bInterfaceSubClass */
+	MSC_PROTOCOL_BULK_ONLY,			/* bInterfaceProtocol */
+	0x05,							/* iInterface */
+	/* Endpoint, MSC Bulk In */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	MSC_EP_IN,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_HS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+	/* Endpoint, MSC Bulk Out */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	MSC_EP_OUT,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_HS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+#endif
+#ifdef USE_CDC
+	/* Interface association, CDC interfaces 1 and 2 */
+	USB_INTERFACE_ASSOC_DESC_SIZE,	/* bLength */
+	USB_INTERFACE_ASSOCIATION_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x01,							/* bFirstInterface */
+	0x02,							/* bInterfaceCount */
+	CDC_COMMUNICATION_INTERFACE_CLASS,	/* bFunctionClass */
+	CDC_ABSTRACT_CONTROL_MODEL,		/* bFunctionSubClass */
+	0x00,							/* bFunctionProtocol */
+	0x06,							/* iFunction */
+	/* Interface 1, Alternate Setting 0, CDC Communication Class */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x01,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x01,							/* bNumEndpoints */
+	CDC_COMMUNICATION_INTERFACE_CLASS,	/* bInterfaceClass */
+	CDC_ABSTRACT_CONTROL_MODEL,		/* bInterfaceSubClass */
+	0x00,							/* bInterfaceProtocol */
+	0x06,							/* iInterface */
+	/* Header Functional Descriptor */
+	0x05,							/* bLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_HEADER,						/* bDescriptorSubtype */
+	WBVAL(CDC_V1_10),				/* bcdCDC 1.10 */
+	/* Call Management Functional Descriptor */
+	0x05,							/* bFunctionLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_CALL_MANAGEMENT,			/* bDescriptorSubtype */
+	0x01,							/* bmCapabilities: device handles call management */
+	0x02,							/* bDataInterface */
+	/* Abstract Control Management Functional Descriptor */
+	0x04,							/* bFunctionLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_ABSTRACT_CONTROL_MANAGEMENT,	/* bDescriptorSubtype */
+	0x02,							/* bmCapabilities: line coding and serial state */
+	/* Union Functional Descriptor */
+	0x05,							/* bFunctionLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_UNION,						/* bDescriptorSubtype */
+	0x01,							/* bMasterInterface */
+	0x02,							/* bSlaveInterface0 */
+	/* Endpoint, CDC Interrupt In */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	CDC_EP_INT,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_INTERRUPT,	/* bmAttributes */
+	WBVAL(0x0010),					/* wMaxPacketSize */
+	0x08,		/* 16ms */           /* bInterval */
+	/* Interface 2, Alternate Setting 0, CDC Data Class */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x02,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x02,							/* bNumEndpoints */
+	CDC_DATA_INTERFACE_CLASS,		/* bInterfaceClass */
+	0x00,							/* bInterfaceSubClass */
+	0x00,							/* bInterfaceProtocol */
+	0x00,							/* iInterface */
+	/* Endpoint, CDC Bulk In */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	CDC_EP_IN,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_HS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+	/* Endpoint, CDC Bulk Out */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	CDC_EP_OUT,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_HS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+#endif
+	/* Interface 1..3, Alternate Setting 0, DFU Runtime */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	USB_DFU_INTERFACE,				/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x00,							/* bNumEndpoints */
+	USB_DEVICE_CLASS_APP,			/* bInterfaceClass */
+	USB_DFU_SUBCLASS,				/* bInterfaceSubClass */
+	0x01,							/* bInterfaceProtocol: runtime */
+	0x07,							/* iInterface */
+	/* DFU Functional Descriptor */
+	USB_DFU_DESCRIPTOR_SIZE,		/* bLength */
+	USB_DFU_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD | USB_DFU_WILL_DETACH,	/* bmAttributes */
+	WBVAL(0x00FF),					/* wDetachTimeOut: 255ms */
+	WBVAL(USB_DFU_XFER_SIZE),		/* wTransferSize */
+	WBVAL(0x0110),					/* bcdDFUVersion: 1.10 */
 	/* Terminator */
 	0								/* bLength */
 };
@@ -178,12 +431,15 @@ ALIGNED(4) uint8_t USB_FsConfigDescriptor[] = {
 		USB_INTERFACE_DESC_SIZE       +
 		HID_DESC_SIZE                 +
 		USB_ENDPOINT_DESC_SIZE        +
-		USB_ENDPOINT_DESC_SIZE
+		USB_ENDPOINT_DESC_SIZE        +
+		USB_FUNCTION_DESC_SIZE        +
+		USB_DFU_DESC_SIZE
 		),
-	0x01,							/* bNumInterfaces */
+	USB_NUM_INTERFACES,				/* bNumInterfaces */
 	0x01,							/* bConfigurationValue */
 	0x00,							/* iConfiguration */
-	USB_CONFIG_SELF_POWERED,		/* bmAttributes */
+	USB_CONFIG_SELF_POWERED |
+	USB_CONFIG_REMOTE_WAKEUP,		/* bmAttributes */
 	USB_CONFIG_POWER_MA(100),		/* bMaxPower */
 
 	/* Interface 0, Alternate Setting 0, HID Class */
@@ -210,15 +466,209 @@ ALIGNED(4) uint8_t USB_FsConfigDescriptor[] = {
 	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
 	HID_EP_IN,						/* bEndpointAddress */
 	USB_ENDPOINT_TYPE_INTERRUPT,	/* bmAttributes */
-	WBVAL(0x0004),					/* wMaxPacketSize */
-	0x20,		/* 16ms */          /* bInterval */
+	WBVAL(HID_REPORT_MAX_SIZE),		/* wMaxPacketSize */
+	0x01,		/* 1ms */           /* bInterval */
 	/* Endpoint, HID Interrupt Out */
 	USB_ENDPOINT_DESC_SIZE,			/* bLength */
 	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
 	HID_EP_OUT,						/* bEndpointAddress */
 	USB_ENDPOINT_TYPE_INTERRUPT,	/* bmAttributes */
-	WBVAL(0x0004),					/* wMaxPacketSize */
-	0x20,							/* bInterval: 16ms */
+	WBVAL(HID_REPORT_MAX_SIZE),		/* wMaxPacketSize */
+	0x01,							/* bInterval: 1ms */
+#ifdef USE_MSC
+	/* Interface 1, Alternate Setting 0, MSC Class */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x01,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x02,							/* bNumEndpoints */
+	USB_DEVICE_CLASS_STORAGE,		/* bInterfaceClass */
+	MSC_SUBCLASS_SCSI,				/* bInterfaceSubClass */
+	MSC_PROTOCOL_BULK_ONLY,			/* bInterfaceProtocol */
+	0x05,							/* iInterface */
+	/* Endpoint, MSC Bulk In */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	MSC_EP_IN,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_FS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+	/* Endpoint, MSC Bulk Out */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	MSC_EP_OUT,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_FS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+#endif
+#ifdef USE_CDC
+	/* Interface association, CDC interfaces 1 and 2 */
+	USB_INTERFACE_ASSOC_DESC_SIZE,	/* bLength */
+	USB_INTERFACE_ASSOCIATION_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x01,							/* bFirstInterface */
+	0x02,							/* bInterfaceCount */
+	CDC_COMMUNICATION_INTERFACE_CLASS,	/* bFunctionClass */
+	CDC_ABSTRACT_CONTROL_MODEL,		/* bFunctionSubClass */
+	0x00,							/* bFunctionProtocol */
+	0x06,							/* iFunction */
+	/* Interface 1, Alternate Setting 0, CDC Communication Class */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x01,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x01,							/* bNumEndpoints */
+	CDC_COMMUNICATION_INTERFACE_CLASS,	/* bInterfaceClass */
+	CDC_ABSTRACT_CONTROL_MODEL,		/* bInterfaceSubClass */
+	0x00,							/* bInterfaceProtocol */
+	0x06,							/* iInterface */
+	/* Header Functional Descriptor */
+	0x05,							/* bLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_HEADER,						/* bDescriptorSubtype */
+	WBVAL(CDC_V1_10),				/* bcdCDC 1.10 */
+	/* Call Management Functional Descriptor */
+	0x05,							/* bFunctionLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_CALL_MANAGEMENT,			/* bDescriptorSubtype */
+	0x01,							/* bmCapabilities: device handles call management */
+	0x02,							/* bDataInterface */
+	/* Abstract Control Management Functional Descriptor */
+	0x04,							/* bFunctionLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_ABSTRACT_CONTROL_MANAGEMENT,	/* bDescriptorSubtype */
+	0x02,							/* bmCapabilities: line coding and serial state */
+	/* Union Functional Descriptor */
+	0x05,							/* bFunctionLength */
+	CDC_CS_INTERFACE,				/* bDescriptorType */
+	CDC_UNION,						/* bDescriptorSubtype */
+	0x01,							/* bMasterInterface */
+	0x02,							/* bSlaveInterface0 */
+	/* Endpoint, CDC Interrupt In */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	CDC_EP_INT,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_INTERRUPT,	/* bmAttributes */
+	WBVAL(0x0010),					/* wMaxPacketSize */
+	0x10,		/* 16ms */           /* bInterval */
+	/* Interface 2, Alternate Setting 0, CDC Data Class */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x02,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x02,							/* bNumEndpoints */
+	CDC_DATA_INTERFACE_CLASS,		/* bInterfaceClass */
+	0x00,							/* bInterfaceSubClass */
+	0x00,							/* bInterfaceProtocol */
+	0x00,							/* iInterface */
+	/* Endpoint, CDC Bulk In */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	CDC_EP_IN,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_FS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+	/* Endpoint, CDC Bulk Out */
+	USB_ENDPOINT_DESC_SIZE,			/* bLength */
+	USB_ENDPOINT_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	CDC_EP_OUT,						/* bEndpointAddress */
+	USB_ENDPOINT_TYPE_BULK,			/* bmAttributes */
+	WBVAL(USB_FS_MAX_BULK_PACKET),	/* wMaxPacketSize */
+	0x00,							/* bInterval: ignore */
+#endif
+	/* Interface 1..3, Alternate Setting 0, DFU Runtime */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	USB_DFU_INTERFACE,				/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x00,							/* bNumEndpoints */
+	USB_DEVICE_CLASS_APP,			/* bInterfaceClass */
+	USB_DFU_SUBCLASS,				/* bInterfaceSubClass */
+	0x01,							/* bInterfaceProtocol: runtime */
+	0x07,							/* iInterface */
+	/* DFU Functional Descriptor */
+	USB_DFU_DESCRIPTOR_SIZE,		/* bLength */
+	USB_DFU_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD | USB_DFU_WILL_DETACH,	/* bmAttributes */
+	WBVAL(0x00FF),					/* wDetachTimeOut: 255ms */
+	WBVAL(USB_DFU_XFER_SIZE),		/* wTransferSize */
+	WBVAL(0x0110),					/* bcdDFUVersion: 1.10 */
+	/* Terminator */
+	0								/* bLength */
+};
+
+/**
+ * DFU mode Device Descriptor, same IDs so host tools find the device again
+ */
+ALIGNED(4) const uint8_t USB_DfuDeviceDescriptor[] = {
+	USB_DEVICE_DESC_SIZE,			/* bLength */
+	USB_DEVICE_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	WBVAL(0x0200),					/* bcdUSB: 2.00 */
+	0x00,							/* bDeviceClass */
+	0x00,							/* bDeviceSubClass */
+	0x00,							/* bDeviceProtocol */
+	USB_MAX_PACKET0,				/* bMaxPacketSize0 */
+	WBVAL(0x1209),					/* idVendor */
+	WBVAL(0x0001),					/* idProduct */
+	WBVAL(0x0100),					/* bcdDevice: 1.00 */
+	0x01,							/* iManufacturer */
+	0x02,							/* iProduct */
+	0x03,							/* iSerialNumber */
+	0x01							/* bNumConfigurations */
+};
+
+/**
+ * DFU mode Configuration Descriptor
+ * One alternate setting per flash, see dfu_update.h
+ */
+ALIGNED(4) uint8_t USB_DfuConfigDescriptor[] = {
+	/* Configuration 1 */
+	USB_CONFIGURATION_DESC_SIZE,		/* bLength */
+	USB_CONFIGURATION_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	WBVAL(								/* wTotalLength */
+		USB_CONFIGURATION_DESC_SIZE   +
+		USB_DFU_DESC_SIZE             +
+		USB_DFU_DESC_SIZE
+		),
+	0x01,							/* bNumInterfaces */
+	0x01,							/* bConfigurationValue */
+	0x00,							/* iConfiguration */
+	USB_CONFIG_SELF_POWERED,		/* bmAttributes */
+	USB_CONFIG_POWER_MA(100),		/* bMaxPower */
+
+	/* Interface 0, Alternate Setting 0, internal flash */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x00,							/* bInterfaceNumber */
+	0x00,							/* bAlternateSetting */
+	0x00,							/* bNumEndpoints */
+	USB_DEVICE_CLASS_APP,			/* bInterfaceClass */
+	USB_DFU_SUBCLASS,				/* bInterfaceSubClass */
+	0x02,							/* bInterfaceProtocol: DFU mode */
+	0x08,							/* iInterface */
+	/* DFU Functional Descriptor */
+	USB_DFU_DESCRIPTOR_SIZE,		/* bLength */
+	USB_DFU_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD,	/* bmAttributes */
+	WBVAL(0x00FF),					/* wDetachTimeOut: 255ms */
+	WBVAL(USB_DFU_XFER_SIZE),		/* wTransferSize */
+	WBVAL(0x0110),					/* bcdDFUVersion: 1.10 */
+	/* Interface 0, Alternate Setting 1, SPIFI flash */
+	USB_INTERFACE_DESC_SIZE,		/* bLength */
+	USB_INTERFACE_DESCRIPTOR_TYPE,	/* bDescriptorType */
+	0x00,							/* bInterfaceNumber */
+	0x01,							/* bAlternateSetting */
+	0x00,							/* bNumEndpoints */
+	USB_DEVICE_CLASS_APP,			/* bInterfaceClass */
+	USB_DFU_SUBCLASS,				/* bInterfaceSubClass */
+	0x02,							/* bInterfaceProtocol: DFU mode */
+	0x09,							/* iInterface */
+	/* DFU Functional Descriptor */
+	USB_DFU_DESCRIPTOR_SIZE,		/* bLength */
+	USB_DFU_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	USB_DFU_CAN_DOWNLOAD | USB_DFU_CAN_UPLOAD,	/* bmAttributes */
+	WBVAL(0x00FF),					/* wDetachTimeOut: 255ms */
+	WBVAL(USB_DFU_XFER_SIZE),		/* wTransferSize */
+	WBVAL(0x0110),					/* bcdDFUVersion: 1.10 */
 	/* Terminator */
 	0								/* bLength */
 };
@@ -226,7 +676,7 @@ ALIGNED(4) uint8_t USB_FsConfigDescriptor[] = {
 /**
  * USB String Descriptor (optional)
  */
-const uint8_t USB_StringDescriptor[] = {
+uint8_t USB_StringDescriptor[] = {
 	/* Index 0x00: LANGID Codes */
 	0x04,							/* bLength */
 	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
@@ -269,16 +719,68 @@ const uint8_t USB_StringDescriptor[] = {
 	'r', 0,
 	't', 0,
 	's', 0,
-	/* Index 0x03: Serial Number */
-	(1 * 2 + 2),					/* bLength (13 Char + Type + length) */
+	/* Index 0x03: Serial Number, unique ID in hex is filled in at startup */
+	(USB_SERIAL_NUMBER_CHARS * 2 + 2),	/* bLength (32 Char + Type + length) */
 	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
-	'0', 0,
+	'0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0,
+	'0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0,
+	'0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0,
+	'0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0, '0', 0,
 	/* Index 0x04: Interface 0, Alternate Setting 0 */
 	(3 * 2 + 2),					/* bLength (3 Char + Type + length) */
 	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
 	'H', 0,
 	'I', 0,
 	'D', 0,
+	/* Index 0x05: Interface 1, Alternate Setting 0 */
+	(3 * 2 + 2),					/* bLength (3 Char + Type + length) */
+	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	'M', 0,
+	'S', 0,
+	'C', 0,
+	/* Index 0x06: Interface 1, CDC */
+	(3 * 2 + 2),					/* bLength (3 Char + Type + length) */
+	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	'C', 0,
+	'D', 0,
+	'C', 0,
+	/* Index 0x07: DFU runtime */
+	(3 * 2 + 2),					/* bLength (3 Char + Type + length) */
+	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	'D', 0,
+	'F', 0,
+	'U', 0,
+	/* Index 0x08: DFU mode, Alternate Setting 0 */
+	(14 * 2 + 2),					/* bLength (14 Char + Type + length) */
+	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	'I', 0,
+	'n', 0,
+	't', 0,
+	'e', 0,
+	'r', 0,
+	'n', 0,
+	'a', 0,
+	'l', 0,
+	' ', 0,
+	'f', 0,
+	'l', 0,
+	'a', 0,
+	's', 0,
+	'h', 0,
+	/* Index 0x09: DFU mode, Alternate Setting 1 */
+	(11 * 2 + 2),					/* bLength (11 Char + Type + length) */
+	USB_STRING_DESCRIPTOR_TYPE,		/* bDescriptorType */
+	'S', 0,
+	'P', 0,
+	'I', 0,
+	'F', 0,
+	'I', 0,
+	' ', 0,
+	'f', 0,
+	'l', 0,
+	'a', 0,
+	's', 0,
+	'h', 0,
 };
 
 
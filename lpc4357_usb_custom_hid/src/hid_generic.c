@@ -33,6 +33,23 @@
 #include <stdint.h>
 #include <string.h>
 #include "usbd_rom_api.h"
+#include "hid_generic.h"
+#include "event_capture.h"
+#include "gpio_events.h"
+#include "pwm_sequencer.h"
+#include "uart_bridge.h"
+#include "can_gateway.h"
+#include "audio_stream.h"
+#include "sd_recorder.h"
+#include "msc_disk.h"
+#include "hid_crypt.h"
+#include "settings.h"
+#include "usb_power.h"
+#include "boot_stages.h"
+#include "logic_capture.h"
+#include "hid_rpc.h"
+#include "hid_batch.h"
+#include "cdc_channel.h"
 
 /*****************************************************************************
  * Private types/enumerations/variables
@@ -40,13 +57,18 @@
 
 /* Buffer to hold report data */
 typedef struct {
-	uint8_t out_report;
-	uint8_t in_report;
+	uint8_t out_report[HID_REPORT_MAX_SIZE];
+	uint8_t in_report[HID_REPORT_MAX_SIZE];
 } report_data_t;
 
 static report_data_t *report_data;
 
-static int sw2_intr_report_pending;
+static hid_in_source_t in_sources[HID_IN_MAX_SOURCES];
+static uint32_t num_in_sources;
+static uint32_t next_in_source;
+static volatile bool in_report_busy;
+static bool in_claimed;
+
 static USBD_HANDLE_T g_hUsb;
 /*****************************************************************************
  * Public types/enumerations/variables
@@ -61,21 +83,96 @@ extern void MCPWM_CH1_Update(uint8_t rate);
  * Private functions
  ****************************************************************************/
 
+/* Output report received on interrupt OUT endpoint, through SET_REPORT or from CDC. */
+void hid_out_report(const uint8_t *report, uint32_t length)
+{
+	uint8_t clear[HID_REPORT_MAX_SIZE];
+
+	if ((length < 1) || (length > HID_REPORT_MAX_SIZE)) {
+		return;
+	}
+
+	// Decrypted copy, caller's buffer may be reused by the USB stack.
+	memcpy(clear, report, length);
+	if (!hid_crypt_out(clear, length)) {
+		return;
+	}
+	report = clear;
+
+	switch (report[0]) {
+	case HID_REPORT_ID_LED:
+		if (length >= HID_LED_REPORT_SIZE) {
+			board_led_set(LED5, report[1] & 0x1);
+		}
+		break;
+
+	case HID_REPORT_ID_UART:
+		uart_bridge_write(&report[1], length - 1);
+		break;
+
+	case HID_REPORT_ID_CAN:
+		can_gateway_write(&report[1], length - 1);
+		break;
+
+	case HID_REPORT_ID_AUDIO:
+		audio_stream_write(&report[1], length - 1);
+		break;
+
+	case HID_REPORT_ID_RECORDER:
+		sd_recorder_write(&report[1], length - 1);
+		break;
+
+	case HID_REPORT_ID_RPC:
+		hid_rpc_write(&report[1], length - 1);
+		break;
+
+	case HID_REPORT_ID_BATCH:
+		hid_batch_write(&report[1], length - 1);
+		break;
+	}
+}
+
+/* Must be called from USB interrupt context or with USB interrupt disabled. */
+static void HID_InPump(void)
+{
+	uint32_t length;
+
+	if (in_report_busy || in_claimed || !is_device_active) {
+		return;
+	}
+
+	length = hid_in_poll(report_data->in_report);
+	if (length > 0) {
+		in_report_busy = true;
+		USBD_API->hw->WriteEP(g_hUsb, HID_EP_IN, report_data->in_report, length);
+	}
+}
+
 /*  HID get report callback function. */
 static ErrorCode_t HID_GetReport(USBD_HANDLE_T hHid, USB_SETUP_PACKET *pSetup, uint8_t * *pBuffer, uint16_t *plength)
 {
-	/* ReportID = SetupPacket.wValue.WB.L; */
+	uint8_t report_id = pSetup->wValue.WB.L;
+
 	switch (pSetup->wValue.WB.H) {
 	case HID_REPORT_INPUT:
-		*pBuffer[0] = report_data->in_report;
-		*plength = 1;
+		if (report_id != HID_REPORT_ID_EVENTS) {
+			return ERR_USBD_STALL;
+		}
+		memset(*pBuffer, 0, HID_EVENTS_REPORT_SIZE);
+		(*pBuffer)[0] = report_id;
+		event_capture_fill_report(&(*pBuffer)[1], HID_EVENTS_REPORT_SIZE - 1);
+		*plength = HID_EVENTS_REPORT_SIZE;
 		break;
 
 	case HID_REPORT_OUTPUT:
 		return ERR_USBD_STALL;			/* Not Supported */
 
 	case HID_REPORT_FEATURE:
-		return ERR_USBD_STALL;			/* Not Supported */
+		(*pBuffer)[0] = report_id;
+		if (!hid_get_feature(*pBuffer, plength)) {
+			return ERR_USBD_STALL;
+		}
+		break;
 	}
 	return LPC_OK;
 }
@@ -83,26 +180,23 @@ static ErrorCode_t HID_GetReport(USBD_HANDLE_T hHid, USB_SETUP_PACKET *pSetup, u
 /* HID set report callback function. */
 static ErrorCode_t HID_SetReport(USBD_HANDLE_T hHid, USB_SETUP_PACKET *pSetup, uint8_t * *pBuffer, uint16_t length)
 {
-	uint8_t blink_rate;
-
 	/* we will reuse standard EP0Buf */
 	if (length == 0) {
 		return LPC_OK;
 	}
 
-	/* ReportID = SetupPacket.wValue.WB.L; */
 	switch (pSetup->wValue.WB.H) {
 	case HID_REPORT_INPUT:
 		return ERR_USBD_STALL;			/* Not Supported */
 
 	case HID_REPORT_OUTPUT:
-		report_data->out_report = **pBuffer;
-		board_led_set(LED5, report_data->out_report & 0x1);
+		hid_out_report(*pBuffer, length);
 		break;
 
 	case HID_REPORT_FEATURE:
-		blink_rate = **pBuffer;
-		MCPWM_CH1_Update(blink_rate);
+		if (!hid_set_feature(*pBuffer, length)) {
+			return ERR_USBD_STALL;
+		}
 		break;
 	}
 	return LPC_OK;
@@ -112,41 +206,276 @@ static ErrorCode_t HID_SetReport(USBD_HANDLE_T hHid, USB_SETUP_PACKET *pSetup, u
 static ErrorCode_t HID_Ep_Hdlr(USBD_HANDLE_T hUsb, void *data, uint32_t event)
 {
 	USB_HID_CTRL_T *pHidCtrl = (USB_HID_CTRL_T *) data;
+	uint32_t length;
 
 	switch (event) {
 	case USB_EVT_IN:
-		sw2_intr_report_pending = 0;
+		in_report_busy = false;
+		usb_power_in_done();
+		HID_InPump();
 		break;
 
 	case USB_EVT_OUT_NAK:
-		USBD_API->hw->ReadReqEP(hUsb, pHidCtrl->epout_adr, &report_data->out_report, 1);
+		USBD_API->hw->ReadReqEP(hUsb, pHidCtrl->epout_adr, report_data->out_report, HID_REPORT_MAX_SIZE);
 		break;
 
 	case USB_EVT_OUT:
-		USBD_API->hw->ReadEP(hUsb, pHidCtrl->epout_adr, &report_data->out_report);
-		board_led_set(LED5, report_data->out_report & 0x1);
+		length = USBD_API->hw->ReadEP(hUsb, pHidCtrl->epout_adr, report_data->out_report);
+		hid_out_report(report_data->out_report, length);
+		// Call responses go out now rather than on the next main loop kick.
+		HID_InPump();
 		break;
 	}
 	return LPC_OK;
 }
 
-void GPIO0_IRQHandler(void) {
-	Chip_PININT_ClearFallStates(LPC_GPIO_PIN_INT, PININTCH0);
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
 
-	// Report only when device is configured and not suspended.
-	if (is_device_active) {
-		sw2_intr_report_pending++;
+static USB_HID_REPORT_T hid_reports_data[1];
 
-		report_data->in_report = (uint8_t) sw2_intr_report_pending;
-		USBD_API->hw->WriteEP(g_hUsb, HID_EP_IN, &report_data->in_report, 1);
+bool hid_in_add_source(hid_in_source_t source)
+{
+	if (num_in_sources >= HID_IN_MAX_SOURCES) {
+		return false;
 	}
+	in_sources[num_in_sources++] = source;
+	return true;
 }
 
-/*****************************************************************************
- * Public functions
- ****************************************************************************/
+/* Feature report read, report[0] holds the report ID. */
+bool hid_get_feature(uint8_t *report, uint16_t *plength)
+{
+	uint8_t report_id = report[0];
+
+	switch (report_id) {
+	case HID_REPORT_ID_PWM_SEQ:
+		memset(report, 0, HID_PWM_SEQ_FEATURE_SIZE);
+		report[0] = report_id;
+		pwm_sequencer_get_feature(&report[1], HID_PWM_SEQ_FEATURE_SIZE - 1);
+		*plength = HID_PWM_SEQ_FEATURE_SIZE;
+		break;
 
-static USB_HID_REPORT_T hid_reports_data[1];
+	case HID_REPORT_ID_UART:
+		memset(report, 0, HID_UART_FEATURE_SIZE);
+		report[0] = report_id;
+		uart_bridge_get_feature(&report[1], HID_UART_FEATURE_SIZE - 1);
+		*plength = HID_UART_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_CAN:
+		memset(report, 0, HID_CAN_FEATURE_SIZE);
+		report[0] = report_id;
+		can_gateway_get_feature(&report[1], HID_CAN_FEATURE_SIZE - 1);
+		*plength = HID_CAN_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_AUDIO:
+		memset(report, 0, HID_AUDIO_FEATURE_SIZE);
+		report[0] = report_id;
+		audio_stream_get_feature(&report[1], HID_AUDIO_FEATURE_SIZE - 1);
+		*plength = HID_AUDIO_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_RECORDER:
+		memset(report, 0, HID_RECORDER_FEATURE_SIZE);
+		report[0] = report_id;
+		sd_recorder_get_feature(&report[1], HID_RECORDER_FEATURE_SIZE - 1);
+		*plength = HID_RECORDER_FEATURE_SIZE;
+		break;
+
+#ifdef USE_MSC
+	case HID_REPORT_ID_MSC:
+		memset(report, 0, HID_MSC_FEATURE_SIZE);
+		report[0] = report_id;
+		msc_disk_get_feature(&report[1], HID_MSC_FEATURE_SIZE - 1);
+		*plength = HID_MSC_FEATURE_SIZE;
+		break;
+#endif
+
+	case HID_REPORT_ID_CRYPT:
+		memset(report, 0, HID_CRYPT_FEATURE_SIZE);
+		report[0] = report_id;
+		hid_crypt_get_feature(&report[1], HID_CRYPT_FEATURE_SIZE - 1);
+		*plength = HID_CRYPT_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_SETTINGS:
+		memset(report, 0, HID_SETTINGS_FEATURE_SIZE);
+		report[0] = report_id;
+		settings_get_feature(&report[1], HID_SETTINGS_FEATURE_SIZE - 1);
+		*plength = HID_SETTINGS_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_POWER:
+		memset(report, 0, HID_POWER_FEATURE_SIZE);
+		report[0] = report_id;
+		usb_power_get_feature(&report[1], HID_POWER_FEATURE_SIZE - 1);
+		*plength = HID_POWER_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_BOOT:
+		memset(report, 0, HID_BOOT_FEATURE_SIZE);
+		report[0] = report_id;
+		boot_stages_get_feature(&report[1], HID_BOOT_FEATURE_SIZE - 1);
+		*plength = HID_BOOT_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_LOGIC:
+		memset(report, 0, HID_LOGIC_FEATURE_SIZE);
+		report[0] = report_id;
+		logic_capture_get_feature(&report[1], HID_LOGIC_FEATURE_SIZE - 1);
+		*plength = HID_LOGIC_FEATURE_SIZE;
+		break;
+
+	case HID_REPORT_ID_BATCH:
+		memset(report, 0, HID_BATCH_FEATURE_SIZE);
+		report[0] = report_id;
+		hid_batch_get_feature(&report[1], HID_BATCH_FEATURE_SIZE - 1);
+		*plength = HID_BATCH_FEATURE_SIZE;
+		break;
+
+#ifdef USE_CDC
+	case HID_REPORT_ID_CDC:
+		memset(report, 0, HID_CDC_FEATURE_SIZE);
+		report[0] = report_id;
+		cdc_channel_get_feature(&report[1], HID_CDC_FEATURE_SIZE - 1);
+		*plength = HID_CDC_FEATURE_SIZE;
+		break;
+#endif
+
+	default:
+		return false;
+	}
+	return true;
+}
+
+/* Feature report write, report[0] holds the report ID. */
+bool hid_set_feature(const uint8_t *report, uint16_t length)
+{
+	uint8_t report_id = report[0];
+	const uint8_t *payload = &report[1];
+
+	switch (report_id) {
+	case HID_REPORT_ID_LED:
+		if (length < HID_LED_REPORT_SIZE) {
+			return false;
+		}
+		MCPWM_CH1_Update(payload[0]);
+		settings_set(SETTINGS_KEY_BLINK_RATE, payload, 1);
+		break;
+
+	case HID_REPORT_ID_EVENTS:
+		if (!gpio_events_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_PWM_SEQ:
+		if (!pwm_sequencer_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_UART:
+		if (!uart_bridge_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_CAN:
+		if (!can_gateway_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_AUDIO:
+		if (!audio_stream_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_RECORDER:
+		if (!sd_recorder_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+#ifdef USE_MSC
+	case HID_REPORT_ID_MSC:
+		if (!msc_disk_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+#endif
+
+	case HID_REPORT_ID_CRYPT:
+		if (!hid_crypt_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_SETTINGS:
+		if (!settings_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	case HID_REPORT_ID_LOGIC:
+		if (!logic_capture_set_feature(payload, length - 1)) {
+			return false;
+		}
+		break;
+
+	default:
+		return false;
+	}
+	return true;
+}
+
+uint32_t hid_in_poll(uint8_t *report)
+{
+	uint32_t i, idx, length;
+
+	for (i = 0; i < num_in_sources; i++) {
+		idx = next_in_source;
+		next_in_source = (next_in_source + 1) % num_in_sources;
+
+		memset(report, 0, HID_REPORT_MAX_SIZE);
+		length = in_sources[idx](report);
+		if ((length > 0) && hid_crypt_in(report, length)) {
+			return length;
+		}
+	}
+	return 0;
+}
+
+void hid_in_claim(bool claim)
+{
+	in_claimed = claim;
+}
+
+void hid_in_kick(void)
+{
+	if (report_data == NULL) {
+		return;
+	}
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	HID_InPump();
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+}
+
+bool hid_in_pending(void)
+{
+	return in_report_busy;
+}
+
+void hid_in_reset(void)
+{
+	in_report_busy = false;
+}
 
 /* HID init routine */
 ErrorCode_t usb_hid_init(USBD_HANDLE_T hUsb,
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "hid_generic.h"
+#include "byte_order.h"
+#include "hid_rpc.h"
+
+/* Written from hid_rpc_write(), taken by the IN report source. */
+static uint8_t responses[HID_RPC_WINDOW][HID_RPC_REPORT_SIZE];
+static volatile uint32_t resp_head, resp_tail;
+static hid_rpc_stats_t stats;
+
+static uint32_t rpc_in_source(uint8_t *report) {
+	if (resp_tail == resp_head) {
+		return 0;
+	}
+	memcpy(report, responses[resp_tail % HID_RPC_WINDOW], HID_RPC_REPORT_SIZE);
+	resp_tail++;
+	return HID_RPC_REPORT_SIZE;
+}
+
+/* Runs a method, result goes to data, returns status. */
+static uint8_t rpc_call(uint8_t method, const uint8_t *args, uint32_t args_length,
+						uint8_t *data, uint32_t *data_length) {
+	uint8_t feature[HID_REPORT_MAX_SIZE];
+	uint16_t feature_length;
+	uint32_t offset;
+
+	*data_length = 0;
+	switch (method) {
+	case HID_RPC_METHOD_PING:
+		memcpy(data, args, args_length);
+		*data_length = args_length;
+		break;
+
+	case HID_RPC_METHOD_INFO:
+		data[0] = HID_RPC_VERSION;
+		data[1] = HID_RPC_WINDOW;
+		data[2] = HID_RPC_MAX_DATA;
+		data[3] = 0;
+		put_u32(&data[4], stats.requests);
+		put_u32(&data[8], stats.errors);
+		put_u32(&data[12], stats.dropped);
+		put_u32(&data[16], stats.malformed);
+		*data_length = 20;
+		break;
+
+	case HID_RPC_METHOD_GET_FEATURE:
+		if ((args_length < 2) || (args[0] == HID_REPORT_ID_RPC)) {
+			return HID_RPC_STATUS_BAD_ARGS;
+		}
+		memset(feature, 0, sizeof(feature));
+		feature[0] = args[0];
+		feature_length = 0;
+		if (!hid_get_feature(feature, &feature_length)) {
+			return HID_RPC_STATUS_REFUSED;
+		}
+		// Feature reports are longer than a result, host asks for the rest from an offset.
+		offset = 1 + args[1];
+		if (offset < feature_length) {
+			*data_length = MIN(feature_length - offset, HID_RPC_MAX_DATA);
+			memcpy(data, &feature[offset], *data_length);
+		}
+		break;
+
+	case HID_RPC_METHOD_SET_FEATURE:
+		if ((args_length < 1) || (args[0] == HID_REPORT_ID_RPC)) {
+			return HID_RPC_STATUS_BAD_ARGS;
+		}
+		if (!hid_set_feature(args, args_length)) {
+			return HID_RPC_STATUS_REFUSED;
+		}
+		break;
+
+	case HID_RPC_METHOD_LED5:
+		if (args_length < 1) {
+			return HID_RPC_STATUS_BAD_ARGS;
+		}
+		board_led_set(LED5, args[0] & 0x1);
+		break;
+
+	default:
+		return HID_RPC_STATUS_NO_METHOD;
+	}
+	return HID_RPC_STATUS_OK;
+}
+
+void hid_rpc_init(void) {
+	hid_in_add_source(rpc_in_source);
+}
+
+void hid_rpc_write(const uint8_t *payload, uint32_t length) {
+	uint8_t *response;
+	uint32_t data_length;
+	uint8_t status;
+
+	if ((length < (HID_RPC_HEADER_SIZE - 1)) || (payload[2] > (length - (HID_RPC_HEADER_SIZE - 1)))) {
+		stats.malformed++;
+		return;
+	}
+	stats.requests++;
+	if ((resp_head - resp_tail) >= HID_RPC_WINDOW) {
+		stats.dropped++;
+		return;
+	}
+
+	// Response is built in its slot, the IN source copies it out as is.
+	response = responses[resp_head % HID_RPC_WINDOW];
+	memset(response, 0, HID_RPC_REPORT_SIZE);
+	status = rpc_call(payload[1], &payload[HID_RPC_HEADER_SIZE - 1], payload[2],
+					  &response[HID_RPC_HEADER_SIZE], &data_length);
+	if (status != HID_RPC_STATUS_OK) {
+		stats.errors++;
+		data_length = 0;
+	}
+	response[0] = HID_REPORT_ID_RPC;
+	response[1] = payload[0];
+	response[2] = status;
+	response[3] = data_length;
+	resp_head++;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "init_stages.h"
+
+/* Kahn's algorithm on dependency masks, every stage must become runnable. */
+static bool deps_acyclic(const init_stage_def_t *defs, uint32_t num_stages) {
+	uint32_t all = (num_stages < 32) ? ((1UL << num_stages) - 1) : 0xFFFFFFFF;
+	uint32_t done = 0;
+	uint32_t i;
+	bool progress = true;
+
+	for (i = 0; i < num_stages; i++) {
+		if (defs[i].deps & ~all) {
+			return false;
+		}
+	}
+
+	while (progress && (done != all)) {
+		progress = false;
+		for (i = 0; i < num_stages; i++) {
+			if (!(done & (1UL << i)) && ((defs[i].deps & ~done) == 0)) {
+				done |= 1UL << i;
+				progress = true;
+			}
+		}
+	}
+	return done == all;
+}
+
+bool init_stages_init(init_stages_t *st, const init_stage_def_t *defs, uint32_t num_stages,
+					  uint32_t (*now_us)(void), void *ctx) {
+	memset(st, 0, sizeof(*st));
+	if ((num_stages > INIT_STAGES_MAX) || !deps_acyclic(defs, num_stages)) {
+		return false;
+	}
+
+	st->defs = defs;
+	st->num_stages = num_stages;
+	st->now_us = now_us;
+	st->ctx = ctx;
+	return true;
+}
+
+/* Acyclic deps are checked at init, recursion depth is bounded by INIT_STAGES_MAX. */
+static bool run_stage(init_stages_t *st, uint32_t stage, bool on_demand) {
+	init_stage_status_t *status = &st->status[stage];
+	uint32_t i;
+	bool ok = true;
+
+	switch (status->state) {
+	case INIT_STAGE_DONE:
+		return true;
+	case INIT_STAGE_WAITING:
+		break;
+	default:
+		return false;
+	}
+
+	status->state = INIT_STAGE_RUNNING;
+	status->on_demand = on_demand;
+
+	for (i = 0; ok && (i < st->num_stages); i++) {
+		if (st->defs[stage].deps & (1UL << i)) {
+			ok = run_stage(st, i, on_demand);
+		}
+	}
+
+	status->start_us = st->now_us();
+	if (ok) {
+		ok = st->defs[stage].init(st->ctx);
+	}
+	status->duration_us = st->now_us() - status->start_us;
+	status->state = ok ? INIT_STAGE_DONE : INIT_STAGE_FAILED;
+	return ok;
+}
+
+bool init_stages_require(init_stages_t *st, uint32_t stage) {
+	if (stage >= st->num_stages) {
+		return false;
+	}
+	return run_stage(st, stage, true);
+}
+
+bool init_stages_done(const init_stages_t *st, uint32_t stage) {
+	return (stage < st->num_stages) && (st->status[stage].state == INIT_STAGE_DONE);
+}
+
+bool init_stages_pending(const init_stages_t *st) {
+	uint32_t i;
+
+	for (i = 0; i < st->num_stages; i++) {
+		if (st->defs[i].background && (st->status[i].state == INIT_STAGE_WAITING)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void init_stages_process(init_stages_t *st) {
+	uint32_t i;
+
+	for (i = 0; i < st->num_stages; i++) {
+		if (st->defs[i].background && (st->status[i].state == INIT_STAGE_WAITING)) {
+			run_stage(st, i, false);
+			return;
+		}
+	}
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "timer_service.h"
+#include "dma_service.h"
+#include "boot_stages.h"
+#include "byte_order.h"
+#include "logic_capture.h"
+
+#define LOGIC_TIMER				LPC_TIMER2
+#define LOGIC_TIMER_CLK			CLK_MX_TIMER2
+#define LOGIC_MATCH				0
+#define SGPIO_BASE_CLK			CLK_BASE_PERIPH
+
+/* 8 bit parallel slice reading SGPIO8..15 */
+#define SGPIO_SLICE				1
+#define SGPIO_PINS_MASK			0xFF00
+#define SLICE_MUX_PARALLEL_8	(3 << 6)
+#define SGPIO_POS(pos, reset)	((pos) | ((reset) << 8))
+#define SAMPLES_PER_WORD		4
+
+/* SDRAM ring above RAM disk and flash cache lines, below DFU buffers */
+#define RAW_BASE				((uint8_t *) (SDRAM_BASE_ADDR + (24 * 1024 * 1024)))
+#define RAW_NUM_SEGMENTS		128
+#define RAW_SEGMENT_WORDS		2048
+#define RAW_SEGMENT_SIZE		(RAW_SEGMENT_WORDS * SAMPLES_PER_WORD)
+#define RAW_SIZE				(RAW_NUM_SEGMENTS * RAW_SEGMENT_SIZE)
+
+/* Samples compressed per main loop pass, other modules wait meanwhile */
+#define FEED_MAX				(16 * 1024)
+#define RLE_FIFO_SIZE			4096
+
+/* SGPIO8..15 on P4, channel n is SGPIO(8 + n). Glitch filter is off for fast edges. */
+static const PINMUX_GRP_T logic_pins[] = {
+	{0x4, 2, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO8 */
+	{0x4, 3, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO9 */
+	{0x4, 4, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO10 */
+	{0x4, 5, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO11 */
+	{0x4, 6, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO12 */
+	{0x4, 8, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO13 */
+	{0x4, 9, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO14 */
+	{0x4, 10, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | SCU_MODE_ZIF_DIS | SCU_MODE_FUNC7)},	/* SGPIO15 */
+};
+
+static DMA_TransferDescriptor_t raw_lli[RAW_NUM_SEGMENTS];
+static volatile uint32_t raw_segments;	/* Completed segments, counted in DMA interrupt */
+static uint32_t raw_seen;				/* raw_segments at last main loop pass */
+static uint32_t raw_consumed;			/* Total samples taken out of the ring */
+static int dma = -1;
+static bool running;
+
+static logic_rle_t rle;
+static __BSS(RAM2) uint8_t rle_fifo[RLE_FIFO_SIZE];
+static uint32_t rate;
+static uint32_t flush_since_us;
+static uint32_t chunk_since_us;
+
+/* Start and stop requests from USB interrupt, main loop runs them. */
+static volatile bool command;
+static bool command_start;
+static uint32_t command_rate;
+static uint8_t command_mask, command_value;
+static uint32_t command_limit;
+
+/* Total samples written by DMA since capture started. */
+static uint32_t raw_produced(void) {
+	uint32_t segments, dst_offset, dst_segment, lag;
+
+	do {
+		segments = raw_segments;
+		dst_offset = LPC_GPDMA->CH[dma].DESTADDR - (uint32_t) RAW_BASE;
+	} while (segments != raw_segments);
+
+	// Segment interrupt may still be pending, account for segments DMA
+	// already moved past.
+	dst_segment = (dst_offset / RAW_SEGMENT_SIZE) % RAW_NUM_SEGMENTS;
+	lag = (dst_segment + RAW_NUM_SEGMENTS - (segments % RAW_NUM_SEGMENTS)) % RAW_NUM_SEGMENTS;
+
+	return ((segments + lag) * RAW_SEGMENT_SIZE) + (dst_offset % RAW_SEGMENT_SIZE);
+}
+
+static void raw_dma_done(uint8_t dma_ch, bool error) {
+	raw_segments++;
+}
+
+/* @return	SGPIO clock divider closest to rate, 0 if out of range. */
+static uint32_t rate_divider(uint32_t new_rate) {
+	uint32_t divider;
+
+	if (new_rate == 0) {
+		return 0;
+	}
+	divider = (Chip_Clock_GetBaseClocktHz(SGPIO_BASE_CLK) + (new_rate / 2)) / new_rate;
+	if ((divider < LOGIC_CAPTURE_MIN_DIVIDER) || (divider > LOGIC_CAPTURE_MAX_DIVIDER)) {
+		return 0;
+	}
+	return divider;
+}
+
+/* IN report producer, full chunks or whatever waited flush timeout. */
+static uint32_t logic_in_source(uint8_t *report) {
+	uint32_t now_us = timer_service_now_us();
+	bool flush = (timer_service_elapsed_us(chunk_since_us, now_us) >= LOGIC_CAPTURE_FLUSH_US);
+
+	if (rle.state == LOGIC_RLE_IDLE) {
+		return 0;
+	}
+	if (logic_rle_chunk(&rle, &report[1], HID_LOGIC_REPORT_SIZE - 1, flush) == 0) {
+		return 0;
+	}
+	chunk_since_us = now_us;
+	report[0] = HID_REPORT_ID_LOGIC;
+	return HID_LOGIC_REPORT_SIZE;
+}
+
+static void dma_prepare(void) {
+	uint32_t i;
+
+	for (i = 0; i < RAW_NUM_SEGMENTS; i++) {
+		raw_lli[i].src = (uint32_t) &LPC_SGPIO->REG_SS[SGPIO_SLICE];
+		raw_lli[i].dst = (uint32_t) &RAW_BASE[i * RAW_SEGMENT_SIZE];
+		raw_lli[i].lli = (uint32_t) &raw_lli[(i + 1) % RAW_NUM_SEGMENTS];
+		raw_lli[i].ctrl = GPDMA_DMACCxControl_TransferSize(RAW_SEGMENT_WORDS) |
+						  GPDMA_DMACCxControl_SBSize(GPDMA_BSIZE_1) |
+						  GPDMA_DMACCxControl_DBSize(GPDMA_BSIZE_1) |
+						  GPDMA_DMACCxControl_SWidth(GPDMA_WIDTH_WORD) |
+						  GPDMA_DMACCxControl_DWidth(GPDMA_WIDTH_WORD) |
+						  GPDMA_DMACCxControl_DI |
+						  GPDMA_DMACCxControl_I;
+	}
+	raw_segments = 0;
+	raw_seen = 0;
+	// First match comes before the first swap and copies a stale word.
+	raw_consumed = SAMPLES_PER_WORD;
+}
+
+static void sgpio_prepare(uint32_t divider) {
+	LPC_SGPIO->CTRL_ENABLED &= ~(1 << SGPIO_SLICE);
+	LPC_SGPIO->GPIO_OENREG &= ~SGPIO_PINS_MASK;
+
+	// Internal clock from the slice counter, data from pins, no qualifier.
+	LPC_SGPIO->SGPIO_MUX_CFG[SGPIO_SLICE] = 0;
+	LPC_SGPIO->SLICE_MUX_CFG[SGPIO_SLICE] = SLICE_MUX_PARALLEL_8;
+	LPC_SGPIO->PRESET[SGPIO_SLICE] = divider - 1;
+	LPC_SGPIO->COUNT[SGPIO_SLICE] = divider - 1;
+	LPC_SGPIO->POS[SGPIO_SLICE] = SGPIO_POS(SAMPLES_PER_WORD - 1, SAMPLES_PER_WORD - 1);
+	LPC_SGPIO->REG[SGPIO_SLICE] = 0;
+	LPC_SGPIO->REG_SS[SGPIO_SLICE] = 0;
+}
+
+static void capture_stop(void) {
+	if (!running) {
+		return;
+	}
+
+	running = false;
+	Chip_TIMER_Disable(LOGIC_TIMER);
+	LPC_SGPIO->CTRL_ENABLED &= ~(1 << SGPIO_SLICE);
+	dma_service_free(dma);
+	dma = -1;
+	dma_service_release_request(DMA_REQ_LINE_MAT2_0);
+	Chip_Clock_Disable(CLK_PERIPH_SGPIO);
+	timer_service_wake_request(false);
+}
+
+void logic_capture_init(void) {
+	logic_rle_init(&rle, rle_fifo, sizeof(rle_fifo));
+	running = false;
+	command = false;
+
+	Chip_TIMER_Init(LOGIC_TIMER);
+	Chip_TIMER_Reset(LOGIC_TIMER);
+	Chip_TIMER_PrescaleSet(LOGIC_TIMER, 0);
+	Chip_TIMER_ResetOnMatchEnable(LOGIC_TIMER, LOGIC_MATCH);
+
+	hid_in_add_source(logic_in_source);
+}
+
+bool logic_capture_start(uint32_t new_rate, uint8_t mask, uint8_t value, uint32_t limit) {
+	uint32_t sgpio_clk = Chip_Clock_GetBaseClocktHz(SGPIO_BASE_CLK);
+	uint32_t divider = rate_divider(new_rate);
+
+	if (divider == 0) {
+		return false;
+	}
+	// Timer only stays in step with the slice when both count the same clock.
+	if (Chip_Clock_GetRate(LOGIC_TIMER_CLK) != sgpio_clk) {
+		return false;
+	}
+	if (!boot_stage_require(BOOT_STAGE_SDRAM)) {
+		return false;
+	}
+
+	capture_stop();
+	dma = dma_service_alloc(raw_dma_done, true);
+	if (dma < 0) {
+		return false;
+	}
+	// Line is USART2 TX as well, taken while UART bridge channel 1 is open.
+	if (!dma_service_claim_request(DMA_REQ_LINE_MAT2_0, DMA_REQ_FUNC_TIMER)) {
+		dma_service_free(dma);
+		dma = -1;
+		return false;
+	}
+
+	rate = sgpio_clk / divider;
+	Chip_Clock_Enable(CLK_PERIPH_SGPIO);
+	Chip_SCU_SetPinMuxing(logic_pins, sizeof(logic_pins) / sizeof(PINMUX_GRP_T));
+	sgpio_prepare(divider);
+	dma_prepare();
+
+	// Stream is reset while USB interrupt can not take a chunk out of it.
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	logic_rle_arm(&rle, mask, value, limit);
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	dma_service_start(dma, &raw_lli[0],
+					  GPDMA_DMACCxConfig_SrcPeripheral(DMA_REQ_LINE_MAT2_0) |
+					  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_P2M_CONTROLLER_DMA));
+
+	// Slice swaps every 4 dividers from its start, matches fall 2 dividers
+	// after each swap. Both start within a few cycles of each other.
+	Chip_TIMER_Reset(LOGIC_TIMER);
+	Chip_TIMER_SetMatch(LOGIC_TIMER, LOGIC_MATCH, (SAMPLES_PER_WORD * divider) - 1);
+	LOGIC_TIMER->TC = (SAMPLES_PER_WORD / 2) * divider;
+	__disable_irq();
+	LPC_SGPIO->CTRL_ENABLED |= (1 << SGPIO_SLICE);
+	Chip_TIMER_Enable(LOGIC_TIMER);
+	__enable_irq();
+
+	running = true;
+	flush_since_us = chunk_since_us = timer_service_now_us();
+	// Slow rates fill segments rarely, ring is also polled every tick.
+	timer_service_wake_request(true);
+	return true;
+}
+
+void logic_capture_stop(void) {
+	capture_stop();
+	logic_rle_stop(&rle);
+}
+
+bool logic_capture_pending(void) {
+	return command || (running && (raw_segments != raw_seen));
+}
+
+void logic_capture_process(void) {
+	uint32_t now_us, produced, avail, offset, count;
+
+	if (command) {
+		command = false;
+		if (command_start) {
+			logic_capture_start(command_rate, command_mask, command_value, command_limit);
+		}
+		else {
+			logic_capture_stop();
+		}
+	}
+	if (!running) {
+		// Stream tail may still wait for FIFO room after a stop.
+		logic_rle_flush(&rle);
+		return;
+	}
+
+	raw_seen = raw_segments;
+	produced = raw_produced();
+	avail = produced - raw_consumed;
+	if (avail > (RAW_SIZE - RAW_SEGMENT_SIZE)) {
+		// DMA lapped compression, skip to the segments it can not be writing to.
+		logic_rle_gap(&rle, avail - (RAW_SIZE - RAW_SEGMENT_SIZE));
+		raw_consumed = produced - (RAW_SIZE - RAW_SEGMENT_SIZE);
+		avail = RAW_SIZE - RAW_SEGMENT_SIZE;
+	}
+
+	offset = raw_consumed % RAW_SIZE;
+	count = MIN(MIN(avail, FEED_MAX), RAW_SIZE - offset);
+	raw_consumed += logic_rle_feed(&rle, &RAW_BASE[offset], count);
+
+	now_us = timer_service_now_us();
+	if (timer_service_elapsed_us(flush_since_us, now_us) >= LOGIC_CAPTURE_FLUSH_US) {
+		flush_since_us = now_us;
+		logic_rle_flush(&rle);
+	}
+
+	if (rle.state == LOGIC_RLE_DONE) {
+		capture_stop();
+	}
+}
+
+void logic_capture_get_status(logic_capture_status_t *status) {
+	memset(status, 0, sizeof(*status));
+	status->state = rle.state;
+	status->mask = rle.mask;
+	status->value = rle.value;
+	status->rate = rate;
+	status->limit = rle.limit;
+	if (running) {
+		status->backlog = raw_produced() - raw_consumed;
+	}
+	status->stats = rle.stats;
+}
+
+bool logic_capture_set_feature(const uint8_t *payload, uint16_t length) {
+	if (length < 11) {
+		return false;
+	}
+
+	command_start = (payload[0] != 0);
+	if (command_start) {
+		command_rate = get_u32(&payload[3]);
+		if (rate_divider(command_rate) == 0) {
+			return false;
+		}
+		command_mask = payload[1];
+		command_value = payload[2];
+		command_limit = get_u32(&payload[7]);
+	}
+	command = true;
+	return true;
+}
+
+uint16_t logic_capture_get_feature(uint8_t *payload, uint16_t max_length) {
+	logic_capture_status_t status;
+	const uint32_t *counters;
+	uint32_t i, offset = 16;
+
+	if (max_length < LOGIC_CAPTURE_STATUS_SIZE) {
+		return 0;
+	}
+
+	logic_capture_get_status(&status);
+	payload[0] = status.state;
+	payload[1] = status.mask;
+	payload[2] = status.value;
+	payload[3] = 0;
+	put_u32(&payload[4], status.rate);
+	put_u32(&payload[8], status.limit);
+	put_u32(&payload[12], status.backlog);
+
+	counters = (const uint32_t *) &status.stats;
+	for (i = 0; i < sizeof(logic_rle_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return LOGIC_CAPTURE_STATUS_SIZE;
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "logic_rle.h"
+
+static uint32_t fifo_free(const logic_rle_t *rle) {
+	return rle->size - logic_rle_level(rle);
+}
+
+static void put_byte(logic_rle_t *rle, uint32_t *head, uint8_t byte) {
+	rle->fifo[*head & (rle->size - 1)] = byte;
+	(*head)++;
+}
+
+static void put_varint(logic_rle_t *rle, uint32_t *head, uint32_t value) {
+	while (value >= 0x80) {
+		put_byte(rle, head, (value & 0x7F) | 0x80);
+		value >>= 7;
+	}
+	put_byte(rle, head, value);
+}
+
+/* Queue the open run, false if FIFO has no room for it. */
+static bool emit_run(logic_rle_t *rle) {
+	uint32_t head = rle->head;
+
+	if (rle->run_length == 0) {
+		return true;
+	}
+	if (fifo_free(rle) < LOGIC_RLE_RUN_MAX) {
+		return false;
+	}
+
+	put_byte(rle, &head, rle->run_value);
+	put_varint(rle, &head, rle->run_length);
+	rle->stats.bytes += head - rle->head;
+	rle->stats.runs++;
+	rle->head = head;
+	rle->run_length = 0;
+	return true;
+}
+
+/* Queue the gap marker after the run it interrupted. */
+static bool emit_gap(logic_rle_t *rle) {
+	uint32_t head;
+
+	if (rle->pending_gap == 0) {
+		return true;
+	}
+	if (!emit_run(rle) || (fifo_free(rle) < LOGIC_RLE_GAP_MAX)) {
+		return false;
+	}
+
+	head = rle->head;
+	put_byte(rle, &head, rle->run_value);
+	put_byte(rle, &head, 0);
+	put_varint(rle, &head, rle->pending_gap);
+	rle->stats.bytes += head - rle->head;
+	rle->stats.gaps++;
+	rle->head = head;
+	rle->pending_gap = 0;
+	return true;
+}
+
+/* Queue what is left of the stream, capture is over once it fits. */
+static void finish(logic_rle_t *rle) {
+	rle->stopping = true;
+	if (emit_gap(rle) && emit_run(rle)) {
+		rle->state = LOGIC_RLE_DONE;
+	}
+}
+
+static bool limit_reached(const logic_rle_t *rle) {
+	return (rle->limit != 0) && (rle->stats.samples >= rle->limit);
+}
+
+/* @return	Leading samples equal to value. Lines are idle most of the
+ *			time, so whole words are compared while they can be. */
+static uint32_t run_span(const uint8_t *samples, uint32_t count, uint8_t value) {
+	const uint32_t pattern = value * 0x01010101UL;
+	uint32_t word, i = 0;
+
+	while ((count - i) >= 4) {
+		memcpy(&word, &samples[i], sizeof(word));
+		if (word != pattern) {
+			break;
+		}
+		i += 4;
+	}
+	while ((i < count) && (samples[i] == value)) {
+		i++;
+	}
+	return i;
+}
+
+void logic_rle_init(logic_rle_t *rle, uint8_t *fifo, uint32_t size) {
+	memset(rle, 0, sizeof(*rle));
+	rle->fifo = fifo;
+	rle->size = size;
+}
+
+void logic_rle_arm(logic_rle_t *rle, uint8_t mask, uint8_t value, uint32_t limit) {
+	rle->head = rle->tail = 0;
+	rle->mask = mask;
+	rle->value = value & mask;
+	// Without a mask every sample matches, first one triggers.
+	rle->missed = (mask == 0);
+	rle->stopping = false;
+	rle->run_length = 0;
+	rle->limit = limit;
+	rle->pending_gap = 0;
+	rle->seq = 0;
+	rle->end_sent = false;
+	memset(&rle->stats, 0, sizeof(rle->stats));
+	rle->state = LOGIC_RLE_ARMED;
+}
+
+void logic_rle_stop(logic_rle_t *rle) {
+	if (rle->state == LOGIC_RLE_TRIGGERED) {
+		finish(rle);
+	}
+	else if (rle->state == LOGIC_RLE_ARMED) {
+		rle->state = LOGIC_RLE_DONE;
+	}
+}
+
+uint32_t logic_rle_feed(logic_rle_t *rle, const uint8_t *samples, uint32_t count) {
+	uint32_t i = 0, span, end;
+
+	if (rle->state == LOGIC_RLE_ARMED) {
+		for (; i < count; i++) {
+			if ((samples[i] & rle->mask) != rle->value) {
+				rle->missed = true;
+			}
+			else if (rle->missed) {
+				break;
+			}
+		}
+		if (i == count) {
+			return count;
+		}
+		rle->state = LOGIC_RLE_TRIGGERED;
+		rle->run_value = samples[i];
+	}
+
+	if (rle->state != LOGIC_RLE_TRIGGERED) {
+		return count;
+	}
+	if (rle->stopping) {
+		finish(rle);
+		return count;
+	}
+
+	while (i < count) {
+		if (!emit_gap(rle)) {
+			break;
+		}
+
+		end = count;
+		if (rle->limit != 0) {
+			end = i + MIN(count - i, rle->limit - rle->stats.samples);
+		}
+		span = run_span(&samples[i], end - i, rle->run_value);
+		rle->run_length += span;
+		rle->stats.samples += span;
+		i += span;
+
+		if (limit_reached(rle)) {
+			finish(rle);
+			return count;
+		}
+		// Value changed, it starts the next run once this one is queued.
+		if ((i == count) || !emit_run(rle)) {
+			break;
+		}
+		rle->run_value = samples[i];
+	}
+	return i;
+}
+
+void logic_rle_gap(logic_rle_t *rle, uint32_t dropped) {
+	if (dropped == 0) {
+		return;
+	}
+
+	rle->stats.dropped += dropped;
+	if ((rle->state != LOGIC_RLE_TRIGGERED) || rle->stopping) {
+		return;
+	}
+
+	rle->pending_gap += dropped;
+	rle->stats.samples += dropped;
+	if (limit_reached(rle)) {
+		finish(rle);
+	}
+	else {
+		emit_gap(rle);
+	}
+}
+
+void logic_rle_flush(logic_rle_t *rle) {
+	if (rle->state != LOGIC_RLE_TRIGGERED) {
+		return;
+	}
+
+	if (rle->stopping) {
+		finish(rle);
+	}
+	else if (emit_gap(rle)) {
+		emit_run(rle);
+	}
+}
+
+uint32_t logic_rle_level(const logic_rle_t *rle) {
+	return rle->head - rle->tail;
+}
+
+uint32_t logic_rle_chunk(logic_rle_t *rle, uint8_t *chunk, uint32_t max_len, bool flush) {
+	// State first, stream is complete once producer marked it done.
+	bool done = (rle->state == LOGIC_RLE_DONE);
+	uint32_t level = logic_rle_level(rle);
+	uint32_t capacity = MIN(max_len - LOGIC_CHUNK_HEADER_SIZE, 0xFF);
+	uint32_t tail = rle->tail;
+	uint32_t i, count;
+	uint8_t flags = 0;
+
+	if (level == 0) {
+		if (!done || rle->end_sent) {
+			return 0;
+		}
+	}
+	else if ((level < capacity) && !flush && !done) {
+		return 0;
+	}
+
+	count = MIN(level, capacity);
+	for (i = 0; i < count; i++) {
+		chunk[LOGIC_CHUNK_HEADER_SIZE + i] = rle->fifo[(tail + i) & (rle->size - 1)];
+	}
+	rle->tail = tail + count;
+
+	// Not seq, it wraps on long captures.
+	if ((rle->stats.chunks == 0) && (count > 0)) {
+		flags |= LOGIC_CHUNK_FIRST;
+	}
+	if (done && (count == level)) {
+		flags |= LOGIC_CHUNK_END;
+		rle->end_sent = true;
+	}
+
+	chunk[0] = rle->seq & 0xFF;
+	chunk[1] = rle->seq >> 8;
+	chunk[2] = flags;
+	chunk[3] = count;
+	rle->seq++;
+	rle->stats.chunks++;
+	return LOGIC_CHUNK_HEADER_SIZE + count;
+}
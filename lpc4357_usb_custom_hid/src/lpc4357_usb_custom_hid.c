@@ -29,6 +29,24 @@
 
 #include "app_usbd_cfg.h"
 #include "hid_generic.h"
+#include "timer_service.h"
+#include "event_capture.h"
+#include "gpio_events.h"
+#include "dma_service.h"
+#include "pwm_sequencer.h"
+#include "uart_bridge.h"
+#include "can_gateway.h"
+#include "audio_stream.h"
+#include "sd_recorder.h"
+#include "msc_disk.h"
+#include "cdc_channel.h"
+#include "dfu_update.h"
+#include "hid_crypt.h"
+#include "settings.h"
+#include "usb_power.h"
+#include "boot_stages.h"
+#include "logic_capture.h"
+#include "hid_rpc.h"
 
 
 
@@ -52,11 +70,19 @@ bool is_device_active = false;
  ****************************************************************************/
 static ErrorCode_t device_configured (USBD_HANDLE_T hUsb);
 static ErrorCode_t device_suspended (USBD_HANDLE_T hUsb);
+static ErrorCode_t device_resumed (USBD_HANDLE_T hUsb);
 static ErrorCode_t device_reset (USBD_HANDLE_T hUsb);
+static ErrorCode_t device_wakeup_cfg (USBD_HANDLE_T hUsb, uint32_t enable);
 
 #define USB_IRQ_PRIORITY 0
 #define MCPWM_IRQ_PRIORITY 2
 #define GPIO_IRQ_PRIORITY 1
+#define DMA_IRQ_PRIORITY 1
+#define UART_IRQ_PRIORITY 2
+#define CAN_IRQ_PRIORITY 1
+#define SDIO_IRQ_PRIORITY 2
+#define TIMER_IRQ_PRIORITY 3
+#define EEPROM_IRQ_PRIORITY USB_IRQ_PRIORITY	// Shares saved settings with USB interrupt
 
 /* EP0_patch part of WORKAROUND for artf45032. */
 ErrorCode_t EP0_patch(USBD_HANDLE_T hUsb, void *data, uint32_t event)
@@ -82,6 +108,26 @@ ErrorCode_t EP0_patch(USBD_HANDLE_T hUsb, void *data, uint32_t event)
 	return g_Ep0BaseHdlr(hUsb, data, event);
 }
 
+/* Serial number from the chip unique ID, so that hosts running many boards
+ * can tell them apart. Zeros are left in place if IAP does not answer. */
+static void set_serial_number(void)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint8_t *string = USB_StringDescriptor;
+	uint32_t uid[4];
+	uint32_t i;
+
+	for (i = 0; i < USB_SERIAL_NUMBER_INDEX; i++) {
+		string += string[0];
+	}
+	if ((Chip_IAP_Init() != IAP_CMD_SUCCESS) || (Chip_IAP_ReadUID(uid) != IAP_CMD_SUCCESS)) {
+		return;
+	}
+	for (i = 0; i < USB_SERIAL_NUMBER_CHARS; i++) {
+		string[2 + (2 * i)] = hex[(uid[i / 8] >> (28 - (4 * (i % 8)))) & 0xF];
+	}
+}
+
 /*****************************************************************************
  * Public functions
  ****************************************************************************/
@@ -154,17 +200,13 @@ void MCPWM_CH1_Update(uint8_t rate) {
 	else if (rate > 20)
 		rate = 20;
 
-	// Stop timer
-	LPC_MCPWM->CON_CLR = (1<<8);
+	// A running sequence would overwrite the new rate on its next step.
+	pwm_sequencer_stop();
 
-	// Update PWM cycle
+	// LIM and MAT are shadowed, new values take effect at the end of
+	// current cycle so timer keeps running and output does not glitch.
 	LPC_MCPWM->LIM[1] =  BLINK_PERIOD_MS(rate) * ticks_in_one_msec;
 	LPC_MCPWM->MAT[1] =  BLINK_ONTIME_MS(rate) * ticks_in_one_msec;
-	LPC_MCPWM->TC[1] = 0;
-
-	// restart timer.
-	LPC_MCPWM->CON_SET = (1<<8);
-
 }
 
 
@@ -178,12 +220,43 @@ int main(void)
 	USB_CORE_DESCS_T desc;
 	ErrorCode_t ret = LPC_OK;
 	USB_CORE_CTRL_T *pCtrl;
+	bool dfu_mode;
+	uint8_t blink_rate;
+
+	boot_stages_init();
 
 	// Change LED4 driver from GPIO to Motor Control PWM channel 1 - MCOA1/B1
 	Chip_SCU_PinMuxSet(LED4_PORT, LED4_PIN, (SCU_MODE_8MA_DRIVESTR | SCU_MODE_FUNC1));
 
 	ticks_in_one_msec = MCPWM_CH1_Init(BLINK_PERIOD_MS(DEFAULT_BLINKS_PER_SECOND), BLINK_ONTIME_MS(DEFAULT_BLINKS_PER_SECOND));
 
+	timer_service_init(TIMER_IRQ_PRIORITY);
+	boot_stages_timer_started();
+
+	// Firmware update after DFU detach, leave other peripherals alone.
+	dfu_mode = dfu_update_requested();
+
+	if (!dfu_mode) {
+		// Before the modules, they load their saved settings in init.
+		settings_init(EEPROM_IRQ_PRIORITY);
+		dma_service_init(DMA_IRQ_PRIORITY);
+		hid_crypt_init();
+		hid_rpc_init();
+		pwm_sequencer_init();
+		if (settings_get(SETTINGS_KEY_BLINK_RATE, &blink_rate, 1) == 1) {
+			MCPWM_CH1_Update(blink_rate);
+		}
+		uart_bridge_init(UART_IRQ_PRIORITY);
+		can_gateway_init(CAN_IRQ_PRIORITY);
+		audio_stream_init();
+		sd_recorder_init(SDIO_IRQ_PRIORITY);
+		logic_capture_init();
+
+		// SW2 edges are captured on pin interrupt channel 0.
+		gpio_events_init(GPIO_IRQ_PRIORITY);
+		gpio_events_enable_pin(0, SW2_GPIO_PORT, SW2_GPIO_PIN, GPIO_EVENTS_EDGE_FALL);
+	}
+
 #ifndef USE_USB1
 #error "Use USB1 for device role"
 #endif
@@ -198,13 +271,20 @@ int main(void)
 	usb_param.usb_reg_base = LPC_USB_BASE;
 	usb_param.mem_base = USB_STACK_MEM_BASE;
 	usb_param.mem_size = USB_STACK_MEM_SIZE;
-	usb_param.max_num_ep = 2;
+#ifdef USE_CDC
+	usb_param.max_num_ep = 4;
+#else
+	usb_param.max_num_ep = 3;
+#endif
 	usb_param.USB_Configure_Event = device_configured;
 	usb_param.USB_Suspend_Event = device_suspended;
+	usb_param.USB_Resume_Event = device_resumed;
 	usb_param.USB_Reset_Event = device_reset;
+	usb_param.USB_WakeUpCfg = device_wakeup_cfg;
 
 
 	/* Set the USB descriptors */
+	set_serial_number();
 	desc.device_desc = (uint8_t *) USB_DeviceDescriptor;
 	desc.string_desc = (uint8_t *) USB_StringDescriptor;
 
@@ -222,9 +302,13 @@ int main(void)
 	desc.device_qualifier = 0;
 #endif
 
+	if (dfu_mode) {
+		desc.device_desc = (uint8_t *) USB_DfuDeviceDescriptor;
+		desc.high_speed_desc = USB_DfuConfigDescriptor;
+		desc.full_speed_desc = USB_DfuConfigDescriptor;
+	}
+
 	NVIC_SetPriority(LPC_USB_IRQ, USB_IRQ_PRIORITY);
-	NVIC_SetPriority(BOARD_SW2_GPIO_IRQn, GPIO_IRQ_PRIORITY);
-	NVIC_EnableIRQ(BOARD_SW2_GPIO_IRQn);
 	NVIC_SetPriorityGrouping( 0 );
 
 	/* USB Initialization */
@@ -242,41 +326,137 @@ int main(void)
 		g_Ep0BaseHdlr = pCtrl->ep_event_hdlr[0];/* retrieve the default EP0_OUT handler */
 		pCtrl->ep_event_hdlr[0] = EP0_patch;/* set our patch routine as EP0_OUT handler */
 
-		ret = usb_hid_init(g_hUsb,
-						   (USB_INTERFACE_DESCRIPTOR *) &USB_FsConfigDescriptor[sizeof(USB_CONFIGURATION_DESCRIPTOR)],
-						   &usb_param.mem_base,
-						   &usb_param.mem_size);
+		usb_power_init(g_hUsb);
+
+		if (dfu_mode) {
+			ret = dfu_update_init(g_hUsb,
+								  find_IntfDesc(USB_DfuConfigDescriptor, USB_DEVICE_CLASS_APP),
+								  &usb_param.mem_base,
+								  &usb_param.mem_size);
+		}
+		else {
+			ret = usb_hid_init(g_hUsb,
+							   (USB_INTERFACE_DESCRIPTOR *) &USB_FsConfigDescriptor[sizeof(USB_CONFIGURATION_DESCRIPTOR)],
+							   &usb_param.mem_base,
+							   &usb_param.mem_size);
+		}
+#ifdef USE_MSC
+		if ((ret == LPC_OK) && !dfu_mode) {
+			ret = msc_disk_init(g_hUsb,
+								find_IntfDesc(USB_FsConfigDescriptor, USB_DEVICE_CLASS_STORAGE),
+								&usb_param.mem_base,
+								&usb_param.mem_size);
+		}
+#endif
+#ifdef USE_CDC
+		if ((ret == LPC_OK) && !dfu_mode) {
+			ret = cdc_channel_init(g_hUsb,
+								   USB_FsConfigDescriptor,
+								   &usb_param.mem_base,
+								   &usb_param.mem_size);
+		}
+#endif
+		if ((ret == LPC_OK) && !dfu_mode) {
+			ret = dfu_update_runtime_init(g_hUsb,
+										  find_IntfDesc(USB_FsConfigDescriptor, USB_DEVICE_CLASS_APP),
+										  &usb_param.mem_base,
+										  &usb_param.mem_size);
+		}
 		if (ret == LPC_OK) {
 
 			/*  enable USB interrrupts */
 			NVIC_EnableIRQ(LPC_USB_IRQ);
 			/* now connect */
 			USBD_API->hw->Connect(g_hUsb, 1);
+			boot_stages_usb_connected();
+		}
+	}
+
+	// Sectors are programmed while USB receives the next ones.
+	while (dfu_mode) {
+		__disable_irq();
+		if (!dfu_update_pending()) {
+			__WFI();
 		}
+		__enable_irq();
+
+		dfu_update_process();
 	}
 
 	while (1) {
-		// Complete program is interrupt driven.
-		// Sleep until next IRQ happens.
-		__WFI();
+		// Interrupt handlers only capture, main loop does the rest.
+		// Sleep until next IRQ happens, interrupts are masked while checking
+		// for pending work so that a wakeup can not be lost.
+		__disable_irq();
+		if (!event_capture_pending() && !uart_bridge_pending() && !can_gateway_pending() &&
+#ifdef USE_MSC
+			!msc_disk_pending() &&
+#endif
+			!sd_recorder_pending() && !hid_crypt_pending() && !dfu_update_pending() &&
+			!boot_stages_pending() && !logic_capture_pending()) {
+			__WFI();
+		}
+		__enable_irq();
+
+		event_capture_process();
+		uart_bridge_process();
+		can_gateway_process();
+		sd_recorder_process();
+		logic_capture_process();
+#ifdef USE_MSC
+		msc_disk_process();
+#endif
+		hid_in_kick();
+#ifdef USE_CDC
+		cdc_channel_kick();
+#endif
+		// Keystream for the next reports while these are on the bus.
+		hid_crypt_process();
+		settings_process();
+		usb_power_process();
+		// Slow board parts, after USB enumerated.
+		boot_stages_process();
+		dfu_update_process();
 	}
 }
 
 static ErrorCode_t device_configured (USBD_HANDLE_T hUsb)
 {
+	hid_in_reset();
+#ifdef USE_CDC
+	cdc_channel_reset();
+#endif
 	is_device_active = true;
 	return LPC_OK;
 }
 
+/* Stays configured, reports queue up and the first one waits on the IN endpoint. */
 static ErrorCode_t device_suspended (USBD_HANDLE_T hUsb)
 {
-	is_device_active = false;
+	usb_power_suspended();
+	return LPC_OK;
+}
+
+static ErrorCode_t device_resumed (USBD_HANDLE_T hUsb)
+{
+	usb_power_resumed();
+	return LPC_OK;
+}
+
+static ErrorCode_t device_wakeup_cfg (USBD_HANDLE_T hUsb, uint32_t enable)
+{
+	usb_power_wakeup_cfg(enable != 0);
 	return LPC_OK;
 }
 
 static ErrorCode_t device_reset (USBD_HANDLE_T hUsb)
 {
 	is_device_active = false;
+	usb_power_reset();
+	hid_in_reset();
+#ifdef USE_CDC
+	cdc_channel_reset();
+#endif
 	return LPC_OK;
 }
 
@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "spifi_flash.h"
+#include "app_usbd_cfg.h"
+#include "timer_service.h"
+#include "block_cache.h"
+#include "boot_stages.h"
+#include "byte_order.h"
+#include "msc_disk.h"
+
+#define MSC_BLOCK_SIZE			BLOCK_CACHE_BLOCK_SIZE
+#define SPIFI_SECTOR_SIZE		(64 * 1024)
+#define SPIFI_PAGE_SIZE			256
+#define SPIFI_CACHE_LINES		BLOCK_CACHE_MAX_LINES
+
+/* Dirty line is programmed once host did not write it for this long */
+#define MSC_FLUSH_IDLE_US		500000
+#define MSC_RECONNECT_US		200000
+
+/* RAM disk is zeroed after connect, one chunk per main loop pass */
+#define RAM_CLEAR_CHUNK			(64 * 1024)
+#define RAM_CHUNKS				(MSC_DISK_SIZE / RAM_CLEAR_CHUNK)
+#define RAM_CHUNKS_ALL			((RAM_CHUNKS == 64) ? ~0ULL : ((1ULL << RAM_CHUNKS) - 1))
+
+/* SDRAM layout, RAM disk, cache lines then one parked write */
+#define RAM_DISK_BASE			((uint8_t *) SDRAM_BASE_ADDR)
+#define CACHE_LINES_BASE		((uint8_t *) (SDRAM_BASE_ADDR + MSC_DISK_SIZE))
+#define PARK_BASE				(&CACHE_LINES_BASE[SPIFI_CACHE_LINES * SPIFI_SECTOR_SIZE])
+
+#if MSC_DISK_SIZE != SPIFI_FLASH_SIZE
+#error "Both media must have the geometry given to the ROM driver"
+#endif
+#if RAM_CHUNKS > 64
+#error "RAM disk chunks must fit the cleared mask"
+#endif
+
+/* SCSI inquiry: vendor 8, product 16, revision 4 */
+static const uint8_t inquiry[28] = "LPC4357 Custom HID Disk 1.00";
+
+static USBD_HANDLE_T usb;
+static uint8_t media;
+static block_cache_t cache;
+static block_media_t spifi_media;
+static bool flush_wake;
+
+/* RAM disk chunks zeroed so far, one bit each, and whether SDRAM is up */
+static uint64_t ram_cleared;
+static uint32_t ram_next_chunk;
+static volatile bool ram_up;
+static bool ram_failed;
+
+/* Write which found every line dirty, bulk OUT is held off until it is in */
+static volatile bool write_parked;
+static uint32_t park_offset;
+static uint32_t park_length;
+
+static volatile bool command_pending;
+static uint8_t command;
+static uint8_t command_arg;
+static bool command_result;
+
+static bool media_ready(void) {
+	return (media == MSC_DISK_MEDIA_SPIFI) || (ram_cleared == RAM_CHUNKS_ALL);
+}
+
+static bool ram_chunk_cleared(uint32_t offset) {
+	return (ram_cleared & (1ULL << (offset / RAM_CLEAR_CHUNK))) != 0;
+}
+
+static bool ram_range_cleared(uint32_t offset, uint32_t length) {
+	uint32_t chunk;
+
+	for (chunk = offset / RAM_CLEAR_CHUNK; chunk <= (offset + length - 1) / RAM_CLEAR_CHUNK; chunk++) {
+		if ((ram_cleared & (1ULL << chunk)) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Clears only the chunks a transfer touches. Both sides run it, main loop
+ * with USB interrupt masked. */
+static void ram_disk_clear(uint32_t offset, uint32_t length) {
+	uint32_t chunk;
+
+	for (chunk = offset / RAM_CLEAR_CHUNK; chunk <= (offset + length - 1) / RAM_CLEAR_CHUNK; chunk++) {
+		if ((ram_cleared & (1ULL << chunk)) == 0) {
+			memset(&RAM_DISK_BASE[chunk * RAM_CLEAR_CHUNK], 0, RAM_CLEAR_CHUNK);
+			ram_cleared |= 1ULL << chunk;
+		}
+	}
+}
+
+/* SDRAM is a background boot stage, clearing the disk before connect held
+ * enumeration up. Main loop clears it a chunk at a time instead, USB
+ * interrupt waits for one 64 KB memset at most. */
+static void clear_ram_disk(void) {
+	if (ram_failed || (ram_cleared == RAM_CHUNKS_ALL)) {
+		return;
+	}
+	if (!ram_up) {
+		ram_failed = !boot_stage_require(BOOT_STAGE_SDRAM);
+		ram_up = !ram_failed;
+		return;
+	}
+	// Chunks the host wrote meanwhile are skipped.
+	while (ram_chunk_cleared(ram_next_chunk * RAM_CLEAR_CHUNK)) {
+		ram_next_chunk++;
+	}
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	ram_disk_clear(ram_next_chunk * RAM_CLEAR_CHUNK, RAM_CLEAR_CHUNK);
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+}
+
+/* Chunks of a RAM disk read not cleared yet are zeros, they are never touched. */
+static void ram_disk_read(uint32_t offset, uint8_t **dst, uint32_t length) {
+	uint32_t pos, piece;
+
+	if (!ram_up) {
+		memset(*dst, 0, length);
+		return;
+	}
+	if (ram_range_cleared(offset, length)) {
+		*dst = &RAM_DISK_BASE[offset];
+		return;
+	}
+	for (pos = 0; pos < length; pos += piece) {
+		piece = MIN(length - pos, RAM_CLEAR_CHUNK - ((offset + pos) % RAM_CLEAR_CHUNK));
+		if (ram_chunk_cleared(offset + pos)) {
+			memcpy(&(*dst)[pos], &RAM_DISK_BASE[offset + pos], piece);
+		}
+		else {
+			memset(&(*dst)[pos], 0, piece);
+		}
+	}
+}
+
+static const uint8_t *spifi_map(void *ctx, uint32_t offset) {
+	return (const uint8_t *) (SPIFI_VTABLE + offset);
+}
+
+static bool page_erased(const uint8_t *data) {
+	const uint32_t *words = (const uint32_t *) data;
+	uint32_t i;
+
+	for (i = 0; i < SPIFI_PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (words[i] != 0xFFFFFFFF) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* XIP window is unusable until memory mode is back and USB interrupt is the
+ * only one reading it, so it is masked around each flash operation only. */
+static bool spifi_write_page(uint32_t offset, const uint8_t *data) {
+	bool ok;
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	if (!page_erased(data)) {
+		spifi_set_cmd_mode();
+		spifi_program_page(offset, data, SPIFI_PAGE_SIZE);
+		spifi_set_mem_mode();
+	}
+	// Checked before unmasking, host may write the line again right after.
+	ok = memcmp(spifi_map(NULL, offset), data, SPIFI_PAGE_SIZE) == 0;
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+	return ok;
+}
+
+/* Called from main loop only. */
+static bool spifi_write_line(void *ctx, uint32_t offset, const uint8_t *data) {
+	uint32_t page;
+	bool ok = true;
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	spifi_set_cmd_mode();
+	spifi_erase_sector(offset);
+	spifi_set_mem_mode();
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	for (page = 0; ok && (page < SPIFI_SECTOR_SIZE); page += SPIFI_PAGE_SIZE) {
+		ok = spifi_write_page(offset + page, &data[page]);
+	}
+	return ok;
+}
+
+/* Pick line with USB interrupt masked, its writes may fill blocks too. */
+static block_cache_line_t *flush_begin(uint32_t idle) {
+	block_cache_line_t *line;
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	line = block_cache_flush_begin(&cache, timer_service_now_us(), idle);
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+	return line;
+}
+
+/* USB interrupt side, no line free without programming one. Keep the data
+ * and stop serving bulk OUT, the next transfer is already queued and the
+ * host is NAKed after it until main loop took this one. */
+static void park_write(uint32_t offset, const uint8_t *data, uint32_t length) {
+	if (write_parked || (length > SPIFI_SECTOR_SIZE)) {
+		cache.stats.errors++;
+		return;
+	}
+	if (data != PARK_BASE) {
+		memcpy(PARK_BASE, data, length);
+	}
+	park_offset = offset;
+	park_length = length;
+	write_parked = true;
+	USBD_API->hw->DisableEP(usb, MSC_EP_OUT);
+}
+
+/* Main loop side, program a line so the write fits. */
+static void unpark_write(void) {
+	block_cache_line_t *line = flush_begin(0);
+
+	if (line != NULL) {
+		block_cache_flush_line(&cache, line);
+	}
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	if (block_cache_write(&cache, park_offset, PARK_BASE, park_length, timer_service_now_us(), false)) {
+		write_parked = false;
+		USBD_API->hw->EnableEP(usb, MSC_EP_OUT);
+		// Transfer completed meanwhile does not raise its interrupt again.
+		NVIC_SetPendingIRQ(LPC_USB_IRQ);
+	}
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+}
+
+static void msc_read(uint32_t offset, uint8_t **dst, uint32_t length, uint32_t high_offset) {
+	const uint8_t *data;
+
+	if (media == MSC_DISK_MEDIA_RAM) {
+		ram_disk_read(offset, dst, length);
+		return;
+	}
+
+	data = block_cache_read(&cache, offset, length, *dst);
+	if (data == NULL) {
+		memset(*dst, 0, length);
+	}
+	// Lines are handed to USB DMA in place, XIP window is copied since it
+	// disappears while a line is being programmed.
+	else if ((data >= CACHE_LINES_BASE) && (data < &CACHE_LINES_BASE[SPIFI_CACHE_LINES * SPIFI_SECTOR_SIZE])) {
+		*dst = (uint8_t *) data;
+	}
+	else if (data != *dst) {
+		memcpy(*dst, data, length);
+	}
+}
+
+static void msc_get_write_buf(uint32_t offset, uint8_t **buff_adr, uint32_t length, uint32_t high_offset) {
+	uint8_t *buffer;
+
+	if (media == MSC_DISK_MEDIA_RAM) {
+		// DMA lands in place, so what is still to be cleared goes first.
+		if (ram_up) {
+			ram_disk_clear(offset, length);
+			*buff_adr = &RAM_DISK_BASE[offset];
+		}
+		return;
+	}
+
+	buffer = block_cache_write_buffer(&cache, offset, length, false);
+	if (buffer != NULL) {
+		*buff_adr = buffer;
+	}
+	// Every line dirty, land it where it would be parked anyway.
+	else if (!write_parked && (length <= SPIFI_SECTOR_SIZE)) {
+		*buff_adr = PARK_BASE;
+	}
+}
+
+static void msc_write(uint32_t offset, uint8_t **src, uint32_t length, uint32_t high_offset) {
+	if (media == MSC_DISK_MEDIA_RAM) {
+		// Lost only if the host writes before main loop ever ran.
+		if (!ram_up) {
+			return;
+		}
+		ram_disk_clear(offset, length);
+		if (*src != &RAM_DISK_BASE[offset]) {
+			memcpy(&RAM_DISK_BASE[offset], *src, length);
+		}
+		return;
+	}
+	if (!block_cache_write(&cache, offset, *src, length, timer_service_now_us(), false)) {
+		park_write(offset, *src, length);
+	}
+}
+
+static ErrorCode_t msc_verify(uint32_t offset, uint8_t buf[], uint32_t length, uint32_t high_offset) {
+	static uint8_t bounce[MSC_BLOCK_SIZE];
+	const uint8_t *data;
+	uint32_t pos, piece;
+
+	if (media == MSC_DISK_MEDIA_RAM) {
+		if (!ram_up) {
+			return ERR_FAILED;
+		}
+		// Verify after write, whatever is not cleared yet was never written.
+		ram_disk_clear(offset, length);
+		return memcmp(&RAM_DISK_BASE[offset], buf, length) ? ERR_FAILED : LPC_OK;
+	}
+
+	for (pos = 0; pos < length; pos += piece) {
+		piece = MIN(length - pos, MSC_BLOCK_SIZE - ((offset + pos) % MSC_BLOCK_SIZE));
+		data = block_cache_read(&cache, offset + pos, piece, bounce);
+		if ((data == NULL) || memcmp(data, &buf[pos], piece)) {
+			return ERR_FAILED;
+		}
+	}
+	return LPC_OK;
+}
+
+/* One pass per line, a line the host writes again meanwhile stays dirty. */
+static bool sync_cache(void) {
+	block_cache_line_t *line;
+	uint32_t i;
+	bool ok = true;
+
+	for (i = 0; i < SPIFI_CACHE_LINES; i++) {
+		line = flush_begin(0);
+		if (line == NULL) {
+			break;
+		}
+		ok = block_cache_flush_line(&cache, line) && ok;
+	}
+	return ok;
+}
+
+static bool select_media(uint8_t new_media) {
+	uint32_t start;
+
+	if (new_media > MSC_DISK_MEDIA_SPIFI) {
+		return false;
+	}
+	// Cache lines live in SDRAM as well.
+	if ((new_media == MSC_DISK_MEDIA_SPIFI) &&
+		(!boot_stage_require(BOOT_STAGE_SDRAM) || !boot_stage_require(BOOT_STAGE_SPIFI))) {
+		return false;
+	}
+
+	// Host caches what it read of the old media, make it enumerate again.
+	// Cache is synced while disconnected so nothing is written behind it.
+	USBD_API->hw->Connect(usb, 0);
+	start = timer_service_now_us();
+	if (write_parked) {
+		unpark_write();
+	}
+	sync_cache();
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	block_cache_invalidate(&cache);
+	media = new_media;
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	while (timer_service_elapsed_us(start, timer_service_now_us()) < MSC_RECONNECT_US) {}
+	USBD_API->hw->Connect(usb, 1);
+	return true;
+}
+
+ErrorCode_t msc_disk_init(USBD_HANDLE_T hUsb,
+						  USB_INTERFACE_DESCRIPTOR *pIntfDesc,
+						  uint32_t *mem_base,
+						  uint32_t *mem_size) {
+	USBD_MSC_INIT_PARAM_T msc_param;
+	ErrorCode_t ret;
+
+	if ((pIntfDesc == 0) || (pIntfDesc->bInterfaceClass != USB_DEVICE_CLASS_STORAGE)) {
+		return ERR_FAILED;
+	}
+
+	usb = hUsb;
+	media = MSC_DISK_MEDIA_RAM;
+	command_pending = false;
+	flush_wake = false;
+	write_parked = false;
+	ram_cleared = 0;
+	ram_next_chunk = 0;
+	ram_up = false;
+	ram_failed = false;
+
+	spifi_media.map = spifi_map;
+	spifi_media.read = NULL;
+	spifi_media.write_line = spifi_write_line;
+	spifi_media.ctx = NULL;
+	spifi_media.size = SPIFI_FLASH_SIZE;
+	spifi_media.line_size = SPIFI_SECTOR_SIZE;
+	block_cache_init(&cache, &spifi_media, CACHE_LINES_BASE, SPIFI_CACHE_LINES);
+
+	memset((void *) &msc_param, 0, sizeof(USBD_MSC_INIT_PARAM_T));
+	msc_param.mem_base = *mem_base;
+	msc_param.mem_size = *mem_size;
+	msc_param.InquiryStr = (uint8_t *) inquiry;
+	msc_param.BlockCount = MSC_DISK_SIZE / MSC_BLOCK_SIZE;
+	msc_param.BlockSize = MSC_BLOCK_SIZE;
+	msc_param.MemorySize = MSC_DISK_SIZE;
+	msc_param.MemorySize64 = MSC_DISK_SIZE;
+	msc_param.intf_desc = (uint8_t *) pIntfDesc;
+	/* user defined functions */
+	msc_param.MSC_Write = msc_write;
+	msc_param.MSC_Read = msc_read;
+	msc_param.MSC_Verify = msc_verify;
+	msc_param.MSC_GetWriteBuf = msc_get_write_buf;
+
+	ret = USBD_API->msc->init(hUsb, &msc_param);
+
+	/* update memory variables */
+	*mem_base = msc_param.mem_base;
+	*mem_size = msc_param.mem_size;
+	return ret;
+}
+
+bool msc_disk_pending(void) {
+	return command_pending || write_parked || (!ram_failed && (ram_cleared != RAM_CHUNKS_ALL));
+}
+
+void msc_disk_process(void) {
+	block_cache_line_t *line;
+	bool dirty;
+
+	if (write_parked) {
+		unpark_write();
+	}
+
+	clear_ram_disk();
+
+	if (command_pending) {
+		command_result = (command == MSC_DISK_CMD_SELECT) ? select_media(command_arg) : sync_cache();
+		command_pending = false;
+	}
+
+	if (block_cache_dirty(&cache)) {
+		line = flush_begin(MSC_FLUSH_IDLE_US);
+		if (line != NULL) {
+			block_cache_flush_line(&cache, line);
+		}
+	}
+	dirty = block_cache_dirty(&cache);
+
+	// Keep waking up while lines wait for their idle time.
+	if (dirty != flush_wake) {
+		flush_wake = dirty;
+		timer_service_wake_request(dirty);
+	}
+}
+
+bool msc_disk_set_feature(const uint8_t *payload, uint16_t length) {
+	if ((length < 1) || command_pending || (payload[0] > MSC_DISK_CMD_SYNC)) {
+		return false;
+	}
+
+	command = payload[0];
+	command_arg = (length > 1) ? payload[1] : 0;
+	command_pending = true;
+	return true;
+}
+
+uint16_t msc_disk_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 8;
+
+	if (max_length < MSC_DISK_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = media;
+	payload[1] = command_pending ? 0xFF : command_result;
+	payload[2] = 1;
+	payload[3] = block_cache_dirty(&cache);
+	put_u32(&payload[4], MSC_DISK_SIZE / MSC_BLOCK_SIZE);
+
+	counters = (const uint32_t *) &cache.stats;
+	for (i = 0; i < sizeof(block_cache_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	payload[offset] = media_ready();
+	return MSC_DISK_STATUS_SIZE;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "byte_order.h"
+#include "pwm_sequence.h"
+
+/* Register image word offsets */
+#define MCPWM_LIM(ch)	(ch)
+#define MCPWM_MAT(ch)	(PWM_NUM_MCPWM_CHANNELS + (ch))
+#define MCPWM_DT		6
+#define MCPWM_CCP		7
+
+static uint16_t get_u16(const uint8_t *p) {
+	return p[0] | (p[1] << 8);
+}
+
+uint32_t pwm_sequence_us_to_ticks(uint32_t us, uint32_t clk_hz) {
+	uint64_t ticks = (((uint64_t) us * clk_hz) + 500000) / 1000000;
+
+	if (ticks < 2)
+		ticks = 2;
+	else if (ticks > 0xFFFFFFFF)
+		ticks = 0xFFFFFFFF;
+
+	return (uint32_t) ticks;
+}
+
+uint32_t pwm_sequence_duty_to_ticks(uint32_t period_ticks, uint16_t duty) {
+	if (duty > PWM_DUTY_MAX)
+		duty = PWM_DUTY_MAX;
+
+	return (uint32_t) (((uint64_t) period_ticks * duty) / PWM_DUTY_MAX);
+}
+
+bool pwm_sequence_compile_step(const uint8_t *wire, pwm_step_regs_t *regs,
+							   uint32_t mcpwm_clk_hz, uint32_t sct_clk_hz) {
+	uint32_t ch, period_us, period_ticks;
+
+	for (ch = 0; ch < PWM_NUM_MCPWM_CHANNELS; ch++) {
+		period_us = get_u32(wire);
+		if (period_us == 0) {
+			return false;
+		}
+
+		// TC counts 0..LIM in edge aligned mode, output changes state at MAT.
+		period_ticks = pwm_sequence_us_to_ticks(period_us, mcpwm_clk_hz);
+		regs->mcpwm[MCPWM_LIM(ch)] = period_ticks - 1;
+		regs->mcpwm[MCPWM_MAT(ch)] = pwm_sequence_duty_to_ticks(period_ticks, get_u16(wire + 4));
+		wire += 6;
+	}
+
+	// Dead time and communication pattern stay disabled, they are only
+	// part of the image so that one DMA burst covers all channels.
+	regs->mcpwm[MCPWM_DT] = 0;
+	regs->mcpwm[MCPWM_CCP] = 0;
+
+	period_us = get_u32(wire);
+	if (period_us == 0) {
+		return false;
+	}
+
+	// MATCHREL[0] is the SCT limit, MATCHREL[1..3] clear outputs 1..3.
+	period_ticks = pwm_sequence_us_to_ticks(period_us, sct_clk_hz);
+	regs->sct[0] = period_ticks - 1;
+	for (ch = 0; ch < PWM_NUM_SCT_OUTPUTS; ch++) {
+		regs->sct[1 + ch] = pwm_sequence_duty_to_ticks(period_ticks, get_u16(wire + 4 + (ch * 2)));
+	}
+
+	return true;
+}
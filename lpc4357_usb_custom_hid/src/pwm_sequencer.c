@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+
+#include "board.h"
+#include "dma_service.h"
+#include "pwm_sequencer.h"
+
+#define PWM_SEQ_TIMER			LPC_TIMER1
+#define PWM_SEQ_TIMER_CLK		CLK_MX_TIMER1
+#define PWM_SEQ_TICK_HZ			1000
+#define PWM_SEQ_MATCH_MCPWM		0
+#define PWM_SEQ_MATCH_SCT		1
+
+#define MCPWM_CON_RUN(ch)		(1 << ((ch) * 8))
+
+/* DMA reads the register images from RamLoc40 as well as from RamLoc32 */
+static __BSS(RAM2) pwm_step_regs_t steps[PWM_SEQUENCER_MAX_STEPS];
+static uint64_t loaded_mask;
+
+/* One linked list item per step and peripheral, item i loads step i + 1. */
+static DMA_TransferDescriptor_t mcpwm_lli[PWM_SEQUENCER_MAX_STEPS];
+static DMA_TransferDescriptor_t sct_lli[PWM_SEQUENCER_MAX_STEPS];
+
+static int mcpwm_dma_ch = -1;
+static int sct_dma_ch = -1;
+
+static uint16_t num_steps;
+static uint16_t step_ms;
+static uint8_t seq_flags;
+static volatile pwm_seq_state_t state;
+
+static void sequence_done(uint8_t channel, bool error) {
+	// Only the MCPWM chain raises terminal count, SCT chain ends with it.
+	Chip_TIMER_Disable(PWM_SEQ_TIMER);
+	state = PWM_SEQ_DONE;
+}
+
+static void apply_step(const pwm_step_regs_t *regs) {
+	uint32_t i;
+
+	for (i = 0; i < PWM_MCPWM_REG_WORDS; i++) {
+		(&LPC_MCPWM->LIM[0])[i] = regs->mcpwm[i];
+	}
+	for (i = 0; i < PWM_SCT_REG_WORDS; i++) {
+		LPC_SCT->MATCHREL[i].U = regs->sct[i];
+	}
+}
+
+static void build_chain(DMA_TransferDescriptor_t *lli, uint32_t count, uint32_t dst,
+						uint32_t offset, uint32_t words, uint32_t burst) {
+	uint32_t i;
+	uint32_t ctrl = GPDMA_DMACCxControl_TransferSize(words) |
+					GPDMA_DMACCxControl_SBSize(burst) |
+					GPDMA_DMACCxControl_DBSize(burst) |
+					GPDMA_DMACCxControl_SWidth(GPDMA_WIDTH_WORD) |
+					GPDMA_DMACCxControl_DWidth(GPDMA_WIDTH_WORD) |
+					GPDMA_DMACCxControl_SI | GPDMA_DMACCxControl_DI;
+
+	for (i = 0; i < count; i++) {
+		lli[i].src = (uint32_t) &steps[(i + 1) % num_steps] + offset;
+		lli[i].dst = dst;
+		lli[i].lli = (uint32_t) &lli[(i + 1) % count];
+		lli[i].ctrl = ctrl;
+	}
+
+	if ((seq_flags & PWM_SEQ_FLAG_LOOP) == 0) {
+		lli[count - 1].lli = 0;
+		lli[count - 1].ctrl |= GPDMA_DMACCxControl_I;
+	}
+}
+
+void pwm_sequencer_init(void) {
+	uint32_t ch;
+
+	mcpwm_dma_ch = dma_service_alloc(sequence_done, true);
+	sct_dma_ch = dma_service_alloc(NULL, true);
+
+	// Match events of the step timer are the DMA requests, kept for good.
+	dma_service_claim_request(DMA_REQ_LINE_MAT1_0, DMA_REQ_FUNC_TIMER);
+	dma_service_claim_request(DMA_REQ_LINE_MAT1_1, DMA_REQ_FUNC_TIMER);
+
+	Chip_TIMER_Init(PWM_SEQ_TIMER);
+	Chip_TIMER_Reset(PWM_SEQ_TIMER);
+	Chip_TIMER_PrescaleSet(PWM_SEQ_TIMER, (Chip_Clock_GetRate(PWM_SEQ_TIMER_CLK) / PWM_SEQ_TICK_HZ) - 1);
+	Chip_TIMER_ResetOnMatchEnable(PWM_SEQ_TIMER, PWM_SEQ_MATCH_MCPWM);
+
+	// SCT in unified 32 bit mode, match 0 is the limit, matches 1..3 clear outputs 0..2.
+	Chip_SCTPWM_Init(LPC_SCT);
+	Chip_SCTPWM_SetRate(LPC_SCT, 1000);
+	for (ch = 0; ch < PWM_NUM_SCT_OUTPUTS; ch++) {
+		Chip_SCTPWM_SetOutPin(LPC_SCT, ch + 1, ch);
+	}
+
+	num_steps = 0;
+	loaded_mask = 0;
+	state = PWM_SEQ_IDLE;
+}
+
+bool pwm_sequencer_begin(uint16_t count, uint16_t ms, uint8_t flags) {
+	if ((count == 0) || (count > PWM_SEQUENCER_MAX_STEPS) || (ms == 0)) {
+		return false;
+	}
+
+	pwm_sequencer_stop();
+	num_steps = count;
+	step_ms = ms;
+	seq_flags = flags;
+	loaded_mask = 0;
+	return true;
+}
+
+bool pwm_sequencer_load(uint16_t first, const uint8_t *wire, uint8_t count) {
+	uint32_t i;
+
+	if ((state == PWM_SEQ_RUNNING) || (first + count > num_steps)) {
+		return false;
+	}
+
+	for (i = first; i < (uint32_t) (first + count); i++) {
+		if (!pwm_sequence_compile_step(wire, &steps[i],
+									   Chip_Clock_GetRate(CLK_APB1_MOTOCON),
+									   Chip_Clock_GetRate(CLK_MX_SCT))) {
+			return false;
+		}
+		loaded_mask |= ((uint64_t) 1 << i);
+		wire += PWM_STEP_WIRE_SIZE;
+	}
+	return true;
+}
+
+bool pwm_sequencer_start(void) {
+	uint32_t chain_len, ch;
+	uint64_t all_loaded;
+
+	if ((num_steps == 0) || (mcpwm_dma_ch < 0) || (sct_dma_ch < 0)) {
+		return false;
+	}
+	all_loaded = (num_steps == 64) ? ~(uint64_t) 0 : (((uint64_t) 1 << num_steps) - 1);
+	if (loaded_mask != all_loaded) {
+		return false;
+	}
+
+	pwm_sequencer_stop();
+
+	// First step is written by CPU, DMA takes over from the first step boundary.
+	apply_step(&steps[0]);
+	for (ch = 0; ch < PWM_NUM_MCPWM_CHANNELS; ch++) {
+		LPC_MCPWM->CON_SET = MCPWM_CON_RUN(ch);
+	}
+	Chip_SCTPWM_Start(LPC_SCT);
+
+	chain_len = (seq_flags & PWM_SEQ_FLAG_LOOP) ? num_steps : (num_steps - 1);
+	if (chain_len == 0) {
+		state = PWM_SEQ_DONE;
+		return true;
+	}
+
+	build_chain(mcpwm_lli, chain_len, (uint32_t) &LPC_MCPWM->LIM[0],
+				0, PWM_MCPWM_REG_WORDS, GPDMA_BSIZE_8);
+	build_chain(sct_lli, chain_len, (uint32_t) &LPC_SCT->MATCHREL[0],
+				PWM_MCPWM_REG_WORDS * sizeof(uint32_t), PWM_SCT_REG_WORDS, GPDMA_BSIZE_4);
+
+	dma_service_start(mcpwm_dma_ch, &mcpwm_lli[0],
+					  GPDMA_DMACCxConfig_DestPeripheral(DMA_REQ_LINE_MAT1_0) |
+					  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA));
+	dma_service_start(sct_dma_ch, &sct_lli[0],
+					  GPDMA_DMACCxConfig_DestPeripheral(DMA_REQ_LINE_MAT1_1) |
+					  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA));
+
+	Chip_TIMER_Reset(PWM_SEQ_TIMER);
+	Chip_TIMER_SetMatch(PWM_SEQ_TIMER, PWM_SEQ_MATCH_MCPWM, (step_ms * (PWM_SEQ_TICK_HZ / 1000)) - 1);
+	Chip_TIMER_SetMatch(PWM_SEQ_TIMER, PWM_SEQ_MATCH_SCT, (step_ms * (PWM_SEQ_TICK_HZ / 1000)) - 1);
+
+	state = PWM_SEQ_RUNNING;
+	Chip_TIMER_Enable(PWM_SEQ_TIMER);
+	return true;
+}
+
+void pwm_sequencer_stop(void) {
+	Chip_TIMER_Disable(PWM_SEQ_TIMER);
+
+	if (mcpwm_dma_ch >= 0) {
+		dma_service_stop(mcpwm_dma_ch);
+	}
+	if (sct_dma_ch >= 0) {
+		dma_service_stop(sct_dma_ch);
+	}
+
+	// Outputs keep the last applied step.
+	if (state == PWM_SEQ_RUNNING) {
+		state = PWM_SEQ_IDLE;
+	}
+}
+
+pwm_seq_state_t pwm_sequencer_state(void) {
+	return state;
+}
+
+uint16_t pwm_sequencer_current_step(void) {
+	uint32_t next;
+
+	if (state == PWM_SEQ_DONE) {
+		return num_steps - 1;
+	}
+	if ((state != PWM_SEQ_RUNNING) || (mcpwm_dma_ch < 0)) {
+		return 0;
+	}
+
+	// Pending item i loads step i + 1, so step i is on the outputs.
+	next = dma_service_next_lli(mcpwm_dma_ch);
+	if (next == 0) {
+		return num_steps - 2;
+	}
+	next = (next - (uint32_t) &mcpwm_lli[0]) / sizeof(DMA_TransferDescriptor_t);
+	return (next == 0) ? (num_steps - 1) : (next - 1);
+}
+
+bool pwm_sequencer_set_feature(const uint8_t *payload, uint16_t length) {
+	if (length < 1) {
+		return false;
+	}
+
+	switch (payload[0]) {
+	case PWM_SEQ_CMD_BEGIN:
+		if (length < 6) {
+			return false;
+		}
+		return pwm_sequencer_begin(payload[1] | (payload[2] << 8), payload[3] | (payload[4] << 8), payload[5]);
+
+	case PWM_SEQ_CMD_STEPS:
+		if ((length < 4) || (length < 4 + (payload[3] * PWM_STEP_WIRE_SIZE))) {
+			return false;
+		}
+		return pwm_sequencer_load(payload[1] | (payload[2] << 8), &payload[4], payload[3]);
+
+	case PWM_SEQ_CMD_START:
+		return pwm_sequencer_start();
+
+	case PWM_SEQ_CMD_STOP:
+		pwm_sequencer_stop();
+		return true;
+	}
+	return false;
+}
+
+uint16_t pwm_sequencer_get_feature(uint8_t *payload, uint16_t max_length) {
+	uint16_t step = pwm_sequencer_current_step();
+
+	if (max_length < PWM_SEQ_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = state;
+	payload[1] = num_steps & 0xFF;
+	payload[2] = num_steps >> 8;
+	payload[3] = step & 0xFF;
+	payload[4] = step >> 8;
+	payload[5] = step_ms & 0xFF;
+	payload[6] = step_ms >> 8;
+	return PWM_SEQ_STATUS_SIZE;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "rec_container.h"
+
+#define HEADER_SIZE		sizeof(rec_batch_header_t)
+
+static uint32_t batches_for(uint32_t bytes) {
+	return (bytes + REC_BATCH_PAYLOAD - 1) / REC_BATCH_PAYLOAD;
+}
+
+static uint32_t next_start_block(const rec_container_t *rec) {
+	const rec_entry_t *last;
+	uint32_t end;
+
+	if (rec->index.count == 0) {
+		return REC_ALIGN_BLOCKS;
+	}
+	last = &rec->index.entries[rec->index.count - 1];
+	end = last->start_block + (batches_for(last->bytes) * REC_BATCH_BLOCKS);
+	return (end + REC_ALIGN_BLOCKS - 1) & ~(REC_ALIGN_BLOCKS - 1);
+}
+
+static bool write_index(rec_container_t *rec) {
+	if (!rec->dev->write(rec->dev->ctx, 0, &rec->index, 1)) {
+		rec->stats.write_errors++;
+		return false;
+	}
+	return true;
+}
+
+static void reset_buffers(rec_container_t *rec) {
+	uint32_t i;
+
+	for (i = 0; i < 2; i++) {
+		rec->buffers[i].ready = false;
+		rec->buffers[i].pos = HEADER_SIZE;
+	}
+	rec->fill = 0;
+	rec->drain = 0;
+}
+
+/* Find out how far an open recording got before reset. */
+static void recover(rec_container_t *rec, rec_entry_t *entry) {
+	rec_batch_header_t *header = (rec_batch_header_t *) rec->buffers[0].data;
+	uint32_t seq, block;
+
+	entry->bytes = 0;
+	for (seq = 0; ; seq++) {
+		block = entry->start_block + (seq * REC_BATCH_BLOCKS);
+		if ((block >= rec->dev->num_blocks) || !rec->dev->read(rec->dev->ctx, block, header, 1)) {
+			break;
+		}
+		if ((header->magic != REC_BATCH_MAGIC) || (header->id != entry->id) ||
+			(header->seq != seq) || (header->length > REC_BATCH_PAYLOAD)) {
+			break;
+		}
+		entry->bytes += header->length;
+		if (header->length < REC_BATCH_PAYLOAD) {
+			break;
+		}
+	}
+	entry->flags &= ~REC_ENTRY_OPEN;
+}
+
+static void write_batch(rec_container_t *rec, rec_buffer_t *buf) {
+	rec_batch_header_t *header = (rec_batch_header_t *) buf->data;
+	uint32_t block = rec->current->start_block + (rec->seq * REC_BATCH_BLOCKS);
+	uint32_t count = (buf->pos + REC_BLOCK_SIZE - 1) / REC_BLOCK_SIZE;
+
+	if (rec->halted) {
+		return;
+	}
+	if (block + count > rec->dev->num_blocks) {
+		rec->halted = true;
+		return;
+	}
+
+	header->magic = REC_BATCH_MAGIC;
+	header->id = rec->current->id;
+	header->seq = rec->seq;
+	header->length = buf->pos - HEADER_SIZE;
+	// Short batch, keep stale buffer contents off the card.
+	memset((uint8_t *) buf->data + buf->pos, 0, (count * REC_BLOCK_SIZE) - buf->pos);
+
+	if (!rec->dev->write(rec->dev->ctx, block, buf->data, count)) {
+		rec->stats.write_errors++;
+		rec->halted = true;
+		return;
+	}
+	rec->current->bytes += header->length;
+	rec->seq++;
+	rec->stats.batches++;
+}
+
+static void load_batch(rec_container_t *rec, rec_buffer_t *buf) {
+	rec_batch_header_t *header = (rec_batch_header_t *) buf->data;
+	uint32_t seq = rec->read_pos / REC_BATCH_PAYLOAD;
+	uint32_t batch_offset = seq * REC_BATCH_PAYLOAD;
+	uint32_t batch_end = MIN(batch_offset + REC_BATCH_PAYLOAD, rec->read_end);
+	uint32_t count = (HEADER_SIZE + (batch_end - batch_offset) + REC_BLOCK_SIZE - 1) / REC_BLOCK_SIZE;
+
+	if (!rec->dev->read(rec->dev->ctx, rec->current->start_block + (seq * REC_BATCH_BLOCKS), buf->data, count) ||
+		(header->magic != REC_BATCH_MAGIC) || (header->id != rec->current->id) || (header->seq != seq)) {
+		rec->stats.read_errors++;
+		rec->read_end = rec->read_pos;
+		return;
+	}
+
+	buf->pos = HEADER_SIZE + (rec->read_pos - batch_offset);
+	buf->end = HEADER_SIZE + (batch_end - batch_offset);
+	buf->offset = rec->read_pos;
+	buf->ready = true;
+	rec->read_pos = batch_end;
+	rec->fill ^= 1;
+}
+
+bool rec_mount(rec_container_t *rec, const rec_blockdev_t *dev) {
+	rec_entry_t *last;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->dev = dev;
+	if (!dev->read(dev->ctx, 0, &rec->index, 1)) {
+		return false;
+	}
+	if ((rec->index.magic != REC_INDEX_MAGIC) || (rec->index.version != REC_INDEX_VERSION) ||
+		(rec->index.count > REC_MAX_RECORDINGS)) {
+		return false;
+	}
+
+	if (rec->index.count > 0) {
+		last = &rec->index.entries[rec->index.count - 1];
+		if (last->flags & REC_ENTRY_OPEN) {
+			recover(rec, last);
+			write_index(rec);
+		}
+	}
+	rec->mounted = true;
+	return true;
+}
+
+bool rec_format(rec_container_t *rec, const rec_blockdev_t *dev) {
+	memset(rec, 0, sizeof(*rec));
+	rec->dev = dev;
+	rec->index.magic = REC_INDEX_MAGIC;
+	rec->index.version = REC_INDEX_VERSION;
+	rec->index.next_id = 1;
+	rec->mounted = write_index(rec);
+	return rec->mounted;
+}
+
+bool rec_start(rec_container_t *rec) {
+	rec_entry_t *entry;
+	uint32_t start;
+
+	if (!rec->mounted || rec->recording || rec->reading || (rec->index.count >= REC_MAX_RECORDINGS)) {
+		return false;
+	}
+	start = next_start_block(rec);
+	if (start + REC_BATCH_BLOCKS > rec->dev->num_blocks) {
+		return false;
+	}
+
+	entry = &rec->index.entries[rec->index.count];
+	entry->id = rec->index.next_id++;
+	entry->start_block = start;
+	entry->bytes = 0;
+	entry->flags = REC_ENTRY_OPEN;
+	rec->index.count++;
+	if (!write_index(rec)) {
+		rec->index.count--;
+		return false;
+	}
+
+	memset(&rec->stats, 0, sizeof(rec->stats));
+	rec->current = entry;
+	rec->seq = 0;
+	rec->halted = false;
+	reset_buffers(rec);
+	rec->recording = true;
+	return true;
+}
+
+uint32_t rec_append(rec_container_t *rec, const uint8_t *data, uint32_t length) {
+	rec_buffer_t *buf;
+	uint32_t n, done = 0;
+
+	if (!rec->recording) {
+		return 0;
+	}
+
+	while (!rec->halted && (done < length)) {
+		buf = &rec->buffers[rec->fill];
+		if (buf->ready) {
+			// Writer is still busy with it.
+			break;
+		}
+		n = MIN(length - done, REC_BATCH_SIZE - buf->pos);
+		memcpy((uint8_t *) buf->data + buf->pos, &data[done], n);
+		buf->pos += n;
+		done += n;
+		if (buf->pos == REC_BATCH_SIZE) {
+			buf->ready = true;
+			rec->fill ^= 1;
+		}
+	}
+
+	rec->stats.bytes += done;
+	rec->stats.dropped += length - done;
+	return done;
+}
+
+bool rec_pending(const rec_container_t *rec) {
+	if (rec->recording) {
+		return rec->buffers[rec->drain].ready;
+	}
+	if (rec->reading) {
+		return !rec->buffers[rec->fill].ready && (rec->read_pos < rec->read_end);
+	}
+	return false;
+}
+
+bool rec_process(rec_container_t *rec) {
+	rec_buffer_t *buf;
+
+	if (!rec_pending(rec)) {
+		return false;
+	}
+
+	if (rec->recording) {
+		buf = &rec->buffers[rec->drain];
+		write_batch(rec, buf);
+		buf->pos = HEADER_SIZE;
+		buf->ready = false;
+		rec->drain ^= 1;
+	}
+	else {
+		load_batch(rec, &rec->buffers[rec->fill]);
+	}
+	return true;
+}
+
+bool rec_stop(rec_container_t *rec) {
+	rec_buffer_t *buf;
+	uint32_t i;
+
+	if (!rec->recording) {
+		return false;
+	}
+	rec->recording = false;
+
+	// Older buffer first, a partial batch can only be the last one.
+	for (i = 0; i < 2; i++) {
+		buf = &rec->buffers[rec->drain];
+		if (buf->ready || (buf->pos > HEADER_SIZE)) {
+			write_batch(rec, buf);
+		}
+		buf->pos = HEADER_SIZE;
+		buf->ready = false;
+		rec->drain ^= 1;
+	}
+
+	rec->current->flags &= ~REC_ENTRY_OPEN;
+	return write_index(rec);
+}
+
+bool rec_read_start(rec_container_t *rec, uint32_t index, uint32_t offset, uint32_t length) {
+	rec_entry_t *entry;
+
+	if (!rec->mounted || rec->recording || (index >= rec->index.count)) {
+		return false;
+	}
+	entry = &rec->index.entries[index];
+	if (offset > entry->bytes) {
+		return false;
+	}
+
+	rec->reading = false;
+	rec->current = entry;
+	rec->read_pos = offset;
+	rec->read_end = offset + MIN(length, entry->bytes - offset);
+	reset_buffers(rec);
+	rec->reading = true;
+	return true;
+}
+
+void rec_read_stop(rec_container_t *rec) {
+	rec->reading = false;
+}
+
+uint32_t rec_read(rec_container_t *rec, uint8_t *data, uint32_t max_length, uint32_t *offset) {
+	rec_buffer_t *buf = &rec->buffers[rec->drain];
+	uint32_t n;
+
+	if (!rec->reading || !buf->ready) {
+		return 0;
+	}
+
+	n = MIN(max_length, buf->end - buf->pos);
+	memcpy(data, (uint8_t *) buf->data + buf->pos, n);
+	*offset = buf->offset;
+	buf->pos += n;
+	buf->offset += n;
+	if (buf->pos == buf->end) {
+		buf->ready = false;
+		rec->drain ^= 1;
+	}
+	return n;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "report_crypt.h"
+
+#define SLOT_EMPTY		0
+#define SLOT_RUNNING	1
+#define SLOT_READY		2
+
+#define NUM_SLOTS		(REPORT_CRYPT_MAX_IDS * 2)
+
+static report_crypt_slot_t *slot_at(report_crypt_t *rc, uint32_t idx) {
+	return &rc->slots[idx / 2][idx % 2];
+}
+
+/* Wait for the engine run in flight and hand its keystream to the slot. */
+static void engine_finish(report_crypt_t *rc) {
+	const report_crypt_engine_t *engine = rc->engine;
+
+	if (rc->running == NULL) {
+		return;
+	}
+	while ((engine->busy != NULL) && engine->busy(engine->ctx)) {}
+	rc->running->state = SLOT_READY;
+	rc->running = NULL;
+}
+
+static void engine_start(report_crypt_t *rc, uint32_t idx, uint32_t blocks) {
+	report_crypt_slot_t *slot = slot_at(rc, idx);
+	uint8_t *block = rc->blocks;
+	uint32_t b;
+
+	for (b = 0; b < blocks; b++, block += AES128_BLOCK_SIZE) {
+		memcpy(block, rc->nonce, REPORT_CRYPT_NONCE_SIZE);
+		block[8] = (uint8_t) (idx / 2);
+		block[9] = (uint8_t) (idx % 2);
+		block[10] = (uint8_t) (slot->counter >> 24);
+		block[11] = (uint8_t) (slot->counter >> 16);
+		block[12] = (uint8_t) (slot->counter >> 8);
+		block[13] = (uint8_t) slot->counter;
+		block[14] = 0;
+		block[15] = (uint8_t) b;
+	}
+
+	slot->state = SLOT_RUNNING;
+	rc->running = slot;
+	rc->engine->encrypt(rc->engine->ctx, rc->blocks, slot->stream, blocks);
+	if (rc->engine->busy == NULL) {
+		engine_finish(rc);
+	}
+}
+
+static void reset_slots(report_crypt_t *rc) {
+	uint32_t i;
+
+	engine_finish(rc);
+	for (i = 0; i < NUM_SLOTS; i++) {
+		slot_at(rc, i)->counter = 0;
+		slot_at(rc, i)->state = SLOT_EMPTY;
+		slot_at(rc, i)->used = false;
+	}
+	rc->next_slot = 0;
+}
+
+void report_crypt_init(report_crypt_t *rc, const report_crypt_engine_t *engine) {
+	memset(rc, 0, sizeof(report_crypt_t));
+	rc->engine = engine;
+}
+
+void report_crypt_set_key(report_crypt_t *rc, const uint8_t *key) {
+	report_crypt_stop(rc);
+	engine_finish(rc);
+	rc->engine->set_key(rc->engine->ctx, key);
+	rc->keyed = true;
+}
+
+bool report_crypt_start(report_crypt_t *rc, const uint8_t *nonce, uint8_t threshold) {
+	if (!rc->keyed || (threshold == 0)) {
+		return false;
+	}
+
+	reset_slots(rc);
+	memcpy(rc->nonce, nonce, REPORT_CRYPT_NONCE_SIZE);
+	rc->threshold = threshold;
+	rc->expired = false;
+	memset(&rc->stats, 0, sizeof(report_crypt_stats_t));
+	rc->active = true;
+	return true;
+}
+
+void report_crypt_stop(report_crypt_t *rc) {
+	rc->active = false;
+}
+
+bool report_crypt_apply(report_crypt_t *rc, uint8_t dir, uint8_t *report, uint32_t length) {
+	report_crypt_slot_t *slot;
+	uint32_t idx, i;
+
+	if (!rc->active || (length < 1) || (report[0] >= REPORT_CRYPT_MAX_IDS)) {
+		return true;
+	}
+	if ((length - 1) < rc->threshold) {
+		rc->stats.clear++;
+		return true;
+	}
+
+	idx = report[0] * 2 + (dir & 1);
+	slot = slot_at(rc, idx);
+	if (slot->counter == 0xFFFFFFFF) {
+		rc->expired = true;
+		return false;
+	}
+	slot->used = true;
+
+	if (slot->state == SLOT_READY) {
+		rc->stats.prefetched++;
+	}
+	else if (slot->state == SLOT_RUNNING) {
+		rc->stats.waited++;
+		engine_finish(rc);
+	}
+	else {
+		// Only the blocks this payload needs.
+		rc->stats.computed++;
+		engine_finish(rc);
+		engine_start(rc, idx, MIN(length - 1 + AES128_BLOCK_SIZE - 1, REPORT_CRYPT_STREAM_SIZE) / AES128_BLOCK_SIZE);
+		engine_finish(rc);
+	}
+
+	for (i = 1; (i < length) && (i <= REPORT_CRYPT_STREAM_SIZE); i++) {
+		report[i] ^= slot->stream[i - 1];
+	}
+	slot->counter++;
+	slot->state = SLOT_EMPTY;
+	rc->stats.reports++;
+	return true;
+}
+
+bool report_crypt_pending(const report_crypt_t *rc) {
+	const report_crypt_slot_t *slot;
+	uint32_t i;
+
+	if (!rc->active) {
+		return false;
+	}
+	if (rc->running != NULL) {
+		return true;
+	}
+	for (i = 0; i < NUM_SLOTS; i++) {
+		slot = &rc->slots[i / 2][i % 2];
+		if (slot->used && (slot->state == SLOT_EMPTY)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void report_crypt_process(report_crypt_t *rc) {
+	const report_crypt_engine_t *engine = rc->engine;
+	report_crypt_slot_t *slot;
+	uint32_t i, idx;
+
+	if (rc->running != NULL) {
+		if ((engine->busy != NULL) && engine->busy(engine->ctx)) {
+			return;
+		}
+		engine_finish(rc);
+	}
+	if (!rc->active) {
+		return;
+	}
+
+	for (i = 0; i < NUM_SLOTS; i++) {
+		idx = (rc->next_slot + i) % NUM_SLOTS;
+		slot = slot_at(rc, idx);
+		if (slot->used && (slot->state == SLOT_EMPTY)) {
+			rc->next_slot = (idx + 1) % NUM_SLOTS;
+			engine_start(rc, idx, REPORT_CRYPT_STREAM_BLOCKS);
+			return;
+		}
+	}
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+#include "board.h"
+#include "hid_generic.h"
+#include "timer_service.h"
+#include "rec_container.h"
+#include "byte_order.h"
+#include "sd_recorder.h"
+
+#define SD_WAIT_TIMEOUT_US	1000000
+
+/* SD slot on port C, P1 alternatives are taken by SDRAM data bus. */
+static const PINMUX_GRP_T sd_pins[] = {
+	{0xC, 0, (SCU_MODE_INACT | SCU_MODE_HIGHSPEEDSLEW_EN | SCU_MODE_FUNC7)},	/* SD_CLK */
+	{0xC, 4, (SCU_PINIO_FAST | SCU_MODE_FUNC7)},								/* SD_DAT0 */
+	{0xC, 5, (SCU_PINIO_FAST | SCU_MODE_FUNC7)},								/* SD_DAT1 */
+	{0xC, 6, (SCU_PINIO_FAST | SCU_MODE_FUNC7)},								/* SD_DAT2 */
+	{0xC, 7, (SCU_PINIO_FAST | SCU_MODE_FUNC7)},								/* SD_DAT3 */
+	{0xC, 10, (SCU_PINIO_FAST | SCU_MODE_FUNC7)},								/* SD_CMD */
+};
+
+static mci_card_struct card;
+static rec_blockdev_t card_dev;
+// Cleared in init, no need to zero it at reset too.
+static __NOINIT(RAM2) rec_container_t rec;
+static bool card_present;
+
+static volatile bool sdio_done;
+
+/* Host command, run from main loop since card transfers block */
+static volatile bool command_pending;
+static uint8_t command;
+static uint8_t command_args[9];
+static bool command_result;
+static uint8_t selected;
+
+static void sdmmc_setup_wakeup(void *bits) {
+	uint32_t mask = *((uint32_t *) bits);
+
+	NVIC_ClearPendingIRQ(SDIO_IRQn);
+	sdio_done = false;
+	Chip_SDIF_SetIntMask(LPC_SDMMC, mask);
+	NVIC_EnableIRQ(SDIO_IRQn);
+}
+
+static uint32_t sdmmc_wait(void) {
+	uint32_t start = timer_service_now_us();
+
+	while (!sdio_done) {
+		if (timer_service_elapsed_us(start, timer_service_now_us()) > SD_WAIT_TIMEOUT_US) {
+			NVIC_DisableIRQ(SDIO_IRQn);
+			return MCI_INT_RTO;
+		}
+	}
+	return Chip_SDIF_GetIntStatus(LPC_SDMMC);
+}
+
+static void sdmmc_delay_ms(uint32_t ms) {
+	uint32_t start = timer_service_now_us();
+
+	while (timer_service_elapsed_us(start, timer_service_now_us()) < (ms * 1000)) {}
+}
+
+static bool card_read(void *ctx, uint32_t block, void *buffer, uint32_t count) {
+	return Chip_SDMMC_ReadBlocks(LPC_SDMMC, buffer, block, count) == (int32_t) (count * REC_BLOCK_SIZE);
+}
+
+static bool card_write(void *ctx, uint32_t block, const void *buffer, uint32_t count) {
+	return Chip_SDMMC_WriteBlocks(LPC_SDMMC, (void *) buffer, block, count) == (int32_t) (count * REC_BLOCK_SIZE);
+}
+
+static bool card_acquire(void) {
+	Chip_SCU_SetPinMuxing(sd_pins, sizeof(sd_pins) / sizeof(PINMUX_GRP_T));
+	Chip_Clock_SetBaseClock(CLK_BASE_SDIO, CLKIN_MAINPLL, true, false);
+	Chip_SDIF_Init(LPC_SDMMC);
+	Chip_SDIF_PowerOn(LPC_SDMMC);
+
+	memset(&card, 0, sizeof(card));
+	card.card_info.evsetup_cb = sdmmc_setup_wakeup;
+	card.card_info.waitfunc_cb = sdmmc_wait;
+	card.card_info.msdelay_func = sdmmc_delay_ms;
+
+	card_present = Chip_SDMMC_Acquire(LPC_SDMMC, &card) != 0;
+	if (!card_present) {
+		Chip_SDIF_DeInit(LPC_SDMMC);
+		return false;
+	}
+
+	card_dev.read = card_read;
+	card_dev.write = card_write;
+	card_dev.ctx = NULL;
+	card_dev.num_blocks = Chip_SDMMC_GetDeviceBlocks(LPC_SDMMC);
+	return true;
+}
+
+static bool run_command(void) {
+	switch (command) {
+	case SD_RECORDER_CMD_MOUNT:
+		if (rec.recording) {
+			return false;
+		}
+		rec_read_stop(&rec);
+		return card_acquire() && rec_mount(&rec, &card_dev);
+
+	case SD_RECORDER_CMD_FORMAT:
+		if (rec.recording || (get_u32(command_args) != REC_INDEX_MAGIC)) {
+			return false;
+		}
+		rec_read_stop(&rec);
+		return (card_present || card_acquire()) && rec_format(&rec, &card_dev);
+
+	case SD_RECORDER_CMD_START:
+		return rec_start(&rec);
+
+	case SD_RECORDER_CMD_STOP:
+		return rec_stop(&rec);
+
+	case SD_RECORDER_CMD_READ:
+		selected = command_args[0];
+		return rec_read_start(&rec, command_args[0], get_u32(&command_args[1]), get_u32(&command_args[5]));
+
+	case SD_RECORDER_CMD_READ_STOP:
+		rec_read_stop(&rec);
+		return true;
+
+	case SD_RECORDER_CMD_SELECT:
+		selected = command_args[0];
+		return selected < rec.index.count;
+	}
+	return false;
+}
+
+/* IN report producer, readback stream. */
+static uint32_t recorder_in_source(uint8_t *report) {
+	uint32_t offset, length;
+
+	length = rec_read(&rec, &report[6], SD_RECORDER_READ_DATA_SIZE, &offset);
+	if (length == 0) {
+		return 0;
+	}
+	report[0] = HID_REPORT_ID_RECORDER;
+	put_u32(&report[1], offset);
+	report[5] = length;
+	return HID_RECORDER_REPORT_SIZE;
+}
+
+void sd_recorder_init(uint32_t irq_priority) {
+	memset(&rec, 0, sizeof(rec));
+	card_present = false;
+	command_pending = false;
+	selected = 0;
+	NVIC_SetPriority(SDIO_IRQn, irq_priority);
+	hid_in_add_source(recorder_in_source);
+}
+
+void sd_recorder_write(const uint8_t *payload, uint32_t length) {
+	if (length < 1) {
+		return;
+	}
+	sd_recorder_append(&payload[1], MIN(payload[0], length - 1));
+}
+
+uint32_t sd_recorder_append(const uint8_t *data, uint32_t length) {
+	return rec_append(&rec, data, length);
+}
+
+bool sd_recorder_pending(void) {
+	return command_pending || rec_pending(&rec);
+}
+
+void sd_recorder_process(void) {
+	if (command_pending) {
+		command_result = run_command();
+		command_pending = false;
+	}
+
+	// One card transfer per pass so other main loop work is not held up longer.
+	rec_process(&rec);
+
+	if (rec.reading && (rec.read_pos >= rec.read_end) &&
+		!rec.buffers[0].ready && !rec.buffers[1].ready) {
+		rec_read_stop(&rec);
+	}
+}
+
+bool sd_recorder_set_feature(const uint8_t *payload, uint16_t length) {
+	if ((length < 1) || command_pending || (payload[0] > SD_RECORDER_CMD_SELECT)) {
+		return false;
+	}
+
+	memset(command_args, 0, sizeof(command_args));
+	memcpy(command_args, &payload[1], MIN(length - 1, sizeof(command_args)));
+	command = payload[0];
+	command_pending = true;
+	return true;
+}
+
+uint16_t sd_recorder_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	const rec_entry_t *entry;
+	uint32_t i, offset = 8;
+
+	if (max_length < SD_RECORDER_STATUS_SIZE) {
+		return 0;
+	}
+
+	if (!card_present) {
+		payload[0] = SD_RECORDER_STATE_NO_CARD;
+	}
+	else if (!rec.mounted) {
+		payload[0] = SD_RECORDER_STATE_UNFORMATTED;
+	}
+	else if (rec.recording) {
+		payload[0] = SD_RECORDER_STATE_RECORDING;
+	}
+	else if (rec.reading) {
+		payload[0] = SD_RECORDER_STATE_READING;
+	}
+	else {
+		payload[0] = SD_RECORDER_STATE_IDLE;
+	}
+	payload[1] = command_pending ? 0xFF : command_result;
+	payload[2] = rec.index.count;
+	payload[3] = selected;
+	put_u32(&payload[4], card_present ? card_dev.num_blocks : 0);
+
+	counters = (const uint32_t *) &rec.stats;
+	for (i = 0; i < sizeof(rec_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	put_u32(&payload[offset], rec.read_pos);
+	put_u32(&payload[offset + 4], rec.read_end);
+	offset += 8;
+
+	if (selected < rec.index.count) {
+		entry = &rec.index.entries[selected];
+		put_u32(&payload[offset], entry->id);
+		put_u32(&payload[offset + 4], entry->start_block);
+		put_u32(&payload[offset + 8], entry->bytes);
+		put_u32(&payload[offset + 12], entry->flags);
+	}
+	return SD_RECORDER_STATUS_SIZE;
+}
+
+void SDIO_IRQHandler(void) {
+	NVIC_DisableIRQ(SDIO_IRQn);
+	sdio_done = true;
+}
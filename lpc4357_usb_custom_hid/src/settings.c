@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "timer_service.h"
+#include "config_store.h"
+#include "byte_order.h"
+#include "settings.h"
+
+/* Flash banks and EEPROM share FLASH_EEPROM_IRQHandler */
+#define EEPROM_IRQ				RESERVED2_IRQn
+
+/* Changed settings are programmed once the host left them alone for this long */
+#define SETTINGS_FLUSH_IDLE_US	500000
+
+/* EEPROM pages 0 .. 2 * SETTINGS_PAGES - 1 */
+#define SETTINGS_PAGES			CONFIG_STORE_MAX_PAGES
+
+// Cleared by config_store_init(), no need to zero it at reset too.
+static __NOINIT(RAM2) config_store_t store;
+static config_media_t eeprom_media;
+static uint32_t programming_page;
+static uint32_t flush_idle;
+static bool flush_wake;
+
+static bool eeprom_read(void *ctx, uint32_t page, uint8_t *data) {
+	memcpy(data, (const void *) EEPROM_ADDRESS(page, 0), EEPROM_PAGE_SIZE);
+	return true;
+}
+
+/* Fill page register word by word, end of program interrupt follows. */
+static void eeprom_write(void *ctx, uint32_t page, const uint8_t *data) {
+	volatile uint32_t *dst = (volatile uint32_t *) EEPROM_ADDRESS(page, 0);
+	const uint32_t *src = (const uint32_t *) data;
+	uint32_t i;
+
+	programming_page = page;
+	for (i = 0; i < EEPROM_PAGE_SIZE / sizeof(uint32_t); i++) {
+		dst[i] = src[i];
+	}
+	Chip_EEPROM_ClearIntStatus(LPC_EEPROM, EEPROM_INT_ENDOFPROG);
+	Chip_EEPROM_SetCmd(LPC_EEPROM, EEPROM_CMD_ERASE_PRG_PAGE);
+}
+
+void FLASH_EEPROM_IRQHandler(void) {
+	uint32_t now = timer_service_now_us();
+	bool ok;
+
+	if (!(Chip_EEPROM_GetIntStatus(LPC_EEPROM) & EEPROM_INT_ENDOFPROG)) {
+		return;
+	}
+	Chip_EEPROM_ClearIntStatus(LPC_EEPROM, EEPROM_INT_ENDOFPROG);
+
+	ok = memcmp((const void *) EEPROM_ADDRESS(programming_page, 0), store.image, EEPROM_PAGE_SIZE) == 0;
+	config_store_write_done(&store, ok, now);
+	config_store_flush(&store, now, flush_idle);
+}
+
+void settings_init(uint32_t irq_priority) {
+	Chip_Clock_Enable(CLK_MX_EEPROM);
+	Chip_EEPROM_Init(LPC_EEPROM);
+	Chip_EEPROM_SetAutoProg(LPC_EEPROM, EEPROM_AUTOPROG_OFF);
+
+	eeprom_media.read = eeprom_read;
+	eeprom_media.write = eeprom_write;
+	eeprom_media.ctx = NULL;
+	config_store_init(&store, &eeprom_media, SETTINGS_PAGES);
+
+	flush_idle = SETTINGS_FLUSH_IDLE_US;
+	flush_wake = false;
+
+	Chip_EEPROM_ClearIntStatus(LPC_EEPROM, EEPROM_INT_ENDOFPROG);
+	Chip_EEPROM_EnableInt(LPC_EEPROM, EEPROM_INT_ENDOFPROG);
+	NVIC_SetPriority(EEPROM_IRQ, irq_priority);
+	NVIC_ClearPendingIRQ(EEPROM_IRQ);
+	NVIC_EnableIRQ(EEPROM_IRQ);
+}
+
+uint32_t settings_get(uint8_t key, uint8_t *value, uint32_t max_length) {
+	return config_store_get(&store, key, value, max_length);
+}
+
+bool settings_set(uint8_t key, const uint8_t *value, uint32_t length) {
+	bool ok;
+
+	NVIC_DisableIRQ(EEPROM_IRQ);
+	ok = config_store_set(&store, key, value, length, timer_service_now_us());
+	NVIC_EnableIRQ(EEPROM_IRQ);
+	return ok;
+}
+
+void settings_delete(uint8_t key) {
+	NVIC_DisableIRQ(EEPROM_IRQ);
+	config_store_delete(&store, key, timer_service_now_us());
+	NVIC_EnableIRQ(EEPROM_IRQ);
+}
+
+void settings_process(void) {
+	bool dirty;
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	NVIC_DisableIRQ(EEPROM_IRQ);
+	config_store_flush(&store, timer_service_now_us(), flush_idle);
+	dirty = config_store_dirty(&store) || config_store_busy(&store);
+	if (!dirty) {
+		flush_idle = SETTINGS_FLUSH_IDLE_US;
+	}
+	NVIC_EnableIRQ(EEPROM_IRQ);
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	// Keep waking up while pages wait for their idle time.
+	if (dirty != flush_wake) {
+		flush_wake = dirty;
+		timer_service_wake_request(dirty);
+	}
+}
+
+bool settings_set_feature(const uint8_t *payload, uint16_t length) {
+	if (length < 1) {
+		return false;
+	}
+
+	NVIC_DisableIRQ(EEPROM_IRQ);
+	switch (payload[0]) {
+	case SETTINGS_CMD_SYNC:
+		flush_idle = 0;
+		break;
+
+	case SETTINGS_CMD_CLEAR:
+		config_store_clear(&store, timer_service_now_us());
+		flush_idle = 0;
+		break;
+
+	default:
+		NVIC_EnableIRQ(EEPROM_IRQ);
+		return false;
+	}
+	NVIC_EnableIRQ(EEPROM_IRQ);
+	return true;
+}
+
+uint16_t settings_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 4;
+
+	if (max_length < SETTINGS_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = config_store_dirty(&store);
+	payload[1] = config_store_busy(&store);
+	payload[2] = SETTINGS_PAGES;
+
+	counters = (const uint32_t *) &store.stats;
+	for (i = 0; i < sizeof(config_store_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return SETTINGS_STATUS_SIZE;
+}
@@ -30,6 +30,7 @@
  */
 
  #include "board.h"
+#include "boot_stages.h"
 
 
 /*****************************************************************************
@@ -77,7 +78,9 @@ void SystemInit(void)
 	fpuInit();
 #endif
 
-	board_init_all();
+	/* SDRAM, SPIFI and Ethernet PHY come up after USB connected */
+	board_init_early();
+	boot_stages_start_clock();
 	__asm volatile ("cpsie i");
 	__asm volatile ("cpsie f");
 
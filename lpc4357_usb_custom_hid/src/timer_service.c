@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "board.h"
+#include "timer_service.h"
+
+#define TIMER_SERVICE_TIMER LPC_TIMER0
+#define TIMER_SERVICE_TICK_HZ 1000000
+#define TIMER_SERVICE_WAKE_MATCH 0
+
+static uint32_t wake_requests;
+
+void timer_service_init(uint32_t irq_priority) {
+	uint32_t timer_clk_hz;
+
+	Chip_TIMER_Init(TIMER_SERVICE_TIMER);
+	Chip_TIMER_Reset(TIMER_SERVICE_TIMER);
+
+	// Prescale timer clock down to 1us ticks, TC free runs and wraps at 2^32.
+	timer_clk_hz = Chip_Clock_GetRate(CLK_MX_TIMER0);
+	Chip_TIMER_PrescaleSet(TIMER_SERVICE_TIMER, (timer_clk_hz / TIMER_SERVICE_TICK_HZ) - 1);
+	wake_requests = 0;
+
+	NVIC_SetPriority(TIMER0_IRQn, irq_priority);
+	NVIC_EnableIRQ(TIMER0_IRQn);
+
+	Chip_TIMER_Enable(TIMER_SERVICE_TIMER);
+}
+
+/* Requested from USB interrupt and main loop alike, every interrupt is
+ * held off while the count and match interrupt change together. */
+void timer_service_wake_request(bool enable) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+
+	if (enable) {
+		if (wake_requests++ == 0) {
+			Chip_TIMER_SetMatch(TIMER_SERVICE_TIMER, TIMER_SERVICE_WAKE_MATCH,
+								timer_service_now_us() + TIMER_SERVICE_WAKE_US);
+			Chip_TIMER_ClearMatch(TIMER_SERVICE_TIMER, TIMER_SERVICE_WAKE_MATCH);
+			Chip_TIMER_MatchEnableInt(TIMER_SERVICE_TIMER, TIMER_SERVICE_WAKE_MATCH);
+		}
+	}
+	else if ((wake_requests > 0) && (--wake_requests == 0)) {
+		Chip_TIMER_MatchDisableInt(TIMER_SERVICE_TIMER, TIMER_SERVICE_WAKE_MATCH);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/* Only purpose is to wake up main loop, match register is moved one period ahead. */
+void TIMER0_IRQHandler(void) {
+	Chip_TIMER_ClearMatch(TIMER_SERVICE_TIMER, TIMER_SERVICE_WAKE_MATCH);
+	TIMER_SERVICE_TIMER->MR[TIMER_SERVICE_WAKE_MATCH] += TIMER_SERVICE_WAKE_US;
+}
+
+uint32_t timer_service_now_us(void) {
+	return Chip_TIMER_ReadCount(TIMER_SERVICE_TIMER);
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <cr_section_macros.h>
+#include <string.h>
+
+#include "board.h"
+#include "hid_generic.h"
+#include "dma_service.h"
+#include "timer_service.h"
+#include "uart_bridge.h"
+
+/* RX buffer is a ring of DMA segments, terminal count of each segment interrupts. */
+#define RX_SEGMENT_SIZE		64
+#define RX_NUM_SEGMENTS		8
+#define RX_BUFFER_SIZE		(RX_SEGMENT_SIZE * RX_NUM_SEGMENTS)
+#define TX_BUFFER_SIZE		1024	/* Power of 2, RINGBUFF_T requirement */
+
+/* TX ring space freed before host hears of it unprompted */
+#define TX_CREDIT_THRESHOLD	(TX_BUFFER_SIZE / 4)
+
+/* Largest single TX DMA transfer, limited by 12 bit transfer size */
+#define TX_MAX_CHUNK		0xFFF
+
+typedef struct {
+	LPC_USART_T *uart;
+	IRQn_Type irq;
+	uint8_t tx_port, tx_pin, rx_port, rx_pin;
+	uint16_t pin_func;
+	uint8_t tx_req_line, rx_req_line;	/* DMAMUX lines, UART is function 1 on both */
+} uart_channel_hw_t;
+
+static const uart_channel_hw_t channel_hw[UART_BRIDGE_NUM_CHANNELS] = {
+	{ LPC_USART3, USART3_IRQn, 2, 3, 2, 4, SCU_MODE_FUNC2, 7, 8 },		/* P2_3 U3_TXD, P2_4 U3_RXD */
+	{ LPC_USART2, USART2_IRQn, 1, 15, 1, 16, SCU_MODE_FUNC1, 5, 6 },	/* P1_15 U2_TXD, P1_16 U2_RXD */
+};
+
+#define DMA_REQ_FUNC_UART	1
+
+typedef struct {
+	bool open;
+	int rx_dma;
+	int tx_dma;
+	uint32_t flush_us;
+
+	/* RX, written by DMA, consumed by IN report producer */
+	DMA_TransferDescriptor_t rx_lli[RX_NUM_SEGMENTS];
+	uint8_t rx_buffer[RX_BUFFER_SIZE];
+	volatile uint32_t rx_segments;	/* Completed segments, counted in DMA interrupt */
+	uint32_t rx_consumed;			/* Total bytes taken out of rx_buffer */
+	uint32_t rx_pending_since_us;
+	bool rx_pending;
+	credit_tx_t in_credit;			/* Host's room for received bytes */
+	bool in_stalled;
+
+	/* TX, filled from USB interrupt, drained by DMA */
+	RINGBUFF_T tx_ring;
+	uint8_t tx_buffer[TX_BUFFER_SIZE];
+	uint32_t tx_chunk;				/* Bytes in flight, 0 when idle */
+	credit_rx_t out_credit;			/* TX ring room granted to host */
+
+	uart_bridge_stats_t stats;
+} uart_channel_t;
+
+// Cleared in init, no need to zero it at reset too.
+static __NOINIT(RAM2) uart_channel_t channels[UART_BRIDGE_NUM_CHANNELS];
+static uint32_t next_in_channel;
+static volatile bool tx_kick;
+
+static uart_channel_t *channel_from_dma(uint8_t dma_ch, bool tx) {
+	uint32_t i;
+
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		if (channels[i].open && ((tx ? channels[i].tx_dma : channels[i].rx_dma) == dma_ch)) {
+			return &channels[i];
+		}
+	}
+	return NULL;
+}
+
+/* Total bytes written by DMA since channel was opened. */
+static uint32_t rx_produced(uart_channel_t *ch) {
+	uint32_t segments, dst_offset, dst_segment, lag;
+
+	do {
+		segments = ch->rx_segments;
+		dst_offset = LPC_GPDMA->CH[ch->rx_dma].DESTADDR - (uint32_t) ch->rx_buffer;
+	} while (segments != ch->rx_segments);
+
+	// Segment interrupt may still be pending when called from higher priority
+	// USB interrupt, account for segments DMA already moved past.
+	dst_segment = (dst_offset / RX_SEGMENT_SIZE) % RX_NUM_SEGMENTS;
+	lag = (dst_segment + RX_NUM_SEGMENTS - (segments % RX_NUM_SEGMENTS)) % RX_NUM_SEGMENTS;
+
+	return ((segments + lag) * RX_SEGMENT_SIZE) + (dst_offset % RX_SEGMENT_SIZE);
+}
+
+static void rx_dma_done(uint8_t dma_ch, bool error) {
+	uart_channel_t *ch = channel_from_dma(dma_ch, false);
+
+	if (ch != NULL) {
+		ch->rx_segments++;
+	}
+}
+
+/* Must be called with DMA interrupt masked or from DMA interrupt. */
+static void tx_start(uart_channel_t *ch, const uart_channel_hw_t *hw) {
+	DMA_TransferDescriptor_t desc;
+	uint32_t count, tail;
+
+	if (ch->tx_chunk != 0) {
+		return;
+	}
+
+	count = RingBuffer_GetCount(&ch->tx_ring);
+	if (count == 0) {
+		return;
+	}
+
+	// DMA needs contiguous memory, send up to end of ring and wrap on next chunk.
+	tail = RB_VTAIL(&ch->tx_ring) & (TX_BUFFER_SIZE - 1);
+	count = MIN(count, TX_BUFFER_SIZE - tail);
+	count = MIN(count, TX_MAX_CHUNK);
+
+	desc.src = (uint32_t) &ch->tx_buffer[tail];
+	desc.dst = (uint32_t) &hw->uart->THR;
+	desc.lli = 0;
+	desc.ctrl = GPDMA_DMACCxControl_TransferSize(count) |
+				GPDMA_DMACCxControl_SBSize(GPDMA_BSIZE_1) |
+				GPDMA_DMACCxControl_DBSize(GPDMA_BSIZE_1) |
+				GPDMA_DMACCxControl_SWidth(GPDMA_WIDTH_BYTE) |
+				GPDMA_DMACCxControl_DWidth(GPDMA_WIDTH_BYTE) |
+				GPDMA_DMACCxControl_SI | GPDMA_DMACCxControl_I;
+
+	ch->tx_chunk = count;
+	dma_service_start(ch->tx_dma, &desc,
+					  GPDMA_DMACCxConfig_DestPeripheral(hw->tx_req_line) |
+					  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_M2P_CONTROLLER_DMA));
+}
+
+static void tx_dma_done(uint8_t dma_ch, bool error) {
+	uart_channel_t *ch = channel_from_dma(dma_ch, true);
+
+	if (ch == NULL) {
+		return;
+	}
+
+	if (!error) {
+		ch->stats.tx_bytes += ch->tx_chunk;
+	}
+	RB_VTAIL(&ch->tx_ring) += ch->tx_chunk;
+	credit_rx_consume(&ch->out_credit, ch->tx_chunk);
+	ch->tx_chunk = 0;
+	tx_start(ch, &channel_hw[ch - channels]);
+}
+
+static void rx_start(uart_channel_t *ch, const uart_channel_hw_t *hw) {
+	uint32_t i;
+
+	for (i = 0; i < RX_NUM_SEGMENTS; i++) {
+		ch->rx_lli[i].src = (uint32_t) &hw->uart->RBR;
+		ch->rx_lli[i].dst = (uint32_t) &ch->rx_buffer[i * RX_SEGMENT_SIZE];
+		ch->rx_lli[i].lli = (uint32_t) &ch->rx_lli[(i + 1) % RX_NUM_SEGMENTS];
+		ch->rx_lli[i].ctrl = GPDMA_DMACCxControl_TransferSize(RX_SEGMENT_SIZE) |
+							 GPDMA_DMACCxControl_SBSize(GPDMA_BSIZE_1) |
+							 GPDMA_DMACCxControl_DBSize(GPDMA_BSIZE_1) |
+							 GPDMA_DMACCxControl_SWidth(GPDMA_WIDTH_BYTE) |
+							 GPDMA_DMACCxControl_DWidth(GPDMA_WIDTH_BYTE) |
+							 GPDMA_DMACCxControl_DI | GPDMA_DMACCxControl_I;
+	}
+
+	ch->rx_segments = 0;
+	ch->rx_consumed = 0;
+	ch->rx_pending = false;
+	dma_service_start(ch->rx_dma, &ch->rx_lli[0],
+					  GPDMA_DMACCxConfig_SrcPeripheral(hw->rx_req_line) |
+					  GPDMA_DMACCxConfig_TransferType(GPDMA_TRANSFERTYPE_P2M_CONTROLLER_DMA));
+}
+
+/* Received bytes due to go to host now, full reports or ones waiting flush timeout. */
+static uint32_t rx_ready(uart_channel_t *ch, uint32_t now_us) {
+	uint32_t produced, avail;
+
+	produced = rx_produced(ch);
+	avail = produced - ch->rx_consumed;
+	if (avail > (RX_BUFFER_SIZE - RX_SEGMENT_SIZE)) {
+		// DMA lapped us, keep only the segments it can not be writing to.
+		ch->stats.rx_overflow += avail - (RX_BUFFER_SIZE - RX_SEGMENT_SIZE);
+		ch->rx_consumed = produced - (RX_BUFFER_SIZE - RX_SEGMENT_SIZE);
+		avail = RX_BUFFER_SIZE - RX_SEGMENT_SIZE;
+	}
+	if (avail == 0) {
+		ch->rx_pending = false;
+		return 0;
+	}
+
+	if (!ch->rx_pending) {
+		ch->rx_pending = true;
+		ch->rx_pending_since_us = now_us;
+	}
+	if ((avail < UART_BRIDGE_REPORT_DATA_SIZE) &&
+		(timer_service_elapsed_us(ch->rx_pending_since_us, now_us) < ch->flush_us)) {
+		return 0;
+	}
+	return MIN(avail, UART_BRIDGE_REPORT_DATA_SIZE);
+}
+
+/* IN report producer, one report per call, channels served round robin. */
+static uint32_t uart_in_source(uint8_t *report) {
+	uart_channel_t *ch;
+	uint32_t i, limit, offset, count, credit, first;
+	uint32_t now_us = timer_service_now_us();
+
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		ch = &channels[next_in_channel];
+		next_in_channel = (next_in_channel + 1) % UART_BRIDGE_NUM_CHANNELS;
+		if (!ch->open) {
+			continue;
+		}
+
+		count = rx_ready(ch, now_us);
+		credit = credit_tx_available(&ch->in_credit);
+		if (count > credit) {
+			// Bytes wait in RX buffer until host frees room.
+			if (!ch->in_stalled) {
+				credit_tx_stall(&ch->in_credit);
+				ch->in_stalled = true;
+			}
+			count = credit;
+		}
+		else {
+			ch->in_stalled = false;
+		}
+		if ((count == 0) && !credit_rx_update_due(&ch->out_credit)) {
+			continue;
+		}
+
+		offset = ch->rx_consumed % RX_BUFFER_SIZE;
+		first = MIN(count, RX_BUFFER_SIZE - offset);
+		limit = credit_rx_advertise(&ch->out_credit);
+
+		report[0] = HID_REPORT_ID_UART;
+		report[1] = ch - channels;
+		report[2] = count;
+		report[3] = limit & 0xFF;
+		report[4] = (limit >> 8) & 0xFF;
+		report[5] = (limit >> 16) & 0xFF;
+		report[6] = limit >> 24;
+		memcpy(&report[UART_BRIDGE_REPORT_HEADER_SIZE], &ch->rx_buffer[offset], first);
+		memcpy(&report[UART_BRIDGE_REPORT_HEADER_SIZE + first], &ch->rx_buffer[0], count - first);
+
+		if (count > 0) {
+			credit_tx_sent(&ch->in_credit, count);
+			ch->rx_consumed += count;
+			ch->rx_pending_since_us = now_us;
+			ch->rx_pending = (rx_produced(ch) != ch->rx_consumed);
+			ch->stats.rx_bytes += count;
+			ch->stats.rx_reports++;
+		}
+		return HID_UART_REPORT_SIZE;
+	}
+	return 0;
+}
+
+static void uart_irq(uint8_t channel) {
+	uint32_t lsr = Chip_UART_ReadLineStatus(channel_hw[channel].uart);
+
+	if (lsr & (UART_LSR_OE | UART_LSR_PE | UART_LSR_FE | UART_LSR_BI)) {
+		channels[channel].stats.line_errors++;
+	}
+}
+
+void uart_bridge_init(uint32_t irq_priority) {
+	uint32_t i;
+
+	memset(channels, 0, sizeof(channels));
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		channels[i].rx_dma = -1;
+		channels[i].tx_dma = -1;
+		RingBuffer_Init(&channels[i].tx_ring, channels[i].tx_buffer, 1, TX_BUFFER_SIZE);
+		NVIC_SetPriority(channel_hw[i].irq, irq_priority);
+	}
+	next_in_channel = 0;
+	tx_kick = false;
+
+	hid_in_add_source(uart_in_source);
+}
+
+/* Lines are shared with timer match and SSP requests, e.g. logic capture. */
+static bool claim_lines(const uart_channel_hw_t *hw) {
+	if (!dma_service_claim_request(hw->tx_req_line, DMA_REQ_FUNC_UART)) {
+		return false;
+	}
+	if (!dma_service_claim_request(hw->rx_req_line, DMA_REQ_FUNC_UART)) {
+		dma_service_release_request(hw->tx_req_line);
+		return false;
+	}
+	return true;
+}
+
+bool uart_bridge_open(uint8_t channel, uint32_t baud, uint32_t flush_us) {
+	const uart_channel_hw_t *hw;
+	uart_channel_t *ch;
+
+	if ((channel >= UART_BRIDGE_NUM_CHANNELS) || (baud == 0)) {
+		return false;
+	}
+	hw = &channel_hw[channel];
+	ch = &channels[channel];
+
+	uart_bridge_close(channel);
+
+	ch->rx_dma = dma_service_alloc(rx_dma_done, true);
+	ch->tx_dma = dma_service_alloc(tx_dma_done, false);
+	if ((ch->rx_dma < 0) || (ch->tx_dma < 0) || !claim_lines(hw)) {
+		if (ch->rx_dma >= 0) {
+			dma_service_free(ch->rx_dma);
+		}
+		if (ch->tx_dma >= 0) {
+			dma_service_free(ch->tx_dma);
+		}
+		ch->rx_dma = ch->tx_dma = -1;
+		return false;
+	}
+
+	Chip_SCU_PinMuxSet(hw->tx_port, hw->tx_pin, (SCU_MODE_INACT | hw->pin_func));
+	Chip_SCU_PinMuxSet(hw->rx_port, hw->rx_pin, (SCU_MODE_INACT | SCU_MODE_INBUFF_EN | hw->pin_func));
+
+	Chip_UART_Init(hw->uart);
+	Chip_UART_ConfigData(hw->uart, (UART_LCR_WLEN8 | UART_LCR_SBS_1BIT | UART_LCR_PARITY_DIS));
+	Chip_UART_SetBaudFDR(hw->uart, baud);
+	// RX trigger level 1 so DMA picks every byte up as soon as it arrives.
+	Chip_UART_SetupFIFOS(hw->uart, (UART_FCR_FIFO_EN | UART_FCR_RX_RS | UART_FCR_TX_RS |
+									UART_FCR_DMAMODE_SEL | UART_FCR_TRG_LEV0));
+	Chip_UART_IntEnable(hw->uart, UART_IER_RLSINT);
+	Chip_UART_TXEnable(hw->uart);
+
+	RingBuffer_Flush(&ch->tx_ring);
+	ch->tx_chunk = 0;
+	ch->flush_us = flush_us;
+	// Host starts counting from zero when it opens the channel.
+	credit_rx_init(&ch->out_credit, TX_BUFFER_SIZE, TX_CREDIT_THRESHOLD);
+	credit_tx_init(&ch->in_credit);
+	ch->in_stalled = false;
+	memset(&ch->stats, 0, sizeof(ch->stats));
+
+	rx_start(ch, hw);
+	ch->open = true;
+
+	NVIC_EnableIRQ(hw->irq);
+	// Flush timeout is checked from main loop, it must not sleep through it.
+	timer_service_wake_request(true);
+	return true;
+}
+
+void uart_bridge_close(uint8_t channel) {
+	uart_channel_t *ch = &channels[channel];
+
+	if (!ch->open) {
+		return;
+	}
+
+	ch->open = false;
+	NVIC_DisableIRQ(channel_hw[channel].irq);
+	dma_service_free(ch->rx_dma);
+	dma_service_free(ch->tx_dma);
+	ch->rx_dma = ch->tx_dma = -1;
+	dma_service_release_request(channel_hw[channel].tx_req_line);
+	dma_service_release_request(channel_hw[channel].rx_req_line);
+	Chip_UART_DeInit(channel_hw[channel].uart);
+	timer_service_wake_request(false);
+}
+
+void uart_bridge_write(const uint8_t *payload, uint32_t length) {
+	uart_channel_t *ch;
+	uint32_t count, written;
+
+	if ((length < (UART_BRIDGE_REPORT_HEADER_SIZE - 1)) || (payload[0] >= UART_BRIDGE_NUM_CHANNELS)) {
+		return;
+	}
+	ch = &channels[payload[0]];
+	if (!ch->open) {
+		return;
+	}
+
+	credit_tx_grant(&ch->in_credit, payload[2] | (payload[3] << 8) | (payload[4] << 16) |
+					((uint32_t) payload[5] << 24));
+	count = MIN(payload[1], length - (UART_BRIDGE_REPORT_HEADER_SIZE - 1));
+	if (count == 0) {
+		return;
+	}
+	written = RingBuffer_InsertMult(&ch->tx_ring, &payload[UART_BRIDGE_REPORT_HEADER_SIZE - 1],
+									credit_rx_accept(&ch->out_credit, count));
+	ch->stats.tx_dropped += count - written;
+	ch->stats.tx_reports++;
+	tx_kick = true;
+}
+
+bool uart_bridge_pending(void) {
+	return tx_kick;
+}
+
+void uart_bridge_process(void) {
+	uint32_t i;
+
+	if (!tx_kick) {
+		return;
+	}
+	tx_kick = false;
+
+	NVIC_DisableIRQ(DMA_IRQn);
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		if (channels[i].open) {
+			tx_start(&channels[i], &channel_hw[i]);
+		}
+	}
+	NVIC_EnableIRQ(DMA_IRQn);
+}
+
+bool uart_bridge_get_stats(uint8_t channel, uart_bridge_stats_t *stats) {
+	if (channel >= UART_BRIDGE_NUM_CHANNELS) {
+		return false;
+	}
+	*stats = channels[channel].stats;
+	return true;
+}
+
+bool uart_bridge_set_feature(const uint8_t *payload, uint16_t length) {
+	uint32_t baud;
+
+	if ((length < 8) || (payload[0] >= UART_BRIDGE_NUM_CHANNELS)) {
+		return false;
+	}
+
+	if (!payload[1]) {
+		uart_bridge_close(payload[0]);
+		return true;
+	}
+
+	baud = payload[2] | (payload[3] << 8) | (payload[4] << 16) | ((uint32_t) payload[5] << 24);
+	return uart_bridge_open(payload[0], baud, payload[6] | (payload[7] << 8));
+}
+
+uint16_t uart_bridge_get_feature(uint8_t *payload, uint16_t max_length) {
+	uint32_t i, j;
+	const uint32_t *counters;
+
+	if (max_length < UART_BRIDGE_STATUS_SIZE) {
+		return 0;
+	}
+
+	*payload++ = UART_BRIDGE_NUM_CHANNELS;
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		counters = (const uint32_t *) &channels[i].stats;
+		for (j = 0; j < sizeof(uart_bridge_stats_t) / sizeof(uint32_t); j++) {
+			*payload++ = counters[j] & 0xFF;
+			*payload++ = (counters[j] >> 8) & 0xFF;
+			*payload++ = (counters[j] >> 16) & 0xFF;
+			*payload++ = counters[j] >> 24;
+		}
+	}
+	return UART_BRIDGE_STATUS_SIZE;
+}
+
+void UART3_IRQHandler(void) {
+	uart_irq(0);
+}
+
+void UART2_IRQHandler(void) {
+	uart_irq(1);
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "timer_service.h"
+#include "byte_order.h"
+#include "usb_power.h"
+
+static USBD_HANDLE_T g_hUsb;
+static usb_power_stats_t stats;
+static volatile bool suspended;
+static bool remote_wakeup;
+static bool wakeup_sent;
+static bool in_after_resume;
+static uint32_t suspend_us;
+static uint32_t wakeup_us;
+static uint32_t resume_us;
+static bool delay_wake;
+
+// Not used by this firmware, kept running by Board_Init outside suspend.
+static const CHIP_CCU_CLK_T gated_clocks[] = {
+	CLK_MX_LCD,
+	CLK_MX_ETHERNET,
+	CLK_MX_USB0,
+};
+
+static void gate_clocks(bool gate) {
+	uint32_t i;
+
+	for (i = 0; i < sizeof(gated_clocks) / sizeof(gated_clocks[0]); i++) {
+		if (gate) {
+			Chip_Clock_Disable(gated_clocks[i]);
+		}
+		else {
+			Chip_Clock_Enable(gated_clocks[i]);
+		}
+	}
+}
+
+void usb_power_init(USBD_HANDLE_T hUsb) {
+	g_hUsb = hUsb;
+	memset(&stats, 0, sizeof(stats));
+	suspended = false;
+	remote_wakeup = false;
+	wakeup_sent = false;
+	in_after_resume = false;
+	delay_wake = false;
+}
+
+void usb_power_suspended(void) {
+	if (suspended) {
+		return;
+	}
+	suspended = true;
+	wakeup_sent = false;
+	suspend_us = timer_service_now_us();
+	stats.suspends++;
+	gate_clocks(true);
+}
+
+void usb_power_resumed(void) {
+	if (!suspended) {
+		return;
+	}
+	gate_clocks(false);
+	suspended = false;
+	resume_us = timer_service_now_us();
+	stats.resumes++;
+	if (wakeup_sent) {
+		stats.wakeup_latency_us = timer_service_elapsed_us(wakeup_us, resume_us);
+	}
+	// Only a report queued across suspend measures resume, later ones measure idle time.
+	in_after_resume = hid_in_pending();
+}
+
+void usb_power_reset(void) {
+	// Reset ends suspend and clears the remote wakeup feature.
+	if (suspended) {
+		gate_clocks(false);
+		suspended = false;
+	}
+	remote_wakeup = false;
+	in_after_resume = false;
+}
+
+void usb_power_wakeup_cfg(bool enable) {
+	remote_wakeup = enable;
+	USBD_API->hw->WakeUpCfg(g_hUsb, enable ? 1 : 0);
+}
+
+void usb_power_in_done(void) {
+	uint32_t latency;
+
+	if (!in_after_resume) {
+		return;
+	}
+	in_after_resume = false;
+	latency = timer_service_elapsed_us(resume_us, timer_service_now_us());
+	stats.resume_latency_us = latency;
+	stats.resume_latency_max_us = MAX(stats.resume_latency_max_us, latency);
+}
+
+bool usb_power_is_suspended(void) {
+	return suspended;
+}
+
+void usb_power_process(void) {
+	uint32_t now = timer_service_now_us();
+	bool wait = false;
+
+	NVIC_DisableIRQ(LPC_USB_IRQ);
+	if (suspended && remote_wakeup && !wakeup_sent && hid_in_pending()) {
+		if (timer_service_elapsed_us(suspend_us, now) >= USB_POWER_WAKEUP_DELAY_US) {
+			wakeup_sent = true;
+			wakeup_us = now;
+			stats.wakeups++;
+			USBD_API->hw->WakeUp(g_hUsb);
+		}
+		else {
+			wait = true;
+		}
+	}
+	NVIC_EnableIRQ(LPC_USB_IRQ);
+
+	// Keep waking up until the bus was idle long enough.
+	if (wait != delay_wake) {
+		delay_wake = wait;
+		timer_service_wake_request(wait);
+	}
+}
+
+uint16_t usb_power_get_feature(uint8_t *payload, uint16_t max_length) {
+	const uint32_t *counters;
+	uint32_t i, offset = 4;
+
+	if (max_length < USB_POWER_STATUS_SIZE) {
+		return 0;
+	}
+
+	payload[0] = suspended;
+	payload[1] = remote_wakeup;
+
+	counters = (const uint32_t *) &stats;
+	for (i = 0; i < sizeof(usb_power_stats_t) / sizeof(uint32_t); i++, offset += 4) {
+		put_u32(&payload[offset], counters[i]);
+	}
+	return USB_POWER_STATUS_SIZE;
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test and benchmark of audio_packetizer.c and drift_estimator.c on
+ * synthetic sample streams.
+ *
+ * Every I2S frame carries its own index, so the host side knows exactly
+ * which frames a packet holds. Capture runs I2S at a given clock error
+ * into the FIFO 32 frames per DMA half buffer, as audio_stream.c does,
+ * and the host takes one packet per USB interval. Checks cover lossless
+ * in order delivery, sequence numbers, mono packets, and a host stall:
+ * frames dropped by slip and overrun must match the gap the host sees
+ * behind the discontinuity flag.
+ *
+ * Playback sends host packets paced by the device's feedback, or by the
+ * nominal rate with -n, into the FIFO the I2S clock drains. Drift
+ * estimator timestamps come from the 1 ms full speed frame counter like
+ * on the board.
+ *
+ * The HID full speed endpoint carries 12 kHz stereo at most, so the 48 kHz
+ * and 96 kHz stereo runs use 125 us high speed intervals with the same 63
+ * byte packets. Tables show the measured clock error and packet cost for
+ * capture, and FIFO level range, underruns and overruns for playback. The
+ * estimator starts from its first, coarse window and smooths with a time
+ * constant of 32 windows, its error is checked only on runs of 3 minutes
+ * or longer, the default.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o audio_packetizer_sim -I../lpc_chip_43xx/inc -Iinc tools/audio_packetizer_sim.c \
+ *       src/audio_packetizer.c src/drift_estimator.c
+ * $ ./audio_packetizer_sim [-s seconds] [-n]
+ */
+
+#include "lpc_types.h"
+#include "audio_packetizer.h"
+#include "drift_estimator.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Same as audio_stream.c */
+#define HALF_FRAMES			32
+#define FIFO_FRAMES			256
+#define CAPTURE_HIGH_LEVEL	(FIFO_FRAMES * 3 / 4)
+#define PLAYBACK_TARGET		(FIFO_FRAMES / 2)
+#define PACKET_SIZE			63
+
+#define TIME_BASE_US		1000	/* Full speed frame counter */
+
+typedef struct {
+	uint32_t rate;
+	uint8_t channels;
+	int32_t ppm;			/* I2S clock error */
+	uint32_t interval_us;
+} stream_cfg_t;
+
+typedef struct {
+	uint64_t produced;
+	uint64_t received;
+	uint64_t gap;			/* Frames missing behind discontinuity flags */
+	int32_t est_ppm;
+	double ns_per_packet;
+	bool ok;
+} capture_result_t;
+
+typedef struct {
+	uint32_t level_min;
+	uint32_t level_max;
+	uint32_t underruns;
+	uint32_t overruns;
+	int32_t est_ppm;
+	bool ok;
+} playback_result_t;
+
+static uint32_t failures;
+static uint32_t seconds = 180;
+static bool nominal_pacing;
+
+static uint32_t fifo_frames[FIFO_FRAMES];
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* I2S word of frame n: index low half in left channel, high half in right. */
+static uint32_t frame_word(uint64_t n) {
+	return (uint32_t) n;
+}
+
+static uint32_t quantize(double t_us) {
+	return ((uint32_t) t_us / TIME_BASE_US) * TIME_BASE_US;
+}
+
+/*
+ * Host side of capture: packets must carry consecutive frames and
+ * sequence numbers, a jump is allowed only behind the discontinuity flag.
+ */
+static void host_capture_packet(const uint8_t *packet, uint32_t length, uint8_t channels, uint16_t *seq,
+								uint64_t *next, capture_result_t *r) {
+	uint32_t count = packet[2], i;
+	const uint8_t *p = &packet[AUDIO_PACKET_HEADER_SIZE];
+	uint64_t n;
+	uint32_t word;
+
+	if ((length != AUDIO_PACKET_HEADER_SIZE + count * channels * 2) || ((packet[0] | (packet[1] << 8)) != *seq)) {
+		r->ok = false;
+	}
+	(*seq)++;
+	for (i = 0; i < count; i++, p += channels * 2) {
+		word = p[0] | (p[1] << 8);
+		if (channels == 2) {
+			word |= (uint32_t) (p[2] | (p[3] << 8)) << 16;
+			n = (*next & ~0xFFFFFFFFULL) | word;
+		}
+		else {
+			// Mono carries the low half only, gaps are far shorter than 65536 frames.
+			n = *next + (uint16_t) (word - (uint16_t) *next);
+		}
+		if (n != *next) {
+			if ((i != 0) || !(packet[3] & AUDIO_FLAG_DISCONTINUITY) || (n < *next)) {
+				r->ok = false;
+			}
+			r->gap += n - *next;
+		}
+		*next = n + 1;
+		r->received++;
+	}
+}
+
+/* stall_from/stall_us: host takes no packets for a while. */
+static void run_capture(const stream_cfg_t *cfg, uint32_t run_s, uint32_t stall_from_us, uint32_t stall_us,
+						capture_result_t *r) {
+	uint32_t half[HALF_FRAMES], i, length;
+	uint8_t packet[PACKET_SIZE];
+	double frame_us = 1e6 / (cfg->rate * (1.0 + cfg->ppm / 1e6));
+	double t_i2s = HALF_FRAMES * frame_us, t_usb = 0, end = run_s * 1e6;
+	audio_fifo_t fifo;
+	drift_estimator_t drift;
+	uint64_t next = 0;
+	uint16_t seq = 0;
+	uint32_t packets = 0;
+	struct timespec t0, t1;
+	double packet_ns = 0;
+
+	memset(r, 0, sizeof(*r));
+	r->ok = true;
+	audio_fifo_init(&fifo, fifo_frames, FIFO_FRAMES, cfg->channels);
+	drift_estimator_init(&drift, cfg->rate);
+
+	while ((t_i2s < end) || (t_usb < end)) {
+		if (t_i2s <= t_usb) {
+			for (i = 0; i < HALF_FRAMES; i++) {
+				half[i] = frame_word(r->produced + i);
+			}
+			r->produced += HALF_FRAMES;
+			audio_fifo_write(&fifo, half, HALF_FRAMES);
+			drift_estimator_update(&drift, HALF_FRAMES, quantize(t_i2s));
+			t_i2s += HALF_FRAMES * frame_us;
+			continue;
+		}
+
+		if ((t_usb < stall_from_us) || (t_usb >= stall_from_us + stall_us)) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			audio_fifo_slip(&fifo, CAPTURE_HIGH_LEVEL);
+			length = audio_packetize(&fifo, packet, PACKET_SIZE, 1);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			if (length > 0) {
+				packet_ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+				packets++;
+				host_capture_packet(packet, length, cfg->channels, &seq, &next, r);
+			}
+		}
+		t_usb += cfg->interval_us;
+	}
+
+	// Every frame produced was received, dropped as counted, or is still queued.
+	r->ok = r->ok && (r->gap == fifo.stats.slips + fifo.stats.overruns) &&
+			(r->received + r->gap + audio_fifo_level(&fifo) == r->produced);
+	r->est_ppm = drift_estimator_ppm(&drift);
+	r->ns_per_packet = packets ? packet_ns / packets : 0;
+}
+
+/* Host packet of count frames, as pack_audio_packets() in custom_hid.py builds them. */
+static uint32_t host_playback_packet(uint8_t *packet, uint8_t channels, uint16_t seq, uint64_t first, uint32_t count) {
+	uint8_t *p = &packet[AUDIO_PACKET_HEADER_SIZE];
+	uint32_t i, word;
+
+	packet[0] = seq & 0xFF;
+	packet[1] = seq >> 8;
+	packet[2] = count;
+	packet[3] = 0;
+	for (i = 0; i < count; i++) {
+		word = frame_word(first + i);
+		*p++ = word;
+		*p++ = word >> 8;
+		if (channels == 2) {
+			*p++ = word >> 16;
+			*p++ = word >> 24;
+		}
+	}
+	return p - packet;
+}
+
+static void run_playback(const stream_cfg_t *cfg, bool use_feedback, playback_result_t *r) {
+	uint32_t half[HALF_FRAMES], i, count, level, length;
+	uint32_t capacity = audio_packet_capacity(cfg->channels, PACKET_SIZE);
+	uint8_t packet[PACKET_SIZE];
+	double frame_us = 1e6 / (cfg->rate * (1.0 + cfg->ppm / 1e6));
+	double t_i2s = HALF_FRAMES * frame_us, t_usb = 0, end = seconds * 1e6, credit = 0;
+	audio_fifo_t fifo;
+	drift_estimator_t drift;
+	uint64_t sent = 1, played = 1, skipped = 0;	/* Frame 0 would look like silence */
+	uint16_t seq = 0;
+	bool primed = false;
+
+	memset(r, 0, sizeof(*r));
+	r->ok = true;
+	r->level_min = FIFO_FRAMES;
+	audio_fifo_init(&fifo, fifo_frames, FIFO_FRAMES, cfg->channels);
+	drift_estimator_init(&drift, cfg->rate);
+
+	while (t_i2s < end) {
+		if (t_i2s <= t_usb) {
+			// Same as playback_dma_done() in audio_stream.c.
+			if (!primed && (audio_fifo_level(&fifo) >= PLAYBACK_TARGET)) {
+				primed = true;
+			}
+			if (primed) {
+				audio_fifo_read(&fifo, half, HALF_FRAMES);
+				for (i = 0; i < HALF_FRAMES; i++) {
+					// Silence stands in for missing frames, frames never go backwards.
+					if (half[i] == 0) {
+						continue;
+					}
+					if (half[i] < played) {
+						r->ok = false;
+					}
+					else {
+						skipped += half[i] - played;
+					}
+					played = (uint64_t) half[i] + 1;
+				}
+				level = audio_fifo_level(&fifo);
+				r->level_min = MIN(r->level_min, level);
+				r->level_max = MAX(r->level_max, level);
+			}
+			drift_estimator_update(&drift, HALF_FRAMES, quantize(t_i2s));
+			t_i2s += HALF_FRAMES * frame_us;
+			continue;
+		}
+
+		// Host paces by feedback read every interval, or by nominal rate.
+		credit += (use_feedback ? drift_estimator_feedback(&drift, audio_fifo_level(&fifo), PLAYBACK_TARGET) / 65536.0 :
+								  cfg->rate / 1000.0) * cfg->interval_us / 1000.0;
+		count = MIN((uint32_t) credit, capacity);
+		if (count > 0) {
+			length = host_playback_packet(packet, cfg->channels, seq++, sent, count);
+			count = audio_depacketize(&fifo, packet, length);
+			sent += packet[2];
+			credit -= packet[2];
+		}
+		t_usb += cfg->interval_us;
+	}
+
+	r->underruns = fifo.stats.underruns;
+	r->overruns = fifo.stats.overruns;
+	r->est_ppm = drift_estimator_ppm(&drift);
+	// Only frames that did not fit were skipped.
+	r->ok = r->ok && (fifo.stats.lost_packets == 0) && (skipped == fifo.stats.overruns);
+}
+
+static void test_drift_estimator(void) {
+	drift_estimator_t est;
+	uint32_t t, fb;
+
+	drift_estimator_init(&est, 48000);
+	check(drift_estimator_ppm(&est) == 0, "nominal before first window");
+	fb = drift_estimator_feedback(&est, PLAYBACK_TARGET, PLAYBACK_TARGET);
+	check(fb == (48 << 16), "feedback at target is nominal frames per ms");
+	check(drift_estimator_feedback(&est, PLAYBACK_TARGET - 64, PLAYBACK_TARGET) == fb + (1 << 16),
+		  "64 frames below target asks one more frame per ms");
+	check(drift_estimator_feedback(&est, 0xFFFFFF, PLAYBACK_TARGET) == 0, "feedback never negative");
+
+	// 48 frames per ms plus 1 frame per 10 ms is +2083 ppm.
+	for (t = 0; t <= 3000000; t += 10000) {
+		drift_estimator_update(&est, 481, t);
+	}
+	check(abs(drift_estimator_ppm(&est) - 2083) <= 1, "first window taken as is");
+}
+
+static void test_capture(void) {
+	stream_cfg_t cfg = { 12000, 2, 0, 1000 };
+	capture_result_t r;
+
+	run_capture(&cfg, 10, 0, 0, &r);
+	check(r.ok && (r.gap == 0) && (r.received + HALF_FRAMES >= r.produced), "12 kHz stereo capture lossless");
+
+	cfg.channels = 1;
+	cfg.rate = 27000;
+	cfg.ppm = 300;
+	run_capture(&cfg, 10, 0, 0, &r);
+	check(r.ok && (r.gap == 0), "27 kHz mono capture lossless with fast clock");
+
+	cfg.channels = 2;
+	cfg.rate = 12000;
+	cfg.ppm = 0;
+	run_capture(&cfg, 10, 2000000, 50000, &r);
+	check(r.ok && (r.gap > 0), "host stall shows as counted gap behind discontinuity");
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t rates[] = { 48000, 96000 };
+	static const int32_t ppms[] = { -500, -100, 0, 100, 500 };
+	stream_cfg_t cfg;
+	capture_result_t c;
+	playback_result_t p;
+	uint32_t i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:n")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nominal_pacing = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds] [-n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (seconds < 2) {
+		fprintf(stderr, "at least 2 s, the estimator measures over 1 s windows\n");
+		return 1;
+	}
+
+	test_drift_estimator();
+	test_capture();
+
+	printf("stereo, %u s per run, %u byte packets every 125 us, time base %u us\n\n", seconds, PACKET_SIZE,
+		   TIME_BASE_US);
+	printf("                  capture                         playback, %s pacing\n",
+		   nominal_pacing ? "nominal" : "feedback");
+	printf("   rate    ppm  measured  ns/pkt  data      level min  max  underruns  overruns  measured  data\n");
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		for (j = 0; j < sizeof(ppms) / sizeof(ppms[0]); j++) {
+			cfg.rate = rates[i];
+			cfg.channels = 2;
+			cfg.ppm = ppms[j];
+			cfg.interval_us = 125;
+
+			run_capture(&cfg, seconds, 0, 0, &c);
+			run_playback(&cfg, !nominal_pacing, &p);
+			printf("%7u %6d %9d %7.1f  %-6s %13u %4u %10u %9u %9d  %s\n", cfg.rate, cfg.ppm, c.est_ppm,
+				   c.ns_per_packet, c.ok ? "ok" : "FAILED", p.level_min, p.level_max, p.underruns, p.overruns,
+				   p.est_ppm, p.ok ? "ok" : "FAILED");
+
+			check(c.ok && (c.gap == 0), "capture lossless and in order");
+			if (seconds >= 180) {
+				check(abs(c.est_ppm - cfg.ppm) <= 20, "capture clock error measured");
+			}
+			check(p.ok, "playback in order");
+			if (!nominal_pacing) {
+				check((p.underruns == 0) && (p.overruns == 0), "feedback keeps playback FIFO within bounds");
+			}
+		}
+	}
+
+	printf("\naudio_packetizer checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
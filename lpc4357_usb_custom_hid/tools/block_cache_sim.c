@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host benchmark of block_cache.c in front of a file standing in for the
+ * SPIFI flash, driven the way msc_disk.c serves the ROM SCSI callbacks.
+ *
+ * Host transfers are split into chunks like the ROM driver's. Writes never
+ * evict, a chunk which finds every line dirty waits until the oldest line
+ * is programmed, as the bulk endpoint NAKs on the board. Lines are also
+ * programmed once left alone for half a second.
+ *
+ * Device time is simulated: USB moves data at the given rate, flash takes
+ * the erase and page program times of a typical quad SPI part, unmapped
+ * reads come at XIP speed and mapped ones overlap with USB. Host CPU time spent in the cache is measured
+ * as well. At the end the file is compared with what was written.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o block_cache_sim -I../lpc_chip_43xx/inc -Iinc tools/block_cache_sim.c src/block_cache.c
+ * $ ./block_cache_sim [-f image_file] [-c chunk] [-u usb_kb_per_s] [-n]
+ *   -n serves reads through the read callback instead of a mapping
+ */
+
+#include "lpc_types.h"
+#include "block_cache.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MEDIA_SIZE			(4 * 1024 * 1024)
+#define SECTOR_SIZE			(64 * 1024)
+#define PAGE_SIZE			256
+#define CACHE_LINES			BLOCK_CACHE_MAX_LINES
+
+#define ERASE_US			150000
+#define PAGE_PROGRAM_US		400
+#define XIP_BYTES_PER_US	40
+#define FLUSH_IDLE_US		500000
+
+#define RANDOM_IO_SIZE		4096
+#define RANDOM_IOS			256
+
+static const char *image_path = "block_cache_sim.img";
+static uint32_t chunk = 4096;
+static uint32_t usb_kb_per_s = 1000;
+static bool unmapped;
+
+static int fd;
+static uint8_t *image;			/* File mapping */
+static uint8_t *shadow;			/* What the host wrote */
+static uint8_t *line_memory;
+static uint8_t *host_buf;
+
+static block_media_t media;
+static block_cache_t cache;
+
+static uint64_t now_us;			/* Simulated device time */
+static uint64_t flash_us;
+static uint32_t waits;			/* Chunks that found every line dirty */
+
+/* XIP reads overlap with USB, they cost nothing here. */
+static const uint8_t *file_map(void *ctx, uint32_t offset) {
+	return &image[offset];
+}
+
+static bool file_read(void *ctx, uint32_t offset, uint8_t *data, uint32_t length) {
+	now_us += length / XIP_BYTES_PER_US;
+	return pread(fd, data, length, offset) == (ssize_t) length;
+}
+
+/* Pages left erased cost nothing, as in msc_disk.c. */
+static bool file_write_line(void *ctx, uint32_t offset, const uint8_t *data) {
+	uint32_t page, i, cost = ERASE_US;
+
+	for (page = 0; page < SECTOR_SIZE; page += PAGE_SIZE) {
+		for (i = 0; (i < PAGE_SIZE) && (data[page + i] == 0xFF); i++) {}
+		if (i < PAGE_SIZE) {
+			cost += PAGE_PROGRAM_US;
+		}
+	}
+	now_us += cost;
+	flash_us += cost;
+	return pwrite(fd, data, SECTOR_SIZE, offset) == SECTOR_SIZE;
+}
+
+static uint64_t usb_us(uint32_t length) {
+	return (uint64_t) length * 1000000 / ((uint64_t) usb_kb_per_s * 1024);
+}
+
+static double cpu_seconds(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Main loop pass, idle lines are programmed. */
+static void main_loop(void) {
+	block_cache_line_t *line = block_cache_flush_begin(&cache, (uint32_t) now_us, FLUSH_IDLE_US);
+
+	if (line != NULL) {
+		block_cache_flush_line(&cache, line);
+	}
+}
+
+/* One ROM write chunk, GetWriteBuf then Write. */
+static void usb_write_chunk(uint32_t offset, const uint8_t *data, uint32_t length) {
+	block_cache_line_t *line;
+	uint8_t *dst;
+
+	dst = block_cache_write_buffer(&cache, offset, length, false);
+	while ((dst == NULL) && !block_cache_write(&cache, offset, data, length, (uint32_t) now_us, false)) {
+		waits++;
+		line = block_cache_flush_begin(&cache, (uint32_t) now_us, 0);
+		if (line != NULL) {
+			block_cache_flush_line(&cache, line);
+		}
+	}
+	if (dst != NULL) {
+		memcpy(dst, data, length);
+		block_cache_write(&cache, offset, dst, length, (uint32_t) now_us, false);
+	}
+	now_us += usb_us(length);
+	memcpy(&shadow[offset], data, length);
+	main_loop();
+}
+
+static void usb_write(uint32_t offset, const uint8_t *data, uint32_t length) {
+	uint32_t pos, piece;
+
+	for (pos = 0; pos < length; pos += piece) {
+		piece = MIN(chunk, length - pos);
+		// Chunks never span lines, as block_cache_write_buffer() wants.
+		piece = MIN(piece, SECTOR_SIZE - ((offset + pos) % SECTOR_SIZE));
+		usb_write_chunk(offset + pos, &data[pos], piece);
+	}
+}
+
+static bool usb_read(uint32_t offset, uint32_t length) {
+	const uint8_t *data;
+	uint32_t pos, piece;
+	bool ok = true;
+
+	for (pos = 0; pos < length; pos += piece) {
+		piece = MIN(chunk, length - pos);
+		data = block_cache_read(&cache, offset + pos, piece, host_buf);
+		ok = ok && (data != NULL) && (memcmp(data, &shadow[offset + pos], piece) == 0);
+		now_us += usb_us(piece);
+		main_loop();
+	}
+	return ok;
+}
+
+static void fill_random(uint8_t *data, uint32_t length) {
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		data[i] = rand();
+	}
+}
+
+/* Host leaves the disk alone long enough for every line to be programmed. */
+static void settle(void) {
+	now_us += FLUSH_IDLE_US;
+	while (block_cache_dirty(&cache)) {
+		main_loop();
+		now_us += 1000;
+	}
+}
+
+typedef struct {
+	const char *name;
+	uint64_t bytes;
+	uint64_t device_us;
+	double cpu_s;
+	uint64_t flash_us;
+	uint32_t waits;
+	uint32_t write_backs;
+	bool ok;
+} bench_result_t;
+
+static void begin(bench_result_t *r, const char *name) {
+	memset(r, 0, sizeof(*r));
+	r->name = name;
+	r->device_us = now_us;
+	r->cpu_s = cpu_seconds();
+	r->flash_us = flash_us;
+	r->waits = waits;
+	r->write_backs = cache.stats.write_backs;
+	r->ok = true;
+}
+
+static void end(bench_result_t *r) {
+	r->device_us = now_us - r->device_us;
+	r->cpu_s = cpu_seconds() - r->cpu_s;
+	r->flash_us = flash_us - r->flash_us;
+	r->waits = waits - r->waits;
+	r->write_backs = cache.stats.write_backs - r->write_backs;
+	printf("%-10s %8.1f %10.1f %10.1f %8.1f %7u %7u  %s\n", r->name, r->bytes / 1024.0,
+		   r->bytes / 1024.0 / (r->device_us / 1e6), r->bytes / 1048576.0 / MAX(r->cpu_s, 1e-9),
+		   r->flash_us / 1e6, r->waits, r->write_backs, r->ok ? "ok" : "MISMATCH");
+}
+
+static bool run(void) {
+	static uint8_t data[MEDIA_SIZE];
+	bench_result_t r;
+	uint32_t i, offset;
+	bool ok = true;
+
+	fill_random(data, sizeof(data));
+
+	begin(&r, "seq write");
+	usb_write(0, data, MEDIA_SIZE);
+	settle();
+	r.bytes = MEDIA_SIZE;
+	end(&r);
+
+	begin(&r, "seq read");
+	r.ok = usb_read(0, MEDIA_SIZE);
+	r.bytes = MEDIA_SIZE;
+	end(&r);
+	ok = ok && r.ok;
+
+	begin(&r, "rand write");
+	for (i = 0; i < RANDOM_IOS; i++) {
+		offset = (rand() % (MEDIA_SIZE / RANDOM_IO_SIZE)) * RANDOM_IO_SIZE;
+		usb_write(offset, &data[i * RANDOM_IO_SIZE], RANDOM_IO_SIZE);
+	}
+	settle();
+	r.bytes = RANDOM_IOS * RANDOM_IO_SIZE;
+	end(&r);
+
+	begin(&r, "rand read");
+	for (i = 0; i < RANDOM_IOS; i++) {
+		offset = (rand() % (MEDIA_SIZE / RANDOM_IO_SIZE)) * RANDOM_IO_SIZE;
+		r.ok = usb_read(offset, RANDOM_IO_SIZE) && r.ok;
+	}
+	r.bytes = RANDOM_IOS * RANDOM_IO_SIZE;
+	end(&r);
+	ok = ok && r.ok;
+
+	// Small rewrites of the same blocks, like a FAT and directory update.
+	begin(&r, "rewrite");
+	for (i = 0; i < RANDOM_IOS; i++) {
+		usb_write((i % 8) * BLOCK_CACHE_BLOCK_SIZE, &data[i * BLOCK_CACHE_BLOCK_SIZE], BLOCK_CACHE_BLOCK_SIZE);
+	}
+	settle();
+	r.bytes = RANDOM_IOS * BLOCK_CACHE_BLOCK_SIZE;
+	end(&r);
+
+	ok = ok && (memcmp(image, shadow, MEDIA_SIZE) == 0);
+	return ok;
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+	bool ok;
+
+	while ((opt = getopt(argc, argv, "f:c:u:n")) != -1) {
+		switch (opt) {
+		case 'f':
+			image_path = optarg;
+			break;
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			usb_kb_per_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			unmapped = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f image_file] [-c chunk] [-u usb_kb_per_s] [-n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((chunk < BLOCK_CACHE_BLOCK_SIZE) || (chunk % BLOCK_CACHE_BLOCK_SIZE) || (usb_kb_per_s == 0)) {
+		fprintf(stderr, "chunk must be a multiple of %u bytes, USB rate set\n", BLOCK_CACHE_BLOCK_SIZE);
+		return 1;
+	}
+
+	fd = open(image_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ((fd < 0) || (ftruncate(fd, MEDIA_SIZE) != 0)) {
+		perror(image_path);
+		return 1;
+	}
+	image = mmap(NULL, MEDIA_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	shadow = malloc(MEDIA_SIZE);
+	line_memory = malloc(CACHE_LINES * SECTOR_SIZE);
+	host_buf = malloc(chunk);
+	if ((image == MAP_FAILED) || (shadow == NULL) || (line_memory == NULL) || (host_buf == NULL)) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memset(image, 0xFF, MEDIA_SIZE);
+	memset(shadow, 0xFF, MEDIA_SIZE);
+
+	media.map = unmapped ? NULL : file_map;
+	media.read = file_read;
+	media.write_line = file_write_line;
+	media.size = MEDIA_SIZE;
+	media.line_size = SECTOR_SIZE;
+	if (!block_cache_init(&cache, &media, line_memory, CACHE_LINES)) {
+		fprintf(stderr, "cache init failed\n");
+		return 1;
+	}
+
+	srand(1);
+	printf("%u MB %s media, %u x %u KB lines, %u byte chunks, USB %u KB/s\n\n", MEDIA_SIZE >> 20,
+		   unmapped ? "unmapped" : "mapped", CACHE_LINES, SECTOR_SIZE / 1024, chunk, usb_kb_per_s);
+	printf("test             KB  dev KB/s  host MB/s  flash s   waits  writes\n");
+	ok = run();
+
+	printf("\nread hits %u, direct %u, misses %u, fills %u, errors %u\n", cache.stats.read_hits,
+		   cache.stats.read_direct, cache.stats.read_misses, cache.stats.fills, cache.stats.errors);
+	printf("image %s\n", ok ? "matches" : "DIFFERS");
+
+	munmap(image, MEDIA_SIZE);
+	close(fd);
+	unlink(image_path);
+	return ok ? 0 : 1;
+}
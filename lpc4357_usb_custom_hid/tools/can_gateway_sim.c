@@ -0,0 +1,644 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test of the CAN gateway's portable parts, can_filter.c and
+ * can_codec.c, with a replay benchmark. Linux only for the SocketCAN path.
+ *
+ * Checks cover filter allocation onto the 31 receive message objects:
+ * normalization, duplicates and covered filters costing no object, and
+ * merged objects still accepting every frame the exact list accepts for
+ * random lists of up to CAN_FILTER_MAX filters. Frame batching is checked
+ * by packing random frames into input reports and decoding them back,
+ * reports must be filled as far as the next record allows, and by lost
+ * frame counting and output report decoding including malformed records.
+ *
+ * Replay runs a trace through the gateway's receive path: message objects,
+ * then the exact list, then the RX queue, with one input report taken per
+ * millisecond. Default trace is synthetic traffic at a given bus load for
+ * a sweep of bitrates, -r replays a candump -L log instead. With -i the
+ * frames go out on a SocketCAN interface and are read back from it before
+ * they enter the gateway, a vcan interface stands in for the bus:
+ * $ sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o can_gateway_sim -I../lpc_chip_43xx/inc -Iinc tools/can_gateway_sim.c \
+ *       src/can_filter.c src/can_codec.c ../lpc_chip_43xx/src/ring_buffer.c
+ * $ ./can_gateway_sim [-l bus_load_percent] [-s seconds] [-r candump.log] [-i vcan0]
+ */
+
+#include "lpc_types.h"
+#include "can_codec.h"
+#include "can_filter.h"
+#include "byte_order.h"
+
+#include <getopt.h>
+#include <linux/can.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RX_OBJECTS			31		/* CAN_GATEWAY_RX_OBJECTS */
+#define REPORT_LEN			63		/* CAN report without report ID */
+#define REPORT_INTERVAL_US	1000
+#define MAX_TRACE			2000000
+
+typedef struct {
+	uint64_t t_us;
+	can_frame_t frame;
+} trace_frame_t;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t hw_accepted;	/* Passed message objects */
+	uint32_t accepted;		/* Passed exact list too */
+	uint32_t delivered;
+	uint32_t overflow;
+	uint32_t reports;
+	uint64_t max_wait_us;
+	double host_ns;
+	bool ok;
+} replay_result_t;
+
+static uint32_t failures;
+
+static uint32_t load_percent = 50;
+static uint32_t seconds = 2;
+static const char *replay_path;
+static const char *ifname;
+
+static trace_frame_t trace[MAX_TRACE];
+static uint32_t trace_len;
+static uint32_t expected[MAX_TRACE];	/* Trace index of every frame queued */
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static uint8_t wire_length(const can_frame_t *f) {
+	return (f->id & CAN_ID_FLAG_RTR) ? 0 : f->dlc;
+}
+
+static void random_frame(can_frame_t *f) {
+	uint32_t i;
+
+	memset(f, 0, sizeof(*f));
+	if (rand() & 1) {
+		f->id = CAN_ID_FLAG_EXT | ((((uint32_t) rand() << 8) ^ rand()) & CAN_ID_EXT_MASK);
+	}
+	else {
+		f->id = rand() & CAN_ID_STD_MASK;
+	}
+	if ((rand() % 8) == 0) {
+		f->id |= CAN_ID_FLAG_RTR;
+	}
+	f->dlc = rand() % 9;
+	for (i = 0; i < wire_length(f); i++) {
+		f->data[i] = rand();
+	}
+	f->timestamp_us = rand();
+}
+
+/* Random id passing f, of its type. */
+static uint32_t id_in_filter(const can_filter_t *f) {
+	uint32_t width = (f->id & CAN_ID_FLAG_EXT) ? CAN_ID_EXT_MASK : CAN_ID_STD_MASK;
+	uint32_t r = ((uint32_t) rand() << 8) ^ rand();
+
+	return (f->id & CAN_ID_FLAG_EXT) | (((f->id & f->mask) | (r & ~f->mask)) & width);
+}
+
+static void random_filter(can_filter_t *f) {
+	static const uint32_t std_masks[] = { 0x7FF, 0x7F0, 0x700, 0x7FE };
+	static const uint32_t ext_masks[] = { 0x1FFFFFFF, 0x1FFFFF00, 0x1FFF0000, 0x00FF };
+
+	if (rand() % 3 == 0) {
+		f->id = CAN_ID_FLAG_EXT | ((((uint32_t) rand() << 8) ^ rand()) & CAN_ID_EXT_MASK);
+		f->mask = ext_masks[rand() % 4];
+	}
+	else {
+		f->id = rand() & CAN_ID_STD_MASK;
+		f->mask = std_masks[rand() % 4];
+	}
+}
+
+/*****************************************************************************
+ * Filter allocation
+ ****************************************************************************/
+
+static void test_allocation_basics(void) {
+	const can_filter_t filters[] = {
+		{ 0x123 | 0xF000, 0xFFFFFFFF },			/* bits beyond 11 are dropped */
+		{ 0x123, 0x7FF },						/* same as the first */
+		{ 0x120, 0x7F0 },						/* covers both */
+		{ CAN_ID_FLAG_EXT | 0x123, 0x7FF },		/* extended, not merged with standard */
+	};
+	can_filter_t objects[RX_OBJECTS];
+	uint32_t used;
+
+	check(can_filter_allocate(filters, 4, objects, 1) == 0, "fewer than 2 objects refused");
+
+	used = can_filter_allocate(filters, 2, objects, RX_OBJECTS);
+	check((used == 1) && (objects[0].id == 0x123) && (objects[0].mask == 0x7FF), "normalized, duplicate free");
+
+	used = can_filter_allocate(filters, 4, objects, RX_OBJECTS);
+	check((used == 3) && (objects[2].id == (CAN_ID_FLAG_EXT | 0x123)), "covering filter gets own object, types kept apart");
+
+	used = can_filter_allocate(filters, 4, objects, 2);
+	check((used == 2) && (objects[0].id == 0x120) && (objects[0].mask == 0x7F0) &&
+		  (objects[1].id == (CAN_ID_FLAG_EXT | 0x123)), "merge keeps most mask bits");
+
+	check(can_filter_match(filters, 0, 0x555), "empty list accepts all");
+	check(!can_filter_match(&filters[3], 1, 0x123), "standard frame does not pass extended filter");
+	check(can_filter_match(&filters[3], 1, CAN_ID_FLAG_EXT | CAN_ID_FLAG_RTR | 0x123), "RTR flag ignored");
+}
+
+/* @return	Fraction of random frames the objects pass that the exact list rejects. */
+static double allocation_leak(uint32_t num, uint32_t max_objects, bool *superset) {
+	can_filter_t filters[CAN_FILTER_MAX], objects[RX_OBJECTS];
+	uint32_t used, i, j, id, hw = 0, leaked = 0;
+	can_frame_t f;
+
+	for (i = 0; i < num; i++) {
+		random_filter(&filters[i]);
+	}
+	used = can_filter_allocate(filters, num, objects, max_objects);
+	*superset = (used <= max_objects) && (used >= MIN(num, 2U));
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < 64; j++) {
+			id = id_in_filter(&filters[i]);
+			if (!can_filter_match(objects, used, id)) {
+				*superset = false;
+			}
+		}
+	}
+	for (i = 0; i < 20000; i++) {
+		// Half the frames near a filter, half anywhere.
+		if (i & 1) {
+			random_frame(&f);
+			id = f.id;
+		}
+		else {
+			id = id_in_filter(&filters[rand() % num]) ^ (1 << (rand() % 11));
+		}
+		if (can_filter_match(objects, used, id)) {
+			hw++;
+			leaked += !can_filter_match(filters, num, id);
+		}
+	}
+	return hw ? (double) leaked / hw : 0;
+}
+
+static void test_allocation_random(void) {
+	static const uint32_t counts[] = { 8, 31, 40, 48, 64 };
+	bool superset, all_superset = true;
+	double leak;
+	uint32_t i, n;
+
+	printf("filters  objects  hardware pass rejected by exact list\n");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		leak = 0;
+		for (n = 0; n < 200; n++) {
+			leak += allocation_leak(counts[i], RX_OBJECTS, &superset);
+			all_superset = all_superset && superset;
+		}
+		printf("%7u %8u %36.2f %%\n", counts[i], MIN(counts[i], (uint32_t) RX_OBJECTS), 100.0 * leak / 200);
+	}
+	check(all_superset, "objects accept everything the filters accept");
+}
+
+/*****************************************************************************
+ * Frame batching
+ ****************************************************************************/
+
+/* @return	Frames decoded from an input report payload of length bytes. */
+static uint32_t decode_report(const uint8_t *payload, uint32_t length, can_frame_t *frames, uint32_t *lost, bool *ok) {
+	uint32_t i, offset = CAN_REPORT_HEADER_SIZE, count = payload[0];
+	uint8_t len;
+
+	*lost = payload[1];
+	for (i = 0; i < count; i++) {
+		if (offset + CAN_RX_RECORD_SIZE(0) > length) {
+			*ok = false;
+			return i;
+		}
+		memset(&frames[i], 0, sizeof(frames[i]));
+		frames[i].timestamp_us = get_u32(&payload[offset]);
+		frames[i].id = get_u32(&payload[offset + 4]);
+		frames[i].dlc = payload[offset + 8];
+		len = wire_length(&frames[i]);
+		memcpy(frames[i].data, &payload[offset + 9], len);
+		offset += CAN_RX_RECORD_SIZE(len);
+	}
+	*ok = *ok && (offset == length);
+	return count;
+}
+
+static bool same_frame(const can_frame_t *a, const can_frame_t *b) {
+	return (a->timestamp_us == b->timestamp_us) && (a->id == b->id) && (a->dlc == b->dlc) &&
+		   (memcmp(a->data, b->data, wire_length(a)) == 0);
+}
+
+static void test_batching(void) {
+	can_frame_t sent[48], got[REPORT_LEN / CAN_RX_RECORD_SIZE(0)];
+	uint8_t payload[REPORT_LEN];
+	uint32_t i, n, length, lost, next = 0, next_len;
+	bool ok = true, full = true;
+
+	can_codec_init();
+	for (i = 0; i < 48; i++) {
+		random_frame(&sent[i]);
+		can_codec_push_rx(&sent[i]);
+	}
+	while ((length = can_codec_fill_report(payload, sizeof(payload))) > 0) {
+		n = decode_report(payload, length, got, &lost, &ok);
+		for (i = 0; i < n; i++) {
+			ok = ok && same_frame(&got[i], &sent[next + i]);
+		}
+		next += n;
+		// Report ends only where the next record would not fit.
+		if (next < 48) {
+			next_len = CAN_RX_RECORD_SIZE(wire_length(&sent[next]));
+			full = full && (length + next_len > sizeof(payload));
+		}
+		ok = ok && (lost == 0);
+	}
+	check(ok && (next == 48), "frames come back in order and intact");
+	check(full, "reports filled as far as records fit");
+
+	can_codec_init();
+	for (i = 0; i < 100; i++) {
+		random_frame(&sent[0]);
+		can_codec_push_rx(&sent[0]);
+	}
+	check(can_codec_get_stats()->rx_overflow == 36, "RX queue holds 64 frames");
+	length = can_codec_fill_report(payload, sizeof(payload));
+	check(payload[1] == 36, "overflow reported in next report");
+	while (can_codec_fill_report(payload, sizeof(payload)) > 0) {}
+	for (i = 0; i < 400; i++) {
+		can_codec_push_rx(&sent[0]);
+	}
+	while ((length = can_codec_fill_report(payload, sizeof(payload))) > 0) {
+		if (payload[0] == 0) {
+			break;
+		}
+	}
+	check(length == 0, "lost count fits reports carrying frames");
+}
+
+static void test_tx_decode(void) {
+	uint8_t payload[REPORT_LEN];
+	can_frame_t f;
+	uint32_t offset = 1;
+
+	can_codec_init();
+	payload[0] = 3;
+	put_u32(&payload[offset], 0x321);
+	payload[offset + 4] = 2;
+	payload[offset + 5] = 0xAA;
+	payload[offset + 6] = 0xBB;
+	offset += CAN_TX_RECORD_SIZE(2);
+	put_u32(&payload[offset], CAN_ID_FLAG_EXT | CAN_ID_FLAG_RTR | 0x1234567);
+	payload[offset + 4] = 8;					/* remote frame, no data bytes */
+	offset += CAN_TX_RECORD_SIZE(0);
+	put_u32(&payload[offset], 0x100);
+	payload[offset + 4] = 9;					/* bad DLC */
+	offset += CAN_TX_RECORD_SIZE(0);
+
+	check(can_codec_queue_tx(payload, offset) == 2, "records before a bad one queued");
+	check(can_codec_get_stats()->tx_malformed == 1, "bad DLC counted");
+	check(can_codec_pop_tx(&f) && (f.id == 0x321) && (f.dlc == 2) && (f.data[1] == 0xBB), "data frame decoded");
+	check(can_codec_pop_tx(&f) && (f.id == (CAN_ID_FLAG_EXT | CAN_ID_FLAG_RTR | 0x1234567)) && (f.dlc == 8),
+		  "remote frame decoded");
+	check(!can_codec_pop_tx(&f), "nothing else queued");
+
+	payload[0] = 1;
+	check(can_codec_queue_tx(payload, 5) == 0, "truncated record refused");
+}
+
+/*****************************************************************************
+ * Replay
+ ****************************************************************************/
+
+/* Bits on the wire with typical stuffing. */
+static uint32_t frame_bits(const can_frame_t *f) {
+	uint32_t bits = ((f->id & CAN_ID_FLAG_EXT) ? 67 : 47) + 8 * wire_length(f);
+
+	return bits + bits / 5;
+}
+
+/* 128 standard and 64 extended ids, a few of them busy. */
+static void make_trace(uint32_t bitrate) {
+	uint64_t t = 0;
+	uint32_t r;
+	can_frame_t *f;
+
+	srand(bitrate);
+	trace_len = 0;
+	while ((t < (uint64_t) seconds * 1000000) && (trace_len < MAX_TRACE)) {
+		f = &trace[trace_len].frame;
+		memset(f, 0, sizeof(*f));
+		r = rand() % 192;
+		if ((rand() % 4) == 0) {
+			r %= 8;
+		}
+		f->id = (r < 128) ? (0x100 + r * 5) : (CAN_ID_FLAG_EXT | (0x18FE0000 + (r - 128) * 0x101));
+		f->dlc = (r & 1) ? 8 : (r % 9);
+		memset(f->data, r, sizeof(f->data));
+		trace[trace_len].t_us = t;
+		trace_len++;
+		// Idle gaps bring the bus down to the requested load.
+		t += ((uint64_t) frame_bits(f) * 1000000 * 100) / ((uint64_t) bitrate * load_percent);
+	}
+}
+
+/* One line of candump -L: (seconds) interface id#data, R for remote frames. */
+static bool load_candump(const char *path) {
+	char line[256], iface[32], frame_str[128], *hash;
+	double t, t0 = -1;
+	can_frame_t *f;
+	uint32_t i;
+	FILE *fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		perror(path);
+		return false;
+	}
+	trace_len = 0;
+	while ((trace_len < MAX_TRACE) && (fgets(line, sizeof(line), fp) != NULL)) {
+		if ((sscanf(line, " (%lf) %31s %127s", &t, iface, frame_str) != 3) ||
+			((hash = strchr(frame_str, '#')) == NULL)) {
+			continue;
+		}
+		*hash++ = '\0';
+		f = &trace[trace_len].frame;
+		memset(f, 0, sizeof(*f));
+		f->id = strtoul(frame_str, NULL, 16);
+		if (strlen(frame_str) > 3) {
+			f->id |= CAN_ID_FLAG_EXT;
+		}
+		if (*hash == 'R') {
+			f->id |= CAN_ID_FLAG_RTR;
+			f->dlc = (hash[1] != '\0') ? hash[1] - '0' : 0;
+		}
+		else {
+			for (i = 0; (i < 8) && (sscanf(&hash[2 * i], "%2hhx", &f->data[i]) == 1); i++) {}
+			f->dlc = i;
+		}
+		if (t0 < 0) {
+			t0 = t;
+		}
+		trace[trace_len++].t_us = (uint64_t) ((t - t0) * 1e6);
+	}
+	fclose(fp);
+	return trace_len > 0;
+}
+
+static int open_can(const char *name) {
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+	int s = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+
+	if (s < 0) {
+		perror("socket");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name) - 1);
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+	if ((ioctl(s, SIOCGIFINDEX, &ifr) < 0) ||
+		((addr.can_ifindex = ifr.ifr_ifindex), bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0)) {
+		perror(name);
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+/* Frame goes out on tx and is taken back from rx, as the gateway's controller would see it. */
+static bool bus_transfer(int tx, int rx, can_frame_t *f) {
+	struct can_frame cf;
+
+	memset(&cf, 0, sizeof(cf));
+	cf.can_id = (f->id & CAN_ID_FLAG_EXT) ? ((f->id & CAN_ID_EXT_MASK) | CAN_EFF_FLAG) : (f->id & CAN_ID_STD_MASK);
+	if (f->id & CAN_ID_FLAG_RTR) {
+		cf.can_id |= CAN_RTR_FLAG;
+	}
+	cf.can_dlc = f->dlc;
+	memcpy(cf.data, f->data, wire_length(f));
+	if ((write(tx, &cf, sizeof(cf)) != sizeof(cf)) || (read(rx, &cf, sizeof(cf)) != sizeof(cf))) {
+		return false;
+	}
+
+	f->id = (cf.can_id & CAN_EFF_FLAG) ? (CAN_ID_FLAG_EXT | (cf.can_id & CAN_EFF_MASK)) : (cf.can_id & CAN_SFF_MASK);
+	if (cf.can_id & CAN_RTR_FLAG) {
+		f->id |= CAN_ID_FLAG_RTR;
+	}
+	f->dlc = cf.can_dlc;
+	memcpy(f->data, cf.data, wire_length(f));
+	return true;
+}
+
+/* Host takes one report, frames must be the queued ones in order. */
+static void take_report(uint64_t now, uint32_t *next, uint32_t queued, replay_result_t *r) {
+	can_frame_t got[REPORT_LEN / CAN_RX_RECORD_SIZE(0)];
+	uint8_t payload[REPORT_LEN];
+	uint32_t length, n, i, lost;
+	const trace_frame_t *t;
+
+	length = can_codec_fill_report(payload, sizeof(payload));
+	if (length == 0) {
+		return;
+	}
+	r->reports++;
+	n = decode_report(payload, length, got, &lost, &r->ok);
+	for (i = 0; i < n; i++, (*next)++) {
+		if (*next >= queued) {
+			r->ok = false;
+			return;
+		}
+		t = &trace[expected[*next]];
+		r->ok = r->ok && (got[i].timestamp_us == (uint32_t) t->t_us) && (got[i].id == t->frame.id) &&
+				(memcmp(got[i].data, t->frame.data, wire_length(&got[i])) == 0);
+		r->max_wait_us = MAX(r->max_wait_us, now - t->t_us);
+	}
+	r->delivered += n;
+}
+
+static void replay(const can_filter_t *filters, uint32_t num, int tx, int rx, replay_result_t *r) {
+	can_filter_t objects[RX_OBJECTS];
+	uint32_t i, used, queued = 0, next = 0;
+	uint64_t usb_t = 0;
+	struct timespec t0, t1;
+	can_frame_t f;
+
+	memset(r, 0, sizeof(*r));
+	r->ok = true;
+	can_codec_init();
+	used = can_filter_allocate(filters, num, objects, RX_OBJECTS);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < trace_len; i++) {
+		// USB frames due before this CAN frame arrives.
+		for (; usb_t <= trace[i].t_us; usb_t += REPORT_INTERVAL_US) {
+			take_report(usb_t, &next, queued, r);
+		}
+
+		f = trace[i].frame;
+		if ((tx >= 0) && !bus_transfer(tx, rx, &f)) {
+			r->ok = false;
+			break;
+		}
+		f.timestamp_us = (uint32_t) trace[i].t_us;
+		r->frames++;
+		if (!can_filter_match(objects, used, f.id)) {
+			continue;
+		}
+		r->hw_accepted++;
+		if (!can_filter_match(filters, num, f.id)) {
+			continue;
+		}
+		r->accepted++;
+		if (can_codec_push_rx(&f)) {
+			expected[queued++] = i;
+		}
+	}
+	while (can_codec_rx_pending() || (next < queued)) {
+		take_report(usb_t, &next, queued, r);
+		usb_t += REPORT_INTERVAL_US;
+		if (usb_t > trace[trace_len - 1].t_us + 10000000) {
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	r->overflow = can_codec_get_stats()->rx_overflow;
+	r->ok = r->ok && (next == queued) && (r->delivered + r->overflow == r->accepted);
+	r->host_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / MAX(r->frames, 1U);
+}
+
+static void print_replay(const char *name, const replay_result_t *r, double trace_s) {
+	printf("%-11s %8.0f %8.0f %8.0f %9.0f %9.0f %7.2f %8.1f %6.0f  %s\n", name, r->frames / trace_s,
+		   r->hw_accepted / trace_s, r->accepted / trace_s, r->delivered / trace_s, r->overflow / trace_s,
+		   r->reports ? (double) r->delivered / r->reports : 0,
+		   r->max_wait_us / 1000.0, r->host_ns, r->ok ? "ok" : "FAILED");
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t bitrates[] = { 125000, 250000, 500000, 1000000 };
+	can_filter_t filters[40];
+	replay_result_t r;
+	int tx = -1, rx = -1;
+	char name[32];
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:s:r:i:")) != -1) {
+		switch (opt) {
+		case 'l':
+			load_percent = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-l bus_load_percent] [-s seconds] [-r candump.log] [-i vcan0]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((load_percent == 0) || (load_percent > 100) || (seconds == 0)) {
+		fprintf(stderr, "bus load 1..100 %%, duration non zero\n");
+		return 1;
+	}
+	if (ifname != NULL) {
+		tx = open_can(ifname);
+		rx = open_can(ifname);
+		if ((tx < 0) || (rx < 0)) {
+			return 1;
+		}
+	}
+
+	srand(1);
+	test_allocation_basics();
+	test_allocation_random();
+	test_batching();
+	test_tx_decode();
+
+	// Every third of the synthetic traffic's ids, 32 standard and 8 extended
+	// ones, more than there are objects.
+	for (i = 0; i < 40; i++) {
+		filters[i].id = (i < 32) ? (0x100 + i * 3 * 5) : (CAN_ID_FLAG_EXT | (0x18FE0000 + (i - 32) * 3 * 0x101));
+		filters[i].mask = (i < 32) ? CAN_ID_STD_MASK : CAN_ID_EXT_MASK;
+	}
+
+	printf("\n%s, one %u byte report per ms%s%s\n\n", replay_path ? "no filters" : "40 exact filters",
+		   REPORT_LEN, ifname ? " through " : "", ifname ? ifname : "");
+	printf("            frames per second on bus, after objects, exact list, delivered and lost\n");
+	printf("trace            bus  objects    exact delivered      lost frm/rep  wait ms ns/frm  data\n");
+	if (replay_path != NULL) {
+		if (!load_candump(replay_path)) {
+			fprintf(stderr, "no frames in %s\n", replay_path);
+			return 1;
+		}
+		// Synthetic filters mean nothing to a real log, all of it goes to the host.
+		replay(filters, 0, tx, rx, &r);
+		print_replay("candump", &r, MAX(trace[trace_len - 1].t_us, 1ULL) / 1e6);
+		check(r.ok, "replayed frames delivered in order");
+	}
+	else {
+		for (i = 0; i < sizeof(bitrates) / sizeof(bitrates[0]); i++) {
+			make_trace(bitrates[i]);
+			replay(filters, 40, tx, rx, &r);
+			snprintf(name, sizeof(name), "%u k %u%%", bitrates[i] / 1000, load_percent);
+			print_replay(name, &r, seconds);
+			check(r.ok, "replayed frames delivered in order");
+
+			// Without filters everything goes to the host.
+			replay(filters, 0, tx, rx, &r);
+			print_replay("  no filter", &r, seconds);
+			check(r.ok, "replayed frames delivered in order");
+		}
+	}
+
+	if (tx >= 0) {
+		close(tx);
+		close(rx);
+	}
+	printf("\ncan_gateway checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
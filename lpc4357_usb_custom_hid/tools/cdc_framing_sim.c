@@ -0,0 +1,760 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test and benchmark of cdc_framing.c and the CDC channel behind it,
+ * Linux only.
+ *
+ * cdc_channel.c runs natively behind a stand-in USB ROM API, its bulk
+ * endpoints are the master side of a pseudo terminal and the host end is
+ * the slave side, where custom_cdc.py would open /dev/ttyACM0. Each 1 ms
+ * full speed frame moves up to 19 bulk packets of 64 bytes, OUT and IN
+ * taking turns. Bytes the host wrote since the previous frame form one
+ * OUT transfer which completes on a short packet or when the firmware's
+ * buffer is full, so a write ending on a full packet waits for more data
+ * as it does without a ZLP. Input reports come from a numbered stand-in
+ * producer, output reports are checked against the host's numbering.
+ *
+ * Checks cover feature requests and refusals, sequence gaps and repeats,
+ * resynchronization after garbage, padding of writes ending on a full
+ * packet and IN transfers never ending on one. Tables show framing cost on
+ * the host CPU and channel throughput per report size in both directions,
+ * and feature request round trips.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o cdc_framing_sim -DCORE_M4 -D__USE_LPCOPEN -D__LPC43XX__ \
+ *       -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast \
+ *       -I../lpc_chip_43xx/inc -I../lpc_chip_43xx/inc/usbd_rom \
+ *       -I../lpc_chip_43xx/inc/config_43xx -I../lpc4357_xplorer_plusplus_board/inc \
+ *       -Iinc -Itools tools/cdc_framing_sim.c src/cdc_channel.c src/cdc_framing.c src/crc32c.c
+ * $ ./cdc_framing_sim [-s seconds]
+ */
+
+// posix_openpt() and friends
+#define _GNU_SOURCE
+
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "crc32c.h"
+#include "cdc_framing.h"
+#include "cdc_channel.h"
+#include "byte_order.h"
+
+// After chip headers, libc macros clash with register names.
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PACKETS_PER_FRAME	19		/* Bulk packets a full speed frame carries in practice */
+#define PACKET_SIZE			USB_FS_MAX_BULK_PACKET
+#define USB_MEM_SIZE		0x1000
+#define STAGE_SIZE			4096
+
+#define REPORT_ID_IN		0x30	/* Stand-in input report producer */
+#define REPORT_ID_OUT		0x31	/* Stand-in output report consumer */
+#define REPORT_ID_ECHO		0x32	/* Stand-in feature report, reads what was set */
+
+typedef ErrorCode_t (*ep_handler_t)(USBD_HANDLE_T hUsb, void *data, uint32_t event);
+typedef ErrorCode_t (*line_state_handler_t)(USBD_HANDLE_T hCDC, uint16_t state);
+
+/* Defined by the firmware main file on the board */
+const USBD_API_T *g_pUsbApi;
+
+static uint32_t seconds = 2;
+static uint32_t failures;
+static int master = -1;		/* USB side */
+static int slave = -1;		/* Host side */
+
+/* Stand-in ROM state */
+static ep_handler_t ep_in_handler;
+static ep_handler_t ep_out_handler;
+static line_state_handler_t line_state_handler;
+static uint8_t *out_req_buf;
+static uint32_t out_req_len;
+static uint32_t out_req_got;
+static bool out_req_queued;
+static uint8_t *in_buf;
+static uint32_t in_len;
+static uint32_t in_sent;
+static bool in_active;
+static uint8_t out_stage[STAGE_SIZE];
+static uint32_t out_stage_len;
+static uint32_t in_full_end;	/* IN transfers ending on a full packet */
+static uint32_t packets;
+
+/* Stand-in firmware modules */
+static bool claimed;
+static uint32_t in_budget;	/* Input reports left to produce */
+static uint32_t in_report_size;
+static uint32_t in_seq;
+static uint32_t out_expect;
+static uint64_t out_bytes;
+static uint32_t out_bad;
+static uint8_t echo[HID_REPORT_MAX_SIZE];
+static uint16_t echo_length;
+
+/* Host end */
+static cdc_frame_decoder_t host_dec;
+static uint16_t host_seq;
+static bool host_pad = true;
+static uint8_t host_tx[STAGE_SIZE * 2];
+static uint32_t host_tx_len;
+static uint32_t host_in_expect;
+static uint64_t host_in_bytes;
+static uint32_t host_in_bad;
+static uint8_t reply_kind;
+static uint8_t reply[HID_REPORT_MAX_SIZE];
+static uint32_t reply_length;
+static bool reply_ready;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static uint8_t pattern(uint32_t seq, uint32_t i) {
+	return (seq * 31) + (i * 7);
+}
+
+/* [id][seq u32][pattern] */
+static void numbered_report(uint8_t *report, uint8_t id, uint32_t seq, uint32_t length) {
+	uint32_t i;
+
+	report[0] = id;
+	put_u32(&report[1], seq);
+	for (i = 5; i < length; i++) {
+		report[i] = pattern(seq, i);
+	}
+}
+
+static bool numbered_report_ok(const uint8_t *report, uint32_t length, uint8_t id, uint32_t seq) {
+	uint32_t i;
+
+	if ((length < 5) || (report[0] != id) || (get_u32(&report[1]) != seq)) {
+		return false;
+	}
+	for (i = 5; i < length; i++) {
+		if (report[i] != pattern(seq, i)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*****************************************************************************
+ * Stand-in USB ROM API
+ ****************************************************************************/
+
+static uint32_t rom_write_ep(USBD_HANDLE_T hUsb, uint32_t EPNum, uint8_t *pData, uint32_t cnt) {
+	if ((EPNum != CDC_EP_IN) || in_active) {
+		return 0;
+	}
+	// Nothing copied, the controller sends from the firmware's buffer.
+	in_buf = pData;
+	in_len = cnt;
+	in_sent = 0;
+	in_active = true;
+	if ((cnt % PACKET_SIZE) == 0) {
+		in_full_end++;
+	}
+	return cnt;
+}
+
+static uint32_t rom_read_req_ep(USBD_HANDLE_T hUsb, uint32_t EPNum, uint8_t *pData, uint32_t len) {
+	out_req_buf = pData;
+	out_req_len = len;
+	out_req_got = 0;
+	out_req_queued = true;
+	return len;
+}
+
+/* Data is in place already, only the length is reported. */
+static uint32_t rom_read_ep(USBD_HANDLE_T hUsb, uint32_t EPNum, uint8_t *pData) {
+	return out_req_got;
+}
+
+static ErrorCode_t rom_register_ep_handler(USBD_HANDLE_T hUsb, uint32_t ep_index, USB_EP_HANDLER_T pfn, void *data) {
+	if (ep_index == (((CDC_EP_IN & 0x0F) << 1) + 1)) {
+		ep_in_handler = pfn;
+	}
+	else if (ep_index == ((CDC_EP_OUT & 0x0F) << 1)) {
+		ep_out_handler = pfn;
+	}
+	return LPC_OK;
+}
+
+static ErrorCode_t rom_cdc_init(USBD_HANDLE_T hUsb, USBD_CDC_INIT_PARAM_T *param, USBD_HANDLE_T *phCDC) {
+	line_state_handler = param->SetCtrlLineState;
+	*phCDC = hUsb;
+	return LPC_OK;
+}
+
+static const USBD_HW_API_T rom_hw = {
+	.WriteEP = rom_write_ep,
+	.ReadEP = rom_read_ep,
+	.ReadReqEP = rom_read_req_ep,
+};
+
+static const USBD_CORE_API_T rom_core = {
+	.RegisterEpHandler = rom_register_ep_handler,
+};
+
+static const USBD_CDC_API_T rom_cdc = {
+	.init = rom_cdc_init,
+};
+
+static const USBD_API_T rom_api = {
+	.hw = &rom_hw,
+	.core = &rom_core,
+	.cdc = &rom_cdc,
+};
+
+/* Both CDC interfaces are found, the stand-in ROM never looks at them. */
+USB_INTERFACE_DESCRIPTOR *find_IntfDesc(const uint8_t *pDesc, uint32_t intfClass) {
+	static USB_INTERFACE_DESCRIPTOR intf;
+
+	intf.bInterfaceClass = intfClass;
+	return &intf;
+}
+
+/*****************************************************************************
+ * Stand-in firmware modules
+ ****************************************************************************/
+
+void hid_in_claim(bool claim) {
+	claimed = claim;
+}
+
+uint32_t hid_in_poll(uint8_t *report) {
+	if (!claimed || (in_budget == 0)) {
+		return 0;
+	}
+	in_budget--;
+	numbered_report(report, REPORT_ID_IN, in_seq++, in_report_size);
+	return in_report_size;
+}
+
+void hid_out_report(const uint8_t *report, uint32_t length) {
+	if (!numbered_report_ok(report, length, REPORT_ID_OUT, out_expect)) {
+		out_bad++;
+	}
+	out_expect = get_u32(&report[1]) + 1;
+	out_bytes += length;
+}
+
+bool hid_get_feature(uint8_t *report, uint16_t *plength) {
+	switch (report[0]) {
+	case HID_REPORT_ID_CDC:
+		*plength = 1 + cdc_channel_get_feature(&report[1], HID_REPORT_MAX_SIZE - 1);
+		return true;
+
+	case REPORT_ID_ECHO:
+		memcpy(report, echo, echo_length);
+		*plength = echo_length;
+		return echo_length > 0;
+	}
+	return false;
+}
+
+bool hid_set_feature(const uint8_t *report, uint16_t length) {
+	if ((report[0] != REPORT_ID_ECHO) || (length > HID_REPORT_MAX_SIZE)) {
+		return false;
+	}
+	memcpy(echo, report, length);
+	echo_length = length;
+	return true;
+}
+
+/*****************************************************************************
+ * Bus model
+ ****************************************************************************/
+
+static bool usb_out_packet(void) {
+	uint32_t n;
+
+	if (out_stage_len == 0) {
+		return false;
+	}
+	if (!out_req_queued) {
+		ep_out_handler(NULL, NULL, USB_EVT_OUT_NAK);
+		if (!out_req_queued) {
+			return false;
+		}
+	}
+
+	n = MIN(PACKET_SIZE, out_stage_len);
+	n = MIN(n, out_req_len - out_req_got);
+	memcpy(&out_req_buf[out_req_got], out_stage, n);
+	memmove(out_stage, &out_stage[n], out_stage_len - n);
+	out_stage_len -= n;
+	out_req_got += n;
+	packets++;
+	if ((n < PACKET_SIZE) || (out_req_got == out_req_len)) {
+		out_req_queued = false;
+		ep_out_handler(NULL, NULL, USB_EVT_OUT);
+	}
+	return true;
+}
+
+static bool usb_in_packet(void) {
+	ssize_t n;
+
+	if (!in_active) {
+		return false;
+	}
+	// Host not reading leaves the pty full, the endpoint NAKs.
+	n = write(master, &in_buf[in_sent], MIN(PACKET_SIZE, in_len - in_sent));
+	if (n <= 0) {
+		return false;
+	}
+	in_sent += n;
+	packets++;
+	if (in_sent == in_len) {
+		in_active = false;
+		ep_in_handler(NULL, NULL, USB_EVT_IN);
+	}
+	return true;
+}
+
+/* One frame, main loop kicks the channel between packets. */
+static void usb_frame(void) {
+	ssize_t n;
+	uint32_t slot;
+	bool out_first;
+
+	n = read(master, &out_stage[out_stage_len], sizeof(out_stage) - out_stage_len);
+	if (n > 0) {
+		out_stage_len += n;
+	}
+	for (slot = 0; slot < PACKETS_PER_FRAME; slot++) {
+		out_first = (slot & 1) == 0;
+		if (!(out_first ? usb_out_packet() : usb_in_packet())) {
+			out_first ? usb_in_packet() : usb_out_packet();
+		}
+		cdc_channel_kick();
+	}
+}
+
+/*****************************************************************************
+ * Host end
+ ****************************************************************************/
+
+static void host_frame_handler(void *ctx, uint8_t kind, const uint8_t *report, uint32_t length) {
+	if (kind == CDC_FRAME_INPUT) {
+		if (!numbered_report_ok(report, length, REPORT_ID_IN, host_in_expect)) {
+			host_in_bad++;
+		}
+		host_in_expect = get_u32(&report[1]) + 1;
+		host_in_bytes += length;
+		return;
+	}
+	reply_kind = kind;
+	memcpy(reply, report, length);
+	reply_length = length;
+	reply_ready = true;
+}
+
+static void host_send(uint8_t kind, const uint8_t *report, uint32_t length) {
+	host_tx_len += cdc_frame_encode(kind, host_seq++, report, length, &host_tx[host_tx_len]);
+}
+
+static void host_send_raw(const uint8_t *data, uint32_t length) {
+	memcpy(&host_tx[host_tx_len], data, length);
+	host_tx_len += length;
+}
+
+/* Write what the pty takes, a write ending on a full packet gets an empty frame. */
+static void host_flush(void) {
+	ssize_t n;
+
+	if (host_tx_len == 0) {
+		return;
+	}
+	if (host_pad && ((host_tx_len % PACKET_SIZE) == 0)) {
+		host_tx[host_tx_len++] = 0;
+	}
+	n = write(slave, host_tx, host_tx_len);
+	if (n > 0) {
+		memmove(host_tx, &host_tx[n], host_tx_len - n);
+		host_tx_len -= n;
+	}
+}
+
+static void host_poll(void) {
+	uint8_t buf[STAGE_SIZE];
+	ssize_t n;
+
+	while ((n = read(slave, buf, sizeof(buf))) > 0) {
+		cdc_frame_decode(&host_dec, buf, n, host_frame_handler, NULL);
+	}
+}
+
+/* Host then bus for a number of frames. */
+static void run_frames(uint32_t frames) {
+	while (frames-- > 0) {
+		host_flush();
+		usb_frame();
+		host_poll();
+	}
+}
+
+/* Feature request, false if nothing came back in time. */
+static bool host_request(uint8_t kind, const uint8_t *report, uint32_t length) {
+	uint32_t i;
+
+	reply_ready = false;
+	host_send(kind, report, length);
+	for (i = 0; (i < 20) && !reply_ready; i++) {
+		run_frames(1);
+	}
+	return reply_ready;
+}
+
+static bool host_link_stats(cdc_frame_stats_t *stats) {
+	uint8_t id = HID_REPORT_ID_CDC;
+	uint32_t i, *counters = (uint32_t *) stats;
+
+	if (!host_request(CDC_FRAME_GET_FEATURE, &id, 1) || (reply_kind != CDC_FRAME_FEATURE) ||
+		(reply_length < CDC_CHANNEL_STATUS_SIZE + 1)) {
+		return false;
+	}
+	for (i = 0; i < sizeof(*stats) / sizeof(uint32_t); i++) {
+		counters[i] = get_u32(&reply[17 + (i * 4)]);
+	}
+	return true;
+}
+
+/* Port opened, DTR up. Both ends start over with empty buffers. */
+static void open_port(void) {
+	uint8_t buf[STAGE_SIZE];
+
+	line_state_handler(NULL, 0);
+	cdc_channel_reset();
+	while (read(master, buf, sizeof(buf)) > 0) {}
+	while (read(slave, buf, sizeof(buf)) > 0) {}
+	out_req_queued = false;
+	in_active = false;
+	out_stage_len = 0;
+	host_tx_len = 0;
+	cdc_frame_decoder_init(&host_dec);
+	in_budget = 0;
+	host_in_expect = in_seq;
+	out_expect = 0;
+	host_in_bytes = 0;
+	out_bytes = 0;
+	packets = 0;
+	line_state_handler(NULL, 1);
+}
+
+static bool open_pty(void) {
+	struct termios tio;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0)) {
+		perror("pty");
+		return false;
+	}
+	slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if ((slave < 0) || (tcgetattr(slave, &tio) != 0)) {
+		perror("pty slave");
+		return false;
+	}
+	// Raw mode like custom_cdc.py sets, bytes pass as they are.
+	cfmakeraw(&tio);
+	return tcsetattr(slave, TCSANOW, &tio) == 0;
+}
+
+/*****************************************************************************
+ * Tests
+ ****************************************************************************/
+
+static void test_features(void) {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+	cdc_frame_stats_t stats;
+
+	open_port();
+	check(claimed, "DTR claims input reports");
+	check(host_link_stats(&stats) && (stats.frames == 1) && (stats.errors == 0), "CDC status feature read");
+
+	report[0] = REPORT_ID_ECHO;
+	memset(&report[1], 0xA5, 40);
+	host_send(CDC_FRAME_SET_FEATURE, report, 41);
+	memset(report, 0, sizeof(report));
+	report[0] = REPORT_ID_ECHO;
+	check(host_request(CDC_FRAME_GET_FEATURE, report, 1) && (reply_kind == CDC_FRAME_FEATURE) &&
+		  (reply_length == 41) && (reply[40] == 0xA5), "feature set and read back");
+
+	report[0] = 0x7F;
+	check(host_request(CDC_FRAME_GET_FEATURE, report, 1) && (reply_kind == CDC_FRAME_NAK) &&
+		  (reply_length == 1) && (reply[0] == 0x7F), "unknown feature read refused");
+	check(host_request(CDC_FRAME_SET_FEATURE, report, 8) && (reply_kind == CDC_FRAME_NAK) &&
+		  (reply[0] == 0x7F), "unknown feature write refused");
+
+	line_state_handler(NULL, 0);
+	check(!claimed, "DTR down releases input reports");
+}
+
+static void test_stream_errors(void) {
+	uint8_t report[HID_REPORT_MAX_SIZE], garbage[100];
+	cdc_frame_stats_t stats;
+	uint32_t i;
+
+	open_port();
+	numbered_report(report, REPORT_ID_OUT, 0, 20);
+	host_send(CDC_FRAME_OUTPUT, report, 20);
+
+	// Frames lost on the way, then one repeated.
+	host_seq += 3;
+	numbered_report(report, REPORT_ID_OUT, 1, 20);
+	host_send(CDC_FRAME_OUTPUT, report, 20);
+	host_seq--;
+	host_send(CDC_FRAME_OUTPUT, report, 20);
+
+	// Line noise, decoder picks up at the next delimiter.
+	for (i = 0; i < sizeof(garbage); i++) {
+		garbage[i] = 1 + (rand() % 255);
+	}
+	host_send_raw(garbage, sizeof(garbage));
+	host_send_raw((const uint8_t *) "", 1);
+	numbered_report(report, REPORT_ID_OUT, 2, 20);
+	host_send(CDC_FRAME_OUTPUT, report, 20);
+
+	// One corrupt byte inside a frame.
+	numbered_report(report, REPORT_ID_OUT, 3, 20);
+	host_send(CDC_FRAME_OUTPUT, report, 20);
+	host_tx[host_tx_len - 5] ^= 0x40;
+	numbered_report(report, REPORT_ID_OUT, 3, 20);
+	host_send(CDC_FRAME_OUTPUT, report, 20);
+	run_frames(5);
+
+	check((out_expect == 4) && (out_bad == 0), "frames around errors delivered in order");
+	check(host_link_stats(&stats) && (stats.gaps == 4) && (stats.duplicates == 1) &&
+		  (stats.errors + stats.crc_errors == 2), "gaps, repeats and bad frames counted");
+}
+
+/* Frame of 54 report bytes encodes to exactly one packet. */
+static void test_full_packet(void) {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+
+	open_port();
+	host_pad = false;
+	numbered_report(report, REPORT_ID_OUT, 0, 54);
+	host_send(CDC_FRAME_OUTPUT, report, 54);
+	check(host_tx_len == PACKET_SIZE, "test frame fills one packet");
+	run_frames(20);
+	check(out_expect == 0, "unpadded write on a full packet waits for more data");
+	host_send_raw((const uint8_t *) "", 1);
+	run_frames(2);
+	check(out_expect == 1, "next write completes it");
+
+	host_pad = true;
+	numbered_report(report, REPORT_ID_OUT, 1, 54);
+	host_send(CDC_FRAME_OUTPUT, report, 54);
+	run_frames(2);
+	check(out_expect == 2, "padded write on a full packet arrives");
+
+	in_report_size = 54;
+	in_budget = 1;
+	run_frames(2);
+	check((host_in_bytes == 54) && (in_full_end == 0), "input frame filling a packet sent with padding");
+}
+
+/*****************************************************************************
+ * Benchmarks
+ ****************************************************************************/
+
+static double cpu_seconds(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void count_frame(void *ctx, uint8_t kind, const uint8_t *report, uint32_t length) {
+	(*(uint32_t *) ctx)++;
+}
+
+/* Encode and decode cost on this machine, CRC included. */
+static void bench_cpu(uint32_t length) {
+	static uint8_t stream[1024 * CDC_FRAME_MAX_ENCODED];
+	uint8_t report[CDC_FRAME_MAX_REPORT];
+	cdc_frame_decoder_t dec;
+	uint32_t i, round, pos, decoded = 0;
+	double t0, t_enc = 0, t_dec = 0;
+
+	for (i = 0; i < length; i++) {
+		report[i] = rand();
+	}
+	cdc_frame_decoder_init(&dec);
+	for (round = 0; round < 200; round++) {
+		t0 = cpu_seconds();
+		for (i = 0, pos = 0; i < 1024; i++) {
+			pos += cdc_frame_encode(CDC_FRAME_OUTPUT, (round * 1024) + i, report, length, &stream[pos]);
+		}
+		t_enc += cpu_seconds() - t0;
+		t0 = cpu_seconds();
+		cdc_frame_decode(&dec, stream, pos, count_frame, &decoded);
+		t_dec += cpu_seconds() - t0;
+	}
+	printf("%7u %12.1f %12.1f %14.1f\n", length, t_enc * 1e9 / (200 * 1024), t_dec * 1e9 / (200 * 1024),
+		   (200.0 * 1024 * length) / 1048576.0 / (t_enc + t_dec));
+	check(decoded == 200 * 1024, "every encoded frame decodes");
+}
+
+typedef struct {
+	double out_kbs;
+	double in_kbs;
+	double bus;
+	bool ok;
+} bench_result_t;
+
+/* Output reports from the host and input reports from the firmware, as fast as the channel takes them. */
+static void bench_stream(uint32_t size, bool out, bool in, bench_result_t *r) {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+	uint32_t frame, out_seq = 0, frames = seconds * 1000;
+
+	open_port();
+	in_report_size = size;
+	in_budget = in ? UINT32_MAX : 0;
+	out_bad = 0;
+	host_in_bad = 0;
+	for (frame = 0; frame < frames; frame++) {
+		// Host keeps the tty full like a writer thread blocking on it.
+		while (out && (host_tx_len < STAGE_SIZE)) {
+			numbered_report(report, REPORT_ID_OUT, out_seq++, size);
+			host_send(CDC_FRAME_OUTPUT, report, size);
+		}
+		run_frames(1);
+	}
+	r->out_kbs = out_bytes / 1024.0 / seconds;
+	r->in_kbs = host_in_bytes / 1024.0 / seconds;
+	r->bus = (double) packets / (frames * PACKETS_PER_FRAME);
+	r->ok = (out_bad == 0) && (host_in_bad == 0) && (host_dec.stats.gaps == 0) && (in_full_end == 0);
+	in_budget = 0;
+}
+
+/* Feature reads one after another, frames per round trip. */
+static double bench_ping(void) {
+	uint8_t id = HID_REPORT_ID_CDC;
+	uint32_t i, frames = 0, trips = 200;
+
+	open_port();
+	for (i = 0; i < trips; i++) {
+		reply_ready = false;
+		host_send(CDC_FRAME_GET_FEATURE, &id, 1);
+		while (!reply_ready && (frames < trips * 20)) {
+			run_frames(1);
+			frames++;
+		}
+	}
+	check(frames < trips * 20, "feature round trips answered");
+	return (double) frames / trips;
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t sizes[] = { 8, 16, 32, 64 };
+	uint32_t mem_base, mem_size = USB_MEM_SIZE, i;
+	bench_result_t r;
+	void *mem;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (seconds == 0) {
+		fprintf(stderr, "duration must be non zero\n");
+		return 1;
+	}
+
+	// NVIC and the cycle counter, cdc_channel_kick() masks the USB interrupt.
+	mem = mmap((void *) 0xE0000000UL, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem != (void *) 0xE0000000UL) {
+		fprintf(stderr, "can not map system control space\n");
+		return 1;
+	}
+	// ROM hands out memory as 32 bit addresses.
+	mem = mmap(NULL, USB_MEM_SIZE, PROT_READ | PROT_WRITE,
+#ifdef MAP_32BIT
+			   MAP_32BIT |
+#endif
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((mem == MAP_FAILED) || ((uintptr_t) mem != (uint32_t) (uintptr_t) mem)) {
+		fprintf(stderr, "no memory below 4 GB\n");
+		return 1;
+	}
+	mem_base = (uint32_t) (uintptr_t) mem;
+	if (!open_pty()) {
+		return 1;
+	}
+
+	g_pUsbApi = &rom_api;
+	// Any handle but NULL, cdc_channel_kick() takes NULL as not initialized.
+	if (cdc_channel_init((USBD_HANDLE_T) &rom_api, NULL, &mem_base, &mem_size) != LPC_OK) {
+		fprintf(stderr, "CDC init failed\n");
+		return 1;
+	}
+	srand(1);
+
+	test_features();
+	test_stream_errors();
+	test_full_packet();
+
+	printf("framing on this host, CRC-32C slice-by-8\n");
+	printf(" report  encode ns/f  decode ns/f  report MB/s\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_cpu(sizes[i]);
+	}
+
+	printf("\nfull speed bulk, %u packets per frame, %u s per run\n", PACKETS_PER_FRAME, seconds);
+	printf(" report   OUT KB/s   IN KB/s  both OUT   both IN   bus %%  data\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_stream(sizes[i], true, false, &r);
+		printf("%7u %10.1f", sizes[i], r.out_kbs);
+		check(r.ok, "output reports in order");
+		bench_stream(sizes[i], false, true, &r);
+		printf(" %9.1f", r.in_kbs);
+		check(r.ok, "input reports in order");
+		bench_stream(sizes[i], true, true, &r);
+		printf(" %9.1f %9.1f %7.1f  %s\n", r.out_kbs, r.in_kbs, 100.0 * r.bus, r.ok ? "ok" : "FAILED");
+		check(r.ok, "both directions in order");
+	}
+	printf("\nfeature read round trip %.2f ms\n", bench_ping());
+
+	printf("\ncdc_framing checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
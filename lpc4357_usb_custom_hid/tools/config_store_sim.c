@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test of config_store.c on an emulated EEPROM which counts program
+ * cycles of every physical page and can lose power in the middle of one.
+ *
+ * Checks cover values surviving a reload, a power loss while the spare
+ * copy is programmed leaving the previous copy in charge, and a value
+ * growing onto another page: the page it moved to is programmed first,
+ * a power loss before the page it left is programmed finds the value on
+ * both and keeps the newer one.
+ *
+ * Benchmark sets random keys at a given rate for a while, like the host
+ * tuning settings from the test tool, and prints page writes, wear of
+ * the busiest physical page and the longest change to program latency
+ * for a sweep of flush idle times.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o config_store_sim -I../lpc_chip_43xx/inc -Iinc tools/config_store_sim.c src/config_store.c
+ * $ ./config_store_sim [-s seconds] [-r sets_per_second] [-k keys]
+ */
+
+#include "lpc_types.h"
+#include "config_store.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGES			CONFIG_STORE_MAX_PAGES
+#define PHYS_PAGES		(2 * PAGES)
+#define PROGRAM_US		2800	/* Erase and program of one EEPROM page */
+
+typedef struct {
+	uint8_t data[PHYS_PAGES][CONFIG_STORE_PAGE_SIZE];
+	uint32_t wear[PHYS_PAGES];
+	uint32_t pending;		/* Page being programmed, PHYS_PAGES if none */
+	const uint8_t *image;
+	uint32_t done_at;
+} eeprom_t;
+
+static eeprom_t eeprom;
+static uint32_t failures;
+
+static uint32_t seconds = 600;
+static uint32_t set_rate = 20;
+static uint32_t num_keys = 24;
+
+static bool eeprom_read(void *ctx, uint32_t page, uint8_t *data) {
+	eeprom_t *e = ctx;
+
+	memcpy(data, e->data[page], CONFIG_STORE_PAGE_SIZE);
+	return true;
+}
+
+/* Contents only change when the program completes or power fails. */
+static void eeprom_write(void *ctx, uint32_t page, const uint8_t *data) {
+	eeprom_t *e = ctx;
+
+	e->pending = page;
+	e->image = data;
+}
+
+static const config_media_t eeprom_media = { eeprom_read, eeprom_write, &eeprom };
+
+static void eeprom_reset(void) {
+	memset(&eeprom, 0xFF, sizeof(eeprom.data));
+	memset(eeprom.wear, 0, sizeof(eeprom.wear));
+	eeprom.pending = PHYS_PAGES;
+}
+
+/* Start a write if one is due and finish it. */
+static bool program_one(config_store_t *cs, uint32_t *now, uint32_t idle) {
+	uint32_t page;
+
+	if (!config_store_flush(cs, *now, idle)) {
+		return false;
+	}
+	page = eeprom.pending;
+	*now += PROGRAM_US;
+	memcpy(eeprom.data[page], eeprom.image, CONFIG_STORE_PAGE_SIZE);
+	eeprom.wear[page]++;
+	eeprom.pending = PHYS_PAGES;
+	config_store_write_done(cs, true, *now);
+	return true;
+}
+
+/* Power fails half way through the write just started, page was erased and
+ * half of it programmed. */
+static void power_fail(config_store_t *cs, uint32_t now) {
+	uint32_t page;
+
+	if (!config_store_flush(cs, now, 0)) {
+		return;
+	}
+	page = eeprom.pending;
+	memset(eeprom.data[page], 0xFF, CONFIG_STORE_PAGE_SIZE);
+	memcpy(eeprom.data[page], eeprom.image, CONFIG_STORE_PAGE_SIZE / 2);
+	eeprom.wear[page]++;
+	eeprom.pending = PHYS_PAGES;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static bool has_value(const config_store_t *cs, uint8_t key, const uint8_t *value, uint32_t length) {
+	uint8_t buf[CONFIG_STORE_VALUE_MAX];
+
+	return (config_store_get(cs, key, buf, sizeof(buf)) == length) && (memcmp(buf, value, length) == 0);
+}
+
+static uint32_t key_copies(const config_store_t *cs, uint8_t key) {
+	uint32_t i, offset, count = 0;
+	const config_page_t *page;
+
+	for (i = 0; i < cs->num_pages; i++) {
+		page = &cs->pages[i];
+		for (offset = 0; (offset + 2 <= CONFIG_STORE_PAYLOAD_SIZE) && page->data[offset];
+			 offset += 2 + page->data[offset + 1]) {
+			count += page->data[offset] == key;
+		}
+	}
+	return count;
+}
+
+static void test_reload(void) {
+	config_store_t cs;
+	uint32_t now = 0, i;
+	uint8_t v[4] = { 1, 2, 3, 4 };
+
+	eeprom_reset();
+	config_store_init(&cs, &eeprom_media, PAGES);
+	for (i = 0; i < 50; i++) {
+		v[0] = i;
+		check(config_store_set(&cs, 7, v, sizeof(v), now), "set");
+		now += 1000;
+	}
+	check(cs.stats.coalesced == 49, "burst coalesced");
+	while (program_one(&cs, &now, 0)) {}
+	check(cs.stats.page_writes == 1, "burst costs one page write");
+	check(cs.stats.latency_max == 50000 + PROGRAM_US, "latency from first change");
+
+	config_store_init(&cs, &eeprom_media, PAGES);
+	check(has_value(&cs, 7, v, sizeof(v)), "value after reload");
+}
+
+static void test_power_fail(void) {
+	config_store_t cs;
+	uint32_t now = 0;
+	const uint8_t old_value[3] = { 1, 1, 1 }, new_value[3] = { 2, 2, 2 };
+
+	eeprom_reset();
+	config_store_init(&cs, &eeprom_media, PAGES);
+	config_store_set(&cs, 9, old_value, sizeof(old_value), now);
+	while (program_one(&cs, &now, 0)) {}
+	config_store_set(&cs, 9, new_value, sizeof(new_value), now);
+	while (program_one(&cs, &now, 0)) {}
+
+	// Third write goes to the copy holding the first one.
+	config_store_set(&cs, 9, old_value, sizeof(old_value), now);
+	power_fail(&cs, now);
+	config_store_init(&cs, &eeprom_media, PAGES);
+	check(has_value(&cs, 9, new_value, sizeof(new_value)), "torn write keeps previous copy");
+
+	config_store_set(&cs, 9, old_value, sizeof(old_value), now);
+	while (program_one(&cs, &now, 0)) {}
+	config_store_init(&cs, &eeprom_media, PAGES);
+	check(has_value(&cs, 9, old_value, sizeof(old_value)), "written after torn one");
+}
+
+/* Two 50 byte values fill most of page 0, key 1 growing to 70 moves to page 1.
+ * Key 2 may keep page 0 changing every 100 ms for a while before. */
+static void move_setup(config_store_t *cs, uint32_t *now, uint8_t *small, uint8_t *big, uint32_t before) {
+	uint32_t t;
+
+	memset(small, 0x11, 50);
+	memset(big, 0x22, 70);
+	eeprom_reset();
+	config_store_init(cs, &eeprom_media, PAGES);
+	config_store_set(cs, 1, small, 50, *now);
+	config_store_set(cs, 2, small, 50, *now);
+	while (program_one(cs, now, 0)) {}
+	for (t = 0; t < before; t += 100000) {
+		small[0]++;
+		config_store_set(cs, 2, small, 50, *now);
+		*now += 100000;
+		check(!config_store_flush(cs, *now, 500000), "busy page waits");
+	}
+	*now += 1000;
+	check(config_store_set(cs, 1, big, 70, *now), "grow");
+}
+
+static void test_move(void) {
+	config_store_t cs;
+	uint32_t now = 0, first;
+	uint8_t small[50], big[70];
+
+	move_setup(&cs, &now, small, big, 0);
+	check(cs.pages[1].last_change == now - 1, "new page looks idle first");
+	check(config_store_flush(&cs, now, 0) && (cs.writing == 1), "new page programmed first");
+	first = eeprom.pending;
+	config_store_write_done(&cs, true, now);
+	check(first / 2 == 1, "first write on page 1");
+
+	// Power fails before page 0 drops the old value.
+	memcpy(eeprom.data[first], eeprom.image, CONFIG_STORE_PAGE_SIZE);
+	config_store_init(&cs, &eeprom_media, PAGES);
+	check(has_value(&cs, 1, big, 70) && (key_copies(&cs, 1) == 1), "newer page wins");
+	check(has_value(&cs, 2, small, 50), "other value kept");
+	check(config_store_dirty(&cs) && cs.pages[0].dirty, "stale page rewritten");
+	while (program_one(&cs, &now, 0)) {}
+	config_store_init(&cs, &eeprom_media, PAGES);
+	check(has_value(&cs, 1, big, 70) && (key_copies(&cs, 1) == 1), "settled after rewrite");
+
+	// Power fails while the new page is programmed, old value stays.
+	now = 0;
+	move_setup(&cs, &now, small, big, 0);
+	power_fail(&cs, now);
+	config_store_init(&cs, &eeprom_media, PAGES);
+	check(has_value(&cs, 1, small, 50) && (key_copies(&cs, 1) == 1), "old value after torn move");
+
+	// Page the value left keeps changing, overdue flush still takes the new page first.
+	now = 0;
+	move_setup(&cs, &now, small, big, 1800000);
+	while (!config_store_flush(&cs, now, 500000)) {
+		now += 100000;
+		small[0]++;
+		config_store_set(&cs, 2, small, 50, now);
+	}
+	check((cs.writing == 1) && (now <= 4 * 500000 + 100000), "overdue new page first");
+	config_store_write_done(&cs, true, now);
+}
+
+static void bench(uint32_t idle_us) {
+	config_store_t cs;
+	uint32_t now = 0, next_set = 0, end = seconds * 1000000, i, max_wear = 0, total = 0;
+	uint8_t value[8];
+
+	eeprom_reset();
+	config_store_init(&cs, &eeprom_media, PAGES);
+	srand(1);
+	while (now < end) {
+		if (now >= next_set) {
+			for (i = 0; i < sizeof(value); i++) {
+				value[i] = rand();
+			}
+			config_store_set(&cs, 1 + (rand() % num_keys), value, 1 + (rand() % sizeof(value)), now);
+			next_set += 1000000 / set_rate;
+		}
+		if (!program_one(&cs, &now, idle_us)) {
+			now = MIN(next_set, now + 1000);
+		}
+	}
+	while (program_one(&cs, &now, 0)) {}
+
+	for (i = 0; i < PHYS_PAGES; i++) {
+		max_wear = MAX(max_wear, eeprom.wear[i]);
+		total += eeprom.wear[i];
+	}
+	printf("%8u | %6u %9u %10u %11u %8u %13.1f\n", idle_us / 1000, cs.stats.sets, cs.stats.coalesced,
+		   cs.stats.page_writes, max_wear, total / PHYS_PAGES, cs.stats.latency_max / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t idles_us[] = { 0, 10000, 100000, 500000, 2000000 };
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:r:k:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			set_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			num_keys = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds] [-r sets_per_second] [-k keys]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((seconds == 0) || (set_rate == 0) || (set_rate > 1000) || (num_keys == 0) || (num_keys > 64)) {
+		fprintf(stderr, "seconds must be set, rate 1..1000 sets/s, keys 1..64\n");
+		return 1;
+	}
+
+	test_reload();
+	test_power_fail();
+	test_move();
+	printf("config_store checks: %s\n\n", failures ? "FAILED" : "passed");
+
+	printf("%u s of %u sets/s over %u keys, %u us page program\n\n", seconds, set_rate, num_keys, PROGRAM_US);
+	printf(" idle ms |   sets coalesced page writes  max wear avg wear latency max ms\n");
+	for (i = 0; i < sizeof(idles_us) / sizeof(idles_us[0]); i++) {
+		bench(idles_us[i]);
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+# CRC-32C for host tools, same CRC as crc32c.c
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import ctypes
+import os
+import time
+
+# Must match crc32c.h
+CRC32C_CHECK = 0xE3069283
+_POLY = 0x82F63B78
+
+
+def _make_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ _POLY if crc & 1 else crc >> 1
+        table.append(crc)
+    return table
+
+
+_TABLE = _make_table()
+
+
+def crc32c_table(data, crc=0):
+    """Bytewise table CRC, crc is 0 to start or a previous result to continue."""
+    crc ^= 0xFFFFFFFF
+    for byte in bytes(data):
+        crc = (crc >> 8) ^ _TABLE[(crc ^ byte) & 0xFF]
+    return crc ^ 0xFFFFFFFF
+
+
+def _load_sse42():
+    # Built from crc32c_sse42.c next to this file.
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libcrc32c_sse42.so")
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        return None
+    if not lib.crc32c_sse42_supported():
+        return None
+    lib.crc32c_sse42.restype = ctypes.c_uint32
+    lib.crc32c_sse42.argtypes = (ctypes.c_uint32, ctypes.c_char_p, ctypes.c_size_t)
+    return lib.crc32c_sse42
+
+
+_sse42 = _load_sse42()
+
+if _sse42 is not None:
+    CRC32C_IMPLEMENTATION = "sse4.2"
+
+    def crc32c(data, crc=0):
+        data = bytes(data)
+        return _sse42(crc, data, len(data))
+else:
+    CRC32C_IMPLEMENTATION = "table"
+    crc32c = crc32c_table
+
+
+def benchmark(length=68, seconds=0.5):
+    """Nanoseconds per byte of crc32c() over length byte buffers."""
+    data = bytes(range(256)) * (length // 256 + 1)
+    data = data[:length]
+    rounds = 0
+    began = time.monotonic()
+    while True:
+        for _ in range(100):
+            crc32c(data)
+        rounds += 100
+        elapsed = time.monotonic() - began
+        if elapsed >= seconds:
+            return elapsed * 1e9 / (rounds * length)
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Per byte cost of CRC-32C on the host: bytewise and slice-by-8 tables of
+ * src/crc32c.c as the firmware runs them, and the SSE4.2 instruction of
+ * crc32c_sse42.c. Checks all three agree first. The firmware's own cycle
+ * counts on the M4 are in the CDC feature report, test tool shows them.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o crc32c_bench -I../lpc_chip_43xx/inc -Iinc tools/crc32c_bench.c \
+ *       tools/crc32c_sse42.c src/crc32c.c
+ * $ ./crc32c_bench [-n megabytes]
+ */
+
+#include "lpc_types.h"
+#include "crc32c.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint32_t (*crc_fn_t)(uint32_t crc, const uint8_t *data, size_t length);
+
+int crc32c_sse42_supported(void);
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length);
+
+static uint32_t table_slice8(uint32_t crc, const uint8_t *data, size_t length) {
+	return crc32c(crc, data, length);
+}
+
+static uint32_t table_bytewise(uint32_t crc, const uint8_t *data, size_t length) {
+	return crc32c_bytewise(crc, data, length);
+}
+
+static const struct {
+	const char *name;
+	crc_fn_t fn;
+	bool sse42;
+} impls[] = {
+	{ "bytewise", table_bytewise, false },
+	{ "slice-by-8", table_slice8, false },
+	{ "sse4.2", crc32c_sse42, true },
+};
+
+/* Largest CDC frame without CRC, and a long stream buffer. */
+static const uint32_t lengths[] = { 68, 4096 };
+
+static uint8_t buf[4096];
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t megabytes = 64, i, j, rounds, r, crc;
+	double began, ns;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			megabytes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n megabytes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (megabytes == 0) {
+		fprintf(stderr, "megabytes must be set\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(buf); i++) {
+		buf[i] = rand();
+	}
+	for (i = 0; i < (sizeof(impls) / sizeof(impls[0])); i++) {
+		if (impls[i].sse42 && !crc32c_sse42_supported()) {
+			continue;
+		}
+		if ((impls[i].fn(0, (const uint8_t *) "123456789", 9) != CRC32C_CHECK) ||
+			(impls[i].fn(0, buf + 1, sizeof(buf) - 1) != crc32c_bytewise(0, buf + 1, sizeof(buf) - 1))) {
+			fprintf(stderr, "%s CRC mismatch\n", impls[i].name);
+			return 1;
+		}
+	}
+
+	printf("%u MB per run\n\n", megabytes);
+	printf("%-12s", "");
+	for (j = 0; j < (sizeof(lengths) / sizeof(lengths[0])); j++) {
+		printf("  %4u B ns/byte", lengths[j]);
+	}
+	printf("\n");
+	for (i = 0; i < (sizeof(impls) / sizeof(impls[0])); i++) {
+		printf("%-12s", impls[i].name);
+		if (impls[i].sse42 && !crc32c_sse42_supported()) {
+			printf("  not supported by this CPU\n");
+			continue;
+		}
+		for (j = 0; j < (sizeof(lengths) / sizeof(lengths[0])); j++) {
+			rounds = (megabytes << 20) / lengths[j];
+			crc = 0;
+			began = now_ns();
+			for (r = 0; r < rounds; r++) {
+				// Chained so no run can be skipped.
+				crc = impls[i].fn(crc, buf, lengths[j]);
+			}
+			ns = now_ns() - began;
+			printf("  %15.3f", ns / ((double) rounds * lengths[j]));
+			buf[0] ^= crc;
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * CRC-32C with the SSE4.2 crc32 instruction, eight bytes per instruction,
+ * same CRC as src/crc32c.c. crc32c.py loads it with ctypes and uses a
+ * table in Python when the library is missing or the CPU lacks SSE4.2.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -shared -fPIC -o tools/libcrc32c_sse42.so tools/crc32c_sse42.c
+ */
+
+#include <nmmintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+int crc32c_sse42_supported(void) {
+	return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length) {
+	uint64_t crc64, word;
+
+	crc = ~crc;
+	while ((length > 0) && (((uintptr_t) data & 7) != 0)) {
+		crc = _mm_crc32_u8(crc, *data++);
+		length--;
+	}
+	crc64 = crc;
+	while (length >= 8) {
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		length -= 8;
+	}
+	crc = (uint32_t) crc64;
+	while (length--) {
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	return ~crc;
+}
@@ -0,0 +1,81 @@
+# Slice-by-8 CRC-32C tables for crc32c.c
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import sys
+
+# Must match crc32c.c
+POLY = 0x82F63B78
+
+# Table block of src/crc32c.c, text between these lines inclusive.
+BEGIN = "static const uint32_t table[8][256] = {"
+END = "};"
+PER_LINE = 8
+
+
+def make_tables():
+    """tables[k][b] is the CRC of byte b followed by k zero bytes."""
+    first = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ POLY if crc & 1 else crc >> 1
+        first.append(crc)
+    tables = [first]
+    for _ in range(1, 8):
+        prev = tables[-1]
+        tables.append([(prev[i] >> 8) ^ first[prev[i] & 0xFF] for i in range(256)])
+    return tables
+
+
+def table_source():
+    lines = [BEGIN]
+    for k, table in enumerate(make_tables()):
+        lines.append("\t{{\t/* {0} zero byte{1} */".format(k, "" if k == 1 else "s"))
+        for i in range(0, 256, PER_LINE):
+            lines.append("\t\t" + " ".join("0x{0:08X},".format(v) for v in table[i:i + PER_LINE]))
+        lines.append("\t},")
+    lines.append(END)
+    return "\n".join(lines) + "\n"
+
+
+def check(path):
+    with open(path) as f:
+        text = f.read()
+    start = text.find(BEGIN)
+    end = text.find("\n" + END + "\n", start)
+    return start >= 0 and end >= 0 and text[start:end + len(END) + 2] == table_source()
+
+
+if __name__ == "__main__":
+    if len(sys.argv) == 1:
+        sys.stdout.write(table_source())
+    elif len(sys.argv) == 3 and sys.argv[1] == "--check":
+        ok = check(sys.argv[2])
+        print("{0} table {1}".format(sys.argv[2], "matches" if ok else "is stale, regenerate it"))
+        sys.exit(0 if ok else 1)
+    else:
+        print("Usage: crc32c_table.py [--check SOURCE]\n"
+              "    Prints the table block for src/crc32c.c, or checks SOURCE holds it")
+        sys.exit(1)
@@ -0,0 +1,94 @@
+# Credit based flow control, host side of credit_flow.c
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+_MASK = 0xFFFFFFFF
+
+
+def _after(a, b):
+    """Counters wrap, b is ahead of a if the difference is below half the range."""
+    return 0 < ((b - a) & _MASK) < 0x80000000
+
+
+class CreditReceiver:
+    """Owns a buffer of size bytes, grants the sender a limit of total bytes.
+
+    Same rules as credit_rx_t in credit_flow.h.
+    """
+
+    def __init__(self, size, threshold):
+        self.size = size
+        self.threshold = max(threshold, 1)
+        self.accepted = 0
+        self.consumed = 0
+        self.advertised = 0
+        self.overruns = 0
+
+    def accept(self, count):
+        """Returns bytes within credit, the rest is counted as overrun."""
+        room = self.size - ((self.accepted - self.consumed) & _MASK)
+        if count > room:
+            self.overruns += count - room
+            count = room
+        self.accepted = (self.accepted + count) & _MASK
+        return count
+
+    def consume(self, count):
+        self.consumed = (self.consumed + count) & _MASK
+
+    def update_due(self):
+        limit = (self.consumed + self.size) & _MASK
+        growth = (limit - self.advertised) & _MASK
+        return growth >= self.threshold or (
+            growth >= max(self.threshold // 4, 1) and
+            ((self.advertised - self.accepted) & _MASK) < self.threshold)
+
+    def advertise(self):
+        self.advertised = (self.consumed + self.size) & _MASK
+        return self.advertised
+
+
+class CreditSender:
+    """Sends while total sent is below the last limit heard from receiver.
+
+    Same rules as credit_tx_t in credit_flow.h.
+    """
+
+    def __init__(self):
+        self.sent = 0
+        self.limit = 0
+        self.stalls = 0
+
+    def grant(self, limit):
+        if _after(self.limit, limit):
+            self.limit = limit
+
+    def available(self):
+        return ((self.limit - self.sent) & _MASK) if _after(self.sent, self.limit) else 0
+
+    def sent_bytes(self, count):
+        self.sent = (self.sent + count) & _MASK
+
+    def stall(self):
+        self.stalls += 1
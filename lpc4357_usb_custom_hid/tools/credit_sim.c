@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host simulation of credit_flow.c on a stream like the UART bridge's,
+ * sweeps producer and consumer rate mismatches with and without credits.
+ *
+ * Sender gets one report of up to 57 data bytes per millisecond, like a
+ * full speed interrupt endpoint, receiver one report back per millisecond
+ * for its limit. Both arrive latency ms later. Producer blocks while the
+ * sender's buffer is full, consumer drains the receiver's buffer at its
+ * rate. Without credits the sender sends whatever it has and bytes that
+ * do not fit the receiver's buffer are dropped.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o credit_sim -I../lpc_chip_43xx/inc -Iinc tools/credit_sim.c src/credit_flow.c
+ * $ ./credit_sim [-s seconds] [-b buffer] [-l latency_ms]
+ */
+
+#include "lpc_types.h"
+#include "credit_flow.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPORT_DATA_SIZE	57
+#define MAX_LATENCY_MS		64
+
+typedef struct {
+	uint64_t delivered;		/* Bytes consumed */
+	uint32_t dropped;
+	uint32_t blocked_ms;	/* Milliseconds producer waited for sender's buffer */
+	uint32_t stalls;
+	uint32_t credit_reports;
+	uint32_t max_fill;
+} sim_result_t;
+
+static uint32_t seconds = 10;
+static uint32_t buffer_size = 1024;
+static uint32_t latency_ms = 1;
+
+static const uint32_t producer_rates[] = { 4000, 16000, 32000, 57000 };
+static const uint32_t consumer_rates[] = { 2000, 8000, 16000, 32000, 64000 };
+
+static void simulate(uint32_t producer_bps, uint32_t consumer_bps, bool credits, sim_result_t *result) {
+	uint32_t data_link[MAX_LATENCY_MS], credit_link[MAX_LATENCY_MS];
+	bool credit_sent[MAX_LATENCY_MS];
+	uint32_t ms, slot, count, backlog = 0, fill;
+	uint64_t produce_budget = 0, consume_budget = 0;
+	credit_rx_t rx;
+	credit_tx_t tx;
+
+	memset(result, 0, sizeof(*result));
+	memset(data_link, 0, sizeof(data_link));
+	memset(credit_sent, 0, sizeof(credit_sent));
+	credit_rx_init(&rx, buffer_size, buffer_size / 4);
+	credit_tx_init(&tx);
+
+	for (ms = 0; ms < (seconds * 1000); ms++) {
+		// Reports sent latency_ms ago arrive, their slots are reused below.
+		slot = ms % latency_ms;
+		credit_rx_accept(&rx, data_link[slot]);
+		if (credit_sent[slot]) {
+			credit_tx_grant(&tx, credit_link[slot]);
+		}
+
+		// Rates are bytes per second, budgets carry the fraction to the next millisecond.
+		produce_budget += producer_bps;
+		count = produce_budget / 1000;
+		if (count > (buffer_size - backlog)) {
+			count = buffer_size - backlog;
+			produce_budget = (uint64_t) count * 1000;
+			result->blocked_ms++;
+		}
+		produce_budget -= (uint64_t) count * 1000;
+		backlog += count;
+
+		count = MIN(backlog, REPORT_DATA_SIZE);
+		if (credits && (count > credit_tx_available(&tx))) {
+			credit_tx_stall(&tx);
+			count = credit_tx_available(&tx);
+		}
+		credit_tx_sent(&tx, count);
+		backlog -= count;
+		data_link[slot] = count;
+
+		fill = rx.accepted - rx.consumed;
+		result->max_fill = MAX(result->max_fill, fill);
+		consume_budget = MIN(consume_budget + consumer_bps, MAX(consumer_bps, 1000));
+		count = MIN(consume_budget / 1000, fill);
+		consume_budget -= (uint64_t) count * 1000;
+		credit_rx_consume(&rx, count);
+		result->delivered += count;
+
+		credit_sent[slot] = credits && credit_rx_update_due(&rx);
+		if (credit_sent[slot]) {
+			credit_link[slot] = credit_rx_advertise(&rx);
+			result->credit_reports++;
+		}
+	}
+	result->dropped = rx.overruns;
+	result->stalls = tx.stalls;
+}
+
+int main(int argc, char *argv[]) {
+	sim_result_t plain, credited;
+	uint32_t i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:b:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buffer_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds] [-b buffer] [-l latency_ms]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((seconds == 0) || (buffer_size < REPORT_DATA_SIZE) || (latency_ms == 0) ||
+		(latency_ms > MAX_LATENCY_MS)) {
+		fprintf(stderr, "seconds and latency 1..%u ms must be set, buffer at least %u bytes\n",
+				MAX_LATENCY_MS, REPORT_DATA_SIZE);
+		return 1;
+	}
+
+	printf("%u s, %u byte buffers, %u ms latency\n\n", seconds, buffer_size, latency_ms);
+	printf("producer consumer |  no credits B/s  dropped |    credits B/s  dropped  blocked  stalls"
+		   "  credit/s  max fill\n");
+	for (i = 0; i < (sizeof(producer_rates) / sizeof(producer_rates[0])); i++) {
+		for (j = 0; j < (sizeof(consumer_rates) / sizeof(consumer_rates[0])); j++) {
+			simulate(producer_rates[i], consumer_rates[j], false, &plain);
+			simulate(producer_rates[i], consumer_rates[j], true, &credited);
+			printf("%8u %8u | %15llu %8u | %14llu %8u %7.1f%% %7u %9u %9u\n",
+				   producer_rates[i], consumer_rates[j],
+				   (unsigned long long) (plain.delivered / seconds), plain.dropped,
+				   (unsigned long long) (credited.delivered / seconds), credited.dropped,
+				   100.0 * credited.blocked_ms / (seconds * 1000), credited.stalls,
+				   credited.credit_reports / seconds, credited.max_fill);
+		}
+	}
+	return 0;
+}
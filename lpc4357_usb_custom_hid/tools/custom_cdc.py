@@ -0,0 +1,232 @@
+# Same interface as CustomHID over the CDC-ACM serial port.
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+
+import os
+import queue
+import select
+import struct
+import termios
+import threading
+import tty
+
+from crc32c import crc32c, benchmark as crc32c_benchmark, CRC32C_IMPLEMENTATION
+from custom_hid import CustomHID, HID_REPORT_MAX_SIZE
+
+# Frame kinds, see cdc_framing.h
+CDC_FRAME_OUTPUT = 0
+CDC_FRAME_SET_FEATURE = 1
+CDC_FRAME_GET_FEATURE = 2
+CDC_FRAME_INPUT = 3
+CDC_FRAME_FEATURE = 4
+CDC_FRAME_NAK = 5
+_CDC_FRAME_HEADER = "<BHB"
+_CDC_FRAME_HEADER_SIZE = 4
+_CDC_FRAME_CRC_SIZE = 4
+CDC_FRAME_STATS_FIELDS = ("frames", "errors", "crc_errors", "gaps", "duplicates")
+HID_REPORT_ID_CDC = 0x10
+CDC_BULK_PACKET_SIZE = 64
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for byte in data:
+        if byte == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+        else:
+            block.append(byte)
+            if len(block) == 254:
+                out += bytes([255]) + block
+                block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("bad COBS frame")
+        out += data[i + 1:i + code]
+        i += code
+        if code != 255 and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def pack_cdc_frame(kind, seq, report):
+    frame = struct.pack(_CDC_FRAME_HEADER, kind, seq & 0xFFFF, len(report)) + bytes(report)
+    return cobs_encode(frame + struct.pack("<I", crc32c(frame))) + b"\0"
+
+
+class FrameChecker:
+    """Length, CRC and sequence checks of received frames, as cdc_framing.c.
+
+    check() returns (kind, report) of a good frame, None for a frame to
+    drop. Frames lost on the way show up as gaps, repeated or older ones
+    are dropped as duplicates.
+    """
+
+    def __init__(self):
+        self.stats = dict.fromkeys(CDC_FRAME_STATS_FIELDS, 0)
+        self._next_seq = None
+
+    def check(self, frame):
+        size = len(frame) - _CDC_FRAME_CRC_SIZE
+        if size < _CDC_FRAME_HEADER_SIZE or frame[3] != size - _CDC_FRAME_HEADER_SIZE:
+            self.stats["errors"] += 1
+            return None
+        if crc32c(frame[:size]) != struct.unpack_from("<I", frame, size)[0]:
+            self.stats["crc_errors"] += 1
+            return None
+        kind, seq, _ = struct.unpack_from(_CDC_FRAME_HEADER, frame)
+        if self._next_seq is not None:
+            # Sequence wraps, a frame up to half the range ahead is newer.
+            ahead = (seq - self._next_seq) & 0xFFFF
+            if ahead >= 0x8000:
+                self.stats["duplicates"] += 1
+                return None
+            self.stats["gaps"] += ahead
+        self._next_seq = (seq + 1) & 0xFFFF
+        self.stats["frames"] += 1
+        return kind, frame[_CDC_FRAME_HEADER_SIZE:size]
+
+
+class _FrameEndpoint:
+    # Stands in for the HID interrupt OUT endpoint.
+    def __init__(self, cdc):
+        self.cdc = cdc
+
+    def write(self, report):
+        self.cdc._send(CDC_FRAME_OUTPUT, report)
+
+
+class CustomCDC(CustomHID):
+    def __init__(self, port):
+        self.port = port
+        self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+        # Raw mode, opening the port raised DTR which routes input reports here.
+        tty.setraw(self.fd)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        print("")
+        print("CDC port {0} opened".format(port))
+
+        self.ep_out = _FrameEndpoint(self)
+        self._tx_lock = threading.Lock()
+        self._tx_seq = 0
+        self.frame_checker = FrameChecker()
+        self._feature_lock = threading.Lock()
+        self._feature_replies = queue.Queue()
+        self._init_state()
+        self.close_thread = False
+        self.poll_th = threading.Thread(target=self._poll_port)
+        self.poll_th.start()
+
+    def _send(self, kind, report):
+        with self._tx_lock:
+            frame = pack_cdc_frame(kind, self._tx_seq, report)
+            self._tx_seq += 1
+            # Without a ZLP a write ending on a full bulk packet waits for
+            # more data, an empty frame ends it like cdc_channel.c does.
+            if len(frame) % CDC_BULK_PACKET_SIZE == 0:
+                frame += b"\0"
+            while frame:
+                frame = frame[os.write(self.fd, frame):]
+
+    def _poll_port(self):
+        pending = b""
+        while self.close_thread == False:
+            try:
+                ready, _, _ = select.select([self.fd], [], [], 1.0)
+                if not ready:
+                    continue
+                pending += os.read(self.fd, 4096)
+                *frames, pending = pending.split(b"\0")
+                for frame in frames:
+                    if len(frame) > 0:
+                        try:
+                            frame = cobs_decode(frame)
+                        except ValueError:
+                            self.frame_checker.stats["errors"] += 1
+                            continue
+                        self._handle_frame(frame)
+            except ValueError:
+                # Resynchronizes at the next delimiter.
+                pass
+            except Exception as e:
+                print(e)
+                print("aborting CDC polling")
+                return
+
+    def _handle_frame(self, frame):
+        checked = self.frame_checker.check(frame)
+        if checked is None:
+            return
+        kind, report = checked
+        if kind == CDC_FRAME_INPUT:
+            self._handle_in_report(report)
+        elif kind in (CDC_FRAME_FEATURE, CDC_FRAME_NAK):
+            if self._feature_lock.locked():
+                self._feature_replies.put((kind, report))
+            elif kind == CDC_FRAME_NAK and len(report) > 0:
+                print("\nFeature report {0} refused".format(report[0]))
+
+    def _set_feature(self, report_id, payload):
+        # Refusal comes back as a NAK frame, reported by the polling thread.
+        self._send(CDC_FRAME_SET_FEATURE, bytes([report_id]) + bytes(payload))
+
+    def _get_feature(self, report_id, length, timeout=1.0):
+        with self._feature_lock:
+            self._send(CDC_FRAME_GET_FEATURE, [report_id])
+            while True:
+                try:
+                    kind, report = self._feature_replies.get(timeout=timeout)
+                except queue.Empty:
+                    raise Exception("Feature report {0} timed out".format(report_id))
+                if len(report) == 0 or report[0] != report_id:
+                    continue
+                if kind == CDC_FRAME_NAK:
+                    raise Exception("Feature report {0} refused".format(report_id))
+                return report[:length]
+
+    def get_link_status(self):
+        """Frame checks on both ends and CRC cost of each."""
+        fields = struct.unpack_from("<{0}I".format(4 + len(CDC_FRAME_STATS_FIELDS)),
+                                    bytes(self._get_feature(HID_REPORT_ID_CDC, HID_REPORT_MAX_SIZE)), 1)
+        crc_bytes, crc_cycles, bytewise_cycles, tx_frames = fields[:4]
+        return dict(device=dict(sent=tx_frames, received=dict(zip(CDC_FRAME_STATS_FIELDS, fields[4:])),
+                                crc_cycles_per_byte=crc_cycles / crc_bytes,
+                                bytewise_cycles_per_byte=bytewise_cycles / crc_bytes),
+                    host=dict(sent=self._tx_seq, received=dict(self.frame_checker.stats),
+                              crc=CRC32C_IMPLEMENTATION, crc_ns_per_byte=crc32c_benchmark()))
+
+    def close(self):
+        self.close_thread = True
+        self.poll_th.join()
+        os.close(self.fd)
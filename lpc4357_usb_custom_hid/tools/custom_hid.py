@@ -26,10 +26,18 @@
 import usb.core
 import usb.util
 
+import os
+import struct
 import threading
+import time
+
+from report_crypt import ReportCrypt, REPORT_CRYPT_IN, REPORT_CRYPT_OUT
+from credit_flow import CreditReceiver, CreditSender
 
 _USB_HID_CLASS_CTRL_bmRequestType = 0x21
 _USB_HID_CLASS_CTRL_bRequest_SET_REPORT = 0x09
+_USB_HID_CLASS_CTRL_bmRequestType_IN = 0xA1
+_USB_HID_CLASS_CTRL_bRequest_GET_REPORT = 0x01
 _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_INPUT = 0x01 << 8
 _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_OUTPUT = 0x02 << 8
 _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_FEATURE = 0x03 << 8
@@ -43,6 +51,257 @@ _USB_HID_CLASS_REPORT_DESCRIPTOR_TYPE = 0x22
 _BLINK_RATE_MAX = 20
 _BLINK_RATE_MIN = 1
 
+# Report IDs and sizes, must match hid_generic.h
+HID_REPORT_ID_LED = 0x01
+HID_REPORT_ID_EVENTS = 0x02
+HID_REPORT_ID_PWM_SEQ = 0x03
+HID_REPORT_ID_UART = 0x04
+HID_REPORT_ID_CAN = 0x05
+HID_REPORT_ID_AUDIO = 0x06
+HID_REPORT_ID_RECORDER = 0x07
+HID_REPORT_ID_MSC = 0x08
+HID_REPORT_ID_CRYPT = 0x09
+HID_REPORT_ID_SETTINGS = 0x0A
+HID_REPORT_ID_POWER = 0x0B
+HID_REPORT_ID_BOOT = 0x0C
+HID_REPORT_ID_LOGIC = 0x0D
+HID_REPORT_ID_RPC = 0x0E
+HID_REPORT_ID_BATCH = 0x0F
+HID_REPORT_MAX_SIZE = 64
+
+EVENT_CHANNEL_SW2 = 0
+_EVENT_RECORD_SIZE = 5
+_EVENT_RECORD_FLAG_RISE = 0x80
+_EVENT_RECORD_CHANNEL_MASK = 0x0F
+
+# PWM sequencer, must match pwm_sequencer.h and pwm_sequence.h
+PWM_SEQ_MAX_STEPS = 64
+PWM_DUTY_MAX = 1000
+PWM_SEQ_STATES = ("idle", "running", "done")
+_PWM_SEQ_CMD_BEGIN = 0
+_PWM_SEQ_CMD_STEPS = 1
+_PWM_SEQ_CMD_START = 2
+_PWM_SEQ_CMD_STOP = 3
+_PWM_SEQ_FLAG_LOOP = 0x01
+_PWM_SEQ_STEPS_PER_REPORT = 2
+
+# UART bridge, must match uart_bridge.h
+UART_BRIDGE_NUM_CHANNELS = 2
+_UART_REPORT_HEADER = "<BBBI"
+_UART_REPORT_HEADER_SIZE = struct.calcsize(_UART_REPORT_HEADER)
+UART_BRIDGE_REPORT_DATA_SIZE = HID_REPORT_MAX_SIZE - _UART_REPORT_HEADER_SIZE
+# Received bytes host takes before the device has to wait for credit
+UART_HOST_RX_BUFFER = 4096
+UART_BRIDGE_STATS_FIELDS = ("rx_bytes", "tx_bytes", "rx_reports", "tx_reports",
+                            "rx_overflow", "tx_dropped", "line_errors")
+
+# CAN gateway, must match can_codec.h and can_gateway.h
+CAN_ID_FLAG_EXT = 1 << 31
+CAN_ID_FLAG_RTR = 1 << 30
+CAN_MODE_SILENT = 0x01
+CAN_MODE_LOOPBACK = 0x02
+_CAN_CMD_START = 0
+_CAN_CMD_STOP = 1
+_CAN_CMD_FILTER_CLEAR = 2
+_CAN_CMD_FILTER_ADD = 3
+_CAN_CMD_FILTER_APPLY = 4
+_CAN_FILTERS_PER_REPORT = 7
+CAN_STATUS_FIELDS = ("rx_frames", "rx_overflow", "tx_frames", "tx_overflow", "tx_malformed",
+                     "rx_filtered", "rx_hw_lost", "tx_done", "bus_errors", "bus_off")
+
+# Audio stream, must match audio_stream.h and audio_packetizer.h
+AUDIO_STREAM_CAPTURE = 0x01
+AUDIO_STREAM_PLAYBACK = 0x02
+AUDIO_FLAG_DISCONTINUITY = 0x01
+_AUDIO_PACKET_HEADER = "<HBB"
+_AUDIO_PACKET_SIZE = HID_REPORT_MAX_SIZE - 1
+AUDIO_STATS_FIELDS = ("overruns", "underruns", "slips", "packets", "lost_packets")
+
+# SD recorder, must match sd_recorder.h and rec_container.h
+_SD_CMD_MOUNT = 0
+_SD_CMD_FORMAT = 1
+_SD_CMD_START = 2
+_SD_CMD_STOP = 3
+_SD_CMD_READ = 4
+_SD_CMD_READ_STOP = 5
+_SD_CMD_SELECT = 6
+_SD_FORMAT_MAGIC = 0x43455248
+_SD_COMMAND_BUSY = 0xFF
+SD_RECORDER_STATES = ("no card", "unformatted", "idle", "recording", "reading")
+SD_RECORDER_WRITE_DATA_SIZE = HID_REPORT_MAX_SIZE - 2
+SD_RECORDER_STATS_FIELDS = ("bytes", "dropped", "batches", "write_errors", "read_errors")
+
+# Mass storage, must match msc_disk.h and block_cache.h
+MSC_MEDIA_RAM = 0
+MSC_MEDIA_SPIFI = 1
+MSC_MEDIA_NAMES = ("ram", "spifi")
+_MSC_CMD_SELECT = 0
+_MSC_CMD_SYNC = 1
+# Encrypted reports, see hid_crypt.h
+_CRYPT_CMD_KEY = 0
+_CRYPT_CMD_START = 1
+_CRYPT_CMD_STOP = 2
+CRYPT_ENGINES = ("software", "aes")
+CRYPT_STATS_FIELDS = ("reports", "prefetched", "waited", "computed", "clear")
+
+# Saved settings, see settings.h
+_SETTINGS_CMD_SYNC = 0
+_SETTINGS_CMD_CLEAR = 1
+SETTINGS_STATS_FIELDS = ("sets", "unchanged", "coalesced", "page_writes", "errors", "latency_max_us")
+
+POWER_STATS_FIELDS = ("suspends", "resumes", "wakeups", "wakeup_latency_us", "resume_latency_us",
+                      "resume_latency_max_us")
+
+# Boot stages, must match boot_stages.h and init_stages.h
+BOOT_STAGE_NAMES = ("sdram", "spifi", "eth_phy")
+BOOT_STAGE_STATES = ("waiting", "running", "done", "failed")
+
+# Logic capture, must match logic_capture.h and logic_rle.h
+LOGIC_STATES = ("idle", "armed", "triggered", "done")
+LOGIC_CHUNK_FIRST = 0x01
+LOGIC_CHUNK_END = 0x02
+LOGIC_STATS_FIELDS = ("samples", "runs", "bytes", "chunks", "gaps", "dropped")
+
+MSC_CACHE_STATS_FIELDS = ("read_hits", "read_direct", "read_misses", "write_hits", "write_allocs",
+                          "fills", "write_backs", "errors")
+
+
+class _CryptEndpoint:
+    # Encrypts output reports on their way to the real endpoint, in the
+    # order they are sent.
+    def __init__(self, hid, ep_out):
+        self.hid = hid
+        self.ep_out = ep_out
+        self._lock = threading.Lock()
+
+    def write(self, report):
+        with self._lock:
+            crypt = self.hid._crypt
+            if crypt is not None:
+                report = crypt.apply(REPORT_CRYPT_OUT, report)
+            return self.ep_out.write(report)
+
+
+def parse_audio_packet(payload, channels):
+    """Decode audio input report payload (report ID stripped).
+
+    Returns (seq, flags, samples), samples is a flat list of signed 16 bit
+    values, interleaved left/right for stereo streams.
+    """
+    seq, frames, flags = struct.unpack_from(_AUDIO_PACKET_HEADER, bytes(payload), 0)
+    count = min(frames * channels, (len(payload) - 4) // 2)
+    return seq, flags, list(struct.unpack_from("<{0}h".format(count), bytes(payload), 4))
+
+
+def pack_audio_packets(samples, channels, seq=0):
+    """Pack interleaved 16 bit samples into output report payloads."""
+    frames_per_packet = (_AUDIO_PACKET_SIZE - 4) // (2 * channels)
+    step = frames_per_packet * channels
+    reports = []
+    for first in range(0, len(samples) - len(samples) % channels, step):
+        chunk = samples[first:first + step]
+        chunk = chunk[:len(chunk) - len(chunk) % channels]
+        reports.append(struct.pack(_AUDIO_PACKET_HEADER, seq & 0xFFFF, len(chunk) // channels, 0) +
+                       struct.pack("<{0}h".format(len(chunk)), *chunk))
+        seq += 1
+    return reports, seq & 0xFFFF
+
+
+def parse_can_report(payload):
+    """Decode CAN input report payload (report ID stripped).
+
+    Returns (frames, lost) where frames is a list of
+    (timestamp_us, id, dlc, data) tuples, id includes CAN_ID_FLAG_* bits.
+    """
+    count = payload[0]
+    lost = payload[1]
+    frames = []
+    offset = 2
+    for _ in range(count):
+        ts, can_id, dlc = struct.unpack_from("<IIB", payload, offset)
+        length = 0 if can_id & CAN_ID_FLAG_RTR else min(dlc, 8)
+        frames.append((ts, can_id, dlc, bytes(payload[offset + 9:offset + 9 + length])))
+        offset += 9 + length
+    return frames, lost
+
+
+def pack_can_frames(frames):
+    """Pack (id, data) tuples into output report payloads, as many per report as fit."""
+    reports = []
+    records = []
+    size = 1
+    for can_id, data in frames:
+        record = struct.pack("<IB", can_id, len(data)) + bytes(data)
+        if size + len(record) > HID_REPORT_MAX_SIZE - 1:
+            reports.append(bytes([len(records)]) + b"".join(records))
+            records = []
+            size = 1
+        records.append(record)
+        size += len(record)
+    if records:
+        reports.append(bytes([len(records)]) + b"".join(records))
+    return reports
+
+
+def pack_pwm_step(mcpwm, sct):
+    """Pack one sequencer step.
+
+    mcpwm is a list of 3 (period_us, duty) tuples for MCPWM channels 0..2,
+    sct is (period_us, [duty0, duty1, duty2]) for SCT outputs 0..2.
+    Duty is in 1/1000 of period.
+    """
+    data = b"".join(struct.pack("<IH", period, duty) for period, duty in mcpwm)
+    return data + struct.pack("<I3H", sct[0], *sct[1])
+
+
+def parse_event_report(payload):
+    """Decode event capture report payload (report ID stripped).
+
+    Returns (events, lost) where events is a list of
+    (channel, rising, timestamp_us) tuples.
+    """
+    count = payload[0]
+    lost = payload[1]
+    events = []
+    offset = 2
+    for _ in range(count):
+        flags, ts = struct.unpack_from("<BI", payload, offset)
+        events.append((flags & _EVENT_RECORD_CHANNEL_MASK,
+                       bool(flags & _EVENT_RECORD_FLAG_RISE), ts))
+        offset += _EVENT_RECORD_SIZE
+    return events, lost
+
+
+def _read_varint(stream, offset):
+    value = shift = 0
+    while True:
+        byte = stream[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, offset
+
+
+def decode_logic_runs(stream):
+    """Decode concatenated logic capture chunk payloads.
+
+    Returns a list of (value, length, gap) tuples. Gap entries keep the
+    value from before the gap, length is the number of samples lost.
+    """
+    runs = []
+    offset = 0
+    while offset < len(stream):
+        value = stream[offset]
+        length, offset = _read_varint(stream, offset + 1)
+        if length == 0:
+            length, offset = _read_varint(stream, offset)
+            runs.append((value, length, True))
+        else:
+            runs.append((value, length, False))
+    return runs
+
+
 class CustomHID:
     def __init__(self, vendor_id, product_id):
         self.device = usb.core.find(idVendor=vendor_id, idProduct=product_id)
@@ -57,7 +316,7 @@ class CustomHID:
             cfg = self.device[0]
             cfg.set()
     
-        # There is only one interface for this device.
+        # HID is interface 0, mass storage or CDC interfaces are left to the OS.
         intf = cfg[(0,0)]
         
         self.interface_number = intf.bInterfaceNumber
@@ -76,16 +335,40 @@ class CustomHID:
         self.ep_in = intf[0]
         self.ep_out = intf[1]    
             
+        self._init_state()
         self.close_thread = False
         self.poll_th = threading.Thread(target=self._poll_ep_in)
         self.poll_th.start()
+
+    def _init_state(self):
         self.led5_state = 0
+        self.uart_rx_callback = None
+        self._uart_credit = threading.Condition()
+        self._uart_write_lock = threading.Lock()
+        self._uart_tx = [CreditSender() for _ in range(UART_BRIDGE_NUM_CHANNELS)]
+        self._uart_rx = [CreditReceiver(UART_HOST_RX_BUFFER, UART_HOST_RX_BUFFER // 4)
+                         for _ in range(UART_BRIDGE_NUM_CHANNELS)]
+        self.can_rx_callback = None
+        self.audio_rx_callback = None
+        self.audio_channels = 2
+        self._audio_seq = 0
+        self.recorder_rx_callback = None
+        self.rpc_rx_callback = None
+        self._readback = None
+        self._readback_start = 0
+        self._readback_end = 0
+        self._readback_done = threading.Event()
+        self._logic_stream = None
+        self._logic_seq = 0
+        self._logic_done = threading.Event()
+        self._crypt = None
+        self.ep_out = _CryptEndpoint(self, self.ep_out)
         
     def _poll_ep_in(self):
         while self.close_thread == False:
             try:
-                self.ep_in.read(1, 1000)
-                print("\n\n***\nInterrupt IN Endpoint: SW2 switch pressed.\n***")
+                report = self.ep_in.read(HID_REPORT_MAX_SIZE, 1000)
+                self._handle_in_report(report)
             except usb.core.USBError as e:
                 if "timed out" in str(e):
                     pass
@@ -97,17 +380,418 @@ class CustomHID:
                 print(e)
                 return
 
+    def _handle_in_report(self, report):
+        if len(report) == 0:
+            return
+        if self._crypt is not None:
+            report = self._crypt.apply(REPORT_CRYPT_IN, report)
+        if report[0] == HID_REPORT_ID_EVENTS:
+            events, lost = parse_event_report(report[1:])
+            if lost:
+                print("\n{0} events lost".format(lost))
+            for channel, rising, ts in events:
+                if channel == EVENT_CHANNEL_SW2 and not rising:
+                    print("\n\n***\nInterrupt IN Endpoint: SW2 switch pressed at {0} us.\n***".format(ts))
+                else:
+                    print("\nChannel {0} {1} edge at {2} us".format(
+                        channel, "rising" if rising else "falling", ts))
+        elif report[0] == HID_REPORT_ID_UART:
+            _, channel, length, limit = struct.unpack_from(_UART_REPORT_HEADER, bytes(report))
+            if channel >= UART_BRIDGE_NUM_CHANNELS:
+                return
+            with self._uart_credit:
+                self._uart_tx[channel].grant(limit)
+                self._uart_rx[channel].accept(length)
+                self._uart_credit.notify_all()
+            if length == 0:
+                return
+            data = bytes(report[_UART_REPORT_HEADER_SIZE:_UART_REPORT_HEADER_SIZE + length])
+            if self.uart_rx_callback is not None:
+                self.uart_rx_callback(channel, data)
+            else:
+                print("\nUART {0}: {1}".format(channel, data))
+            # Room is back once the data was handed over.
+            with self._uart_credit:
+                self._uart_rx[channel].consume(length)
+                due = self._uart_rx[channel].update_due()
+            if due:
+                self._uart_send(channel, b"")
+        elif report[0] == HID_REPORT_ID_CAN:
+            frames, lost = parse_can_report(report[1:])
+            if self.can_rx_callback is not None:
+                self.can_rx_callback(frames, lost)
+                return
+            if lost:
+                print("\n{0} CAN frames lost".format(lost))
+            for ts, can_id, dlc, data in frames:
+                print("\nCAN {0:>10} us {1:08X} [{2}] {3}".format(ts, can_id, dlc, data.hex()))
+        elif report[0] == HID_REPORT_ID_RECORDER:
+            offset, length = struct.unpack_from("<IB", bytes(report), 1)
+            data = bytes(report[6:6 + length])
+            if self.recorder_rx_callback is not None:
+                self.recorder_rx_callback(offset, data)
+            elif self._readback is not None and offset == self._readback_start + len(self._readback):
+                self._readback += data
+                if self._readback_start + len(self._readback) >= self._readback_end:
+                    self._readback_done.set()
+        elif report[0] == HID_REPORT_ID_AUDIO:
+            if self.audio_rx_callback is not None:
+                self.audio_rx_callback(*parse_audio_packet(report[1:], self.audio_channels))
+        elif report[0] == HID_REPORT_ID_LOGIC:
+            seq, flags, length = struct.unpack_from("<HBB", bytes(report), 1)
+            if self._logic_stream is None:
+                return
+            if seq != self._logic_seq:
+                print("\nLogic capture chunk {0} lost".format(self._logic_seq))
+            self._logic_seq = (seq + 1) & 0xFFFF
+            self._logic_stream += bytes(report[5:5 + length])
+            if flags & LOGIC_CHUNK_END:
+                self._logic_done.set()
+        elif report[0] == HID_REPORT_ID_RPC:
+            if self.rpc_rx_callback is not None:
+                self.rpc_rx_callback(report)
+
+    def _set_feature(self, report_id, payload):
+        self.device.ctrl_transfer(_USB_HID_CLASS_CTRL_bmRequestType,
+                            _USB_HID_CLASS_CTRL_bRequest_SET_REPORT,
+                            _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_FEATURE | report_id,
+                            self.interface_number,
+                            bytes([report_id]) + bytes(payload))
+
+    def _get_feature(self, report_id, length):
+        return self.device.ctrl_transfer(_USB_HID_CLASS_CTRL_bmRequestType_IN,
+                            _USB_HID_CLASS_CTRL_bRequest_GET_REPORT,
+                            _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_FEATURE | report_id,
+                            self.interface_number,
+                            length)
+
     def toggle_led5(self):
         self.led5_state = self.led5_state ^ 1
-        self.ep_out.write([self.led5_state])
+        self.ep_out.write([HID_REPORT_ID_LED, self.led5_state])
     
     def set_led4_blink_rate(self, rate_hz):
-        self.device.ctrl_transfer(_USB_HID_CLASS_CTRL_bmRequestType,
-                            _USB_HID_CLASS_CTRL_bRequest_SET_REPORT,
-                            _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_FEATURE,
-                            self.interface_number,
-                            bytes([rate_hz]))
+        self._set_feature(HID_REPORT_ID_LED, [rate_hz])
+
+    def set_event_debounce(self, channel, debounce_ms):
+        self._set_feature(HID_REPORT_ID_EVENTS, struct.pack("<BH", channel, debounce_ms))
+
+    def upload_pwm_sequence(self, steps, step_ms, loop=True):
+        """Upload steps packed with pack_pwm_step(), sequence is not started."""
+        if not 0 < len(steps) <= PWM_SEQ_MAX_STEPS:
+            raise ValueError("1 to {0} steps supported".format(PWM_SEQ_MAX_STEPS))
+        flags = _PWM_SEQ_FLAG_LOOP if loop else 0
+        self._set_feature(HID_REPORT_ID_PWM_SEQ,
+                          struct.pack("<BHHB", _PWM_SEQ_CMD_BEGIN, len(steps), step_ms, flags))
+        for first in range(0, len(steps), _PWM_SEQ_STEPS_PER_REPORT):
+            chunk = steps[first:first + _PWM_SEQ_STEPS_PER_REPORT]
+            self._set_feature(HID_REPORT_ID_PWM_SEQ,
+                              struct.pack("<BHB", _PWM_SEQ_CMD_STEPS, first, len(chunk)) + b"".join(chunk))
+
+    def start_pwm_sequence(self):
+        self._set_feature(HID_REPORT_ID_PWM_SEQ, [_PWM_SEQ_CMD_START])
+
+    def stop_pwm_sequence(self):
+        self._set_feature(HID_REPORT_ID_PWM_SEQ, [_PWM_SEQ_CMD_STOP])
+
+    def get_pwm_sequence_status(self):
+        """Returns (state, num_steps, current_step, step_ms)."""
+        report = self._get_feature(HID_REPORT_ID_PWM_SEQ, HID_REPORT_MAX_SIZE)
+        state, num_steps, step, step_ms = struct.unpack_from("<BHHH", bytes(report), 1)
+        return PWM_SEQ_STATES[state], num_steps, step, step_ms
     
+    def open_uart(self, channel, baud, flush_us=2000):
+        # Both ends count from zero again, device grants TX credit in its first report.
+        with self._uart_credit:
+            self._uart_tx[channel] = CreditSender()
+            self._uart_rx[channel] = CreditReceiver(UART_HOST_RX_BUFFER, UART_HOST_RX_BUFFER // 4)
+        self._set_feature(HID_REPORT_ID_UART, struct.pack("<BBIH", channel, 1, baud, flush_us))
+        self._uart_send(channel, b"")
+
+    def close_uart(self, channel):
+        self._set_feature(HID_REPORT_ID_UART, struct.pack("<BBIH", channel, 0, 0, 0))
+
+    def _uart_send(self, channel, chunk):
+        # Limit and write in one go, a later limit must not go out before an earlier one.
+        with self._uart_write_lock:
+            with self._uart_credit:
+                limit = self._uart_rx[channel].advertise()
+            self.ep_out.write(struct.pack(_UART_REPORT_HEADER, HID_REPORT_ID_UART, channel,
+                                          len(chunk), limit) + chunk)
+
+    def uart_write(self, channel, data, timeout=5.0):
+        """Send data to UART channel, split in as many output reports as needed.
+
+        Waits for credit when the board's TX buffer is full rather than
+        overrunning it, raises if none came within timeout.
+        """
+        data = bytes(data)
+        offset = 0
+        while offset < len(data):
+            with self._uart_credit:
+                sender = self._uart_tx[channel]
+                if sender.available() == 0:
+                    sender.stall()
+                    if not self._uart_credit.wait_for(sender.available, timeout):
+                        raise Exception("UART {0}: no credit from device".format(channel))
+                count = min(len(data) - offset, sender.available(), UART_BRIDGE_REPORT_DATA_SIZE)
+                sender.sent_bytes(count)
+            self._uart_send(channel, data[offset:offset + count])
+            offset += count
+
+    def get_uart_tx_stalls(self, channel):
+        """Times uart_write() waited for credit."""
+        return self._uart_tx[channel].stalls
+
+    def get_uart_stats(self):
+        """Returns list of per channel statistics dicts."""
+        report = bytes(self._get_feature(HID_REPORT_ID_UART, HID_REPORT_MAX_SIZE))
+        num_channels = report[1]
+        fields = len(UART_BRIDGE_STATS_FIELDS)
+        stats = []
+        for ch in range(num_channels):
+            values = struct.unpack_from("<{0}I".format(fields), report, 2 + (ch * fields * 4))
+            stats.append(dict(zip(UART_BRIDGE_STATS_FIELDS, values)))
+        return stats
+
+    def start_can(self, bitrate, mode=0):
+        self._set_feature(HID_REPORT_ID_CAN, struct.pack("<BIB", _CAN_CMD_START, bitrate, mode))
+
+    def stop_can(self):
+        self._set_feature(HID_REPORT_ID_CAN, [_CAN_CMD_STOP])
+
+    def set_can_filters(self, filters):
+        """filters: list of (id, mask) tuples, id may include CAN_ID_FLAG_EXT. Empty list receives all."""
+        self._set_feature(HID_REPORT_ID_CAN, [_CAN_CMD_FILTER_CLEAR])
+        for first in range(0, len(filters), _CAN_FILTERS_PER_REPORT):
+            chunk = filters[first:first + _CAN_FILTERS_PER_REPORT]
+            self._set_feature(HID_REPORT_ID_CAN, struct.pack("<BB", _CAN_CMD_FILTER_ADD, len(chunk)) +
+                              b"".join(struct.pack("<II", can_id, mask) for can_id, mask in chunk))
+        self._set_feature(HID_REPORT_ID_CAN, [_CAN_CMD_FILTER_APPLY])
+
+    def can_send(self, frames):
+        """frames: list of (id, data) tuples."""
+        for payload in pack_can_frames(frames):
+            self.ep_out.write(bytes([HID_REPORT_ID_CAN]) + payload)
+
+    def get_can_status(self):
+        report = bytes(self._get_feature(HID_REPORT_ID_CAN, HID_REPORT_MAX_SIZE))
+        running, num_filters, num_objects, tec, rec, stat = report[1:7]
+        values = struct.unpack_from("<{0}I".format(len(CAN_STATUS_FIELDS)), report, 7)
+        status = dict(zip(CAN_STATUS_FIELDS, values))
+        status.update(running=bool(running), filters=num_filters, objects=num_objects,
+                      tec=tec, rec=rec, stat=stat)
+        return status
+
+    def start_audio(self, rate, channels, directions=AUDIO_STREAM_CAPTURE | AUDIO_STREAM_PLAYBACK):
+        """Start I2S streaming, device stalls formats its report bandwidth can not carry."""
+        self.audio_channels = channels
+        self._audio_seq = 0
+        self._set_feature(HID_REPORT_ID_AUDIO, struct.pack("<BBI", directions, channels, rate))
+
+    def stop_audio(self):
+        self._set_feature(HID_REPORT_ID_AUDIO, struct.pack("<BBI", 0, 0, 0))
+
+    def audio_write(self, samples):
+        """Queue interleaved 16 bit samples for playback.
+
+        Pace calls with feedback from get_audio_status(), it is the number of
+        frames per millisecond device actually consumes.
+        """
+        reports, self._audio_seq = pack_audio_packets(samples, self.audio_channels, self._audio_seq)
+        for payload in reports:
+            self.ep_out.write(bytes([HID_REPORT_ID_AUDIO]) + payload)
+
+    def get_audio_status(self):
+        report = bytes(self._get_feature(HID_REPORT_ID_AUDIO, HID_REPORT_MAX_SIZE))
+        directions, channels, rate, capture_level, playback_level, feedback, capture_ppm, playback_ppm = \
+            struct.unpack_from("<BBIHHIii", report, 1)
+        fields = len(AUDIO_STATS_FIELDS)
+        capture = struct.unpack_from("<{0}I".format(fields), report, 23)
+        playback = struct.unpack_from("<{0}I".format(fields), report, 23 + (fields * 4))
+        return dict(directions=directions, channels=channels, rate=rate,
+                    capture_level=capture_level, playback_level=playback_level,
+                    feedback=feedback / 65536.0, capture_ppm=capture_ppm, playback_ppm=playback_ppm,
+                    capture=dict(zip(AUDIO_STATS_FIELDS, capture)),
+                    playback=dict(zip(AUDIO_STATS_FIELDS, playback)))
+
+    def _recorder_command(self, command, args=b"", timeout=5.0):
+        """Commands run from device main loop, wait until status reports the result."""
+        self._set_feature(HID_REPORT_ID_RECORDER, bytes([command]) + args)
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            result = self._get_feature(HID_REPORT_ID_RECORDER, HID_REPORT_MAX_SIZE)[2]
+            if result != _SD_COMMAND_BUSY:
+                return bool(result)
+            time.sleep(0.01)
+        return False
+
+    def mount_sd(self):
+        return self._recorder_command(_SD_CMD_MOUNT)
+
+    def format_sd(self):
+        """Erase recording index, card is used raw and any file system on it is lost."""
+        return self._recorder_command(_SD_CMD_FORMAT, struct.pack("<I", _SD_FORMAT_MAGIC))
+
+    def start_recording(self):
+        return self._recorder_command(_SD_CMD_START)
+
+    def stop_recording(self):
+        return self._recorder_command(_SD_CMD_STOP)
+
+    def record_write(self, data):
+        for first in range(0, len(data), SD_RECORDER_WRITE_DATA_SIZE):
+            chunk = data[first:first + SD_RECORDER_WRITE_DATA_SIZE]
+            self.ep_out.write(bytes([HID_REPORT_ID_RECORDER, len(chunk)]) + chunk)
+
+    def get_recorder_status(self, index=None):
+        if index is not None:
+            self._recorder_command(_SD_CMD_SELECT, bytes([index]))
+        report = bytes(self._get_feature(HID_REPORT_ID_RECORDER, HID_REPORT_MAX_SIZE))
+        state, result, count, selected, blocks = struct.unpack_from("<BBBBI", report, 1)
+        fields = len(SD_RECORDER_STATS_FIELDS)
+        stats = struct.unpack_from("<{0}I".format(fields), report, 9)
+        read_pos, read_end, rec_id, start_block, size, flags = \
+            struct.unpack_from("<6I", report, 9 + (fields * 4))
+        return dict(state=SD_RECORDER_STATES[state], recordings=count, card_blocks=blocks,
+                    stats=dict(zip(SD_RECORDER_STATS_FIELDS, stats)), read_pos=read_pos, read_end=read_end,
+                    selected=dict(index=selected, id=rec_id, start_block=start_block,
+                                  bytes=size, open=bool(flags & 1)))
+
+    def read_recording(self, index, offset=0, length=None, timeout=30.0):
+        """Download recording, returns bytes received before timeout."""
+        if length is None:
+            length = self.get_recorder_status(index)["selected"]["bytes"] - offset
+        self._readback_start = offset
+        self._readback_end = offset + length
+        self._readback = bytearray()
+        self._readback_done.clear()
+        if length > 0 and self._recorder_command(_SD_CMD_READ, struct.pack("<BII", index, offset, length)):
+            self._readback_done.wait(timeout)
+        data = bytes(self._readback)
+        self._readback = None
+        return data
+
+    def select_msc_media(self, media):
+        """Device syncs its flash cache and reconnects, this handle is unusable afterwards."""
+        self._set_feature(HID_REPORT_ID_MSC, [_MSC_CMD_SELECT, media])
+
+    def sync_msc(self, timeout=10.0):
+        """Program SPIFI sectors still held in the write-back cache."""
+        self._set_feature(HID_REPORT_ID_MSC, [_MSC_CMD_SYNC])
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            result = self._get_feature(HID_REPORT_ID_MSC, HID_REPORT_MAX_SIZE)[2]
+            if result != _SD_COMMAND_BUSY:
+                return bool(result)
+            time.sleep(0.01)
+        return False
+
+    def get_msc_status(self):
+        report = bytes(self._get_feature(HID_REPORT_ID_MSC, HID_REPORT_MAX_SIZE))
+        media, result, switchable, dirty, blocks = struct.unpack_from("<BBBBI", report, 1)
+        stats = struct.unpack_from("<{0}I".format(len(MSC_CACHE_STATS_FIELDS)), report, 9)
+        ready = report[9 + 4 * len(MSC_CACHE_STATS_FIELDS)]
+        return dict(media=MSC_MEDIA_NAMES[media], blocks=blocks, switchable=bool(switchable),
+                    dirty=bool(dirty), ready=bool(ready), cache=dict(zip(MSC_CACHE_STATS_FIELDS, stats)))
+
+    def start_encryption(self, key, threshold=1):
+        """Input and output reports with at least threshold payload bytes are
+        AES-128 CTR encrypted from now on. Start it while the device is quiet,
+        reports already in flight are not decrypted."""
+        self._crypt = None
+        self._set_feature(HID_REPORT_ID_CRYPT, bytes([_CRYPT_CMD_KEY]) + bytes(key))
+        self._set_feature(HID_REPORT_ID_CRYPT, bytes([_CRYPT_CMD_START, threshold]) + os.urandom(4))
+        status = self.get_encryption_status()
+        if not status["active"]:
+            raise Exception("Encrypted reports refused")
+        self._crypt = ReportCrypt(key, status["nonce"], threshold)
+
+    def stop_encryption(self):
+        self._set_feature(HID_REPORT_ID_CRYPT, [_CRYPT_CMD_STOP])
+        self._crypt = None
+
+    def get_encryption_status(self):
+        report = bytes(self._get_feature(HID_REPORT_ID_CRYPT, HID_REPORT_MAX_SIZE))
+        active, expired, threshold, engine = struct.unpack_from("<BBBB", report, 1)
+        stats = struct.unpack_from("<{0}I".format(len(CRYPT_STATS_FIELDS)), report, 13)
+        return dict(active=bool(active), expired=bool(expired), threshold=threshold,
+                    engine=CRYPT_ENGINES[engine], nonce=report[5:13],
+                    stats=dict(zip(CRYPT_STATS_FIELDS, stats)))
+
+    def sync_settings(self, clear=False, timeout=5.0):
+        """Program changed settings now instead of after they were idle for
+        a while, clear forgets them all. Returns False on timeout or write errors."""
+        errors = self.get_settings_status()["stats"]["errors"]
+        self._set_feature(HID_REPORT_ID_SETTINGS, [_SETTINGS_CMD_CLEAR if clear else _SETTINGS_CMD_SYNC])
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            status = self.get_settings_status()
+            if not status["dirty"] and not status["busy"]:
+                return status["stats"]["errors"] == errors
+            time.sleep(0.01)
+        return False
+
+    def get_settings_status(self):
+        report = bytes(self._get_feature(HID_REPORT_ID_SETTINGS, HID_REPORT_MAX_SIZE))
+        dirty, busy, pages = struct.unpack_from("<BBB", report, 1)
+        stats = struct.unpack_from("<{0}I".format(len(SETTINGS_STATS_FIELDS)), report, 5)
+        return dict(dirty=bool(dirty), busy=bool(busy), pages=pages,
+                    stats=dict(zip(SETTINGS_STATS_FIELDS, stats)))
+
+    def get_power_status(self):
+        # Resume latency runs from bus resume until the host took the report
+        # queued across suspend, wakeup latency from remote wakeup until bus
+        # resume.
+        report = bytes(self._get_feature(HID_REPORT_ID_POWER, HID_REPORT_MAX_SIZE))
+        suspended, remote_wakeup = struct.unpack_from("<BB", report, 1)
+        stats = struct.unpack_from("<{0}I".format(len(POWER_STATS_FIELDS)), report, 5)
+        return dict(suspended=bool(suspended), remote_wakeup=bool(remote_wakeup),
+                    stats=dict(zip(POWER_STATS_FIELDS, stats)))
+
+    def get_boot_status(self):
+        # Microseconds since core clock setup, stages which were needed
+        # before main loop got to them show on_demand.
+        report = bytes(self._get_feature(HID_REPORT_ID_BOOT, HID_REPORT_MAX_SIZE))
+        count = report[1]
+        main_us, connect_us = struct.unpack_from("<II", report, 5)
+        stages = {}
+        for i in range(count):
+            state, on_demand, start_us, duration_us = struct.unpack_from("<BBxxII", report, 13 + 12 * i)
+            name = BOOT_STAGE_NAMES[i] if i < len(BOOT_STAGE_NAMES) else str(i)
+            stages[name] = dict(state=BOOT_STAGE_STATES[state], on_demand=bool(on_demand),
+                                start_us=start_us, duration_us=duration_us)
+        return dict(main_us=main_us, usb_connect_us=connect_us, stages=stages)
+
+    def start_logic_capture(self, rate, mask=0, value=0, limit=0):
+        """Capture SGPIO8..15 from the first sample with (sample & mask) == value
+        after one without, limit 0 runs until stopped."""
+        self._logic_stream = bytearray()
+        self._logic_seq = 0
+        self._logic_done.clear()
+        self._set_feature(HID_REPORT_ID_LOGIC, struct.pack("<BBBII", 1, mask, value, rate, limit))
+
+    def stop_logic_capture(self):
+        self._set_feature(HID_REPORT_ID_LOGIC, struct.pack("<BBBII", 0, 0, 0, 0, 0))
+
+    def read_logic_capture(self, timeout=10.0):
+        """Wait for the capture to end, stops it on timeout. Returns decoded runs."""
+        if not self._logic_done.wait(timeout):
+            self.stop_logic_capture()
+            self._logic_done.wait(1.0)
+        stream = bytes(self._logic_stream or b"")
+        self._logic_stream = None
+        return decode_logic_runs(stream)
+
+    def get_logic_status(self):
+        # Rate is the one SGPIO clock divides down to, backlog is raw samples
+        # in SDRAM waiting for compression.
+        report = bytes(self._get_feature(HID_REPORT_ID_LOGIC, HID_REPORT_MAX_SIZE))
+        state, mask, value = struct.unpack_from("<BBB", report, 1)
+        rate, limit, backlog = struct.unpack_from("<III", report, 5)
+        stats = struct.unpack_from("<{0}I".format(len(LOGIC_STATS_FIELDS)), report, 17)
+        return dict(state=LOGIC_STATES[state], mask=mask, value=value, rate=rate, limit=limit,
+                    backlog=backlog, stats=dict(zip(LOGIC_STATS_FIELDS, stats)))
+
     def close(self):
         self.close_thread = True
         self.poll_th.join()
@@ -0,0 +1,150 @@
+# Custom HID device through Linux hidraw, kernel HID driver stays bound.
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import fcntl
+import glob
+import os
+import select
+import threading
+
+from custom_hid import CustomHID, HID_REPORT_MAX_SIZE
+
+# linux/hidraw.h, feature report ioctls carry the buffer length.
+_IOC_READ_WRITE = 3
+
+
+def _hidraw_ioc(nr, length):
+    return (_IOC_READ_WRITE << 30) | (length << 16) | (ord("H") << 8) | nr
+
+
+def HIDIOCSFEATURE(length):
+    return _hidraw_ioc(0x06, length)
+
+
+def HIDIOCGFEATURE(length):
+    return _hidraw_ioc(0x07, length)
+
+
+def find_hidraw(vendor_id, product_id, serial=None):
+    """Return /dev/hidrawN nodes of matching devices as (node, serial, name)."""
+    found = []
+    hid_id = "0003:{0:08X}:{1:08X}".format(vendor_id, product_id)
+    for path in sorted(glob.glob("/sys/class/hidraw/hidraw*")):
+        try:
+            with open(os.path.join(path, "device", "uevent")) as f:
+                uevent = dict(line.strip().split("=", 1) for line in f if "=" in line)
+        except OSError:
+            continue
+        if uevent.get("HID_ID", "").upper() != hid_id:
+            continue
+        if serial is not None and uevent.get("HID_UNIQ") != serial:
+            continue
+        found.append(("/dev/" + os.path.basename(path), uevent.get("HID_UNIQ", ""),
+                      uevent.get("HID_NAME", "")))
+    return found
+
+
+class _HidrawEndpoint:
+    # Stands in for the HID interrupt OUT endpoint, hidraw writes are
+    # output reports with the report ID first.
+    def __init__(self, fd):
+        self.fd = fd
+
+    def write(self, report):
+        return os.write(self.fd, bytes(report))
+
+
+class CustomHIDRaw(CustomHID):
+    def __init__(self, vendor_id, product_id, node=None, serial=None):
+        self.vid_pid_str = "{0:04X}:{1:04X}".format(vendor_id, product_id)
+        if node is None:
+            found = find_hidraw(vendor_id, product_id, serial)
+            if not found:
+                raise Exception("USB Device ID {0} not found".format(self.vid_pid_str))
+            node, serial, name = found[0]
+        else:
+            name = ""
+
+        self.node = node
+        self.fd = os.open(node, os.O_RDWR | os.O_NONBLOCK)
+        print("")
+        print("USB Device ID {0} found at {1}".format(self.vid_pid_str, node))
+        if name:
+            print("Product: {0}".format(name))
+            print("Serial Number: {0}".format(serial))
+
+        # Input reports are read as epoll reports them, the pipe wakes the
+        # thread on close.
+        self._wake_r, self._wake_w = os.pipe()
+        self._epoll = select.epoll()
+        self._epoll.register(self.fd, select.EPOLLIN)
+        self._epoll.register(self._wake_r, select.EPOLLIN)
+
+        self.ep_out = _HidrawEndpoint(self.fd)
+        self._init_state()
+        self.close_thread = False
+        self.poll_th = threading.Thread(target=self._poll_hidraw)
+        self.poll_th.start()
+
+    def _poll_hidraw(self):
+        while self.close_thread == False:
+            try:
+                for fd, events in self._epoll.poll():
+                    if fd == self._wake_r:
+                        continue
+                    if events & (select.EPOLLHUP | select.EPOLLERR):
+                        print("\nDevice {0} gone".format(self.node))
+                        print("aborting hidraw polling")
+                        return
+                    # One report per read, empty queue ends the batch.
+                    while True:
+                        try:
+                            report = os.read(self.fd, HID_REPORT_MAX_SIZE)
+                        except BlockingIOError:
+                            break
+                        self._handle_in_report(report)
+            except Exception as e:
+                print(e)
+                print("aborting hidraw polling")
+                return
+
+    def _set_feature(self, report_id, payload):
+        report = bytearray([report_id]) + bytes(payload)
+        fcntl.ioctl(self.fd, HIDIOCSFEATURE(len(report)), report)
+
+    def _get_feature(self, report_id, length):
+        report = bytearray(length)
+        report[0] = report_id
+        length = fcntl.ioctl(self.fd, HIDIOCGFEATURE(len(report)), report, True)
+        return bytes(report[:length])
+
+    def close(self):
+        self.close_thread = True
+        os.write(self._wake_w, b"\0")
+        self.poll_th.join()
+        self._epoll.close()
+        os.close(self._wake_r)
+        os.close(self._wake_w)
+        os.close(self.fd)
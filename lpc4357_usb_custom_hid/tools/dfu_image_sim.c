@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host simulation of dfu_image.c downloading images into simulated
+ * internal flash and SPIFI flash, with the geometry and poll estimates of
+ * dfu_update.c.
+ *
+ * Host sends a 2048 byte block per transfer, waits the poll timeout it got
+ * back, then sends the next one. Main loop programs a queued sector as soon
+ * as one is there, taking the real erase and program time, which is the
+ * estimate times a factor. Factors above one make the estimate too short,
+ * the host then hits a busy buffer and sends the block again after the new
+ * poll timeout. Every image is downloaded twice, the second run finds the
+ * data in flash already and skips all sectors.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o dfu_image_sim -I../lpc_chip_43xx/inc -Iinc tools/dfu_image_sim.c src/dfu_image.c
+ * $ ./dfu_image_sim [-f flash_time_factor] [-x transfer_us]
+ */
+
+#include "lpc_types.h"
+#include "dfu_image.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XFER_SIZE				2048
+#define STATUS_US				1000	/* GETSTATUS round trip */
+
+#define FLASH_BANK_SIZE			(512 * 1024)
+#define FLASH_SMALL_SECTORS		8
+#define FLASH_SMALL_SECTOR_SIZE	(8 * 1024)
+#define FLASH_LARGE_SECTOR_SIZE	(64 * 1024)
+#define SPIFI_FLASH_SIZE		(4 * 1024 * 1024)
+#define SPIFI_SECTOR_SIZE		(64 * 1024)
+
+typedef struct {
+	uint8_t *flash;
+	uint32_t erase_us;		/* Real cost, estimate times factor */
+	uint32_t program_us_per_kb;
+	uint32_t busy_us;		/* Cost of the last program call */
+} sim_flash_t;
+
+typedef struct {
+	uint32_t total_us;
+	uint32_t retries;		/* Blocks sent again after a busy buffer */
+	uint32_t flash_us;		/* Time spent erasing and programming */
+	dfu_image_stats_t stats;
+	bool ok;
+} sim_result_t;
+
+static double flash_factor = 1.0;
+static uint32_t xfer_us = 2500;
+static uint32_t failures;
+
+static uint8_t buffers[2 * DFU_IMAGE_SECTOR_MAX];
+static uint8_t internal_flash[FLASH_BANK_SIZE];
+static uint8_t spifi_flash[SPIFI_FLASH_SIZE];
+static uint8_t image[SPIFI_FLASH_SIZE];
+
+static uint32_t internal_sector_size(void *ctx, uint32_t offset) {
+	return (offset < FLASH_SMALL_SECTORS * FLASH_SMALL_SECTOR_SIZE) ? FLASH_SMALL_SECTOR_SIZE : FLASH_LARGE_SECTOR_SIZE;
+}
+
+static uint32_t spifi_sector_size(void *ctx, uint32_t offset) {
+	return SPIFI_SECTOR_SIZE;
+}
+
+static bool sim_program(void *ctx, uint32_t offset, const uint8_t *data, uint32_t length) {
+	sim_flash_t *f = ctx;
+
+	memcpy(&f->flash[offset], data, length);
+	f->busy_us = f->erase_us + (length / 1024) * f->program_us_per_kb;
+	return true;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Event driven, host sends at host_at, flash is busy until flash_at. */
+static void download(const dfu_media_t *media, sim_flash_t *f, uint32_t size, sim_result_t *result) {
+	dfu_image_t img;
+	uint32_t now = 0, host_at = 0, flash_at = 0, offset = 0, poll_ms;
+	int32_t idx = -1;
+	uint8_t status;
+	bool finished = false;
+
+	memset(result, 0, sizeof(*result));
+	dfu_image_init(&img, buffers);
+	check(dfu_image_begin(&img, media), "begin");
+
+	while (!finished || (idx >= 0) || dfu_image_busy(&img)) {
+		if ((idx >= 0) && (finished || (flash_at <= host_at))) {
+			now = flash_at;
+			dfu_image_release(&img, idx, true);
+			idx = -1;
+		}
+		else if (!finished) {
+			now = host_at;
+			if (offset < size) {
+				status = dfu_image_write(&img, offset, &image[offset], XFER_SIZE, now, &poll_ms);
+				if (status == DFU_IMAGE_ERR_BUSY) {
+					result->retries++;
+				}
+				else if (status == DFU_IMAGE_OK) {
+					offset += XFER_SIZE;
+				}
+				else {
+					check(false, "write status");
+					return;
+				}
+				host_at = now + xfer_us + MAX(poll_ms * 1000, STATUS_US);
+			}
+			else {
+				dfu_image_finish(&img);
+				finished = true;
+			}
+		}
+
+		// Main loop picks a queued sector right away.
+		if (idx < 0) {
+			idx = dfu_image_claim(&img, now);
+			if (idx >= 0) {
+				f->busy_us = 0;
+				check(dfu_image_program(&img, idx), "program");
+				flash_at = now + f->busy_us;
+				result->flash_us += f->busy_us;
+			}
+		}
+	}
+
+	result->total_us = MAX(now, host_at);
+	result->stats = img.stats;
+	result->ok = dfu_image_done(&img) && (img.status == DFU_IMAGE_OK) &&
+		(memcmp(f->flash, image, size) == 0);
+	check(result->ok, "image in flash");
+}
+
+/* A busy buffer must not fail the rest of the download. */
+static void test_busy_not_sticky(const dfu_media_t *media) {
+	dfu_image_t img;
+	uint32_t offset, poll_ms;
+	uint8_t status = DFU_IMAGE_OK;
+	int32_t idx;
+
+	dfu_image_init(&img, buffers);
+	dfu_image_begin(&img, media);
+	for (offset = 0; status == DFU_IMAGE_OK; offset += XFER_SIZE) {
+		status = dfu_image_write(&img, offset, &image[offset], XFER_SIZE, 0, &poll_ms);
+	}
+	offset -= XFER_SIZE;
+	check((status == DFU_IMAGE_ERR_BUSY) && (poll_ms > 0), "busy with poll timeout");
+	check(img.status == DFU_IMAGE_OK, "busy not sticky");
+
+	idx = dfu_image_claim(&img, 0);
+	dfu_image_release(&img, idx, dfu_image_program(&img, idx));
+	check(dfu_image_write(&img, offset, &image[offset], XFER_SIZE, 0, &poll_ms) == DFU_IMAGE_OK,
+		  "same block accepted later");
+
+	check(dfu_image_write(&img, offset, &image[offset], XFER_SIZE, 0, &poll_ms) == DFU_IMAGE_ERR_ADDRESS,
+		  "repeated block refused");
+	check(dfu_image_write(&img, offset + XFER_SIZE, &image[offset], XFER_SIZE, 0, &poll_ms) ==
+		  DFU_IMAGE_ERR_ADDRESS, "address error sticks");
+}
+
+static void run(const char *name, dfu_media_t *media, sim_flash_t *f, uint32_t erase_ms,
+		uint32_t program_us_per_kb, uint32_t size) {
+	sim_result_t first, again;
+
+	media->erase_ms = erase_ms;
+	media->program_us_per_kb = program_us_per_kb;
+	f->erase_us = erase_ms * 1000 * flash_factor;
+	f->program_us_per_kb = program_us_per_kb * flash_factor;
+
+	memset(f->flash, 0xFF, media->size);
+	download(media, f, size, &first);
+	download(media, f, size, &again);
+
+	printf("%-8s %5u KB | %9.3f %7.1f %6.1f %7u %8u | %9.3f %7u\n", name, size / 1024,
+		   first.total_us / 1e6, (size / 1024) / (first.total_us / 1e6), first.flash_us / 1e6,
+		   first.stats.programmed, first.retries, again.total_us / 1e6, again.stats.skipped);
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t internal_sizes[] = { 64 * 1024, 256 * 1024, 512 * 1024 };
+	static const uint32_t spifi_sizes[] = { 256 * 1024, 1024 * 1024, 4096 * 1024 };
+	sim_flash_t internal_sim = { .flash = internal_flash }, spifi_sim = { .flash = spifi_flash };
+	dfu_media_t internal, spifi;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:x:")) != -1) {
+		switch (opt) {
+		case 'f':
+			flash_factor = strtod(optarg, NULL);
+			break;
+		case 'x':
+			xfer_us = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f flash_time_factor] [-x transfer_us]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (flash_factor <= 0) {
+		fprintf(stderr, "flash time factor must be positive\n");
+		return 1;
+	}
+
+	srand(1);
+	for (i = 0; i < sizeof(image); i++) {
+		image[i] = rand();
+	}
+
+	memset(&internal, 0, sizeof(internal));
+	internal.sector_size = internal_sector_size;
+	internal.program = sim_program;
+	internal.ctx = &internal_sim;
+	internal.map = internal_flash;
+	internal.size = FLASH_BANK_SIZE;
+
+	memset(&spifi, 0, sizeof(spifi));
+	spifi.sector_size = spifi_sector_size;
+	spifi.program = sim_program;
+	spifi.ctx = &spifi_sim;
+	spifi.map = spifi_flash;
+	spifi.size = SPIFI_FLASH_SIZE;
+
+	internal.erase_ms = 100;
+	internal.program_us_per_kb = 2000;
+	memset(internal_flash, 0xFF, sizeof(internal_flash));
+	test_busy_not_sticky(&internal);
+
+	printf("flash time %.2f x estimate, %u us per %u byte transfer\n\n", flash_factor, xfer_us, XFER_SIZE);
+	printf("media       image | total s    KB/s flash s sectors  retries | resume s skipped\n");
+	for (i = 0; i < sizeof(internal_sizes) / sizeof(internal_sizes[0]); i++) {
+		run("internal", &internal, &internal_sim, 100, 2000, internal_sizes[i]);
+	}
+	for (i = 0; i < sizeof(spifi_sizes) / sizeof(spifi_sizes[0]); i++) {
+		run("spifi", &spifi, &spifi_sim, 500, 6000, spifi_sizes[i]);
+	}
+
+	printf("\ndfu_image checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
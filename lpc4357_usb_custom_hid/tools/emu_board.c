@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "event_capture.h"
+#include "gpio_events.h"
+#include "pwm_sequencer.h"
+#include "uart_bridge.h"
+#include "can_gateway.h"
+#include "audio_stream.h"
+#include "sd_recorder.h"
+#include "msc_disk.h"
+#include "hid_crypt.h"
+#include "settings.h"
+#include "usb_power.h"
+#include "boot_stages.h"
+#include "logic_capture.h"
+#include "hid_rpc.h"
+#include "emu_board.h"
+
+/* Bytes looped back per UART channel, same credit as the board's TX ring */
+#define UART_LOOPBACK_SIZE		1024
+
+/* Room for the HID function driver and report buffers, as the ROM gets it */
+#define USB_MEM_SIZE			0x1000
+
+/* SW2 is on pin interrupt channel 0 */
+#define SW2_CHANNEL				0
+
+typedef ErrorCode_t (*ep_handler_t)(USBD_HANDLE_T hUsb, void *data, uint32_t event);
+
+typedef struct {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+	uint32_t length;
+} queued_report_t;
+
+/* Defined by the firmware main file on the board */
+const USBD_API_T *g_pUsbApi;
+bool is_device_active;
+
+extern const uint8_t USB_DeviceDescriptor[];
+extern uint8_t USB_FsConfigDescriptor[];
+extern uint8_t USB_HsConfigDescriptor[];
+extern uint8_t USB_StringDescriptor[];
+extern const uint8_t HID_ReportDescriptor[];
+extern const uint16_t HID_ReportDescSize;
+
+static emu_board_stats_t stats;
+
+/* hid_generic.c callbacks, as registered with the ROM HID driver */
+static USB_HID_CTRL_T hid_ctrl;
+static ep_handler_t ep_in_handler;
+static ep_handler_t ep_out_handler;
+
+/* Interrupt IN endpoint, report loaded by the firmware */
+static queued_report_t in_endpoint;
+static bool in_loaded;
+
+/* Interrupt OUT endpoint, report handed to ReadEP */
+static const uint8_t *out_data;
+static uint32_t out_length;
+
+typedef struct {
+	bool open;
+	uint8_t loopback[UART_LOOPBACK_SIZE];
+	credit_rx_t out_credit;
+	credit_tx_t in_credit;
+	uart_bridge_stats_t stats;
+} uart_channel_t;
+
+static bool led5;
+static uart_channel_t uart_channels[UART_BRIDGE_NUM_CHANNELS];
+static uint32_t next_uart_channel;
+
+/*****************************************************************************
+ * Stand-in USB ROM API
+ ****************************************************************************/
+
+static uint32_t rom_write_ep(USBD_HANDLE_T hUsb, uint32_t EPNum, uint8_t *pData, uint32_t cnt) {
+	if ((EPNum != HID_EP_IN) || (cnt > HID_REPORT_MAX_SIZE)) {
+		return 0;
+	}
+	memcpy(in_endpoint.report, pData, cnt);
+	in_endpoint.length = cnt;
+	in_loaded = true;
+	return cnt;
+}
+
+static uint32_t rom_read_ep(USBD_HANDLE_T hUsb, uint32_t EPNum, uint8_t *pData) {
+	memcpy(pData, out_data, out_length);
+	return out_length;
+}
+
+static uint32_t rom_read_req_ep(USBD_HANDLE_T hUsb, uint32_t EPNum, uint8_t *pData, uint32_t len) {
+	return len;
+}
+
+static ErrorCode_t rom_hid_init(USBD_HANDLE_T hUsb, USBD_HID_INIT_PARAM_T *param) {
+	hid_ctrl.if_num = ((USB_INTERFACE_DESCRIPTOR *) param->intf_desc)->bInterfaceNumber;
+	hid_ctrl.epin_adr = HID_EP_IN;
+	hid_ctrl.epout_adr = HID_EP_OUT;
+	hid_ctrl.HID_GetReport = param->HID_GetReport;
+	hid_ctrl.HID_SetReport = param->HID_SetReport;
+	ep_in_handler = param->HID_EpIn_Hdlr;
+	ep_out_handler = param->HID_EpOut_Hdlr;
+	return LPC_OK;
+}
+
+static const USBD_HW_API_T rom_hw = {
+	.WriteEP = rom_write_ep,
+	.ReadEP = rom_read_ep,
+	.ReadReqEP = rom_read_req_ep,
+};
+
+static const USBD_HID_API_T rom_hid = {
+	.init = rom_hid_init,
+};
+
+static const USBD_API_T rom_api = {
+	.hw = &rom_hw,
+	.hid = &rom_hid,
+};
+
+/*****************************************************************************
+ * Board module stubs
+ ****************************************************************************/
+
+void board_led_set(uint8_t led_number, bool on) {
+	if ((led_number == LED5) && (on != led5)) {
+		led5 = on;
+		printf("LED5 %s\n", on ? "on" : "off");
+	}
+}
+
+void MCPWM_CH1_Update(uint8_t rate) {
+	printf("LED4 blink rate %u\n", rate);
+}
+
+/* Same as gpio_events.c, SW2 edges come from emu_board_sw2_press(). */
+static uint32_t events_in_source(uint8_t *report) {
+	if (event_capture_fill_report(&report[1], HID_EVENTS_REPORT_SIZE - 1) == 0) {
+		return 0;
+	}
+	report[0] = HID_REPORT_ID_EVENTS;
+	return HID_EVENTS_REPORT_SIZE;
+}
+
+bool gpio_events_set_feature(const uint8_t *payload, uint16_t length) {
+	if ((length < (HID_EVENTS_FEATURE_SIZE - 1)) || (payload[0] >= EVENT_CAPTURE_NUM_CHANNELS)) {
+		return false;
+	}
+
+	event_capture_set_debounce(payload[0], (payload[1] | (payload[2] << 8)) * 1000);
+	return true;
+}
+
+/* UART channels are wired TX to RX, bytes sent come back in input reports
+ * as host credit allows and free loopback room for it to send more. */
+static uint32_t uart_in_source(uint8_t *report) {
+	uart_channel_t *ch;
+	uint32_t i, j, count, limit, offset;
+
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		ch = &uart_channels[next_uart_channel];
+		next_uart_channel = (next_uart_channel + 1) % UART_BRIDGE_NUM_CHANNELS;
+		if (!ch->open) {
+			continue;
+		}
+
+		count = ch->out_credit.accepted - ch->out_credit.consumed;
+		count = MIN(count, UART_BRIDGE_REPORT_DATA_SIZE);
+		if (count > credit_tx_available(&ch->in_credit)) {
+			credit_tx_stall(&ch->in_credit);
+			count = credit_tx_available(&ch->in_credit);
+		}
+		if ((count == 0) && !credit_rx_update_due(&ch->out_credit)) {
+			continue;
+		}
+
+		offset = ch->out_credit.consumed;
+		for (j = 0; j < count; j++) {
+			report[UART_BRIDGE_REPORT_HEADER_SIZE + j] = ch->loopback[(offset + j) % UART_LOOPBACK_SIZE];
+		}
+		credit_tx_sent(&ch->in_credit, count);
+		credit_rx_consume(&ch->out_credit, count);
+		limit = credit_rx_advertise(&ch->out_credit);
+
+		report[0] = HID_REPORT_ID_UART;
+		report[1] = ch - uart_channels;
+		report[2] = count;
+		report[3] = limit & 0xFF;
+		report[4] = (limit >> 8) & 0xFF;
+		report[5] = (limit >> 16) & 0xFF;
+		report[6] = limit >> 24;
+		if (count > 0) {
+			ch->stats.rx_bytes += count;
+			ch->stats.rx_reports++;
+		}
+		return HID_UART_REPORT_SIZE;
+	}
+	return 0;
+}
+
+void uart_bridge_write(const uint8_t *payload, uint32_t length) {
+	uart_channel_t *ch;
+	uint32_t i, count, accepted, offset;
+
+	if ((length < (UART_BRIDGE_REPORT_HEADER_SIZE - 1)) || (payload[0] >= UART_BRIDGE_NUM_CHANNELS)) {
+		return;
+	}
+	ch = &uart_channels[payload[0]];
+	if (!ch->open) {
+		return;
+	}
+
+	credit_tx_grant(&ch->in_credit, payload[2] | (payload[3] << 8) | (payload[4] << 16) |
+					((uint32_t) payload[5] << 24));
+	count = MIN(payload[1], length - (UART_BRIDGE_REPORT_HEADER_SIZE - 1));
+	if (count == 0) {
+		return;
+	}
+	offset = ch->out_credit.accepted;
+	accepted = credit_rx_accept(&ch->out_credit, count);
+	for (i = 0; i < accepted; i++) {
+		ch->loopback[(offset + i) % UART_LOOPBACK_SIZE] = payload[UART_BRIDGE_REPORT_HEADER_SIZE - 1 + i];
+	}
+	ch->stats.tx_reports++;
+	ch->stats.tx_bytes += accepted;
+	ch->stats.tx_dropped += count - accepted;
+}
+
+bool uart_bridge_set_feature(const uint8_t *payload, uint16_t length) {
+	uart_channel_t *ch;
+
+	if ((length < 8) || (payload[0] >= UART_BRIDGE_NUM_CHANNELS)) {
+		return false;
+	}
+	ch = &uart_channels[payload[0]];
+	ch->open = payload[1];
+	credit_rx_init(&ch->out_credit, UART_LOOPBACK_SIZE, UART_LOOPBACK_SIZE / 4);
+	credit_tx_init(&ch->in_credit);
+	memset(&ch->stats, 0, sizeof(ch->stats));
+	return true;
+}
+
+uint16_t uart_bridge_get_feature(uint8_t *payload, uint16_t max_length) {
+	uint32_t i, j;
+	const uint32_t *counters;
+
+	if (max_length < UART_BRIDGE_STATUS_SIZE) {
+		return 0;
+	}
+
+	*payload++ = UART_BRIDGE_NUM_CHANNELS;
+	for (i = 0; i < UART_BRIDGE_NUM_CHANNELS; i++) {
+		counters = (const uint32_t *) &uart_channels[i].stats;
+		for (j = 0; j < sizeof(uart_bridge_stats_t) / sizeof(uint32_t); j++) {
+			*payload++ = counters[j] & 0xFF;
+			*payload++ = (counters[j] >> 8) & 0xFF;
+			*payload++ = (counters[j] >> 16) & 0xFF;
+			*payload++ = (counters[j] >> 24) & 0xFF;
+		}
+	}
+	return UART_BRIDGE_STATUS_SIZE;
+}
+
+/* Modules without a stand-in read as zeros, idle, and refuse writes. */
+
+bool pwm_sequencer_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t pwm_sequencer_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+void can_gateway_write(const uint8_t *payload, uint32_t length) {
+}
+
+bool can_gateway_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t can_gateway_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+void audio_stream_write(const uint8_t *payload, uint32_t length) {
+}
+
+bool audio_stream_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t audio_stream_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+void sd_recorder_write(const uint8_t *payload, uint32_t length) {
+}
+
+bool sd_recorder_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t sd_recorder_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+bool msc_disk_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t msc_disk_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+/* Reports stay in clear, no session can be started. */
+bool hid_crypt_in(uint8_t *report, uint32_t length) {
+	return true;
+}
+
+bool hid_crypt_out(uint8_t *report, uint32_t length) {
+	return true;
+}
+
+bool hid_crypt_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t hid_crypt_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+bool settings_set(uint8_t key, const uint8_t *value, uint32_t length) {
+	return true;
+}
+
+bool settings_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t settings_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+void usb_power_in_done(void) {
+}
+
+uint16_t usb_power_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+uint16_t boot_stages_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+bool logic_capture_set_feature(const uint8_t *payload, uint16_t length) {
+	return false;
+}
+
+uint16_t logic_capture_get_feature(uint8_t *payload, uint16_t max_length) {
+	return 0;
+}
+
+/*****************************************************************************
+ * Public functions
+ ****************************************************************************/
+
+static USB_INTERFACE_DESCRIPTOR *find_hid_interface(void) {
+	uint8_t *desc = USB_FsConfigDescriptor;
+	uint8_t *end = desc + (desc[2] | (desc[3] << 8));
+
+	while ((desc < end) && (desc[0] > 0)) {
+		if ((desc[1] == USB_INTERFACE_DESCRIPTOR_TYPE) &&
+			(desc[5] == USB_DEVICE_CLASS_HUMAN_INTERFACE)) {
+			return (USB_INTERFACE_DESCRIPTOR *) desc;
+		}
+		desc += desc[0];
+	}
+	return NULL;
+}
+
+bool emu_board_init(void) {
+	uint32_t mem_base, mem_size = USB_MEM_SIZE;
+	void *mem;
+
+	// ROM hands out memory as 32 bit addresses.
+	mem = mmap(NULL, USB_MEM_SIZE, PROT_READ | PROT_WRITE,
+#ifdef MAP_32BIT
+			   MAP_32BIT |
+#endif
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((mem == MAP_FAILED) || ((uintptr_t) mem != (uint32_t) (uintptr_t) mem)) {
+		fprintf(stderr, "no memory below 4 GB\n");
+		return false;
+	}
+	mem_base = (uint32_t) (uintptr_t) mem;
+
+	g_pUsbApi = &rom_api;
+	if (usb_hid_init(NULL, find_hid_interface(), &mem_base, &mem_size) != LPC_OK) {
+		fprintf(stderr, "HID init failed\n");
+		return false;
+	}
+	event_capture_init();
+	hid_in_add_source(events_in_source);
+	hid_in_add_source(uart_in_source);
+	hid_rpc_init();
+	return true;
+}
+
+void emu_board_connect(bool active) {
+	is_device_active = active;
+}
+
+uint32_t emu_board_in_take(uint8_t *report) {
+	uint32_t length;
+
+	if (!in_loaded) {
+		// IN done, firmware loads the next report if it has one.
+		ep_in_handler(NULL, &hid_ctrl, USB_EVT_IN);
+		if (!in_loaded) {
+			return 0;
+		}
+	}
+	length = in_endpoint.length;
+	memcpy(report, in_endpoint.report, length);
+	in_loaded = false;
+	stats.input++;
+	return length;
+}
+
+/* Interrupt OUT transfer, ROM stack signals it to the OUT handler. */
+void emu_board_out_report(const uint8_t *report, uint32_t length) {
+	if (length > HID_REPORT_MAX_SIZE) {
+		return;
+	}
+	out_data = report;
+	out_length = length;
+	ep_out_handler(NULL, &hid_ctrl, USB_EVT_OUT);
+	stats.output++;
+}
+
+static void setup_packet(USB_SETUP_PACKET *setup, uint8_t request, uint8_t type, uint8_t report_id, uint16_t length) {
+	memset(setup, 0, sizeof(*setup));
+	setup->bmRequestType.B = (request == HID_REQUEST_GET_REPORT) ? 0xA1 : 0x21;
+	setup->bRequest = request;
+	setup->wValue.WB.L = report_id;
+	setup->wValue.WB.H = type;
+	setup->wIndex.W = hid_ctrl.if_num;
+	setup->wLength = length;
+}
+
+bool emu_board_get_report(uint8_t type, uint8_t report_id, uint8_t *report, uint16_t *length) {
+	USB_SETUP_PACKET setup;
+	uint8_t *buffer = report;
+
+	stats.get_report++;
+	setup_packet(&setup, HID_REQUEST_GET_REPORT, type, report_id, HID_REPORT_MAX_SIZE);
+	*length = 0;
+	if (hid_ctrl.HID_GetReport(&hid_ctrl, &setup, &buffer, length) != LPC_OK) {
+		stats.stalled++;
+		return false;
+	}
+	if (buffer != report) {
+		memmove(report, buffer, *length);
+	}
+	return true;
+}
+
+bool emu_board_set_report(uint8_t type, uint8_t *report, uint16_t length) {
+	USB_SETUP_PACKET setup;
+
+	stats.set_report++;
+	setup_packet(&setup, HID_REQUEST_SET_REPORT, type, (length > 0) ? report[0] : 0, length);
+	if (hid_ctrl.HID_SetReport(&hid_ctrl, &setup, &report, length) != LPC_OK) {
+		stats.stalled++;
+		return false;
+	}
+	return true;
+}
+
+void emu_board_sw2_press(void) {
+	event_capture_push(SW2_CHANNEL, EVENT_EDGE_FALL, emu_board_now_us());
+	event_capture_process();
+	stats.sw2++;
+}
+
+const uint8_t *emu_board_report_descriptor(uint16_t *length) {
+	*length = HID_ReportDescSize;
+	return HID_ReportDescriptor;
+}
+
+const uint8_t *emu_board_device_descriptor(void) {
+	return USB_DeviceDescriptor;
+}
+
+const uint8_t *emu_board_config_descriptor(bool high_speed) {
+	return high_speed ? USB_HsConfigDescriptor : USB_FsConfigDescriptor;
+}
+
+void emu_board_string(uint8_t index, char *str, uint32_t size) {
+	const uint8_t *desc = USB_StringDescriptor;
+	uint32_t i, n = 0;
+
+	// String descriptors follow each other, terminated by a zero length.
+	for (i = 0; (i < index) && (desc[0] > 0); i++) {
+		desc += desc[0];
+	}
+	if ((desc[0] > 0) && (size > 0)) {
+		for (i = 2; ((i + 1) < desc[0]) && ((n + 1) < size); i += 2) {
+			str[n++] = desc[i];
+		}
+	}
+	if (size > 0) {
+		str[n] = '\0';
+	}
+}
+
+uint32_t emu_board_now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t) ((uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+const emu_board_stats_t *emu_board_get_stats(void) {
+	return &stats;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef EMU_BOARD_H_
+#define EMU_BOARD_H_
+
+#include "lpc_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Virtual board for the host emulators, uhid_device.c and ffs_device.c.
+ * hid_generic.c runs natively behind a stand-in USB ROM API, board modules
+ * are stubs: UART bridge channels loop bytes sent back to host under the
+ * same credit flow control as the board, SW2 presses go through the real
+ * event_capture.c, other modules read as idle and refuse feature writes. Not thread safe, front ends serialize
+ * calls like the USB interrupt does on the board.
+ */
+
+typedef struct {
+	uint32_t input;		/* Input reports taken from the interrupt IN endpoint */
+	uint32_t output;	/* Output reports from interrupt OUT endpoint */
+	uint32_t get_report;
+	uint32_t set_report;
+	uint32_t stalled;	/* GET_REPORT and SET_REPORT requests refused */
+	uint32_t sw2;		/* SW2 presses injected */
+} emu_board_stats_t;
+
+/**
+ * Registers hid_generic.c with the stand-in ROM, false if that failed.
+ */
+bool emu_board_init(void);
+
+/* Host polls the interrupt IN endpoint, set by configure or open. */
+void emu_board_connect(bool active);
+
+/**
+ * Previous input report left the endpoint, copies the next one the firmware
+ * loads into report. Returns its length, 0 if none is pending.
+ */
+uint32_t emu_board_in_take(uint8_t *report);
+
+/* Interrupt OUT endpoint received report. */
+void emu_board_out_report(const uint8_t *report, uint32_t length);
+
+/**
+ * Control GET_REPORT and SET_REPORT, type is HID_REPORT_INPUT, _OUTPUT or
+ * _FEATURE. Report ID is in report[0] as on the wire, false stalls.
+ */
+bool emu_board_get_report(uint8_t type, uint8_t report_id, uint8_t *report, uint16_t *length);
+bool emu_board_set_report(uint8_t type, uint8_t *report, uint16_t length);
+
+/* Falling edge on SW2 now, channel 0 like the board. */
+void emu_board_sw2_press(void);
+
+/* Report descriptor and the device, configuration and string descriptors */
+const uint8_t *emu_board_report_descriptor(uint16_t *length);
+const uint8_t *emu_board_device_descriptor(void);
+const uint8_t *emu_board_config_descriptor(bool high_speed);
+/* ASCII copy of string descriptor index, empty if missing */
+void emu_board_string(uint8_t index, char *str, uint32_t size);
+
+uint32_t emu_board_now_us(void);
+const emu_board_stats_t *emu_board_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EMU_BOARD_H_ */
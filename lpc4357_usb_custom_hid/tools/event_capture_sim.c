@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test of event_capture.c on synthetic edge traces.
+ *
+ * Checks replay bouncing button presses on several channels and expect one
+ * falling and one rising record per press with the timestamps of the first
+ * edges, lockout working across the microsecond timer wrap, and edges lost
+ * to a full raw ring showing up in the lost byte of the next report.
+ *
+ * Benchmark pushes evenly spaced edges spread over all channels with
+ * debounce off, runs event_capture_process() every main loop pass and
+ * takes one report per millisecond like the interrupt IN endpoint. Table
+ * shows delivered events per second and where the rest were lost for a
+ * sweep of edge rates, followed by host cost of one event through push,
+ * process and report.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o event_capture_sim -I../lpc_chip_43xx/inc -Iinc tools/event_capture_sim.c src/event_capture.c ../lpc_chip_43xx/src/ring_buffer.c
+ * $ ./event_capture_sim [-p loop_us] [-s seconds]
+ */
+
+#include "lpc_types.h"
+#include "event_capture.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REPORT_LEN			63		/* Events report without report ID */
+#define REPORT_INTERVAL_US	1000
+
+typedef struct {
+	uint8_t channel;
+	uint8_t edge;
+	uint32_t timestamp_us;
+} record_t;
+
+static uint32_t failures;
+
+static uint32_t loop_us = 100;
+static uint32_t seconds = 2;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* @return	Records decoded from one report, lost byte in *lost. */
+static uint32_t take_report(record_t *records, uint32_t *lost) {
+	uint8_t payload[REPORT_LEN];
+	const uint8_t *rec = &payload[EVENT_REPORT_HEADER_SIZE];
+	uint32_t count, i;
+
+	memset(payload, 0, sizeof(payload));
+	count = event_capture_fill_report(payload, sizeof(payload));
+	check(count == payload[0], "count byte matches return value");
+	*lost = payload[1];
+
+	for (i = 0; i < count; i++, rec += EVENT_RECORD_SIZE) {
+		records[i].channel = rec[0] & EVENT_RECORD_CHANNEL_MASK;
+		records[i].edge = (rec[0] & EVENT_RECORD_FLAG_RISE) ? EVENT_EDGE_RISE : EVENT_EDGE_FALL;
+		records[i].timestamp_us = rec[1] | (rec[2] << 8) | (rec[3] << 16) | ((uint32_t) rec[4] << 24);
+	}
+	return count;
+}
+
+/* Contacts bounce for about a millisecond, edge is the first one seen. */
+static void push_bounce(uint8_t channel, uint8_t edge, uint32_t t) {
+	uint32_t i;
+
+	for (i = 0; i < 6; i++) {
+		event_capture_push(channel, edge ^ (i & 1), t + i * 150);
+	}
+}
+
+static void test_bouncing_presses(void) {
+	record_t records[REPORT_LEN / EVENT_RECORD_SIZE];
+	uint32_t press, lost, count, i, expected_t;
+	bool order_ok = true;
+
+	event_capture_init();
+	for (press = 0; press < 4; press++) {
+		// Channel 0 and the group interrupt interleaved, 200 ms apart, held 50 ms.
+		push_bounce(0, EVENT_EDGE_FALL, press * 200000);
+		push_bounce(EVENT_CHANNEL_GINT0, EVENT_EDGE_FALL, press * 200000 + 300);
+		push_bounce(0, EVENT_EDGE_RISE, press * 200000 + 50000);
+		push_bounce(EVENT_CHANNEL_GINT0, EVENT_EDGE_RISE, press * 200000 + 50300);
+		event_capture_process();
+
+		count = take_report(records, &lost);
+		check((count == 4) && (lost == 0), "four records per pair of presses");
+		for (i = 0; i < count; i++) {
+			expected_t = press * 200000 + ((i & 1) ? 300 : 0) + ((i & 2) ? 50000 : 0);
+			order_ok = order_ok && (records[i].channel == ((i & 1) ? EVENT_CHANNEL_GINT0 : 0)) &&
+					   (records[i].edge == ((i & 2) ? EVENT_EDGE_RISE : EVENT_EDGE_FALL)) &&
+					   (records[i].timestamp_us == expected_t);
+		}
+	}
+	check(order_ok, "records carry channel, edge and time of first edge");
+	check((event_capture_get_stats()->accepted == 16) && (event_capture_get_stats()->bounced == 80),
+		  "bounces counted, not reported");
+	check(take_report(records, &lost) == 0, "nothing left after last report");
+}
+
+static void test_timer_wrap(void) {
+	record_t records[REPORT_LEN / EVENT_RECORD_SIZE];
+	uint32_t lost;
+
+	event_capture_init();
+	event_capture_set_debounce(3, 1000);
+	event_capture_push(3, EVENT_EDGE_FALL, 0xFFFFFE00);
+	event_capture_push(3, EVENT_EDGE_RISE, 0x00000100);		/* 768 us later */
+	event_capture_push(3, EVENT_EDGE_FALL, 0x00000200);		/* 1024 us later */
+	event_capture_process();
+
+	check((take_report(records, &lost) == 2) && (records[1].timestamp_us == 0x200),
+		  "lockout measured across timer wrap");
+}
+
+static void test_lost_reporting(void) {
+	record_t records[REPORT_LEN / EVENT_RECORD_SIZE];
+	uint32_t i, lost, count;
+
+	event_capture_init();
+	event_capture_set_debounce(1, 0);
+	for (i = 0; i < 100; i++) {
+		event_capture_push(1, i & 1, i);
+	}
+	check(event_capture_get_stats()->overflow > 0, "raw ring overflows without process");
+	event_capture_process();
+
+	count = take_report(records, &lost);
+	check(lost == event_capture_get_stats()->overflow, "first report carries lost edges");
+	check((count == (REPORT_LEN - EVENT_REPORT_HEADER_SIZE) / EVENT_RECORD_SIZE) && (records[0].timestamp_us == 0),
+		  "report filled with oldest edges first");
+	take_report(records, &lost);
+	check(lost == 0, "lost edges reported only once");
+
+	for (i = 0; i < 400; i++) {
+		event_capture_push(1, i & 1, 1000 + i);
+	}
+	take_report(records, &lost);
+	check(lost == 0xFF, "lost count saturates");
+}
+
+typedef struct {
+	uint64_t pushed;
+	uint64_t delivered;
+	uint64_t lost_bytes;
+} load_result_t;
+
+static void run_load(uint32_t rate, load_result_t *r) {
+	record_t records[REPORT_LEN / EVENT_RECORD_SIZE];
+	const uint64_t end_us = (uint64_t) seconds * 1000000;
+	uint64_t t;
+	uint32_t lost, ch;
+
+	memset(r, 0, sizeof(*r));
+	event_capture_init();
+	for (ch = 0; ch < EVENT_CAPTURE_NUM_CHANNELS; ch++) {
+		event_capture_set_debounce(ch, 0);
+	}
+
+	for (t = 0; t < end_us; t++) {
+		// Edge k due at k / rate seconds.
+		while ((r->pushed * 1000000) / rate <= t) {
+			ch = r->pushed % EVENT_CAPTURE_NUM_CHANNELS;
+			event_capture_push(ch, (r->pushed / EVENT_CAPTURE_NUM_CHANNELS) & 1, (uint32_t) t);
+			r->pushed++;
+		}
+		if ((t % loop_us) == 0) {
+			event_capture_process();
+		}
+		if ((t % REPORT_INTERVAL_US) == 0) {
+			r->delivered += take_report(records, &lost);
+			r->lost_bytes += lost;
+		}
+	}
+}
+
+static double host_ns_per_event(void) {
+	record_t records[REPORT_LEN / EVENT_RECORD_SIZE];
+	const uint32_t events = 10000000;
+	struct timespec t0, t1;
+	uint32_t i, lost, delivered = 0;
+
+	event_capture_init();
+	event_capture_set_debounce(0, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < events; i++) {
+		event_capture_push(0, i & 1, i);
+		if ((i % 12) == 11) {
+			event_capture_process();
+			delivered += take_report(records, &lost);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	check(delivered == events - (events % 12), "host loop delivers every event");
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / events;
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t rates[] = { 1000, 5000, 10000, 12000, 15000, 50000, 200000, 640000, 1000000 };
+	const event_capture_stats_t *st;
+	load_result_t r;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			loop_us = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p loop_us] [-s seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((loop_us == 0) || (seconds == 0)) {
+		fprintf(stderr, "loop time and duration must be non zero\n");
+		return 1;
+	}
+
+	test_bouncing_presses();
+	test_timer_wrap();
+	test_lost_reporting();
+
+	printf("main loop pass every %u us, one report of %u records per ms\n\n", loop_us,
+		   (REPORT_LEN - EVENT_REPORT_HEADER_SIZE) / EVENT_RECORD_SIZE);
+	printf("edges/s  delivered/s  raw overflow  report drops\n");
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		run_load(rates[i], &r);
+		st = event_capture_get_stats();
+		// Every edge is either delivered, still queued, or counted as lost.
+		check(r.pushed == st->raw, "every edge pushed");
+		check(r.delivered + st->overflow + st->dropped <= r.pushed, "no event delivered twice");
+		printf("%7u %12.0f %13u %13u\n", rates[i], (double) r.delivered / seconds, st->overflow, st->dropped);
+	}
+
+	printf("\nhost: %.1f ns per event through push, process and report\n", host_ns_per_event());
+
+	printf("\nevent_capture checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
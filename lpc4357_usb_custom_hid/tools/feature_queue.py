@@ -0,0 +1,174 @@
+# Queued feature report requests, sent back to back from a worker thread.
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import collections
+import concurrent.futures
+import struct
+import threading
+
+from custom_hid import HID_REPORT_MAX_SIZE, HID_REPORT_ID_LED, HID_REPORT_ID_EVENTS
+
+_SET = 0
+_GET = 1
+
+
+class _Request:
+    __slots__ = ("kind", "report_id", "payload", "key", "future", "done", "result", "error", "merged")
+
+    def __init__(self, kind, report_id, payload, key):
+        self.kind = kind
+        self.report_id = report_id
+        self.payload = payload
+        self.key = key
+        self.future = concurrent.futures.Future()
+        self.done = False
+        self.result = None
+        self.error = None
+        # Later sets folded into this one, completed with it.
+        self.merged = []
+
+
+class FeatureQueue:
+    """Feature report requests of one device, queued without waiting.
+
+    A worker thread sends them one after the other as fast as the control
+    pipe takes them, callers get futures. Futures complete, and callbacks
+    added to them run, in the order requests were queued.
+
+    Sets given a coalesce key replace a queued set with the same key that
+    has not gone out yet, the device only sees the latest value. Use it
+    for settings, not for commands. Any other request for the same report
+    ID queued in between keeps them apart.
+    """
+
+    def __init__(self, hid):
+        self.hid = hid
+        self.sent = 0
+        self.coalesced = 0
+        self._lock = threading.Condition()
+        self._pending = collections.deque()
+        self._order = collections.deque()
+        self._by_key = {}
+        self._closing = False
+        self._thread = threading.Thread(target=self._run)
+        self._thread.start()
+
+    def set_feature(self, report_id, payload, coalesce=None):
+        payload = bytes(payload)
+        with self._lock:
+            queued = self._by_key.get(coalesce) if coalesce is not None else None
+            if queued is not None:
+                queued.payload = payload
+                request = _Request(_SET, report_id, payload, coalesce)
+                queued.merged.append(request)
+                self._order.append(request)
+                self.coalesced += 1
+                return request.future
+            return self._queue(_Request(_SET, report_id, payload, coalesce))
+
+    def get_feature(self, report_id, length=HID_REPORT_MAX_SIZE):
+        with self._lock:
+            return self._queue(_Request(_GET, report_id, length, None))
+
+    def set_led4_blink_rate(self, rate_hz):
+        return self.set_feature(HID_REPORT_ID_LED, [rate_hz], coalesce=HID_REPORT_ID_LED)
+
+    def set_event_debounce(self, channel, debounce_ms):
+        return self.set_feature(HID_REPORT_ID_EVENTS, struct.pack("<BH", channel, debounce_ms),
+                                coalesce=(HID_REPORT_ID_EVENTS, channel))
+
+    def flush(self, timeout=None):
+        """Wait until everything queued so far completed."""
+        with self._lock:
+            if not self._order:
+                return
+            last = self._order[-1].future
+        concurrent.futures.wait([last], timeout)
+
+    def close(self):
+        with self._lock:
+            self._closing = True
+            self._lock.notify()
+        self._thread.join()
+
+    def _queue(self, request):
+        # Called with the lock held.
+        if self._closing:
+            raise Exception("Feature queue closed")
+        if request.key is None:
+            # Later sets must not jump over this request.
+            for key in [k for k, r in self._by_key.items() if r.report_id == request.report_id]:
+                del self._by_key[key]
+        else:
+            self._by_key[request.key] = request
+        self._pending.append(request)
+        self._order.append(request)
+        self._lock.notify()
+        return request.future
+
+    def _run(self):
+        while True:
+            with self._lock:
+                while not self._pending and not self._closing:
+                    self._lock.wait()
+                if not self._pending:
+                    break
+                request = self._pending.popleft()
+                if self._by_key.get(request.key) is request:
+                    del self._by_key[request.key]
+
+            try:
+                if request.kind == _SET:
+                    self.hid._set_feature(request.report_id, request.payload)
+                else:
+                    request.result = bytes(self.hid._get_feature(request.report_id, request.payload))
+            except Exception as e:
+                request.error = e
+
+            with self._lock:
+                self.sent += 1
+                request.done = True
+                for merged in request.merged:
+                    merged.done = True
+                    merged.error = request.error
+                completed = []
+                while self._order and self._order[0].done:
+                    completed.append(self._order.popleft())
+            self._complete(completed)
+
+        error = Exception("Feature queue closed")
+        for request in self._order:
+            request.error = error
+        self._complete(self._order)
+
+    @staticmethod
+    def _complete(requests):
+        for request in requests:
+            if request.future.cancelled():
+                continue
+            if request.error is not None:
+                request.future.set_exception(request.error)
+            else:
+                request.future.set_result(request.result)
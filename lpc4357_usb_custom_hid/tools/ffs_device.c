@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Virtual board as a USB device on the Linux gadget stack, Linux only.
+ *
+ * Creates a configfs gadget with the device IDs, strings and HID interface
+ * of hid_desc.c, serves the interface through FunctionFS and binds it to a
+ * UDC. With dummy_hcd the device shows up on the same machine, host tools
+ * then go through usbhid or libusb and the kernel USB core, interrupt
+ * endpoints are polled at their descriptor intervals. Reports are handled
+ * by the firmware code in emu_board.c.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o ffs_device -DCORE_M4 -D__USE_LPCOPEN -D__LPC43XX__ \
+ *       -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast \
+ *       -I../lpc_chip_43xx/inc -I../lpc_chip_43xx/inc/usbd_rom \
+ *       -I../lpc_chip_43xx/inc/config_43xx -I../lpc4357_xplorer_plusplus_board/inc \
+ *       -Iinc -Itools tools/ffs_device.c tools/emu_board.c src/hid_generic.c \
+ *       src/hid_desc.c src/hid_rpc.c src/hid_batch.c src/credit_flow.c \
+ *       src/event_capture.c ../lpc_chip_43xx/src/ring_buffer.c -lpthread
+ * $ sudo modprobe libcomposite && sudo modprobe dummy_hcd
+ * $ sudo ./ffs_device [-s serial] [-e sw2_per_second] [-u udc]
+ *
+ * Gadget is removed on exit. Only the HID interface is served, mass storage,
+ * CDC and DFU are left out.
+ */
+
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "emu_board.h"
+
+// After chip headers, libc macros clash with register names.
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/usb/functionfs.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GADGET_NAME		"lpc4357_hid"
+#define GADGET_DIR		"/sys/kernel/config/usb_gadget/" GADGET_NAME
+#define FFS_DIR			"/dev/ffs-" GADGET_NAME
+
+/* HID interface, class descriptor and two endpoints */
+#define HID_DESCS_MAX	64
+
+typedef struct {
+	uint8_t data[HID_DESCS_MAX];
+	uint32_t length;
+	uint32_t count;
+} desc_set_t;
+
+static volatile sig_atomic_t quit;
+static int ep0_fd = -1;
+static int ep_in_fd = -1;
+static int ep_out_fd = -1;
+
+/* Serializes calls into the board, as the USB interrupt does on the board */
+static pthread_mutex_t board_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t board_cond = PTHREAD_COND_INITIALIZER;
+static bool enabled;
+
+static pthread_t in_th, out_th;
+static volatile bool in_running, out_running;
+
+static desc_set_t fs_descs, hs_descs;
+
+static bool write_attr(const char *path, const char *fmt, ...) {
+	char value[128];
+	va_list ap;
+	int fd, len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(value, sizeof(value), fmt, ap);
+	va_end(ap);
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+	if (write(fd, value, len) != len) {
+		perror(path);
+		close(fd);
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+/* HID interface of a configuration descriptor, renumbered as interface 0. */
+static bool hid_descriptors(const uint8_t *config, desc_set_t *set, uint8_t *in_index) {
+	const uint8_t *desc = config;
+	const uint8_t *end = config + (config[2] | (config[3] << 8));
+	uint8_t endpoints = 0;
+	bool inside = false;
+
+	set->length = 0;
+	set->count = 0;
+	for (; (desc < end) && (desc[0] > 0); desc += desc[0]) {
+		if ((desc[1] == USB_INTERFACE_DESCRIPTOR_TYPE) || (desc[1] == USB_INTERFACE_ASSOCIATION_DESCRIPTOR_TYPE)) {
+			if (inside) {
+				break;
+			}
+			inside = (desc[1] == USB_INTERFACE_DESCRIPTOR_TYPE) && (desc[5] == USB_DEVICE_CLASS_HUMAN_INTERFACE);
+		}
+		if (!inside) {
+			continue;
+		}
+		if (set->length + desc[0] > sizeof(set->data)) {
+			return false;
+		}
+		memcpy(&set->data[set->length], desc, desc[0]);
+		if (desc[1] == USB_INTERFACE_DESCRIPTOR_TYPE) {
+			// FunctionFS numbers interfaces itself and carries no strings here.
+			set->data[set->length + 2] = 0;
+			set->data[set->length + 8] = 0;
+		}
+		if (desc[1] == USB_ENDPOINT_DESCRIPTOR_TYPE) {
+			if (desc[2] & 0x80) {
+				*in_index = endpoints;
+			}
+			endpoints++;
+		}
+		set->length += desc[0];
+		set->count++;
+	}
+	return endpoints == 2;
+}
+
+static bool ffs_write_descriptors(void) {
+	struct {
+		struct usb_functionfs_descs_head_v2 header;
+		__le32 fs_count;
+		__le32 hs_count;
+		uint8_t data[2 * HID_DESCS_MAX];
+	} __attribute__((packed)) descs;
+	struct usb_functionfs_strings_head strings;
+	uint32_t length;
+
+	length = sizeof(descs.header) + 2 * sizeof(__le32) + fs_descs.length + hs_descs.length;
+	descs.header.magic = htole32(FUNCTIONFS_DESCRIPTORS_MAGIC_V2);
+	descs.header.length = htole32(length);
+	descs.header.flags = htole32(FUNCTIONFS_HAS_FS_DESC | FUNCTIONFS_HAS_HS_DESC);
+	descs.fs_count = htole32(fs_descs.count);
+	descs.hs_count = htole32(hs_descs.count);
+	memcpy(descs.data, fs_descs.data, fs_descs.length);
+	memcpy(&descs.data[fs_descs.length], hs_descs.data, hs_descs.length);
+
+	strings.magic = htole32(FUNCTIONFS_STRINGS_MAGIC);
+	strings.length = htole32(sizeof(strings));
+	strings.str_count = 0;
+	strings.lang_count = 0;
+
+	if ((write(ep0_fd, &descs, length) != (ssize_t) length) ||
+		(write(ep0_fd, &strings, sizeof(strings)) != sizeof(strings))) {
+		perror(FFS_DIR "/ep0");
+		return false;
+	}
+	return true;
+}
+
+static void gadget_remove(void) {
+	struct stat st;
+
+	if (stat(GADGET_DIR, &st) < 0) {
+		return;
+	}
+	write_attr(GADGET_DIR "/UDC", "\n");
+	umount(FFS_DIR);
+	rmdir(FFS_DIR);
+	unlink(GADGET_DIR "/configs/c.1/ffs." GADGET_NAME);
+	rmdir(GADGET_DIR "/configs/c.1/strings/0x409");
+	rmdir(GADGET_DIR "/configs/c.1");
+	rmdir(GADGET_DIR "/functions/ffs." GADGET_NAME);
+	rmdir(GADGET_DIR "/strings/0x409");
+	rmdir(GADGET_DIR);
+}
+
+static bool gadget_create(const char *serial) {
+	const uint8_t *dev = emu_board_device_descriptor();
+	const uint8_t *config = emu_board_config_descriptor(false);
+	char str[64];
+
+	if ((mkdir(GADGET_DIR, 0755) < 0) ||
+		(mkdir(GADGET_DIR "/strings/0x409", 0755) < 0) ||
+		(mkdir(GADGET_DIR "/configs/c.1", 0755) < 0) ||
+		(mkdir(GADGET_DIR "/configs/c.1/strings/0x409", 0755) < 0) ||
+		(mkdir(GADGET_DIR "/functions/ffs." GADGET_NAME, 0755) < 0)) {
+		perror(GADGET_DIR);
+		return false;
+	}
+
+	if (!write_attr(GADGET_DIR "/idVendor", "0x%04x", dev[8] | (dev[9] << 8)) ||
+		!write_attr(GADGET_DIR "/idProduct", "0x%04x", dev[10] | (dev[11] << 8)) ||
+		!write_attr(GADGET_DIR "/bcdDevice", "0x%04x", dev[12] | (dev[13] << 8)) ||
+		!write_attr(GADGET_DIR "/bcdUSB", "0x%04x", dev[2] | (dev[3] << 8))) {
+		return false;
+	}
+	emu_board_string(1, str, sizeof(str));
+	if (!write_attr(GADGET_DIR "/strings/0x409/manufacturer", "%s", str)) {
+		return false;
+	}
+	emu_board_string(2, str, sizeof(str));
+	if (!write_attr(GADGET_DIR "/strings/0x409/product", "%s", str) ||
+		!write_attr(GADGET_DIR "/strings/0x409/serialnumber", "%s", serial)) {
+		return false;
+	}
+	if (!write_attr(GADGET_DIR "/configs/c.1/bmAttributes", "0x%02x", config[7]) ||
+		!write_attr(GADGET_DIR "/configs/c.1/MaxPower", "%u", config[8] * 2) ||
+		!write_attr(GADGET_DIR "/configs/c.1/strings/0x409/configuration", "HID")) {
+		return false;
+	}
+	if (symlink(GADGET_DIR "/functions/ffs." GADGET_NAME, GADGET_DIR "/configs/c.1/ffs." GADGET_NAME) < 0) {
+		perror("configs/c.1");
+		return false;
+	}
+
+	if (((mkdir(FFS_DIR, 0755) < 0) && (errno != EEXIST)) ||
+		(mount(GADGET_NAME, FFS_DIR, "functionfs", 0, NULL) < 0)) {
+		perror(FFS_DIR);
+		return false;
+	}
+	return true;
+}
+
+/* First UDC unless one was given, dummy_udc.0 with dummy_hcd. */
+static bool gadget_bind(const char *udc) {
+	struct dirent *entry;
+	char name[256] = "";
+	DIR *dir;
+
+	if (udc == NULL) {
+		dir = opendir("/sys/class/udc");
+		if (dir != NULL) {
+			while ((entry = readdir(dir)) != NULL) {
+				if (entry->d_name[0] != '.') {
+					snprintf(name, sizeof(name), "%s", entry->d_name);
+					break;
+				}
+			}
+			closedir(dir);
+		}
+		if (name[0] == '\0') {
+			fprintf(stderr, "no UDC, load dummy_hcd\n");
+			return false;
+		}
+		udc = name;
+	}
+	printf("Bound to %s\n", udc);
+	return write_attr(GADGET_DIR "/UDC", "%s", udc);
+}
+
+/* Interrupt IN endpoint, a write completes when the host polled the report. */
+static void *in_thread(void *arg) {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+	uint32_t length = 0;
+
+	while (!quit) {
+		pthread_mutex_lock(&board_lock);
+		while (!quit && (!enabled || ((length = emu_board_in_take(report)) == 0))) {
+			pthread_cond_wait(&board_cond, &board_lock);
+		}
+		pthread_mutex_unlock(&board_lock);
+
+		// Report is lost if the endpoint goes down meanwhile, as on a bus reset.
+		if (!quit && (write(ep_in_fd, report, length) < 0) && (errno != EINTR) && (errno != ESHUTDOWN)) {
+			perror("IN endpoint");
+			usleep(100000);
+		}
+	}
+	in_running = false;
+	return NULL;
+}
+
+static void *out_thread(void *arg) {
+	uint8_t report[HID_REPORT_MAX_SIZE];
+	ssize_t length;
+
+	while (!quit) {
+		length = read(ep_out_fd, report, sizeof(report));
+		if (length <= 0) {
+			if ((length < 0) && (errno != EINTR) && (errno != ESHUTDOWN)) {
+				perror("OUT endpoint");
+				usleep(100000);
+			}
+			continue;
+		}
+		pthread_mutex_lock(&board_lock);
+		emu_board_out_report(report, length);
+		pthread_cond_broadcast(&board_cond);
+		pthread_mutex_unlock(&board_lock);
+	}
+	out_running = false;
+	return NULL;
+}
+
+static void ep0_stall(bool in) {
+	// FunctionFS stalls a request on I/O in the wrong direction, the call
+	// fails with EL2HLT once the stall went out.
+	ssize_t ret = in ? read(ep0_fd, NULL, 0) : write(ep0_fd, NULL, 0);
+
+	(void) ret;
+}
+
+static void ep0_setup(const struct usb_ctrlrequest *setup) {
+	uint8_t data[HID_REPORT_MAX_SIZE];
+	const uint8_t *reply = data;
+	uint16_t value = le16toh(setup->wValue);
+	uint16_t length = le16toh(setup->wLength);
+	uint16_t reply_length = 0;
+	uint8_t type = (setup->bRequestType >> 5) & 0x03;
+	ssize_t received;
+	bool ok = false;
+
+	if (setup->bRequestType & USB_DIR_IN) {
+		if ((type == REQUEST_STANDARD) && (setup->bRequest == USB_REQUEST_GET_DESCRIPTOR) &&
+			((value >> 8) == HID_REPORT_DESCRIPTOR_TYPE)) {
+			reply = emu_board_report_descriptor(&reply_length);
+			ok = true;
+		}
+		else if ((type == REQUEST_STANDARD) && (setup->bRequest == USB_REQUEST_GET_DESCRIPTOR) &&
+				 ((value >> 8) == HID_HID_DESCRIPTOR_TYPE)) {
+			reply = &fs_descs.data[fs_descs.data[0]];
+			reply_length = reply[0];
+			ok = true;
+		}
+		else if ((type == REQUEST_CLASS) && (setup->bRequest == HID_REQUEST_GET_REPORT)) {
+			pthread_mutex_lock(&board_lock);
+			ok = emu_board_get_report(value >> 8, value & 0xFF, data, &reply_length);
+			pthread_mutex_unlock(&board_lock);
+		}
+		else if ((type == REQUEST_CLASS) && (setup->bRequest == HID_REQUEST_GET_IDLE)) {
+			data[0] = 0;
+			reply_length = 1;
+			ok = true;
+		}
+
+		if (!ok) {
+			ep0_stall(true);
+		}
+		else if (write(ep0_fd, reply, MIN(reply_length, length)) < 0) {
+			perror("ep0");
+		}
+		return;
+	}
+
+	if ((type == REQUEST_CLASS) && (setup->bRequest == HID_REQUEST_SET_REPORT) && (length <= sizeof(data))) {
+		// Data stage is acknowledged by reading it, refusal can only be counted.
+		received = read(ep0_fd, data, length);
+		if (received < 0) {
+			perror("ep0");
+			return;
+		}
+		pthread_mutex_lock(&board_lock);
+		emu_board_set_report(value >> 8, data, received);
+		pthread_cond_broadcast(&board_cond);
+		pthread_mutex_unlock(&board_lock);
+	}
+	else if ((type == REQUEST_CLASS) && (length == 0) &&
+			 ((setup->bRequest == HID_REQUEST_SET_IDLE) || (setup->bRequest == HID_REQUEST_SET_PROTOCOL))) {
+		if (read(ep0_fd, NULL, 0) < 0) {
+			perror("ep0");
+		}
+	}
+	else {
+		ep0_stall(false);
+	}
+}
+
+static bool ep0_events(void) {
+	struct usb_functionfs_event events[4];
+	ssize_t ret;
+	int i;
+
+	ret = read(ep0_fd, events, sizeof(events));
+	if (ret < 0) {
+		return (errno == EINTR) || (errno == EAGAIN);
+	}
+
+	for (i = 0; i < (int) (ret / sizeof(events[0])); i++) {
+		switch (events[i].type) {
+		case FUNCTIONFS_ENABLE:
+			// Host configured the device and polls the interrupt IN endpoint.
+			pthread_mutex_lock(&board_lock);
+			enabled = true;
+			emu_board_connect(true);
+			pthread_cond_broadcast(&board_cond);
+			pthread_mutex_unlock(&board_lock);
+			printf("Configured\n");
+			break;
+		case FUNCTIONFS_DISABLE:
+		case FUNCTIONFS_UNBIND:
+			pthread_mutex_lock(&board_lock);
+			enabled = false;
+			emu_board_connect(false);
+			pthread_mutex_unlock(&board_lock);
+			break;
+		case FUNCTIONFS_SETUP:
+			ep0_setup(&events[i].u.setup);
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+static void stop_thread(pthread_t thread, volatile bool *running) {
+	// Interrupts a blocked endpoint read or write until the thread saw quit.
+	while (*running) {
+		pthread_kill(thread, SIGUSR1);
+		usleep(10000);
+	}
+	pthread_join(thread, NULL);
+}
+
+static void stop(int sig) {
+	quit = 1;
+}
+
+static void wake(int sig) {
+}
+
+int main(int argc, char *argv[]) {
+	const char *serial = "FFS00001";
+	const char *udc = NULL;
+	const emu_board_stats_t *stats = emu_board_get_stats();
+	struct sigaction sa;
+	struct pollfd pfd;
+	uint32_t sw2_interval_us = 0, next_sw2_us = 0;
+	uint8_t in_index = 0, hs_in_index = 0;
+	char path[64];
+	int32_t wait_us;
+	double rate;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:e:u:")) != -1) {
+		switch (opt) {
+		case 's':
+			serial = optarg;
+			break;
+		case 'e':
+			rate = strtod(optarg, NULL);
+			sw2_interval_us = (rate > 0) ? (uint32_t) (1000000 / rate) : 0;
+			break;
+		case 'u':
+			udc = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s serial] [-e sw2_per_second] [-u udc]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!emu_board_init() ||
+		!hid_descriptors(emu_board_config_descriptor(false), &fs_descs, &in_index) ||
+		!hid_descriptors(emu_board_config_descriptor(true), &hs_descs, &hs_in_index) ||
+		(in_index != hs_in_index)) {
+		fprintf(stderr, "no HID interface\n");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	// No SA_RESTART, endpoint I/O returns EINTR.
+	sa.sa_handler = wake;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	gadget_remove();
+	if (!gadget_create(serial)) {
+		goto remove;
+	}
+
+	ep0_fd = open(FFS_DIR "/ep0", O_RDWR);
+	if ((ep0_fd < 0) || !ffs_write_descriptors()) {
+		perror(FFS_DIR "/ep0");
+		goto remove;
+	}
+	// Endpoint files follow descriptor order, IN and OUT in either order.
+	snprintf(path, sizeof(path), FFS_DIR "/ep%u", in_index + 1);
+	ep_in_fd = open(path, O_RDWR);
+	snprintf(path, sizeof(path), FFS_DIR "/ep%u", (in_index == 0) ? 2 : 1);
+	ep_out_fd = open(path, O_RDWR);
+	if ((ep_in_fd < 0) || (ep_out_fd < 0)) {
+		perror(FFS_DIR);
+		goto remove;
+	}
+
+	in_running = true;
+	out_running = true;
+	pthread_create(&in_th, NULL, in_thread, NULL);
+	pthread_create(&out_th, NULL, out_thread, NULL);
+
+	if (gadget_bind(udc)) {
+		ret = 0;
+		next_sw2_us = emu_board_now_us() + sw2_interval_us;
+		pfd.fd = ep0_fd;
+		pfd.events = POLLIN;
+		while (!quit) {
+			wait_us = -1;
+			if (sw2_interval_us > 0) {
+				wait_us = MAX((int32_t) (next_sw2_us - emu_board_now_us()), 0);
+			}
+			if (poll(&pfd, 1, (wait_us < 0) ? -1 : (int) ((wait_us + 999) / 1000)) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("poll");
+				break;
+			}
+			if ((pfd.revents & POLLIN) && !ep0_events()) {
+				perror("ep0");
+				break;
+			}
+			if ((sw2_interval_us > 0) && ((int32_t) (next_sw2_us - emu_board_now_us()) <= 0)) {
+				pthread_mutex_lock(&board_lock);
+				emu_board_sw2_press();
+				pthread_cond_broadcast(&board_cond);
+				pthread_mutex_unlock(&board_lock);
+				next_sw2_us += sw2_interval_us;
+			}
+		}
+	}
+
+	quit = 1;
+	pthread_mutex_lock(&board_lock);
+	pthread_cond_broadcast(&board_cond);
+	pthread_mutex_unlock(&board_lock);
+	stop_thread(in_th, &in_running);
+	stop_thread(out_th, &out_running);
+
+remove:
+	if (ep_in_fd >= 0) {
+		close(ep_in_fd);
+	}
+	if (ep_out_fd >= 0) {
+		close(ep_out_fd);
+	}
+	// Unbinding first, FunctionFS cannot be unmounted while bound.
+	write_attr(GADGET_DIR "/UDC", "\n");
+	if (ep0_fd >= 0) {
+		close(ep0_fd);
+	}
+	gadget_remove();
+
+	printf("%u input, %u output, %u get report, %u set report, %u stalled, %u SW2\n",
+		   stats->input, stats->output, stats->get_report, stats->set_report, stats->stalled, stats->sw2);
+	return ret;
+}
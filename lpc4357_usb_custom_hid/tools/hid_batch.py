@@ -0,0 +1,129 @@
+# Batched commands in HID_REPORT_ID_BATCH output reports
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import struct
+import time
+
+from custom_hid import HID_REPORT_MAX_SIZE, HID_REPORT_ID_LED, HID_REPORT_ID_BATCH
+
+# Must match hid_batch.h
+BATCH_VERSION = 1
+BATCH_OP_END = 0x00
+BATCH_OP_LED = 0x01
+BATCH_OP_BLINK_RATE = 0x02
+BATCH_OP_DEBOUNCE = 0x03
+BATCH_OP_FEATURE = 0x04
+BATCH_LED5 = 1
+BATCH_MAX_STREAM = HID_REPORT_MAX_SIZE - 1
+BATCH_STATS_FIELDS = ("reports", "commands", "refused", "malformed")
+
+
+class BatchEncoder:
+    """Commands collected into as few output reports as they fit in.
+
+    Device runs the commands of a report in order, reports in the order
+    they are sent. A command is never split over two reports, so each
+    report stands on its own. Nothing goes out before send().
+    """
+
+    def __init__(self):
+        self._commands = []
+
+    def __len__(self):
+        return len(self._commands)
+
+    def _add(self, op, args):
+        command = bytes([op]) + bytes(args)
+        if len(command) > BATCH_MAX_STREAM:
+            raise Exception("Batch command longer than {0} bytes".format(BATCH_MAX_STREAM))
+        self._commands.append(command)
+        return self
+
+    def led5(self, on):
+        return self._add(BATCH_OP_LED, [BATCH_LED5, 1 if on else 0])
+
+    def blink_rate(self, rate_hz):
+        return self._add(BATCH_OP_BLINK_RATE, [rate_hz])
+
+    def debounce(self, channel, debounce_ms):
+        return self._add(BATCH_OP_DEBOUNCE, struct.pack("<BH", channel, debounce_ms))
+
+    def set_feature(self, report_id, payload):
+        """Feature report write, same payload as the SET_REPORT request."""
+        feature = bytes([report_id]) + bytes(payload)
+        return self._add(BATCH_OP_FEATURE, bytes([len(feature)]) + feature)
+
+    def reports(self):
+        """Output reports holding all commands, zero padding ends each one."""
+        reports = []
+        stream = b""
+        for command in self._commands:
+            if len(stream) + len(command) > BATCH_MAX_STREAM:
+                reports.append(stream)
+                stream = b""
+            stream += command
+        if stream:
+            reports.append(stream)
+        return [bytes([HID_REPORT_ID_BATCH]) + s + bytes(BATCH_MAX_STREAM - len(s))
+                for s in reports]
+
+    def send(self, hid):
+        """Writes the reports and starts over, returns the number of reports."""
+        reports = self.reports()
+        for report in reports:
+            hid.ep_out.write(report)
+        self._commands = []
+        return len(reports)
+
+
+def get_batch_status(hid):
+    version, num_ops, _, _, *stats = struct.unpack_from(
+        "<BBBB{0}I".format(len(BATCH_STATS_FIELDS)),
+        bytes(hid._get_feature(HID_REPORT_ID_BATCH, HID_REPORT_MAX_SIZE)), 1)
+    return dict(version=version, ops=num_ops, stats=dict(zip(BATCH_STATS_FIELDS, stats)))
+
+
+def benchmark(hid, count=1000):
+    """Commands per second of count LED5 writes, one per report and batched.
+
+    Returns (single rate, batched rate, reports sent batched). Commands
+    the device ran are checked against its statistics.
+    """
+    began = time.monotonic()
+    for i in range(count):
+        hid.ep_out.write([HID_REPORT_ID_LED, i & 1])
+    single = count / (time.monotonic() - began)
+
+    before = get_batch_status(hid)["stats"]["commands"]
+    encoder = BatchEncoder()
+    began = time.monotonic()
+    for i in range(count):
+        encoder.led5(i & 1)
+    reports = encoder.send(hid)
+    after = get_batch_status(hid)["stats"]["commands"]
+    batched = count / (time.monotonic() - began)
+    if after - before != count:
+        raise Exception("Device ran {0} of {1} batched commands".format(after - before, count))
+    return single, batched, reports
@@ -0,0 +1,371 @@
+# Capture and replay of HID reports in an indexed append-only file.
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import bisect
+import mmap
+import os
+import struct
+import threading
+import time
+
+# File layout, little endian:
+#   header   magic, version, start wall clock ns
+#   records  t_ns (since start, monotonic), kind, report ID, length, report
+#   index    record of kind CAPTURE_INDEX every CAPTURE_INDEX_ENTRIES
+#            checkpoints: previous index offset, then (seq, t_ns, offset) of
+#            every CAPTURE_CHECKPOINT_INTERVAL th report
+#   footer   written on close: magic, last index offset, report count
+# A file cut short by a crash has no footer and is indexed by a scan.
+CAPTURE_MAGIC = b"HIDCAP01"
+CAPTURE_FOOTER_MAGIC = b"HIDCAPIX"
+CAPTURE_VERSION = 1
+
+_HEADER = struct.Struct("<8sHHIQ")
+_RECORD = struct.Struct("<QBBH")
+_INDEX_ENTRY = struct.Struct("<QQQ")
+_INDEX_PREV = struct.Struct("<Q")
+_FOOTER = struct.Struct("<8sQQ")
+
+CAPTURE_IN = 0
+CAPTURE_OUT = 1
+CAPTURE_SET_FEATURE = 2
+CAPTURE_GET_FEATURE = 3
+CAPTURE_INDEX = 0xFF
+CAPTURE_KIND_NAMES = {CAPTURE_IN: "in", CAPTURE_OUT: "out",
+                      CAPTURE_SET_FEATURE: "set", CAPTURE_GET_FEATURE: "get"}
+
+CAPTURE_CHECKPOINT_INTERVAL = 256
+CAPTURE_INDEX_ENTRIES = 64
+
+
+def _now_ns():
+    return int(time.monotonic() * 1e9)
+
+
+class CaptureWriter:
+    """Appends reports to a capture file, safe to call from several threads."""
+
+    def __init__(self, path):
+        self._file = open(path, "wb")
+        self._lock = threading.Lock()
+        self._start = _now_ns()
+        self._offset = 0
+        self._seq = 0
+        self._checkpoints = []
+        self._last_index = 0
+        self._write(_HEADER.pack(CAPTURE_MAGIC, CAPTURE_VERSION, 0, 0, int(time.time() * 1e9)))
+
+    def _write(self, data):
+        self._file.write(data)
+        self._offset += len(data)
+
+    def add(self, kind, report, t_ns=None):
+        report = bytes(report)
+        if t_ns is None:
+            t_ns = _now_ns() - self._start
+        with self._lock:
+            if self._file is None:
+                return
+            if self._seq % CAPTURE_CHECKPOINT_INTERVAL == 0:
+                self._checkpoints.append(_INDEX_ENTRY.pack(self._seq, t_ns, self._offset))
+            self._write(_RECORD.pack(t_ns, kind, report[0] if report else 0, len(report)) + report)
+            self._seq += 1
+            if len(self._checkpoints) == CAPTURE_INDEX_ENTRIES:
+                self._write_index(t_ns)
+
+    def _write_index(self, t_ns):
+        payload = _INDEX_PREV.pack(self._last_index) + b"".join(self._checkpoints)
+        self._last_index = self._offset
+        self._checkpoints = []
+        self._write(_RECORD.pack(t_ns, CAPTURE_INDEX, 0, len(payload)) + payload)
+        # Everything up to an index survives a crash.
+        self._file.flush()
+
+    def close(self):
+        with self._lock:
+            if self._file is None:
+                return
+            self._write_index(_now_ns() - self._start)
+            self._write(_FOOTER.pack(CAPTURE_FOOTER_MAGIC, self._last_index, self._seq))
+            self._file.close()
+            self._file = None
+
+
+class CaptureFile:
+    """Memory mapped capture, reports are looked up by number or time.
+
+    Records are (t_ns, kind, report), report is a memoryview into the file.
+    """
+
+    def __init__(self, path):
+        self._file = open(path, "rb")
+        self._map = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, _, _, self.start_wall_ns = _HEADER.unpack_from(self._map, 0)
+        if magic != CAPTURE_MAGIC or version != CAPTURE_VERSION:
+            raise Exception("{0} is not a HID capture".format(path))
+        self._view = memoryview(self._map)
+        self._end = len(self._map)
+        self.complete = False
+        if self._end >= _HEADER.size + _FOOTER.size:
+            magic, last_index, count = _FOOTER.unpack_from(self._map, self._end - _FOOTER.size)
+            if magic == CAPTURE_FOOTER_MAGIC:
+                self._end -= _FOOTER.size
+                self._load_index(last_index)
+                self._count = count
+                self.complete = True
+        if not self.complete:
+            self._scan()
+        self._seqs = [c[0] for c in self._checkpoints]
+        self._times = [c[1] for c in self._checkpoints]
+
+    def _load_index(self, offset):
+        blocks = []
+        while offset:
+            _, kind, _, length = _RECORD.unpack_from(self._map, offset)
+            if kind != CAPTURE_INDEX:
+                raise Exception("Broken capture index at {0}".format(offset))
+            payload = offset + _RECORD.size
+            entries = [_INDEX_ENTRY.unpack_from(self._map, pos)
+                       for pos in range(payload + _INDEX_PREV.size, payload + length, _INDEX_ENTRY.size)]
+            blocks.append(entries)
+            offset = _INDEX_PREV.unpack_from(self._map, payload)[0]
+        self._checkpoints = [entry for entries in reversed(blocks) for entry in entries]
+
+    def _scan(self):
+        # No footer, checkpoints are rebuilt and a torn last record is ignored.
+        self._checkpoints = []
+        seq = 0
+        offset = _HEADER.size
+        while offset + _RECORD.size <= self._end:
+            t_ns, kind, _, length = _RECORD.unpack_from(self._map, offset)
+            if offset + _RECORD.size + length > self._end:
+                break
+            if kind != CAPTURE_INDEX:
+                if seq % CAPTURE_CHECKPOINT_INTERVAL == 0:
+                    self._checkpoints.append((seq, t_ns, offset))
+                seq += 1
+            offset += _RECORD.size + length
+        self._end = offset
+        self._count = seq
+
+    def __len__(self):
+        return self._count
+
+    def _walk(self, seq):
+        # Records from seq onwards, starting at the checkpoint before it.
+        i = bisect.bisect_right(self._seqs, seq) - 1
+        if i < 0:
+            return
+        at, _, offset = self._checkpoints[i]
+        while offset + _RECORD.size <= self._end:
+            t_ns, kind, _, length = _RECORD.unpack_from(self._map, offset)
+            start = offset + _RECORD.size
+            offset = start + length
+            if kind == CAPTURE_INDEX:
+                continue
+            if at >= seq:
+                yield t_ns, kind, self._view[start:offset]
+            at += 1
+            if at >= self._count:
+                return
+
+    def __getitem__(self, seq):
+        if seq < 0:
+            seq += self._count
+        if not 0 <= seq < self._count:
+            raise IndexError(seq)
+        return next(self._walk(seq))
+
+    def records(self, start=0, count=None):
+        for n, record in enumerate(self._walk(start)):
+            if count is not None and n >= count:
+                return
+            yield record
+
+    def seek_time(self, t_ns):
+        """Number of the first report at or after t_ns."""
+        i = max(bisect.bisect_right(self._times, t_ns) - 1, 0)
+        if not self._checkpoints:
+            return 0
+        seq = self._checkpoints[i][0]
+        for record in self._walk(seq):
+            if record[0] >= t_ns:
+                return seq
+            seq += 1
+        return seq
+
+    def duration_ns(self):
+        return self[-1][0] if self._count else 0
+
+    def close(self):
+        # Reports still referenced keep the mapping until they are dropped.
+        try:
+            self._view.release()
+            self._map.close()
+        except BufferError:
+            pass
+        self._file.close()
+
+
+class _CaptureEndpoint:
+    # Records output reports as they go on the wire, after encryption.
+    def __init__(self, writer, ep_out):
+        self.writer = writer
+        self.ep_out = ep_out
+
+    def write(self, report):
+        self.writer.add(CAPTURE_OUT, report)
+        return self.ep_out.write(report)
+
+
+def attach_capture(hid, path):
+    """Record all reports of a CustomHID, CustomCDC or CustomHIDRaw.
+
+    Input and output reports are recorded as on the wire, encrypted if a
+    session runs. Returns the CaptureWriter, close it when done.
+    """
+    writer = CaptureWriter(path)
+    handle_in_report = hid._handle_in_report
+    set_feature = hid._set_feature
+    get_feature = hid._get_feature
+
+    def _handle_in_report(report):
+        if len(report) > 0:
+            writer.add(CAPTURE_IN, report)
+        handle_in_report(report)
+
+    def _set_feature(report_id, payload):
+        writer.add(CAPTURE_SET_FEATURE, bytes([report_id]) + bytes(payload))
+        set_feature(report_id, payload)
+
+    def _get_feature(report_id, length, *args, **kwargs):
+        report = get_feature(report_id, length, *args, **kwargs)
+        writer.add(CAPTURE_GET_FEATURE, bytes(report) if len(report) else bytes([report_id]))
+        return report
+
+    hid._handle_in_report = _handle_in_report
+    hid._set_feature = _set_feature
+    hid._get_feature = _get_feature
+    # Below the encryption layer.
+    hid.ep_out.ep_out = _CaptureEndpoint(writer, hid.ep_out.ep_out)
+    return writer
+
+
+def _percentile(values, fraction):
+    return values[min(int(len(values) * fraction), len(values) - 1)] if values else 0
+
+
+def replay(capture, hid, speed=1.0, start=0, count=None,
+           kinds=(CAPTURE_OUT, CAPTURE_SET_FEATURE, CAPTURE_GET_FEATURE)):
+    """Send host to device reports of a capture to hid.
+
+    speed 1.0 keeps the recorded timing, 10.0 runs ten times faster, 0 sends
+    back to back as fast as the device takes them. Output reports bypass
+    encryption, they are sent as recorded. Returns timing fidelity: how late
+    each report went out against its schedule, in microseconds, and the
+    rate reached.
+    """
+    lateness = []
+    sent = 0
+    first_t = last_t = None
+    began = time.monotonic()
+    for t_ns, kind, report in capture.records(start, count):
+        if kind not in kinds:
+            continue
+        if first_t is None:
+            first_t = t_ns
+            began = time.monotonic()
+        last_t = t_ns
+        due = began + ((t_ns - first_t) / 1e9 / speed if speed else 0)
+        wait = due - time.monotonic()
+        if wait > 0.002:
+            time.sleep(wait - 0.001)
+        while time.monotonic() < due:
+            pass
+        if speed:
+            lateness.append((time.monotonic() - due) * 1e6)
+
+        if kind == CAPTURE_OUT:
+            hid.ep_out.ep_out.write(bytes(report))
+        elif kind == CAPTURE_SET_FEATURE:
+            hid._set_feature(report[0], bytes(report[1:]))
+        elif kind == CAPTURE_GET_FEATURE:
+            hid._get_feature(report[0], max(len(report), 1))
+        sent += 1
+
+    elapsed = time.monotonic() - began
+    recorded = (last_t - first_t) / 1e9 if first_t is not None else 0
+    lateness.sort()
+    return dict(sent=sent, elapsed_s=elapsed, recorded_s=recorded,
+                rate=sent / elapsed if elapsed > 0 else 0,
+                late_mean_us=sum(lateness) / len(lateness) if lateness else 0,
+                late_p50_us=_percentile(lateness, 0.5), late_p99_us=_percentile(lateness, 0.99),
+                late_max_us=lateness[-1] if lateness else 0)
+
+
+if __name__ == "__main__":
+    import sys
+
+    usage = """Usage:
+    hid_capture.py info FILE
+    hid_capture.py dump FILE [START [COUNT]]
+    hid_capture.py replay FILE [SPEED [/dev/hidrawN]]
+        SPEED 1 keeps recorded timing, 0 sends as fast as possible.
+        Without a hidraw node the board is opened through PyUSB."""
+
+    if len(sys.argv) < 3:
+        print(usage)
+        sys.exit(1)
+
+    capture = CaptureFile(sys.argv[2])
+    if sys.argv[1] == "info":
+        kinds = {}
+        for _, kind, _ in capture.records():
+            kinds[kind] = kinds.get(kind, 0) + 1
+        print("{0} reports over {1:.3f} s, {2}".format(len(capture), capture.duration_ns() / 1e9,
+              "complete" if capture.complete else "no footer, indexed by scan"))
+        for kind, n in sorted(kinds.items()):
+            print("  {0:>3}: {1}".format(CAPTURE_KIND_NAMES.get(kind, kind), n))
+    elif sys.argv[1] == "dump":
+        start = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+        count = int(sys.argv[4]) if len(sys.argv) > 4 else 100
+        for t_ns, kind, report in capture.records(start, count):
+            print("{0:14.6f} {1:>3} {2}".format(t_ns / 1e9, CAPTURE_KIND_NAMES.get(kind, kind),
+                                               bytes(report).hex()))
+    elif sys.argv[1] == "replay":
+        speed = float(sys.argv[3]) if len(sys.argv) > 3 else 1.0
+        if len(sys.argv) > 4:
+            from custom_hidraw import CustomHIDRaw
+            hid = CustomHIDRaw(0x1209, 0x0001, node=sys.argv[4])
+        else:
+            from custom_hid import CustomHID
+            hid = CustomHID(vendor_id=0x1209, product_id=0x0001)
+        try:
+            print(replay(capture, hid, speed))
+        finally:
+            hid.close()
+    else:
+        print(usage)
+    capture.close()
@@ -23,13 +23,30 @@
 # TAB = 4 spaces
 #
  
+import sys
 import textwrap
 import threading
+import time
 
-from custom_hid import CustomHID 
+from custom_hid import CustomHID, pack_pwm_step, PWM_DUTY_MAX, MSC_MEDIA_NAMES, HID_REPORT_ID_UART
+from custom_cdc import CustomCDC
+from custom_hidraw import CustomHIDRaw
+from hid_capture import attach_capture
+from feature_queue import FeatureQueue
+from hid_rpc import RPCClient, RPC_WINDOW, benchmark
+import hid_batch
 
 hid = None
+capture = None
 try:
+    # --record FILE keeps every report of the session for hid_capture.py.
+    if "--record" in sys.argv[1:-1]:
+        i = sys.argv.index("--record")
+        record_path = sys.argv[i + 1]
+        del sys.argv[i:i + 2]
+    else:
+        record_path = None
+
     VID = 0x1209
     PID = 0x0001
     
@@ -38,7 +55,18 @@ try:
     Do Not Use it outside your testing environment.
     """.format(VID, PID)))
     
-    hid = CustomHID(vendor_id=VID, product_id=PID)
+    if len(sys.argv) > 1 and sys.argv[1] == "hidraw":
+        # Linux hidraw node of the board, kernel HID driver stays bound.
+        hid = CustomHIDRaw(vendor_id=VID, product_id=PID)
+    elif len(sys.argv) > 1 and sys.argv[1].startswith("/dev/hidraw"):
+        hid = CustomHIDRaw(vendor_id=VID, product_id=PID, node=sys.argv[1])
+    elif len(sys.argv) > 1:
+        # Serial port of a USE_CDC build, e.g. /dev/ttyACM0
+        hid = CustomCDC(sys.argv[1])
+    else:
+        hid = CustomHID(vendor_id=VID, product_id=PID)
+    if record_path is not None:
+        capture = attach_capture(hid, record_path)
     
     prompt = textwrap.dedent("""
         Choices:
@@ -47,6 +75,48 @@ try:
         \tEnter "2 Rate" (without quotes)
         \twhere Rate is in number of blinks per second.
         \tExample "2 4" LED 4 will blink four times per second.
+        3) Set event debounce time.
+        \tEnter "3 Channel Milliseconds" (without quotes)
+        \tExample "3 0 50" SW2 edges closer than 50ms are ignored.
+        4) Play LED 4 fade sequence.
+        5) Show PWM sequence status and stop it.
+        6) Open UART bridge channel.
+        \tEnter "6 Channel Baud" (without quotes)
+        \tExample "6 0 115200" received bytes are printed here.
+        7) Send text to UART bridge channel.
+        \tEnter "7 Channel Text" (without quotes)
+        8) Show UART bridge statistics.
+        9) Start CAN gateway.
+        \tEnter "9 Bitrate" (without quotes)
+        \tExample "9 500000" received frames are printed here.
+        10) Send CAN frame.
+        \tEnter "10 Id Hexdata" (without quotes)
+        \tExample "10 123 deadbeef"
+        11) Show CAN gateway status.
+        12) Start I2S audio loopback.
+        \tEnter "12 Rate Channels" (without quotes)
+        \tExample "12 8000 2" captured audio is played back.
+        13) Show I2S audio status and stop it.
+        14) Mount SD card and record text.
+        \tEnter "14 Text" (without quotes)
+        15) Show SD recorder status and download last recording.
+        16) Show mass storage status.
+        17) Switch mass storage media, device reconnects.
+        \tEnter "17 Media" (without quotes), Media is ram or spifi.
+        18) Encrypt input and output reports.
+        \tEnter "18 Hexkey" (without quotes), 16 byte key.
+        19) Show encryption status and stop it.
+        20) Save settings now and show settings status.
+        21) Forget saved settings, defaults after reset.
+        22) Show suspend and remote wakeup status.
+        23) Show boot stage timing.
+        24) Capture logic analyzer channels SGPIO8..15.
+        \tEnter "24 Rate Samples" (without quotes)
+        \tExample "24 1000000 100000" 0.1 s at 1 MHz.
+        25) Measure feature request rate, one by one and queued.
+        26) Measure RPC calls per second versus calls outstanding.
+        27) Measure commands per second, one per report and batched.
+        28) Show CDC frame checks and CRC cost on both ends, CDC port only.
         q) Quit
         Enter choice: """)
 
@@ -61,14 +131,167 @@ try:
                 hid.set_led4_blink_rate(rate)
             else:
                 print("**Error** Invalid input: {0}".format(choice))
+        elif choice.startswith("3 "):
+            params = choice.split(maxsplit=3)
+            if (len(params) == 3) and params[1].isdigit() and params[2].isdigit():
+                hid.set_event_debounce(int(params[1]), int(params[2]))
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice == "4":
+            # LED4 is MCPWM channel 1, 1 kHz PWM ramping up and down.
+            ramp = list(range(0, PWM_DUTY_MAX + 1, 100))
+            steps = [pack_pwm_step([(1000, 0), (1000, duty), (1000, 0)], (1000, [0, 0, 0]))
+                     for duty in ramp + ramp[-2:0:-1]]
+            hid.upload_pwm_sequence(steps, step_ms=50, loop=True)
+            hid.start_pwm_sequence()
+        elif choice == "5":
+            print("Sequence {0}, {1} steps, at step {2}, {3} ms per step".format(
+                *hid.get_pwm_sequence_status()))
+            hid.stop_pwm_sequence()
+        elif choice.startswith("6 "):
+            params = choice.split(maxsplit=3)
+            if (len(params) == 3) and params[1].isdigit() and params[2].isdigit():
+                hid.open_uart(int(params[1]), int(params[2]))
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice.startswith("7 "):
+            params = choice.split(maxsplit=2)
+            if (len(params) == 3) and params[1].isdigit():
+                hid.uart_write(int(params[1]), (params[2] + "\r\n").encode())
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice == "8":
+            for channel, stats in enumerate(hid.get_uart_stats()):
+                print("UART {0}: {1}".format(channel, stats))
+        elif choice.startswith("9 "):
+            params = choice.split(maxsplit=2)
+            if (len(params) == 2) and params[1].isdigit():
+                hid.start_can(int(params[1]))
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice.startswith("10 "):
+            params = choice.split()
+            try:
+                data = bytes.fromhex(params[2]) if len(params) > 2 else b""
+                hid.can_send([(int(params[1], 16), data)])
+            except (IndexError, ValueError):
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice == "11":
+            print(hid.get_can_status())
+        elif choice.startswith("12 "):
+            params = choice.split(maxsplit=3)
+            if (len(params) == 3) and params[1].isdigit() and params[2].isdigit():
+                hid.audio_rx_callback = lambda seq, flags, samples: hid.audio_write(samples)
+                hid.start_audio(int(params[1]), int(params[2]))
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice == "13":
+            print(hid.get_audio_status())
+            hid.stop_audio()
+            hid.audio_rx_callback = None
+        elif choice.startswith("14 "):
+            if hid.mount_sd() and hid.start_recording():
+                hid.record_write((choice.split(maxsplit=1)[1] + "\r\n").encode())
+                hid.stop_recording()
+            else:
+                print("**Error** No formatted SD card")
+        elif choice == "15":
+            status = hid.get_recorder_status()
+            print(status)
+            if status["recordings"] > 0:
+                print(hid.read_recording(status["recordings"] - 1))
+        elif choice == "16":
+            print(hid.get_msc_status())
+        elif choice.startswith("17 "):
+            params = choice.split()
+            if (len(params) == 2) and params[1] in MSC_MEDIA_NAMES:
+                hid.select_msc_media(MSC_MEDIA_NAMES.index(params[1]))
+                print("Device reconnects, restart the test tool")
+                break
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice.startswith("18 "):
+            params = choice.split()
+            try:
+                key = bytes.fromhex(params[1])
+                if len(key) != 16:
+                    raise ValueError
+                hid.start_encryption(key)
+            except (IndexError, ValueError):
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice == "19":
+            print(hid.get_encryption_status())
+            hid.stop_encryption()
+        elif choice in ("20", "21"):
+            if not hid.sync_settings(clear=(choice == "21")):
+                print("**Error** Settings not saved")
+            print(hid.get_settings_status())
+        elif choice == "22":
+            print(hid.get_power_status())
+        elif choice == "23":
+            print(hid.get_boot_status())
+        elif choice.startswith("24 "):
+            params = choice.split()
+            if (len(params) == 3) and params[1].isdigit() and params[2].isdigit():
+                hid.start_logic_capture(int(params[1]), limit=int(params[2]))
+                runs = hid.read_logic_capture()
+                status = hid.get_logic_status()
+                print(status)
+                if status["stats"]["bytes"]:
+                    print("{0} runs, {1:.1f} samples per stream byte".format(
+                        len(runs), status["stats"]["samples"] / status["stats"]["bytes"]))
+                for value, length, gap in runs[:16]:
+                    print("{0} {1:08b} x {2}".format("gap" if gap else "   ", value, length))
+            else:
+                print("**Error** Invalid input: {0}".format(choice))
+        elif choice == "25":
+            count = 200
+            began = time.monotonic()
+            for _ in range(count):
+                hid.get_uart_stats()
+            sync_rate = count / (time.monotonic() - began)
+            queue = FeatureQueue(hid)
+            began = time.monotonic()
+            for _ in range(count):
+                queue.get_feature(HID_REPORT_ID_UART)
+            for rate in range(count):
+                queue.set_led4_blink_rate(rate % 10 + 1)
+            queue.flush()
+            queued_rate = queue.sent / (time.monotonic() - began)
+            queue.close()
+            print("One by one {0:.0f} requests/s, queued {1:.0f} requests/s, "
+                  "{2} blink rate sets went out as {3}".format(
+                      sync_rate, queued_rate, count, count - queue.coalesced))
+        elif choice == "26":
+            rpc = RPCClient(hid)
+            try:
+                print(rpc.info())
+                for window, rate in benchmark(rpc, windows=range(1, RPC_WINDOW + 1)):
+                    print("{0} outstanding: {1:.0f} calls/s".format(window, rate))
+            finally:
+                rpc.close()
+        elif choice == "27":
+            single, batched, reports = hid_batch.benchmark(hid)
+            print("One per report {0:.0f} commands/s, batched {1:.0f} commands/s "
+                  "in {2} reports".format(single, batched, reports))
+            print(hid_batch.get_batch_status(hid))
+        elif choice == "28":
+            if isinstance(hid, CustomCDC):
+                print(hid.get_link_status())
+            else:
+                print("**Error** Frames are checked on the CDC port only")
         elif choice == "q":
             break
         else:
             print("**Error** Invalid input: {0}".format(choice))
 
     hid.close()
+    if capture is not None:
+        capture.close()
     
 except Exception as e:
     print(e)
     if hid is not None:
         hid.close()
+    if capture is not None:
+        capture.close()
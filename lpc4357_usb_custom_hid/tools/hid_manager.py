@@ -0,0 +1,418 @@
+# Many boards on one event loop, through libusb pollfds and hotplug.
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import collections
+import concurrent.futures
+import fcntl
+import os
+import select
+import threading
+
+import usb1
+
+from custom_hid import (CustomHID, HID_REPORT_MAX_SIZE, REPORT_CRYPT_IN,
+                        _USB_HID_CLASS_CTRL_bmRequestType, _USB_HID_CLASS_CTRL_bRequest_SET_REPORT,
+                        _USB_HID_CLASS_CTRL_bmRequestType_IN, _USB_HID_CLASS_CTRL_bRequest_GET_REPORT,
+                        _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_FEATURE)
+
+# HID is interface 0, its interrupt endpoints are EP1 IN and OUT.
+_HID_INTERFACE = 0
+_HID_EP_IN = 0x81
+_HID_EP_OUT = 0x01
+
+_TRANSFER_TIMEOUT_MS = 1000
+_RESCAN_INTERVAL_S = 1.0
+
+_TRANSFER_ERRORS = {
+    usb1.TRANSFER_ERROR: "error",
+    usb1.TRANSFER_TIMED_OUT: "timed out",
+    usb1.TRANSFER_CANCELLED: "cancelled",
+    usb1.TRANSFER_STALL: "refused",
+    usb1.TRANSFER_NO_DEVICE: "device gone",
+    usb1.TRANSFER_OVERFLOW: "overflow",
+}
+
+
+class _ManagedEndpoint:
+    # Stands in for the HID interrupt OUT endpoint, returns a future instead
+    # of waiting so that callbacks on the loop thread can send too.
+    def __init__(self, device):
+        self.device = device
+
+    def write(self, report):
+        return self.device._submit(self.device._out_transfer, bytes(report))
+
+
+class ManagedDevice(CustomHID):
+    """One board on a HIDManager loop, same methods as CustomHID.
+
+    CustomHID methods which read feature reports wait for the loop, do not
+    call them from input_callback or the manager callbacks, those run on the
+    loop thread. The *_async methods return futures and work from anywhere.
+    """
+
+    def __init__(self, manager, device, handle, serial):
+        self.manager = manager
+        self.serial = serial
+        self.bus = device.getBusNumber()
+        self.address = device.getDeviceAddress()
+        self.interface_number = _HID_INTERFACE
+        self.connected = True
+        # Called on the loop thread with (device, report) instead of the
+        # CustomHID printouts and callbacks.
+        self.input_callback = None
+        self._handle = handle
+        self._in_transfers = []
+        self.ep_out = _ManagedEndpoint(self)
+        self._init_state()
+
+    def write_async(self, report):
+        return self.ep_out.write(report)
+
+    def set_feature_async(self, report_id, payload):
+        return self._submit(self._control_transfer, _USB_HID_CLASS_CTRL_bmRequestType,
+                            _USB_HID_CLASS_CTRL_bRequest_SET_REPORT, report_id,
+                            bytes([report_id]) + bytes(payload))
+
+    def get_feature_async(self, report_id, length=HID_REPORT_MAX_SIZE):
+        return self._submit(self._control_transfer, _USB_HID_CLASS_CTRL_bmRequestType_IN,
+                            _USB_HID_CLASS_CTRL_bRequest_GET_REPORT, report_id, length)
+
+    def _set_feature(self, report_id, payload):
+        self.set_feature_async(report_id, payload).result()
+
+    def _get_feature(self, report_id, length):
+        return self.get_feature_async(report_id, length).result()
+
+    def _handle_in_report(self, report):
+        if self.input_callback is None:
+            CustomHID._handle_in_report(self, report)
+            return
+        if self._crypt is not None:
+            report = self._crypt.apply(REPORT_CRYPT_IN, report)
+        self.input_callback(self, bytes(report))
+
+    def close(self):
+        """Hand the board back to the kernel, the manager forgets it."""
+        self.manager._call(self.manager._remove, self).result()
+
+    def _submit(self, start, *args):
+        future = concurrent.futures.Future()
+        self.manager._call(start, future, *args)
+        return future
+
+    # Everything below runs on the loop thread.
+
+    def _start(self, in_transfers):
+        for _ in range(in_transfers):
+            transfer = self._handle.getTransfer()
+            transfer.setInterrupt(_HID_EP_IN, HID_REPORT_MAX_SIZE, callback=self._in_done)
+            transfer.submit()
+            self._in_transfers.append(transfer)
+
+    def _in_done(self, transfer):
+        status = transfer.getStatus()
+        if status == usb1.TRANSFER_COMPLETED:
+            report = transfer.getBuffer()[:transfer.getActualLength()]
+            try:
+                self._handle_in_report(report)
+            except Exception as e:
+                print(e)
+        if status == usb1.TRANSFER_NO_DEVICE:
+            self.manager._lost(self)
+        elif self.connected and status != usb1.TRANSFER_CANCELLED:
+            transfer.submit()
+
+    def _out_transfer(self, future, report):
+        transfer = self._handle.getTransfer()
+        transfer.setInterrupt(_HID_EP_OUT, report, callback=self._done,
+                              user_data=(future, None), timeout=_TRANSFER_TIMEOUT_MS)
+        self._start_transfer(transfer, future)
+
+    def _control_transfer(self, future, request_type, request, report_id, data):
+        # IN transfers are given a length, OUT transfers their data.
+        length = data if isinstance(data, int) else None
+        transfer = self._handle.getTransfer()
+        transfer.setControl(request_type, request,
+                            _USB_HID_CLASS_CTRL_wValue_REPORT_TYPE_FEATURE | report_id,
+                            self.interface_number, data, callback=self._done,
+                            user_data=(future, length), timeout=_TRANSFER_TIMEOUT_MS)
+        self._start_transfer(transfer, future)
+
+    def _start_transfer(self, transfer, future):
+        if not self.connected:
+            future.set_exception(Exception("Device {0} gone".format(self.serial)))
+            return
+        try:
+            transfer.submit()
+        except usb1.USBError as e:
+            future.set_exception(e)
+
+    def _done(self, transfer):
+        future, length = transfer.getUserData()
+        status = transfer.getStatus()
+        if status != usb1.TRANSFER_COMPLETED:
+            future.set_exception(Exception("Device {0} transfer {1}".format(
+                self.serial, _TRANSFER_ERRORS.get(status, status))))
+            if status == usb1.TRANSFER_NO_DEVICE:
+                self.manager._lost(self)
+            return
+        if length is None:
+            future.set_result(transfer.getActualLength())
+            return
+        # Control buffers may still carry the setup packet in front.
+        buffer = transfer.getBuffer()
+        offset = len(buffer) - length
+        future.set_result(bytes(buffer[offset:offset + transfer.getActualLength()]))
+
+
+class HIDManager:
+    """All boards with a VID:PID, driven from one thread.
+
+    libusb file descriptors sit in one epoll set, input reports of every
+    board are handled as their transfers complete. Boards plugged in later
+    are opened as they arrive, through libusb hotplug or a rescan every
+    second where libusb has no hotplug support. Boards are told apart by
+    serial number, the chip unique ID.
+    """
+
+    def __init__(self, vendor_id, product_id, on_added=None, on_removed=None, in_transfers=2):
+        self.vendor_id = vendor_id
+        self.product_id = product_id
+        # Called on the loop thread with the ManagedDevice.
+        self.on_added = on_added
+        self.on_removed = on_removed
+        self.in_transfers = in_transfers
+        self.devices = {}
+        self._lock = threading.Lock()
+        self._calls = collections.deque()
+        self._arrived = []
+        self._departed = []
+        self._removing = []
+        self._closing = False
+
+        self.context = usb1.USBContext()
+        if hasattr(self.context, "open"):
+            self.context.open()
+
+        # libusb hands out poll() event masks, POLLIN and POLLOUT have the
+        # same values as EPOLLIN and EPOLLOUT.
+        self._epoll = select.epoll()
+        for fd, events in self.context.getPollFDList():
+            self._epoll.register(fd, events)
+        self.context.setPollFDNotifiers(self._fd_added, self._fd_removed)
+
+        self._wake_r, self._wake_w = os.pipe()
+        fcntl.fcntl(self._wake_r, fcntl.F_SETFL, os.O_NONBLOCK)
+        self._epoll.register(self._wake_r, select.EPOLLIN)
+
+        self._hotplug = usb1.hasCapability(usb1.CAP_HAS_HOTPLUG)
+        if self._hotplug:
+            # Boards already present arrive right away.
+            self.context.hotplugRegisterCallback(self._hotplug_event,
+                                                 vendor_id=vendor_id, product_id=product_id)
+        self._next_rescan = 0
+
+        self._thread = threading.Thread(target=self._run)
+        self._thread.start()
+
+    def get(self, serial):
+        with self._lock:
+            return self.devices.get(serial)
+
+    def list(self):
+        with self._lock:
+            return list(self.devices.values())
+
+    def close(self):
+        self._call(self._shutdown).result()
+        self._thread.join()
+        self._epoll.close()
+        os.close(self._wake_r)
+        os.close(self._wake_w)
+        self.context.close()
+
+    def _call(self, function, *args):
+        """Run function on the loop thread, returns a future of its result."""
+        future = concurrent.futures.Future()
+        if threading.current_thread() is self._thread:
+            self._invoke(future, function, args)
+            return future
+        with self._lock:
+            self._calls.append((future, function, args))
+        os.write(self._wake_w, b"\0")
+        return future
+
+    @staticmethod
+    def _invoke(future, function, args):
+        try:
+            result = function(*args)
+        except Exception as e:
+            future.set_exception(e)
+            return
+        # Transfer starters settle the future handed to them themselves.
+        if not future.done():
+            future.set_result(result)
+
+    # Everything below runs on the loop thread.
+
+    def _run(self):
+        while not self._closing:
+            wait = _RESCAN_INTERVAL_S
+            timeout = self.context.getNextTimeout()
+            if timeout is not None and timeout is not False:
+                wait = min(wait, timeout)
+            for fd, _ in self._epoll.poll(wait):
+                if fd == self._wake_r:
+                    try:
+                        os.read(self._wake_r, 4096)
+                    except BlockingIOError:
+                        pass
+            self.context.handleEventsTimeout(0)
+
+            while True:
+                with self._lock:
+                    if not self._calls:
+                        break
+                    future, function, args = self._calls.popleft()
+                self._invoke(future, function, args)
+
+            # Hotplug callbacks run inside libusb event handling where no
+            # I/O is allowed, boards are opened and closed from here.
+            if not self._hotplug:
+                self._rescan()
+            arrived, self._arrived = self._arrived, []
+            for device in arrived:
+                self._open(device)
+            departed, self._departed = self._departed, []
+            for bus, address in departed:
+                for managed in self.list():
+                    if (managed.bus, managed.address) == (bus, address):
+                        self._lost(managed)
+            removing, self._removing = self._removing, []
+            for managed in removing:
+                self._remove(managed)
+
+    def _fd_added(self, fd, events, user_data=None):
+        self._epoll.register(fd, events)
+
+    def _fd_removed(self, fd, user_data=None):
+        self._epoll.unregister(fd)
+
+    def _hotplug_event(self, context, device, event):
+        if event == usb1.HOTPLUG_EVENT_DEVICE_ARRIVED:
+            self._arrived.append(device)
+        else:
+            self._departed.append((device.getBusNumber(), device.getDeviceAddress()))
+        return False
+
+    def _rescan(self):
+        now = os.times()[4]
+        if now < self._next_rescan:
+            return
+        self._next_rescan = now + _RESCAN_INTERVAL_S
+        known = set((managed.bus, managed.address) for managed in self.list())
+        for device in self.context.getDeviceIterator(skip_on_error=True):
+            if ((device.getVendorID(), device.getProductID()) == (self.vendor_id, self.product_id) and
+                    (device.getBusNumber(), device.getDeviceAddress()) not in known):
+                self._arrived.append(device)
+
+    def _open(self, device):
+        handle = None
+        try:
+            handle = device.open()
+            handle.setAutoDetachKernelDriver(True)
+            handle.claimInterface(_HID_INTERFACE)
+            serial = handle.getSerialNumber()
+        except usb1.USBError as e:
+            print("USB device {0:03d}:{1:03d} not opened: {2}".format(
+                device.getBusNumber(), device.getDeviceAddress(), e))
+            if handle is not None:
+                handle.close()
+            return
+
+        with self._lock:
+            # Old firmware reports serial 0 on every board.
+            if not serial or serial in self.devices:
+                serial = "{0}@{1:03d}:{2:03d}".format(serial, device.getBusNumber(),
+                                                      device.getDeviceAddress())
+            managed = ManagedDevice(self, device, handle, serial)
+            self.devices[serial] = managed
+        managed._start(self.in_transfers)
+        if self.on_added is not None:
+            self.on_added(managed)
+
+    def _lost(self, managed):
+        # Called from transfer callbacks, closing waits for the loop.
+        if managed.connected:
+            managed.connected = False
+            self._removing.append(managed)
+
+    def _remove(self, managed):
+        managed.connected = False
+        with self._lock:
+            if self.devices.get(managed.serial) is not managed:
+                return
+            del self.devices[managed.serial]
+        for transfer in managed._in_transfers:
+            if transfer.isSubmitted():
+                try:
+                    transfer.cancel()
+                except usb1.USBError:
+                    pass
+        try:
+            managed._handle.releaseInterface(_HID_INTERFACE)
+        except usb1.USBError:
+            pass
+        # Closing handles events until cancelled transfers completed.
+        managed._handle.close()
+        if self.on_removed is not None:
+            self.on_removed(managed)
+
+    def _shutdown(self):
+        for managed in self.list():
+            self._remove(managed)
+        self._closing = True
+
+
+if __name__ == "__main__":
+    # Rack monitor: lists boards as they come and go, prints their events.
+    import sys
+    import time
+
+    def added(device):
+        print("{0} added on {1:03d}:{2:03d}".format(device.serial, device.bus, device.address))
+
+    def removed(device):
+        print("{0} removed".format(device.serial))
+
+    manager = HIDManager(0x1209, 0x0001, on_added=added, on_removed=removed)
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    manager.close()
+    sys.exit(0)
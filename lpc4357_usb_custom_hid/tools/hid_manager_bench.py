@@ -0,0 +1,645 @@
+# Benchmark hid_manager.py with many virtual boards
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import contextlib
+import heapq
+import io
+import os
+import queue
+import struct
+import sys
+import threading
+import time
+import types
+
+# Virtual boards stand in for libusb and PyUSB. Both modules are replaced
+# before hid_manager and custom_hid import them, so the benchmark runs the
+# real HIDManager and CustomHID code without hardware or root.
+
+VENDOR_ID = 0x1209
+PRODUCT_ID = 0x0001
+REPORT_SIZE = 64
+REPORT_ID_BENCH = 0x7F      # Not used by the firmware, CustomHID ignores it
+FEATURE_ID = 0x01
+FRAME_S = 0.001             # Interrupt and control transfers finish on the next frame
+_REPORT = struct.Struct("<BdI")
+
+
+class VirtualBoard:
+    """One board on the virtual bus: an input report every 1 / rate seconds,
+    NAKed until the host has a read pending, like the interrupt IN endpoint."""
+
+    def __init__(self, bus, index):
+        self.bus = bus
+        self.serial = "VB{0:04d}".format(index)
+        self.address = index + 1
+        self.connected = True
+        self.handle = None      # libusb handle or PyUSB device that opened it
+        self.waiting = []       # Reports the host has not read yet
+        self.produced = 0
+        self.received = 0
+        self.received_at_replug = None
+
+    # usb1 device methods
+    def getBusNumber(self):
+        return 1
+
+    def getDeviceAddress(self):
+        return self.address
+
+    def getVendorID(self):
+        return VENDOR_ID
+
+    def getProductID(self):
+        return PRODUCT_ID
+
+    def open(self):
+        if not self.connected:
+            raise USBError("no device")
+        return _Handle(self)
+
+    def produce(self, now):
+        report = _REPORT.pack(REPORT_ID_BENCH, now, self.produced).ljust(REPORT_SIZE, b"\0")
+        self.produced += 1
+        if self.handle is not None:
+            self.handle._deliver(report)
+        else:
+            self.waiting.append(report)
+
+
+class VirtualBus:
+    """Host controller and boards, one thread serving every frame."""
+
+    def __init__(self, boards, rate):
+        self.lock = threading.RLock()
+        self.boards = [VirtualBoard(self, i) for i in range(boards)]
+        self.rate = rate
+        self.contexts = []
+        self.next_address = boards + 1
+        self._frame_jobs = []
+        self._producing = False
+        self._stop = False
+        self._thread = threading.Thread(target=self._run)
+        self._thread.start()
+
+    def on_next_frame(self, job):
+        with self.lock:
+            self._frame_jobs.append(job)
+
+    def start_producing(self):
+        with self.lock:
+            now = time.perf_counter()
+            # Boards spread over the report interval, as they would be.
+            self._due = [(now + i / (self.rate * len(self.boards)), i) for i in range(len(self.boards))]
+            heapq.heapify(self._due)
+            self._producing = True
+
+    def stop_producing(self):
+        with self.lock:
+            self._producing = False
+
+    def stop(self):
+        self._stop = True
+        self._thread.join()
+
+    def unplug(self, board):
+        with self.lock:
+            board.connected = False
+            if board.handle is not None:
+                board.handle._gone()
+            board.handle = None
+            board.waiting = []
+            for context in self.contexts:
+                context._hotplug(board, HOTPLUG_EVENT_DEVICE_LEFT)
+
+    def replug(self, board):
+        with self.lock:
+            board.address = self.next_address
+            self.next_address += 1
+            board.connected = True
+            board.received_at_replug = board.received
+            for context in self.contexts:
+                context._hotplug(board, HOTPLUG_EVENT_DEVICE_ARRIVED)
+
+    def _run(self):
+        next_frame = time.perf_counter()
+        while not self._stop:
+            next_frame += FRAME_S
+            delay = next_frame - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+            with self.lock:
+                jobs, self._frame_jobs = self._frame_jobs, []
+                now = time.perf_counter()
+                while self._producing and self._due[0][0] <= now:
+                    due, i = heapq.heappop(self._due)
+                    board = self.boards[i]
+                    if board.connected:
+                        board.produce(now)
+                    heapq.heappush(self._due, (due + 1.0 / self.rate, i))
+            for job in jobs:
+                job()
+
+
+# Stand-in python-libusb1, the parts hid_manager.py uses
+
+TRANSFER_COMPLETED = 0
+TRANSFER_ERROR = 1
+TRANSFER_TIMED_OUT = 2
+TRANSFER_CANCELLED = 3
+TRANSFER_STALL = 4
+TRANSFER_NO_DEVICE = 5
+TRANSFER_OVERFLOW = 6
+HOTPLUG_EVENT_DEVICE_ARRIVED = 1
+HOTPLUG_EVENT_DEVICE_LEFT = 2
+CAP_HAS_HOTPLUG = 1
+_POLLIN = 1
+
+bus = None
+
+
+class USBError(Exception):
+    pass
+
+
+def hasCapability(capability):
+    return capability == CAP_HAS_HOTPLUG
+
+
+class USBContext:
+    """Each open handle has its own file descriptor like a usbfs node,
+    completions are reaped in handleEventsTimeout as libusb does."""
+
+    def __init__(self):
+        self._wake_r, self._wake_w = os.pipe()
+        os.set_blocking(self._wake_r, False)
+        self._completed = []
+        self._hotplug_events = []
+        self._hotplug_callback = None
+        self._fd_added = None
+        self._fd_removed = None
+        with bus.lock:
+            bus.contexts.append(self)
+
+    def close(self):
+        with bus.lock:
+            bus.contexts.remove(self)
+        os.close(self._wake_r)
+        os.close(self._wake_w)
+
+    def getPollFDList(self):
+        return [(self._wake_r, _POLLIN)]
+
+    def setPollFDNotifiers(self, added, removed):
+        self._fd_added = added
+        self._fd_removed = removed
+
+    def getNextTimeout(self):
+        return None
+
+    def hotplugRegisterCallback(self, callback, vendor_id=None, product_id=None):
+        self._hotplug_callback = callback
+        # Boards already present arrive right away, HOTPLUG_ENUMERATE.
+        for board in self.getDeviceIterator():
+            callback(self, board, HOTPLUG_EVENT_DEVICE_ARRIVED)
+
+    def getDeviceIterator(self, skip_on_error=False):
+        with bus.lock:
+            return [board for board in bus.boards if board.connected]
+
+    def _hotplug(self, board, event):
+        self._hotplug_events.append((board, event))
+        os.write(self._wake_w, b"\0")
+
+    def _complete(self, transfer, status, data=b""):
+        # Host controller side, the handle's descriptor becomes readable.
+        with bus.lock:
+            transfer._status = status
+            transfer._data = data
+            self._completed.append(transfer)
+        os.write(transfer._handle._fd_w, b"\0")
+
+    def handleEventsTimeout(self, timeout=0):
+        self._reap(None)
+
+    def _reap(self, only):
+        with bus.lock:
+            if only is None:
+                done, self._completed = self._completed, []
+                events, self._hotplug_events = self._hotplug_events, []
+            else:
+                done = [t for t in self._completed if t._handle is only]
+                self._completed = [t for t in self._completed if t._handle is not only]
+                events = []
+        for handle in set(t._handle for t in done):
+            try:
+                os.read(handle._fd_r, 65536)
+            except (BlockingIOError, OSError):
+                pass
+        try:
+            os.read(self._wake_r, 65536)
+        except BlockingIOError:
+            pass
+        for board, event in events:
+            if self._hotplug_callback is not None:
+                self._hotplug_callback(self, board, event)
+        for transfer in done:
+            transfer._submitted = False
+            transfer._callback(transfer)
+
+
+class _Handle:
+    def __init__(self, board):
+        self._board = board
+        self._context = bus.contexts[-1]
+        self._fd_r, self._fd_w = os.pipe()
+        os.set_blocking(self._fd_r, False)
+        self._reads = []        # IN transfers waiting for a report
+        self._open = True
+        with bus.lock:
+            board.handle = self
+            waiting, board.waiting = board.waiting, []
+        self._context._fd_added(self._fd_r, _POLLIN)
+        for report in waiting:
+            self._deliver(report)
+
+    def setAutoDetachKernelDriver(self, enable):
+        pass
+
+    def claimInterface(self, interface):
+        pass
+
+    def releaseInterface(self, interface):
+        pass
+
+    def getSerialNumber(self):
+        return self._board.serial
+
+    def getTransfer(self):
+        return _Transfer(self)
+
+    def close(self):
+        # Cancelled transfers complete before the handle goes.
+        self._context._reap(self)
+        self._open = False
+        with bus.lock:
+            if self._board.handle is self:
+                self._board.handle = None
+        self._context._fd_removed(self._fd_r)
+        os.close(self._fd_r)
+        os.close(self._fd_w)
+
+    def _deliver(self, report):
+        with bus.lock:
+            if not self._reads:
+                self._board.waiting.append(report)
+                return
+            transfer = self._reads.pop(0)
+        self._context._complete(transfer, TRANSFER_COMPLETED, report)
+
+    def _gone(self):
+        reads, self._reads = self._reads, []
+        for transfer in reads:
+            self._context._complete(transfer, TRANSFER_NO_DEVICE)
+
+
+class _Transfer:
+    def __init__(self, handle):
+        self._handle = handle
+        self._submitted = False
+        self._status = None
+        self._data = b""
+        self._user_data = None
+        self._callback = None
+
+    def setInterrupt(self, endpoint, buffer_or_len, callback=None, user_data=None, timeout=0):
+        self._endpoint = endpoint
+        self._setup = None
+        self._out = None if isinstance(buffer_or_len, int) else bytes(buffer_or_len)
+        self._callback = callback
+        self._user_data = user_data
+
+    def setControl(self, request_type, request, value, index, buffer_or_len, callback=None,
+                   user_data=None, timeout=0):
+        self._endpoint = 0
+        self._setup = (request_type, request, value, index)
+        self._length = buffer_or_len if isinstance(buffer_or_len, int) else len(buffer_or_len)
+        self._callback = callback
+        self._user_data = user_data
+
+    def submit(self):
+        board = self._handle._board
+        if not board.connected or not self._handle._open:
+            raise USBError("no device")
+        self._submitted = True
+        if self._endpoint & 0x80:
+            with bus.lock:
+                if board.waiting:
+                    report = board.waiting.pop(0)
+                else:
+                    self._handle._reads.append(self)
+                    return
+            self._handle._context._complete(self, TRANSFER_COMPLETED, report)
+            return
+        # OUT reports and control requests finish on the next frame, GET_REPORT
+        # answers with the serial so replies can be told apart.
+        if self._setup is not None and self._setup[0] & 0x80:
+            data = bytes(8) + bytes([self._setup[2] & 0xFF]) + board.serial.encode()
+            data = data.ljust(8 + self._length, b"\0")
+        else:
+            data = self._out or b""
+        bus.on_next_frame(lambda: self._handle._context._complete(self, TRANSFER_COMPLETED, data))
+
+    def cancel(self):
+        with bus.lock:
+            if self not in self._handle._reads:
+                raise USBError("not submitted")
+            self._handle._reads.remove(self)
+        self._handle._context._complete(self, TRANSFER_CANCELLED)
+
+    def isSubmitted(self):
+        return self._submitted
+
+    def getStatus(self):
+        return self._status
+
+    def getBuffer(self):
+        return self._data
+
+    def getActualLength(self):
+        if self._setup is not None:
+            return len(self._data) - 8 if self._setup[0] & 0x80 else self._length
+        return len(self._data)
+
+    def getUserData(self):
+        return self._user_data
+
+
+# Stand-in PyUSB, the parts CustomHID uses
+
+class _PyUSBError(Exception):
+    pass
+
+
+class _PyUSBEndpoint:
+    def __init__(self, device, direction_in):
+        self.device = device
+        self.direction_in = direction_in
+
+    def read(self, size, timeout):
+        try:
+            return self.device.reports.get(timeout=timeout / 1000.0)
+        except queue.Empty:
+            raise _PyUSBError("[Errno 110] Operation timed out")
+
+    def write(self, data):
+        return len(data)
+
+
+class _PyUSBDevice:
+    """Opened board, reports go straight to the endpoint read of its thread."""
+
+    bInterfaceNumber = 0
+    manufacturer = "Virtual"
+    product = "Virtual board"
+
+    def __init__(self, board):
+        self.board = board
+        self.serial_number = board.serial
+        self.reports = queue.Queue()
+        self._deliver = self.reports.put
+        with bus.lock:
+            board.handle = self
+            for report in board.waiting:
+                self.reports.put(report)
+            board.waiting = []
+
+    def get_active_configuration(self):
+        return self
+
+    def __getitem__(self, index):
+        if index == (0, 0):
+            return self
+        return _PyUSBEndpoint(self, index == 0)
+
+    def is_kernel_driver_active(self, interface):
+        return False
+
+    def ctrl_transfer(self, request_type, request, value, index, data_or_length, timeout=None):
+        done = threading.Event()
+        bus.on_next_frame(done.set)
+        done.wait()
+        if request_type & 0x80:
+            return (bytes([value & 0xFF]) + self.serial_number.encode()).ljust(data_or_length, b"\0")
+        return len(data_or_length)
+
+
+def _pyusb_find(idVendor=None, idProduct=None):
+    with bus.lock:
+        for board in bus.boards:
+            if board.connected and board.handle is None:
+                return _PyUSBDevice(board)
+    return None
+
+
+def _install_stand_ins():
+    usb1 = types.ModuleType("usb1")
+    for name in ("TRANSFER_COMPLETED", "TRANSFER_ERROR", "TRANSFER_TIMED_OUT", "TRANSFER_CANCELLED",
+                 "TRANSFER_STALL", "TRANSFER_NO_DEVICE", "TRANSFER_OVERFLOW", "HOTPLUG_EVENT_DEVICE_ARRIVED",
+                 "HOTPLUG_EVENT_DEVICE_LEFT", "CAP_HAS_HOTPLUG", "USBError", "USBContext", "hasCapability"):
+        setattr(usb1, name, globals()[name])
+    usb = types.ModuleType("usb")
+    usb.core = types.ModuleType("usb.core")
+    usb.core.find = _pyusb_find
+    usb.core.USBError = _PyUSBError
+    usb.util = types.ModuleType("usb.util")
+    sys.modules.update({"usb1": usb1, "usb": usb, "usb.core": usb.core, "usb.util": usb.util})
+
+
+_install_stand_ins()
+
+from custom_hid import CustomHID           # noqa: E402
+from hid_manager import HIDManager          # noqa: E402
+
+
+class Latencies:
+    def __init__(self):
+        self.values = []
+
+    def add(self, board, report):
+        _, sent, _ = _REPORT.unpack_from(bytes(report))
+        self.values.append(time.perf_counter() - sent)
+        board.received += 1
+
+    def summary(self):
+        values = sorted(self.values) or [0.0]
+        return (1e3 * sum(values) / len(values), 1e3 * values[min(len(values) - 1, int(len(values) * 0.99))],
+                1e3 * values[-1])
+
+
+class ThreadedBoard(CustomHID):
+    """One CustomHID per board with its polling thread, as before HIDManager."""
+
+    latencies = None
+
+    def _handle_in_report(self, report):
+        if len(report) > 0 and report[0] == REPORT_ID_BENCH:
+            self.latencies.add(self.device.board, report)
+
+
+def _wait(condition, timeout):
+    deadline = time.perf_counter() + timeout
+    while not condition() and time.perf_counter() < deadline:
+        time.sleep(0.01)
+    return condition()
+
+
+def run_manager(boards, rate, seconds, hotplug):
+    global bus
+    bus = VirtualBus(boards, rate)
+    latencies = Latencies()
+    added = []
+    removed = []
+    by_serial = dict((board.serial, board) for board in bus.boards)
+
+    def on_added(device):
+        added.append(time.perf_counter())
+        device.input_callback = lambda device, report: latencies.add(by_serial[device.serial], report)
+
+    def on_removed(device):
+        removed.append(time.perf_counter())
+
+    manager = HIDManager(VENDOR_ID, PRODUCT_ID, on_added=on_added, on_removed=on_removed)
+    ok = _wait(lambda: len(manager.list()) == boards, 10)
+
+    cpu = time.process_time()
+    bus.start_producing()
+    unplugged = []
+    hotplug_ms = [0.0, 0.0]
+    if hotplug:
+        # An eighth of the rack is pulled and plugged back in a third into the run.
+        time.sleep(seconds / 3.0)
+        unplugged = bus.boards[::8]
+        start = time.perf_counter()
+        for board in unplugged:
+            bus.unplug(board)
+        ok = _wait(lambda: len(removed) == len(unplugged), 5) and ok
+        hotplug_ms[0] = 1e3 * (max(removed or [start]) - start)
+        start = time.perf_counter()
+        for board in unplugged:
+            bus.replug(board)
+        ok = _wait(lambda: len(added) == boards + len(unplugged), 5) and ok
+        hotplug_ms[1] = 1e3 * (max(added) - start)
+        time.sleep(seconds * 2 / 3.0)
+    else:
+        time.sleep(seconds)
+    bus.stop_producing()
+    cpu = time.process_time() - cpu
+    threads = threading.active_count()
+
+    # Every board's feature report at once.
+    start = time.perf_counter()
+    futures = [(device, device.get_feature_async(FEATURE_ID)) for device in manager.list()]
+    replies_ok = all(reply.result(5)[1:1 + len(device.serial)] == device.serial.encode()
+                     for device, reply in futures)
+    features_ms = 1e3 * (time.perf_counter() - start)
+
+    _wait(lambda: all(board.received == board.produced for board in bus.boards if board not in unplugged), 2)
+    delivered_ok = all(board.received == board.produced for board in bus.boards if board not in unplugged)
+    replug_ok = all(board.received <= board.produced and board.received > board.received_at_replug
+                    for board in unplugged)
+    manager.close()
+    bus.stop()
+    return dict(ok=ok, delivered_ok=delivered_ok, replug_ok=replug_ok, replies_ok=replies_ok,
+                reports=len(latencies.values), latency=latencies.summary(), cpu=100.0 * cpu / seconds,
+                threads=threads, features_ms=features_ms, hotplug_ms=hotplug_ms)
+
+
+def run_threads(boards, rate, seconds):
+    global bus
+    bus = VirtualBus(boards, rate)
+    latencies = Latencies()
+    ThreadedBoard.latencies = latencies
+    with contextlib.redirect_stdout(io.StringIO()):
+        devices = [ThreadedBoard(VENDOR_ID, PRODUCT_ID) for _ in range(boards)]
+
+    cpu = time.process_time()
+    bus.start_producing()
+    time.sleep(seconds)
+    bus.stop_producing()
+    cpu = time.process_time() - cpu
+    threads = threading.active_count()
+
+    # One board after the other, each read waits for its reply.
+    start = time.perf_counter()
+    replies_ok = all(bytes(device._get_feature(FEATURE_ID, REPORT_SIZE))[1:1 + len(device.device.serial_number)] ==
+                     device.device.serial_number.encode() for device in devices)
+    features_ms = 1e3 * (time.perf_counter() - start)
+
+    _wait(lambda: all(board.received == board.produced for board in bus.boards), 2)
+    delivered_ok = all(board.received == board.produced for board in bus.boards)
+    for device in devices:
+        device.close_thread = True
+    for device in devices:
+        device.poll_th.join()
+    bus.stop()
+    return dict(ok=True, delivered_ok=delivered_ok, replug_ok=True, replies_ok=replies_ok,
+                reports=len(latencies.values), latency=latencies.summary(), cpu=100.0 * cpu / seconds,
+                threads=threads, features_ms=features_ms, hotplug_ms=None)
+
+
+if __name__ == "__main__":
+    try:
+        counts = [int(n) for n in sys.argv[1].split(",")] if len(sys.argv) > 1 else [64, 128, 256]
+        rate = float(sys.argv[2]) if len(sys.argv) > 2 else 100.0
+        seconds = float(sys.argv[3]) if len(sys.argv) > 3 else 3.0
+    except ValueError:
+        print("Usage: hid_manager_bench.py [BOARDS[,BOARDS...] [REPORTS_PER_S [SECONDS]]]\n"
+              "    Defaults 64,128,256 boards, 100 input reports per second each, 3 s per run")
+        sys.exit(1)
+
+    print("{0} input reports per second per board, {1} s per run\n".format(rate, seconds))
+    print("model     boards  reports/s  mean ms  p99 ms  max ms  CPU %  threads  features ms  "
+          "unplug ms  replug ms  checks")
+    failed = False
+    for boards in counts:
+        for name in ("manager", "threads"):
+            if name == "manager":
+                r = run_manager(boards, rate, seconds, True)
+            else:
+                r = run_threads(boards, rate, seconds)
+            ok = r["ok"] and r["delivered_ok"] and r["replug_ok"] and r["replies_ok"]
+            failed = failed or not ok
+            hotplug = ("{0:9.1f}  {1:9.1f}".format(*r["hotplug_ms"]) if r["hotplug_ms"] is not None
+                       else "{0:>9}  {0:>9}".format("-"))
+            print("{0:<8} {1:>7} {2:>10.0f} {3:>8.2f} {4:>7.2f} {5:>7.2f} {6:>6.0f} {7:>8} {8:>12.1f}  {9}  {10}".format(
+                  name, boards, r["reports"] / seconds, r["latency"][0], r["latency"][1], r["latency"][2],
+                  r["cpu"], r["threads"], r["features_ms"], hotplug, "ok" if ok else "FAILED"))
+            if not ok:
+                print("    added {0}, delivered {1}, replugged boards report {2}, feature replies {3}".format(
+                      r["ok"], r["delivered_ok"], r["replug_ok"], r["replies_ok"]))
+
+    print("\nhid_manager checks: {0}".format("FAILED" if failed else "passed"))
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,215 @@
+# Tagged calls over HID_REPORT_ID_RPC reports
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import concurrent.futures
+import struct
+import threading
+import time
+
+from custom_hid import HID_REPORT_MAX_SIZE, HID_REPORT_ID_RPC
+
+# Must match hid_rpc.h
+RPC_VERSION = 1
+RPC_WINDOW = 8
+RPC_MAX_DATA = HID_REPORT_MAX_SIZE - 4
+RPC_METHOD_PING = 0x00
+RPC_METHOD_INFO = 0x01
+RPC_METHOD_GET_FEATURE = 0x02
+RPC_METHOD_SET_FEATURE = 0x03
+RPC_METHOD_LED5 = 0x04
+RPC_STATUS_NAMES = ("ok", "no such method", "bad arguments", "refused")
+RPC_STATS_FIELDS = ("requests", "errors", "dropped", "malformed")
+
+
+def _gather(futures, combine):
+    """Future of combine(results) once all futures completed."""
+    gathered = concurrent.futures.Future()
+    remaining = [len(futures)]
+    lock = threading.Lock()
+
+    def _done(_):
+        with lock:
+            remaining[0] -= 1
+            if remaining[0]:
+                return
+        try:
+            gathered.set_result(combine([f.result() for f in futures]))
+        except Exception as e:
+            gathered.set_exception(e)
+
+    for future in futures:
+        future.add_done_callback(_done)
+    return gathered
+
+
+class RPCClient:
+    """Calls to the device with up to window of them outstanding.
+
+    Each call goes out in an output report with a tag, the response input
+    report carries the tag back, so calls overlap instead of each paying
+    a full round trip. call_async() returns a future and blocks only while
+    window calls are outstanding. Calls fail with
+    concurrent.futures.TimeoutError when no response came within their
+    timeout, e.g. when the device dropped them, and free their slot.
+
+    Tags cycle through all 256 values, a late response to a timed out call
+    is only mistaken for another call's after 256 more calls. Futures
+    complete on the input report thread, callbacks must not block.
+    """
+
+    def __init__(self, hid, window=RPC_WINDOW, timeout=1.0):
+        self.hid = hid
+        self.window = window
+        self.timeout = timeout
+        self.calls = 0
+        self.timeouts = 0
+        self.late = 0
+        self._lock = threading.Condition()
+        self._write_lock = threading.Lock()
+        self._pending = {}
+        self._next_tag = 0
+        self._closing = False
+        hid.rpc_rx_callback = self._handle_response
+        self._thread = threading.Thread(target=self._expire)
+        self._thread.start()
+
+    def call_async(self, method, args=b"", timeout=None):
+        args = bytes(args)
+        if len(args) > RPC_MAX_DATA:
+            raise Exception("RPC arguments longer than {0} bytes".format(RPC_MAX_DATA))
+        future = concurrent.futures.Future()
+        with self._lock:
+            while len(self._pending) >= self.window and not self._closing:
+                self._lock.wait()
+            if self._closing:
+                raise Exception("RPC client closed")
+            tag = self._next_tag
+            while tag in self._pending:
+                tag = (tag + 1) & 0xFF
+            self._next_tag = (tag + 1) & 0xFF
+            deadline = time.monotonic() + (self.timeout if timeout is None else timeout)
+            # Registered before the request goes out, the response may beat write().
+            self._pending[tag] = (future, deadline, method)
+            self.calls += 1
+            self._lock.notify_all()
+        try:
+            with self._write_lock:
+                self.hid.ep_out.write(bytes([HID_REPORT_ID_RPC, tag, method, len(args)]) + args)
+        except Exception as e:
+            with self._lock:
+                self._pending.pop(tag, None)
+                self._lock.notify_all()
+            future.set_exception(e)
+        return future
+
+    def call(self, method, args=b"", timeout=None):
+        return self.call_async(method, args, timeout).result()
+
+    def ping(self, data=b""):
+        return self.call(RPC_METHOD_PING, data)
+
+    def info(self):
+        version, window, max_data, _, *stats = struct.unpack_from(
+            "<BBBB{0}I".format(len(RPC_STATS_FIELDS)), self.call(RPC_METHOD_INFO))
+        return dict(version=version, window=window, max_data=max_data,
+                    stats=dict(zip(RPC_STATS_FIELDS, stats)))
+
+    def get_feature_async(self, report_id, length=HID_REPORT_MAX_SIZE):
+        """Feature report without report ID, pieces are fetched in parallel."""
+        futures = [self.call_async(RPC_METHOD_GET_FEATURE, [report_id, offset])
+                   for offset in range(0, length - 1, RPC_MAX_DATA)]
+        return _gather(futures, b"".join)
+
+    def get_feature(self, report_id, length=HID_REPORT_MAX_SIZE):
+        return self.get_feature_async(report_id, length).result()
+
+    def set_feature_async(self, report_id, payload):
+        return self.call_async(RPC_METHOD_SET_FEATURE, bytes([report_id]) + bytes(payload))
+
+    def set_feature(self, report_id, payload):
+        self.set_feature_async(report_id, payload).result()
+
+    def set_led5(self, on):
+        self.call(RPC_METHOD_LED5, [1 if on else 0])
+
+    def close(self):
+        with self._lock:
+            self._closing = True
+            pending = [future for future, _, _ in self._pending.values()]
+            self._pending.clear()
+            self._lock.notify_all()
+        self._thread.join()
+        if self.hid.rpc_rx_callback == self._handle_response:
+            self.hid.rpc_rx_callback = None
+        for future in pending:
+            future.cancel()
+
+    def _handle_response(self, report):
+        tag, status, length = report[1], report[2], report[3]
+        with self._lock:
+            entry = self._pending.pop(tag, None)
+            if entry is None:
+                self.late += 1
+                return
+            self._lock.notify_all()
+        future, _, method = entry
+        if status == 0:
+            future.set_result(bytes(report[4:4 + length]))
+        else:
+            name = RPC_STATUS_NAMES[status] if status < len(RPC_STATUS_NAMES) else status
+            future.set_exception(Exception("RPC method {0}: {1}".format(method, name)))
+
+    def _expire(self):
+        while True:
+            with self._lock:
+                if self._closing:
+                    return
+                now = time.monotonic()
+                expired = [tag for tag, (_, deadline, _) in self._pending.items() if deadline <= now]
+                if not expired:
+                    deadlines = [deadline for _, deadline, _ in self._pending.values()]
+                    self._lock.wait(min(deadlines) - now if deadlines else None)
+                    continue
+                futures = [self._pending.pop(tag)[0] for tag in expired]
+                self.timeouts += len(futures)
+                self._lock.notify_all()
+            for future in futures:
+                future.set_exception(concurrent.futures.TimeoutError("RPC call timed out"))
+
+
+def benchmark(client, count=1000, windows=(1, 2, 4, 8)):
+    """Calls per second of count pings at each window size."""
+    rates = []
+    window = client.window
+    try:
+        for size in windows:
+            client.window = size
+            began = time.monotonic()
+            futures = [client.call_async(RPC_METHOD_PING) for _ in range(count)]
+            concurrent.futures.wait(futures)
+            rates.append((size, count / (time.monotonic() - began)))
+    finally:
+        client.window = window
+    return rates
@@ -0,0 +1,126 @@
+# hidraw against libusb on the same board, Linux only
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import sys
+import time
+
+from custom_hid import CustomHID, HID_REPORT_ID_POWER
+from custom_hidraw import CustomHIDRaw, find_hidraw
+from hid_rpc import RPCClient, RPC_METHOD_PING, benchmark
+
+VID = 0x1209
+PID = 0x0001
+
+# The uhid board (uhid_device.c) is a HID device without USB under it,
+# only the hidraw leg runs there. The FunctionFS board (ffs_device.c) on
+# dummy_hcd is a USB device, both legs run against the same firmware. The
+# libusb leg detaches the kernel driver and attaches it back on close, so
+# it runs second. Start one of them, then
+# $ sudo python3 hidraw_bench.py
+
+
+def _percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * fraction))]
+
+
+def measure(hid, count):
+    result = {}
+
+    samples = []
+    for _ in range(count):
+        start = time.perf_counter()
+        hid._get_feature(HID_REPORT_ID_POWER, 64)
+        samples.append(time.perf_counter() - start)
+    result["feature"] = (1e6 * sum(samples) / count, 1e6 * _percentile(samples, 0.99))
+
+    client = RPCClient(hid)
+    try:
+        samples = []
+        for _ in range(count):
+            start = time.perf_counter()
+            client.call(RPC_METHOD_PING)
+            samples.append(time.perf_counter() - start)
+        result["ping"] = (1e6 * sum(samples) / count, 1e6 * _percentile(samples, 0.99))
+
+        # Host CPU of both the calling and the input report thread.
+        cpu = time.process_time()
+        rates = benchmark(client, count, windows=(1, 8))
+        cpu = time.process_time() - cpu
+        result["rates"] = rates
+        result["cpu_us"] = 1e6 * cpu / (count * len(rates))
+        result["timeouts"] = client.timeouts
+    finally:
+        client.close()
+    return result
+
+
+def run(name, count):
+    if name == "hidraw":
+        found = find_hidraw(VID, PID)
+        if not found:
+            return None, "no hidraw node for {0:04X}:{1:04X}".format(VID, PID)
+        hid = CustomHIDRaw(VID, PID, node=found[0][0])
+    else:
+        try:
+            hid = CustomHID(VID, PID)
+        except Exception as e:
+            return None, "{0}, a uhid board is not a USB device".format(e)
+    try:
+        return measure(hid, count), None
+    finally:
+        hid.close()
+
+
+if __name__ == "__main__":
+    legs = ["hidraw", "libusb"]
+    count = 1000
+    try:
+        if len(sys.argv) > 1 and sys.argv[1] in legs:
+            legs = [sys.argv.pop(1)]
+        if len(sys.argv) > 1:
+            count = int(sys.argv[1])
+    except ValueError:
+        count = 0
+    if count <= 0:
+        print("Usage: hidraw_bench.py [hidraw|libusb] [COUNT]\n"
+              "    Runs both legs against the board with COUNT requests each, default 1000")
+        sys.exit(1)
+
+    results = [(name,) + run(name, count) for name in legs]
+
+    print("\n{0} requests per measurement\n".format(count))
+    print("backend  feature us  p99 us  ping us  p99 us  calls/s w1  calls/s w8  CPU us/call  timeouts")
+    failed = False
+    for name, r, skipped in results:
+        if r is None:
+            print("{0:<8} skipped: {1}".format(name, skipped))
+            continue
+        rates = dict(r["rates"])
+        print("{0:<8} {1:>10.0f} {2:>7.0f} {3:>8.0f} {4:>7.0f} {5:>11.0f} {6:>11.0f} {7:>12.1f} {8:>9}".format(
+              name, r["feature"][0], r["feature"][1], r["ping"][0], r["ping"][1], rates[1], rates[8],
+              r["cpu_us"], r["timeouts"]))
+        failed = failed or r["timeouts"] > 0
+    sys.exit(1 if failed or all(r is None for _, r, _ in results) else 0)
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test of init_stages.c with simulated stages, then a boot timeline
+ * of boot_stages.c and msc_disk.c with made up init costs.
+ *
+ * Checks cover dependency order, rejected tables, failure propagation,
+ * on demand versus background starts and per stage durations. The
+ * timeline compares bringing every part up before USB connect with the
+ * staged boot, main loop clearing the RAM disk one chunk per pass and
+ * running one background stage per pass. Host may select SPIFI media
+ * some time after connect, which pulls that stage forward.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o init_stages_sim -I../lpc_chip_43xx/inc -Iinc tools/init_stages_sim.c src/init_stages.c
+ * $ ./init_stages_sim [-r ram_clear_us_per_mb] [-q spifi_request_us]
+ */
+
+#include "lpc_types.h"
+#include "init_stages.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Simulated clock, init functions advance it by their cost */
+static uint32_t now;
+static uint32_t failures;
+
+static uint32_t sim_now_us(void) {
+	return now;
+}
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Test stages log their order and cost 10 us times their index plus one */
+#define TEST_STAGES		5
+
+static uint32_t run_order[TEST_STAGES];
+static uint32_t num_runs;
+static uint32_t fail_mask;
+
+#define TEST_INIT(n) \
+	static bool test_init_##n(void *ctx) { \
+		run_order[num_runs++] = n; \
+		now += 10 * (n + 1); \
+		return !(fail_mask & (1UL << n)); \
+	}
+
+TEST_INIT(0)
+TEST_INIT(1)
+TEST_INIT(2)
+TEST_INIT(3)
+TEST_INIT(4)
+
+static void reset_test(uint32_t fail) {
+	now = 1000;
+	num_runs = 0;
+	fail_mask = fail;
+}
+
+static void test_tables(void) {
+	init_stages_t st;
+	const init_stage_def_t cycle[3] = {
+		{ test_init_0, 1 << 2, false },
+		{ test_init_1, 1 << 0, false },
+		{ test_init_2, 1 << 1, false },
+	};
+	const init_stage_def_t unknown[2] = {
+		{ test_init_0, 0, false },
+		{ test_init_1, 1 << 5, false },
+	};
+	const init_stage_def_t self[1] = {
+		{ test_init_0, 1 << 0, false },
+	};
+
+	check(!init_stages_init(&st, cycle, 3, sim_now_us, NULL), "cycle rejected");
+	check(!init_stages_init(&st, unknown, 2, sim_now_us, NULL), "unknown dependency rejected");
+	check(!init_stages_init(&st, self, 1, sim_now_us, NULL), "self dependency rejected");
+	check(!init_stages_init(&st, unknown, INIT_STAGES_MAX + 1, sim_now_us, NULL), "too many stages rejected");
+}
+
+/*   0 <- 1 <- 3
+ *   0 <- 2 <- 3, 4 alone, 2 and 4 background */
+static const init_stage_def_t diamond[TEST_STAGES] = {
+	{ test_init_0, 0, false },
+	{ test_init_1, 1 << 0, false },
+	{ test_init_2, 1 << 0, true },
+	{ test_init_3, (1 << 1) | (1 << 2), false },
+	{ test_init_4, 0, true },
+};
+
+static void test_order(void) {
+	init_stages_t st;
+
+	reset_test(0);
+	check(init_stages_init(&st, diamond, TEST_STAGES, sim_now_us, NULL), "diamond accepted");
+	check(init_stages_pending(&st), "background pending");
+	check(init_stages_require(&st, 3), "require 3");
+	check((num_runs == 4) && (run_order[0] == 0) && (run_order[1] == 1) && (run_order[2] == 2) &&
+		  (run_order[3] == 3), "dependencies first, once each");
+	check(st.status[2].on_demand && st.status[3].on_demand, "pulled in stages are on demand");
+	check(st.status[3].duration_us == 40, "duration excludes dependencies");
+	check(st.status[3].start_us == 1000 + 10 + 20 + 30, "start after dependencies");
+	check(init_stages_require(&st, 1) && (num_runs == 4), "done stage not run again");
+
+	init_stages_process(&st);
+	check((num_runs == 5) && (run_order[4] == 4) && !st.status[4].on_demand, "background stage 4");
+	check(!init_stages_pending(&st), "nothing pending");
+	init_stages_process(&st);
+	check(num_runs == 5, "process idles");
+	check(!init_stages_require(&st, TEST_STAGES), "unknown stage");
+}
+
+static void test_failure(void) {
+	init_stages_t st;
+
+	reset_test(1 << 0);
+	init_stages_init(&st, diamond, TEST_STAGES, sim_now_us, NULL);
+	check(!init_stages_require(&st, 3), "failed dependency fails stage");
+	check((num_runs == 1) && (st.status[0].state == INIT_STAGE_FAILED), "stops at first failure");
+	check(st.status[3].state == INIT_STAGE_FAILED, "dependent marked failed");
+	check(!init_stages_require(&st, 0) && (num_runs == 1), "failed stage not retried");
+
+	// Background stage depending on a failed one leaves pending state too.
+	init_stages_process(&st);
+	init_stages_process(&st);
+	check(!init_stages_pending(&st), "failed background not pending");
+	check(init_stages_done(&st, 4) && !init_stages_done(&st, 2), "independent stage still runs");
+}
+
+/* Boot timeline, same stages as boot_stages.c plus main loop work of msc_disk.c */
+#define BOOT_SDRAM		0
+#define BOOT_SPIFI		1
+#define BOOT_ETH_PHY	2
+#define BOOT_STAGES		3
+
+#define RAM_DISK_MB		16
+#define MAIN_LOOP_US	20		/* Pass through every other module */
+
+static const char *const boot_names[BOOT_STAGES] = { "sdram", "spifi", "eth_phy" };
+static const uint32_t boot_costs[BOOT_STAGES] = { 200, 3000, 15000 };
+static const uint32_t usb_init_us = 2500;
+
+static uint32_t ram_clear_us_per_mb = 5000;
+static uint32_t spifi_request_us = 30000;
+
+static bool boot_init_sdram(void *ctx) {
+	now += boot_costs[BOOT_SDRAM];
+	return true;
+}
+
+static bool boot_init_spifi(void *ctx) {
+	now += boot_costs[BOOT_SPIFI];
+	return true;
+}
+
+static bool boot_init_eth_phy(void *ctx) {
+	now += boot_costs[BOOT_ETH_PHY];
+	return true;
+}
+
+static const init_stage_def_t boot_defs[BOOT_STAGES] = {
+	[BOOT_SDRAM]	= { boot_init_sdram, 0, true },
+	[BOOT_SPIFI]	= { boot_init_spifi, 0, true },
+	[BOOT_ETH_PHY]	= { boot_init_eth_phy, 0, true },
+};
+
+typedef struct {
+	uint32_t connect_us;
+	uint32_t ram_ready_us;
+	uint32_t spifi_ready_us;	/* From host request */
+	uint32_t longest_pass_us;	/* Main loop blocked at most this long */
+} boot_result_t;
+
+static void boot_eager(boot_result_t *result) {
+	init_stages_t st;
+	uint32_t i;
+
+	now = 0;
+	init_stages_init(&st, boot_defs, BOOT_STAGES, sim_now_us, NULL);
+	for (i = 0; i < BOOT_STAGES; i++) {
+		init_stages_require(&st, i);
+	}
+	now += RAM_DISK_MB * ram_clear_us_per_mb;
+	result->ram_ready_us = now;
+	now += usb_init_us;
+	result->connect_us = now;
+	result->spifi_ready_us = 0;
+	result->longest_pass_us = MAIN_LOOP_US;
+}
+
+static void boot_staged(boot_result_t *result, init_stages_t *st) {
+	uint32_t cleared_mb = 0, pass_start, request_at;
+	bool requested = false;
+
+	now = 0;
+	init_stages_init(st, boot_defs, BOOT_STAGES, sim_now_us, NULL);
+	now += usb_init_us;
+	result->connect_us = now;
+	result->ram_ready_us = 0;
+	result->spifi_ready_us = 0;
+	result->longest_pass_us = 0;
+	request_at = now + spifi_request_us;
+
+	while ((cleared_mb < RAM_DISK_MB) || init_stages_pending(st) || (spifi_request_us && !requested)) {
+		pass_start = now;
+
+		// Select command from USB interrupt, run by msc_disk_process() next pass.
+		if (spifi_request_us && !requested && (now >= request_at)) {
+			requested = true;
+			init_stages_require(st, BOOT_SDRAM);
+			init_stages_require(st, BOOT_SPIFI);
+			result->spifi_ready_us = now - request_at;
+		}
+		if ((cleared_mb < RAM_DISK_MB) && init_stages_require(st, BOOT_SDRAM)) {
+			now += ram_clear_us_per_mb;
+			if (++cleared_mb == RAM_DISK_MB) {
+				result->ram_ready_us = now;
+			}
+		}
+		init_stages_process(st);
+		now += MAIN_LOOP_US;
+
+		result->longest_pass_us = MAX(result->longest_pass_us, now - pass_start);
+	}
+}
+
+static void print_boot(void) {
+	boot_result_t eager, staged;
+	init_stages_t st;
+	uint32_t i;
+
+	boot_eager(&eager);
+	boot_staged(&staged, &st);
+
+	printf("\n%u MB RAM disk cleared at %u us/MB, SPIFI requested %u us after connect\n\n",
+		   RAM_DISK_MB, ram_clear_us_per_mb, spifi_request_us);
+	printf("stage    state  demand  start us  duration us\n");
+	for (i = 0; i < BOOT_STAGES; i++) {
+		printf("%-8s %5u %7u %9u %12u\n", boot_names[i], st.status[i].state, st.status[i].on_demand,
+			   st.status[i].start_us, st.status[i].duration_us);
+	}
+	printf("\n        connect us  RAM disk ready us  SPIFI wait us  longest pass us\n");
+	printf("eager   %10u %18u %14s %16u\n", eager.connect_us, eager.ram_ready_us, "-",
+		   eager.longest_pass_us);
+	printf("staged  %10u %18u ", staged.connect_us, staged.ram_ready_us);
+	if (spifi_request_us) {
+		printf("%14u %16u\n", staged.spifi_ready_us, staged.longest_pass_us);
+	}
+	else {
+		printf("%14s %16u\n", "-", staged.longest_pass_us);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:q:")) != -1) {
+		switch (opt) {
+		case 'r':
+			ram_clear_us_per_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			spifi_request_us = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-r ram_clear_us_per_mb] [-q spifi_request_us]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	test_tables();
+	test_order();
+	test_failure();
+	printf("init_stages checks: %s\n", failures ? "FAILED" : "passed");
+
+	print_boot();
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+# Check logic_rle_sim.c streams with the test tool's decoder
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import sys
+import time
+
+from custom_hid import decode_logic_runs
+
+WAVEFORMS = ["idle", "clock", "uart", "spi", "noise"]
+# Second table of logic_rle_sim, these streams carry gaps.
+WAVEFORMS += [name + "_usb" for name in WAVEFORMS]
+
+
+def check(prefix, name):
+    with open("{0}_{1}.stream".format(prefix, name), "rb") as f:
+        stream = f.read()
+    with open("{0}_{1}.samples".format(prefix, name), "rb") as f:
+        samples = f.read()
+
+    start = time.monotonic()
+    runs = decode_logic_runs(stream)
+    seconds = time.monotonic() - start
+
+    # Gaps have no samples behind them, sim leaves dropped samples out too.
+    decoded = b"".join(bytes([value]) * length for value, length, gap in runs if not gap)
+    ok = decoded == samples
+    print("{0:<10} {1:>8} runs {2:>10.1f} KB/s decoded  {3}".format(
+          name, len(runs), len(stream) / 1024.0 / max(seconds, 1e-6), "ok" if ok else "FAILED"))
+    return ok
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("Usage: logic_rle_check.py PREFIX [WAVEFORM...]\n"
+              "    PREFIX as given to logic_rle_sim -o")
+        sys.exit(1)
+
+    results = [check(sys.argv[1], name) for name in (sys.argv[2:] or WAVEFORMS)]
+    sys.exit(0 if all(results) else 1)
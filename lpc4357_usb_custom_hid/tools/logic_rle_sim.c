@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host round trip of logic_rle.c on synthetic waveforms. Samples are fed
+ * in DMA sized blocks, chunks are taken as the HID IN endpoint would and
+ * their payloads decoded back. Decoded runs must give back every sample
+ * that was fed, gaps must account for every one that was not.
+ *
+ * First table drains every chunk right away and shows compression ratio
+ * and host encoding throughput. Second one takes one chunk per
+ * millisecond like the device does, so busy waveforms overrun the FIFO at
+ * high sample rates and show up as gaps.
+ *
+ * With -o, the stream and the samples it must decode to are written per
+ * waveform and table for tools/logic_rle_check.py, which decodes them with the
+ * test tool's decode_logic_runs().
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o logic_rle_sim -I../lpc_chip_43xx/inc -Iinc tools/logic_rle_sim.c src/logic_rle.c
+ * $ ./logic_rle_sim [-s sample_rate] [-o prefix]
+ */
+
+#include "lpc_types.h"
+#include "logic_rle.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_SAMPLES			(4 * 1024 * 1024)
+#define BLOCK_SIZE			8192		/* Raw segment of logic_capture.c */
+#define FIFO_SIZE			4096
+#define CHUNK_MAX			63			/* Logic report without report ID */
+
+typedef void (*waveform_fn)(uint8_t *samples, uint32_t count);
+
+typedef struct {
+	uint64_t samples;
+	uint64_t kept;
+	uint64_t dropped;
+	uint64_t stream_bytes;
+	uint32_t chunks;
+	uint32_t gaps;
+	double seconds;
+	bool ok;
+} trip_result_t;
+
+static uint32_t sample_rate = 17000000;
+static const char *out_prefix;
+
+static uint8_t samples[NUM_SAMPLES];
+static uint8_t kept[NUM_SAMPLES];
+static uint8_t fifo[FIFO_SIZE];
+static uint8_t stream[2 * NUM_SAMPLES + 1024];
+
+static void wave_idle(uint8_t *s, uint32_t count) {
+	memset(s, 0xFF, count);
+	s[count / 2] = 0xFE;
+}
+
+/* Channel 0 toggles every 4 samples, the rest sits still. */
+static void wave_clock(uint8_t *s, uint32_t count) {
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		s[i] = 0xF0 | ((i / 4) & 1);
+	}
+}
+
+/* 115200 baud on channel 1, random bytes with random idle time between. */
+static void wave_uart(uint8_t *s, uint32_t count) {
+	uint32_t bit_samples = MAX(sample_rate / 115200, 1), i = 0, end, bit, frame;
+
+	memset(s, 0xFF, count);
+	while (i < count) {
+		i += rand() % (20 * bit_samples);
+		// Start bit low, 8 data bits, stop bit high.
+		frame = 0x200 | ((rand() & 0xFF) << 1);
+		for (bit = 0; bit < 10; bit++) {
+			for (end = MIN(count, i + bit_samples); i < end; i++) {
+				if (!(frame & (1 << bit))) {
+					s[i] &= ~0x02;
+				}
+			}
+		}
+	}
+}
+
+/* SPI bursts, clock on channel 2 every 8 samples, data on channel 3. */
+static void wave_spi(uint8_t *s, uint32_t count) {
+	uint32_t i, start, end;
+
+	memset(s, 0x00, count);
+	for (start = 10000; start < count; start += 50000) {
+		end = MIN(count, start + 8 * 8 * 1024);
+		for (i = start; i < end; i++) {
+			s[i] = 0x01 | (((i - start) / 4) & 1) << 2 | ((rand() & 1) && ((i - start) % 8 == 0) ? 0x08 : (s[i - 1] & 0x08));
+		}
+	}
+}
+
+static void wave_noise(uint8_t *s, uint32_t count) {
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		s[i] = rand();
+	}
+}
+
+static const struct {
+	const char *name;
+	waveform_fn fn;
+} waveforms[] = {
+	{ "idle", wave_idle },
+	{ "clock", wave_clock },
+	{ "uart", wave_uart },
+	{ "spi", wave_spi },
+	{ "noise", wave_noise },
+};
+
+static uint32_t read_varint(const uint8_t *p, uint64_t *offset, uint64_t end, bool *ok) {
+	uint32_t value = 0, shift = 0;
+	uint8_t byte;
+
+	do {
+		if ((*offset >= end) || (shift > 28)) {
+			*ok = false;
+			return 0;
+		}
+		byte = p[(*offset)++];
+		value |= (uint32_t) (byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return value;
+}
+
+/* Same as decode_logic_runs() in custom_hid.py, checked against kept samples. */
+static bool decode_check(const trip_result_t *r) {
+	uint64_t offset = 0, pos = 0, dropped = 0;
+	uint32_t length, i;
+	uint8_t value;
+	bool ok = true;
+
+	while (ok && (offset < r->stream_bytes)) {
+		value = stream[offset++];
+		length = read_varint(stream, &offset, r->stream_bytes, &ok);
+		if (length == 0) {
+			dropped += read_varint(stream, &offset, r->stream_bytes, &ok);
+			continue;
+		}
+		for (i = 0; ok && (i < length); i++, pos++) {
+			ok = (pos < r->kept) && (kept[pos] == value);
+		}
+	}
+	return ok && (pos == r->kept) && (dropped == r->dropped);
+}
+
+/* Chunk headers must count up from FIRST to END. */
+static bool take_chunk(logic_rle_t *rle, trip_result_t *r, bool flush, bool *end) {
+	uint8_t chunk[CHUNK_MAX];
+	uint32_t length = logic_rle_chunk(rle, chunk, sizeof(chunk), flush);
+
+	if (length == 0) {
+		return false;
+	}
+	if (((uint32_t) (chunk[0] | (chunk[1] << 8)) != (r->chunks & 0xFFFF)) ||
+		(((chunk[2] & LOGIC_CHUNK_FIRST) != 0) != (r->chunks == 0)) ||
+		(chunk[3] != length - LOGIC_CHUNK_HEADER_SIZE)) {
+		r->ok = false;
+	}
+	memcpy(&stream[r->stream_bytes], &chunk[LOGIC_CHUNK_HEADER_SIZE], chunk[3]);
+	r->stream_bytes += chunk[3];
+	r->chunks++;
+	*end = (chunk[2] & LOGIC_CHUNK_END) != 0;
+	return true;
+}
+
+/* chunks_per_block 0 drains the FIFO after every feed. */
+static void round_trip(uint32_t chunks_per_block, uint32_t block, trip_result_t *r) {
+	logic_rle_t rle;
+	uint32_t pos, count, used, n;
+	struct timespec t0, t1;
+	bool end = false;
+
+	memset(r, 0, sizeof(*r));
+	r->ok = true;
+	logic_rle_init(&rle, fifo, sizeof(fifo));
+	logic_rle_arm(&rle, 0, 0, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (pos = 0; pos < NUM_SAMPLES; pos += block) {
+		count = MIN(block, NUM_SAMPLES - pos);
+		used = 0;
+		do {
+			n = logic_rle_feed(&rle, &samples[pos + used], count - used);
+			memcpy(&kept[r->kept], &samples[pos + used], n);
+			r->kept += n;
+			used += n;
+			if (used == count) {
+				break;
+			}
+			if (chunks_per_block) {
+				// FIFO full and USB is not draining faster, rest of the block is lost.
+				logic_rle_gap(&rle, count - used);
+				r->dropped += count - used;
+				break;
+			}
+		} while (take_chunk(&rle, r, true, &end));
+
+		for (n = 0; (!chunks_per_block || (n < chunks_per_block)) && take_chunk(&rle, r, false, &end); n++) {}
+	}
+	logic_rle_stop(&rle);
+	while (!end && take_chunk(&rle, r, true, &end)) {}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	r->seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	r->samples = NUM_SAMPLES;
+	r->gaps = rle.stats.gaps;
+	r->ok = r->ok && end && decode_check(r);
+}
+
+static bool write_file(const char *name, const char *mode, const char *suffix, const uint8_t *data, uint64_t length) {
+	char path[256];
+	FILE *f;
+	bool ok;
+
+	snprintf(path, sizeof(path), "%s_%s%s.%s", out_prefix, name, mode, suffix);
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return false;
+	}
+	ok = fwrite(data, 1, length, f) == length;
+	return (fclose(f) == 0) && ok;
+}
+
+int main(int argc, char *argv[]) {
+	trip_result_t r;
+	uint32_t i, block_ms;
+	bool ok = true;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:o:")) != -1) {
+		switch (opt) {
+		case 's':
+			sample_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_prefix = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s sample_rate] [-o prefix]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((sample_rate < 1000) || (sample_rate > 17000000)) {
+		fprintf(stderr, "sample rate 1 kHz .. 17 MHz\n");
+		return 1;
+	}
+
+	printf("%u samples per waveform, every chunk taken right away\n\n", NUM_SAMPLES);
+	printf("waveform  stream KB    ratio  chunks  host MB/s  round trip\n");
+	for (i = 0; i < sizeof(waveforms) / sizeof(waveforms[0]); i++) {
+		srand(1);
+		waveforms[i].fn(samples, NUM_SAMPLES);
+		round_trip(0, BLOCK_SIZE, &r);
+		printf("%-8s %10.1f %8.1f %7u %10.1f  %s\n", waveforms[i].name, r.stream_bytes / 1024.0,
+			   (double) r.samples / MAX(r.stream_bytes, 1), r.chunks, r.samples / 1048576.0 / r.seconds,
+			   r.ok ? "ok" : "FAILED");
+		ok = ok && r.ok;
+
+		if (out_prefix != NULL) {
+			ok = write_file(waveforms[i].name, "", "stream", stream, r.stream_bytes) &&
+				 write_file(waveforms[i].name, "", "samples", kept, r.kept) && ok;
+		}
+	}
+
+	// One millisecond of samples per block, one chunk per millisecond.
+	block_ms = MAX(sample_rate / 1000, 1);
+	printf("\n%u Hz sampling, one %u byte chunk per ms\n\n", sample_rate, CHUNK_MAX);
+	printf("waveform  stream KB/s  dropped %%   gaps  round trip\n");
+	for (i = 0; i < sizeof(waveforms) / sizeof(waveforms[0]); i++) {
+		srand(1);
+		waveforms[i].fn(samples, NUM_SAMPLES);
+		round_trip(1, block_ms, &r);
+		printf("%-8s %12.1f %10.2f %6u  %s\n", waveforms[i].name,
+			   r.stream_bytes / 1024.0 / ((double) NUM_SAMPLES / sample_rate),
+			   100.0 * r.dropped / r.samples, r.gaps, r.ok ? "ok" : "FAILED");
+		ok = ok && r.ok;
+
+		if (out_prefix != NULL) {
+			ok = write_file(waveforms[i].name, "_usb", "stream", stream, r.stream_bytes) &&
+				 write_file(waveforms[i].name, "_usb", "samples", kept, r.kept) && ok;
+		}
+	}
+	return ok ? 0 : 1;
+}
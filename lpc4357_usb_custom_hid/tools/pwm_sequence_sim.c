@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test of pwm_sequence.c, the step compiler of the PWM sequencer.
+ *
+ * Checks cover rounding and clamping of microseconds to ticks, duty
+ * clamping, register images of a step packed the way custom_hid.py
+ * pack_pwm_step() does, and zero periods being refused on every channel.
+ *
+ * Timing table compiles random steps for a range of periods and compares
+ * the period and duty the registers give back with what was asked for,
+ * worst error must stay within half a tick for period and one tick for
+ * duty. Last line is host compile speed in steps per second.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o pwm_sequence_sim -I../lpc_chip_43xx/inc -Iinc tools/pwm_sequence_sim.c src/pwm_sequence.c -lm
+ * $ ./pwm_sequence_sim [-m mcpwm_clk_hz] [-c sct_clk_hz]
+ */
+
+#include "lpc_types.h"
+#include "pwm_sequence.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STEPS_PER_RANGE		100000
+
+typedef struct {
+	uint32_t period_us;
+	uint16_t duty;
+} pwm_channel_t;
+
+static uint32_t failures;
+
+static uint32_t mcpwm_clk_hz = 204000000;
+static uint32_t sct_clk_hz = 204000000;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+	return p + 4;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+/* Same layout as pack_pwm_step() in custom_hid.py. */
+static void pack_step(uint8_t *wire, const pwm_channel_t *mcpwm, uint32_t sct_period_us, const uint16_t *sct_duty) {
+	uint32_t ch;
+
+	for (ch = 0; ch < PWM_NUM_MCPWM_CHANNELS; ch++) {
+		wire = put_u32(wire, mcpwm[ch].period_us);
+		wire = put_u16(wire, mcpwm[ch].duty);
+	}
+	wire = put_u32(wire, sct_period_us);
+	for (ch = 0; ch < PWM_NUM_SCT_OUTPUTS; ch++) {
+		wire = put_u16(wire, sct_duty[ch]);
+	}
+}
+
+static void test_tick_math(void) {
+	check(pwm_sequence_us_to_ticks(1, 204000000) == 204, "1 us at 204 MHz");
+	check(pwm_sequence_us_to_ticks(0, 204000000) == 2, "at least 2 ticks");
+	check(pwm_sequence_us_to_ticks(1, 1500000) == 2, "1.5 ticks rounds up");
+	check(pwm_sequence_us_to_ticks(3, 1500000) == 5, "4.5 ticks rounds up");
+	check(pwm_sequence_us_to_ticks(1, 1400000) == 2, "1.4 ticks clamped to 2");
+	check(pwm_sequence_us_to_ticks(7, 1400000) == 10, "9.8 ticks rounds to 10");
+	check(pwm_sequence_us_to_ticks(0xFFFFFFFF, 204000000) == 0xFFFFFFFF, "long period saturates");
+	check(pwm_sequence_us_to_ticks(21000000, 204000000) == 4284000000UL, "21 s fits 32 bits");
+
+	check(pwm_sequence_duty_to_ticks(1000, 0) == 0, "0 duty");
+	check(pwm_sequence_duty_to_ticks(1000, 1000) == 1000, "full duty");
+	check(pwm_sequence_duty_to_ticks(1000, 1500) == 1000, "duty clamped");
+	check(pwm_sequence_duty_to_ticks(999, 500) == 499, "half of odd period rounds down");
+	check(pwm_sequence_duty_to_ticks(0xFFFFFFFF, 1000) == 0xFFFFFFFF, "no overflow on long period");
+}
+
+static void test_compile(void) {
+	const pwm_channel_t mcpwm[PWM_NUM_MCPWM_CHANNELS] = { { 1000, 250 }, { 50000, 1000 }, { 20, 0 } };
+	const uint16_t sct_duty[PWM_NUM_SCT_OUTPUTS] = { 100, 500, 2000 };
+	uint8_t wire[PWM_STEP_WIRE_SIZE];
+	pwm_step_regs_t regs;
+	uint32_t ch;
+	bool ok;
+
+	pack_step(wire, mcpwm, 100, sct_duty);
+	ok = pwm_sequence_compile_step(wire, &regs, 204000000, 102000000);
+	check(ok, "valid step compiles");
+	check((regs.mcpwm[0] == 203999) && (regs.mcpwm[3] == 51000), "MCPWM 0 limit and match");
+	check((regs.mcpwm[1] == 10199999) && (regs.mcpwm[4] == 10200000), "MCPWM 1 full duty match past limit");
+	check((regs.mcpwm[2] == 4079) && (regs.mcpwm[5] == 0), "MCPWM 2 zero duty");
+	check((regs.mcpwm[6] == 0) && (regs.mcpwm[7] == 0), "dead time and pattern off");
+	check((regs.sct[0] == 10199) && (regs.sct[1] == 1020) && (regs.sct[2] == 5100) && (regs.sct[3] == 10200),
+		  "SCT limit and clamped matches");
+
+	for (ch = 0; ch <= PWM_NUM_MCPWM_CHANNELS; ch++) {
+		pwm_channel_t zero[PWM_NUM_MCPWM_CHANNELS];
+
+		memcpy(zero, mcpwm, sizeof(zero));
+		if (ch < PWM_NUM_MCPWM_CHANNELS) {
+			zero[ch].period_us = 0;
+		}
+		pack_step(wire, zero, (ch < PWM_NUM_MCPWM_CHANNELS) ? 100 : 0, sct_duty);
+		check(!pwm_sequence_compile_step(wire, &regs, 204000000, 102000000), "zero period refused");
+	}
+}
+
+typedef struct {
+	double period_err_ticks;	/* worst |actual - asked| period */
+	double period_err_ppm;
+	double duty_err_ticks;		/* worst |actual - asked| high time */
+} timing_err_t;
+
+static void check_timing(uint32_t period_us, uint16_t duty, uint32_t lim, uint32_t mat, uint32_t clk_hz,
+						 timing_err_t *err) {
+	double asked_ticks = (double) period_us * clk_hz / 1e6;
+	double ticks = (double) lim + 1;
+	double d = fabs(ticks - asked_ticks);
+
+	// Periods clamped to 2 ticks or to 32 bits are off on purpose.
+	if ((asked_ticks >= 2) && (asked_ticks < 4294967295.0)) {
+		err->period_err_ticks = fmax(err->period_err_ticks, d);
+		err->period_err_ppm = fmax(err->period_err_ppm, d / asked_ticks * 1e6);
+	}
+	err->duty_err_ticks = fmax(err->duty_err_ticks, fabs(mat - ticks * MIN(duty, PWM_DUTY_MAX) / PWM_DUTY_MAX));
+}
+
+static void run_range(uint32_t min_us, uint32_t max_us, timing_err_t *mcpwm_err, timing_err_t *sct_err,
+					  double *steps_per_s) {
+	uint8_t wire[PWM_STEP_WIRE_SIZE];
+	pwm_channel_t mcpwm[PWM_NUM_MCPWM_CHANNELS];
+	uint16_t sct_duty[PWM_NUM_SCT_OUTPUTS];
+	pwm_step_regs_t regs;
+	uint32_t sct_period_us, i, ch;
+	struct timespec t0, t1;
+	double compile_ns = 0;
+
+	memset(mcpwm_err, 0, sizeof(*mcpwm_err));
+	memset(sct_err, 0, sizeof(*sct_err));
+	for (i = 0; i < STEPS_PER_RANGE; i++) {
+		for (ch = 0; ch < PWM_NUM_MCPWM_CHANNELS; ch++) {
+			mcpwm[ch].period_us = min_us + (uint32_t) (((uint64_t) rand() * rand()) % (max_us - min_us + 1));
+			mcpwm[ch].duty = rand() % (PWM_DUTY_MAX + 1);
+			sct_duty[ch] = rand() % (PWM_DUTY_MAX + 1);
+		}
+		sct_period_us = min_us + (uint32_t) (((uint64_t) rand() * rand()) % (max_us - min_us + 1));
+		pack_step(wire, mcpwm, sct_period_us, sct_duty);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (!pwm_sequence_compile_step(wire, &regs, mcpwm_clk_hz, sct_clk_hz)) {
+			check(false, "random step compiles");
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		compile_ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+
+		for (ch = 0; ch < PWM_NUM_MCPWM_CHANNELS; ch++) {
+			check_timing(mcpwm[ch].period_us, mcpwm[ch].duty, regs.mcpwm[ch], regs.mcpwm[PWM_NUM_MCPWM_CHANNELS + ch],
+						 mcpwm_clk_hz, mcpwm_err);
+			check_timing(sct_period_us, sct_duty[ch], regs.sct[0], regs.sct[1 + ch], sct_clk_hz, sct_err);
+		}
+	}
+	*steps_per_s = STEPS_PER_RANGE / (compile_ns / 1e9);
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t ranges[][2] = {
+		{ 1, 10 }, { 10, 1000 }, { 1000, 100000 }, { 100000, 10000000 }, { 10000000, 4000000000UL },
+	};
+	timing_err_t mcpwm_err, sct_err;
+	double steps_per_s, worst_rate = 0;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:c:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mcpwm_clk_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			sct_clk_hz = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-m mcpwm_clk_hz] [-c sct_clk_hz]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((mcpwm_clk_hz < 1000000) || (sct_clk_hz < 1000000)) {
+		fprintf(stderr, "clocks must be at least 1 MHz\n");
+		return 1;
+	}
+
+	test_tick_math();
+	test_compile();
+
+	srand(1);
+	printf("MCPWM %u Hz, SCT %u Hz, %u random steps per range\n\n", mcpwm_clk_hz, sct_clk_hz, STEPS_PER_RANGE);
+	printf("        period us   MCPWM period err     duty err   SCT period err     duty err\n");
+	printf("                       ticks      ppm       ticks     ticks      ppm       ticks\n");
+	for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+		run_range(ranges[i][0], ranges[i][1], &mcpwm_err, &sct_err, &steps_per_s);
+		printf("%8u..%-10u %8.3f %8.3f %11.3f %9.3f %8.3f %11.3f\n", ranges[i][0], ranges[i][1],
+			   mcpwm_err.period_err_ticks, mcpwm_err.period_err_ppm, mcpwm_err.duty_err_ticks,
+			   sct_err.period_err_ticks, sct_err.period_err_ppm, sct_err.duty_err_ticks);
+		check((mcpwm_err.period_err_ticks <= 0.5) && (sct_err.period_err_ticks <= 0.5), "period within half a tick");
+		check((mcpwm_err.duty_err_ticks < 1.0) && (sct_err.duty_err_ticks < 1.0), "duty within one tick");
+		worst_rate = (i == 0) ? steps_per_s : MIN(worst_rate, steps_per_s);
+	}
+	printf("\nhost: %.0f steps compiled per second\n", worst_rate);
+
+	printf("\npwm_sequence checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
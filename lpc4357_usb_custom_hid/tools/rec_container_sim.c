@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test and benchmark of rec_container.c, the container format and
+ * batch scheduler behind sd_recorder.c, on a file backed card image.
+ *
+ * Tests cover readback at any offset and read size, recordings of exact
+ * and partial batch multiples, alignment of consecutive recordings, index
+ * persistence, recovery of a recording left open by a reset, a full card,
+ * a failing write, a corrupt batch header, the recording limit and an
+ * unformatted card.
+ *
+ * The sequential write benchmark runs in simulated device time. A producer
+ * appends 64 byte chunks at a fixed rate from "interrupt context", main
+ * loop writes batches through the blocking callbacks while the producer
+ * keeps filling the other buffer, as on the board. The card takes a command
+ * latency plus bus time per write, and a long busy period every few MB the
+ * way SD cards pause for internal housekeeping (the spec allows 250 ms).
+ * Dropped bytes show where double buffering stops covering the card. Host
+ * CPU throughput of the container on the file image is shown as well, and
+ * every recording is read back and compared.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o rec_container_sim -I../lpc_chip_43xx/inc -Iinc tools/rec_container_sim.c src/rec_container.c
+ * $ ./rec_container_sim [-f image_file] [-s seconds] [-l latency_us] [-b bus_kb_per_s] [-p pause_ms]
+ */
+
+#include "lpc_types.h"
+#include "rec_container.h"
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IMAGE_BLOCKS		(512 * 1024)	/* 256 MB, sparse */
+#define CHUNK_SIZE			64
+#define PAUSE_EVERY_BYTES	(4 * 1024 * 1024)
+
+static const char *image_path = "rec_container_sim.img";
+static uint32_t seconds = 10;
+static uint32_t latency_us = 1500;
+static uint32_t bus_kb_per_s = 10000;	/* 4 bit bus at 25 MHz, less overhead */
+static uint32_t pause_ms = 100;
+
+static int fd;
+static rec_blockdev_t dev;
+static rec_container_t rec;
+static uint32_t failures;
+
+/* Fault injection */
+static uint32_t fail_write_at = UINT32_MAX;	/* Block number */
+
+/* Device time model, only the benchmark sets the producer. */
+static uint64_t now_us;
+static uint64_t card_busy_us;
+static uint64_t card_bytes;
+static uint64_t longest_write_us;
+static uint32_t producer_interval_us;
+static uint64_t producer_next_us;
+static uint64_t produced;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Content of a recording depends on its id and offset only. */
+static uint8_t pattern(uint32_t id, uint32_t offset) {
+	return ((offset * 2654435761u) >> 24) ^ (id * 37) ^ (offset >> 16);
+}
+
+static void producer_run_until(uint64_t t);
+
+static bool file_read(void *ctx, uint32_t block, void *buffer, uint32_t count) {
+	return pread(fd, buffer, count * REC_BLOCK_SIZE, (off_t) block * REC_BLOCK_SIZE) ==
+		   (ssize_t) (count * REC_BLOCK_SIZE);
+}
+
+/* Write blocks main loop, producer interrupts it meanwhile. */
+static bool file_write(void *ctx, uint32_t block, const void *buffer, uint32_t count) {
+	uint64_t cost = latency_us + ((uint64_t) count * REC_BLOCK_SIZE * 1000000) / ((uint64_t) bus_kb_per_s * 1024);
+
+	if ((block <= fail_write_at) && (fail_write_at < block + count)) {
+		return false;
+	}
+	if ((card_bytes / PAUSE_EVERY_BYTES) != ((card_bytes + count * REC_BLOCK_SIZE) / PAUSE_EVERY_BYTES)) {
+		cost += pause_ms * 1000;
+	}
+	card_bytes += count * REC_BLOCK_SIZE;
+	card_busy_us += cost;
+	longest_write_us = MAX(longest_write_us, cost);
+	producer_run_until(now_us + cost);
+	return pwrite(fd, buffer, count * REC_BLOCK_SIZE, (off_t) block * REC_BLOCK_SIZE) ==
+		   (ssize_t) (count * REC_BLOCK_SIZE);
+}
+
+/* Producer appends chunks as the USB interrupt would, content by recording offset. */
+static void producer_run_until(uint64_t t) {
+	uint8_t chunk[CHUNK_SIZE];
+	uint32_t i;
+
+	while ((producer_interval_us > 0) && (producer_next_us <= t)) {
+		now_us = producer_next_us;
+		for (i = 0; i < CHUNK_SIZE; i++) {
+			chunk[i] = pattern(rec.current->id, rec.stats.bytes + i);
+		}
+		rec_append(&rec, chunk, CHUNK_SIZE);
+		produced += CHUNK_SIZE;
+		producer_next_us += producer_interval_us;
+	}
+	now_us = t;
+}
+
+static void image_create(uint32_t blocks) {
+	if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t) blocks * REC_BLOCK_SIZE) != 0) {
+		perror(image_path);
+		exit(1);
+	}
+	dev.num_blocks = blocks;
+}
+
+/* Appends in random sizes up to 62 bytes like HID reports, writing batches as they fill. */
+static uint32_t record(uint32_t length) {
+	uint8_t data[62];
+	uint32_t done = 0, n, i, accepted;
+
+	while (done < length) {
+		// MIN() evaluates its arguments twice.
+		n = 1 + (rand() % sizeof(data));
+		n = MIN(length - done, n);
+		for (i = 0; i < n; i++) {
+			data[i] = pattern(rec.current->id, done + i);
+		}
+		accepted = rec_append(&rec, data, n);
+		done += accepted;
+		while (rec_process(&rec)) {}
+		if (accepted < n) {
+			break;
+		}
+	}
+	return done;
+}
+
+/* Read back length bytes of recording index from offset in random pieces. */
+static bool readback(uint32_t index, uint32_t offset, uint32_t length, uint32_t *got) {
+	uint8_t data[256];
+	uint32_t id = rec.index.entries[index].id, expect = offset, at, n, i;
+	bool ok = true;
+
+	*got = 0;
+	if (!rec_read_start(&rec, index, offset, length)) {
+		return false;
+	}
+	for (;;) {
+		rec_process(&rec);
+		n = 1 + (rand() % sizeof(data));
+		n = rec_read(&rec, data, n, &at);
+		if (n == 0) {
+			if (!rec_pending(&rec)) {
+				break;
+			}
+			continue;
+		}
+		ok = ok && (at == expect);
+		for (i = 0; i < n; i++) {
+			ok = ok && (data[i] == pattern(id, at + i));
+		}
+		expect += n;
+		*got += n;
+	}
+	rec_read_stop(&rec);
+	return ok;
+}
+
+static bool remount(void) {
+	return rec_mount(&rec, &dev);
+}
+
+static void test_sizes(void) {
+	static const uint32_t sizes[] = { 0, 1, REC_BATCH_PAYLOAD - 1, REC_BATCH_PAYLOAD, REC_BATCH_PAYLOAD + 1,
+									  3 * REC_BATCH_PAYLOAD, 1000000 };
+	uint32_t i, got, block;
+
+	image_create(IMAGE_BLOCKS);
+	check(rec_format(&rec, &dev), "format");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		check(rec_start(&rec), "start");
+		check(record(sizes[i]) == sizes[i], "all bytes accepted");
+		check(rec_stop(&rec), "stop");
+	}
+
+	check(remount() && (rec.index.count == sizeof(sizes) / sizeof(sizes[0])), "index survives remount");
+	block = REC_ALIGN_BLOCKS;
+	for (i = 0; i < rec.index.count; i++) {
+		check(rec.index.entries[i].bytes == sizes[i], "recording length");
+		check(rec.index.entries[i].flags == 0, "recording closed");
+		check(rec.index.entries[i].start_block == block, "recordings packed on alignment");
+		check(readback(i, 0, UINT32_MAX, &got) && (got == sizes[i]), "full readback");
+		block += ((sizes[i] + REC_BATCH_PAYLOAD - 1) / REC_BATCH_PAYLOAD) * REC_BATCH_BLOCKS;
+		block = (block + REC_ALIGN_BLOCKS - 1) & ~(REC_ALIGN_BLOCKS - 1);
+	}
+
+	// Windows starting and ending inside, on and across batch boundaries.
+	i = rec.index.count - 1;
+	check(readback(i, REC_BATCH_PAYLOAD - 10, 20, &got) && (got == 20), "readback across batches");
+	check(readback(i, 2 * REC_BATCH_PAYLOAD, REC_BATCH_PAYLOAD, &got) && (got == REC_BATCH_PAYLOAD),
+		  "readback of one whole batch");
+	check(readback(i, 999990, 100, &got) && (got == 10), "readback clipped at end");
+	check(readback(i, 1000000, 100, &got) && (got == 0), "readback at end is empty");
+	check(!rec_read_start(&rec, i, 1000001, 1), "readback past end refused");
+	check(!rec_read_start(&rec, rec.index.count, 0, 1), "readback of missing recording refused");
+}
+
+static void test_recovery(void) {
+	uint32_t got;
+
+	image_create(IMAGE_BLOCKS);
+	rec_format(&rec, &dev);
+	rec_start(&rec);
+	record(2 * REC_BATCH_PAYLOAD);
+	rec_stop(&rec);
+
+	// Reset while recording, partial batch in RAM is lost.
+	rec_start(&rec);
+	record(3 * REC_BATCH_PAYLOAD + 1234);
+	check(remount(), "mount after reset");
+	check((rec.index.count == 2) && (rec.index.entries[1].bytes == 3 * REC_BATCH_PAYLOAD) &&
+		  !(rec.index.entries[1].flags & REC_ENTRY_OPEN), "open recording recovered up to last batch");
+	check(readback(1, 0, UINT32_MAX, &got) && (got == 3 * REC_BATCH_PAYLOAD), "recovered recording reads back");
+
+	// Stale batches of an older recording at the same place must not count.
+	check(remount() && rec_start(&rec), "start after recovery");
+	record(100);
+	check(remount() && (rec.index.entries[2].bytes == 0), "reset before first batch recovers nothing");
+	check(remount() && (rec.index.entries[0].bytes == 2 * REC_BATCH_PAYLOAD), "older recording untouched");
+}
+
+static void test_faults(void) {
+	uint32_t got, i, fit;
+	uint8_t block[REC_BLOCK_SIZE];
+
+	// Room for 5 batches behind the index.
+	image_create(REC_ALIGN_BLOCKS + 5 * REC_BATCH_BLOCKS);
+	rec_format(&rec, &dev);
+	rec_start(&rec);
+	fit = record(10 * REC_BATCH_PAYLOAD);
+	check((fit >= 5 * REC_BATCH_PAYLOAD) && (fit <= 7 * REC_BATCH_PAYLOAD) && rec.halted && (rec.stats.dropped > 0),
+		  "card full halts recording");
+	rec_stop(&rec);
+	check(rec.index.entries[0].bytes == 5 * REC_BATCH_PAYLOAD, "full card keeps written batches");
+	check(readback(0, 0, UINT32_MAX, &got) && (got == 5 * REC_BATCH_PAYLOAD), "full card reads back");
+	check(!rec_start(&rec), "no room for another recording");
+
+	image_create(IMAGE_BLOCKS);
+	rec_format(&rec, &dev);
+	rec_start(&rec);
+	fail_write_at = REC_ALIGN_BLOCKS + 2 * REC_BATCH_BLOCKS + 3;
+	record(5 * REC_BATCH_PAYLOAD);
+	fail_write_at = UINT32_MAX;
+	check(rec.halted && (rec.stats.write_errors == 1), "write error halts recording");
+	rec_stop(&rec);
+	check(rec.index.entries[0].bytes == 2 * REC_BATCH_PAYLOAD, "write error keeps earlier batches");
+
+	// Corrupt header of the second batch.
+	rec_start(&rec);
+	record(4 * REC_BATCH_PAYLOAD);
+	rec_stop(&rec);
+	file_read(NULL, rec.index.entries[1].start_block + REC_BATCH_BLOCKS, block, 1);
+	block[0] ^= 0xFF;
+	file_write(NULL, rec.index.entries[1].start_block + REC_BATCH_BLOCKS, block, 1);
+	check(readback(1, 0, UINT32_MAX, &got) && (got == REC_BATCH_PAYLOAD) && (rec.stats.read_errors == 1),
+		  "readback stops at corrupt batch");
+
+	for (i = rec.index.count; i < REC_MAX_RECORDINGS; i++) {
+		check(rec_start(&rec) && rec_stop(&rec), "recording up to limit");
+	}
+	check(!rec_start(&rec), "recording limit");
+
+	image_create(IMAGE_BLOCKS);
+	check(!remount(), "unformatted card not mounted");
+}
+
+typedef struct {
+	uint32_t kb_per_s;
+	uint64_t bytes;
+	uint64_t dropped;
+	double busy;
+	uint64_t longest_write_us;
+	double host_mb_s;
+	double read_mb_s;
+	bool ok;
+} bench_result_t;
+
+static double wall_seconds(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Record for seconds of device time at kb_per_s, then read it all back. */
+static void bench(uint32_t kb_per_s, bench_result_t *r) {
+	uint64_t end_us = (uint64_t) seconds * 1000000;
+	uint32_t got;
+	double t;
+
+	memset(r, 0, sizeof(*r));
+	r->kb_per_s = kb_per_s;
+	image_create(IMAGE_BLOCKS);
+	rec_format(&rec, &dev);
+	rec_start(&rec);
+	now_us = 0;
+	card_busy_us = 0;
+	card_bytes = 0;
+	longest_write_us = 0;
+	produced = 0;
+	producer_interval_us = (CHUNK_SIZE * 1000000) / (kb_per_s * 1024);
+	producer_next_us = 0;
+
+	t = wall_seconds();
+	while (now_us < end_us) {
+		// Main loop pass, a blocking card write lets the producer run inside it.
+		if (!rec_process(&rec)) {
+			producer_run_until(producer_next_us);
+		}
+	}
+	producer_interval_us = 0;
+	rec_stop(&rec);
+	t = wall_seconds() - t;
+
+	r->bytes = rec.index.entries[0].bytes;
+	r->dropped = produced - r->bytes;
+	r->busy = (double) card_busy_us / now_us;
+	r->longest_write_us = longest_write_us;
+	r->host_mb_s = r->bytes / 1048576.0 / MAX(t, 1e-9);
+	r->ok = (r->dropped == rec.stats.dropped) && !rec.halted;
+
+	t = wall_seconds();
+	r->ok = readback(0, 0, UINT32_MAX, &got) && (got == r->bytes) && r->ok;
+	r->read_mb_s = got / 1048576.0 / MAX(wall_seconds() - t, 1e-9);
+}
+
+int main(int argc, char *argv[]) {
+	// HID at 1 ms and 125 us, then firmware sources.
+	static const uint32_t rates[] = { 62, 496, 1000, 2000, 4000, 6000, 8000 };
+	bench_result_t r;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:s:l:b:p:")) != -1) {
+		switch (opt) {
+		case 'f':
+			image_path = optarg;
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			latency_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bus_kb_per_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pause_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f image_file] [-s seconds] [-l latency_us] [-b bus_kb_per_s] [-p pause_ms]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if ((seconds == 0) || (bus_kb_per_s == 0)) {
+		fprintf(stderr, "seconds and bus rate must be set\n");
+		return 1;
+	}
+
+	fd = open(image_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(image_path);
+		return 1;
+	}
+	dev.read = file_read;
+	dev.write = file_write;
+	dev.ctx = NULL;
+	srand(1);
+
+	test_sizes();
+	test_recovery();
+	test_faults();
+
+	printf("%u KB batches, card %u us per write + %u KB/s, %u ms pause every %u MB, %u s per run\n\n",
+		   REC_BATCH_SIZE / 1024, latency_us, bus_kb_per_s, pause_ms, PAUSE_EVERY_BYTES >> 20, seconds);
+	printf("  in KB/s  recorded KB  dropped %%  card busy %%  longest ms  host MB/s  read MB/s  data\n");
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		bench(rates[i], &r);
+		printf("%9u %12.0f %10.2f %12.1f %11.1f %10.1f %10.1f  %s\n", r.kb_per_s, r.bytes / 1024.0,
+			   100.0 * r.dropped / MAX(r.bytes + r.dropped, 1), 100.0 * r.busy, r.longest_write_us / 1000.0,
+			   r.host_mb_s, r.read_mb_s, r.ok ? "ok" : "FAILED");
+		check(r.ok, "benchmark recording reads back");
+	}
+
+	close(fd);
+	unlink(image_path);
+	printf("\nrec_container checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+# Host side of report_crypt, AES-128 CTR of report payloads.
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+
+import struct
+
+try:
+    from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+except ImportError:
+    Cipher = None
+
+REPORT_CRYPT_OUT = 0
+REPORT_CRYPT_IN = 1
+REPORT_CRYPT_MAX_IDS = 16
+_STREAM_BLOCKS = 4
+
+_SBOX = bytes.fromhex(
+    "637c777bf26b6fc53001672bfed7ab76ca82c97dfa5947f0add4a2af9ca472c0"
+    "b7fd9326363ff7cc34a5e5f171d8311504c723c31896059a071280e2eb27b275"
+    "09832c1a1b6e5aa0523bd6b329e32f8453d100ed20fcb15b6acbbe394a4c58cf"
+    "d0efaafb434d338545f9027f503c9fa851a3408f929d38f5bcb6da2110fff3d2"
+    "cd0c13ec5f974417c4a77e3d645d197360814fdc222a908846eeb814de5e0bdb"
+    "e0323a0a4906245cc2d3ac629195e479e7c8376d8dd54ea96c56f4ea657aae08"
+    "ba78252e1ca6b4c6e8dd741f4bbd8b8a703eb5664803f60e613557b986c11d9e"
+    "e1f8981169d98e949b1e87e9ce5528df8ca1890dbfe6426841992d0fb054bb16")
+
+
+def _xtime(x):
+    return ((x << 1) ^ 0x1B) & 0xFF if x & 0x80 else x << 1
+
+
+class SoftwareAES:
+    """AES-128 forward cipher, same as aes128.c. Slow but has no dependencies."""
+
+    def __init__(self, key):
+        rk = bytearray(key)
+        rcon = 1
+        while len(rk) < 176:
+            t = rk[-4:]
+            if len(rk) % 16 == 0:
+                t = bytearray([_SBOX[t[1]] ^ rcon, _SBOX[t[2]], _SBOX[t[3]], _SBOX[t[0]]])
+                rcon = _xtime(rcon)
+            rk += bytes(a ^ b for a, b in zip(rk[-16:-12], t))
+        self.round_keys = [bytes(rk[i:i + 16]) for i in range(0, 176, 16)]
+
+    def encrypt_block(self, block):
+        s = [a ^ b for a, b in zip(block, self.round_keys[0])]
+        for rnd in range(1, 11):
+            s = [_SBOX[b] for b in s]
+            # ShiftRows, state is column major
+            s = [s[(i + 4 * (i % 4)) % 16] for i in range(16)]
+            if rnd < 10:
+                m = []
+                for c in range(0, 16, 4):
+                    a0, a1, a2, a3 = s[c:c + 4]
+                    t = a0 ^ a1 ^ a2 ^ a3
+                    m += [a0 ^ t ^ _xtime(a0 ^ a1), a1 ^ t ^ _xtime(a1 ^ a2),
+                          a2 ^ t ^ _xtime(a2 ^ a3), a3 ^ t ^ _xtime(a3 ^ a0)]
+                s = m
+            s = [a ^ b for a, b in zip(s, self.round_keys[rnd])]
+        return bytes(s)
+
+    def encrypt(self, data):
+        return b"".join(self.encrypt_block(data[i:i + 16]) for i in range(0, len(data), 16))
+
+
+class _LibraryAES:
+    def __init__(self, key):
+        self._ecb = Cipher(algorithms.AES(bytes(key)), modes.ECB()).encryptor()
+
+    def encrypt(self, data):
+        return self._ecb.update(bytes(data))
+
+
+def new_aes(key):
+    """ECB engine, the cryptography package when installed."""
+    return _LibraryAES(key) if Cipher is not None else SoftwareAES(key)
+
+
+class ReportCrypt:
+    """One session, both directions. Counters advance per report ID and
+    direction exactly like on the device, so reports must be applied in the
+    order they travel."""
+
+    def __init__(self, key, nonce, threshold, aes=None):
+        if len(nonce) != 8 or threshold < 1:
+            raise ValueError("bad session parameters")
+        self.aes = aes if aes is not None else new_aes(key)
+        self.nonce = bytes(nonce)
+        self.threshold = threshold
+        self.counters = {}
+
+    def keystream(self, report_id, direction, counter, length):
+        blocks = b"".join(self.nonce + struct.pack(">BBIBB", report_id, direction, counter, 0, b)
+                          for b in range((min(length, 16 * _STREAM_BLOCKS) + 15) // 16))
+        return self.aes.encrypt(blocks)
+
+    def apply(self, direction, report):
+        """Returns report encrypted or decrypted, report[0] is the ID."""
+        report = bytes(report)
+        if len(report) < 1 or report[0] >= REPORT_CRYPT_MAX_IDS or len(report) - 1 < self.threshold:
+            return report
+        slot = (report[0], direction)
+        counter = self.counters.get(slot, 0)
+        self.counters[slot] = counter + 1
+        payload = report[1:1 + 16 * _STREAM_BLOCKS]
+        stream = self.keystream(report[0], direction, counter, len(payload))
+        return report[:1] + bytes(a ^ b for a, b in zip(payload, stream)) + report[1 + len(payload):]
@@ -0,0 +1,59 @@
+# Check report_crypt_sim.c vectors with the test tool's report crypt
+#
+# Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+# DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+# THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#
+# TAB = 4 spaces
+#
+
+import binascii
+import sys
+import time
+
+from report_crypt import ReportCrypt, SoftwareAES, new_aes
+
+
+def check(path, name, make_aes):
+    with open(path) as f:
+        lines = [line.split() for line in f if line.strip()]
+    key = binascii.unhexlify(lines[0][1])
+    nonce = binascii.unhexlify(lines[1][1])
+    threshold = int(lines[2][1])
+    reports = [(int(d), binascii.unhexlify(p), binascii.unhexlify(w)) for d, p, w in lines[3:]]
+
+    # Host encrypts OUT and decrypts IN, either way applying to plain gives wire.
+    crypt = ReportCrypt(key, nonce, threshold, aes=make_aes(key))
+    start = time.monotonic()
+    matched = sum(1 for direction, plain, wire in reports if crypt.apply(direction, plain) == wire)
+    seconds = time.monotonic() - start
+    ok = matched == len(reports)
+    print("{0:<14} {1:>5} of {2} reports matched {3:>8.1f} us per report  {4}".format(
+          name, matched, len(reports), seconds * 1e6 / max(len(reports), 1), "ok" if ok else "FAILED"))
+    return ok
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: report_crypt_check.py VECTOR_FILE\n"
+              "    VECTOR_FILE as written by report_crypt_sim -o")
+        sys.exit(1)
+
+    results = [check(sys.argv[1], "software AES", SoftwareAES), check(sys.argv[1], "default AES", new_aes)]
+    sys.exit(0 if all(results) else 1)
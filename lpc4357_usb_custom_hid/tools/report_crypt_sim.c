@@ -0,0 +1,519 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test and benchmark of report_crypt.c and aes128.c.
+ *
+ * aes128.c is checked against the FIPS-197 example vector and every
+ * keystream against counter blocks built here from the layout documented
+ * in report_crypt.h. A device and a host instance then carry random
+ * reports on random IDs and directions, the device with a stand-in for the
+ * DMA fed AES engine which runs in the background and only writes its
+ * output once finished, main loop passes landing anywhere in between.
+ * Every report must come out as it went in, with some keystream
+ * prefetched, some waited for and some computed on the spot. Threshold,
+ * report IDs out of range, session restart and counter expiry are
+ * checked too. -o writes the reports as vectors for report_crypt_check.py.
+ *
+ * The pipeline benchmark runs in simulated device time, bursts of
+ * reports on random slots every USB interval and main loop passes between
+ * them. The software engine blocks main loop for the whole run at an
+ * estimated cost per block of aes128.c on the M4, the AES engine model
+ * runs beside it. Table shows how often keystream was ready in time, what
+ * a report costs the USB interrupt and how much of main loop goes to
+ * keystream. Host CPU cost per block and per report is shown as well.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o report_crypt_sim -I../lpc_chip_43xx/inc -Iinc tools/report_crypt_sim.c \
+ *       src/report_crypt.c src/aes128.c
+ * $ ./report_crypt_sim [-o vector_file] [-b software_block_ns] [-e engine_block_ns]
+ */
+
+#include "lpc_types.h"
+#include "aes128.h"
+#include "report_crypt.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RANDOM_REPORTS		2000
+#define ENGINE_SETUP_NS		1000	/* DMA channel setup per engine run */
+#define POLL_NS				100		/* One busy() poll */
+#define LOOP_PASS_NS		5000	/* Rest of a main loop pass */
+#define BENCH_REPORTS		20000
+
+/* Stand-in for the AES engine, output appears when the run is over. */
+typedef struct {
+	aes128_key_t key;
+	const uint8_t *in;
+	uint8_t *out;
+	uint32_t blocks;
+	uint64_t done_ns;
+	bool running;
+	bool background;
+	uint32_t block_ns;
+} sim_engine_t;
+
+static uint32_t failures;
+static uint32_t software_block_ns = 15000;	/* aes128.c at 204 MHz, estimate */
+static uint32_t engine_block_ns = 100;
+static uint64_t now_ns;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void sim_set_key(void *ctx, const uint8_t *key) {
+	aes128_set_key(&((sim_engine_t *) ctx)->key, key);
+}
+
+static void sim_run(sim_engine_t *e) {
+	uint32_t b;
+
+	for (b = 0; b < e->blocks; b++) {
+		aes128_encrypt(&e->key, &e->in[b * AES128_BLOCK_SIZE], &e->out[b * AES128_BLOCK_SIZE]);
+	}
+	e->running = false;
+}
+
+/* Software engine blocks until done, the engine model only takes the job. */
+static void sim_encrypt(void *ctx, const uint8_t *in, uint8_t *out, uint32_t blocks) {
+	sim_engine_t *e = (sim_engine_t *) ctx;
+
+	e->in = in;
+	e->out = out;
+	e->blocks = blocks;
+	e->running = true;
+	if (!e->background) {
+		now_ns += (uint64_t) blocks * e->block_ns;
+		sim_run(e);
+		return;
+	}
+	e->done_ns = now_ns + ENGINE_SETUP_NS + ((uint64_t) blocks * e->block_ns);
+}
+
+/* Output is written only here, so keystream used early comes out wrong. */
+static bool sim_busy(void *ctx) {
+	sim_engine_t *e = (sim_engine_t *) ctx;
+
+	if (e->running && (now_ns >= e->done_ns)) {
+		sim_run(e);
+	}
+	if (e->running) {
+		now_ns += POLL_NS;
+	}
+	return e->running;
+}
+
+static sim_engine_t device_engine;
+static sim_engine_t host_engine;
+static const report_crypt_engine_t background_engine = { sim_set_key, sim_encrypt, sim_busy, &device_engine };
+static const report_crypt_engine_t blocking_engine = { sim_set_key, sim_encrypt, NULL, &device_engine };
+static const report_crypt_engine_t host_side = { sim_set_key, sim_encrypt, NULL, &host_engine };
+
+static void fill_random(uint8_t *data, uint32_t length) {
+	uint32_t i;
+
+	for (i = 0; i < length; i++) {
+		data[i] = rand();
+	}
+}
+
+static void test_aes128(void) {
+	static const uint8_t key[AES128_KEY_SIZE] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+	static const uint8_t plain[AES128_BLOCK_SIZE] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+	static const uint8_t cipher[AES128_BLOCK_SIZE] = {
+		0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+	aes128_key_t ks;
+	uint8_t block[AES128_BLOCK_SIZE];
+
+	aes128_set_key(&ks, key);
+	aes128_encrypt(&ks, plain, block);
+	check(memcmp(block, cipher, sizeof(block)) == 0, "FIPS-197 appendix C.1 vector");
+	aes128_encrypt(&ks, block, block);
+	aes128_encrypt(&ks, plain, block);
+	check(memcmp(block, cipher, sizeof(block)) == 0, "in place encryption");
+}
+
+/* Payload XOR keystream of counter blocks nonce | ID | dir | n BE | 0 | b. */
+static void reference_apply(const uint8_t *key, const uint8_t *nonce, uint8_t dir, uint32_t n,
+							const uint8_t *report, uint32_t length, uint8_t *out) {
+	aes128_key_t ks;
+	uint8_t block[AES128_BLOCK_SIZE], stream[AES128_BLOCK_SIZE];
+	uint32_t i;
+
+	aes128_set_key(&ks, key);
+	memcpy(out, report, length);
+	for (i = 1; (i < length) && (i <= REPORT_CRYPT_STREAM_SIZE); i++) {
+		if (((i - 1) % AES128_BLOCK_SIZE) == 0) {
+			memcpy(block, nonce, REPORT_CRYPT_NONCE_SIZE);
+			block[8] = report[0];
+			block[9] = dir;
+			block[10] = n >> 24;
+			block[11] = n >> 16;
+			block[12] = n >> 8;
+			block[13] = n;
+			block[14] = 0;
+			block[15] = (i - 1) / AES128_BLOCK_SIZE;
+			aes128_encrypt(&ks, block, stream);
+		}
+		out[i] ^= stream[(i - 1) % AES128_BLOCK_SIZE];
+	}
+}
+
+static void test_layout(void) {
+	report_crypt_t rc;
+	uint8_t key[AES128_KEY_SIZE], nonce[REPORT_CRYPT_NONCE_SIZE];
+	uint8_t report[64], expect[64];
+	uint32_t n;
+
+	fill_random(key, sizeof(key));
+	fill_random(nonce, sizeof(nonce));
+	device_engine.background = false;
+	report_crypt_init(&rc, &blocking_engine);
+	report_crypt_set_key(&rc, key);
+	check(report_crypt_start(&rc, nonce, 8), "session start");
+
+	for (n = 0; n < 3; n++) {
+		fill_random(report, sizeof(report));
+		report[0] = 5;
+		reference_apply(key, nonce, REPORT_CRYPT_IN, n, report, 64, expect);
+		report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 64);
+		check(memcmp(report, expect, 64) == 0, "keystream follows documented counter block");
+	}
+
+	// Below threshold stays clear and leaves the counter alone.
+	fill_random(report, sizeof(report));
+	report[0] = 5;
+	memcpy(expect, report, 8);
+	report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 8);
+	check((memcmp(report, expect, 8) == 0) && (rc.stats.clear == 1), "short payload in clear");
+	reference_apply(key, nonce, REPORT_CRYPT_IN, 3, report, 9, expect);
+	report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 9);
+	check(memcmp(report, expect, 9) == 0, "threshold payload encrypted with next counter");
+
+	report[0] = REPORT_CRYPT_MAX_IDS;
+	memcpy(expect, report, 64);
+	report_crypt_apply(&rc, REPORT_CRYPT_OUT, report, 64);
+	check(memcmp(report, expect, 64) == 0, "report ID out of range in clear");
+
+	// Other direction of the same ID counts on its own.
+	report[0] = 5;
+	reference_apply(key, nonce, REPORT_CRYPT_OUT, 0, report, 20, expect);
+	report_crypt_apply(&rc, REPORT_CRYPT_OUT, report, 20);
+	check(memcmp(report, expect, 20) == 0, "directions have separate counters");
+
+	// New session, counters restart under the new nonce.
+	nonce[7] ^= 1;
+	report_crypt_start(&rc, nonce, 8);
+	reference_apply(key, nonce, REPORT_CRYPT_IN, 0, report, 20, expect);
+	report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 20);
+	check(memcmp(report, expect, 20) == 0, "restart begins at counter 0");
+
+	rc.slots[5][REPORT_CRYPT_IN].counter = 0xFFFFFFFE;
+	rc.slots[5][REPORT_CRYPT_IN].state = 0;
+	check(report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 20), "last counter used");
+	check(!report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 20) && rc.expired, "counter expiry drops report");
+
+	report_crypt_stop(&rc);
+	memcpy(expect, report, 20);
+	report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 20);
+	check(memcmp(report, expect, 20) == 0, "stopped session in clear");
+
+	report_crypt_init(&rc, &blocking_engine);
+	check(!report_crypt_start(&rc, nonce, 8), "no session without key");
+}
+
+/* Device encrypts IN and decrypts OUT, host the other way round. */
+static void test_pipeline(FILE *vectors) {
+	report_crypt_t dev, host;
+	uint8_t key[AES128_KEY_SIZE], nonce[REPORT_CRYPT_NONCE_SIZE];
+	uint8_t report[64], plain[64], wire[64];
+	uint32_t i, j, length, passes, mismatches = 0, threshold = 4;
+	uint8_t dir;
+
+	fill_random(key, sizeof(key));
+	fill_random(nonce, sizeof(nonce));
+	device_engine.background = true;
+	device_engine.block_ns = engine_block_ns;
+	host_engine.background = false;
+	report_crypt_init(&dev, &background_engine);
+	report_crypt_init(&host, &host_side);
+	report_crypt_set_key(&dev, key);
+	report_crypt_set_key(&host, key);
+	report_crypt_start(&dev, nonce, threshold);
+	report_crypt_start(&host, nonce, threshold);
+
+	if (vectors != NULL) {
+		fprintf(vectors, "key ");
+		for (i = 0; i < sizeof(key); i++) {
+			fprintf(vectors, "%02x", key[i]);
+		}
+		fprintf(vectors, "\nnonce ");
+		for (i = 0; i < sizeof(nonce); i++) {
+			fprintf(vectors, "%02x", nonce[i]);
+		}
+		fprintf(vectors, "\nthreshold %u\n", threshold);
+	}
+
+	for (i = 0; i < RANDOM_REPORTS; i++) {
+		// A few IDs, like real traffic, plus some out of range.
+		length = 1 + (rand() % 64);
+		fill_random(plain, length);
+		plain[0] = (rand() % 8 == 0) ? (rand() % 256) : (rand() % 6);
+		dir = rand() % 2;
+		memcpy(report, plain, length);
+
+		if (dir == REPORT_CRYPT_IN) {
+			report_crypt_apply(&dev, dir, report, length);
+			memcpy(wire, report, length);
+			report_crypt_apply(&host, dir, report, length);
+		}
+		else {
+			report_crypt_apply(&host, dir, report, length);
+			memcpy(wire, report, length);
+			report_crypt_apply(&dev, dir, report, length);
+		}
+		if (memcmp(report, plain, length) != 0) {
+			mismatches++;
+		}
+		if (vectors != NULL) {
+			// Host view: plain and wire bytes in the direction they travel.
+			fprintf(vectors, "%u ", dir);
+			for (j = 0; j < length; j++) {
+				fprintf(vectors, "%02x", plain[j]);
+			}
+			fprintf(vectors, " ");
+			for (j = 0; j < length; j++) {
+				fprintf(vectors, "%02x", wire[j]);
+			}
+			fprintf(vectors, "\n");
+		}
+
+		// Main loop gets anywhere from nothing to several passes, engine time goes by.
+		passes = rand() % 4;
+		for (j = 0; j < passes; j++) {
+			report_crypt_process(&dev);
+			now_ns += rand() % (2 * ENGINE_SETUP_NS);
+		}
+	}
+
+	check(mismatches == 0, "every report decrypts to what was sent");
+	check((dev.stats.prefetched > 0) && (dev.stats.waited > 0) && (dev.stats.computed > 0),
+		  "prefetched, waited and computed keystream all exercised");
+	check(dev.stats.reports + dev.stats.clear <= RANDOM_REPORTS, "out of range IDs not counted");
+	printf("%u random reports: %u prefetched, %u waited, %u computed, %u clear\n\n", RANDOM_REPORTS,
+		   dev.stats.prefetched, dev.stats.waited, dev.stats.computed, dev.stats.clear);
+}
+
+static double cpu_seconds(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_host(void) {
+	report_crypt_t rc;
+	aes128_key_t ks;
+	uint8_t key[AES128_KEY_SIZE], nonce[REPORT_CRYPT_NONCE_SIZE], report[64];
+	uint32_t i, n = 200000;
+	double t, block_ns, computed_ns, prefetched_ns;
+
+	fill_random(key, sizeof(key));
+	fill_random(nonce, sizeof(nonce));
+	fill_random(report, sizeof(report));
+	aes128_set_key(&ks, key);
+	t = cpu_seconds();
+	for (i = 0; i < n; i++) {
+		aes128_encrypt(&ks, report, report);
+	}
+	block_ns = (cpu_seconds() - t) * 1e9 / n;
+
+	device_engine.background = false;
+	device_engine.block_ns = 0;
+	report_crypt_init(&rc, &blocking_engine);
+	report_crypt_set_key(&rc, key);
+	report_crypt_start(&rc, nonce, 1);
+	report[0] = 1;
+	t = cpu_seconds();
+	for (i = 0; i < n / 4; i++) {
+		report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 64);
+	}
+	computed_ns = (cpu_seconds() - t) * 1e9 / (n / 4);
+
+	// Keystream made between reports, apply only XORs.
+	t = 0;
+	for (i = 0; i < n / 4; i++) {
+		report_crypt_process(&rc);
+		t -= cpu_seconds();
+		report_crypt_apply(&rc, REPORT_CRYPT_IN, report, 64);
+		t += cpu_seconds();
+	}
+	prefetched_ns = t * 1e9 / (n / 4);
+
+	printf("host CPU: %.1f ns per AES block, 63 byte payload %.1f ns computed on the spot, %.1f ns prefetched\n\n",
+		   block_ns, computed_ns, prefetched_ns);
+}
+
+typedef struct {
+	uint32_t prefetched;
+	uint32_t waited;
+	uint32_t computed;
+	double mean_us;
+	double max_us;
+	double loop_pct;
+	bool ok;
+} bench_result_t;
+
+/*
+ * Bursts of reports on random slots every interval, main loop passes in
+ * between. Apply time is what the USB interrupt spends on a report.
+ */
+static void bench_pipeline(bool background, uint32_t slots, uint32_t interval_us, uint32_t burst,
+						   bench_result_t *r) {
+	report_crypt_t dev, host;
+	uint8_t key[AES128_KEY_SIZE], nonce[REPORT_CRYPT_NONCE_SIZE], report[64], plain[64];
+	uint64_t next_report_ns = 0, t, total_ns = 0, max_ns = 0, loop_ns = 0;
+	uint32_t i, slot;
+
+	fill_random(key, sizeof(key));
+	fill_random(nonce, sizeof(nonce));
+	device_engine.background = background;
+	device_engine.block_ns = background ? engine_block_ns : software_block_ns;
+	report_crypt_init(&dev, background ? &background_engine : &blocking_engine);
+	report_crypt_init(&host, &host_side);
+	report_crypt_set_key(&dev, key);
+	report_crypt_set_key(&host, key);
+	report_crypt_start(&dev, nonce, 1);
+	report_crypt_start(&host, nonce, 1);
+	now_ns = 0;
+	r->ok = true;
+
+	for (i = 0; i < BENCH_REPORTS; i++) {
+		// Main loop until the next report is due, a blocking run may overshoot.
+		while (now_ns < next_report_ns) {
+			if (report_crypt_pending(&dev)) {
+				t = now_ns;
+				report_crypt_process(&dev);
+				loop_ns += now_ns - t;
+			}
+			now_ns += LOOP_PASS_NS;
+		}
+
+		slot = rand() % slots;
+		fill_random(plain, sizeof(plain));
+		plain[0] = slot / 2;
+		memcpy(report, plain, sizeof(report));
+		t = now_ns;
+		report_crypt_apply(&dev, slot % 2, report, sizeof(report));
+		t = now_ns - t;
+		total_ns += t;
+		max_ns = MAX(max_ns, t);
+		report_crypt_apply(&host, slot % 2, report, sizeof(report));
+		r->ok = r->ok && (memcmp(report, plain, sizeof(report)) == 0);
+		if ((i % burst) == (burst - 1)) {
+			next_report_ns += (uint64_t) interval_us * 1000;
+		}
+	}
+
+	r->prefetched = dev.stats.prefetched;
+	r->waited = dev.stats.waited;
+	r->computed = dev.stats.computed;
+	r->mean_us = total_ns / 1000.0 / BENCH_REPORTS;
+	r->max_us = max_ns / 1000.0;
+	r->loop_pct = 100.0 * loop_ns / now_ns;
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t slot_counts[] = { 4, 32 };
+	static const uint32_t intervals[] = { 1000, 125 };
+	static const uint32_t bursts[] = { 1, 4 };
+	const char *vector_path = NULL;
+	FILE *vectors = NULL;
+	bench_result_t r;
+	uint32_t b, e, i, s;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:b:e:")) != -1) {
+		switch (opt) {
+		case 'o':
+			vector_path = optarg;
+			break;
+		case 'b':
+			software_block_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			engine_block_ns = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-o vector_file] [-b software_block_ns] [-e engine_block_ns]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (vector_path != NULL) {
+		vectors = fopen(vector_path, "w");
+		if (vectors == NULL) {
+			perror(vector_path);
+			return 1;
+		}
+	}
+
+	srand(1);
+	test_aes128();
+	test_layout();
+	test_pipeline(vectors);
+	if (vectors != NULL) {
+		fclose(vectors);
+	}
+	bench_host();
+
+	printf("63 byte payloads, main loop pass every %u us, software %u ns per block, engine %u ns per block\n",
+		   LOOP_PASS_NS / 1000, software_block_ns, engine_block_ns);
+	printf("engine    interval  burst  slots  prefetched %%  waited %%  computed %%  mean us  max us  loop %%  data\n");
+	for (e = 0; e < 2; e++) {
+		for (i = 0; i < sizeof(intervals) / sizeof(intervals[0]); i++) {
+			for (b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++) {
+				for (s = 0; s < sizeof(slot_counts) / sizeof(slot_counts[0]); s++) {
+					bench_pipeline(e == 1, slot_counts[s], intervals[i], bursts[b], &r);
+					printf("%-8s %6u us %6u %6u %13.1f %9.1f %11.1f %8.2f %7.2f %7.1f  %s\n",
+						   (e == 1) ? "engine" : "software", intervals[i], bursts[b], slot_counts[s],
+						   100.0 * r.prefetched / BENCH_REPORTS, 100.0 * r.waited / BENCH_REPORTS,
+						   100.0 * r.computed / BENCH_REPORTS, r.mean_us, r.max_us, r.loop_pct, r.ok ? "ok" : "FAILED");
+					check(r.ok, "pipeline reports decrypt to what was sent");
+				}
+			}
+		}
+	}
+
+	printf("\nreport_crypt checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host benchmark of the section copy and zero loops data_init() and
+ * bss_init() in cr_startup_lpc43xx.c run before main.
+ *
+ * The one word loops they replaced are compiled at -O0 like the Debug
+ * build and at -O2 like Release. The 32 byte LDM/STM loops are ARM
+ * assembly, here they are the same block structure in C at -O2, eight
+ * loads then eight stores per block followed by the remaining words.
+ * Auto-vectorizing and memcpy/memset substitution are off so each stays
+ * the loop the M4 runs. All are first checked against memcpy/memset on
+ * every length up to 260 bytes, including the rounding up to whole words
+ * and words past the end left untouched.
+ *
+ * Tables show host ns per section size and the M4 estimate at 204 MHz
+ * from the cycles each loop takes per word or block, sources and
+ * destinations in zero wait state SRAM.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o startup_copy_bench -I../lpc_chip_43xx/inc tools/startup_copy_bench.c
+ * $ ./startup_copy_bench [-n megabytes]
+ */
+
+#include "lpc_types.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CORE_MHZ			204
+#define MAX_SECTION			(64 * 1024)
+#define GUARD_WORDS			4
+
+/*
+ * M4 cycles from the Thumb-2 each loop compiles to. -O0 keeps pointers
+ * and loop counter in the stack frame: 11 loads and stores, 3 adds, cmp
+ * and a taken branch per copied word, 8 loads and stores when zeroing.
+ * -O2 is ldr/str with post increment, add, cmp and branch. Blocks are
+ * LDM/STM of 8 registers (1 + 8 cycles each), cmp, bhs and b, bss_init
+ * stores 2 x 4 registers.
+ */
+#define M4_COPY_WORD_O0		20
+#define M4_COPY_WORD_O2		7
+#define M4_COPY_BLOCK		23
+#define M4_ZERO_WORD_O0		15
+#define M4_ZERO_WORD_O2		5
+#define M4_ZERO_BLOCK		15
+
+#define LOOP_O0				__attribute__ ((noinline, optimize("O0")))
+#define LOOP_O2				__attribute__ ((noinline, optimize("O2", "no-tree-vectorize", "no-tree-loop-distribute-patterns")))
+
+typedef void (*copy_fn_t)(unsigned int romstart, unsigned int start, unsigned int len);
+typedef void (*zero_fn_t)(unsigned int start, unsigned int len);
+
+static uint32_t failures;
+
+/* Host pointers do not fit the startup code's unsigned int addresses. */
+static uintptr_t base;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Loops as data_init and bss_init had them */
+LOOP_O0 static void copy_word_o0(unsigned int romstart, unsigned int start, unsigned int len) {
+	unsigned int *pulDest = (unsigned int *) (base + start);
+	unsigned int *pulSrc = (unsigned int *) (base + romstart);
+	unsigned int loop;
+
+	for (loop = 0; loop < len; loop = loop + 4)
+		*pulDest++ = *pulSrc++;
+}
+
+LOOP_O2 static void copy_word_o2(unsigned int romstart, unsigned int start, unsigned int len) {
+	unsigned int *pulDest = (unsigned int *) (base + start);
+	unsigned int *pulSrc = (unsigned int *) (base + romstart);
+	unsigned int loop;
+
+	for (loop = 0; loop < len; loop = loop + 4)
+		*pulDest++ = *pulSrc++;
+}
+
+LOOP_O0 static void zero_word_o0(unsigned int start, unsigned int len) {
+	unsigned int *pulDest = (unsigned int *) (base + start);
+	unsigned int loop;
+
+	for (loop = 0; loop < len; loop = loop + 4)
+		*pulDest++ = 0;
+}
+
+LOOP_O2 static void zero_word_o2(unsigned int start, unsigned int len) {
+	unsigned int *pulDest = (unsigned int *) (base + start);
+	unsigned int loop;
+
+	for (loop = 0; loop < len; loop = loop + 4)
+		*pulDest++ = 0;
+}
+
+/* Block structure of the current data_init and bss_init */
+LOOP_O2 static void copy_block(unsigned int romstart, unsigned int start, unsigned int len) {
+	unsigned int *pulDest = (unsigned int *) (base + start);
+	unsigned int *pulSrc = (unsigned int *) (base + romstart);
+	unsigned int *pulEnd = pulDest + ((len + 3) / 4);
+	unsigned int *pulBlockEnd = pulDest + (len / 32) * 8;
+	unsigned int r3, r4, r5, r6, r8, r9, r10, r12;
+
+	while (pulDest < pulBlockEnd) {
+		r3 = pulSrc[0];
+		r4 = pulSrc[1];
+		r5 = pulSrc[2];
+		r6 = pulSrc[3];
+		r8 = pulSrc[4];
+		r9 = pulSrc[5];
+		r10 = pulSrc[6];
+		r12 = pulSrc[7];
+		pulSrc += 8;
+		pulDest[0] = r3;
+		pulDest[1] = r4;
+		pulDest[2] = r5;
+		pulDest[3] = r6;
+		pulDest[4] = r8;
+		pulDest[5] = r9;
+		pulDest[6] = r10;
+		pulDest[7] = r12;
+		pulDest += 8;
+	}
+
+	while (pulDest < pulEnd)
+		*pulDest++ = *pulSrc++;
+}
+
+LOOP_O2 static void zero_block(unsigned int start, unsigned int len) {
+	unsigned int *pulDest = (unsigned int *) (base + start);
+	unsigned int *pulEnd = pulDest + ((len + 3) / 4);
+	unsigned int *pulBlockEnd = pulDest + (len / 32) * 8;
+
+	while (pulDest < pulBlockEnd) {
+		pulDest[0] = 0;
+		pulDest[1] = 0;
+		pulDest[2] = 0;
+		pulDest[3] = 0;
+		pulDest[4] = 0;
+		pulDest[5] = 0;
+		pulDest[6] = 0;
+		pulDest[7] = 0;
+		pulDest += 8;
+	}
+
+	while (pulDest < pulEnd)
+		*pulDest++ = 0;
+}
+
+static const struct {
+	const char *name;
+	copy_fn_t copy;
+	zero_fn_t zero;
+	uint32_t copy_cycles;		/* Per word, or per block */
+	uint32_t zero_cycles;
+	bool block;
+} impls[] = {
+	{ "word -O0", copy_word_o0, zero_word_o0, M4_COPY_WORD_O0, M4_ZERO_WORD_O0, false },
+	{ "word -O2", copy_word_o2, zero_word_o2, M4_COPY_WORD_O2, M4_ZERO_WORD_O2, false },
+	{ "block", copy_block, zero_block, M4_COPY_BLOCK, M4_ZERO_BLOCK, true },
+};
+
+/* Report pools and rings the linker places, up to the recorder container and beyond. */
+static const uint32_t sizes[] = { 8, 64, 256, 1024, 4096, 17 * 1024, 64 * 1024 };
+
+static uint32_t src[MAX_SECTION / 4 + GUARD_WORDS];
+static uint32_t dst[MAX_SECTION / 4 + GUARD_WORDS];
+static uint32_t expect[MAX_SECTION / 4 + GUARD_WORDS];
+
+static double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static unsigned int addr(const void *p) {
+	return (unsigned int) ((uintptr_t) p - base);
+}
+
+/* Sections are word aligned, length rounds up to whole words. */
+static void test_impls(void) {
+	uint32_t i, len, words;
+	bool copy_ok, zero_ok;
+
+	for (i = 0; i < sizeof(src) / sizeof(src[0]); i++) {
+		src[i] = rand();
+	}
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		copy_ok = true;
+		zero_ok = true;
+		for (len = 0; len <= 260; len++) {
+			words = (len + 3) / 4;
+			memset(dst, 0xA5, sizeof(dst));
+			memcpy(expect, dst, sizeof(expect));
+			memcpy(expect, src, words * 4);
+			impls[i].copy(addr(src), addr(dst), len);
+			copy_ok = copy_ok && (memcmp(dst, expect, (words + GUARD_WORDS) * 4) == 0);
+
+			memset(expect, 0, words * 4);
+			impls[i].zero(addr(dst), len);
+			zero_ok = zero_ok && (memcmp(dst, expect, (words + GUARD_WORDS) * 4) == 0);
+		}
+		printf("%-9s copy %s, zero %s\n", impls[i].name, copy_ok ? "ok" : "FAILED", zero_ok ? "ok" : "FAILED");
+		check(copy_ok, "copy matches memcpy, words past the end untouched");
+		check(zero_ok, "zero matches memset, words past the end untouched");
+	}
+	printf("\n");
+}
+
+/* Remaining words after the blocks take a one word loop like -O2 */
+static double m4_us(uint32_t cycles, uint32_t tail_cycles, bool block, uint32_t len) {
+	uint32_t words = (len + 3) / 4;
+	uint64_t total;
+
+	if (block) {
+		total = (uint64_t) (len / 32) * cycles + (words % 8) * tail_cycles;
+	}
+	else {
+		total = (uint64_t) words * cycles;
+	}
+	return (double) total / CORE_MHZ;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t megabytes = 256, i, j, n, rounds, r;
+	double began, ns, ns_blocks;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			megabytes = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n megabytes]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (megabytes == 0) {
+		fprintf(stderr, "megabytes must be set\n");
+		return 1;
+	}
+
+	// Both buffers within 4 GB of the lower one.
+	base = MIN((uintptr_t) src, (uintptr_t) dst) & ~(uintptr_t) 0xFFFF;
+	test_impls();
+
+	printf("host ns per section, %u MB copied and zeroed per size and loop\n", megabytes);
+	printf("%-9s %10s", "", "");
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		printf(" %9u B", sizes[j]);
+	}
+	printf("\n");
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		for (r = 0; r < 2; r++) {
+			printf("%-9s %-10s", impls[i].name, r ? "bss_init" : "data_init");
+			for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+				rounds = MAX((megabytes << 20) / sizes[j] / 4, 1);
+				began = now_ns();
+				for (n = 0; n < rounds; n++) {
+					if (r) {
+						impls[i].zero(addr(dst), sizes[j]);
+					}
+					else {
+						impls[i].copy(addr(src), addr(dst), sizes[j]);
+					}
+				}
+				ns = (now_ns() - began) / rounds;
+				printf(" %11.1f", ns);
+			}
+			printf("\n");
+		}
+	}
+
+	printf("\nM4 us per section at %u MHz, estimated from loop cycles\n", CORE_MHZ);
+	printf("%-9s %10s", "", "");
+	for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+		printf(" %9u B", sizes[j]);
+	}
+	printf("\n");
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		printf("%-9s %-10s", impls[i].name, "data_init");
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			printf(" %11.2f", m4_us(impls[i].copy_cycles, M4_COPY_WORD_O2, impls[i].block, sizes[j]));
+		}
+		printf("\n%-9s %-10s", impls[i].name, "bss_init");
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			printf(" %11.2f", m4_us(impls[i].zero_cycles, M4_ZERO_WORD_O2, impls[i].block, sizes[j]));
+		}
+		printf("\n");
+	}
+
+	// About 24 KB of BSS went to .noinit, its module init clears what it uses.
+	ns = m4_us(M4_ZERO_WORD_O0, 0, false, 24 * 1024);
+	ns_blocks = m4_us(M4_ZERO_BLOCK, M4_ZERO_WORD_O2, true, 24 * 1024);
+	printf("\n24 KB moved to .noinit: %.1f us less at reset with the -O0 loop, %.1f us with blocks\n", ns, ns_blocks);
+
+	printf("\nstartup copy checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,626 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host test and throughput benchmark of uart_bridge.c, Linux only.
+ *
+ * The bridge source runs natively. Its UART, SCU, GPDMA and NVIC registers
+ * are plain memory mapped at their addresses on the chip, DMA channels and
+ * the UARTs are modelled here: RX DMA walks the bridge's descriptor ring
+ * and moves DESTADDR a byte at a time at the line rate, TX DMA shifts bytes
+ * out at the same rate, and terminal count interrupts are taken a
+ * microsecond later so the bridge sees DMA ahead of its segment count.
+ *
+ * Each UART line is a pseudo terminal. The peer device at the far end
+ * writes a numbered byte stream into the slave side and checks what the
+ * bridge transmits on it, the UART reads and writes the master side. The
+ * host takes one IN and sends one OUT report per USB interval with credit
+ * flow control like custom_hid.py, checks received bytes against the peer
+ * stream, skipping exactly what the bridge counted as overflow, and sends
+ * a numbered stream of its own.
+ *
+ * Checks cover the flush timeout of a short burst and lossless, in order
+ * transfer in both directions while the line is slower than USB. Table
+ * shows sustained throughput up to 3 Mbaud for 1 ms full speed intervals
+ * and 125 us high speed ones.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -no-pie -o uart_bridge_sim -DCORE_M4 -D__USE_LPCOPEN -D__LPC43XX__ \
+ *       -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast \
+ *       -I../lpc_chip_43xx/inc -I../lpc_chip_43xx/inc/usbd_rom \
+ *       -I../lpc_chip_43xx/inc/config_43xx -I../lpc4357_xplorer_plusplus_board/inc \
+ *       -Iinc -Itools tools/uart_bridge_sim.c src/uart_bridge.c src/credit_flow.c \
+ *       ../lpc_chip_43xx/src/ring_buffer.c
+ * $ ./uart_bridge_sim [-s seconds] [-l loop_us]
+ *
+ * -no-pie keeps the bridge's buffers below 4 GB, DMA descriptors hold
+ * 32 bit addresses.
+ */
+
+// posix_openpt() and friends
+#define _GNU_SOURCE
+
+#include "board.h"
+#include "hid_generic.h"
+#include "dma_service.h"
+#include "timer_service.h"
+#include "uart_bridge.h"
+
+// After chip headers, libc macros clash with register names.
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <unistd.h>
+
+/* Same order as channel_hw[] in uart_bridge.c */
+#define LINE_UART(ch)		((ch) == 0 ? LPC_USART3 : LPC_USART2)
+
+#define STAGE_SIZE			4096
+#define HOST_RX_BUFFER		4096		/* custom_hid.py UART receive buffer */
+#define BIT_US				10000000ULL	/* 10 bits per byte, baud * us units */
+
+typedef struct {
+	bool used;
+	bool active;
+	bool irq;			/* Terminal count interrupt pending */
+	bool rx;
+	uint8_t line;
+	dma_service_callback_t callback;
+	DMA_TransferDescriptor_t desc;
+	uint32_t pos;
+} dma_model_t;
+
+typedef struct {
+	int master;			/* UART side */
+	int slave;			/* Peer device side */
+	uint32_t baud;
+
+	/* Peer to host */
+	uint64_t peer_written;
+	uint64_t peer_limit;	/* Bytes peer writes in total */
+	uint64_t rx_accum;
+	uint64_t rx_line;		/* Bytes clocked into the UART */
+	uint8_t rx_stage[STAGE_SIZE];
+	uint32_t rx_stage_len, rx_stage_pos;
+	uint64_t host_rx;		/* Stream position host expects next */
+	uint32_t overflow_seen;
+	uint64_t host_rx_bytes;
+	uint32_t last_rx_us;	/* When host last got bytes */
+	uint32_t last_line_us;	/* When the last byte arrived on the line */
+
+	/* Host to peer */
+	uint64_t host_sent;
+	uint64_t tx_accum;
+	uint8_t tx_stage[STAGE_SIZE];
+	uint32_t tx_stage_len;
+	uint64_t peer_read;
+
+	credit_rx_t host_in;
+	credit_tx_t host_out;
+	bool ok;
+} line_t;
+
+static uint32_t failures;
+static uint32_t seconds = 1;
+static uint32_t loop_us = 50;
+
+static dma_model_t dma[GPDMA_NUMBER_CHANNELS];
+static line_t lines[UART_BRIDGE_NUM_CHANNELS];
+static hid_in_source_t in_source;
+static uint32_t now_us;
+static uint32_t next_out_line;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+/* Byte n of the stream going the given way on a line. */
+static uint8_t stream_byte(uint32_t line, bool to_host, uint64_t n) {
+	return (uint8_t) ((n * 31) + (n >> 8) + (line * 101) + (to_host ? 0 : 53));
+}
+
+/*****************************************************************************
+ * Stand-ins for the services the bridge uses
+ ****************************************************************************/
+
+uint32_t timer_service_now_us(void) {
+	return now_us;
+}
+
+void timer_service_wake_request(bool enable) {
+}
+
+bool hid_in_add_source(hid_in_source_t source) {
+	in_source = source;
+	return true;
+}
+
+void Chip_UART_Init(LPC_USART_T *pUART) {
+}
+
+void Chip_UART_DeInit(LPC_USART_T *pUART) {
+}
+
+uint32_t Chip_UART_SetBaudFDR(LPC_USART_T *pUART, uint32_t baud) {
+	return baud;
+}
+
+int dma_service_alloc(dma_service_callback_t callback, bool high_priority) {
+	uint32_t i;
+
+	for (i = 0; i < GPDMA_NUMBER_CHANNELS; i++) {
+		if (!dma[i].used) {
+			memset(&dma[i], 0, sizeof(dma[i]));
+			dma[i].used = true;
+			dma[i].callback = callback;
+			return i;
+		}
+	}
+	return -1;
+}
+
+void dma_service_free(uint8_t channel) {
+	dma[channel].used = false;
+	dma[channel].active = false;
+	dma[channel].irq = false;
+}
+
+bool dma_service_claim_request(uint8_t line, uint8_t function) {
+	return true;
+}
+
+void dma_service_release_request(uint8_t line) {
+}
+
+void dma_service_start(uint8_t channel, const DMA_TransferDescriptor_t *desc, uint32_t config) {
+	dma_model_t *d = &dma[channel];
+	uint32_t uart = (desc->ctrl & GPDMA_DMACCxControl_DI) ? desc->src : desc->dst;
+
+	d->desc = *desc;
+	d->pos = 0;
+	d->active = true;
+	d->rx = (desc->ctrl & GPDMA_DMACCxControl_DI) != 0;
+	d->line = (uart == (uint32_t) &LPC_USART3->RBR) ? 0 : 1;
+	LPC_GPDMA->CH[channel].SRCADDR = desc->src;
+	LPC_GPDMA->CH[channel].DESTADDR = desc->dst;
+}
+
+/*****************************************************************************
+ * DMA and UART model
+ ****************************************************************************/
+
+static bool map_registers(uint32_t base, uint32_t size) {
+	void *mem = mmap((void *) (uintptr_t) base, size, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem != (void *) (uintptr_t) base) {
+		fprintf(stderr, "can not map registers at 0x%08X\n", base);
+		return false;
+	}
+	return true;
+}
+
+static dma_model_t *line_dma(uint32_t line, bool rx) {
+	uint32_t i;
+
+	for (i = 0; i < GPDMA_NUMBER_CHANNELS; i++) {
+		if (dma[i].used && dma[i].active && (dma[i].rx == rx) && (dma[i].line == line)) {
+			return &dma[i];
+		}
+	}
+	return NULL;
+}
+
+/* One byte arrived on the RX line, DMA stores it and follows the descriptor chain. */
+static void rx_byte(uint32_t line, uint8_t byte) {
+	dma_model_t *d = line_dma(line, true);
+	uint8_t ch;
+
+	if (d == NULL) {
+		return;
+	}
+	ch = d - dma;
+	*(uint8_t *) (uintptr_t) (d->desc.dst + d->pos) = byte;
+	d->pos++;
+	LPC_GPDMA->CH[ch].DESTADDR = d->desc.dst + d->pos;
+	if (d->pos == (d->desc.ctrl & 0xFFF)) {
+		d->irq = true;
+		if (d->desc.lli != 0) {
+			d->desc = *(const DMA_TransferDescriptor_t *) (uintptr_t) d->desc.lli;
+			d->pos = 0;
+			LPC_GPDMA->CH[ch].DESTADDR = d->desc.dst;
+		}
+		else {
+			d->active = false;
+		}
+	}
+}
+
+static void line_rx(uint32_t l) {
+	line_t *ln = &lines[l];
+	ssize_t n;
+
+	ln->rx_accum += ln->baud;
+	while (ln->rx_accum >= BIT_US) {
+		if (ln->rx_stage_pos == ln->rx_stage_len) {
+			n = read(ln->master, ln->rx_stage, sizeof(ln->rx_stage));
+			ln->rx_stage_len = (n > 0) ? n : 0;
+			ln->rx_stage_pos = 0;
+			if (n <= 0) {
+				// Line idle, time does not bank up.
+				ln->rx_accum = 0;
+				return;
+			}
+		}
+		ln->rx_accum -= BIT_US;
+		rx_byte(l, ln->rx_stage[ln->rx_stage_pos++]);
+		ln->rx_line++;
+		ln->last_line_us = now_us;
+	}
+}
+
+static void flush_tx_stage(line_t *ln) {
+	ssize_t n;
+
+	if (ln->tx_stage_len == 0) {
+		return;
+	}
+	n = write(ln->master, ln->tx_stage, ln->tx_stage_len);
+	if (n > 0) {
+		memmove(ln->tx_stage, &ln->tx_stage[n], ln->tx_stage_len - n);
+		ln->tx_stage_len -= n;
+	}
+}
+
+static void line_tx(uint32_t l) {
+	line_t *ln = &lines[l];
+	dma_model_t *d = line_dma(l, false);
+
+	if (d == NULL) {
+		ln->tx_accum = 0;
+		return;
+	}
+	ln->tx_accum += ln->baud;
+	while ((ln->tx_accum >= BIT_US) && d->active && (ln->tx_stage_len < sizeof(ln->tx_stage))) {
+		ln->tx_accum -= BIT_US;
+		ln->tx_stage[ln->tx_stage_len++] = *(const uint8_t *) (uintptr_t) (d->desc.src + d->pos);
+		d->pos++;
+		if (d->pos == (d->desc.ctrl & 0xFFF)) {
+			d->active = false;
+			d->irq = true;
+		}
+	}
+	if (ln->tx_stage_len >= (sizeof(ln->tx_stage) / 2)) {
+		flush_tx_stage(ln);
+	}
+}
+
+static void take_dma_irqs(void) {
+	uint32_t i;
+
+	for (i = 0; i < GPDMA_NUMBER_CHANNELS; i++) {
+		if (dma[i].used && dma[i].irq) {
+			dma[i].irq = false;
+			dma[i].callback(i, false);
+		}
+	}
+}
+
+/*****************************************************************************
+ * Peer device and host
+ ****************************************************************************/
+
+static void peer_io(uint32_t l) {
+	line_t *ln = &lines[l];
+	uint8_t buf[STAGE_SIZE];
+	uint32_t i, count;
+	ssize_t n;
+
+	flush_tx_stage(ln);
+	while ((n = read(ln->slave, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < (uint32_t) n; i++) {
+			if (buf[i] != stream_byte(l, false, ln->peer_read + i)) {
+				ln->ok = false;
+			}
+		}
+		ln->peer_read += n;
+	}
+
+	count = (uint32_t) MIN(sizeof(buf), ln->peer_limit - ln->peer_written);
+	for (i = 0; i < count; i++) {
+		buf[i] = stream_byte(l, true, ln->peer_written + i);
+	}
+	n = (count > 0) ? write(ln->slave, buf, count) : 0;
+	if (n > 0) {
+		ln->peer_written += n;
+	}
+}
+
+static void host_in(void) {
+	uint8_t report[HID_UART_REPORT_SIZE];
+	uart_bridge_stats_t stats;
+	line_t *ln;
+	uint32_t length, count, i;
+
+	length = in_source(report);
+	if (length == 0) {
+		return;
+	}
+	ln = &lines[report[1]];
+	count = report[2];
+	credit_tx_grant(&ln->host_out, report[3] | (report[4] << 8) | (report[5] << 16) | ((uint32_t) report[6] << 24));
+
+	// Bytes the bridge overwrote went missing just before this report's data.
+	uart_bridge_get_stats(report[1], &stats);
+	ln->host_rx += stats.rx_overflow - ln->overflow_seen;
+	ln->overflow_seen = stats.rx_overflow;
+
+	if (credit_rx_accept(&ln->host_in, count) != count) {
+		ln->ok = false;
+	}
+	for (i = 0; i < count; i++) {
+		if (report[UART_BRIDGE_REPORT_HEADER_SIZE + i] != stream_byte(report[1], true, ln->host_rx + i)) {
+			ln->ok = false;
+		}
+	}
+	ln->host_rx += count;
+	ln->host_rx_bytes += count;
+	credit_rx_consume(&ln->host_in, count);
+	if (count > 0) {
+		ln->last_rx_us = now_us;
+	}
+}
+
+/* One OUT report per interval, lines take turns. */
+static void host_out(uint32_t num_lines) {
+	uint8_t payload[HID_UART_REPORT_SIZE - 1];
+	uint32_t i, j, l, count, limit;
+	line_t *ln;
+
+	for (i = 0; i < num_lines; i++) {
+		l = (next_out_line + i) % num_lines;
+		ln = &lines[l];
+		count = MIN(credit_tx_available(&ln->host_out), UART_BRIDGE_REPORT_DATA_SIZE);
+		if ((count == 0) && !credit_rx_update_due(&ln->host_in)) {
+			continue;
+		}
+
+		limit = credit_rx_advertise(&ln->host_in);
+		payload[0] = l;
+		payload[1] = count;
+		payload[2] = limit;
+		payload[3] = limit >> 8;
+		payload[4] = limit >> 16;
+		payload[5] = limit >> 24;
+		for (j = 0; j < count; j++) {
+			payload[UART_BRIDGE_REPORT_HEADER_SIZE - 1 + j] = stream_byte(l, false, ln->host_sent + j);
+		}
+		uart_bridge_write(payload, UART_BRIDGE_REPORT_HEADER_SIZE - 1 + count);
+		credit_tx_sent(&ln->host_out, count);
+		ln->host_sent += count;
+		next_out_line = (l + 1) % num_lines;
+		return;
+	}
+}
+
+static bool open_pty(line_t *ln) {
+	struct termios tio;
+
+	ln->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if ((ln->master < 0) || (grantpt(ln->master) != 0) || (unlockpt(ln->master) != 0)) {
+		perror("pty");
+		return false;
+	}
+	ln->slave = open(ptsname(ln->master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if ((ln->slave < 0) || (tcgetattr(ln->slave, &tio) != 0)) {
+		perror("pty slave");
+		return false;
+	}
+	// Bytes pass as they are, like a serial port opened by a terminal program in raw mode.
+	cfmakeraw(&tio);
+	return tcsetattr(ln->slave, TCSANOW, &tio) == 0;
+}
+
+static void drain_pty(line_t *ln) {
+	uint8_t buf[STAGE_SIZE];
+
+	while (read(ln->master, buf, sizeof(buf)) > 0) {}
+	while (read(ln->slave, buf, sizeof(buf)) > 0) {}
+}
+
+/* Open num_lines channels, the peer writes peer_limit bytes on each. */
+static void start_run(uint32_t num_lines, uint32_t baud, uint32_t flush_us, uint64_t peer_limit) {
+	uint8_t feature[8];
+	line_t *ln;
+	uint32_t l;
+
+	for (l = 0; l < UART_BRIDGE_NUM_CHANNELS; l++) {
+		uart_bridge_close(l);
+	}
+	uart_bridge_init(0);
+	now_us = 0;
+	next_out_line = 0;
+
+	for (l = 0; l < num_lines; l++) {
+		ln = &lines[l];
+		drain_pty(ln);
+		memset(&ln->baud, 0, sizeof(*ln) - offsetof(line_t, baud));
+		ln->baud = baud;
+		ln->peer_limit = peer_limit;
+		ln->ok = true;
+		credit_rx_init(&ln->host_in, HOST_RX_BUFFER, HOST_RX_BUFFER / 4);
+		credit_tx_init(&ln->host_out);
+
+		feature[0] = l;
+		feature[1] = 1;
+		feature[2] = baud;
+		feature[3] = baud >> 8;
+		feature[4] = baud >> 16;
+		feature[5] = baud >> 24;
+		feature[6] = flush_us;
+		feature[7] = flush_us >> 8;
+		check(uart_bridge_set_feature(feature, sizeof(feature)), "channel opens");
+	}
+}
+
+static void step(uint32_t num_lines, uint32_t interval_us) {
+	uint32_t l;
+
+	take_dma_irqs();
+	for (l = 0; l < num_lines; l++) {
+		line_rx(l);
+		line_tx(l);
+	}
+	if ((now_us % loop_us) == 0) {
+		uart_bridge_process();
+	}
+	if ((now_us % interval_us) == 0) {
+		host_in();
+		host_out(num_lines);
+		for (l = 0; l < num_lines; l++) {
+			peer_io(l);
+		}
+	}
+	now_us++;
+}
+
+/* Short burst goes out once the flush timeout passed. */
+static void test_flush_timeout(void) {
+	const uint32_t flush_us = UART_BRIDGE_DEFAULT_FLUSH_US;
+	line_t *ln = &lines[0];
+	uint32_t latency;
+
+	start_run(1, 115200, flush_us, 10);
+	while ((ln->host_rx_bytes < 10) && (now_us < 100000)) {
+		step(1, 1000);
+	}
+	latency = ln->last_rx_us - ln->last_line_us;
+	check(ln->host_rx_bytes == 10, "burst delivered");
+	check(ln->ok, "burst in order");
+	check((latency >= flush_us - 100) && (latency <= flush_us + 1000 + loop_us),
+		  "burst waits one flush timeout and a USB interval");
+}
+
+typedef struct {
+	double rx_kbs;
+	double tx_kbs;
+	uint32_t rx_overflow;
+	uint32_t tx_dropped;
+	bool ok;
+} load_result_t;
+
+static void run_load(uint32_t num_lines, uint32_t baud, uint32_t interval_us, load_result_t *r) {
+	uart_bridge_stats_t stats;
+	uint64_t rx = 0, tx = 0;
+	uint32_t l;
+
+	start_run(num_lines, baud, UART_BRIDGE_DEFAULT_FLUSH_US, UINT64_MAX);
+	while (now_us < seconds * 1000000) {
+		step(num_lines, interval_us);
+	}
+
+	memset(r, 0, sizeof(*r));
+	r->ok = true;
+	for (l = 0; l < num_lines; l++) {
+		uart_bridge_get_stats(l, &stats);
+		rx += lines[l].host_rx_bytes;
+		tx += lines[l].peer_read;
+		r->rx_overflow += stats.rx_overflow;
+		r->tx_dropped += stats.tx_dropped;
+		r->ok = r->ok && lines[l].ok && (stats.rx_bytes == lines[l].host_rx_bytes);
+	}
+	r->rx_kbs = rx / 1024.0 / seconds;
+	r->tx_kbs = tx / 1024.0 / seconds;
+}
+
+int main(int argc, char *argv[]) {
+	static const struct {
+		uint32_t interval_us;
+		uint32_t lines;
+		uint32_t baud;
+	} runs[] = {
+		{ 1000, 1, 115200 }, { 1000, 2, 115200 }, { 1000, 1, 460800 }, { 1000, 2, 460800 },
+		{ 1000, 1, 921600 }, { 1000, 1, 3000000 }, { 1000, 2, 3000000 },
+		{ 125, 1, 921600 }, { 125, 2, 921600 }, { 125, 1, 3000000 }, { 125, 2, 3000000 },
+	};
+	load_result_t r;
+	double line_kbs, usb_kbs;
+	uint32_t i, l;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:l:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loop_us = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds] [-l loop_us]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ((seconds == 0) || (loop_us == 0)) {
+		fprintf(stderr, "duration and loop time must be non zero\n");
+		return 1;
+	}
+
+	if (!map_registers(0x40000000, 0x100000) || !map_registers(SCS_BASE, 0x1000)) {
+		return 1;
+	}
+	for (l = 0; l < UART_BRIDGE_NUM_CHANNELS; l++) {
+		if (!open_pty(&lines[l])) {
+			return 1;
+		}
+	}
+
+	test_flush_timeout();
+
+	printf("%u s per run, main loop pass every %u us\n\n", seconds, loop_us);
+	printf("interval  lines     baud  line KB/s   RX KB/s   TX KB/s  rx overflow  tx dropped  data\n");
+	for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+		run_load(runs[i].lines, runs[i].baud, runs[i].interval_us, &r);
+		line_kbs = runs[i].lines * runs[i].baud / 10.0 / 1024.0;
+		usb_kbs = UART_BRIDGE_REPORT_DATA_SIZE * (1000000.0 / runs[i].interval_us) / 1024.0;
+		printf("%5u us %6u %8u %10.1f %9.1f %9.1f %12u %11u  %s\n", runs[i].interval_us, runs[i].lines,
+			   runs[i].baud, line_kbs, r.rx_kbs, r.tx_kbs, r.rx_overflow, r.tx_dropped, r.ok ? "ok" : "FAILED");
+		check(r.ok, "data in order, overflow accounted for");
+		check(r.tx_dropped == 0, "host stays within TX credit");
+		// Slower than USB, nothing may be lost.
+		if (line_kbs < 0.9 * usb_kbs) {
+			check(r.rx_overflow == 0, "no RX overflow below USB rate");
+		}
+	}
+
+	printf("\nuart_bridge checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Virtual board for testing host tools without hardware, Linux only.
+ *
+ * Registers a HID device through /dev/uhid with the report descriptor of
+ * hid_desc.c, reports are handled by the firmware code in emu_board.c.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o uhid_device -DCORE_M4 -D__USE_LPCOPEN -D__LPC43XX__ \
+ *       -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast \
+ *       -I../lpc_chip_43xx/inc -I../lpc_chip_43xx/inc/usbd_rom \
+ *       -I../lpc_chip_43xx/inc/config_43xx -I../lpc4357_xplorer_plusplus_board/inc \
+ *       -Iinc -Itools tools/uhid_device.c tools/emu_board.c src/hid_generic.c \
+ *       src/hid_desc.c src/hid_rpc.c src/hid_batch.c src/credit_flow.c \
+ *       src/event_capture.c ../lpc_chip_43xx/src/ring_buffer.c
+ * $ sudo ./uhid_device [-s serial] [-i interval_us] [-e sw2_per_second]
+ *
+ * Input reports go out one per interval, 1000 us like the full speed
+ * interrupt endpoint, -i 0 sends them as fast as the host takes them.
+ */
+
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "emu_board.h"
+
+// After chip headers, libc macros clash with register names.
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int uhid_fd = -1;
+static volatile sig_atomic_t quit;
+
+/* Interrupt IN endpoint, one report waits for its interval */
+static uint8_t in_report[HID_REPORT_MAX_SIZE];
+static uint32_t in_length;
+static uint32_t in_interval_us = 1000;
+static uint32_t next_in_us;
+
+static uint32_t sw2_interval_us;
+static uint32_t next_sw2_us;
+
+static bool uhid_send(struct uhid_event *ev) {
+	if (write(uhid_fd, ev, sizeof(*ev)) != sizeof(*ev)) {
+		perror("uhid write");
+		return false;
+	}
+	return true;
+}
+
+static uint8_t report_type(uint8_t rtype) {
+	switch (rtype) {
+	case UHID_FEATURE_REPORT:
+		return HID_REPORT_FEATURE;
+	case UHID_OUTPUT_REPORT:
+		return HID_REPORT_OUTPUT;
+	default:
+		return HID_REPORT_INPUT;
+	}
+}
+
+static bool uhid_create(const char *serial) {
+	const uint8_t *dev = emu_board_device_descriptor();
+	const uint8_t *rd;
+	struct uhid_event ev;
+	uint16_t rd_size;
+
+	rd = emu_board_report_descriptor(&rd_size);
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	emu_board_string(2, (char *) ev.u.create2.name, sizeof(ev.u.create2.name));
+	snprintf((char *) ev.u.create2.phys, sizeof(ev.u.create2.phys), "uhid_device");
+	snprintf((char *) ev.u.create2.uniq, sizeof(ev.u.create2.uniq), "%s", serial);
+	ev.u.create2.rd_size = rd_size;
+	ev.u.create2.bus = BUS_USB;
+	ev.u.create2.vendor = dev[8] | (dev[9] << 8);
+	ev.u.create2.product = dev[10] | (dev[11] << 8);
+	ev.u.create2.version = dev[12] | (dev[13] << 8);
+	memcpy(ev.u.create2.rd_data, rd, rd_size);
+	return uhid_send(&ev);
+}
+
+static void uhid_get_report(const struct uhid_event *req) {
+	struct uhid_event ev;
+	uint16_t length;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_GET_REPORT_REPLY;
+	ev.u.get_report_reply.id = req->u.get_report.id;
+	if (emu_board_get_report(report_type(req->u.get_report.rtype), req->u.get_report.rnum,
+							 ev.u.get_report_reply.data, &length)) {
+		ev.u.get_report_reply.size = length;
+	}
+	else {
+		ev.u.get_report_reply.err = EIO;
+	}
+	uhid_send(&ev);
+}
+
+static void uhid_set_report(const struct uhid_event *req) {
+	struct uhid_event ev;
+	uint8_t data[HID_REPORT_MAX_SIZE];
+	uint16_t length = MIN(req->u.set_report.size, sizeof(data));
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_SET_REPORT_REPLY;
+	ev.u.set_report_reply.id = req->u.set_report.id;
+	memcpy(data, req->u.set_report.data, length);
+	if (!emu_board_set_report(report_type(req->u.set_report.rtype), data, length)) {
+		ev.u.set_report_reply.err = EIO;
+	}
+	uhid_send(&ev);
+}
+
+static bool uhid_event(void) {
+	struct uhid_event ev;
+	ssize_t ret;
+
+	ret = read(uhid_fd, &ev, sizeof(ev));
+	if (ret < 0) {
+		return (errno == EINTR) || (errno == EAGAIN);
+	}
+	if (ret < (ssize_t) sizeof(ev.type)) {
+		return false;
+	}
+
+	switch (ev.type) {
+	case UHID_OPEN:
+		// Host started polling the interrupt IN endpoint.
+		emu_board_connect(true);
+		break;
+	case UHID_CLOSE:
+		emu_board_connect(false);
+		break;
+	case UHID_OUTPUT:
+		if ((ev.u.output.rtype == UHID_OUTPUT_REPORT) && (ev.u.output.size <= HID_REPORT_MAX_SIZE)) {
+			emu_board_out_report(ev.u.output.data, ev.u.output.size);
+		}
+		break;
+	case UHID_GET_REPORT:
+		uhid_get_report(&ev);
+		break;
+	case UHID_SET_REPORT:
+		uhid_set_report(&ev);
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+static int32_t us_until(uint32_t t) {
+	return (int32_t) (t - emu_board_now_us());
+}
+
+/* IN token of the next interval, send the loaded report and take the next. */
+static void in_service(void) {
+	struct uhid_event ev;
+
+	if (in_length > 0) {
+		if (us_until(next_in_us) > 0) {
+			return;
+		}
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		ev.u.input2.size = in_length;
+		memcpy(ev.u.input2.data, in_report, in_length);
+		if (!uhid_send(&ev)) {
+			return;
+		}
+		next_in_us = emu_board_now_us() + in_interval_us;
+	}
+	in_length = emu_board_in_take(in_report);
+}
+
+static void sw2_service(void) {
+	if ((sw2_interval_us > 0) && (us_until(next_sw2_us) <= 0)) {
+		emu_board_sw2_press();
+		next_sw2_us += sw2_interval_us;
+	}
+}
+
+static void stop(int sig) {
+	quit = 1;
+}
+
+int main(int argc, char *argv[]) {
+	const char *serial = "UHID0001";
+	const emu_board_stats_t *stats = emu_board_get_stats();
+	const uint8_t *dev = emu_board_device_descriptor();
+	struct uhid_event ev;
+	struct pollfd pfd;
+	int32_t wait_us;
+	double rate;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:i:e:")) != -1) {
+		switch (opt) {
+		case 's':
+			serial = optarg;
+			break;
+		case 'i':
+			in_interval_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			rate = strtod(optarg, NULL);
+			sw2_interval_us = (rate > 0) ? (uint32_t) (1000000 / rate) : 0;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s serial] [-i interval_us] [-e sw2_per_second]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!emu_board_init()) {
+		return 1;
+	}
+
+	uhid_fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (uhid_fd < 0) {
+		perror("/dev/uhid");
+		return 1;
+	}
+	if (!uhid_create(serial)) {
+		return 1;
+	}
+	printf("Virtual board %04X:%04X serial %s\n",
+		   dev[8] | (dev[9] << 8), dev[10] | (dev[11] << 8), serial);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	next_in_us = emu_board_now_us();
+	next_sw2_us = next_in_us + sw2_interval_us;
+
+	pfd.fd = uhid_fd;
+	pfd.events = POLLIN;
+	while (!quit) {
+		wait_us = -1;
+		if (in_length > 0) {
+			wait_us = MAX(us_until(next_in_us), 0);
+		}
+		if (sw2_interval_us > 0) {
+			wait_us = (wait_us < 0) ? MAX(us_until(next_sw2_us), 0) : MIN(wait_us, MAX(us_until(next_sw2_us), 0));
+		}
+		if (poll(&pfd, 1, (wait_us < 0) ? -1 : (int) ((wait_us + 999) / 1000)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+		if ((pfd.revents & POLLIN) && !uhid_event()) {
+			perror("uhid read");
+			break;
+		}
+		sw2_service();
+		in_service();
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	uhid_send(&ev);
+	close(uhid_fd);
+
+	printf("%u input, %u output, %u get report, %u set report, %u stalled, %u SW2\n",
+		   stats->input, stats->output, stats->get_report, stats->set_report, stats->stalled, stats->sw2);
+	return 0;
+}
@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2019 Ravikiran Bukkasagara, <contact@ravikiranb.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH
+ * THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Host simulation of usb_power.c with event_capture.c as the input report
+ * queue.
+ *
+ * Both run natively in simulated time behind stand-ins for the USB ROM,
+ * the clock control unit and timer_service.c. A bus and host model polls
+ * the interrupt IN endpoint every frame, suspends the bus after a period
+ * without input reports like USB autosuspend, answers remote wakeup with
+ * resume signaling and holds off traffic for the resume recovery time.
+ * Main loop runs after every interrupt and on timer wakeups while a module
+ * requests them, as on the board. Firmware timer starts just below the
+ * 32 bit wrap.
+ *
+ * Checks cover remote wakeup only when enabled, only while suspended, once
+ * per suspend and not before the bus was idle 5 ms, reset ending suspend
+ * and clearing the feature, clock gating, repeated bus callbacks, no input
+ * event lost or reordered across suspends and the latencies the POWER
+ * feature report gives against the ones measured here. Table shows press
+ * to host latency of SW2 like events for an active bus, autosuspend with
+ * remote wakeup and autosuspend with the host resuming on its own.
+ *
+ * Build from lpc4357_usb_custom_hid directory:
+ * $ gcc -O2 -o usb_power_sim -DCORE_M4 -D__USE_LPCOPEN -D__LPC43XX__ \
+ *       -Wno-pointer-to-int-cast -Wno-int-to-pointer-cast \
+ *       -I../lpc_chip_43xx/inc -I../lpc_chip_43xx/inc/usbd_rom \
+ *       -I../lpc_chip_43xx/inc/config_43xx -I../lpc4357_xplorer_plusplus_board/inc \
+ *       -Iinc -Itools tools/usb_power_sim.c src/usb_power.c src/event_capture.c \
+ *       ../lpc_chip_43xx/src/ring_buffer.c
+ * $ ./usb_power_sim [-s seconds] [-i autosuspend_ms] [-r resume_ms] [-c recovery_ms]
+ */
+
+#include "board.h"
+#include "app_usbd_cfg.h"
+#include "hid_generic.h"
+#include "event_capture.h"
+#include "timer_service.h"
+#include "usb_power.h"
+
+// After chip headers, libc macros clash with register names.
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define FRAME_US			1000
+#define SUSPEND_DETECT_US	3000	/* Bus idle until the controller reports suspend */
+#define WAKEUP_IDLE_US		5000	/* Idle the spec requires before remote wakeup */
+#define REPORT_LEN			63		/* Events report without report ID */
+#define MAX_EDGES			65536
+#define NEVER				UINT64_MAX
+
+typedef enum {
+	BUS_ACTIVE,
+	BUS_IDLE,			/* No SOFs, device has not noticed yet */
+	BUS_SUSPENDED,
+	BUS_RESUMING,
+} bus_state_t;
+
+typedef struct {
+	const char *name;
+	bool autosuspend;
+	bool remote_wakeup;
+	uint32_t host_resume_ms;	/* Host resumes on its own after this long, 0 never */
+} scenario_t;
+
+typedef struct {
+	uint32_t events;
+	uint32_t suspends;
+	uint32_t wakeups;
+	double mean_ms;
+	double max_ms;
+	double fw_wakeup_ms;
+	double fw_resume_max_ms;
+	uint32_t timer_wakes;
+} scenario_result_t;
+
+/* Defined by the firmware main file on the board */
+const USBD_API_T *g_pUsbApi;
+
+static uint32_t failures;
+static uint32_t seconds = 600;
+static uint32_t autosuspend_ms = 2000;
+static uint32_t resume_ms = 20;
+static uint32_t recovery_ms = 10;
+
+/* Simulated time, firmware sees it through a 32 bit timer started near the wrap */
+static uint64_t now_us;
+static uint32_t timer_offset;
+
+/* Stand-in timer_service.c and clock control */
+static uint32_t wake_requests;
+static uint64_t next_tick_us;
+static uint32_t timer_wakes;
+static uint32_t clocks_gated;
+static bool usb1_gated;
+
+/* Stand-in HID IN path, hid_generic.c with event_capture as only source */
+static bool in_busy;
+static uint8_t in_report[1 + REPORT_LEN];
+static uint32_t main_passes;
+
+/* Bus and host */
+static const scenario_t *scenario;
+static bus_state_t bus;
+static bool wakeup_enabled;			/* As set by the device through WakeUpCfg */
+static uint64_t idle_since_us;
+static uint64_t bus_event_us;		/* Suspend detect, resume end or host resume, by state */
+static uint64_t traffic_us;			/* First IN token after resume recovery */
+static uint64_t last_input_us;
+static uint64_t wakeup_call_us;
+static uint64_t resume_done_us;
+static uint32_t wakeup_calls;
+static uint32_t wakeup_bad;			/* WakeUp calls the spec does not allow */
+static uint32_t suspends;
+static uint64_t measured_wakeup_us;
+static uint64_t measured_resume_max_us;
+static bool first_in_after_resume;
+
+/* Edges pushed and not yet seen by the host, in push order */
+static uint64_t edge_at[MAX_EDGES];
+static uint8_t edge_kind[MAX_EDGES];
+static uint32_t edges_pushed;
+static uint32_t edges_seen;
+static uint32_t edges_bad;
+static double latency_sum_us;
+static uint64_t latency_max_us;
+
+static void check(bool ok, const char *what) {
+	if (!ok) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+uint32_t timer_service_now_us(void) {
+	return (uint32_t) now_us + timer_offset;
+}
+
+void timer_service_wake_request(bool enable) {
+	if (enable) {
+		if (wake_requests++ == 0) {
+			next_tick_us = now_us + TIMER_SERVICE_WAKE_US;
+		}
+	}
+	else if (wake_requests > 0) {
+		wake_requests--;
+	}
+}
+
+void Chip_Clock_Enable(CHIP_CCU_CLK_T clk) {
+	if (clk == CLK_MX_USB1) {
+		usb1_gated = false;
+	}
+	else if (clocks_gated > 0) {
+		clocks_gated--;
+	}
+}
+
+void Chip_Clock_Disable(CHIP_CCU_CLK_T clk) {
+	if (clk == CLK_MX_USB1) {
+		usb1_gated = true;
+	}
+	else {
+		clocks_gated++;
+	}
+}
+
+bool hid_in_pending(void) {
+	return in_busy;
+}
+
+static void rom_wakeup_cfg(USBD_HANDLE_T hUsb, uint32_t cfg) {
+	wakeup_enabled = cfg != 0;
+}
+
+/* Device drives K, host answers with resume signaling. */
+static void rom_wakeup(USBD_HANDLE_T hUsb) {
+	wakeup_calls++;
+	if ((bus != BUS_SUSPENDED) || !wakeup_enabled || !scenario->remote_wakeup ||
+		(now_us - idle_since_us < WAKEUP_IDLE_US)) {
+		wakeup_bad++;
+		return;
+	}
+	wakeup_call_us = now_us;
+	bus = BUS_RESUMING;
+	bus_event_us = now_us + (uint64_t) resume_ms * 1000;
+}
+
+static const USBD_HW_API_T rom_hw = {
+	.WakeUpCfg = rom_wakeup_cfg,
+	.WakeUp = rom_wakeup,
+};
+
+static const USBD_API_T rom_api = {
+	.hw = &rom_hw,
+};
+
+/* HID_InPump: the next report waits on the endpoint, suspended or not. */
+static void hid_pump(void) {
+	if (in_busy) {
+		return;
+	}
+	memset(in_report, 0, sizeof(in_report));
+	in_report[0] = HID_REPORT_ID_EVENTS;
+	in_busy = event_capture_fill_report(&in_report[1], REPORT_LEN) > 0;
+}
+
+static void main_pass(void) {
+	event_capture_process();
+	hid_pump();
+	usb_power_process();
+	main_passes++;
+}
+
+/* Host reads the primed report, records must match the pushed edges. */
+static void host_take(void) {
+	const uint8_t *rec = &in_report[1 + EVENT_REPORT_HEADER_SIZE];
+	uint32_t count = in_report[1], i, t;
+	uint64_t latency;
+
+	for (i = 0; i < count; i++, rec += EVENT_RECORD_SIZE) {
+		t = rec[1] | (rec[2] << 8) | (rec[3] << 16) | ((uint32_t) rec[4] << 24);
+		if ((edges_seen == edges_pushed) || (t != (uint32_t) edge_at[edges_seen] + timer_offset) ||
+			(rec[0] != edge_kind[edges_seen])) {
+			edges_bad++;
+			continue;
+		}
+		latency = now_us - edge_at[edges_seen];
+		latency_sum_us += latency;
+		latency_max_us = MAX(latency_max_us, latency);
+		edges_seen++;
+	}
+	if (in_report[2] != 0) {
+		edges_bad++;
+	}
+
+	in_busy = false;
+	last_input_us = now_us;
+	if (first_in_after_resume) {
+		first_in_after_resume = false;
+		measured_resume_max_us = MAX(measured_resume_max_us, now_us - resume_done_us);
+	}
+	// USB interrupt: IN done, next report primed right away.
+	usb_power_in_done();
+	hid_pump();
+}
+
+static void push_edge(uint8_t edge) {
+	if (edges_pushed == MAX_EDGES) {
+		return;
+	}
+	edge_at[edges_pushed] = now_us;
+	edge_kind[edges_pushed] = (edge == EVENT_EDGE_RISE) ? EVENT_RECORD_FLAG_RISE : 0;
+	edges_pushed++;
+	event_capture_push(0, edge, timer_service_now_us());
+}
+
+static void bus_start(const scenario_t *s) {
+	scenario = s;
+	now_us = 0;
+	timer_offset = 0xFFFFFFFF - 50000;
+	wake_requests = 0;
+	timer_wakes = 0;
+	clocks_gated = 0;
+	usb1_gated = false;
+	in_busy = false;
+	main_passes = 0;
+	wakeup_enabled = false;
+	wakeup_calls = 0;
+	wakeup_bad = 0;
+	suspends = 0;
+	measured_wakeup_us = 0;
+	measured_resume_max_us = 0;
+	first_in_after_resume = false;
+	edges_pushed = 0;
+	edges_seen = 0;
+	edges_bad = 0;
+	latency_sum_us = 0;
+	latency_max_us = 0;
+
+	event_capture_init();
+	g_pUsbApi = &rom_api;
+	usb_power_init((USBD_HANDLE_T) &rom_api);
+	// Enumeration: configured, host sets DEVICE_REMOTE_WAKEUP if it uses it.
+	usb_power_reset();
+	usb_power_wakeup_cfg(s->remote_wakeup);
+	bus = BUS_ACTIVE;
+	traffic_us = 0;
+	last_input_us = 0;
+}
+
+static void bus_suspend_now(void) {
+	bus = BUS_IDLE;
+	idle_since_us = now_us;
+	bus_event_us = now_us + SUSPEND_DETECT_US;
+}
+
+static void bus_resumed(void) {
+	bus = BUS_ACTIVE;
+	resume_done_us = now_us;
+	if (wakeup_call_us != NEVER) {
+		measured_wakeup_us = now_us - wakeup_call_us;
+	}
+	first_in_after_resume = in_busy;
+	traffic_us = now_us + (uint64_t) recovery_ms * 1000;
+	last_input_us = traffic_us;
+	usb_power_resumed();
+}
+
+/* Runs bus, host and main loop until simulated time reaches end_us. */
+static void run_until(uint64_t end_us) {
+	uint64_t frame_us, next;
+
+	while (now_us < end_us) {
+		frame_us = NEVER;
+		if (bus == BUS_ACTIVE) {
+			frame_us = MAX(traffic_us, ((now_us / FRAME_US) + 1) * FRAME_US);
+		}
+		next = MIN(end_us, frame_us);
+		if (bus != BUS_ACTIVE) {
+			next = MIN(next, bus_event_us);
+		}
+		if (wake_requests > 0) {
+			next = MIN(next, next_tick_us);
+		}
+		now_us = next;
+
+		if ((bus != BUS_ACTIVE) && (now_us == bus_event_us)) {
+			switch (bus) {
+			case BUS_IDLE:
+				bus = BUS_SUSPENDED;
+				suspends++;
+				wakeup_call_us = NEVER;
+				bus_event_us = (scenario->host_resume_ms > 0) ?
+							   idle_since_us + (uint64_t) scenario->host_resume_ms * 1000 : NEVER;
+				usb_power_suspended();
+				check((clocks_gated > 0) && usb_power_is_suspended(), "clocks gated in suspend");
+				break;
+			case BUS_SUSPENDED:
+				// Host resumes on its own.
+				bus = BUS_RESUMING;
+				bus_event_us = now_us + (uint64_t) resume_ms * 1000;
+				break;
+			case BUS_RESUMING:
+				bus_resumed();
+				check((clocks_gated == 0) && !usb_power_is_suspended(), "clocks back after resume");
+				break;
+			default:
+				break;
+			}
+			main_pass();
+		}
+		if ((wake_requests > 0) && (now_us == next_tick_us)) {
+			next_tick_us += TIMER_SERVICE_WAKE_US;
+			timer_wakes++;
+			main_pass();
+		}
+		if ((bus == BUS_ACTIVE) && (now_us == frame_us)) {
+			if (in_busy) {
+				host_take();
+				main_pass();
+			}
+			else if (scenario->autosuspend && (now_us - last_input_us >= (uint64_t) autosuspend_ms * 1000)) {
+				bus_suspend_now();
+			}
+		}
+	}
+}
+
+/* SW2 like press: falling edge, rising edge hold_ms later, main loop after each. */
+static void press(uint64_t at_us, uint32_t hold_ms) {
+	run_until(at_us);
+	push_edge(EVENT_EDGE_FALL);
+	main_pass();
+	run_until(at_us + (uint64_t) hold_ms * 1000);
+	push_edge(EVENT_EDGE_RISE);
+	main_pass();
+}
+
+static void get_power_status(uint8_t *payload, usb_power_stats_t *stats) {
+	const uint8_t *p;
+	uint32_t *counters = (uint32_t *) stats;
+	uint32_t i;
+
+	check(usb_power_get_feature(payload, USB_POWER_STATUS_SIZE) == USB_POWER_STATUS_SIZE, "POWER report size");
+	check(usb_power_get_feature(payload, USB_POWER_STATUS_SIZE - 1) == 0, "short POWER buffer refused");
+	usb_power_get_feature(payload, USB_POWER_STATUS_SIZE);
+	for (i = 0, p = &payload[4]; i < sizeof(*stats) / sizeof(uint32_t); i++, p += 4) {
+		counters[i] = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+	}
+}
+
+static void test_remote_wakeup(void) {
+	static const scenario_t s = { "test", true, true, 0 };
+	uint8_t payload[USB_POWER_STATUS_SIZE];
+	usb_power_stats_t stats;
+	uint64_t suspend_us;
+
+	bus_start(&s);
+	press(100000, 50);
+	run_until(200000);
+	check(edges_seen == 2, "press delivered on active bus");
+
+	// Autosuspend, then a press 1 ms after the device noticed.
+	while ((bus != BUS_SUSPENDED) && (now_us < 10000000)) {
+		run_until(now_us + 100);
+	}
+	check((bus == BUS_SUSPENDED) && (suspends == 1), "bus autosuspended");
+	suspend_us = idle_since_us + SUSPEND_DETECT_US;
+	get_power_status(payload, &stats);
+	check((payload[0] == 1) && (payload[1] == 1) && (stats.suspends == 1), "POWER shows suspended, wakeup on");
+	check(wake_requests == 0, "no timer wakeups while nothing waits");
+
+	press(suspend_us + 1000, 50);
+	check((wakeup_calls == 1) && (wakeup_bad == 0), "one remote wakeup, bus idle long enough");
+	check(wakeup_call_us - suspend_us <= USB_POWER_WAKEUP_DELAY_US + TIMER_SERVICE_WAKE_US,
+		  "wakeup within a timer tick of the idle delay");
+	check(timer_wakes > 0, "timer wakeups until the bus was idle long enough");
+	run_until(now_us + 100000);
+	check((edges_seen == 4) && (edges_bad == 0), "events queued across suspend arrive in order");
+	check(wake_requests == 0, "timer wakeups released after wakeup");
+	check(!usb1_gated, "USB1 clock never gated");
+
+	get_power_status(payload, &stats);
+	check((stats.resumes == 1) && (stats.wakeups == 1), "POWER counts resume and wakeup");
+	check(stats.wakeup_latency_us == measured_wakeup_us, "wakeup latency matches bus");
+	check(stats.resume_latency_us == measured_resume_max_us, "resume to first report latency matches host");
+	check((payload[0] == 0) && (stats.resume_latency_us >= recovery_ms * 1000), "first report after recovery");
+
+	// Callbacks the ROM may repeat count once.
+	usb_power_resumed();
+	bus_suspend_now();
+	run_until(now_us + SUSPEND_DETECT_US);
+	usb_power_suspended();
+	get_power_status(payload, &stats);
+	check((stats.suspends == 2) && (stats.resumes == 1), "repeated callbacks counted once");
+	check(clocks_gated == 3, "clocks gated once per suspend");
+
+	// Reset ends suspend and clears remote wakeup, events wait for the host.
+	usb_power_reset();
+	check((clocks_gated == 0) && !usb_power_is_suspended(), "reset ungates clocks");
+	usb_power_suspended();
+	press(now_us + 10000, 50);
+	run_until(now_us + 100000);
+	check(wakeup_calls == 1, "no wakeup after reset cleared the feature");
+	check(wake_requests == 0, "no timer wakeups without remote wakeup");
+	usb_power_reset();
+}
+
+static void test_no_wakeup(void) {
+	static const scenario_t s = { "test", true, false, 500 };
+	uint8_t payload[USB_POWER_STATUS_SIZE];
+	usb_power_stats_t stats;
+
+	bus_start(&s);
+	run_until((uint64_t) autosuspend_ms * 1000 + 10000);
+	check(bus == BUS_SUSPENDED, "idle bus autosuspended");
+	press(now_us + 1000, 50);
+	run_until(now_us + 600000);
+	check(wakeup_calls == 0, "no remote wakeup unless host enabled it");
+	check((edges_seen == 2) && (edges_bad == 0), "events wait for host resume");
+	get_power_status(payload, &stats);
+	check((payload[1] == 0) && (stats.wakeups == 0) && (stats.resumes == 1), "POWER without wakeups");
+	check(stats.resume_latency_us == measured_resume_max_us, "resume latency matches host");
+}
+
+/* Presses a few seconds apart on average, so the bus suspends between some of them. */
+static void run_scenario(const scenario_t *s, scenario_result_t *r) {
+	uint8_t payload[USB_POWER_STATUS_SIZE];
+	usb_power_stats_t stats;
+	const uint64_t end_us = (uint64_t) seconds * 1000000;
+	uint64_t t = 0;
+	uint32_t hold_ms;
+
+	bus_start(s);
+	for (;;) {
+		// Anywhere in a frame, at least 100 ms after the last release.
+		t += (100 + (uint64_t) (rand() % 6000)) * 1000 + rand() % FRAME_US;
+		if (t >= end_us) {
+			break;
+		}
+		hold_ms = 30 + rand() % 200;
+		press(t, hold_ms);
+		t += (uint64_t) hold_ms * 1000;
+	}
+	run_until(end_us + (uint64_t) s->host_resume_ms * 1000 + 100000);
+
+	get_power_status(payload, &stats);
+	r->events = edges_seen;
+	r->suspends = suspends;
+	r->wakeups = stats.wakeups;
+	r->mean_ms = edges_seen ? latency_sum_us / edges_seen / 1000.0 : 0;
+	r->max_ms = latency_max_us / 1000.0;
+	r->fw_wakeup_ms = stats.wakeup_latency_us / 1000.0;
+	r->fw_resume_max_ms = stats.resume_latency_max_us / 1000.0;
+	r->timer_wakes = timer_wakes;
+
+	check((edges_seen == edges_pushed) && (edges_bad == 0), "every press delivered in order");
+	check(wakeup_bad == 0, "remote wakeup only when allowed");
+	check(stats.resume_latency_max_us == measured_resume_max_us, "POWER resume latency matches host");
+	check(stats.suspends == suspends, "POWER suspends match bus");
+}
+
+int main(int argc, char *argv[]) {
+	static const scenario_t scenarios[] = {
+		{ "active", false, false, 0 },
+		{ "wakeup", true, true, 0 },
+		{ "host 500", true, false, 500 },
+		{ "host 2000", true, false, 2000 },
+	};
+	scenario_result_t r;
+	void *mem;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:i:r:c:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			autosuspend_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			resume_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			recovery_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s seconds] [-i autosuspend_ms] [-r resume_ms] [-c recovery_ms]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// NVIC registers for usb_power_process().
+	mem = mmap((void *) 0xE0000000UL, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem != (void *) 0xE0000000UL) {
+		fprintf(stderr, "can not map system control space\n");
+		return 1;
+	}
+
+	srand(1);
+	test_remote_wakeup();
+	test_no_wakeup();
+
+	printf("%u s of presses, autosuspend after %u ms, resume signaling %u ms, recovery %u ms\n", seconds,
+		   autosuspend_ms, resume_ms, recovery_ms);
+	printf("scenario   events  suspends  wakeups  mean ms   max ms  fw wakeup ms  fw resume max ms  timer wakes\n");
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		run_scenario(&scenarios[i], &r);
+		printf("%-9s %7u %9u %8u %8.2f %8.2f %13.2f %17.2f %12u\n", scenarios[i].name, r.events, r.suspends,
+			   r.wakeups, r.mean_ms, r.max_ms, r.fw_wakeup_ms, r.fw_resume_max_ms, r.timer_wakes);
+	}
+
+	printf("\nusb_power checks: %s\n", failures ? "FAILED" : "passed");
+	return failures ? 1 : 0;
+}
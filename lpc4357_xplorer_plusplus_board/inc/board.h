@@ -32,6 +32,7 @@ extern "C" {
 #endif
 
 #define SDRAM_BASE_ADDR 0x28000000
+#define SDRAM_SIZE (32*1024*1024)
 #define SPIFI_VTABLE 0x14000000
 #define SPIFI_FLASH_SIZE (4*1024*1024)
 
@@ -49,6 +50,8 @@ extern "C" {
 #define SW2_PIN		0
 
 #define SW2 0
+#define SW2_GPIO_PORT	4
+#define SW2_GPIO_PIN	0
 #define BOARD_SW2_GPIO_IRQn PIN_INT0_IRQn
 
 /**
@@ -69,6 +72,19 @@ void board_init_for_exec_from_spifi(void);
 void board_init_gpio(void);
 bool board_sw2_is_pressed(void);
 
+/**
+ * Clocks, GPIO, delay timer and USB1 pins only, for applications which
+ * bring up the rest later with the calls below.
+ */
+void board_init_early(void);
+void board_init_sdram(void);
+
+/**
+ * Resets the Ethernet PHY and starts auto negotiation without waiting for it.
+ * Returns false if the PHY does not answer on MDIO.
+ */
+bool board_init_eth_phy(void);
+
 /**
  * Initializes only the board specific USB1_VBUS pin, reset is done by USB ROM APIs
  */
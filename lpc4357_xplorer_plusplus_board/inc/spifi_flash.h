@@ -28,6 +28,7 @@
 
 int spifi_init(void);
 int spifi_set_mem_mode(void);
+int spifi_set_cmd_mode(void);
 int spifi_erase_chip(void);
 int spifi_erase_sector(unsigned long address);
 int spifi_program_page(unsigned long address, const unsigned char* data, int datalen);
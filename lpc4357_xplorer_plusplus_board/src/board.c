@@ -38,7 +38,7 @@ static gpio_pin_info_t board_leds[] = {
 };
 
 static gpio_pin_info_t board_switches[] = {
-		{4, 0}, //SW2
+		{SW2_GPIO_PORT, SW2_GPIO_PIN}, //SW2
 };
 
 static void init_clock(void);
@@ -68,6 +68,17 @@ void board_init_all(void) {
 	board_init_usb1();
 }
 
+void board_init_early(void) {
+	init_clock();
+	init_gpio();
+	init_delay();
+	board_init_usb1();
+}
+
+void board_init_sdram(void) {
+	init_sdram();
+}
+
 
 static const PINMUX_GRP_T usb1_pinmuxing[] = {
 	{2, 5,  (SCU_MODE_INBUFF_EN | SCU_MODE_INACT | SCU_MODE_FUNC2)},
@@ -495,6 +506,14 @@ static const PINMUX_GRP_T eth_phy_pinmux[] = {
 #define MAX_PHY_STATUS_ATTEMPTS 250
 
 static void init_eth_phy(void) {
+	if (!board_init_eth_phy()) {
+		while(1); //phy read error.
+	}
+
+	eth_auto_negotiate_speed();
+}
+
+bool board_init_eth_phy(void) {
 
 	uint32_t id1, id2;
 
@@ -524,10 +543,12 @@ static void init_eth_phy(void) {
 	id2 = eth_phy_read (PHY_REG_IDR2);
 
 	if (((id1 << 16) | id2) != LAN8720_ID ) {
-		while(1); //phy read error.
+		return false;
 	}
 
-	eth_auto_negotiate_speed();
+	//start auto negotiation, eth_auto_negotiate_speed() waits for it.
+	eth_phy_write(PHY_REG_BMCR, PHY_AUTO_NEG);
+	return true;
 }
 
 static uint16_t eth_phy_read(uint32_t reg) {
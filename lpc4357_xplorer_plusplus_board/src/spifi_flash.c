@@ -112,7 +112,7 @@ int spifi_program_page(unsigned long address, const unsigned char* data, int dat
 {
 	int i;
 	
-	if (address & (265-1))
+	if (address & (256-1))
 		return 1; /* must be 256 byte aligned*/
 	
 	if (datalen > 256)
@@ -187,6 +187,21 @@ int spifi_init(void)
 	return 1;
 }
 
+int spifi_set_cmd_mode(void)
+{
+	LPC_SPIFI->STAT = RESET; /*Reset SPIFI controller only, leaves memory mode */
+	while(LPC_SPIFI->STAT & RESET);
+	
+	/* Flash still expects address without opcode, mode bits other than Ax end High Performance QIO mode */
+	LPC_SPIFI->IDATA = 0xff;
+	LPC_SPIFI->ADDR = 0;
+	LPC_SPIFI->COMMAND = DATALEN(1) | INTLEN(3) | FIELDFORM(0x3) | FRAMEFORM(0x6) | OPCODE(0xeb);
+	LPC_SPIFI->DATA.byte;
+	wait_cmd_over();
+	
+	return 0;
+}
+
 int spifi_set_mem_mode(void)
 {
 #if 1 /*High Performance Quad IO */